@@ -0,0 +1,54 @@
+#ifndef MODUOS_AMD64_FPU_H
+#define MODUOS_AMD64_FPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file fpu.h
+ * @brief Extended FPU state (x87/SSE/AVX) management
+ *
+ * On CPUs with XSAVE every CPU enables the x87, SSE and AVX (and AVX-512,
+ * when present) components in XCR0 and process state is saved with the best
+ * available instruction: XSAVEOPT (skips components that are in their init
+ * state or unmodified since the last XRSTOR from the same buffer), XSAVEC
+ * (compacted, skips init components) or plain XSAVE. Older CPUs fall back to
+ * FXSAVE/FXRSTOR of the 512-byte legacy area.
+ *
+ * The save area size therefore depends on the CPU: allocate process state
+ * with fpu_state_alloc() and copy it with fpu_state_size() bytes.
+ *
+ * Switching is lazy (CR0.TS + #NM, see fpu_lazy.c). A process that takes an
+ * #NM in FPU_EAGER_THRESHOLD consecutive time slices is switched eagerly
+ * instead: its state is restored at switch-in without the trap.
+ */
+
+#define XFEATURE_X87        (1ULL << 0)
+#define XFEATURE_SSE        (1ULL << 1)
+#define XFEATURE_AVX        (1ULL << 2)
+#define XFEATURE_OPMASK     (1ULL << 5)
+#define XFEATURE_ZMM_HI256  (1ULL << 6)
+#define XFEATURE_HI16_ZMM   (1ULL << 7)
+#define XFEATURE_AVX512     (XFEATURE_OPMASK | XFEATURE_ZMM_HI256 | XFEATURE_HI16_ZMM)
+
+#define FPU_EAGER_THRESHOLD 5
+
+struct process;
+
+/* Enable the FPU, SSE and the supported XSAVE components on this CPU. The
+ * first call (BSP) probes CPUID and picks the save method; APs call it from
+ * smp_ap_main() and load the same XCR0. */
+void fpu_init_cpu(void);
+
+/* Bytes needed for one save area (512 without XSAVE). */
+size_t fpu_state_size(void);
+
+/* Allocate a save area holding the initial FPU state (64-byte aligned, as
+ * XSAVE requires). Free with kfree(). */
+void *fpu_state_alloc(void);
+
+/* Write p's live registers back to p->fpu_state if this CPU holds them, so
+ * the buffer can be copied (fork). */
+void fpu_lazy_sync(struct process *p);
+
+#endif
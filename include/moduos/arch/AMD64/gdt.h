@@ -12,6 +12,9 @@
 
 void amd64_gdt_init(void);
 
+/* Build and load the GDT/TSS of one CPU (the BSP is cpu 0). Preserves GS base. */
+void amd64_gdt_init_cpu(uint32_t cpu);
+
 /* Set the kernel stack (RSP0) used when entering ring0 from ring3 (interrupts/syscalls). */
 void amd64_tss_set_rsp0(uint64_t rsp0);
 
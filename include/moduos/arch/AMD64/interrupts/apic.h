@@ -1,12 +1,48 @@
 #pragma once
 #include <stdint.h>
 
+// Fixed LAPIC vectors. They sit inside the range irq_alloc_vector() hands
+// out (irq.h), which skips them.
+#define APIC_TIMER_VECTOR   0x40
+// Fixed IPI that makes a CPU re-evaluate its run queue (see scheduler.c).
+#define APIC_RESCHED_VECTOR 0x41
+// Fixed IPI that makes a CPU flush kernel TLB entries (see smp_tlb_shootdown()).
+#define APIC_TLB_VECTOR     0x42
+
 // Initialize LAPIC using MADT (ACPI). Returns 0 on success.
 int apic_init_from_madt(void);
 
 // Initialize LAPIC timer to generate periodic ticks at the requested Hz.
-// Uses PIT ticks for calibration (PIT must already be running).
+// Calibrated against the ACPI PM timer; becomes the system timebase.
 int apic_timer_init(uint32_t hz);
 
 int apic_is_enabled(void);
 int apic_timer_is_enabled(void);
+// Signal end-of-interrupt to the calling CPU's LAPIC.
+void apic_eoi(void);
+
+// SMP support.
+// Enable the BSP's LAPIC so it can send IPIs and receive MSIs, leaving PIC
+// delivery intact (LINT0 ExtINT). Idempotent.
+int apic_enable_bsp_for_smp(void);
+// Enable the calling AP's LAPIC (LINT0 masked: device IRQs stay on the BSP).
+void apic_ap_init(void);
+// LAPIC ID of the calling CPU.
+uint32_t apic_local_id(void);
+// INIT / STARTUP IPIs for AP bring-up. vector_page is the 4 KiB page the AP starts at.
+int apic_send_init(uint8_t apic_id);
+int apic_send_startup(uint8_t apic_id, uint8_t vector_page);
+// Start the calling CPU's LAPIC timer at hz without making it the system timebase.
+int apic_timer_start(uint32_t hz);
+// Reschedule IPI to the CPU with the given LAPIC ID.
+int apic_send_resched(uint8_t apic_id);
+// TLB shootdown IPI to the CPU with the given LAPIC ID.
+int apic_send_tlb(uint8_t apic_id);
+
+// Tickless operation: put the calling CPU's LAPIC timer in one-shot mode
+// (TSC-deadline when the CPU has it and the TSC is calibrated), then arm it
+// for each next event or stop it while idle.
+int apic_timer_start_oneshot(void);
+int apic_timer_tsc_deadline(void);
+void apic_timer_arm_ns(uint64_t ns);
+void apic_timer_stop(void);
@@ -16,4 +16,22 @@ void irq_dispatch(uint8_t irq);
 // Initialize all IRQs (set in IDT)
 void irq_init(void);
 
+// Dynamically allocated vectors (MSI/MSI-X and other LAPIC-delivered sources).
+// Vectors IRQ_VECTOR_FIRST..IRQ_VECTOR_LAST are handed out one at a time, each
+// to a single handler, so the handler never has to poll to find out whether
+// the interrupt was its own. The fixed LAPIC vectors (timer, reschedule IPI)
+// and the syscall gate in that range are never allocated. The dispatcher
+// sends the LAPIC EOI after the handler returns.
+#define IRQ_VECTOR_FIRST 0x30
+#define IRQ_VECTOR_LAST  0xEF
+
+typedef void (*irq_vector_handler_t)(void *ctx);
+
+// Returns the vector, or -1 if none is free (or there is no LAPIC to deliver it).
+int irq_alloc_vector(irq_vector_handler_t handler, void *ctx, const char *name);
+void irq_free_vector(int vector);
+
+// Called from assembly stubs (vector_isr.asm)
+void irq_vector_dispatch(uint64_t vector);
+
 #endif
@@ -8,7 +8,8 @@ void timer_irq_handler(void);
 uint64_t get_system_ticks(void);
 uint32_t get_pit_frequency(void);
 
-// Called by APIC timer ISR to drive the system timebase.
+// Called by the APIC timer ISR on every CPU: drives that CPU's scheduler tick,
+// and the system timebase (and the timer wheel, see timer_wheel.h) on the BSP.
 void timer_tick_from_apic(void);
 
 // Enable/disable APIC-driven tick (disables PIT tick increment to avoid double counting).
@@ -18,6 +19,28 @@ void timer_set_apic_enabled(int enabled);
 uint64_t ticks_to_ms(uint64_t ticks);
 uint64_t ms_to_ticks(uint64_t ms);
 
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Measure the TSC rate against the ACPI PM timer (or the tick when there is
+// none). Called once on the BSP before the APs start. If the TSC is
+// invariant, get_system_ticks() is derived from it from then on; otherwise
+// the TSC stays uncalibrated and the tick keeps counting.
+void tsc_calibrate(void);
+// Make the BSP tickless (one-shot LAPIC timer, PIT masked). Returns 0 on
+// success; without an invariant TSC or a LAPIC the PIT keeps ticking.
+int timer_enter_nohz(void);
+// Nanoseconds until get_system_ticks() reaches tick (0 if it already has).
+uint64_t timer_ns_until_tick(uint64_t tick);
+// TSC frequency in kHz, 0 if uncalibrated or not invariant.
+uint64_t tsc_khz(void);
+// Nanoseconds for runtime accounting: the calibrated TSC when available,
+// otherwise the tick count. Only deltas taken on one CPU are meaningful.
+uint64_t sched_clock_ns(void);
+
 void usb_tick(void);
 
 #endif
\ No newline at end of file
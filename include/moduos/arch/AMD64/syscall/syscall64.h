@@ -5,4 +5,7 @@
 
 void amd64_syscall_init(void);
 
+/* Program this CPU's SYSCALL MSRs (called by each AP as it comes online). */
+void amd64_syscall_init_cpu(void);
+
 #endif
@@ -5,7 +5,7 @@
 
 /*
  * Current CPU's kernel syscall stack pointer (top of current process kernel stack).
- * In SMP this must become per-CPU (via GS base).
+ * Kept per-CPU in cpu_local_t.syscall_rsp0 and mirrored into that CPU's TSS.
  */
 void amd64_syscall_set_kernel_stack(uint64_t rsp0);
 uint64_t amd64_syscall_get_kernel_stack(void);
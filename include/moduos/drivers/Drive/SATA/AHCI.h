@@ -2,6 +2,8 @@
 #define AHCI_H
 
 #include <stdint.h>
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/process/waitqueue.h"
 
 // AHCI PCI Class codes
 #define AHCI_CLASS_STORAGE      0x01
@@ -21,6 +23,8 @@
 // ATA Commands
 #define ATA_CMD_READ_DMA_EX     0x25
 #define ATA_CMD_WRITE_DMA_EX    0x35
+#define ATA_CMD_READ_FPDMA_QUEUED  0x60  // NCQ read (tag in count[7:3], sectors in feature)
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61  // NCQ write
 #define ATA_CMD_IDENTIFY        0xEC
 #define ATA_CMD_FLUSH_CACHE     0xE7  // 28-bit legacy flush
 #define ATA_CMD_FLUSH_CACHE_EXT 0xEA  // 48-bit extended flush (use with EXT commands)
@@ -51,6 +55,10 @@
 #define HBA_PxSSTS_DET_MASK     0x0F
 #define HBA_PxSSTS_DET_PRESENT  0x03
 
+// Host Capability Bits
+#define HBA_CAP_SNCQ            (1u << 30)  // Supports Native Command Queuing
+#define HBA_CAP_NCS_SHIFT       8           // Number of Command Slots (0-based, 5 bits)
+
 // Host Control Register Bits
 #define HBA_GHC_AHCI_ENABLE     (1 << 31)
 #define HBA_GHC_RESET           (1 << 0)
@@ -218,6 +226,32 @@ typedef struct {
 
 #define AHCI_MAX_PORTS 32
 
+// Largest request ahci_submit() accepts: one PRD per page for a 128-entry PRDT
+// with an unaligned start.
+#define AHCI_MAX_SECTORS_PER_REQUEST 1016u
+
+#define AHCI_REQ_PENDING 1
+
+// Asynchronous read/write request. The caller owns the memory until
+// ahci_wait() returns or the done callback has run.
+typedef struct ahci_request {
+    uint64_t lba;
+    uint32_t count;                 // 1..AHCI_MAX_SECTORS_PER_REQUEST
+    void *buffer;
+    uint8_t write;
+
+    // Optional completion callback, called from the IRQ handler (or from
+    // whoever polls the port) before status is published. Must not sleep
+    // or submit to the same port.
+    void (*done)(struct ahci_request *req, int status);
+    void *ctx;
+
+    // Set by the driver
+    volatile int status;            // AHCI_REQ_PENDING, then 0 or -1
+    uint8_t port;
+    int8_t slot;
+} ahci_request_t;
+
 typedef enum {
     AHCI_DEV_NULL = 0,
     AHCI_DEV_SATA = 1,
@@ -236,10 +270,20 @@ typedef struct {
     hba_cmd_table_t *cmd_tables[32]; // One per command slot
 
     /* IRQ completion tracking */
-    volatile uint32_t last_ci;
+    volatile uint32_t last_ci;      // slots issued and not yet seen complete (CI|SACT)
     volatile uint32_t completed_slots;
     volatile uint32_t error_slots;
 
+    /* Queued submission */
+    spinlock_t lock;                // slot ownership, slot_req[], last_ci
+    uint8_t ncq;                    // READ/WRITE FPDMA QUEUED in use
+    uint8_t queue_depth;            // usable slots 0..queue_depth-1
+    volatile uint8_t draining;      // non-queued command waiting for an idle port
+    volatile uint8_t needs_recovery;// task file error seen; reset before next issue
+    volatile uint32_t busy_slots;   // slots owned by software
+    ahci_request_t *slot_req[32];   // async request per slot (NULL for blocking commands)
+    wait_queue_t done_wq;           // ahci_wait_sleep() callers; woken on every async completion
+
     uint64_t sector_count;
     uint16_t sector_size;
     char model[41];
@@ -273,6 +317,17 @@ int ahci_write_sectors(uint8_t port, uint64_t start_lba, uint32_t count, const v
 int ahci_flush_cache(uint8_t port);
 int ahci_identify_device(uint8_t port);
 
+// Queued operations: submit returns once the command is issued; completion is
+// reported through req->done and req->status. With NCQ up to queue_depth
+// requests run concurrently on a port.
+int ahci_submit(uint8_t port, ahci_request_t *req);
+int ahci_wait(ahci_request_t *req, uint32_t timeout_ms);
+// Same as ahci_wait(), but the calling process sleeps until the completion
+// IRQ instead of spinning. Only for callers that hold no spinlocks; falls
+// back to ahci_wait() when it cannot block or IRQs are not in use.
+int ahci_wait_sleep(ahci_request_t *req, uint32_t timeout_ms);
+void ahci_poll(uint8_t port);
+
 // Device detection
 ahci_device_type_t ahci_check_type(hba_port_t *port);
 int ahci_probe_ports(void);
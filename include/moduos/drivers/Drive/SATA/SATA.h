@@ -112,6 +112,11 @@ int sata_read_sector(uint8_t port, uint64_t lba, void *buffer);
 // Write single sector
 int sata_write_sector(uint8_t port, uint64_t lba, const void *buffer);
 
+// Queue an asynchronous read/write (see ahci_submit/ahci_wait in AHCI.h).
+// Does not change the device status, so it may run alongside blocking I/O.
+struct ahci_request;
+int sata_submit(uint8_t port, struct ahci_request *req);
+
 // ===========================================================================
 // Utility Functions
 // ===========================================================================
@@ -69,6 +69,41 @@ typedef struct {
     uint64_t errors;              // Total errors
 } vdrive_t;
 
+// Block cache counters (per drive). hits/misses/readahead count sectors,
+// evictions/writebacks count 4 KiB cache lines.
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t readahead;           // Sectors fetched beyond what was asked for
+    uint32_t lines;
+    uint32_t ways;
+    uint32_t valid_lines;
+    uint32_t dirty_lines;
+} vdrive_cache_stats_t;
+
+#define VDRIVE_REQ_PENDING 1
+
+// Asynchronous request for vdrive_submit()/vdrive_complete()
+typedef struct vdrive_request {
+    uint64_t lba;
+    uint32_t count;
+    void *buffer;
+    uint8_t write;
+
+    // Optional; may be called from interrupt context before status is set
+    void (*done)(struct vdrive_request *req, int status);
+    void *ctx;
+
+    // Set by vDrive
+    volatile int status;          // VDRIVE_REQ_PENDING, then VDRIVE_SUCCESS or an error code
+    volatile uint32_t pending;    // device commands still outstanding
+    volatile int error;
+    uint8_t vdrive_id;
+    void *priv;                   // per-command state, released by vdrive_complete()
+} vdrive_request_t;
+
 // vDrive subsystem info
 typedef struct {
     uint8_t initialized;
@@ -123,6 +158,15 @@ int vdrive_read(uint8_t vdrive_id, uint64_t lba, uint32_t count, void *buffer);
 // Write sectors (unified interface for both ATA and SATA)
 int vdrive_write(uint8_t vdrive_id, uint64_t lba, uint32_t count, const void *buffer);
 
+// Queue a read/write without waiting for it. SATA disks run it through the
+// AHCI command queue (NCQ when available); other drives complete it before
+// returning. Every accepted request must be reaped with vdrive_complete().
+int vdrive_submit(uint8_t vdrive_id, vdrive_request_t *req);
+
+// Wait for a submitted request, release its resources and return its status.
+// Blocks the calling process on the completion IRQ, so hold no spinlocks.
+int vdrive_complete(vdrive_request_t *req);
+
 // Read single sector
 int vdrive_read_sector(uint8_t vdrive_id, uint64_t lba, void *buffer);
 
@@ -161,9 +205,28 @@ void vdrive_print_table(void);
 // Flush write cache
 int vdrive_flush(uint8_t vdrive_id);
 
-// Invalidate all cache entries for a drive
+// Invalidate all cache entries for a drive (dirty lines are written back first)
 void vdrive_cache_invalidate_all(uint8_t vdrive_id);
 
+// Write back every dirty cache line of a drive (does not flush the device cache)
+int vdrive_cache_sync(uint8_t vdrive_id);
+
+// Get block cache counters for a drive
+int vdrive_cache_get_stats(uint8_t vdrive_id, vdrive_cache_stats_t *out);
+
+// Dump block cache counters of all drives to COM1
+void vdrive_cache_dump_stats(void);
+
+// Start the background writeback thread (needs the scheduler)
+void vdrive_cache_start_writeback(void);
+
+// Run fn(now_ms) on every writeback pass, before aged cache lines are written.
+// Lets file systems push out data they buffer above the cache. Returns 0, or
+// -1 when all VDRIVE_WB_HOOKS slots are taken.
+#define VDRIVE_WB_HOOKS 4
+typedef void (*vdrive_wb_hook_t)(uint64_t now_ms);
+int vdrive_register_writeback_hook(vdrive_wb_hook_t fn);
+
 // Get drive statistics
 void vdrive_get_stats(uint8_t vdrive_id, uint64_t *reads, uint64_t *writes, uint64_t *errors);
 
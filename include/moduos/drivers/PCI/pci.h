@@ -26,9 +26,53 @@
 #define PCI_BAR3            0x1C
 #define PCI_BAR4            0x20
 #define PCI_BAR5            0x24
+#define PCI_CAPABILITY_LIST 0x34
 #define PCI_INTERRUPT_LINE  0x3C
 #define PCI_INTERRUPT_PIN   0x3D
 
+// PCI Status Register Bits
+#define PCI_STATUS_CAP_LIST         0x10
+
+// Capability IDs
+#define PCI_CAP_ID_MSI              0x05
+#define PCI_CAP_ID_MSIX             0x11
+
+// MSI capability (offsets from the capability)
+#define PCI_MSI_FLAGS               0x02
+#define PCI_MSI_FLAGS_ENABLE        0x0001
+#define PCI_MSI_FLAGS_QMASK         0x000E  // log2 of vectors requested
+#define PCI_MSI_FLAGS_QSIZE         0x0070  // log2 of vectors enabled
+#define PCI_MSI_FLAGS_64BIT         0x0080
+#define PCI_MSI_FLAGS_MASKBIT       0x0100
+#define PCI_MSI_ADDRESS_LO          0x04
+#define PCI_MSI_ADDRESS_HI          0x08    // 64-bit only
+#define PCI_MSI_DATA_32             0x08
+#define PCI_MSI_DATA_64             0x0C
+#define PCI_MSI_MASK_32             0x0C
+#define PCI_MSI_MASK_64             0x10
+
+// MSI-X capability (offsets from the capability) and table entries
+#define PCI_MSIX_FLAGS              0x02
+#define PCI_MSIX_FLAGS_QSIZE        0x07FF  // table size - 1
+#define PCI_MSIX_FLAGS_MASKALL      0x4000
+#define PCI_MSIX_FLAGS_ENABLE       0x8000
+#define PCI_MSIX_TABLE              0x04    // BIR in bits 0-2, offset above
+#define PCI_MSIX_PBA                0x08
+#define PCI_MSIX_ENTRY_SIZE         16
+#define PCI_MSIX_ENTRY_ADDR_LO      0x0
+#define PCI_MSIX_ENTRY_ADDR_HI      0x4
+#define PCI_MSIX_ENTRY_DATA         0x8
+#define PCI_MSIX_ENTRY_CTRL         0xC
+#define PCI_MSIX_ENTRY_CTRL_MASKBIT 0x1
+
+// x86 MSI message: fixed delivery, edge, physical destination
+#define PCI_MSI_ADDR_BASE           0xFEE00000u
+
+// pci_device_t.irq_mode
+#define PCI_IRQ_INTX                0
+#define PCI_IRQ_MSI                 1
+#define PCI_IRQ_MSIX                2
+
 // PCI Command Register Bits
 #define PCI_COMMAND_IO              0x01
 #define PCI_COMMAND_MEMORY          0x02
@@ -95,6 +139,14 @@ typedef struct {
     
     uint16_t command;
     uint16_t status;
+
+    // Message-signalled interrupts (filled in by the bus scan; 0 = absent)
+    uint8_t msi_cap;
+    uint8_t msix_cap;
+    uint8_t irq_mode;           // PCI_IRQ_*
+    uint16_t msix_size;         // MSI-X table entries
+    uint16_t msi_vectors;       // vectors currently requested
+    volatile uint32_t *msix_table;  // mapped on first use
 } pci_device_t;
 
 // PCI Driver Structure
@@ -141,6 +193,24 @@ void pci_enable_memory_space(pci_device_t *dev);
 void pci_enable_io_space(pci_device_t *dev);
 void pci_set_command(pci_device_t *dev, uint16_t command);
 
+// Capabilities
+// Returns the config-space offset of the first capability with this ID, or 0.
+uint8_t pci_find_capability(pci_device_t *dev, uint8_t cap_id);
+
+// Message-signalled interrupts. Each vector gets its own IDT entry and
+// handler (irq_alloc_vector()), so no other device's handler runs for it.
+//
+// pci_irq_vector_count() is the number of vectors the device can have: its
+// MSI-X table size, 1 with plain MSI, 0 if it only has INTx.
+// pci_request_irq_vector() allocates a vector for `index` (the MSI-X table
+// entry; must be 0 for MSI), points that entry at the BSP and switches the
+// device over from INTx on first use. Returns the vector or -1 (the caller
+// then keeps using interrupt_line). pci_free_irq_vector() masks the entry and
+// releases its vector; once none is left the device returns to INTx.
+int pci_irq_vector_count(pci_device_t *dev);
+int pci_request_irq_vector(pci_device_t *dev, int index, void (*handler)(void *ctx), void *ctx, const char *name);
+void pci_free_irq_vector(pci_device_t *dev, int index);
+
 // Driver registration
 int pci_register_driver(pci_driver_t *driver);
 void pci_unregister_driver(pci_driver_t *driver);
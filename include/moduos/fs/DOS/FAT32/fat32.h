@@ -30,6 +30,12 @@ typedef struct {
     uint32_t root_cluster;
     uint32_t total_sectors;
     uint32_t first_data_sector;
+
+    /* Streaming seek hint for fat32_read_at(): cluster `seek_cluster` is entry
+     * `seek_index` of the chain starting at `seek_first`. */
+    uint32_t seek_first;
+    uint32_t seek_cluster;
+    uint32_t seek_index;
 } fat32_fs_t;
 
 /* Mount returns a handle (index), or negative on error */
@@ -44,9 +50,19 @@ int fat32_directory_exists(int handle, const char* path);
 int fat32_list_directory(int handle, const char* path);
 int fat32_read_file_by_path(int handle, const char* path, void* out_buf, size_t buf_size, size_t* out_size);
 
-/* Write/overwrite a file by path (existing file only). */
+/* Read up to `size` bytes at `offset` (short only at EOF). fat32_read_at() takes an
+ * already resolved chain so repeated streaming reads skip the directory walk. */
+int fat32_read_file_at_by_path(int handle, const char* path, uint64_t offset, void* out_buf, size_t size, size_t* out_size);
+int fat32_read_at(int handle, uint32_t first_cluster, uint32_t file_size, uint64_t offset,
+                  void* out_buf, size_t size, size_t* out_size);
+
+/* Replace a file's contents by path (created if missing). */
 int fat32_write_file_by_path(int handle, const char* path, const void* data, size_t size);
 
+/* Write `size` bytes at `offset`, growing the file (zero-filling any gap) but
+ * leaving the rest intact. Created if missing. */
+int fat32_write_file_at_by_path(int handle, const char* path, const void* data, size_t size, uint64_t offset);
+
 // Create a directory (LFN supported)
 int fat32_mkdir_by_path(int handle, const char* path);
 int fat32_rmdir_by_path(int handle, const char* path);
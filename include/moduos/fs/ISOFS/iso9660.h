@@ -46,6 +46,11 @@ int iso9660_read_file_by_path(int handle, const char* path, void* out_buf, size_
 int iso9660_list_directory(int handle, const char* path);
 int iso9660_read_extent(int handle, uint32_t extent_lba, uint32_t size_bytes, void* buffer);
 
+/* Read up to `size` bytes at `offset` (short only at EOF). */
+int iso9660_read_file_at_by_path(int handle, const char* path, uint64_t offset, void* out_buf, size_t size, size_t* out_size);
+int iso9660_read_at(int handle, uint32_t extent_lba, uint32_t file_size, uint64_t offset,
+                    void* out_buf, size_t size, size_t* out_size);
+
 /* Find file and get its info (for fs_stat) */
 int iso9660_find_file(int handle, const char* path, iso9660_dir_entry_t* out_entry);
 
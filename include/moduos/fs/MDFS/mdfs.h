@@ -11,6 +11,13 @@
 #define MDFS_INODE_SIZE 256u
 #define MDFS_MAX_DIRECT 12u
 
+// Superblock feature bits. A volume with a bit we don't know is not mounted.
+#define MDFS_FEATURE_EXTENTS   0x00000001u  // regular files may be extent-mapped
+#define MDFS_FEATURE_SUPPORTED (MDFS_FEATURE_EXTENTS)
+
+// Inode flags
+#define MDFS_INODE_FLAG_EXTENTS 0x00000001u // block map is an extent tree, not direct[]
+
 #define MDFS_MAX_NAME 255u
 
 // Directory record format (exFAT-style entry sets): 32-byte records
@@ -21,6 +28,41 @@
 #define MDFS_DIRFLAG_VALID   0x01u
 #define MDFS_DIRFLAG_DELETED 0x02u
 
+// Bytes of the inode after the fixed fields: the block map.
+#define MDFS_INODE_MAP_SIZE (MDFS_INODE_SIZE - 2 - 2 - 4 - 4 - 8 - 4 - 4)
+
+/*
+ * Extent tree (MDFS_INODE_FLAG_EXTENTS). The inode's block map area holds a
+ * header followed by up to MDFS_EXTENT_ROOT_ENTRIES records. At depth 0 they
+ * are extents; at depth 1 they are index records, each naming a leaf block
+ * that holds a header and up to MDFS_EXTENT_LEAF_ENTRIES extents. Extents are
+ * sorted by logical block and never overlap; unmapped file blocks read as zero.
+ */
+#define MDFS_EXTENT_MAGIC 0xE7F1u
+#define MDFS_EXTENT_MAX_DEPTH 1u
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;       // MDFS_EXTENT_MAGIC
+    uint16_t entries;     // records in use
+    uint16_t max;         // records that fit
+    uint16_t depth;       // 0: extents follow, 1: index records follow
+} mdfs_extent_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t lblock;      // first file block
+    uint32_t len;         // blocks
+    uint64_t pblock;      // first disk block
+} mdfs_extent_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t lblock;      // first file block mapped by the leaf
+    uint32_t _rsv;
+    uint64_t leaf;        // leaf block number
+} mdfs_extent_idx_t;
+
+#define MDFS_EXTENT_ROOT_ENTRIES ((MDFS_INODE_MAP_SIZE - sizeof(mdfs_extent_header_t)) / sizeof(mdfs_extent_t))
+#define MDFS_EXTENT_LEAF_ENTRIES ((MDFS_BLOCK_SIZE - sizeof(mdfs_extent_header_t)) / sizeof(mdfs_extent_t))
+
 typedef struct __attribute__((packed)) {
     uint16_t mode;        // 0x4000 dir, 0x8000 file
     uint16_t _pad0;
@@ -29,9 +71,14 @@ typedef struct __attribute__((packed)) {
     uint64_t size_bytes;
     uint32_t link_count;
     uint32_t flags;
-    uint64_t direct[MDFS_MAX_DIRECT];
-    uint64_t indirect1;
-    uint8_t  _pad[MDFS_INODE_SIZE - 2 - 2 - 4 - 4 - 8 - 4 - 4 - (8*MDFS_MAX_DIRECT) - 8];
+    union {
+        struct __attribute__((packed)) {
+            uint64_t direct[MDFS_MAX_DIRECT];
+            uint64_t indirect1;
+            uint8_t  _pad[MDFS_INODE_MAP_SIZE - (8*MDFS_MAX_DIRECT) - 8];
+        };
+        uint8_t extent_root[MDFS_INODE_MAP_SIZE]; // MDFS_INODE_FLAG_EXTENTS
+    };
 } mdfs_inode_t;
 
 // Primary directory record (32 bytes)
@@ -84,9 +131,11 @@ typedef struct __attribute__((packed)) {
     uint32_t features;
     uint32_t checksum; /* CRC32 over superblock with this field zero */
 
-    uint8_t  pad[MDFS_BLOCK_SIZE - (4*4) - (6*8) - (1*8) - 16 - 4 - 4];
+    uint8_t  pad[MDFS_BLOCK_SIZE - (4*4) - (4*8) - (6*8) - (1*8) - 16 - 4 - 4];
 } mdfs_superblock_t;
 
+struct mdfs_alloc_state;
+
 // Minimal mount record (kept inside kernel mount table via handle)
 typedef struct {
     int in_use;
@@ -95,6 +144,7 @@ typedef struct {
     uint32_t sectors;
 
     mdfs_superblock_t sb;
+    struct mdfs_alloc_state *alloc; // in-memory bitmaps (mdfs_alloc.c)
 } mdfs_fs_t;
 
 int mdfs_mount(int vdrive_id, uint32_t start_lba);
@@ -115,7 +165,10 @@ int mdfs_unlink_by_path(int handle, const char *path);
 int mdfs_unmount(int handle);
 int mdfs_flush_inode(int handle, uint32_t inode);
 int mdfs_create_file_trunc(int handle, const char *path, int truncate, uint32_t *out_inode);
+// Positional writes keep the rest of the file; the by-path form creates a missing file.
 int mdfs_write_file_at_by_path(int handle, const char *path, const void *buffer, size_t size, uint64_t offset);
 int mdfs_write_file_at_by_inode(int handle, uint32_t inode, const void *buffer, size_t size, uint64_t offset);
+int mdfs_read_file_at_by_path(int handle, const char *path, uint64_t offset, void *buffer, size_t size, size_t *bytes_read);
+int mdfs_read_file_at_by_inode(int handle, uint32_t inode, uint64_t offset, void *buffer, size_t size, size_t *bytes_read);
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef MODUOS_FS_MDFS_ALLOC_H
+#define MODUOS_FS_MDFS_ALLOC_H
+
+#include "moduos/fs/MDFS/mdfs.h"
+
+// Blocks tracked by one block of the block bitmap (one allocation group).
+#define MDFS_BITS_PER_BITMAP_BLOCK (MDFS_BLOCK_SIZE * 8u)
+
+// Load the bitmaps into fs->alloc (mount, mkfs) / write back and drop them.
+int mdfs_alloc_init(mdfs_fs_t *fs);
+void mdfs_alloc_release(mdfs_fs_t *fs);
+
+// Write dirty bitmap blocks back; called at the end of each modifying operation.
+int mdfs_alloc_flush(const mdfs_fs_t *fs);
+
+// Current free block / inode counts (for the superblock).
+void mdfs_alloc_counts(const mdfs_fs_t *fs, uint64_t *free_blocks, uint64_t *free_inodes);
+
+/* Allocate a run of up to `want` contiguous data blocks, preferably starting
+ * at `goal`. Returns 0 with the run in *out_start / *out_count, or <0 when
+ * the volume is full. */
+int mdfs_alloc_blocks(const mdfs_fs_t *fs, uint64_t goal, uint64_t want, uint64_t *out_start, uint64_t *out_count);
+
+// Return [start, start + count) to the block bitmap.
+int mdfs_free_blocks(const mdfs_fs_t *fs, uint64_t start, uint64_t count);
+
+int mdfs_alloc_inode(const mdfs_fs_t *fs, uint32_t *out_ino);
+int mdfs_free_inode(const mdfs_fs_t *fs, uint32_t ino);
+
+#endif
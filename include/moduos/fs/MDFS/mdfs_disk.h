@@ -6,6 +6,11 @@
 int mdfs_disk_read_block(int vdrive_id, uint32_t start_lba, uint64_t block_no, void *out);
 int mdfs_disk_write_block(int vdrive_id, uint32_t start_lba, uint64_t block_no, const void *in);
 
+// `count` consecutive blocks in one request (at most MDFS_MAX_IO_BLOCKS).
+#define MDFS_MAX_IO_BLOCKS 1024u /* 4 MiB */
+int mdfs_disk_read_blocks(int vdrive_id, uint32_t start_lba, uint64_t block_no, uint32_t count, void *out);
+int mdfs_disk_write_blocks(int vdrive_id, uint32_t start_lba, uint64_t block_no, uint32_t count, const void *in);
+
 int mdfs_disk_read_inode(int vdrive_id, uint32_t start_lba, const mdfs_superblock_t *sb, uint32_t ino, mdfs_inode_t *out);
 int mdfs_disk_write_inode(int vdrive_id, uint32_t start_lba, const mdfs_superblock_t *sb, uint32_t ino, const mdfs_inode_t *in);
 
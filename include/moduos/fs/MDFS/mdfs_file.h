@@ -0,0 +1,39 @@
+#ifndef MODUOS_FS_MDFS_FILE_H
+#define MODUOS_FS_MDFS_FILE_H
+
+#include "moduos/fs/MDFS/mdfs.h"
+
+// Regular file data, for both block map formats: direct[] (v2 volumes made
+// before extents) and extent trees (MDFS_INODE_FLAG_EXTENTS).
+
+// Fresh regular-file inode; extent-mapped when the volume has MDFS_FEATURE_EXTENTS.
+void mdfs_inode_init_file(const mdfs_fs_t *fs, mdfs_inode_t *ino);
+
+// Read up to `size` bytes at `offset`, clipped to EOF. Holes read as zero.
+int mdfs_inode_read(const mdfs_fs_t *fs, const mdfs_inode_t *ino, uint64_t offset, void *buffer, size_t size, size_t *bytes_read);
+
+/* Write at `offset`, allocating contiguous runs for unmapped blocks and
+ * growing size_bytes. The inode is written back, also after a short write.
+ * Returns -10 past the direct blocks of a non-extent inode. */
+int mdfs_inode_write(const mdfs_fs_t *fs, uint32_t ino_n, mdfs_inode_t *ino, const void *buffer, size_t size, uint64_t offset);
+
+// Set the size, freeing the blocks past it, and write the inode back.
+int mdfs_inode_truncate(const mdfs_fs_t *fs, uint32_t ino_n, mdfs_inode_t *ino, uint64_t new_size);
+
+/* Delayed allocation: appends to an extent-mapped file are buffered and get
+ * their blocks only when the buffer is flushed. Anything else is written
+ * through (after flushing the file's buffer). */
+int mdfs_inode_write_delayed(const mdfs_fs_t *fs, uint32_t ino_n, const void *buffer, size_t size, uint64_t offset);
+
+// Write out the buffered appends of one file (ino_n 0: every file of the mount).
+// A buffer that fails to write stays buffered, and the error is returned.
+int mdfs_delalloc_flush(const mdfs_fs_t *fs, uint32_t ino_n);
+
+// vDrive writeback hook: write out buffered appends older than a second.
+void mdfs_delalloc_writeback(uint64_t now_ms);
+
+// Forget a file's buffered appends (its data is being replaced or removed;
+// ino_n 0: every file of the mount).
+void mdfs_delalloc_drop(const mdfs_fs_t *fs, uint32_t ino_n);
+
+#endif
@@ -12,7 +12,8 @@ typedef int64_t ssize_t;
 #define STDOUT_FILENO 1
 #define STDERR_FILENO 2
 
-/* Maximum number of file descriptors per process */
+/* Maximum number of file descriptors per process (PROCESS_MAX_FDS).
+ * Open files themselves are heap objects; there is no system-wide limit. */
 #define MAX_FDS 256
 
 /* File descriptor flags */
@@ -20,6 +21,7 @@ typedef int64_t ssize_t;
 #define FD_FLAG_WRITE  0x02
 #define FD_FLAG_APPEND 0x04
 #define FD_FLAG_CREATE 0x08
+#define FD_FLAG_NONBLOCK 0x10
 
 /* Open flags (similar to POSIX) */
 #define O_RDONLY  0x0000
@@ -30,6 +32,21 @@ typedef int64_t ssize_t;
 #define O_TRUNC    0x0200
 #define O_NONBLOCK 0x0800
 
+/* fcntl() commands (Linux numbering) */
+#define F_DUPFD       0
+#define F_GETFD       1
+#define F_SETFD       2
+#define F_GETFL       3
+#define F_SETFL       4
+#define F_SETPIPE_SZ  1031
+#define F_GETPIPE_SZ  1032
+
+/* Pipe capacity (bytes). Sizes set with F_SETPIPE_SZ round up to a power of two. */
+#define PIPE_DEF_SIZE    (64u * 1024u)
+#define PIPE_MIN_SIZE    4096u
+#define PIPE_MAX_SIZE    (1024u * 1024u)
+#define PIPE_ATOMIC_SIZE 4096u   /* PIPE_BUF: writes up to this size are not interleaved */
+
 /* Seek positions */
 #define SEEK_SET 0
 #define SEEK_CUR 1
@@ -41,6 +58,10 @@ typedef int64_t ssize_t;
 #define FD_TYPE_DEVFS  2
 #define FD_TYPE_PIPE   3
 #define FD_TYPE_USERFS 4
+#define FD_TYPE_CONSOLE 5
+
+/* Open file description, shared by dup()/dup2()/fork() descriptors. */
+typedef struct open_file open_file_t;
 
 /* File descriptor structure */
 typedef struct {
@@ -69,6 +90,12 @@ typedef struct {
 /* Pipe fd operations */
 int fd_pipe(int fds[2]);
 
+/**
+ * fcntl(): F_DUPFD, F_GETFL/F_SETFL (O_NONBLOCK, O_APPEND), F_GETPIPE_SZ/F_SETPIPE_SZ
+ * @return: Command result (>=0) or -errno
+ */
+int fd_fcntl(int fd, int cmd, long arg);
+
 /**
  * Initialize file descriptor table
  * Called once during kernel init
@@ -153,7 +180,8 @@ int fd_dup(int oldfd);
 int fd_dup2(int oldfd, int newfd);
 
 /**
- * Clone all open FDs from parent into child (used by fork).
+ * Give the child the parent's descriptor table (used by fork).
+ * Slots keep their numbers and share the parent's open files.
  */
 void fd_clone_for_fork(int parent_pid, int child_pid);
 
@@ -163,6 +191,25 @@ void fd_clone_for_fork(int parent_pid, int child_pid);
  */
 void fd_close_all(int pid);
 
+/**
+ * Install an open file at a fixed slot of another process (takes a reference).
+ * @return: 0 on success, -1 on bad pid/fd, -2 if the slot is occupied
+ */
+int fd_install_at(uint32_t pid, int fd, open_file_t *f);
+
+/**
+ * Close slot fd of process pid
+ * @return: 0 on success, -1 on error
+ */
+int fd_close_in(uint32_t pid, int fd);
+
+/**
+ * Look up fd in process pid (0 for current) and take a reference on it.
+ * @return: Open file, or NULL. Release with fd_file_put().
+ */
+open_file_t *fd_file_get(uint32_t pid, int fd);
+void fd_file_put(open_file_t *f);
+
 /**
  * Get current position in file
  * @param fd: File descriptor number
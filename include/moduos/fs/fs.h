@@ -128,6 +128,16 @@ typedef struct fs_ext_driver_ops {
     fs_dir_t* (*opendir)(fs_mount_t *mount, const char *path);
     int (*readdir)(fs_dir_t *dir, fs_dirent_t *entry);
     void (*closedir)(fs_dir_t *dir);
+
+    // Optional offset read: up to `size` bytes starting at `offset`; *bytes_read is
+    // short only at EOF. If NULL, fs_read_file_at() falls back to read_file() through
+    // a whole-file bounce buffer, so streaming large files needs this hook.
+    int (*read_at)(fs_mount_t *mount, const char *path, uint64_t offset, void *buffer, size_t size, size_t *bytes_read);
+
+    // Optional offset write: store `size` bytes at `offset`, growing the file (the gap
+    // past the old end reads as zeros) without touching the rest; creates a missing
+    // file. If NULL, fs_write_file_at() only accepts offset 0 (via write_file()).
+    int (*write_at)(fs_mount_t *mount, const char *path, uint64_t offset, const void *buffer, size_t size);
 } fs_ext_driver_ops_t;
 
 // Register external filesystem driver (string-based). Built-ins always win; external drivers are tried only after.
@@ -201,6 +211,21 @@ int fs_get_mount_count(void);
 int fs_read_file(fs_mount_t* mount, const char* path, void* buffer, 
                  size_t buffer_size, size_t* bytes_read);
 
+/**
+ * Read part of a file
+ * @param mount: Mount handle (from fs_get_mount)
+ * @param path: File path
+ * @param info: Optional result of an earlier fs_stat() on path; lets FAT32/ISO9660
+ *              read from the cached location instead of walking the path again
+ * @param offset: Byte offset to start at
+ * @param buffer: Output buffer (at least size bytes)
+ * @param size: Number of bytes wanted
+ * @param bytes_read: Optional - bytes actually read (short only at EOF)
+ * @return: 0 on success, negative on error
+ */
+int fs_read_file_at(fs_mount_t* mount, const char* path, const fs_file_info_t* info,
+                    uint64_t offset, void* buffer, size_t size, size_t* bytes_read);
+
 /* FS tracing (timing) */
 void fs_set_trace(int enabled);
 int fs_get_trace(void);
@@ -217,7 +242,8 @@ int fs_get_trace(void);
  */
 int fs_write_file(fs_mount_t* mount, const char* path, const void* buffer, size_t size);
 
-// Offset-aware write (used by FD layer for sequential writes). Returns 0 on success.
+// Offset-aware write (used by the FD layer): writes `size` bytes at `offset` and keeps
+// the rest of the file. Returns 0 on success.
 int fs_write_file_at(fs_mount_t* mount, const char* path, const void* buffer, size_t size, size_t offset);
 
 
@@ -0,0 +1,57 @@
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "moduos/fs/fs.h"
+
+/* Page cache for streaming file reads.
+ * File contents are cached in PCACHE_PAGE_SIZE pages keyed by (mount, path, page).
+ * Every FD open on the same file shares one pcache_file_t, so the memory used for
+ * regular-file reads is bounded by the cache size rather than by file size.
+ */
+
+#define PCACHE_PAGE_SIZE     4096u
+#define PCACHE_BYTES         (4u * 1024u * 1024u)  /* preferred size; halved on OOM */
+#define PCACHE_MIN_BYTES     (256u * 1024u)
+#define PCACHE_MAX_FILES     64
+#define PCACHE_RA_MIN_PAGES  4u                    /* fill size after a random access */
+#define PCACHE_RA_MAX_PAGES  32u                   /* 128 KiB sequential read-ahead */
+
+typedef struct pcache_file pcache_file_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t fills;          /* fs_read_file_at() calls */
+    uint64_t readahead;      /* pages brought in beyond the one that missed */
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint32_t pages;          /* cache capacity in pages */
+    uint32_t pages_used;
+    uint32_t files;          /* files with an open reference or resident pages */
+} pcache_stats_t;
+
+/* Get (or create) the shared cache object for a file. `info` is a fresh fs_stat()
+ * of path; if it no longer matches what was cached, the old pages are dropped.
+ * Returns a referenced object, or NULL when the cache cannot be set up. */
+pcache_file_t *pcache_open(fs_mount_t *mount, const char *path, const fs_file_info_t *info);
+
+/* Reference counting (dup/fork take a reference, close drops it). */
+void pcache_get(pcache_file_t *f);
+void pcache_put(pcache_file_t *f);
+
+/* Read up to len bytes at offset. *out is short only at EOF or on error. */
+int pcache_read(pcache_file_t *f, uint64_t offset, void *buf, size_t len, size_t *out);
+
+/* Size of the file as last seen by the cache. */
+uint64_t pcache_file_size(pcache_file_t *f);
+
+/* Drop cached pages for (mount, path), or for the whole mount when path is NULL.
+ * Called by the FS layer after writes, unlink and unmount. */
+void pcache_invalidate(fs_mount_t *mount, const char *path);
+
+void pcache_get_stats(pcache_stats_t *out);
+void pcache_dump_stats(void);
+
+#endif
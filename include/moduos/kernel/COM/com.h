@@ -120,6 +120,16 @@ int com_write_string(uint16_t port, const char* str);
  */
 int com_write(uint16_t port, const uint8_t* data, uint32_t len);
 
+/**
+ * Write a buffer straight to the UART, bypassing the kernel log ring that
+ * COM1 output otherwise goes through once it is running (see klog.h)
+ * @param port COM port base address
+ * @param data Buffer to send
+ * @param len Length of buffer
+ * @return Number of bytes written, -1 on failure
+ */
+int com_write_direct(uint16_t port, const uint8_t* data, uint32_t len);
+
 /**
  * Read a single byte from a COM port (non-blocking)
  * @param port COM port base address
@@ -206,4 +216,15 @@ int com_write_hex64(uint16_t port, uint64_t value);
  */
 int com_printf(uint16_t port, const char* format, ...);
 
+/**
+ * Format into a buffer, with the same conversions as com_printf()
+ * (%d %i %u %x %X %p %s %c, flags '-' '0', width, precision, l/ll/z)
+ * @param buf Destination, always NUL-terminated
+ * @param size Size of buf
+ * @param format Format string
+ * @param args Arguments
+ * @return Length the full output would have, -1 on bad arguments
+ */
+int com_vsnprintf(char *buf, uint32_t size, const char *format, __builtin_va_list args);
+
 #endif /* COM_H */
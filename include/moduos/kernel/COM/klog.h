@@ -0,0 +1,61 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+
+/*
+ * Kernel log ring
+ *
+ * Once klog_start() has run, COM1 output (com_write_string, com_printf, ...)
+ * no longer polls the UART in the caller. Each CPU assembles its output into
+ * lines and publishes them, with a severity, a timestamp and a global
+ * sequence number, into its own single-producer ring; nothing is locked on
+ * the write side. The "klogd" kernel thread merges the rings in sequence
+ * order, writes them to COM1 and keeps a history that user space can tail
+ * through $/dev/kmsg, one record per line:
+ *
+ *     <level>,<seq>,<usec>,<cpu>;<text>\n
+ *
+ * A line is published when its newline arrives (or when it fills the line
+ * buffer). If a ring is full the line is dropped and counted; klogd reports
+ * the count. Before klog_start(), and after klog_console_sync(), output goes
+ * straight to the UART as before.
+ */
+
+/* Severities (syslog numbering). Lines written through com_* take theirs
+ * from the COM_LOG_* tag they start with ("[WARN] ", "[ERROR] ", ...). */
+#define KLOG_EMERG   0
+#define KLOG_ALERT   1
+#define KLOG_CRIT    2
+#define KLOG_ERR     3
+#define KLOG_WARNING 4
+#define KLOG_NOTICE  5
+#define KLOG_INFO    6
+#define KLOG_DEBUG   7
+
+/* Set up this CPU's ring. The BSP's is static; smp_init_aps() calls this for
+ * each AP before starting it. CPUs without a ring write synchronously. */
+int klog_cpu_init(uint32_t cpu);
+
+/* Register $/dev/kmsg, start klogd and switch COM1 output to the rings. */
+void klog_start(void);
+
+/* Whether COM1 output currently goes through the rings. */
+int klog_deferred(void);
+
+/* Append raw COM1 output to this CPU's line buffer. Returns -1 if the caller
+ * has to write it to the UART itself (log not started or no ring). */
+int klog_emit(const char *data, uint32_t len);
+
+/* Log one message at an explicit level. */
+void klog_printf(int level, const char *fmt, ...);
+
+/* Push everything published so far to COM1 (klogd's job; callable from any
+ * context that may write the UART). */
+void klog_drain(void);
+
+/* Fatal paths (faults, panic): flush the rings and go back to synchronous
+ * output for good, so nothing a dying kernel says stays buffered. */
+void klog_console_sync(void);
+
+#endif /* KLOG_H */
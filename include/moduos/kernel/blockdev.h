@@ -23,10 +23,34 @@ typedef struct {
     char model[64];
 } blockdev_info_t;
 
+#define BLOCKDEV_REQ_PENDING 1
+
+// Asynchronous request. Owned by the caller until blockdev_complete() returns.
+typedef struct blockdev_request {
+    uint64_t lba;
+    uint32_t count;
+    void *buf;
+    size_t buf_sz;
+    uint8_t write;
+
+    // Optional; may run in interrupt context. Must not submit or complete requests.
+    void (*done)(struct blockdev_request *req, int status);
+    void *ctx;
+
+    volatile int status;          // BLOCKDEV_REQ_PENDING until the I/O has finished
+    void *driver_data;            // owned by the driver between submit and complete
+} blockdev_request_t;
+
 typedef struct {
     int (*get_info)(void *ctx, blockdev_info_t *out);
     int (*read)(void *ctx, uint64_t lba, uint32_t count, void *buf, size_t buf_sz);
     int (*write)(void *ctx, uint64_t lba, uint32_t count, const void *buf, size_t buf_sz);
+
+    // Optional async pair: submit() starts the I/O and returns 0 once it is
+    // queued; complete() waits for it, releases driver state and returns the
+    // request status. Devices without them are driven synchronously.
+    int (*submit)(void *ctx, blockdev_request_t *req);
+    int (*complete)(void *ctx, blockdev_request_t *req);
 } blockdev_ops_t;
 
 // Register a block device and return an opaque handle.
@@ -42,6 +66,11 @@ int blockdev_get_info(blockdev_handle_t h, blockdev_info_t *out);
 int blockdev_read(blockdev_handle_t h, uint64_t lba, uint32_t count, void *buf, size_t buf_sz);
 int blockdev_write(blockdev_handle_t h, uint64_t lba, uint32_t count, const void *buf, size_t buf_sz);
 
+// Start an asynchronous read/write. On 0 the request must later be passed to
+// blockdev_complete(); on error it was never queued.
+int blockdev_submit(blockdev_handle_t h, blockdev_request_t *req);
+int blockdev_complete(blockdev_handle_t h, blockdev_request_t *req);
+
 #ifdef __cplusplus
 }
 #endif
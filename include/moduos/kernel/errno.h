@@ -24,5 +24,7 @@
 #define ENOTDIR 20
 #define EISDIR  21
 #define EINVAL  22
+#define EMFILE  24
 #define EROFS   30
+#define EPIPE   32
 #define ENOSYS  38
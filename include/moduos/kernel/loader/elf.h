@@ -116,6 +116,15 @@ int elf_load_with_args(const void *elf_data, size_t size, uint64_t *entry_point,
  */
 int elf_get_interp_path(const void *elf_data, size_t size, char *out, size_t out_size);
 
+/* Demand-paged load: register each PT_LOAD segment of img as a file-backed
+ * VMA of p (see vma.h) without reading or allocating any of it; pages are
+ * filled by the page-fault handler on first touch. Returns the entry point
+ * and the covered image range like elf_load_with_args(). */
+struct process;
+struct exec_image;
+int elf_map_image(struct process *p, struct exec_image *img, uint64_t *entry_point,
+                  uint64_t *out_image_base, uint64_t *out_image_end);
+
 int elf_load_process(const char *path, char *const argv[]);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef EXEC_IMAGE_H
+#define EXEC_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "moduos/fs/fs.h"
+
+/*
+ * Executable images for demand-paged exec.
+ *
+ * One exec_image_t per executable file, shared by every process mapping it.
+ * It reads file contents through the page cache and keeps the physical
+ * frames of read-only pages that have been faulted in, indexed by file page,
+ * so the next process to touch the same text page maps the same frame.
+ *
+ * Images stay cached after their last user exits so relaunching a program
+ * finds its text already resident; the least recently used unreferenced
+ * image is recycled when the table is full. Writing, unlinking or unmounting
+ * the file (pcache_invalidate()) retires the image: running processes keep
+ * the frames they mapped, new execs load the new contents.
+ */
+
+#define EXEC_IMAGE_MAX 16
+
+typedef struct exec_image exec_image_t;
+
+/* Get (or create) the image for a file; `info` is a fresh fs_stat() of path.
+ * Returns a referenced image or NULL. */
+exec_image_t *exec_image_open(fs_mount_t *mount, const char *path, const fs_file_info_t *info);
+
+void exec_image_get(exec_image_t *img);
+void exec_image_put(exec_image_t *img);
+
+uint64_t exec_image_size(exec_image_t *img);
+
+/* Read file bytes. *out is short only at EOF or on error. */
+int exec_image_read(exec_image_t *img, uint64_t offset, void *buf, size_t len, size_t *out);
+
+/* Shared frame of file page `index`, with a reference taken for the caller's
+ * mapping, or 0 if it has not been loaded yet. */
+uint64_t exec_image_frame(exec_image_t *img, uint64_t index);
+
+/* Offer a frame holding file page `index` (zero padded past EOF) for sharing.
+ * The image takes its own reference if the slot was still empty. */
+void exec_image_set_frame(exec_image_t *img, uint64_t index, uint64_t phys);
+
+/* Retire images of (mount, path), or of the whole mount when path is NULL. */
+void exec_image_invalidate(fs_mount_t *mount, const char *path);
+
+#endif /* EXEC_IMAGE_H */
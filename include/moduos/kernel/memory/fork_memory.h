@@ -4,13 +4,16 @@
 #include <stdint.h>
 
 /*
- * Copy all user-space memory from source CR3 to destination CR3.
- * Used by fork() to duplicate parent's address space.
+ * Share all user-space memory of source CR3 with destination CR3 copy-on-write.
+ * Used by fork() to duplicate parent's address space; writable pages become
+ * read-only + PFLAG_COW in both and are copied on the first write fault.
  * 
  * Parameters:
  *   src_cr3 - Physical address of source page directory
  *   dst_cr3 - Physical address of destination page directory
+ *
+ * Returns 0 on success, -1 on failure (destination user mappings are released).
  */
-void copy_user_memory(uint64_t src_cr3, uint64_t dst_cr3);
+int copy_user_memory(uint64_t src_cr3, uint64_t dst_cr3);
 
 #endif /* FORK_MEMORY_H */
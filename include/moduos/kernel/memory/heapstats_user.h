@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One entry per online CPU, returned by SYS_HEAPSTATS. */
+typedef struct md_heapstats_cpu_u {
+    uint32_t cpu;
+    uint32_t reserved;
+    uint64_t alloc_hits;      // served from the local magazine
+    uint64_t alloc_misses;    // magazine empty -> batched refill from SLAB
+    uint64_t frees;           // objects returned to the local magazine
+    uint64_t drains;          // magazine full -> batched drain to SLAB
+    uint64_t cached_objects;  // objects currently held in magazines
+    uint64_t cached_bytes;
+} md_heapstats_cpu_u;
+
+#ifdef __cplusplus
+}
+#endif
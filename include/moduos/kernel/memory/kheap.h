@@ -2,6 +2,11 @@
 #define MODUOS_KERNEL_MEMORY_KHEAP_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+/* Kernel heap virtual arena */
+#define KHEAP_START 0xFFFF800000000000ULL
+#define KHEAP_MAX   (KHEAP_START + (32 * 1024 * 1024ULL)) /* 32 MiB heap */
 
 /**
  * @brief Initialize kernel heap (MUST be called during boot)
@@ -26,4 +31,17 @@ void *kmalloc_aligned(size_t size, size_t alignment);
  */
 void kfree(void *ptr);
 
+/**
+ * @brief Allocate whole, physically contiguous heap pages (no header)
+ *
+ * Backing store for the SLAB allocator. Returns a page-aligned virtual
+ * address inside [KHEAP_START, KHEAP_MAX), or NULL on failure.
+ */
+void *kheap_alloc_pages(size_t pages);
+
+/**
+ * @brief Release pages obtained from kheap_alloc_pages()
+ */
+void kheap_free_pages(void *virt, size_t pages);
+
 #endif /* MODUOS_KERNEL_MEMORY_KHEAP_H */
@@ -0,0 +1,38 @@
+#ifndef MEMOPS_H
+#define MEMOPS_H
+
+#include <stddef.h>
+
+/*
+ * memcpy/memset/memmove/memcmp back-ends (declared in string.h).
+ *
+ * Small and medium copies use `rep movsb/stosb` when the CPU advertises
+ * ERMS or FSRM, otherwise a 64-bit word loop. Copies/fills of at least
+ * MEMOPS_NT_THRESHOLD bytes stream through non-temporal `movnti` stores so
+ * multi-megabyte moves such as framebuffer scrolls do not flush the whole
+ * cache. No path touches SSE/AVX registers: memcpy/memset run in fault and
+ * IRQ context with the user's FPU state live (lazy FPU switching).
+ */
+#define MEMOPS_NT_THRESHOLD (256 * 1024)
+
+#ifndef MEMOPS_BOOT_BENCH
+#define MEMOPS_BOOT_BENCH 1
+#endif
+
+/**
+ * @brief Probe CPUID and select the memcpy/memset variants
+ *
+ * Safe to call before the heap exists; until it runs every routine uses the
+ * portable word-at-a-time path.
+ */
+void memops_init(void);
+
+/**
+ * @brief Time every available variant and log GB/s to COM1
+ *
+ * Needs the kernel heap and a running timer tick. No-op when
+ * MEMOPS_BOOT_BENCH is 0.
+ */
+void memops_boot_benchmark(void);
+
+#endif /* MEMOPS_H */
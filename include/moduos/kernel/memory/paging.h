@@ -10,8 +10,26 @@
 #define PFLAG_PWT 0x8
 #define PFLAG_PCD 0x10
 
-/* Software-only flag stored in available PTE bits (bit 9). */
+/* Software-only flags stored in available PTE bits (9..11). */
 #define PFLAG_COW 0x200
+#define PFLAG_SHARED 0x400    /* MAP_SHARED frame: fork() shares it writable, no COW */
+#define PFLAG_NOACCESS 0x800  /* PROT_NONE: frame kept, USER cleared until mprotect() */
+
+/* PS bit: set in what paging_get_pte() returns when virt lies in a 2 MiB page. */
+#define PFLAG_HUGE 0x80
+#define PAGING_2M_SIZE 0x200000ULL
+
+/* Page-table pages must be allocated from memory that is *already* accessible
+ * when we memset() them. During early identity mapping we cannot assume all <512MB is
+ * already mapped, so keep this very low.
+ */
+#ifndef PAGING_PT_ALLOC_LIMIT
+#define PAGING_PT_ALLOC_LIMIT 0x04000000ULL /* 64MB */
+#endif
+
+/* Physical addresses below this are reachable through phys_to_virt_kernel()
+ * (boot sets up a 1GiB physmap window). */
+#define PAGING_PHYSMAP_LIMIT 0x40000000ULL
 
 /* amd64 PTE NX bit is handled elsewhere; for now we only need the USER bit */
 
@@ -21,11 +39,16 @@ void paging_init(void);
 
 /* Configure the physmap direct-map offset used by phys_to_virt_kernel(). */
 void paging_set_phys_offset(uint64_t offset);
+/* The calling CPU's active PML4 (from CR3). */
 uint64_t *paging_get_pml4(void);
 uint64_t paging_get_pml4_phys(void);
 
-/* Switch CR3 and update internal pml4 pointers (used for per-process address spaces). */
+/* Switch the calling CPU's CR3 (used for per-process address spaces). */
 void paging_switch_cr3(uint64_t new_cr3_phys);
+
+/* paging_map_page() and the other calls without an explicit PML4 work on the
+ * calling CPU's active address space. Unmapping or rewriting a kernel-half
+ * entry there also flushes it from the other CPUs' TLBs (smp_tlb_shootdown). */
 int paging_map_page(uint64_t virt, uint64_t phys, uint64_t flags);
 int paging_unmap_page(uint64_t virt);
 int paging_map_range(uint64_t virt_base, uint64_t phys_base, uint64_t size, uint64_t flags);
@@ -34,6 +57,25 @@ int paging_map_range(uint64_t virt_base, uint64_t phys_base, uint64_t size, uint
 int paging_map_2m_page(uint64_t virt, uint64_t phys, uint64_t flags);
 int paging_map_2m_range(uint64_t virt_base, uint64_t phys_base, uint64_t size, uint64_t flags);
 
+/* Map a range with 2 MiB pages wherever virt and phys are both 2 MiB aligned
+ * for a whole chunk (and no page table is in the way), 4 KiB pages elsewhere. */
+int paging_map_range_huge(uint64_t virt_base, uint64_t phys_base, uint64_t size, uint64_t flags);
+
+/* Replace the 2 MiB page covering virt with a page table of 512 PTEs with the
+ * same flags. Returns 0 if virt is now 4 KiB mapped (or was never huge). */
+int paging_split_2m_page(uint64_t virt);
+
+/* Clear the 2 MiB page at virt (2 MiB aligned). Frames stay with the caller. */
+int paging_unmap_2m_page(uint64_t virt);
+
+/* Unmap a range mapped by paging_map_range_huge() (2 MiB pages where it used
+ * them) with a single TLB shootdown. Frames stay with the caller. */
+int paging_unmap_range(uint64_t virt_base, uint64_t size);
+
+/* 1 if nothing at all is mapped in the 2 MiB block around virt (no PD entry),
+ * i.e. paging_map_2m_page() can take it. */
+int paging_2m_slot_free(uint64_t virt);
+
 
 /* NEW: create per-process PML4 copying kernel high-half entries.
  * Returns physical address of new PML4 (non-zero on success).
@@ -59,6 +101,19 @@ uint64_t paging_get_flags(uint64_t virt);
 uint64_t paging_get_pte(uint64_t virt);
 int paging_set_pte(uint64_t virt, uint64_t pte);
 
+/* The same operations on an explicit PML4 (virtual pointer), e.g. the one of
+ * the process being faulted in or torn down, which need not be active on the
+ * calling CPU. User mappings get private upper-level tables like
+ * paging_map_range_to_pml4(). Only the local TLB is flushed. */
+int paging_map_page_in_pml4(uint64_t *pml4_virt, uint64_t virt, uint64_t phys, uint64_t flags);
+int paging_unmap_page_in_pml4(uint64_t *pml4_virt, uint64_t virt);
+uint64_t paging_get_pte_in_pml4(uint64_t *pml4_virt, uint64_t virt);
+int paging_set_pte_in_pml4(uint64_t *pml4_virt, uint64_t virt, uint64_t pte);
+int paging_map_2m_page_in_pml4(uint64_t *pml4_virt, uint64_t virt, uint64_t phys, uint64_t flags);
+int paging_split_2m_page_in_pml4(uint64_t *pml4_virt, uint64_t virt);
+int paging_unmap_2m_page_in_pml4(uint64_t *pml4_virt, uint64_t virt);
+int paging_2m_slot_free_in_pml4(uint64_t *pml4_virt, uint64_t virt);
+
 void *phys_to_virt_kernel(uint64_t phys);
 
 /* A small reserved kernel-only scratch mapping area (2 pages) intended for
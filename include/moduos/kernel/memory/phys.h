@@ -21,6 +21,9 @@ void phys_free_frame(uint64_t paddr);
 void phys_ref_inc(uint64_t paddr);
 void phys_ref_dec(uint64_t paddr);
 uint32_t phys_ref_get(uint64_t paddr);
+/* Nonzero if paddr is an allocated, refcounted frame. MMIO, firmware and pinned
+ * reservations are not: fork shares those as-is and never COW-copies them. */
+int phys_ref_managed(uint64_t paddr);
 
 /* Allocate contiguous frames (returns physical base addr) */
 uint64_t phys_alloc_contiguous(size_t nframes);
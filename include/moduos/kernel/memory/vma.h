@@ -0,0 +1,92 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include <stdint.h>
+
+/*
+ * User virtual memory areas.
+ *
+ * A VMA describes a page-aligned range of a process's address space whose
+ * pages are created on first touch by the page-fault handler instead of up
+ * front. Within a VMA, bytes [file_vaddr, file_vaddr + file_size) come from
+ * the backing executable image at file_offset and everything else reads as
+ * zero (ELF .bss). Anonymous areas (mmap) have no image at all.
+ *
+ * Read-only pages that are a plain copy of one file page are mapped straight
+ * from the image's shared frame, so every process running the same binary
+ * uses the same physical text pages. A read of an untouched private
+ * anonymous page maps the global zero frame copy-on-write. Other pages get a
+ * private frame; VMA_SHARED pages are marked PFLAG_SHARED so fork() shares
+ * them instead of copying. Writable private anonymous areas are backed by
+ * 2 MiB pages where a whole aligned block lies inside one VMA; those are
+ * split back to 4 KiB pages by partial munmap/mprotect and by fork().
+ *
+ * The list is private to the process (no locking): it is built by exec,
+ * duplicated by fork and released with the address space.
+ */
+
+#define VMA_READ   0x1
+#define VMA_WRITE  0x2
+#define VMA_EXEC   0x4
+#define VMA_SHARED 0x8
+#define VMA_PROT_MASK (VMA_READ | VMA_WRITE | VMA_EXEC)
+
+struct process;
+struct exec_image;
+
+typedef struct vma {
+    struct vma *next;             /* sorted by start */
+    uint64_t start;               /* page aligned */
+    uint64_t end;                 /* page aligned, exclusive */
+    uint32_t flags;               /* VMA_* */
+    struct exec_image *image;     /* referenced backing file (NULL: zero fill) */
+    uint64_t file_vaddr;
+    uint64_t file_offset;
+    uint64_t file_size;
+    uint64_t mem_end;             /* end of the zero-filled tail (.bss) */
+} vma_t;
+
+/* Add a file-backed area covering [vaddr, vaddr + mem_size). Takes its own
+ * reference on image. Returns 0, or -1 on overlap/OOM. */
+int vma_add_file(struct process *p, uint64_t vaddr, uint64_t mem_size, uint32_t flags,
+                 struct exec_image *image, uint64_t file_offset, uint64_t file_size);
+
+/* Add an anonymous area [start, end) (page aligned, must not overlap any
+ * VMA). Merges with an adjacent anonymous area of the same flags.
+ * Returns 0, or -1 on overlap/OOM. */
+int vma_add_anon(struct process *p, uint64_t start, uint64_t end, uint32_t flags);
+
+/* Forget [start, end), splitting areas that straddle it. Pages are left to
+ * the caller. Returns 0, or -1 on OOM (nothing removed past that point). */
+int vma_remove_range(struct process *p, uint64_t start, uint64_t end);
+
+/* Lowest `align`-aligned hole of `size` bytes in [lo, hi), or 0. */
+uint64_t vma_find_gap(struct process *p, uint64_t lo, uint64_t hi, uint64_t size, uint64_t align);
+
+/* Unmap and release every page in [start, end) of p's address space (VMA or
+ * not). Whole 2 MiB pages go in one step, partly covered ones are split. */
+void vma_unmap_pages(struct process *p, uint64_t start, uint64_t end);
+
+/* mprotect(): set the VMA_PROT_MASK bits of [start, end), which must be fully
+ * covered, and update the pages already mapped. Returns 0, -1 if part of the
+ * range is unmapped, -2 on OOM. */
+int vma_protect(struct process *p, uint64_t start, uint64_t end, uint32_t prot);
+
+/* Populate every VMA_SHARED page so fork() can share it. Returns 0 or -1. */
+int vma_populate_shared(struct process *p);
+
+/* First VMA containing addr, or NULL. */
+vma_t *vma_find(struct process *p, uint64_t addr);
+
+/* Populate the page containing addr in p's address space (p->page_table).
+ * Returns 1 if it is now mapped with the access allowed, 0 if addr is not in
+ * any VMA, -1 if it is but the access is not permitted or the fill failed. */
+int vma_handle_fault(struct process *p, uint64_t addr, int write);
+
+/* fork(): give dst a copy of src's list. Returns 0 or -1 (OOM). */
+int vma_dup(struct process *dst, struct process *src);
+
+/* Drop every VMA (mapped pages are released with the page tables). */
+void vma_free_all(struct process *p);
+
+#endif /* VMA_H */
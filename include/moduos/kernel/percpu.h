@@ -18,6 +18,8 @@ typedef struct cpu_local {
     uint64_t user_rsp;        /* +48 : user RSP saved by SYSCALL */
     uint64_t user_rip;        /* +56 : user RIP saved by SYSCALL */
     uint64_t user_rflags;     /* +64 : user RFLAGS saved by SYSCALL */
+    uint64_t heap;            /* +72 : percpu_heap_t* (kmalloc magazines) */
+    uint64_t syscall_frame;   /* +80 : saved-GPR frame of the syscall being served (fork) */
 } cpu_local_t;
 
 /* Offsets for assembly (must match struct layout) */
@@ -30,4 +32,6 @@ typedef struct cpu_local {
 #define CPU_LOCAL_OFF_USER_RSP        48
 #define CPU_LOCAL_OFF_USER_RIP        56
 #define CPU_LOCAL_OFF_USER_RFLAGS     64
+#define CPU_LOCAL_OFF_HEAP            72
+#define CPU_LOCAL_OFF_SYSCALL_FRAME   80
 
@@ -51,7 +51,7 @@ extern void context_switch(cpu_context_t *old_state, cpu_context_t *new_state,
                            void *old_fpu_state, void *new_fpu_state);
 
 // Lazy FPU hooks.
-void fpu_lazy_on_context_switch(process_t *next);
+void fpu_lazy_on_context_switch(process_t *prev, process_t *next);
 void fpu_lazy_on_process_exit(process_t *p);
 void fpu_lazy_handle_nm(void);
 
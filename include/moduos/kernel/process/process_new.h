@@ -6,6 +6,9 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "moduos/kernel/percpu.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/timer_wheel.h"
 
 // Process states (POSIX-style)
 typedef enum {
@@ -62,18 +65,18 @@ typedef struct process {
 
     // Scheduling (CFS)
     uint64_t vruntime;            // Virtual runtime (nanoseconds)
-    uint64_t exec_start;          // Time slice start
+    uint64_t exec_start;          // sched_clock_ns() when last charged for CPU time
     int nice;                     // Nice value (-20 to +19)
     int priority;                 // Alias for nice (compatibility)
     uint32_t weight;              // Scheduling weight
-    uint64_t total_time;          // Total CPU time used
+    uint64_t total_time;          // Total CPU time used (ticks, derived from runtime_ns)
     volatile int need_resched;    // Set by IRQ when preemption needed
     struct process *sched_next;   // Red-black tree links (simplified as linked list for now)
     struct process *sched_prev;
 
     // CPU context
     cpu_context_t context;        // Saved registers
-    void *fpu_state;              // FPU/SSE state (512 bytes)
+    void *fpu_state;              // FXSAVE/XSAVE area (fpu_state_size() bytes)
 
     // Memory management
     uint64_t cr3;                 // Page table base (per-process address space)
@@ -126,7 +129,7 @@ typedef struct process {
 
     // Wait queue (for sleep/wakeup)
     void *wait_channel;           // What we're sleeping on
-    uint64_t sleep_ticks;         // Tick count for process_sleep
+    uint64_t sleep_ticks;         // Wake deadline (ticks) of a timed sleep, 0 if none
 
     // Signals
     uint64_t pending_signals;
@@ -146,6 +149,19 @@ typedef struct process {
     // 0 = SIG_DFL, 1 = SIG_IGN, else = user handler VA
     uint64_t signal_handlers[64];
 
+    // Descriptor slot bitmap for fd_table (bit set = slot in use), managed by fs/fd.c
+    uint64_t fd_used[PROCESS_MAX_FDS / 64];
+    int fd_ready;                 // 1 once stdio slots were installed/inherited
+
+    // SMP scheduling
+    int sched_cpu;                // Run queue this process is queued on / last ran on (-1 = unplaced)
+    volatile int on_cpu;          // 1 from pick until its context is fully saved on switch-out
+    spinlock_t wake_lock;         // Serialises sleep/wake state changes against schedule()
+    int sched_blocked;            // SLEEPING and switched out by schedule() (not queued)
+    uint64_t runtime_ns;          // CPU time consumed, TSC-accounted
+    uint8_t fpu_counter;          // Consecutive slices that used the FPU (eager switch past FPU_EAGER_THRESHOLD)
+    struct vma *vmas;             // Demand-paged user mappings (vma.h), sorted by address
+
 } process_t;
 
 // Global process table
@@ -177,24 +193,36 @@ void scheduler_add(process_t *p);
 void scheduler_remove(process_t *p);
 void schedule(void);
 void scheduler_tick(void);
+void scheduler_register_idle(process_t *idle);   // per-CPU idle context
+int scheduler_wake(process_t *p, void *channel);  // SLEEPING -> READY (channel NULL = any)
+void scheduler_set_sleeping(process_t *p, void *channel);  // RUNNING -> SLEEPING, before schedule()
+void scheduler_wait_done(process_t *p);           // back to RUNNING if it never blocked
 int should_reschedule(void);
+void scheduler_resched_ipi(void);                // reschedule IPI handler
+void scheduler_set_nohz(void);                    // this CPU's timer is one-shot
+int scheduler_idle_has_work(void);                // idle loop check (interrupts off)
+void scheduler_timer_armed(uint64_t deadline);    // timer wheel: re-arm a tickless BSP
 
 // Context switching (context_switch.c)
 void switch_to(process_t *prev, process_t *next);
 
-// Current process
-extern volatile process_t *current;
+// Current process. Each CPU keeps the process it is running in its
+// cpu_local_t (GS base); set_curproc() is the only writer.
 static inline process_t *get_current(void) {
-    return (process_t *)current;
+    process_t *p;
+    __asm__ volatile("movq %%gs:%c1, %0" : "=r"(p) : "i"(CPU_LOCAL_OFF_CURRENT_PROCESS));
+    return p;
 }
+#define current (get_current())
+void set_curproc(process_t *p);
 
 uint64_t process_get_current_cr3(void);
 
 static inline process_t *process_get_current(void) {
-    return (process_t *)current;
+    return get_current();
 }
 
-// Forward declarations
+// Legacy wait channels, backed by hashed wait queues (waitqueue.c)
 void sleep_on(void *channel);
 void wakeup(void *channel);
 int send_signal(uint32_t pid, int sig);
@@ -203,10 +231,7 @@ int send_signal(uint32_t pid, int sig);
 process_t *process_get_by_pid(uint32_t pid);
 
 static inline void process_sleep(uint64_t ms) {
-    if (current) {
-        current->sleep_ticks = ms;
-        sleep_on((void *)(uintptr_t)current->pid);
-    }
+    sleep_ms(ms);
 }
 
 static inline void process_yield(void) {
@@ -237,15 +262,16 @@ uint64_t *process_get_build_pml4(void);
  * into another process before it starts executing. Typical use: inject FD 0
  * (stdin), FD 1 (stdout), FD 2 (stderr) backed by a TTY or pipe object.
  *
- * fd_obj  - opaque pointer to the backing object (tty_t *, pipe_t *, etc.)
+ * fd_obj  - open_file_t * (see fs/fd.h); the target takes its own reference
  * Returns 0 on success, -1 on error (pid not found, fd out of range, slot occupied).
  */
 int process_inject_fd(uint32_t pid, int fd, void *fd_obj);
 
-/* Retrieve an injected/open FD from a process. Returns NULL if not found. */
+/* Retrieve an injected/open FD from a process (referenced; release with
+ * fd_file_put()). Returns NULL if not found. */
 void *process_get_fd(uint32_t pid, int fd);
 
-/* Close (clear) an FD slot in a process. Returns 0 on success. */
+/* Close an FD slot in a process. Returns 0 on success. */
 int process_close_fd(uint32_t pid, int fd);
 
 // Signals (signals.c)
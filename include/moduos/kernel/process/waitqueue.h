@@ -0,0 +1,86 @@
+#ifndef MODUOS_KERNEL_PROCESS_WAITQUEUE_H
+#define MODUOS_KERNEL_PROCESS_WAITQUEUE_H
+
+#include <stdint.h>
+#include "moduos/kernel/spinlock.h"
+
+/**
+ * @file waitqueue.h
+ * @brief Wait queues
+ *
+ * A wait_queue_t lists the processes blocked on one condition, so waking
+ * them costs O(waiters) rather than a walk of the process table. Waiters
+ * follow the usual pattern, which cannot lose a wakeup because the caller
+ * is marked asleep before it re-checks the condition:
+ *
+ *     wait_entry_t we;
+ *     while (!cond) {
+ *         prepare_to_wait(&wq, &we, 0);
+ *         if (!cond) schedule();
+ *         finish_wait(&wq, &we);
+ *     }
+ *
+ * Exclusive waiters (exclusive = 1) sit at the tail and are woken one at a
+ * time by wake_up(); non-exclusive ones are always all woken. Use exclusive
+ * waits where one event can satisfy only one waiter (a queued item) to
+ * avoid a thundering herd.
+ *
+ * The legacy sleep_on(channel)/wakeup(channel) calls are built on a table
+ * of hashed wait queues, so they too only visit processes whose channel
+ * hashes to the same bucket.
+ */
+
+struct process;
+
+typedef struct wait_entry {
+    struct wait_entry *next;
+    struct wait_entry *prev;
+    struct process *proc;
+    void *key;                /* wake token: the queue, or a legacy channel */
+    int exclusive;
+} wait_entry_t;
+
+typedef struct wait_queue {
+    spinlock_t lock;
+    wait_entry_t head;        /* circular list sentinel */
+    volatile uint32_t nr_waiters;
+} wait_queue_t;
+
+/* Zero-initialised (static or kzalloc'd) queues are valid as well; the list
+ * head is set up on first use. */
+void wait_queue_init(wait_queue_t *wq);
+
+/* Unlocked check for the wake fast path. The fence orders the waker's
+ * condition update before the load; the waiter is ordered the other way by
+ * the locks prepare_to_wait() takes, so one of the two always sees the
+ * other. */
+static inline int wait_queue_active(wait_queue_t *wq) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&wq->nr_waiters, __ATOMIC_RELAXED) != 0;
+}
+
+/* Queue the current process on wq and mark it SLEEPING. The caller then
+ * re-checks its condition, calls schedule() if it still has to wait, and
+ * always pairs this with finish_wait(). */
+void prepare_to_wait(wait_queue_t *wq, wait_entry_t *we, int exclusive);
+
+/* Leave wq and make sure the caller is RUNNING again, whether or not it
+ * actually slept or was woken. */
+void finish_wait(wait_queue_t *wq, wait_entry_t *we);
+
+/* Wake every non-exclusive waiter and up to nr_exclusive exclusive ones
+ * (0 = all). Safe from IRQ context. Returns the number of processes woken. */
+int wake_up_nr(wait_queue_t *wq, int nr_exclusive);
+#define wake_up(wq)      wake_up_nr((wq), 1)
+#define wake_up_all(wq)  wake_up_nr((wq), 0)
+
+/* schedule() for a caller that has done prepare_to_wait(), bounded by an
+ * absolute tick deadline (0 = none). Returns -1 if the deadline is what
+ * woke it, 0 otherwise. */
+int schedule_until(uint64_t deadline);
+
+/* Whether the current context may block (a real process, not a CPU's
+ * boot/idle context). Code that may run in either falls back to polling. */
+int wait_can_block(void);
+
+#endif
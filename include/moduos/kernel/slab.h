@@ -17,6 +17,16 @@
 
 typedef struct slab_cache slab_cache_t;
 
+/* Object constructor: run once when a slab is populated, not on every alloc.
+ * Objects must be returned to the cache in their constructed state.
+ */
+typedef void (*slab_ctor_t)(void *obj);
+
+/* Smallest/largest kmalloc() size class served by the SLAB caches. */
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE 4096
+#define SLAB_KMALLOC_CLASSES 9   /* 16, 32, ... 4096 */
+
 /**
  * @brief Initialize SLAB allocator
  * Must be called during kernel initialization
@@ -33,6 +43,18 @@ void slab_init(void);
  */
 slab_cache_t *slab_cache_create(const char *name, size_t object_size, size_t align);
 
+/**
+ * @brief Create a SLAB cache whose objects are pre-initialized by a constructor
+ *
+ * @param name Cache name (for debugging)
+ * @param object_size Size of each object
+ * @param align Alignment requirement (must be power of 2)
+ * @param ctor Constructor run once per object when its slab is created (may be NULL)
+ * @return Cache handle, or NULL on failure
+ */
+slab_cache_t *slab_cache_create_ctor(const char *name, size_t object_size, size_t align,
+                                     slab_ctor_t ctor);
+
 /**
  * @brief Allocate object from SLAB cache
  * 
@@ -53,6 +75,39 @@ void *slab_alloc(slab_cache_t *cache);
  */
 void slab_free(slab_cache_t *cache, void *obj);
 
+/**
+ * @brief Allocate up to n objects under a single cache lock
+ *
+ * Used by the per-CPU front-end to refill magazines in batches.
+ *
+ * @return Number of objects stored in objs (0 on exhaustion)
+ */
+size_t slab_alloc_bulk(slab_cache_t *cache, void **objs, size_t n);
+
+/**
+ * @brief Free n objects of one cache under a single cache lock
+ */
+void slab_free_bulk(slab_cache_t *cache, void **objs, size_t n);
+
+/**
+ * @brief Map a size to its kmalloc size class
+ *
+ * @return Class index (0..SLAB_KMALLOC_CLASSES-1), or -1 if size is 0 or too large
+ */
+int slab_kmalloc_index(size_t size);
+
+/**
+ * @brief Get the kmalloc cache for a size class index (NULL if not ready)
+ */
+slab_cache_t *slab_kmalloc_cache(int index);
+
+/**
+ * @brief Get the cache owning ptr
+ *
+ * @return Owning cache if ptr is the start of a live SLAB object slot, else NULL
+ */
+slab_cache_t *slab_obj_cache(const void *ptr);
+
 /**
  * @brief Fast kmalloc using SLAB caches
  * 
@@ -71,6 +126,15 @@ void *slab_kmalloc(size_t size);
  */
 void slab_kfree(void *ptr);
 
+/**
+ * @brief Free ptr if it belongs to a SLAB page
+ *
+ * Used by kfree() to route small objects back to their cache.
+ *
+ * @return 1 if ptr was a SLAB object (and has been freed), 0 otherwise
+ */
+int slab_try_free(void *ptr);
+
 /**
  * @brief Get SLAB cache statistics
  * 
@@ -82,4 +146,9 @@ void slab_kfree(void *ptr);
 void slab_cache_stats(slab_cache_t *cache, size_t *objects_allocated, 
                       size_t *objects_free, size_t *total_memory);
 
+/**
+ * @brief Dump per-cache statistics to COM1
+ */
+void slab_dump_stats(void);
+
 #endif /* MODUOS_KERNEL_SLAB_H */
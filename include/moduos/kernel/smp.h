@@ -4,7 +4,7 @@
 
 #define SMP_MAX_CPUS 256
 
-/* CPU states for AP bring-up (for future APIC integration) */
+/* CPU states for AP bring-up */
 typedef enum {
     CPU_STATE_OFFLINE = 0,      /* Not yet online */
     CPU_STATE_INIT,             /* Initialization in progress */
@@ -20,8 +20,17 @@ typedef enum {
 void smp_init_bsp_early(void);
 
 /*
- * Returns the number of CPUs discovered (online count).
- * For now, returns 1 (BSP only) until APIC AP bring-up is implemented.
+ * SMP initialization phase 2 (BSP, after syscall_init()).
+ * Starts every enabled processor listed in the ACPI MADT through the LAPIC
+ * INIT/STARTUP sequence. Each AP gets its own GDT/TSS, SYSCALL MSRs, LAPIC
+ * timer, per-CPU heap and idle context, then enters its scheduler loop.
+ * Returns the number of CPUs online afterwards.
+ */
+uint32_t smp_init_aps(void);
+
+/*
+ * Returns the number of CPU slots registered (BSP + APs that were started).
+ * Check smp_get_cpu_state() for whether a slot is actually running.
  */
 uint32_t smp_cpu_count(void);
 
@@ -53,3 +62,36 @@ cpu_state_t smp_get_cpu_state(uint32_t cpu_id);
  */
 void smp_set_cpu_state(uint32_t cpu_id, cpu_state_t state);
 
+/*
+ * Send a reschedule IPI to cpu_id (no-op for offline CPUs or without a LAPIC).
+ */
+void smp_send_resched(uint32_t cpu_id);
+
+/*
+ * TLB shootdown for kernel mappings, which every address space shares.
+ * Called after a kernel PTE was cleared or rewritten (and flushed locally):
+ * sends APIC_TLB_VECTOR to every other running CPU and returns once all of
+ * them have flushed [start, end). Only one shootdown is in flight at a time;
+ * a CPU waiting for its turn keeps serving requests aimed at it. No-op while
+ * only one CPU runs.
+ */
+void smp_tlb_shootdown(uint64_t start, uint64_t end);
+
+/* APIC_TLB_VECTOR handler (apic.c). */
+void smp_tlb_ipi(void);
+
+
+/*
+ * Big kernel lock.
+ * Most kernel subsystems predate SMP and assume they are the only code
+ * running in the kernel. Syscalls, user-mode faults and kernel threads run
+ * holding this lock; user code, IRQ handlers and the idle loops do not.
+ * The lock is recursive per CPU. schedule() drops it for the duration of a
+ * context switch (bkl_release_all/bkl_reacquire) so it never follows a
+ * process onto another CPU.
+ */
+void bkl_lock(void);
+void bkl_unlock(void);
+int  bkl_release_all(void);          /* returns the depth that was held */
+void bkl_reacquire(int depth);
+int  bkl_held(void);                 /* held by the calling CPU */
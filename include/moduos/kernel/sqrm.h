@@ -276,6 +276,18 @@ typedef struct sqrm_kernel_api {
     const char *(*get_smbios_field)(int field); /* 0=mfr 1=product 2=bios_vendor 3=bios_version */
     uint64_t (*phys_total_frames)(void);
     uint64_t (*phys_count_free_frames)(void);
+
+    // Dedicated interrupt vectors (PCI modules; may be NULL).
+    // pci_irq_vector_count: MSI-X table size, 1 for MSI, 0 if INTx only.
+    // pci_request_irq_vector: bind MSI-X entry `index` (0 for MSI) to a new
+    // vector whose handler gets `ctx`; the kernel sends the EOI. Returns the
+    // vector, or -1 (fall back to irq_install_handler(interrupt_line)).
+    int (*pci_irq_vector_count)(pci_device_t *dev);
+    int (*pci_request_irq_vector)(pci_device_t *dev, int index, void (*handler)(void *ctx), void *ctx, const char *name);
+    void (*pci_free_irq_vector)(pci_device_t *dev, int index);
+    // Raw vectors for devices that signal through something other than PCI MSI.
+    int (*irq_alloc_vector)(void (*handler)(void *ctx), void *ctx, const char *name);
+    void (*irq_free_vector)(int vector);
 } sqrm_kernel_api_t;
 
 typedef int (*sqrm_module_init_fn)(const sqrm_kernel_api_t *api);
@@ -31,7 +31,7 @@ int sys_wait(int *status);
 int sys_exec(const char *str);
 int sys_getpid(void);
 int sys_getppid(void);
-int sys_sleep(unsigned int seconds);
+int sys_sleep(unsigned int seconds, unsigned int ms);
 void sys_yield(void);
 void* sys_sbrk(intptr_t increment);
 int sys_kill(int pid, int sig);
@@ -55,6 +55,7 @@ int sys_userfs_register(const userfs_user_node_t *user_node);
 /* VM mapping (for userland ld.so) */
 void* sys_mmap(void *addr, size_t size, int prot, int flags);
 int   sys_munmap(void *addr, size_t size);
+int   sys_mprotect(void *addr, size_t size, int prot);
 
 md64api_sysinfo_data* sys_get_sysinfo(void);
 int sys_get_sysinfo2(md64api_sysinfo_data_u *out, size_t out_size);  // Changed to return pointer
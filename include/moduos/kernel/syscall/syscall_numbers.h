@@ -20,7 +20,7 @@
 #define SYS_PIDINFO     50 /* md64api_get_pid_info(pid, out, out_size) -> 0 or -errno */
 #define SYS_GETPID      8
 #define SYS_GETPPID     9
-#define SYS_SLEEP       10
+#define SYS_SLEEP       10  /* sleep(seconds, milliseconds) -> 0 or -EINTR */
 #define SYS_YIELD       11
 /* SYS_MALLOC/FREE removed - handled by userland libc */
 #define SYS_SBRK        14  /* Low-level heap expansion only */
@@ -48,6 +48,18 @@
 /* Virtual memory mapping (userland dynamic linker support) */
 #define SYS_MMAP        39
 #define SYS_MUNMAP      40
+#define SYS_MPROTECT    96  /* mprotect(addr, len, prot) -> 0 or -errno */
+
+/* mmap()/mprotect() arguments. Only anonymous mappings are supported. */
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+#define MAP_FIXED       0x1
+#define MAP_ANONYMOUS   0x2
+#define MAP_ANON        MAP_ANONYMOUS
+#define MAP_PRIVATE     0x4  /* default when neither is given */
+#define MAP_SHARED      0x8  /* shared with fork() children */
 /* Networking - REMOVED: Use $/user/network/* (NetMan service) instead */
 /* FS tracing (timing) */
 #define SYS_FS_TRACE        55 /* arg1=0/1 set, returns previous state */
@@ -91,6 +103,9 @@
 #define SYS_GETPGID            93  /* getpgid(pid) -> pgid or -errno */
 #define SYS_GETSID             94  /* getsid(pid) -> sid or -errno */
 
+/* Kernel heap statistics */
+#define SYS_HEAPSTATS          95  /* heapstats(md_heapstats_cpu_u *buf, buflen) -> cpu count or -errno */
+
 /* ioctl commands for controlling terminal */
 #define TIOCSCTTY              0x540E  /* Set controlling terminal */
 #define TIOCNOTTY              0x5422  /* Give up controlling terminal */
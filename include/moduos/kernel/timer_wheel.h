@@ -0,0 +1,72 @@
+#ifndef MODUOS_KERNEL_TIMER_WHEEL_H
+#define MODUOS_KERNEL_TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/**
+ * @file timer_wheel.h
+ * @brief Kernel timers and timed sleeps
+ *
+ * Timers live in a hierarchical timer wheel keyed by system tick
+ * (get_system_ticks(), 1 kHz): a 256-slot wheel of single ticks plus four
+ * 64-slot wheels of increasing granularity whose entries cascade down as
+ * their range comes up. Arming and cancelling are O(1); each tick touches
+ * one slot. The wheel is advanced by the CPU that owns the system timebase
+ * (the BSP) and callbacks run there, in interrupt context. Once the BSP is
+ * tickless, its scheduler arms the one-shot timer for timer_next_expiry().
+ *
+ * Deadlines are absolute tick values. A timer fires on the first tick with
+ * get_system_ticks() >= deadline.
+ */
+
+typedef void (*ktimer_fn_t)(void *arg);
+
+typedef struct ktimer {
+    struct ktimer *next;      /* wheel slot list */
+    struct ktimer **pprev;
+    uint64_t expires;         /* absolute deadline (ticks) */
+    ktimer_fn_t fn;
+    void *arg;
+    volatile int pending;     /* queued in the wheel */
+} ktimer_t;
+
+typedef struct {
+    uint64_t armed;
+    uint64_t fired;
+    uint64_t cancelled;
+    uint64_t cascaded;        /* timers moved down a level */
+    uint64_t clock;           /* next tick the wheel will process */
+} ktimer_stats_t;
+
+void timer_setup(ktimer_t *t, ktimer_fn_t fn, void *arg);
+
+/* (Re)arm t to fire at deadline. Safe from any CPU and from IRQ context. */
+void timer_arm(ktimer_t *t, uint64_t deadline);
+
+/* Disarm t. Returns 1 if it was still pending, 0 if it already fired (or was
+ * never armed). Waits for a callback running on another CPU to finish, so it
+ * must not be called from t's own callback. */
+int timer_cancel(ktimer_t *t);
+
+/* Tick hook: run every timer whose deadline is <= now. */
+void timer_run_expired(uint64_t now);
+
+/* Earliest tick at which timer_run_expired() has work (a deadline, or an
+ * outer slot to cascade), or TIMER_NO_EXPIRY when the wheel is empty. */
+#define TIMER_NO_EXPIRY UINT64_MAX
+uint64_t timer_next_expiry(void);
+
+void timer_get_stats(ktimer_stats_t *out);
+
+/* Timed sleeps for process context. They block the caller without using the
+ * CPU; from contexts that cannot block (boot thread, idle) they fall back to
+ * halting until the deadline.
+ *   sleep_until:      0 once deadline is reached, -1 if woken early (signal).
+ *   sleep_ms:         sleep_until(now + ms).
+ *   sleep_on_timeout: sleep_on(channel) bounded by deadline; 1 if woken
+ *                     through wakeup(channel), 0 on timeout (waitqueue.c). */
+int sleep_until(uint64_t deadline);
+int sleep_ms(uint64_t ms);
+int sleep_on_timeout(void *channel, uint64_t deadline);
+
+#endif
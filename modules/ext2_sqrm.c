@@ -604,6 +604,21 @@ static int ext2_read_file(fs_mount_t *mount, const char *path, void *buffer, siz
     return 0;
 }
 
+static int ext2_read_at(fs_mount_t *mount, const char *path, uint64_t offset, void *buffer, size_t size, size_t *bytes_read) {
+    ext2_mount_ctx_t *m = (ext2_mount_ctx_t*)mount->ext_ctx;
+    if (bytes_read) *bytes_read = 0;
+    uint32_t ino;
+    if (ext2_resolve_path(m, path, &ino, 0) != 0) return -1;
+    ext2_inode_t in;
+    if (ext2_read_inode(m, ino, &in) != 0) return -2;
+    if ((in.i_mode & 0xF000) != 0x8000) return -3;
+
+    int r = ext2_read_inode_data(m, &in, offset, buffer, size);
+    if (r < 0) return r;
+    if (bytes_read) *bytes_read = (size_t)r;
+    return 0;
+}
+
 static int ext2_add_dirent_root_typed(ext2_mount_ctx_t *m, uint32_t ino, const char *name, uint8_t ftype) {
     // Minimal: add to root directory only (inode 2), single-block directories from ModuOS mkfs.
     ext2_inode_t root;
@@ -1260,6 +1275,81 @@ static int ext2_write_file(fs_mount_t *mount, const char *path, const void *buff
     return 0;
 }
 
+// Offset write: only the blocks covering [offset, offset + size) are touched. Blocks
+// past the old end that are never written stay holes and read back as zeros.
+static int ext2_write_at(fs_mount_t *mount, const char *path, uint64_t offset, const void *buffer, size_t size) {
+    ext2_mount_ctx_t *m = (ext2_mount_ctx_t*)mount->ext_ctx;
+    if (!m || !g_api || !g_api->block_write) return -1;
+
+    // minimal: ModuOS mkfs ext2 only (single group, 4KiB blocks)
+    if (m->block_size != 4096 || m->groups != 1) return -2;
+
+    if (!path || path[0] != '/') return -3;
+    if (size == 0) return 0;
+    if (!buffer) return -3;
+
+    uint64_t end = offset + size;
+    if (end > 0xFFFFFFFFull) return -4;
+
+    uint32_t ino = 0;
+    if (ext2_resolve_path(m, path, &ino, 0) != 0) {
+        int crc = ext2_write_file(mount, path, NULL, 0);
+        if (crc != 0) return crc;
+        if (ext2_resolve_path(m, path, &ino, 0) != 0) return -5;
+    }
+
+    ext2_inode_t in;
+    if (ext2_read_inode(m, ino, &in) != 0) return -6;
+    if ((in.i_mode & 0xF000) != 0x8000) return -7;
+
+    uint32_t bs = m->block_size;
+    uint64_t old_size = in.i_size;
+    const uint8_t *src = (const uint8_t*)buffer;
+    uint8_t *blkbuf = (uint8_t*)g_api->kmalloc(bs);
+    if (!blkbuf) return -8;
+
+    uint32_t allocated = 0;
+    int rc = 0;
+    uint32_t end_lbn = (uint32_t)((end + bs - 1) / bs);
+    for (uint32_t lbn = (uint32_t)(offset / bs); lbn < end_lbn; lbn++) {
+        uint64_t bstart = (uint64_t)lbn * bs;
+        uint64_t lo = (bstart > offset) ? bstart : offset;
+        uint64_t hi = (bstart + bs < end) ? bstart + bs : end;
+
+        uint32_t pblk = ext2_get_block_ptr(m, &in, lbn);
+        int fresh = 0;
+        if (pblk == 0) {
+            if (ext2_alloc_block0(m, &pblk) != 0) { rc = -9; break; }
+            if (ext2_set_block_ptr(m, &in, lbn, pblk) != 0) { (void)ext2_free_block0(m, pblk); rc = -10; break; }
+            allocated++;
+            fresh = 1;
+        }
+
+        if (lo == bstart && hi == bstart + bs) {
+            if (ext2_write_block(m, pblk, src + (lo - offset)) != 0) { rc = -11; break; }
+            continue;
+        }
+
+        if (fresh || bstart >= old_size) {
+            m_memset(blkbuf, 0, bs);
+        } else {
+            if (ext2_read_block(m, pblk, blkbuf) != 0) { rc = -12; break; }
+            if (old_size < bstart + bs) m_memset(blkbuf + (old_size - bstart), 0, (size_t)(bstart + bs - old_size));
+        }
+        m_memcpy(blkbuf + (lo - bstart), src + (lo - offset), (size_t)(hi - lo));
+        if (ext2_write_block(m, pblk, blkbuf) != 0) { rc = -11; break; }
+    }
+
+    g_api->kfree(blkbuf);
+
+    // Record new blocks even on failure so they are not leaked.
+    if (rc == 0 && end > old_size) in.i_size = (uint32_t)end;
+    in.i_blocks += allocated * (bs / 512u);
+    if ((allocated || in.i_size != old_size) && ext2_write_inode(m, ino, &in) != 0) return -13;
+
+    return rc;
+}
+
 typedef struct {
     ext2_mount_ctx_t *m;
     ext2_inode_t dir_inode;
@@ -1749,6 +1839,8 @@ static const fs_ext_driver_ops_t g_ext2_ops = {
     .opendir = ext2_opendir,
     .readdir = ext2_readdir,
     .closedir = ext2_closedir,
+    .read_at = ext2_read_at,
+    .write_at = ext2_write_at,
 };
 
 static void u32_to_dec(char *out, size_t out_sz, uint32_t v) {
@@ -104,10 +104,25 @@ typedef struct {
     char model[64];
 } blockdev_info_t;
 
+typedef struct blockdev_request {
+    uint64_t lba;
+    uint32_t count;
+    void *buf;
+    size_t buf_sz;
+    uint8_t write;
+    void (*done)(struct blockdev_request *req, int status);
+    void *ctx;
+    volatile int status;
+    void *driver_data;
+} blockdev_request_t;
+
 typedef struct {
     int (*get_info)(void *ctx, blockdev_info_t *out);
     int (*read)(void *ctx, uint64_t lba, uint32_t count, void *buf, size_t buf_sz);
     int (*write)(void *ctx, uint64_t lba, uint32_t count, const void *buf, size_t buf_sz);
+    /* Optional async pair (NULL = synchronous device) */
+    int (*submit)(void *ctx, blockdev_request_t *req);
+    int (*complete)(void *ctx, blockdev_request_t *req);
 } blockdev_ops_t;
 
 /* ---- Minimal external FS ABI (optional) ---- */
@@ -162,9 +177,20 @@ typedef struct fs_ext_driver_ops {
     int (*directory_exists)(fs_mount_t *mount, const char *path);
     int (*list_directory)(fs_mount_t *mount, const char *path);
 
+    int (*mkdir)(fs_mount_t *mount, const char *path);
+    int (*rmdir)(fs_mount_t *mount, const char *path);
+    int (*unlink)(fs_mount_t *mount, const char *path);
+
     fs_dir_t* (*opendir)(fs_mount_t *mount, const char *path);
     int (*readdir)(fs_dir_t *dir, fs_dirent_t *entry);
     void (*closedir)(fs_dir_t *dir);
+
+    /* Optional offset read; *bytes_read is short only at EOF. Needed for streaming. */
+    int (*read_at)(fs_mount_t *mount, const char *path, uint64_t offset, void *buffer, size_t size, size_t *bytes_read);
+
+    /* Optional offset write; grows the file (zero-filled gap), creates it if missing.
+     * Without it, fs_write_file_at() accepts offset 0 only. */
+    int (*write_at)(fs_mount_t *mount, const char *path, uint64_t offset, const void *buffer, size_t size);
 } fs_ext_driver_ops_t;
 
 /* ---- Optional shared service ABIs (exported via sqrm_service_register/get) ---- */
@@ -392,6 +418,15 @@ typedef struct sqrm_kernel_api {
     const char *(*get_smbios_field)(int field); /* 0=mfr 1=product 2=bios_vendor 3=bios_version */
     uint64_t (*phys_total_frames)(void);
     uint64_t (*phys_count_free_frames)(void);
+
+    /* Dedicated interrupt vectors (PCI modules; may be NULL).
+     * pci_request_irq_vector binds MSI-X entry `index` (0 for MSI) to a new
+     * vector and returns it, or -1 (fall back to the legacy INTx line). */
+    int (*pci_irq_vector_count)(void *dev);
+    int (*pci_request_irq_vector)(void *dev, int index, void (*handler)(void *ctx), void *ctx, const char *name);
+    void (*pci_free_irq_vector)(void *dev, int index);
+    int (*irq_alloc_vector)(void (*handler)(void *ctx), void *ctx, const char *name);
+    void (*irq_free_vector)(int vector);
 } sqrm_kernel_api_t;
 
 typedef int (*sqrm_module_init_fn)(const sqrm_kernel_api_t *api);
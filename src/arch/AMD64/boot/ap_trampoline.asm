@@ -0,0 +1,98 @@
+; ap_trampoline.asm - Application processor startup code
+;
+; smp_init_aps() copies ap_trampoline_start..ap_trampoline_end to physical
+; 0x8000 and points the STARTUP IPI at it. The AP arrives in real mode with
+; CS:IP = 0800:0000, switches straight to long mode using the BSP's page
+; tables (the low 1 GiB is identity mapped in every PML4), and calls
+; smp_ap_main(cpu) on the stack prepared for it.
+;
+; Everything here runs at the copy's address, so labels are only used through
+; TR(), which turns them into absolute addresses inside the 0x8000 page.
+
+%define AP_TRAMPOLINE_BASE 0x8000
+%define TR(x) ((x) - ap_trampoline_start + AP_TRAMPOLINE_BASE)
+
+%define MSR_EFER  0xC0000080
+%define EFER_LMA  (1 << 10)
+
+global ap_trampoline_start
+global ap_trampoline_data
+global ap_trampoline_end
+
+section .text
+bits 16
+
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [TR(ap_gdtr)]
+
+    ; PAE, then the BSP's PML4 (below 4 GiB), then EFER.LME.
+    mov eax, cr4
+    or eax, (1 << 5)
+    mov cr4, eax
+
+    mov eax, [TR(ap_data_cr3)]
+    mov cr3, eax
+
+    mov ecx, MSR_EFER
+    mov eax, [TR(ap_data_efer)]
+    mov edx, [TR(ap_data_efer) + 4]
+    and eax, ~EFER_LMA
+    wrmsr
+
+    ; PG | ET | PE: enabling paging with LME set activates long mode.
+    mov eax, 0x80000011
+    mov cr0, eax
+
+    jmp dword 0x08:TR(ap_long)
+
+bits 64
+ap_long:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; Match the BSP's control registers (SSE enable, WP, NE, ...).
+    mov rax, [TR(ap_data_cr4)]
+    mov cr4, rax
+    mov rax, [TR(ap_data_cr0)]
+    mov cr0, rax
+
+    mov rsp, [TR(ap_data_stack)]
+    xor rbp, rbp
+    mov rdi, [TR(ap_data_cpu)]
+    mov rax, [TR(ap_data_entry)]
+    call rax
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+ap_gdt:
+    dq 0                        ; null
+    dq 0x00AF9A000000FFFF       ; 0x08: 64-bit code
+    dq 0x00CF92000000FFFF       ; 0x10: data
+ap_gdt_end:
+
+ap_gdtr:
+    dw ap_gdt_end - ap_gdt - 1
+    dd TR(ap_gdt)
+
+; Filled in by smp_init_aps(); layout matches ap_boot_data_t in smp.c.
+align 8
+ap_trampoline_data:
+ap_data_cr3:    dq 0
+ap_data_efer:   dq 0
+ap_data_cr0:    dq 0
+ap_data_cr4:    dq 0
+ap_data_stack:  dq 0
+ap_data_entry:  dq 0
+ap_data_cpu:    dq 0
+ap_trampoline_end:
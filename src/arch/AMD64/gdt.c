@@ -1,4 +1,7 @@
 #include "moduos/arch/AMD64/gdt.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/arch/AMD64/msr.h"
+#include "moduos/kernel/smp.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/kernel/debug.h"
 #include "moduos/kernel/macros.h"
@@ -14,6 +17,9 @@
  *  - user code (DPL3)
  *  - user data (DPL3)
  *  - 64-bit TSS descriptor (for RSP0 stack switching)
+ *
+ * Every CPU gets its own GDT and TSS: the TSS descriptor goes "busy" once loaded,
+ * and RSP0 follows whatever process that CPU is running.
  */
 
 struct __attribute__((packed)) gdt_ptr {
@@ -21,8 +27,8 @@ struct __attribute__((packed)) gdt_ptr {
     uint64_t base;
 };
 
-/* 8-byte segment descriptor */
-static uint64_t gdt[8];
+/* 8-byte segment descriptors, one table per CPU */
+static uint64_t gdt_tables[SMP_MAX_CPUS][8];
 
 /* 64-bit TSS */
 struct __attribute__((packed)) tss64 {
@@ -43,7 +49,7 @@ struct __attribute__((packed)) tss64 {
     uint16_t iopb_offset;
 };
 
-static struct tss64 tss;
+static struct tss64 tss_tables[SMP_MAX_CPUS];
 
 static uint64_t gdt_make_code_desc(uint8_t dpl) {
     /*
@@ -73,7 +79,7 @@ static uint64_t gdt_make_data_desc(uint8_t dpl) {
     return desc;
 }
 
-static void gdt_set_tss_desc(int idx, uint64_t base, uint32_t limit) {
+static void gdt_set_tss_desc(uint64_t *gdt, int idx, uint64_t base, uint32_t limit) {
     /* 16-byte TSS descriptor consumes two GDT slots */
     uint64_t low = 0;
     uint64_t high = 0;
@@ -96,10 +102,13 @@ static void gdt_set_tss_desc(int idx, uint64_t base, uint32_t limit) {
 }
 
 void amd64_tss_set_rsp0(uint64_t rsp0) {
-    tss.rsp0 = rsp0;
+    tss_tables[get_cpu_id()].rsp0 = rsp0;
 }
 
-void amd64_gdt_init(void) {
+void amd64_gdt_init_cpu(uint32_t cpu) {
+    if (cpu >= SMP_MAX_CPUS) return;
+    uint64_t *gdt = gdt_tables[cpu];
+
     /* Null */
     gdt[0] = 0;
 
@@ -115,14 +124,19 @@ void amd64_gdt_init(void) {
     gdt[5] = gdt_make_code_desc(3); /* USER_CS (index 5) */
 
     /* TSS */
-    for (size_t i = 0; i < sizeof(tss); i++) ((uint8_t*)&tss)[i] = 0;
-    tss.iopb_offset = (uint16_t)sizeof(tss);
-    gdt_set_tss_desc(6, (uint64_t)(uintptr_t)&tss, (uint32_t)(sizeof(tss) - 1));
+    struct tss64 *t = &tss_tables[cpu];
+    for (size_t i = 0; i < sizeof(*t); i++) ((uint8_t*)t)[i] = 0;
+    t->iopb_offset = (uint16_t)sizeof(*t);
+    gdt_set_tss_desc(gdt, 6, (uint64_t)(uintptr_t)t, (uint32_t)(sizeof(*t) - 1));
 
     struct gdt_ptr gp;
-    gp.limit = (uint16_t)(sizeof(gdt) - 1);
+    gp.limit = (uint16_t)(sizeof(gdt_tables[0]) - 1);
     gp.base = (uint64_t)(uintptr_t)&gdt[0];
 
+    /* Reloading GS below zeroes its hidden base; keep the per-CPU pointer. */
+    uint64_t gs_base = rdmsr(MSR_IA32_GS_BASE);
+    uint64_t kgs_base = rdmsr(MSR_IA32_KERNEL_GS_BASE);
+
     __asm__ volatile ("lgdt %0" : : "m"(gp));
 
     /* Reload segment registers. CS reload requires far return/jump. */
@@ -150,8 +164,14 @@ void amd64_gdt_init(void) {
         : "rax", "memory"
     );
 
+    wrmsr(MSR_IA32_GS_BASE, gs_base);
+    wrmsr(MSR_IA32_KERNEL_GS_BASE, kgs_base);
+
     /* Load TSS */
     __asm__ volatile ("ltr %0" : : "r"((uint16_t)TSS_SEL));
+}
 
+void amd64_gdt_init(void) {
+    amd64_gdt_init_cpu(0);
     COM_LOG_OK(COM1_PORT, "AMD64 GDT+TSS initialized");
 }
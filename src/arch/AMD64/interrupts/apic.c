@@ -1,18 +1,29 @@
 #include "moduos/arch/AMD64/interrupts/apic.h"
 #include "moduos/arch/AMD64/interrupts/idt.h"
+#include "moduos/arch/AMD64/interrupts/ioapic.h"
 #include "moduos/arch/AMD64/interrupts/timer.h"
 #include "moduos/drivers/power/ACPI.h"
 #include "moduos/drivers/power/acpi_pm_timer.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/kernel/memory/paging.h"
+#include "moduos/arch/AMD64/msr.h"
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/smp.h"
 #include <stdint.h>
 
-// Minimal Local APIC (xAPIC) support (stage 1): enable LAPIC + periodic LAPIC timer.
+// Minimal Local APIC (xAPIC) support: enable LAPIC, periodic or one-shot
+// (TSC-deadline when available) LAPIC timer, the INIT/STARTUP IPIs used to
+// bring up application processors, and the reschedule IPI.
 
 #define LAPIC_REG_ID        0x020
+#define LAPIC_REG_TPR       0x080
 #define LAPIC_REG_EOI       0x0B0
 #define LAPIC_REG_SVR       0x0F0
+#define LAPIC_REG_ICR_LO    0x300
+#define LAPIC_REG_ICR_HI    0x310
 #define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_LVT_LINT0 0x350
+#define LAPIC_REG_LVT_LINT1 0x360
 #define LAPIC_REG_TMRINIT   0x380
 #define LAPIC_REG_TMRCURR   0x390
 #define LAPIC_REG_TMRDIV    0x3E0
@@ -20,14 +31,29 @@
 #define LAPIC_SVR_ENABLE    (1u << 8)
 #define LAPIC_LVT_MASK      (1u << 16)
 #define LAPIC_LVT_PERIODIC  (1u << 17)
+#define LAPIC_LVT_TSC_DEADLINE (2u << 17)
+#define LAPIC_DM_NMI        (4u << 8)
+#define LAPIC_DM_EXTINT     (7u << 8)
+
+#define LAPIC_ICR_FIXED     (0u << 8)
+#define LAPIC_ICR_INIT      (5u << 8)
+#define LAPIC_ICR_STARTUP   (6u << 8)
+#define LAPIC_ICR_PENDING   (1u << 12)
+#define LAPIC_ICR_ASSERT    (1u << 14)
 
 // Use a vector that doesn't collide with exceptions/IRQs (IRQs use 0x20..0x2F).
-#define LAPIC_TIMER_VECTOR  0x40
+#define LAPIC_TIMER_VECTOR  APIC_TIMER_VECTOR
 #define LAPIC_SPURIOUS_VECTOR 0xFF
 
+#define MSR_IA32_TSC_DEADLINE 0x6E0u
+
 static volatile uint32_t *g_lapic;
 static int g_apic_enabled;
 static int g_apic_timer_enabled;
+static uint64_t g_lapic_counts_per_ms;   /* LAPIC timer calibration (divide by 16) */
+static int g_lapic_tsc_deadline;         /* one-shot timers use IA32_TSC_DEADLINE */
+
+static int lapic_timer_calibrate(void);
 
 static inline uint32_t lapic_read(uint32_t reg) {
     return g_lapic[reg / 4];
@@ -43,12 +69,26 @@ static void lapic_eoi(void) {
     if (g_lapic) lapic_write(LAPIC_REG_EOI, 0);
 }
 
+void apic_eoi(void) {
+    lapic_eoi();
+}
+
 // ISR stubs are implemented in asm (apic_isr.asm) and call these C handlers.
 void apic_timer_irq_handler_c(void) {
     lapic_eoi();
     timer_tick_from_apic();
 }
 
+void apic_resched_irq_handler_c(void) {
+    lapic_eoi();
+    scheduler_resched_ipi();
+}
+
+void apic_tlb_irq_handler_c(void) {
+    lapic_eoi();
+    smp_tlb_ipi();
+}
+
 void apic_spurious_irq_handler_c(void) {
     /* Per Intel SDM §10.9: spurious interrupts must NOT generate an EOI.
      * Sending one corrupts the LAPIC ISR state machine. */
@@ -58,37 +98,118 @@ void apic_spurious_irq_handler_c(void) {
 int apic_is_enabled(void) { return g_apic_enabled; }
 int apic_timer_is_enabled(void) { return g_apic_timer_enabled; }
 
-int apic_init_from_madt(void) {
+static int lapic_map(void) {
+    if (g_lapic) return 0;
+
     madt_t *madt = acpi_get_madt();
     if (!madt) return -1;
 
     uint64_t lapic_phys = (uint64_t)madt->local_apic_address;
     if (!lapic_phys) return -1;
 
-    g_lapic = (volatile uint32_t*)phys_to_virt_kernel(lapic_phys);
-    if (!g_lapic) return -1;
+    volatile uint32_t *lapic = (volatile uint32_t*)phys_to_virt_kernel(lapic_phys);
+    if (!lapic) return -1;
 
-    // Install IDT entries we may trigger.
+    // Install IDT entries we may trigger (the IDT is shared by all CPUs).
     extern void apic_timer_stub(void);
     extern void apic_spurious_stub(void);
+    extern void apic_resched_stub(void);
+    extern void apic_tlb_stub(void);
     idt_set_entry(LAPIC_TIMER_VECTOR, apic_timer_stub, 0x8E);
+    idt_set_entry(APIC_RESCHED_VECTOR, apic_resched_stub, 0x8E);
+    idt_set_entry(APIC_TLB_VECTOR, apic_tlb_stub, 0x8E);
     idt_set_entry(LAPIC_SPURIOUS_VECTOR, apic_spurious_stub, 0x8E);
 
-    // Enable LAPIC via SVR.
+    g_lapic = lapic;
+    return 0;
+}
+
+// Software-enable the calling CPU's LAPIC via SVR.
+static void lapic_enable_local(void) {
     uint32_t svr = lapic_read(LAPIC_REG_SVR);
     svr = (svr & ~0xFFu) | LAPIC_SPURIOUS_VECTOR;
     svr |= LAPIC_SVR_ENABLE;
     lapic_write(LAPIC_REG_SVR, svr);
+    lapic_write(LAPIC_REG_TPR, 0);
+}
+
+int apic_init_from_madt(void) {
+    if (lapic_map() != 0) return -1;
+
+    // Enable LAPIC via SVR.
+    lapic_enable_local();
 
     g_apic_enabled = 1;
     com_write_string(COM1_PORT, "[APIC] LAPIC enabled\n");
     return 0;
 }
 
+// Enable the BSP's LAPIC for IPIs without taking over interrupt routing.
+// While the 8259 PIC still delivers IRQs, keep LINT0 in virtual-wire (ExtINT)
+// mode so legacy interrupts keep reaching the BSP.
+int apic_enable_bsp_for_smp(void) {
+    if (lapic_map() != 0) return -1;
+    if (g_apic_enabled) return 0;
+
+    lapic_enable_local();
+    if (!ioapic_is_enabled()) {
+        lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_DM_EXTINT);
+        lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_DM_NMI);
+    }
+
+    g_apic_enabled = 1;
+    com_write_string(COM1_PORT, "[APIC] LAPIC enabled (virtual wire) for SMP\n");
+
+    /* Calibrate once here so APs can start their timers without waiting. */
+    (void)lapic_timer_calibrate();
+    return 0;
+}
+
+// Per-AP LAPIC setup: external interrupts stay on the BSP, so LINT0 is masked.
+void apic_ap_init(void) {
+    if (!g_lapic) return;
+    lapic_enable_local();
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASK);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_DM_NMI);
+}
+
+uint32_t apic_local_id(void) {
+    if (!g_lapic) return 0;
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+static int lapic_send_ipi(uint8_t apic_id, uint32_t icr_lo) {
+    if (!g_lapic) return -1;
+    lapic_write(LAPIC_REG_ICR_HI, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LO, icr_lo);
+    for (uint32_t spin = 0; spin < 1000000u; spin++) {
+        if (!(lapic_read(LAPIC_REG_ICR_LO) & LAPIC_ICR_PENDING)) return 0;
+        __asm__ volatile("pause");
+    }
+    return -1;
+}
+
+int apic_send_init(uint8_t apic_id) {
+    return lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+// STARTUP IPI: the AP begins in real mode at vector_page * 4 KiB.
+int apic_send_startup(uint8_t apic_id, uint8_t vector_page) {
+    return lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | vector_page);
+}
+
+int apic_send_resched(uint8_t apic_id) {
+    return lapic_send_ipi(apic_id, LAPIC_ICR_FIXED | APIC_RESCHED_VECTOR);
+}
+
+int apic_send_tlb(uint8_t apic_id) {
+    return lapic_send_ipi(apic_id, LAPIC_ICR_FIXED | APIC_TLB_VECTOR);
+}
+
 // Calibrate LAPIC timer using ACPI PM timer as reference (preferred).
-int apic_timer_init(uint32_t hz) {
-    if (!g_apic_enabled || !g_lapic) return -1;
-    if (hz == 0) hz = 1000;
+// Every LAPIC runs off the same bus clock, so one calibration serves all CPUs.
+static int lapic_timer_calibrate(void) {
+    if (g_lapic_counts_per_ms) return 0;
 
     // Divide by 16 (common choice).
     lapic_write(LAPIC_REG_TMRDIV, 0x3);
@@ -125,14 +246,30 @@ int apic_timer_init(uint32_t hz) {
     // elapsed counts per 100ms
     uint64_t counts_per_ms = (uint64_t)elapsed / 100ULL;
     if (counts_per_ms == 0) counts_per_ms = 1;
+    g_lapic_counts_per_ms = counts_per_ms;
+    return 0;
+}
 
-    uint64_t counts_per_tick = (counts_per_ms * 1000ULL) / (uint64_t)hz;
+// Program the calling CPU's LAPIC timer in periodic mode.
+int apic_timer_start(uint32_t hz) {
+    if (!g_lapic) return -1;
+    if (hz == 0) hz = 1000;
+    if (lapic_timer_calibrate() != 0) return -1;
+
+    uint64_t counts_per_tick = (g_lapic_counts_per_ms * 1000ULL) / (uint64_t)hz;
     if (counts_per_tick == 0) counts_per_tick = 1;
 
     // Program periodic timer.
+    lapic_write(LAPIC_REG_TMRDIV, 0x3);
     uint32_t lvt = LAPIC_TIMER_VECTOR | LAPIC_LVT_PERIODIC;
     lapic_write(LAPIC_REG_LVT_TIMER, lvt);
     lapic_write(LAPIC_REG_TMRINIT, (uint32_t)counts_per_tick);
+    return 0;
+}
+
+int apic_timer_init(uint32_t hz) {
+    if (!g_apic_enabled || !g_lapic) return -1;
+    if (apic_timer_start(hz) != 0) return -1;
 
     g_apic_timer_enabled = 1;
     timer_set_apic_enabled(1);
@@ -140,3 +277,58 @@ int apic_timer_init(uint32_t hz) {
     com_write_string(COM1_PORT, "[APIC] LAPIC timer enabled\n");
     return 0;
 }
+
+// ---------------------------------------------------------------------------
+// One-shot timer (tickless CPUs)
+// ---------------------------------------------------------------------------
+
+static int cpu_has_tsc_deadline(void) {
+    uint32_t a, b, c, d;
+    __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1u), "c"(0));
+    return (c >> 24) & 1;
+}
+
+// Switch the calling CPU's LAPIC timer to one-shot operation. Nothing fires
+// until apic_timer_arm_ns(). TSC-deadline mode needs a calibrated TSC.
+int apic_timer_start_oneshot(void) {
+    if (!g_lapic) return -1;
+    if (lapic_timer_calibrate() != 0) return -1;
+
+    if (tsc_khz() && cpu_has_tsc_deadline()) {
+        g_lapic_tsc_deadline = 1;
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_LVT_TSC_DEADLINE);
+        /* SDM 10.5.4.1: order the LVT write before the first deadline write. */
+        __asm__ volatile("mfence" ::: "memory");
+        wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+    } else {
+        g_lapic_tsc_deadline = 0;
+        lapic_write(LAPIC_REG_TMRDIV, 0x3);
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_REG_TMRINIT, 0);
+    }
+    return 0;
+}
+
+int apic_timer_tsc_deadline(void) { return g_lapic_tsc_deadline; }
+
+// Fire one timer interrupt on the calling CPU ns nanoseconds from now.
+void apic_timer_arm_ns(uint64_t ns) {
+    if (!g_lapic) return;
+    if (ns == 0) ns = 1;
+    if (g_lapic_tsc_deadline) {
+        uint64_t cycles = (ns * tsc_khz()) / 1000000ULL;
+        wrmsr(MSR_IA32_TSC_DEADLINE, rdtsc() + (cycles ? cycles : 1));
+        return;
+    }
+    uint64_t counts = (ns * g_lapic_counts_per_ms) / 1000000ULL;
+    if (counts == 0) counts = 1;
+    if (counts > 0xFFFFFFFFull) counts = 0xFFFFFFFFull;
+    lapic_write(LAPIC_REG_TMRINIT, (uint32_t)counts);
+}
+
+// Cancel the calling CPU's pending one-shot (the tick is stopped).
+void apic_timer_stop(void) {
+    if (!g_lapic) return;
+    if (g_lapic_tsc_deadline) wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+    else lapic_write(LAPIC_REG_TMRINIT, 0);
+}
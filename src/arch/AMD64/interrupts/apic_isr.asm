@@ -1,9 +1,13 @@
 ; apic_isr.asm
 
 extern apic_timer_irq_handler_c
+extern apic_resched_irq_handler_c
+extern apic_tlb_irq_handler_c
 extern apic_spurious_irq_handler_c
 
 global apic_timer_stub
+global apic_resched_stub
+global apic_tlb_stub
 global apic_spurious_stub
 
 section .text
@@ -47,8 +51,17 @@ section .text
 ; Ensure System V ABI stack alignment for C calls.
 ; On interrupt entry, RSP alignment is not guaranteed. We align by subtracting 8
 ; (same trick as many kernels) before the call.
+;
+; LAPIC interrupts also arrive while an AP runs user code, so switch to the
+; kernel GS base (per-CPU data) when the interrupted CS is ring 3.
 
-apic_timer_stub:
+%macro APIC_STUB 2
+%1:
+    cld
+    test word [rsp + 8], 3
+    jz .from_kernel
+    swapgs
+.from_kernel:
     SAVE_REGS
     ; SysV ABI: RSP must be 16-byte aligned at the point of the call instruction.
     ; 'call' will then push the 8-byte return address, leaving RSP misaligned by 8
@@ -56,16 +69,17 @@ apic_timer_stub:
     ; Save pre-alignment RSP in a callee-saved register so it survives the call.
     mov rbx, rsp
     and rsp, -16
-    call apic_timer_irq_handler_c
+    call %2
     mov rsp, rbx
     RESTORE_REGS
+    test word [rsp + 8], 3
+    jz .to_kernel
+    swapgs
+.to_kernel:
     iretq
+%endmacro
 
-apic_spurious_stub:
-    SAVE_REGS
-    mov rbx, rsp
-    and rsp, -16
-    call apic_spurious_irq_handler_c
-    mov rsp, rbx
-    RESTORE_REGS
-    iretq
+APIC_STUB apic_timer_stub, apic_timer_irq_handler_c
+APIC_STUB apic_resched_stub, apic_resched_irq_handler_c
+APIC_STUB apic_tlb_stub, apic_tlb_irq_handler_c
+APIC_STUB apic_spurious_stub, apic_spurious_irq_handler_c
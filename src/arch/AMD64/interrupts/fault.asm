@@ -27,6 +27,8 @@ extern fault_handler_x87_fpu
 extern fault_handler_alignment_check
 extern fault_handler_machine_check
 extern fault_handler_simd_exception
+extern bkl_lock
+extern bkl_unlock
 
 ; Save/restore all general purpose registers.
 ; (We intentionally do not touch segment registers here.)
@@ -48,6 +50,19 @@ extern fault_handler_simd_exception
     push r15
 %endmacro
 
+; Faults taken in user mode (CPL3 in the saved CS, held in rbx) run their
+; handler under the big kernel lock, like syscalls. Kernel-mode faults already
+; hold it or are not allowed to block on it. NMIs never take it.
+; %1 = vector, %2 = lock/unlock. rbx survives the C call (callee-saved).
+%macro BKL_IF_USER 2
+%if %1 != 2
+    test bl, 3
+    jz %%kernel
+    call bkl_%2
+%%kernel:
+%endif
+%endmacro
+
 %macro POP_GPRS 0
     pop r15
     pop r14
@@ -90,8 +105,10 @@ fault_stub_%1:
     mov [rsp + 16], rcx
     mov qword [rsp + 24], 0
 
+    BKL_IF_USER %1, lock
     mov rdi, rsp
     call %2
+    BKL_IF_USER %1, unlock
 
     add rsp, 32
     POP_GPRS
@@ -124,8 +141,11 @@ fault_stub_%1:
     mov [rsp + 16], rcx
     mov qword [rsp + 24], 0
 
+    BKL_IF_USER %1, lock
+    mov rdi, [rsp + 32 + 120 + 0] ; error code (arg0), reloaded after bkl_lock
     mov rsi, rsp                ; frame* (arg1)
     call %2
+    BKL_IF_USER %1, unlock
 
     add rsp, 32
     POP_GPRS
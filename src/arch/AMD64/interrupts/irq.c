@@ -4,9 +4,11 @@
 #include "moduos/kernel/memory/string.h" // itoa
 #include "moduos/arch/AMD64/interrupts/pic.h"
 #include "moduos/arch/AMD64/interrupts/ioapic.h"
+#include "moduos/arch/AMD64/interrupts/apic.h"
 #include "moduos/kernel/COM/com.h"
 
 extern void (*irq_stubs[16])(); // from isr.asm
+extern void (*irq_vector_stubs[IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1])(); // from vector_isr.asm
 
 static irq_handler_t irq_handlers[16] = { 0 };
 
@@ -70,4 +72,84 @@ void irq_init(void) {
     for (int i = 0; i < 16; i++) {
         idt_set_entry(32 + i, irq_stubs[i], 0x8E); // Interrupt gate, ring 0
     }
-}
\ No newline at end of file
+}
+
+// ============================================================================
+// Dynamically allocated vectors
+// ============================================================================
+
+typedef struct {
+    irq_vector_handler_t handler;
+    void *ctx;
+    const char *name;
+    uint64_t count;
+} irq_vector_t;
+
+static irq_vector_t irq_vectors[IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1];
+static spinlock_t irq_vector_lock;
+
+static int irq_vector_reserved(int vector) {
+    return vector == APIC_TIMER_VECTOR || vector == APIC_RESCHED_VECTOR ||
+           vector == APIC_TLB_VECTOR || vector == 0x80;
+}
+
+int irq_alloc_vector(irq_vector_handler_t handler, void *ctx, const char *name) {
+    if (!handler || !apic_is_enabled()) return -1;
+
+    uint64_t flags;
+    int vector = -1;
+    spinlock_lock_irqsave(&irq_vector_lock, &flags);
+    for (int v = IRQ_VECTOR_FIRST; v <= IRQ_VECTOR_LAST; v++) {
+        irq_vector_t *e = &irq_vectors[v - IRQ_VECTOR_FIRST];
+        if (e->handler || irq_vector_reserved(v)) continue;
+        e->ctx = ctx;
+        e->name = name;
+        e->count = 0;
+        e->handler = handler;
+        vector = v;
+        break;
+    }
+    spinlock_unlock_irqrestore(&irq_vector_lock, flags);
+
+    if (vector < 0) {
+        com_printf(COM1_PORT, "[IRQ] no free vector for %s\n", name ? name : "?");
+        return -1;
+    }
+
+    // The IDT is shared by all CPUs, so the vector is live everywhere at once.
+    idt_set_entry(vector, irq_vector_stubs[vector - IRQ_VECTOR_FIRST], 0x8E);
+    com_printf(COM1_PORT, "[IRQ] vector 0x%x -> %s handler=%p\n",
+               vector, name ? name : "?", (void *)handler);
+    return vector;
+}
+
+void irq_free_vector(int vector) {
+    if (vector < IRQ_VECTOR_FIRST || vector > IRQ_VECTOR_LAST) return;
+
+    // The gate stays pointed at the stub; a late interrupt on a freed vector
+    // finds no handler and is just acknowledged.
+    uint64_t flags;
+    spinlock_lock_irqsave(&irq_vector_lock, &flags);
+    irq_vectors[vector - IRQ_VECTOR_FIRST].handler = 0;
+    irq_vectors[vector - IRQ_VECTOR_FIRST].ctx = 0;
+    irq_vectors[vector - IRQ_VECTOR_FIRST].name = 0;
+    spinlock_unlock_irqrestore(&irq_vector_lock, flags);
+}
+
+void irq_vector_dispatch(uint64_t vector) {
+    irq_depth++;
+
+    if (vector >= IRQ_VECTOR_FIRST && vector <= IRQ_VECTOR_LAST) {
+        irq_vector_t *e = &irq_vectors[vector - IRQ_VECTOR_FIRST];
+        irq_vector_handler_t handler = e->handler;
+        if (handler) {
+            e->count++;
+            handler(e->ctx);
+        }
+    }
+
+    irq_depth--;
+
+    // MSI is edge-triggered and always delivered through the LAPIC.
+    apic_eoi();
+}
@@ -6,6 +6,12 @@
 #include "moduos/kernel/process/process_new.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/timer_wheel.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/drivers/power/acpi_pm_timer.h"
+#include "moduos/arch/AMD64/interrupts/apic.h"
+#include "moduos/arch/AMD64/interrupts/ioapic.h"
+#include "moduos/kernel/interrupts/irq_lock.h"
 #define PIT_CHANNEL0 0x40
 #define PIT_COMMAND  0x43
 
@@ -14,6 +20,17 @@ static volatile int in_timer_handler = 0;
 static volatile uint32_t pit_hz = 100;
 static volatile int apic_tick_enabled = 0;
 
+#define ACPI_PM_HZ 3579545u
+static uint64_t g_tsc_khz;
+static uint64_t g_tsc_ns_mult;          /* ns = (tsc * mult) >> 32 */
+
+/* Once the TSC is calibrated the tick count is derived from it instead of
+ * counted: ticks = g_tick_base + (ns - g_tick_base_ns) * hz / 1e9. */
+static volatile int g_ticks_from_tsc;
+static uint64_t g_tick_base;
+static uint64_t g_tick_base_ns;
+static volatile uint64_t g_ticks_seen;  /* keeps the count monotonic across CPUs */
+
 uint32_t get_pit_frequency(void) {
     return pit_hz;
 }
@@ -51,6 +68,7 @@ void timer_irq_handler(void) {
     in_timer_handler = 1;
     if (!apic_tick_enabled) {
         system_ticks++;
+        timer_run_expired(get_system_ticks());
     }
 
     // EOI is handled by irq_dispatch(); do not send PIC EOI here (breaks IOAPIC mode).
@@ -61,7 +79,35 @@ void timer_irq_handler(void) {
 }
 
 uint64_t get_system_ticks(void) {
-    return system_ticks;
+    if (!g_ticks_from_tsc) return system_ticks;
+
+    uint32_t hz = pit_hz ? pit_hz : 100;
+    uint64_t ns = sched_clock_ns() - g_tick_base_ns;
+    uint64_t t = g_tick_base + (ns / 1000000000ULL) * hz +
+                 ((ns % 1000000000ULL) * hz) / 1000000000ULL;
+
+    /* TSCs of different CPUs may be a little apart: never go backwards. */
+    uint64_t seen = __atomic_load_n(&g_ticks_seen, __ATOMIC_RELAXED);
+    while (t > seen) {
+        if (__atomic_compare_exchange_n(&g_ticks_seen, &seen, t, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return t;
+    }
+    return seen;
+}
+
+uint64_t timer_ns_until_tick(uint64_t tick) {
+    uint32_t hz = pit_hz ? pit_hz : 100;
+    uint64_t now = get_system_ticks();
+    if ((int64_t)(tick - now) <= 0) return 0;
+    if (!g_ticks_from_tsc) return (tick - now) * (1000000000ULL / hz);
+
+    /* Round up so the interrupt never lands just before the tick boundary. */
+    uint64_t d = tick - g_tick_base;
+    uint64_t at_ns = g_tick_base_ns + (d / hz) * 1000000000ULL +
+                     ((d % hz) * 1000000000ULL + hz - 1) / hz;
+    uint64_t cur = sched_clock_ns();
+    return at_ns > cur ? at_ns - cur : 0;
 }
 
 void timer_set_apic_enabled(int enabled) {
@@ -69,6 +115,113 @@ void timer_set_apic_enabled(int enabled) {
 }
 
 void timer_tick_from_apic(void) {
-    system_ticks++;
+    /* Every CPU's LAPIC timer lands here. Only the BSP advances the timebase,
+     * and only when the LAPIC (not the PIT) is its tick source. */
+    if (apic_tick_enabled && get_cpu_id() == 0) {
+        system_ticks++;
+        timer_run_expired(get_system_ticks());
+    }
     scheduler_tick();
-}
\ No newline at end of file
+}
+
+// Stop the BSP's periodic PIT tick and run it tickless like the APs: the
+// tick count comes from the TSC, and the scheduler arms the one-shot LAPIC
+// timer for the next wheel timer or slice end (sched_program_tick()). Needs
+// an invariant, calibrated TSC and the BSP's LAPIC.
+int timer_enter_nohz(void) {
+    if (!g_ticks_from_tsc) return -1;
+    if (get_cpu_id() != 0) return -1;
+    if (apic_timer_start_oneshot() != 0) return -1;
+
+    uint64_t f = irq_save();
+    pic_mask_irq(0);
+    if (ioapic_is_enabled()) (void)ioapic_mask_irq(0);
+    apic_tick_enabled = 1;
+    scheduler_set_nohz();
+    irq_restore(f);
+
+    com_write_string(COM1_PORT, "[TIMER] BSP tickless, PIT stopped\n");
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// TSC
+// ---------------------------------------------------------------------------
+
+void tsc_calibrate(void) {
+    if (g_tsc_khz) return;
+
+    uint64_t t0, t1, ns;
+    if (acpi_pm_timer_port()) {
+        /* 50 ms of the 3.579545 MHz PM timer; mask to 24 bits for the wrap. */
+        const uint32_t want = ACPI_PM_HZ / 20u;
+        uint32_t p0 = acpi_pm_timer_read() & 0x00FFFFFFu;
+        uint32_t el;
+        t0 = rdtsc();
+        do {
+            el = ((acpi_pm_timer_read() & 0x00FFFFFFu) - p0) & 0x00FFFFFFu;
+        } while (el < want);
+        t1 = rdtsc();
+        ns = ((uint64_t)el * 1000000000ULL) / ACPI_PM_HZ;
+    } else {
+        /* No PM timer: count the TSC across 50 ticks, if ticks are running. */
+        uint64_t rflags;
+        __asm__ volatile("pushfq; pop %0" : "=r"(rflags));
+        if (!(rflags & (1ULL << 9))) {
+            com_write_string(COM1_PORT, "[TIMER] TSC not calibrated (no PM timer, IRQs off)\n");
+            return;
+        }
+        uint64_t k = get_system_ticks();
+        while (get_system_ticks() == k) cpu_relax();
+        k = get_system_ticks();
+        t0 = rdtsc();
+        while (get_system_ticks() - k < 50) cpu_relax();
+        t1 = rdtsc();
+        ns = ticks_to_ms(50) * 1000000ULL;
+    }
+    if (t1 <= t0 || ns == 0) return;
+
+    uint64_t khz = ((t1 - t0) * 1000000ULL) / ns;
+    if (khz == 0) return;
+
+    /* Only an invariant TSC (CPUID 80000007h EDX[8]) keeps its rate across
+     * P/C-states; without it the TSC is no timebase and every CPU keeps its
+     * periodic tick. */
+    uint32_t a, b, c, d;
+    __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000000u), "c"(0));
+    int invariant = 0;
+    if (a >= 0x80000007u) {
+        __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000007u), "c"(0));
+        invariant = (d >> 8) & 1;
+    }
+    if (!invariant) {
+        com_printf(COM1_PORT, "[TIMER] TSC %llu kHz not invariant, keeping the periodic tick\n",
+                   (unsigned long long)khz);
+        return;
+    }
+
+    g_tsc_ns_mult = (1000000ULL << 32) / khz;
+    g_tsc_khz = khz;
+
+    /* Switch the tick count over to the TSC, continuing from where it is. */
+    uint64_t f = irq_save();
+    g_tick_base = system_ticks;
+    g_ticks_seen = g_tick_base;
+    g_tick_base_ns = sched_clock_ns();
+    g_ticks_from_tsc = 1;
+    irq_restore(f);
+
+    com_printf(COM1_PORT, "[TIMER] TSC %llu kHz (invariant)\n", (unsigned long long)khz);
+}
+
+uint64_t tsc_khz(void) {
+    return g_tsc_khz;
+}
+
+uint64_t sched_clock_ns(void) {
+    if (g_tsc_ns_mult) {
+        return (uint64_t)(((unsigned __int128)rdtsc() * g_tsc_ns_mult) >> 32);
+    }
+    uint32_t hz = pit_hz ? pit_hz : 100;
+    return system_ticks * (1000000000ULL / hz);
+}
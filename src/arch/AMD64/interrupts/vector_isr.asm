@@ -0,0 +1,92 @@
+; vector_isr.asm
+;
+; Entry stubs for the dynamically allocated vectors (irq_alloc_vector(), irq.c).
+; Each stub pushes its vector number and joins a common path that calls
+; irq_vector_dispatch(vector). irq_vector_stubs[] is indexed from
+; IRQ_VECTOR_FIRST; keep both bounds in sync with irq.h.
+
+%define IRQ_VECTOR_FIRST 0x30
+%define IRQ_VECTOR_LAST  0xEF
+
+extern irq_vector_dispatch
+
+global irq_vector_stubs
+
+section .text
+
+; Stack on entry to the common path:
+;   [rsp]      vector (pushed by the stub)
+;   [rsp + 8]  RIP
+;   [rsp + 16] CS
+;   ...
+; MSIs reach every CPU, including while it runs user code, so switch to the
+; kernel GS base when the interrupted CS is ring 3 (as apic_isr.asm does).
+irq_vector_common:
+    cld
+    test word [rsp + 16], 3
+    jz .from_kernel
+    swapgs
+.from_kernel:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    mov rdi, [rsp + 15*8]       ; vector
+    ; Align for the SysV call; rbx is callee-saved and holds the old RSP.
+    mov rbx, rsp
+    and rsp, -16
+    call irq_vector_dispatch
+    mov rsp, rbx
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 8                  ; drop the vector
+    test word [rsp + 8], 3
+    jz .to_kernel
+    swapgs
+.to_kernel:
+    iretq
+
+%macro VECTOR_STUB 1
+irq_vector_stub_%1:
+    push qword %1
+    jmp irq_vector_common
+%endmacro
+
+%assign vec IRQ_VECTOR_FIRST
+%rep IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1
+VECTOR_STUB vec
+%assign vec vec + 1
+%endrep
+
+section .data
+align 8
+irq_vector_stubs:
+%assign vec IRQ_VECTOR_FIRST
+%rep IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1
+    dq irq_vector_stub_%+vec
+%assign vec vec + 1
+%endrep
@@ -1,6 +1,7 @@
 ; context_switch_new.asm - Context switching for new process system
 ; void context_switch_asm(cpu_context_t *old_ctx, cpu_context_t *new_ctx,
-;                         void *old_fpu, void *new_fpu, uint64_t new_cr3)
+;                         void *old_fpu, void *new_fpu, uint64_t new_cr3,
+;                         volatile int *old_on_cpu)
 
 section .text
 global context_switch_asm
@@ -22,9 +23,7 @@ context_switch_asm:
     ; RDX = old_fpu (or NULL)
     ; RCX = new_fpu
     ; R8  = new_cr3 (or 0 if no switch needed)
-    
-    ; Save new_cr3 in R9 (not used by context_switch)
-    mov r9, r8
+    ; R9  = &old->on_cpu (or NULL); cleared once we are off the old stack
     
     ; Save current context if old_ctx is not NULL
     test rdi, rdi
@@ -88,11 +87,18 @@ context_switch_asm:
     push rdx
     popfq
 
-    ; Switch CR3 if needed (new_cr3 is in R9)
-    test r9, r9
+    ; Switch CR3 if needed (new_cr3 is in R8)
+    test r8, r8
     jz .no_cr3_switch
-    mov cr3, r9
+    mov cr3, r8
     
 .no_cr3_switch:
+    ; The old context is fully saved and its stack is no longer in use:
+    ; from here another CPU may pick it up.
+    test r9, r9
+    jz .no_on_cpu
+    mov dword [r9], 0
+
+.no_on_cpu:
     ; Jump to new RIP.
     jmp rax
@@ -12,12 +12,8 @@ extern void syscall64_entry(void);
    where the per-CPU GS base is mapped, even if the user CR3 doesn't include
    that mapping.  Written once during initialization. */
 uint64_t g_kernel_cr3;
-void amd64_syscall_init(void) {
-    /* record current CR3 (kernel page table) before we possibly switch to
-       user page tables; we'll use it on every syscall entry to return to a
-       known-good page table where kernel memory (including GS base) is mapped. */
-    __asm__ volatile("mov %%cr3, %0" : "=r"(g_kernel_cr3));
-
+/* EFER/STAR/LSTAR/FMASK are per-CPU MSRs: every AP programs its own copy. */
+void amd64_syscall_init_cpu(void) {
     /* Enable SYSCALL/SYSRET */
     uint64_t efer = rdmsr(MSR_IA32_EFER);
     efer |= EFER_SCE;
@@ -44,6 +40,15 @@ void amd64_syscall_init(void) {
 
     /* FMASK: clear IF (and TF) on entry. We'll re-enable as desired in kernel. */
     wrmsr(MSR_IA32_FMASK, 0x700);
+}
+
+void amd64_syscall_init(void) {
+    /* record current CR3 (kernel page table) before we possibly switch to
+       user page tables; we'll use it on every syscall entry to return to a
+       known-good page table where kernel memory (including GS base) is mapped. */
+    __asm__ volatile("mov %%cr3, %0" : "=r"(g_kernel_cr3));
+
+    amd64_syscall_init_cpu();
 
     COM_LOG_OK(COM1_PORT, "SYSCALL/SYSRET initialized");
 }
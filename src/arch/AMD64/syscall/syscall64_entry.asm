@@ -15,7 +15,6 @@
 bits 64
 
 extern syscall_handler
-extern g_syscall_entry_rbp
 extern g_kernel_cr3
 
 global syscall64_entry
@@ -57,9 +56,9 @@ syscall64_entry:
     push rbx
     push rax
 
-    ; Record frame base for sys_fork_impl.
+    ; Record frame base for sys_fork_impl (per-CPU: cpu_local_t.syscall_frame).
     mov rbp, rsp
-    mov [rel g_syscall_entry_rbp], rbp
+    mov [gs:80], rbp
 
     ; SysV ABI alignment.
     test rsp, 0xF
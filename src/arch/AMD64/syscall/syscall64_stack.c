@@ -9,15 +9,9 @@
  * We keep the TSS.rsp0 in sync as well (for interrupt/sysret transitions).
  */
 
-// Until SMP cpu-local storage is fully initialized (GS base, cpu_local_get()),
-// keep a single global syscall RSP0. The TSS RSP0 is still the authoritative value
-// used for privilege transitions.
-static uint64_t g_syscall_rsp0;
-
 void amd64_syscall_set_kernel_stack(uint64_t rsp0) {
     /* Reject non-canonical or user-range values */
     if ((rsp0 >> 48) != 0xFFFF || rsp0 < 0xFFFF800000000000ULL) return;
-    g_syscall_rsp0 = rsp0;
     amd64_tss_set_rsp0(rsp0);
     
     /* Update per-CPU structure for SYSCALL entry point */
@@ -39,5 +33,5 @@ void amd64_syscall_set_kernel_stack(uint64_t rsp0) {
 }
 
 uint64_t amd64_syscall_get_kernel_stack(void) {
-    return g_syscall_rsp0;
+    return cpu_local_get()->syscall_rsp0;
 }
@@ -2,9 +2,7 @@
 bits 64
 
 extern syscall_handler
-extern g_syscall_entry_rbp
 extern g_syscall_entry_rsp
-extern current
 
 global syscall_entry
 global syscall_entry_return
@@ -34,7 +32,7 @@ syscall_entry:
     push rax
 
     mov rbp, rsp
-    mov [rel g_syscall_entry_rbp], rbp
+    mov [gs:80], rbp            ; cpu_local_t.syscall_frame, read by sys_fork_impl
 
     ; Align stack (match SysV ABI for C call)
     test rsp, 0xF
@@ -27,13 +27,18 @@
 #include "moduos/arch/AMD64/interrupts/irq.h"
 #include "moduos/arch/AMD64/interrupts/timer.h"
 #include "moduos/kernel/interrupts/hlt_wait.h"
+#include "moduos/kernel/process/waitqueue.h"
 #include "moduos/kernel/mdinit.h"
 #include "moduos/kernel/multiboot2.h"
 #include <stdint.h>
 #include <stddef.h>
 
+_Static_assert(AHCI_MAX_SECTORS_PER_REQUEST == AHCI_MAX_SECTORS_PER_CMD_WORST,
+               "AHCI_MAX_SECTORS_PER_REQUEST must match the worst-case PRDT capacity");
+
 static ahci_controller_t ahci_controller;
 static int ahci_irq_line = -1;
+static int ahci_msi_vector = -1;
 static int ahci_force_poll = 0;
 
 static void ahci_irq_handler(void);
@@ -343,6 +348,398 @@ int ahci_port_rebase(hba_port_t *port, int portno) {
     return 0;
 }
 
+// ===========================================================================
+// Queued Command Submission
+// ===========================================================================
+
+/* Requests kept in flight by the blocking read/write wrappers */
+#define AHCI_SYNC_INFLIGHT 8
+
+static void ahci_clflush_range(const void *buf, uint32_t bytes) {
+    const uint8_t *p = (const uint8_t*)buf;
+    __asm__ volatile("mfence" ::: "memory");
+    for (uint32_t i = 0; i < bytes; i += 64) {
+        __asm__ volatile("clflush (%0)" :: "r"(p + i) : "memory");
+    }
+    __asm__ volatile("mfence" ::: "memory");
+}
+
+/* Caller holds pi->lock. Slot numbers double as NCQ tags, so stay below queue_depth. */
+static int ahci_claim_slot_locked(ahci_port_info_t *pi) {
+    uint32_t busy = pi->busy_slots | pi->port->ci | pi->port->sact;
+    for (int i = 0; i < pi->queue_depth; i++) {
+        if ((busy & (1u << i)) == 0) {
+            pi->busy_slots |= (1u << i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void ahci_release_slot(ahci_port_info_t *pi, int slot) {
+    uint64_t flags;
+    spinlock_lock_irqsave(&pi->lock, &flags);
+    pi->busy_slots &= ~(1u << slot);
+    spinlock_unlock_irqrestore(&pi->lock, flags);
+}
+
+/* Publish completion: callback first, then status (a waiter may free req after that). */
+static void ahci_finish_request(ahci_request_t *req, int status) {
+    if (status == 0 && !req->write) {
+        /* Same as the blocking path: make sure the CPU sees what DMA wrote. */
+        ahci_clflush_range(req->buffer, req->count * 512u);
+    }
+    if (req->done) req->done(req, status);
+    uint8_t port = req->port;
+    __atomic_store_n(&req->status, status, __ATOMIC_RELEASE);
+    wake_up_all(&ahci_controller.ports[port].done_wq);
+}
+
+/*
+ * Reap finished slots on one port. A slot is done once both its CI and SACT
+ * bits are clear (SACT is what NCQ commands complete on). Called from the IRQ
+ * handler and from pollers; callbacks run after the port lock is dropped.
+ */
+static void ahci_port_complete(ahci_port_info_t *pi, uint32_t pis) {
+    hba_port_t *port = pi->port;
+    ahci_request_t *fin[32];
+    int fin_status[32];
+    int n = 0;
+
+    uint64_t flags;
+    spinlock_lock_irqsave(&pi->lock, &flags);
+
+    uint32_t active = port->ci | port->sact;
+    uint32_t done = pi->last_ci & ~active;
+    uint32_t failed = 0;
+    if (pis & HBA_PxIS_TFES) {
+        /* The HBA stops on a task file error; everything still active is lost. */
+        failed = pi->last_ci & active;
+        pi->error_slots |= failed;
+        pi->needs_recovery = 1;
+    }
+    pi->completed_slots |= done;
+    pi->last_ci &= ~(done | failed);
+
+    uint32_t bits = done | failed;
+    for (int s = 0; bits && s < 32; s++) {
+        uint32_t bit = 1u << s;
+        if (!(bits & bit)) continue;
+        bits &= ~bit;
+        ahci_request_t *req = pi->slot_req[s];
+        if (!req) continue; /* blocking command: its waiter looks at completed/error_slots */
+        pi->slot_req[s] = NULL;
+        pi->completed_slots &= ~bit;
+        pi->error_slots &= ~bit;
+        if (!(failed & bit)) pi->busy_slots &= ~bit; /* failed slots stay busy until the reset */
+        fin[n] = req;
+        fin_status[n] = (failed & bit) ? -1 : 0;
+        n++;
+    }
+
+    spinlock_unlock_irqrestore(&pi->lock, flags);
+
+    for (int i = 0; i < n; i++) {
+        ahci_finish_request(fin[i], fin_status[i]);
+    }
+}
+
+/*
+ * After a task file error (or a timeout) the port is stopped, the link is
+ * reset (COMRESET clears the device's NCQ error state) and every command
+ * still outstanding is failed.
+ */
+static void ahci_port_recover(ahci_port_info_t *pi) {
+    hba_port_t *port = pi->port;
+    ahci_request_t *fin[32];
+    int n = 0;
+
+    uint64_t flags;
+    spinlock_lock_irqsave(&pi->lock, &flags);
+    if (pi->draining == 2) {
+        /* Another CPU is already resetting this port */
+        spinlock_unlock_irqrestore(&pi->lock, flags);
+        return;
+    }
+    uint8_t prev_draining = pi->draining;
+    pi->draining = 2;
+    for (int s = 0; s < 32; s++) {
+        if (pi->slot_req[s]) {
+            fin[n++] = pi->slot_req[s];
+            pi->slot_req[s] = NULL;
+        }
+    }
+    pi->error_slots |= pi->last_ci;
+    pi->last_ci = 0;
+    spinlock_unlock_irqrestore(&pi->lock, flags);
+
+    com_printf(COM1_PORT, "[AHCI] port %u: resetting after error (TFD=0x%08x SERR=0x%08x, %d request(s) failed)\n",
+               pi->port_num, port->tfd, port->serr, n);
+
+    ahci_stop_cmd(port);
+    port->sctl = (port->sctl & ~0xFu) | 1u;   /* DET=1: COMRESET */
+    ahci_usleep(1000);
+    port->sctl &= ~0xFu;
+    for (int i = 0; i < 100 && (port->ssts & HBA_PxSSTS_DET_MASK) != HBA_PxSSTS_DET_PRESENT; i++) {
+        ahci_usleep(1000);
+    }
+    port->serr = (uint32_t)-1;
+    port->is = (uint32_t)-1;
+    ahci_start_cmd(port);
+    (void)ahci_wait_tfd_clear(port, (0x80 | 0x08), 1000 /*ms*/);
+
+    spinlock_lock_irqsave(&pi->lock, &flags);
+    pi->busy_slots = 0;
+    pi->needs_recovery = 0;
+    pi->draining = prev_draining;
+    spinlock_unlock_irqrestore(&pi->lock, flags);
+
+    for (int i = 0; i < n; i++) {
+        ahci_finish_request(fin[i], -1);
+    }
+}
+
+void ahci_poll(uint8_t port_num) {
+    if (port_num >= AHCI_MAX_PORTS) return;
+    ahci_port_info_t *pi = &ahci_controller.ports[port_num];
+    hba_port_t *port = pi->port;
+    if (!port) return;
+
+    uint32_t pis = port->is;
+    if (pis) {
+        port->is = pis;
+        (void)port->is;
+    }
+    ahci_port_complete(pi, pis);
+}
+
+/* Fill the command FIS for a read/write, queued when the port runs NCQ. */
+static void ahci_setup_rw_fis(ahci_port_info_t *pi, hba_cmd_table_t *cmdtbl, int slot,
+                              uint64_t lba, uint32_t count, int write) {
+    fis_reg_h2d_t *cmdfis = (fis_reg_h2d_t*)(&cmdtbl->cfis);
+    for (size_t i = 0; i < sizeof(fis_reg_h2d_t); i++) ((uint8_t*)cmdfis)[i] = 0;
+
+    cmdfis->fis_type = FIS_TYPE_REG_H2D;
+    cmdfis->c = 1;
+    if (pi->ncq) {
+        cmdfis->command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+        cmdfis->featurel = (uint8_t)count;
+        cmdfis->featureh = (uint8_t)(count >> 8);
+        cmdfis->countl = (uint8_t)(slot << 3);  /* NCQ tag */
+    } else {
+        cmdfis->command = write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
+        cmdfis->countl = (uint8_t)count;
+        cmdfis->counth = (uint8_t)(count >> 8);
+    }
+    cmdfis->device = 1 << 6;  // LBA mode
+
+    cmdfis->lba0 = (uint8_t)lba;
+    cmdfis->lba1 = (uint8_t)(lba >> 8);
+    cmdfis->lba2 = (uint8_t)(lba >> 16);
+    cmdfis->lba3 = (uint8_t)(lba >> 24);
+    cmdfis->lba4 = (uint8_t)(lba >> 32);
+    cmdfis->lba5 = (uint8_t)(lba >> 40);
+}
+
+int ahci_submit(uint8_t port_num, ahci_request_t *req) {
+    if (!req) return -1;
+    req->status = -1;
+    req->slot = -1;
+    if (port_num >= AHCI_MAX_PORTS || !req->buffer || req->count == 0 ||
+        req->count > AHCI_MAX_SECTORS_PER_REQUEST)
+        return -1;
+
+    ahci_port_info_t *pi = &ahci_controller.ports[port_num];
+    hba_port_t *port = pi->port;
+    if (!port || pi->type != AHCI_DEV_SATA)
+        return -1;
+
+    const uint32_t bytes = req->count * 512u;
+    req->port = port_num;
+    req->status = AHCI_REQ_PENDING;
+
+    if (req->write) {
+        /* DMA reads data from RAM: push the write buffer out of the CPU cache. */
+        ahci_clflush_range(req->buffer, bytes);
+    }
+
+    /* Wait for a free slot; completions are reaped here too so this works without IRQs. */
+    const uint64_t start = get_system_ticks();
+    const uint64_t timeout_ticks = ms_to_ticks(5000);
+    uint64_t flags;
+    int slot;
+    for (;;) {
+        if (pi->needs_recovery) ahci_port_recover(pi);
+
+        spinlock_lock_irqsave(&pi->lock, &flags);
+        slot = pi->draining ? -1 : ahci_claim_slot_locked(pi);
+        if (slot >= 0) break;
+        spinlock_unlock_irqrestore(&pi->lock, flags);
+
+        ahci_poll(port_num);
+        if ((get_system_ticks() - start) >= timeout_ticks) {
+            COM_LOG_ERROR(COM1_PORT, "No free command slot");
+            req->status = -1;
+            return -1;
+        }
+        ahci_cpu_pause();
+    }
+
+    hba_cmd_header_t *cmdheader = &pi->cmd_list[slot];
+    cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
+    cmdheader->a = 0;
+    cmdheader->w = req->write ? 1 : 0;
+
+    hba_cmd_table_t *cmdtbl = pi->cmd_tables[slot];
+    uint16_t prdtl = 0;
+    if (ahci_build_prdt(cmdtbl, req->buffer, bytes, &prdtl) != 0) {
+        pi->busy_slots &= ~(1u << slot);
+        spinlock_unlock_irqrestore(&pi->lock, flags);
+        COM_LOG_ERROR(COM1_PORT, "Failed to build PRDT");
+        req->status = -1;
+        return -1;
+    }
+    cmdheader->prdtl = prdtl;
+    ahci_setup_rw_fis(pi, cmdtbl, slot, req->lba, req->count, req->write);
+
+    /* Flush command structures to RAM before the HBA fetches them. */
+    ahci_clflush_range(cmdtbl, sizeof(hba_cmd_table_t) + (prdtl * sizeof(hba_prdt_entry_t)));
+    ahci_clflush_range(cmdheader, sizeof(*cmdheader));
+
+    const uint32_t bit = 1u << slot;
+    req->slot = (int8_t)slot;
+    pi->slot_req[slot] = req;
+    pi->completed_slots &= ~bit;
+    pi->error_slots &= ~bit;
+    pi->last_ci |= bit;
+
+    /* NCQ: SACT must be set before CI */
+    if (pi->ncq) port->sact = bit;
+    port->ci = bit;
+    (void)port->ci;
+
+    spinlock_unlock_irqrestore(&pi->lock, flags);
+    return 0;
+}
+
+int ahci_wait(ahci_request_t *req, uint32_t timeout_ms) {
+    if (!req) return -1;
+    if (req->status != AHCI_REQ_PENDING) return req->status;
+
+    ahci_port_info_t *pi = &ahci_controller.ports[req->port];
+    const uint64_t start = get_system_ticks();
+    const uint64_t timeout_ticks = ms_to_ticks(timeout_ms);
+
+    uint32_t fallback_ms = timeout_ms;
+    uint64_t last_tick = start;
+    uint32_t stagnant_iters = 0;
+
+    for (;;) {
+        if (__atomic_load_n(&req->status, __ATOMIC_ACQUIRE) != AHCI_REQ_PENDING) break;
+
+        /* IRQs may not fire on some hypervisors: reap completions ourselves too. */
+        ahci_poll(req->port);
+        if (pi->needs_recovery) ahci_port_recover(pi);
+        if (__atomic_load_n(&req->status, __ATOMIC_ACQUIRE) != AHCI_REQ_PENDING) break;
+
+        const uint64_t now = get_system_ticks();
+        int expired = (now - start) >= timeout_ticks;
+
+        if (now == last_tick) {
+            stagnant_iters++;
+            if (stagnant_iters >= 50000u) {
+                stagnant_iters = 0;
+                if (fallback_ms == 0) expired = 1;
+                else fallback_ms--;
+                ahci_usleep(1000);
+            }
+        } else {
+            last_tick = now;
+            stagnant_iters = 0;
+        }
+
+        if (expired) {
+            com_printf(COM1_PORT, "[AHCI] port %u: request timeout (slot %d, CI=0x%08x SACT=0x%08x)\n",
+                       req->port, req->slot, pi->port->ci, pi->port->sact);
+            pi->needs_recovery = 1;
+            ahci_port_recover(pi);
+        }
+
+        ahci_cpu_pause();
+    }
+
+    return __atomic_load_n(&req->status, __ATOMIC_ACQUIRE);
+}
+
+/* Slice of a sleeping wait: completions that raise no IRQ (some hypervisors)
+ * are still reaped by polling this often. */
+#define AHCI_SLEEP_SLICE_MS 10u
+
+int ahci_wait_sleep(ahci_request_t *req, uint32_t timeout_ms) {
+    if (!req) return -1;
+    if (ahci_force_poll || (ahci_irq_line < 0 && ahci_msi_vector < 0) || !wait_can_block()) return ahci_wait(req, timeout_ms);
+
+    ahci_port_info_t *pi = &ahci_controller.ports[req->port];
+    const uint64_t deadline = get_system_ticks() + ms_to_ticks(timeout_ms);
+    const uint64_t slice = ms_to_ticks(AHCI_SLEEP_SLICE_MS) ? ms_to_ticks(AHCI_SLEEP_SLICE_MS) : 1;
+
+    while ((int64_t)(get_system_ticks() - deadline) < 0) {
+        wait_entry_t we;
+        prepare_to_wait(&pi->done_wq, &we, 0);
+        if (__atomic_load_n(&req->status, __ATOMIC_ACQUIRE) != AHCI_REQ_PENDING) {
+            finish_wait(&pi->done_wq, &we);
+            break;
+        }
+        uint64_t until = get_system_ticks() + slice;
+        if ((int64_t)(until - deadline) > 0) until = deadline;
+        schedule_until(until);
+        finish_wait(&pi->done_wq, &we);
+        ahci_poll(req->port);
+    }
+
+    /* Done, or out of time: ahci_wait() returns the status or runs recovery. */
+    return ahci_wait(req, 0);
+}
+
+/*
+ * Blocking read/write on top of ahci_submit(): the transfer is split into
+ * AHCI_MAX_SECTORS_PER_REQUEST chunks and up to AHCI_SYNC_INFLIGHT of them
+ * are kept queued at once.
+ */
+static int ahci_rw_blocking(uint8_t port_num, uint64_t lba, uint32_t count, uint8_t *buf, int write) {
+    ahci_request_t reqs[AHCI_SYNC_INFLIGHT];
+    uint32_t head = 0, tail = 0;
+    int rc = 0;
+
+    for (;;) {
+        while (count > 0 && rc == 0 && head - tail < AHCI_SYNC_INFLIGHT) {
+            ahci_request_t *r = &reqs[head % AHCI_SYNC_INFLIGHT];
+            uint32_t n = (count > AHCI_MAX_SECTORS_PER_REQUEST) ? AHCI_MAX_SECTORS_PER_REQUEST : count;
+            r->lba = lba;
+            r->count = n;
+            r->buffer = buf;
+            r->write = (uint8_t)write;
+            r->done = NULL;
+            r->ctx = NULL;
+            if (ahci_submit(port_num, r) != 0) {
+                rc = -1;
+                break;
+            }
+            head++;
+            lba += n;
+            buf += (size_t)n * 512u;
+            count -= n;
+        }
+
+        if (head == tail) break;
+        /* Always drain what was issued: the requests live on this stack frame. */
+        if (ahci_wait(&reqs[tail % AHCI_SYNC_INFLIGHT], 5000 /*ms*/) != 0) rc = -1;
+        tail++;
+    }
+
+    return rc;
+}
+
 static inline void cpu_hlt_once(void) {
     /* Ensure interrupts are enabled while halting.
      * This prevents deadlocks if called from code paths that might temporarily
@@ -377,18 +774,8 @@ static void ahci_irq_handler(void) {
         /* Posted read to ensure the write completes before continuing */
         (void)port->is;
 
-        uint32_t ci_now = port->ci;
-        uint32_t ci_prev = pi->last_ci;
-        uint32_t done = ci_prev & ~ci_now; /* 1->0 transitions */
-        if (done) {
-            pi->completed_slots |= done;
-        }
-        pi->last_ci = ci_now;
-
-        if (pis & HBA_PxIS_TFES) {
-            /* Mark all active slots as errored */
-            pi->error_slots |= ci_now;
-        }
+        /* Retire finished slots and run async completions */
+        ahci_port_complete(pi, pis);
     }
 
     /* Clear global HBA interrupt status (write-1-to-clear) */
@@ -400,6 +787,12 @@ static void ahci_irq_handler(void) {
     if (ahci_irq_line >= 0) pic_send_eoi((uint8_t)ahci_irq_line);
 }
 
+/* MSI entry: the vector is ours alone and the dispatcher sends the EOI. */
+static void ahci_msi_handler(void *ctx) {
+    (void)ctx;
+    ahci_irq_handler();
+}
+
 int ahci_find_cmdslot(hba_port_t *port) {
     // Find a free command slot
     uint32_t slots = (port->sact | port->ci);
@@ -713,6 +1106,19 @@ int ahci_identify_device(uint8_t port_num) {
     }
     
     port_info->sector_size = 512;  // Standard sector size
+
+    // NCQ: device word 76 bit 8, queue depth in word 75 (0-based); HBA CAP.SNCQ/NCS
+    uint32_t cap = ahci_controller.abar->cap;
+    uint32_t hba_slots = ((cap >> HBA_CAP_NCS_SHIFT) & 0x1F) + 1;
+    port_info->queue_depth = (uint8_t)hba_slots;
+    port_info->ncq = 0;
+    if ((cap & HBA_CAP_SNCQ) && (identify_buf[76] & (1 << 8))) {
+        uint32_t dev_depth = (identify_buf[75] & 0x1F) + 1;
+        port_info->ncq = 1;
+        port_info->queue_depth = (uint8_t)((dev_depth < hba_slots) ? dev_depth : hba_slots);
+    }
+    com_printf(COM1_PORT, "[AHCI] Port %d: %s, queue depth %u\n", port_num,
+               port_info->ncq ? "NCQ" : "no NCQ", port_info->queue_depth);
     
     kfree(identify_buf);
     return 0;
@@ -731,104 +1137,12 @@ int ahci_read_sectors(uint8_t port_num, uint64_t start_lba, uint32_t count, void
     
     if (!port || port_info->type != AHCI_DEV_SATA)
         return -1;
-    
-    /* Chunk large transfers to avoid overflowing the command table PRDT.
-     * Our cmd tables are sized for AHCI_PRDT_MAX_ENTRIES entries.
-     */
-    uint8_t *buf8 = (uint8_t*)buffer;
-    uint32_t remaining = count;
-
-    while (remaining > 0) {
-        /* Start optimistic for throughput, but fall back if the PRDT would overflow
-         * (e.g. physically fragmented caller buffers).
-         */
-        uint32_t this_count = (remaining > AHCI_MAX_SECTORS_PER_CMD) ? AHCI_MAX_SECTORS_PER_CMD : remaining;
-        if (this_count > AHCI_MAX_SECTORS_PER_CMD_WORST) this_count = AHCI_MAX_SECTORS_PER_CMD_WORST;
-
-        // Clear pending interrupts
-        port->is = (uint32_t)-1;
-
-        int slot = ahci_find_cmdslot(port);
-        if (slot == -1) {
-            COM_LOG_ERROR(COM1_PORT, "No free command slot");
-            return -1;
-        }
-
-        hba_cmd_header_t *cmdheader = &port_info->cmd_list[slot];
-        cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
-        cmdheader->w = 0;  // Read from device
-
-        hba_cmd_table_t *cmdtbl = port_info->cmd_tables[slot];
-
-        uint16_t prdtl = 0;
-        for (;;) {
-            const uint32_t bytes = this_count * 512u;
-            if (ahci_build_prdt(cmdtbl, buf8, bytes, &prdtl) == 0) break;
-
-            if (this_count <= 1) {
-                COM_LOG_ERROR(COM1_PORT, "Failed to build PRDT");
-                return -1;
-            }
-            this_count >>= 1;
-        }
-        cmdheader->prdtl = prdtl;
-
-        // Setup command FIS
-        fis_reg_h2d_t *cmdfis = (fis_reg_h2d_t*)(&cmdtbl->cfis);
-    
-    cmdfis->fis_type = FIS_TYPE_REG_H2D;
-    cmdfis->c = 1;  // Command
-    cmdfis->command = ATA_CMD_READ_DMA_EX;
-    
-    cmdfis->lba0 = (uint8_t)start_lba;
-    cmdfis->lba1 = (uint8_t)(start_lba >> 8);
-    cmdfis->lba2 = (uint8_t)(start_lba >> 16);
-    cmdfis->device = 1 << 6;  // LBA mode
-    
-    cmdfis->lba3 = (uint8_t)(start_lba >> 24);
-    cmdfis->lba4 = (uint8_t)(start_lba >> 32);
-    cmdfis->lba5 = (uint8_t)(start_lba >> 40);
-    
-    cmdfis->countl = (uint8_t)this_count;
-    cmdfis->counth = (uint8_t)(this_count >> 8);
-    
-    // Wait for port to be ready (BSY/DRQ clear)
-    if (ahci_wait_tfd_clear(port, (0x80 | 0x08), 500 /*ms*/) != 0) {
-        COM_LOG_ERROR(COM1_PORT, "Port hung");
-        return -1;
-    }
-
-    // Issue command
-    port->ci = 1u << slot;
-    ahci_controller.ports[port_num].last_ci |= (1u << slot);
-    
-    // Posted read to ensure command register write completes
-    (void)port->ci;
 
-    // Wait for completion
-    ahci_controller.ports[port_num].completed_slots &= ~(1u << slot);
-    ahci_controller.ports[port_num].error_slots &= ~(1u << slot);
-    if (ahci_wait_cmd_done(port_num, slot, 5000 /*ms*/) != 0) {
+    if (ahci_rw_blocking(port_num, start_lba, count, (uint8_t*)buffer, 0) != 0) {
         COM_LOG_ERROR(COM1_PORT, "Read command timeout/error");
         return -1;
     }
 
-    /* DMA writes bypass CPU cache. Flush cache to ensure CPU reads fresh data.
-     * Without this, the CPU might read stale cached data instead of the DMA-transferred data. */
-    __asm__ volatile("mfence" ::: "memory");
-    
-    /* Invalidate cache lines for the DMA buffer to force CPU to read from RAM */
-    for (uint32_t i = 0; i < this_count * 512u; i += 64) {
-        __asm__ volatile("clflush (%0)" :: "r"(buf8 + i) : "memory");
-    }
-    __asm__ volatile("mfence" ::: "memory");
-
-    /* Advance */
-    buf8 += (this_count * 512u);
-    start_lba += this_count;
-    remaining -= this_count;
-    }
-
     return 0;
 }
 
@@ -842,119 +1156,13 @@ int ahci_write_sectors(uint8_t port_num, uint64_t start_lba, uint32_t count, con
     if (!port || port_info->type != AHCI_DEV_SATA)
         return -1;
 
-    const uint8_t *buf8 = (const uint8_t*)buffer;
-    uint32_t remaining = count;
-
-    while (remaining > 0) {
-        /* Start optimistic for throughput, but fall back if the PRDT would overflow
-         * (e.g. physically fragmented caller buffers).
-         */
-        uint32_t this_count = (remaining > AHCI_MAX_SECTORS_PER_CMD) ? AHCI_MAX_SECTORS_PER_CMD : remaining;
-        if (this_count > AHCI_MAX_SECTORS_PER_CMD_WORST) this_count = AHCI_MAX_SECTORS_PER_CMD_WORST;
-
-        // Clear pending interrupts
-        port->is = (uint32_t)-1;
-
-        int slot = ahci_find_cmdslot(port);
-        if (slot == -1) {
-            COM_LOG_ERROR(COM1_PORT, "No free command slot");
-            return -1;
-        }
-
-        hba_cmd_header_t *cmdheader = &port_info->cmd_list[slot];
-        cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
-        cmdheader->w = 1;  // Write to device
-
-        hba_cmd_table_t *cmdtbl = port_info->cmd_tables[slot];
-
-        uint16_t prdtl = 0;
-        for (;;) {
-            const uint32_t bytes = this_count * 512u;
-            if (ahci_build_prdt(cmdtbl, buf8, bytes, &prdtl) == 0) break;
-
-            if (this_count <= 1) {
-                COM_LOG_ERROR(COM1_PORT, "Failed to build PRDT");
-                return -1;
-            }
-            this_count >>= 1;
-        }
-        cmdheader->prdtl = prdtl;
-
-        /* DMA reads data from RAM. Flush CPU cache to ensure data is visible to DMA.
-         * Without this, the DMA controller might read stale data from RAM while the
-         * fresh data sits in CPU cache. */
-        __asm__ volatile("mfence" ::: "memory");
-        
-        /* Flush cache lines for the write buffer to push data to RAM */
-        for (uint32_t i = 0; i < this_count * 512u; i += 64) {
-            __asm__ volatile("clflush (%0)" :: "r"(buf8 + i) : "memory");
-        }
-        __asm__ volatile("mfence" ::: "memory");
-
-        // Setup command FIS
-        fis_reg_h2d_t *cmdfis = (fis_reg_h2d_t*)(&cmdtbl->cfis);
-    
-    cmdfis->fis_type = FIS_TYPE_REG_H2D;
-    cmdfis->c = 1;
-    cmdfis->command = ATA_CMD_WRITE_DMA_EX;
-    
-    cmdfis->lba0 = (uint8_t)start_lba;
-    cmdfis->lba1 = (uint8_t)(start_lba >> 8);
-    cmdfis->lba2 = (uint8_t)(start_lba >> 16);
-    cmdfis->device = 1 << 6;
-    
-    cmdfis->lba3 = (uint8_t)(start_lba >> 24);
-    cmdfis->lba4 = (uint8_t)(start_lba >> 32);
-    cmdfis->lba5 = (uint8_t)(start_lba >> 40);
-    
-    cmdfis->countl = (uint8_t)this_count;
-    cmdfis->counth = (uint8_t)(this_count >> 8);
-    
-    /* Flush command structures to RAM before DMA reads them.
-     * The HBA needs to read the command FIS and PRDT from RAM. */
-    __asm__ volatile("mfence" ::: "memory");
-    
-    /* Flush command table (includes FIS and PRDT) */
-    for (uintptr_t addr = (uintptr_t)cmdtbl; addr < (uintptr_t)cmdtbl + sizeof(hba_cmd_table_t) + (prdtl * sizeof(hba_prdt_entry_t)); addr += 64) {
-        __asm__ volatile("clflush (%0)" :: "r"(addr) : "memory");
-    }
-    
-    /* Flush command header */
-    __asm__ volatile("clflush (%0)" :: "r"(cmdheader) : "memory");
-    
-    __asm__ volatile("mfence" ::: "memory");
-    
-    // Wait for port to be ready (BSY/DRQ clear)
-    if (ahci_wait_tfd_clear(port, (0x80 | 0x08), 500 /*ms*/) != 0) {
-        COM_LOG_ERROR(COM1_PORT, "Port hung");
-        return -1;
-    }
-
-    // Issue command
-    port->ci = 1u << slot;
-    ahci_controller.ports[port_num].last_ci |= (1u << slot);
-    
-    // Posted read to ensure command register write completes
-    (void)port->ci;
-
-    // Wait for completion
-    ahci_controller.ports[port_num].completed_slots &= ~(1u << slot);
-    ahci_controller.ports[port_num].error_slots &= ~(1u << slot);
-    if (ahci_wait_cmd_done(port_num, slot, 5000 /*ms*/) != 0) {
+    if (ahci_rw_blocking(port_num, start_lba, count, (uint8_t*)(uintptr_t)buffer, 1) != 0) {
         COM_LOG_ERROR(COM1_PORT, "Write command timeout/error");
         com_printf(COM1_PORT, "[AHCI] write fail: port %u CI=0x%08x TFD=0x%08x IS=0x%08x SERR=0x%08x\n",
                    port_num, port->ci, port->tfd, port->is, port->serr);
         return -1;
     }
 
-    com_printf(COM1_PORT, "[AHCI] write ok: port %u LBA=%llu count=%u\n",
-               port_num, (unsigned long long)start_lba, (unsigned)this_count);
-
-    buf8 += (this_count * 512u);
-    start_lba += this_count;
-    remaining -= this_count;
-    }
-
     return 0;
 }
 
@@ -968,15 +1176,37 @@ int ahci_flush_cache(uint8_t port_num) {
 
     com_printf(COM1_PORT, "[AHCI] flush: port %u issuing ATA FLUSH CACHE\n", port_num);
 
-    // Clear pending interrupts
-    port->is = (uint32_t)-1;
+    /* FLUSH CACHE is not a queued command: stop new submissions and let the
+     * NCQ commands already on the wire finish first. */
+    uint64_t flags;
+    spinlock_lock_irqsave(&port_info->lock, &flags);
+    port_info->draining = 1;
+    spinlock_unlock_irqrestore(&port_info->lock, flags);
 
-    int slot = ahci_find_cmdslot(port);
-    if (slot == -1) {
-        COM_LOG_ERROR(COM1_PORT, "No free command slot");
-        return -1;
+    int slot = -1;
+    const uint64_t start = get_system_ticks();
+    for (;;) {
+        ahci_poll(port_num);
+        if (port_info->needs_recovery) ahci_port_recover(port_info);
+
+        spinlock_lock_irqsave(&port_info->lock, &flags);
+        if (port_info->busy_slots == 0 && (port->ci | port->sact) == 0) {
+            slot = ahci_claim_slot_locked(port_info);
+        }
+        spinlock_unlock_irqrestore(&port_info->lock, flags);
+        if (slot >= 0) break;
+
+        if ((get_system_ticks() - start) >= ms_to_ticks(5000)) {
+            COM_LOG_ERROR(COM1_PORT, "No free command slot");
+            port_info->draining = 0;
+            return -1;
+        }
+        ahci_cpu_pause();
     }
 
+    // Clear pending interrupts
+    port->is = (uint32_t)-1;
+
     hba_cmd_header_t *cmdheader = &port_info->cmd_list[slot];
     cmdheader->cfl = sizeof(fis_reg_h2d_t) / sizeof(uint32_t);
     cmdheader->w = 0;  // Non-data command
@@ -985,39 +1215,36 @@ int ahci_flush_cache(uint8_t port_num) {
     hba_cmd_table_t *cmdtbl = port_info->cmd_tables[slot];
 
     fis_reg_h2d_t *cmdfis = (fis_reg_h2d_t*)(&cmdtbl->cfis);
+    for (size_t i = 0; i < sizeof(fis_reg_h2d_t); i++) ((uint8_t*)cmdfis)[i] = 0;
     cmdfis->fis_type = FIS_TYPE_REG_H2D;
     cmdfis->c = 1;
     /* Use FLUSH CACHE EXT (0xEA) to match the extended write commands.
      * Using legacy FLUSH CACHE (0xE7) with extended writes can cause data loss. */
     cmdfis->command = ATA_CMD_FLUSH_CACHE_EXT;
-
-    cmdfis->lba0 = 0;
-    cmdfis->lba1 = 0;
-    cmdfis->lba2 = 0;
     cmdfis->device = 1 << 6;
-    cmdfis->lba3 = 0;
-    cmdfis->lba4 = 0;
-    cmdfis->lba5 = 0;
-    cmdfis->countl = 0;
-    cmdfis->counth = 0;
 
+    int rc = 0;
     if (ahci_wait_tfd_clear(port, (0x80 | 0x08), 500 /*ms*/) != 0) {
         COM_LOG_ERROR(COM1_PORT, "Port hung");
-        return -1;
-    }
-
-    port->ci = 1u << slot;
-    ahci_controller.ports[port_num].last_ci |= (1u << slot);
-    (void)port->ci;
+        rc = -1;
+    } else {
+        spinlock_lock_irqsave(&port_info->lock, &flags);
+        port_info->completed_slots &= ~(1u << slot);
+        port_info->error_slots &= ~(1u << slot);
+        port_info->last_ci |= (1u << slot);
+        port->ci = 1u << slot;
+        (void)port->ci;
+        spinlock_unlock_irqrestore(&port_info->lock, flags);
 
-    ahci_controller.ports[port_num].completed_slots &= ~(1u << slot);
-    ahci_controller.ports[port_num].error_slots &= ~(1u << slot);
-    if (ahci_wait_cmd_done(port_num, slot, 5000 /*ms*/) != 0) {
-        COM_LOG_ERROR(COM1_PORT, "Flush cache timeout/error");
-        return -1;
+        if (ahci_wait_cmd_done(port_num, slot, 5000 /*ms*/) != 0) {
+            COM_LOG_ERROR(COM1_PORT, "Flush cache timeout/error");
+            rc = -1;
+        }
     }
 
-    return 0;
+    ahci_release_slot(port_info, slot);
+    port_info->draining = 0;
+    return rc;
 }
 
 // ===========================================================================
@@ -1120,6 +1347,10 @@ int ahci_probe_ports(void) {
                 ahci_controller.ports[i].last_ci = port->ci;
                 ahci_controller.ports[i].completed_slots = 0;
                 ahci_controller.ports[i].error_slots = 0;
+                spinlock_init(&ahci_controller.ports[i].lock);
+                ahci_controller.ports[i].ncq = 0;
+                ahci_controller.ports[i].queue_depth = 1;
+                ahci_controller.ports[i].busy_slots = 0;
                 
                 // Rebase port
                 if (ahci_port_rebase(port, i) == 0) {
@@ -1338,8 +1569,15 @@ int ahci_init(void) {
         ahci_irq_line = -1;
         ahci_controller.abar->ghc &= ~HBA_GHC_IE;
     } else {
-        // Install INTx IRQ handler (PIC) before enabling interrupts
-        if (pci_dev && pci_dev->interrupt_line < 16) {
+        // Prefer a dedicated MSI vector; otherwise install the INTx handler
+        // (PIC/IOAPIC line, possibly shared) before enabling interrupts.
+        if (pci_dev && pci_irq_vector_count(pci_dev) > 0)
+            ahci_msi_vector = pci_request_irq_vector(pci_dev, 0, ahci_msi_handler, NULL, "ahci");
+
+        if (ahci_msi_vector >= 0) {
+            ahci_irq_line = -1;
+            com_printf(COM1_PORT, "[AHCI] Using MSI vector 0x%x\n", ahci_msi_vector);
+        } else if (pci_dev && pci_dev->interrupt_line < 16) {
             ahci_irq_line = (int)pci_dev->interrupt_line;
             irq_install_handler(ahci_irq_line, ahci_irq_handler);
             com_printf(COM1_PORT, "[AHCI] Installed INTx handler on IRQ %d\n", ahci_irq_line);
@@ -1349,7 +1587,7 @@ int ahci_init(void) {
         }
 
         // Enable global interrupts only after all ports are ready
-        if (ahci_irq_line >= 0) {
+        if (ahci_irq_line >= 0 || ahci_msi_vector >= 0) {
             ahci_controller.abar->ghc |= HBA_GHC_IE;
             (void)ahci_controller.abar->ghc;
             com_write_string(COM1_PORT, "[AHCI] Global interrupts enabled\n");
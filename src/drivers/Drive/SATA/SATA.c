@@ -354,6 +354,51 @@ int sata_write(uint8_t port, uint64_t lba, uint32_t count, const void *buffer) {
     }
 }
 
+int sata_submit(uint8_t port, struct ahci_request *req) {
+    if (!sata_info.initialized) {
+        return SATA_ERR_NOT_INIT;
+    }
+    
+    if (port >= 32) {
+        return SATA_ERR_INVALID_PORT;
+    }
+    
+    sata_device_t *dev = &sata_info.devices[port];
+    
+    if (!dev->present || dev->type == SATA_TYPE_OPTICAL) {
+        device_last_error[port] = SATA_ERR_NO_DEVICE;
+        return SATA_ERR_NO_DEVICE;
+    }
+    
+    if (!req || req->buffer == NULL) {
+        device_last_error[port] = SATA_ERR_NULL_BUFFER;
+        return SATA_ERR_NULL_BUFFER;
+    }
+    
+    if (req->count == 0 || req->count > AHCI_MAX_SECTORS_PER_REQUEST) {
+        device_last_error[port] = SATA_ERR_INVALID_COUNT;
+        return SATA_ERR_INVALID_COUNT;
+    }
+    
+    if (req->lba >= dev->total_sectors || req->lba + req->count > dev->total_sectors) {
+        device_last_error[port] = SATA_ERR_INVALID_LBA;
+        return SATA_ERR_INVALID_LBA;
+    }
+    
+    if (ahci_submit(port, req) != 0) {
+        dev->errors++;
+        device_last_error[port] = req->write ? SATA_ERR_WRITE_FAILED : SATA_ERR_READ_FAILED;
+        return device_last_error[port];
+    }
+    
+    if (req->write) {
+        dev->writes_completed++;
+    } else {
+        dev->reads_completed++;
+    }
+    return SATA_SUCCESS;
+}
+
 int sata_read_sector(uint8_t port, uint64_t lba, void *buffer) {
     return sata_read(port, lba, 1, buffer);
 }
@@ -3,10 +3,15 @@
 #include "moduos/drivers/Drive/ATA/atapi.h"
 #include "moduos/drivers/Drive/SATA/SATA.h"
 #include "moduos/drivers/Drive/SATA/satapi.h"
+#include "moduos/drivers/Drive/SATA/AHCI.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/kernel/macros.h"
 #include "moduos/kernel/memory/memory.h"
 #include "moduos/drivers/graphics/VGA.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/process/process.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+#include "moduos/kernel/timer_wheel.h"
 #include <stddef.h>
 
 // freestanding: use kernel string/memory routines
@@ -36,124 +41,519 @@ static vdrive_system_t vdrive_system = {0};
 static int drive_last_error[VDRIVE_MAX_DRIVES] = {0};
 
 // ===========================================================================
-// vDrive Read Cache (per-drive, direct-mapped)
+// vDrive Block Cache (per-drive, set-associative, write-back)
 // ===========================================================================
+//
+// Each drive gets VDRIVE_CACHE_BYTES of 4 KiB lines arranged as
+// VDRIVE_CACHE_WAYS-way sets. A line tracks which of its sectors are valid
+// and which are dirty, so partial-block reads and writes never need a
+// read-modify-write. Writes stay in the cache until the line is evicted,
+// the drive is flushed, or the "vdrive-wb" thread finds it older than
+// VDRIVE_WB_AGE_MS. Sequential readers get a doubling read-ahead window.
+
+#define VDRIVE_CACHE_BYTES     (4 * 1024 * 1024) /* 4MiB per drive */
+#define VDRIVE_CACHE_BLOCK     4096              /* line size in bytes */
+#define VDRIVE_CACHE_WAYS      8
+#define VDRIVE_CACHE_BOUNCE    (128 * 1024)      /* per-drive miss/read-ahead buffer */
+#define VDRIVE_RA_MIN_SECTORS  16
+#define VDRIVE_RA_MAX_SECTORS  256
+#define VDRIVE_WRITE_THROUGH   (64 * 1024)       /* writes this large bypass write-back */
+#define VDRIVE_WB_AGE_MS       1000
+#define VDRIVE_WB_INTERVAL_MS  500
 
-#define VDRIVE_CACHE_BYTES   (4 * 1024 * 1024) /* 4MiB per drive */
+typedef struct {
+    uint64_t block;        /* lba / spb */
+    uint64_t last_use;     /* LRU stamp from vdrive_cache_t.clock */
+    uint64_t dirty_since;  /* ms timestamp of the first dirtying write */
+    uint8_t valid;         /* per-sector bitmask */
+    uint8_t dirty;         /* per-sector bitmask, subset of valid */
+} vdrive_cache_line_t;
 
 typedef struct {
+    spinlock_t lock;       /* held across the whole read/write, including device I/O */
     uint8_t inited;
     uint32_t sector_size;
-    uint32_t entries;
-    uint8_t *data;      /* entries * sector_size */
-    uint64_t *tags;     /* entries, stores LBA */
-    uint8_t *valid;     /* entries */
-    uint64_t hits;
-    uint64_t misses;
+    uint32_t spb;          /* sectors per line (1..8) */
+    uint32_t sets;         /* power of two */
+    uint32_t lines;
+    uint8_t *data;         /* lines * spb * sector_size */
+    vdrive_cache_line_t *meta;
+    uint8_t *bounce;
+    uint32_t bounce_sectors;
+    uint64_t clock;
+    uint64_t next_lba;     /* where a sequential reader will ask next */
+    uint32_t ra_window;    /* current read-ahead in sectors */
+    vdrive_cache_stats_t stats;
 } vdrive_cache_t;
 
 static vdrive_cache_t g_vdrive_cache[VDRIVE_MAX_DRIVES];
 
-static void vdrive_cache_init(uint8_t vdrive_id, uint32_t sector_size) {
-    if (vdrive_id >= VDRIVE_MAX_DRIVES) return;
-    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
+static inline uint64_t vdrive_now_ms(void) {
+    return ticks_to_ms(get_system_ticks());
+}
+
+/* Raw device read: returns 0, -1 on I/O failure or VDRIVE_ERR_BACKEND. */
+static int vdrive_dev_read(vdrive_t *drive, uint64_t lba, uint32_t count, void *buffer) {
+    int result;
+
+    // ========================================================================
+    // CRITICAL: Route based on SPECIFIC drive type first, then backend
+    // ========================================================================
+
+    if (drive->type == VDRIVE_TYPE_SATA_OPTICAL) {
+        // SATAPI - SATA optical drive with 2048-byte sectors
+        if (drive->backend != VDRIVE_BACKEND_SATA) {
+            com_write_string(COM1_PORT, "[vDrive] ERROR: SATAPI drive has wrong backend!\n");
+            return VDRIVE_ERR_BACKEND;
+        }
+
+        // IMPORTANT: SATAPI uses 2048-byte sectors, but the LBA and count 
+        // need to be converted if the caller is using 512-byte addressing
+        // For simplicity, assume caller is using 2048-byte addressing
+        result = satapi_read_blocks(drive->backend_id, (uint32_t)lba, count, buffer);
+        return (result == SATAPI_SUCCESS) ? 0 : -1;
+    }
+    else if (drive->type == VDRIVE_TYPE_ATA_ATAPI) {
+        // ATAPI - ATA optical drive with 2048-byte sectors
+        if (drive->backend != VDRIVE_BACKEND_ATA) {
+            com_write_string(COM1_PORT, "[vDrive] ERROR: ATAPI drive has wrong backend!\n");
+            return VDRIVE_ERR_BACKEND;
+        }
+
+        result = atapi_read_blocks_pio(drive->backend_id, (uint32_t)lba, count, buffer);
+        return (result == 0) ? 0 : -1;
+    }
+    else if (drive->backend == VDRIVE_BACKEND_SATA) {
+        // SATA hard drive or SSD with 512-byte sectors
+        result = sata_read(drive->backend_id, lba, count, buffer);
+        return (result == SATA_SUCCESS) ? 0 : -1;
+    }
+    else if (drive->backend == VDRIVE_BACKEND_ATA) {
+        // ATA hard drive with 512-byte sectors
+        result = ata_read_sectors(drive->backend_id, (uint32_t)lba, buffer, count);
+        return (result == 0) ? 0 : -1;
+    }
+
+    com_write_string(COM1_PORT, "[vDrive] ERROR: Unknown backend type!\n");
+    return VDRIVE_ERR_BACKEND;
+}
+
+/* Raw device write: returns 0, -1 on I/O failure or VDRIVE_ERR_BACKEND. */
+static int vdrive_dev_write(vdrive_t *drive, uint64_t lba, uint32_t count, const void *buffer) {
+    if (drive->backend == VDRIVE_BACKEND_SATA) {
+        int result = sata_write(drive->backend_id, lba, count, buffer);
+        return (result == SATA_SUCCESS) ? 0 : -1;
+    } else if (drive->backend == VDRIVE_BACKEND_ATA) {
+        const uint8_t *buf = (const uint8_t*)buffer;
+        for (uint32_t i = 0; i < count; i++) {
+            if (ata_write_sector_lba28(drive->backend_id, (uint32_t)(lba + i), buf + (i * 512)) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    return VDRIVE_ERR_BACKEND;
+}
+
+static void vdrive_cache_free(vdrive_cache_t *c) {
+    if (c->data) kfree(c->data);
+    if (c->meta) kfree(c->meta);
+    if (c->bounce) kfree(c->bounce);
+    c->data = NULL;
+    c->meta = NULL;
+    c->bounce = NULL;
+    c->inited = 0;
+}
 
+/* Caller holds c->lock. */
+static void vdrive_cache_init(vdrive_cache_t *c, uint32_t sector_size) {
     if (c->inited && c->sector_size == sector_size) return;
 
     /* Re-init if sector size changes (shouldn't happen) */
-    if (c->inited) {
-        if (c->data) kfree(c->data);
-        if (c->tags) kfree(c->tags);
-        if (c->valid) kfree(c->valid);
-        memset(c, 0, sizeof(*c));
-    }
+    if (c->inited) vdrive_cache_free(c);
 
     if (sector_size == 0) sector_size = 512;
-    uint32_t entries = (uint32_t)(VDRIVE_CACHE_BYTES / sector_size);
-    if (entries < 64) entries = 64;
-
-    c->sector_size = sector_size;
-    c->entries = entries;
-    c->data = (uint8_t*)kmalloc((size_t)entries * (size_t)sector_size);
-    c->tags = (uint64_t*)kmalloc((size_t)entries * sizeof(uint64_t));
-    c->valid = (uint8_t*)kmalloc((size_t)entries);
-
-    if (!c->data || !c->tags || !c->valid) {
-        if (c->data) kfree(c->data);
-        if (c->tags) kfree(c->tags);
-        if (c->valid) kfree(c->valid);
-        memset(c, 0, sizeof(*c));
+    uint32_t spb = (sector_size < VDRIVE_CACHE_BLOCK) ? (VDRIVE_CACHE_BLOCK / sector_size) : 1;
+    if (spb > 8) spb = 8;
+    uint32_t line_bytes = spb * sector_size;
+
+    uint32_t sets = 1;
+    while ((uint64_t)sets * 2 * VDRIVE_CACHE_WAYS * line_bytes <= VDRIVE_CACHE_BYTES) sets <<= 1;
+    uint32_t lines = sets * VDRIVE_CACHE_WAYS;
+
+    uint32_t bounce_sectors = VDRIVE_CACHE_BOUNCE / sector_size;
+    if (bounce_sectors < spb * 2) bounce_sectors = spb * 2;
+
+    c->data = (uint8_t*)kmalloc((size_t)lines * line_bytes);
+    c->meta = (vdrive_cache_line_t*)kmalloc((size_t)lines * sizeof(vdrive_cache_line_t));
+    c->bounce = (uint8_t*)kmalloc((size_t)bounce_sectors * sector_size);
+    if (!c->data || !c->meta || !c->bounce) {
+        vdrive_cache_free(c);
         return;
     }
 
-    memset(c->valid, 0, (size_t)entries);
+    memset(c->meta, 0, (size_t)lines * sizeof(vdrive_cache_line_t));
+    memset(&c->stats, 0, sizeof(c->stats));
+    c->sector_size = sector_size;
+    c->spb = spb;
+    c->sets = sets;
+    c->lines = lines;
+    c->bounce_sectors = bounce_sectors;
+    c->clock = 0;
+    c->next_lba = (uint64_t)-1;
+    c->ra_window = VDRIVE_RA_MIN_SECTORS;
     c->inited = 1;
 }
 
-static inline uint32_t vdrive_cache_index(const vdrive_cache_t *c, uint64_t lba) {
-    return (c->entries != 0) ? (uint32_t)(lba % (uint64_t)c->entries) : 0;
+static inline uint8_t *vdrive_line_data(vdrive_cache_t *c, vdrive_cache_line_t *l) {
+    return c->data + (size_t)(l - c->meta) * c->spb * c->sector_size;
 }
 
-static int vdrive_cache_get(uint8_t vdrive_id, uint64_t lba, void *out_sector) {
-    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
-    if (!c->inited) return 0;
+static inline vdrive_cache_line_t *vdrive_cache_set(vdrive_cache_t *c, uint64_t block) {
+    /* Fold higher bits in so strided layouts (FAT copies, inode tables) spread out. */
+    uint64_t h = block ^ (block >> 9) ^ (block >> 18);
+    return &c->meta[(size_t)(h & (c->sets - 1)) * VDRIVE_CACHE_WAYS];
+}
+
+static vdrive_cache_line_t *vdrive_cache_lookup(vdrive_cache_t *c, uint64_t block) {
+    vdrive_cache_line_t *set = vdrive_cache_set(c, block);
+    for (int w = 0; w < VDRIVE_CACHE_WAYS; w++) {
+        if (set[w].valid && set[w].block == block) return &set[w];
+    }
+    return NULL;
+}
+
+/* Write every dirty run of a line back to the device. Caller holds c->lock. */
+static int vdrive_cache_writeback_line(vdrive_t *drive, vdrive_cache_t *c, vdrive_cache_line_t *l) {
+    if (!l->dirty) return 0;
+
+    uint8_t *data = vdrive_line_data(c, l);
+    uint64_t base = l->block * c->spb;
+    uint32_t s = 0;
+    while (s < c->spb) {
+        if (!(l->dirty & (1u << s))) { s++; continue; }
+        uint32_t e = s;
+        while (e < c->spb && (l->dirty & (1u << e))) e++;
+        if (vdrive_dev_write(drive, base + s, e - s, data + (size_t)s * c->sector_size) != 0) {
+            drive->errors++;
+            com_printf(COM1_PORT, "[vDrive] writeback failed: vdrive %u lba %u\n",
+                       drive->vdrive_id, (uint32_t)(base + s));
+            return -1;
+        }
+        s = e;
+    }
+    l->dirty = 0;
+    l->dirty_since = 0;
+    c->stats.writebacks++;
+    return 0;
+}
 
-    uint32_t idx = vdrive_cache_index(c, lba);
-    if (!c->valid[idx] || c->tags[idx] != lba) {
-        c->misses++;
+/* Pick the LRU way for `block`, writing back a dirty victim first. NULL if that fails. */
+static vdrive_cache_line_t *vdrive_cache_alloc(vdrive_t *drive, vdrive_cache_t *c, uint64_t block) {
+    vdrive_cache_line_t *set = vdrive_cache_set(c, block);
+    vdrive_cache_line_t *victim = NULL;
+    for (int w = 0; w < VDRIVE_CACHE_WAYS; w++) {
+        if (!set[w].valid) { victim = &set[w]; break; }
+        if (!victim || set[w].last_use < victim->last_use) victim = &set[w];
+    }
+
+    if (victim->valid) {
+        if (vdrive_cache_writeback_line(drive, c, victim) != 0) return NULL;
+        c->stats.evictions++;
+    }
+    victim->block = block;
+    victim->valid = 0;
+    victim->dirty = 0;
+    victim->dirty_since = 0;
+    return victim;
+}
+
+/* Insert one sector. Clean fills never overwrite a sector that is already cached. */
+static int vdrive_cache_store(vdrive_t *drive, vdrive_cache_t *c, uint64_t lba, const void *src, int dirty) {
+    uint64_t block = lba / c->spb;
+    uint32_t bit = 1u << (uint32_t)(lba % c->spb);
+
+    vdrive_cache_line_t *l = vdrive_cache_lookup(c, block);
+    if (!l) {
+        l = vdrive_cache_alloc(drive, c, block);
+        if (!l) return -1;
+    } else if (!dirty && (l->valid & bit)) {
         return 0;
     }
 
-    memcpy(out_sector, c->data + ((size_t)idx * (size_t)c->sector_size), c->sector_size);
-    c->hits++;
-    return 1;
+    memcpy(vdrive_line_data(c, l) + (size_t)(lba % c->spb) * c->sector_size, src, c->sector_size);
+    l->valid |= bit;
+    if (dirty) {
+        if (!l->dirty) l->dirty_since = vdrive_now_ms();
+        l->dirty |= bit;
+    }
+    l->last_use = ++c->clock;
+    return 0;
 }
 
-static void vdrive_cache_put(uint8_t vdrive_id, uint64_t lba, const void *sector) {
-    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
-    if (!c->inited) return;
+static int vdrive_cache_sync_locked(vdrive_t *drive, vdrive_cache_t *c) {
+    int rc = 0;
+    if (!c->inited) return 0;
+    for (uint32_t i = 0; i < c->lines; i++) {
+        if (c->meta[i].dirty && vdrive_cache_writeback_line(drive, c, &c->meta[i]) != 0) rc = -1;
+    }
+    return rc;
+}
 
-    uint32_t idx = vdrive_cache_index(c, lba);
-    memcpy(c->data + ((size_t)idx * (size_t)c->sector_size), sector, c->sector_size);
-    c->tags[idx] = lba;
-    c->valid[idx] = 1;
+/*
+ * Cached read. Hits are copied out sector by sector; each run of misses is
+ * widened to line boundaries (plus read-ahead when the caller is streaming)
+ * and fetched with a single device request through the bounce buffer.
+ */
+static int vdrive_cache_read(vdrive_t *drive, vdrive_cache_t *c, uint64_t lba, uint32_t count, uint8_t *out) {
+    uint32_t ss = c->sector_size;
+    uint64_t limit = drive->total_sectors;
+
+    if (lba == c->next_lba) {
+        c->ra_window = (c->ra_window * 2 > VDRIVE_RA_MAX_SECTORS) ? VDRIVE_RA_MAX_SECTORS : c->ra_window * 2;
+    } else {
+        c->ra_window = VDRIVE_RA_MIN_SECTORS;
+    }
+    int sequential = (lba == c->next_lba);
+    c->next_lba = lba + count;
+
+    uint32_t i = 0;
+    while (i < count) {
+        uint64_t cur = lba + i;
+        vdrive_cache_line_t *l = vdrive_cache_lookup(c, cur / c->spb);
+        if (l && (l->valid & (1u << (uint32_t)(cur % c->spb)))) {
+            memcpy(out + (size_t)i * ss, vdrive_line_data(c, l) + (size_t)(cur % c->spb) * ss, ss);
+            l->last_use = ++c->clock;
+            c->stats.hits++;
+            i++;
+            continue;
+        }
+
+        uint32_t j = i + 1;
+        while (j < count) {
+            uint64_t n = lba + j;
+            vdrive_cache_line_t *nl = vdrive_cache_lookup(c, n / c->spb);
+            if (nl && (nl->valid & (1u << (uint32_t)(n % c->spb)))) break;
+            j++;
+        }
+        c->stats.misses += j - i;
+
+        uint64_t want_end = lba + j;
+        uint64_t start = cur - (cur % c->spb);
+        uint64_t end = want_end + (c->spb - 1);
+        end -= end % c->spb;
+        if (sequential) {
+            end += c->ra_window;
+            end -= end % c->spb;
+        }
+        if (limit && end > limit) end = limit;
+        if (end - start > c->bounce_sectors) end = start + c->bounce_sectors;
+
+        int rc = -1;
+        if (end >= want_end) {
+            rc = vdrive_dev_read(drive, start, (uint32_t)(end - start), c->bounce);
+            if (rc == VDRIVE_ERR_BACKEND) return rc;
+        }
+
+        if (rc == 0) {
+            for (uint64_t s = start; s < end; s++) {
+                vdrive_cache_store(drive, c, s, c->bounce + (size_t)(s - start) * ss, 0);
+            }
+            if (end > want_end) c->stats.readahead += end - want_end;
+            memcpy(out + (size_t)i * ss, c->bounce + (size_t)(cur - start) * ss, (size_t)(j - i) * ss);
+        } else {
+            /* Too large for the bounce buffer, or the widened read ran off the media. */
+            rc = vdrive_dev_read(drive, cur, j - i, out + (size_t)i * ss);
+            if (rc != 0) return rc;
+            for (uint32_t k = i; k < j; k++) {
+                vdrive_cache_store(drive, c, lba + k, out + (size_t)k * ss, 0);
+            }
+        }
+        i = j;
+    }
+    return 0;
 }
 
-static void vdrive_cache_invalidate_range(uint8_t vdrive_id, uint64_t lba, uint32_t count) {
-    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
-    if (!c->inited) return;
+/*
+ * Cached write. Small writes are absorbed as dirty sectors; large ones go
+ * straight to the device and just refresh any copies already in the cache.
+ */
+static int vdrive_cache_write(vdrive_t *drive, vdrive_cache_t *c, uint64_t lba, uint32_t count, const uint8_t *in) {
+    uint32_t ss = c->sector_size;
+
+    if ((uint64_t)count * ss >= VDRIVE_WRITE_THROUGH) {
+        int rc = vdrive_dev_write(drive, lba, count, in);
+        if (rc != 0) return rc;
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t cur = lba + i;
+            vdrive_cache_line_t *l = vdrive_cache_lookup(c, cur / c->spb);
+            uint32_t bit = 1u << (uint32_t)(cur % c->spb);
+            if (!l || !(l->valid & bit)) continue;
+            memcpy(vdrive_line_data(c, l) + (size_t)(cur % c->spb) * ss, in + (size_t)i * ss, ss);
+            l->dirty &= (uint8_t)~bit;
+            if (!l->dirty) l->dirty_since = 0;
+        }
+        return 0;
+    }
 
     for (uint32_t i = 0; i < count; i++) {
-        uint64_t cur = lba + i;
-        uint32_t idx = vdrive_cache_index(c, cur);
-        if (c->valid[idx] && c->tags[idx] == cur) {
-            c->valid[idx] = 0;
+        if (vdrive_cache_store(drive, c, lba + i, in + (size_t)i * ss, 1) != 0) {
+            /* Could not make room (victim writeback failed): write this sector through. */
+            int rc = vdrive_dev_write(drive, lba + i, 1, in + (size_t)i * ss);
+            if (rc != 0) return rc;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Async requests bypass the cache. Before one is issued, dirty sectors it
+ * would read are written back, and cached copies of sectors it overwrites
+ * are dropped.
+ */
+static void vdrive_cache_prepare_async(vdrive_t *drive, vdrive_cache_t *c, uint64_t lba, uint32_t count, int write) {
+    if (!c->inited) return;
+
+    uint64_t end = lba + count;
+    for (uint64_t block = lba / c->spb; block * c->spb < end; block++) {
+        vdrive_cache_line_t *l = vdrive_cache_lookup(c, block);
+        if (!l) continue;
+
+        uint32_t mask = 0;
+        for (uint32_t s = 0; s < c->spb; s++) {
+            uint64_t cur = block * c->spb + s;
+            if (cur >= lba && cur < end) mask |= 1u << s;
+        }
+
+        if (!write) {
+            if (l->dirty & mask) vdrive_cache_writeback_line(drive, c, l);
+        } else {
+            l->valid &= (uint8_t)~mask;
+            l->dirty &= (uint8_t)~mask;
+            if (!l->dirty) l->dirty_since = 0;
         }
     }
+    c->next_lba = (uint64_t)-1;
+}
+
+int vdrive_cache_sync(uint8_t vdrive_id) {
+    vdrive_t *drive = vdrive_get(vdrive_id);
+    if (!drive) return VDRIVE_ERR_NO_DRIVE;
+
+    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
+    spinlock_lock(&c->lock);
+    int rc = vdrive_cache_sync_locked(drive, c);
+    spinlock_unlock(&c->lock);
+    return (rc == 0) ? VDRIVE_SUCCESS : VDRIVE_ERR_WRITE_FAILED;
 }
 
 void vdrive_cache_invalidate_all(uint8_t vdrive_id) {
     if (vdrive_id >= VDRIVE_MAX_DRIVES) return;
     
     vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
+    spinlock_lock(&c->lock);
     if (!c->inited) {
         /* Cache not initialized yet - nothing to invalidate */
+        spinlock_unlock(&c->lock);
         com_printf(COM1_PORT, "[vDrive] cache_invalidate_all: vdrive %u cache not initialized\n", vdrive_id);
         return;
     }
     
-    com_printf(COM1_PORT, "[vDrive] cache_invalidate_all: vdrive %u invalidating %u entries\n", 
-               vdrive_id, c->entries);
+    com_printf(COM1_PORT, "[vDrive] cache_invalidate_all: vdrive %u invalidating %u lines\n", 
+               vdrive_id, c->lines);
+
+    /* Dirty data must reach the disk before the lines are dropped */
+    vdrive_t *drive = vdrive_get(vdrive_id);
+    if (drive && vdrive_cache_sync_locked(drive, c) != 0) {
+        com_printf(COM1_PORT, "[vDrive] cache_invalidate_all: vdrive %u lost dirty sectors\n", vdrive_id);
+    }
     
     /* Invalidate all cache entries for this drive */
-    memset(c->valid, 0, (size_t)c->entries);
-    
-    /* Also zero out the data to ensure no stale data remains */
-    if (c->data) {
-        memset(c->data, 0, (size_t)c->entries * (size_t)c->sector_size);
+    memset(c->meta, 0, (size_t)c->lines * sizeof(vdrive_cache_line_t));
+    c->next_lba = (uint64_t)-1;
+    spinlock_unlock(&c->lock);
+}
+
+int vdrive_cache_get_stats(uint8_t vdrive_id, vdrive_cache_stats_t *out) {
+    if (vdrive_id >= VDRIVE_MAX_DRIVES || !out) return VDRIVE_ERR_INVALID_ID;
+
+    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
+    spinlock_lock(&c->lock);
+    if (!c->inited) {
+        spinlock_unlock(&c->lock);
+        return VDRIVE_ERR_NOT_INIT;
+    }
+    *out = c->stats;
+    out->lines = c->lines;
+    out->ways = VDRIVE_CACHE_WAYS;
+    out->valid_lines = 0;
+    out->dirty_lines = 0;
+    for (uint32_t i = 0; i < c->lines; i++) {
+        if (c->meta[i].valid) out->valid_lines++;
+        if (c->meta[i].dirty) out->dirty_lines++;
+    }
+    spinlock_unlock(&c->lock);
+    return VDRIVE_SUCCESS;
+}
+
+/* Background writeback: flush lines that have been dirty for VDRIVE_WB_AGE_MS. */
+static void vdrive_writeback_aged(uint64_t now) {
+    for (int i = 0; i < VDRIVE_MAX_DRIVES; i++) {
+        vdrive_cache_t *c = &g_vdrive_cache[i];
+        if (!c->inited || !vdrive_is_ready((uint8_t)i)) continue;
+        /* Never stall behind a foreground request; retry on the next pass. */
+        if (!spinlock_trylock(&c->lock)) continue;
+        vdrive_t *drive = vdrive_get((uint8_t)i);
+        for (uint32_t k = 0; drive && c->inited && k < c->lines; k++) {
+            vdrive_cache_line_t *l = &c->meta[k];
+            if (l->dirty && now - l->dirty_since >= VDRIVE_WB_AGE_MS) {
+                vdrive_cache_writeback_line(drive, c, l);
+            }
+        }
+        spinlock_unlock(&c->lock);
+    }
+}
+
+static vdrive_wb_hook_t g_wb_hooks[VDRIVE_WB_HOOKS];
+
+int vdrive_register_writeback_hook(vdrive_wb_hook_t fn) {
+    if (!fn) return -1;
+    for (int i = 0; i < VDRIVE_WB_HOOKS; i++) {
+        if (__atomic_load_n(&g_wb_hooks[i], __ATOMIC_ACQUIRE) == fn) return 0;
+    }
+    for (int i = 0; i < VDRIVE_WB_HOOKS; i++) {
+        vdrive_wb_hook_t none = NULL;
+        if (__atomic_compare_exchange_n(&g_wb_hooks[i], &none, fn, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return 0;
+        if (none == fn) return 0;
+    }
+    return -1;
+}
+
+static void vdrive_writeback_thread(void) {
+    for (;;) {
+        uint64_t now = vdrive_now_ms();
+        for (int i = 0; i < VDRIVE_WB_HOOKS; i++) {
+            vdrive_wb_hook_t fn = __atomic_load_n(&g_wb_hooks[i], __ATOMIC_ACQUIRE);
+            if (fn) fn(now);
+        }
+        vdrive_writeback_aged(now);
+        sleep_ms(VDRIVE_WB_INTERVAL_MS);
     }
 }
 
+void vdrive_cache_start_writeback(void) {
+    static int started = 0;
+    if (started) return;
+
+    process_t *p = process_create("vdrive-wb", vdrive_writeback_thread, 5);
+    if (!p) {
+        com_write_string(COM1_PORT, "[vDrive] failed to start writeback thread; dirty data is flushed on sync only\n");
+        return;
+    }
+    started = 1;
+    com_printf(COM1_PORT, "[vDrive] writeback thread started (pid %u)\n", p->pid);
+}
+
 // ===========================================================================
 // Helper Functions
 // ===========================================================================
@@ -497,6 +897,13 @@ void vdrive_shutdown(void) {
 
 int vdrive_rescan(void) {
     COM_LOG_INFO(COM1_PORT, "Rescanning drives");
+
+    /* Drive IDs may be reassigned: write back and drop every cache first */
+    if (vdrive_system.initialized) {
+        for (int i = 0; i < VDRIVE_MAX_DRIVES; i++) {
+            if (g_vdrive_cache[i].inited) vdrive_cache_invalidate_all((uint8_t)i);
+        }
+    }
     sata_rescan();
     return vdrive_init();
 }
@@ -620,79 +1027,28 @@ int vdrive_read(uint8_t vdrive_id, uint64_t lba, uint32_t count, void *buffer) {
         return VDRIVE_ERR_NULL_BUFFER;
     }
 
-    /* Ensure cache initialized for this drive */
-    vdrive_cache_init(vdrive_id, drive->sector_size);
-
-    /* Fast path: cached single-sector reads */
-    if (count == 1) {
-        if (vdrive_cache_get(vdrive_id, lba, buffer)) {
-            drive->reads++;
-            drive->status = VDRIVE_STATUS_READY;
-            drive_last_error[vdrive_id] = VDRIVE_SUCCESS;
-            return VDRIVE_SUCCESS;
-        }
-    }
-    
-    int result = -1;
+    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
     drive->status = VDRIVE_STATUS_BUSY;
-    
-    // ========================================================================
-    // CRITICAL: Route based on SPECIFIC drive type first, then backend
-    // ========================================================================
-    
-    if (drive->type == VDRIVE_TYPE_SATA_OPTICAL) {
-        // SATAPI - SATA optical drive with 2048-byte sectors
-        
-        if (drive->backend != VDRIVE_BACKEND_SATA) {
-            com_write_string(COM1_PORT, "[vDrive] ERROR: SATAPI drive has wrong backend!\n");
-            drive->status = VDRIVE_STATUS_ERROR;
-            drive_last_error[vdrive_id] = VDRIVE_ERR_BACKEND;
-            return VDRIVE_ERR_BACKEND;
-        }
-        
-        // IMPORTANT: SATAPI uses 2048-byte sectors, but the LBA and count 
-        // need to be converted if the caller is using 512-byte addressing
-        // For simplicity, assume caller is using 2048-byte addressing
-        result = satapi_read_blocks(drive->backend_id, (uint32_t)lba, count, buffer);
-        result = (result == SATAPI_SUCCESS) ? 0 : -1;
-    }
-    else if (drive->type == VDRIVE_TYPE_ATA_ATAPI) {
-        // ATAPI - ATA optical drive with 2048-byte sectors
-        
-        if (drive->backend != VDRIVE_BACKEND_ATA) {
-            com_write_string(COM1_PORT, "[vDrive] ERROR: ATAPI drive has wrong backend!\n");
-            drive->status = VDRIVE_STATUS_ERROR;
-            drive_last_error[vdrive_id] = VDRIVE_ERR_BACKEND;
-            return VDRIVE_ERR_BACKEND;
-        }
-        
-        result = atapi_read_blocks_pio(drive->backend_id, (uint32_t)lba, count, buffer);
-    }
-    else if (drive->backend == VDRIVE_BACKEND_SATA) {
-        // SATA hard drive or SSD with 512-byte sectors
-        result = sata_read(drive->backend_id, lba, count, buffer);
-        result = (result == SATA_SUCCESS) ? 0 : -1;
-    }
-    else if (drive->backend == VDRIVE_BACKEND_ATA) {
-        // ATA hard drive with 512-byte sectors
-        result = ata_read_sectors(drive->backend_id, (uint32_t)lba, buffer, count);
+
+    spinlock_lock(&c->lock);
+    /* Ensure cache initialized for this drive */
+    vdrive_cache_init(c, drive->sector_size);
+    int result;
+    if (c->inited) {
+        result = vdrive_cache_read(drive, c, lba, count, (uint8_t*)buffer);
+    } else {
+        /* No memory for a cache: go straight to the device */
+        result = vdrive_dev_read(drive, lba, count, buffer);
     }
-    else {
-        com_write_string(COM1_PORT, "[vDrive] ERROR: Unknown backend type!\n");
+    spinlock_unlock(&c->lock);
+
+    if (result == VDRIVE_ERR_BACKEND) {
         drive->status = VDRIVE_STATUS_ERROR;
         drive_last_error[vdrive_id] = VDRIVE_ERR_BACKEND;
         return VDRIVE_ERR_BACKEND;
     }
     
     if (result == 0) {
-        /* Populate cache with what we just read */
-        if (buffer) {
-            uint8_t *b = (uint8_t*)buffer;
-            for (uint32_t i = 0; i < count; i++) {
-                vdrive_cache_put(vdrive_id, lba + i, b + ((size_t)i * (size_t)drive->sector_size));
-            }
-        }
-
         drive->reads++;
         drive->status = VDRIVE_STATUS_READY;
         drive_last_error[vdrive_id] = VDRIVE_SUCCESS;
@@ -735,27 +1091,21 @@ int vdrive_write(uint8_t vdrive_id, uint64_t lba, uint32_t count, const void *bu
         return VDRIVE_ERR_NULL_BUFFER;
     }
 
-    /* Ensure cache initialized for this drive */
-    vdrive_cache_init(vdrive_id, drive->sector_size);
-
-    /* Writes invalidate cached sectors */
-    vdrive_cache_invalidate_range(vdrive_id, lba, count);
-    
-    int result = -1;
+    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
     drive->status = VDRIVE_STATUS_BUSY;
-    
-    if (drive->backend == VDRIVE_BACKEND_SATA) {
-        result = sata_write(drive->backend_id, lba, count, buffer);
-        result = (result == SATA_SUCCESS) ? 0 : -1;
-    } else if (drive->backend == VDRIVE_BACKEND_ATA) {
-        const uint8_t *buf = (const uint8_t*)buffer;
-        for (uint32_t i = 0; i < count; i++) {
-            result = ata_write_sector_lba28(drive->backend_id, (uint32_t)(lba + i), buf + (i * 512));
-            if (result != 0) {
-                break;
-            }
-        }
+
+    spinlock_lock(&c->lock);
+    /* Ensure cache initialized for this drive */
+    vdrive_cache_init(c, drive->sector_size);
+    int result;
+    if (c->inited) {
+        result = vdrive_cache_write(drive, c, lba, count, (const uint8_t*)buffer);
     } else {
+        result = vdrive_dev_write(drive, lba, count, buffer);
+    }
+    spinlock_unlock(&c->lock);
+
+    if (result == VDRIVE_ERR_BACKEND) {
         drive->status = VDRIVE_STATUS_ERROR;
         drive_last_error[vdrive_id] = VDRIVE_ERR_BACKEND;
         return VDRIVE_ERR_BACKEND;
@@ -782,6 +1132,144 @@ int vdrive_write_sector(uint8_t vdrive_id, uint64_t lba, const void *buffer) {
     return vdrive_write(vdrive_id, lba, 1, buffer);
 }
 
+// ===========================================================================
+// Asynchronous I/O
+// ===========================================================================
+
+static void vdrive_async_finish(vdrive_request_t *req) {
+    int status = req->error;
+    if (req->done) req->done(req, status);
+    __atomic_store_n(&req->status, status, __ATOMIC_RELEASE);
+}
+
+static void vdrive_async_chunk_done(ahci_request_t *areq, int status) {
+    vdrive_request_t *req = (vdrive_request_t*)areq->ctx;
+    if (status != 0) {
+        req->error = req->write ? VDRIVE_ERR_WRITE_FAILED : VDRIVE_ERR_READ_FAILED;
+    }
+    if (__atomic_sub_fetch(&req->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        vdrive_async_finish(req);
+    }
+}
+
+static inline uint32_t vdrive_async_chunks(const vdrive_request_t *req) {
+    return (req->count + AHCI_MAX_SECTORS_PER_REQUEST - 1) / AHCI_MAX_SECTORS_PER_REQUEST;
+}
+
+int vdrive_submit(uint8_t vdrive_id, vdrive_request_t *req) {
+    if (!req) {
+        return VDRIVE_ERR_NULL_BUFFER;
+    }
+    req->status = VDRIVE_REQ_PENDING;
+    req->error = VDRIVE_SUCCESS;
+    req->pending = 0;
+    req->priv = NULL;
+    req->vdrive_id = vdrive_id;
+
+    if (!vdrive_system.initialized) {
+        req->status = VDRIVE_ERR_NOT_INIT;
+        return VDRIVE_ERR_NOT_INIT;
+    }
+
+    vdrive_t *drive = vdrive_get(vdrive_id);
+    if (!drive) {
+        req->status = VDRIVE_ERR_NO_DRIVE;
+        return VDRIVE_ERR_NO_DRIVE;
+    }
+
+    int err = VDRIVE_SUCCESS;
+    if (req->count == 0) err = VDRIVE_ERR_INVALID_COUNT;
+    else if (req->buffer == NULL) err = VDRIVE_ERR_NULL_BUFFER;
+    else if (req->write && drive->read_only) err = VDRIVE_ERR_READ_ONLY;
+    if (err != VDRIVE_SUCCESS) {
+        drive_last_error[vdrive_id] = err;
+        req->status = err;
+        return err;
+    }
+
+    ahci_request_t *chunks = NULL;
+    int queued = (drive->backend == VDRIVE_BACKEND_SATA &&
+                  drive->type != VDRIVE_TYPE_SATA_OPTICAL &&
+                  drive->status == VDRIVE_STATUS_READY);
+    if (queued) {
+        chunks = (ahci_request_t*)kmalloc((size_t)vdrive_async_chunks(req) * sizeof(ahci_request_t));
+    }
+
+    if (!chunks) {
+        /* ATA PIO and optical drives have no command queue: do it now */
+        req->error = req->write ? vdrive_write(vdrive_id, req->lba, req->count, req->buffer)
+                                : vdrive_read(vdrive_id, req->lba, req->count, req->buffer);
+        vdrive_async_finish(req);
+        return VDRIVE_SUCCESS;
+    }
+
+    vdrive_cache_t *c = &g_vdrive_cache[vdrive_id];
+    spinlock_lock(&c->lock);
+    vdrive_cache_prepare_async(drive, c, req->lba, req->count, req->write);
+    spinlock_unlock(&c->lock);
+
+    /* One reference per chunk plus ours, so early completions cannot finish the request. */
+    uint32_t n = vdrive_async_chunks(req);
+    memset(chunks, 0, (size_t)n * sizeof(ahci_request_t)); /* unissued chunks read as not pending */
+    req->priv = chunks;
+    req->pending = n + 1;
+
+    uint32_t issued = 0;
+    uint8_t *buf = (uint8_t*)req->buffer;
+    for (; issued < n; issued++) {
+        ahci_request_t *a = &chunks[issued];
+        uint32_t off = issued * AHCI_MAX_SECTORS_PER_REQUEST;
+        a->lba = req->lba + off;
+        a->count = (req->count - off > AHCI_MAX_SECTORS_PER_REQUEST) ? AHCI_MAX_SECTORS_PER_REQUEST : req->count - off;
+        a->buffer = buf + (size_t)off * drive->sector_size;
+        a->write = req->write;
+        a->done = vdrive_async_chunk_done;
+        a->ctx = req;
+        if (sata_submit(drive->backend_id, a) != SATA_SUCCESS) {
+            req->error = req->write ? VDRIVE_ERR_WRITE_FAILED : VDRIVE_ERR_READ_FAILED;
+            break;
+        }
+    }
+
+    if (__atomic_sub_fetch(&req->pending, (n - issued) + 1, __ATOMIC_ACQ_REL) == 0) {
+        vdrive_async_finish(req);
+    }
+
+    if (req->write) drive->writes++;
+    else drive->reads++;
+    return VDRIVE_SUCCESS;
+}
+
+int vdrive_complete(vdrive_request_t *req) {
+    if (!req) {
+        return VDRIVE_ERR_NULL_BUFFER;
+    }
+
+    ahci_request_t *chunks = (ahci_request_t*)req->priv;
+    if (chunks) {
+        /* Waiting on every chunk also polls the port, so this works without
+         * IRQs. No locks are held here, so the caller may sleep. */
+        uint32_t n = vdrive_async_chunks(req);
+        for (uint32_t i = 0; i < n; i++) {
+            if (chunks[i].status == AHCI_REQ_PENDING) ahci_wait_sleep(&chunks[i], 5000 /*ms*/);
+        }
+        kfree(chunks);
+        req->priv = NULL;
+    }
+
+    while (__atomic_load_n(&req->status, __ATOMIC_ACQUIRE) == VDRIVE_REQ_PENDING) {
+        cpu_relax();
+    }
+
+    int status = req->status;
+    if (status != VDRIVE_SUCCESS && req->vdrive_id < VDRIVE_MAX_DRIVES) {
+        vdrive_t *drive = vdrive_get(req->vdrive_id);
+        if (drive) drive->errors++;
+        drive_last_error[req->vdrive_id] = status;
+    }
+    return status;
+}
+
 // ===========================================================================
 // Utility Functions
 // ===========================================================================
@@ -875,12 +1363,13 @@ void vdrive_cache_dump_stats(void) {
     for (int i = 0; i < VDRIVE_MAX_DRIVES; i++) {
         vdrive_t *d = vdrive_get(i);
         if (!d) continue;
-        vdrive_cache_t *c = &g_vdrive_cache[i];
-        if (!c->inited) continue;
-        com_printf(COM1_PORT, "[vDriveCache] drive=%d sector=%u entries=%u hits=%llu misses=%llu\n",
-                   i, c->sector_size, c->entries,
-                   (unsigned long long)c->hits,
-                   (unsigned long long)c->misses);
+        vdrive_cache_stats_t st;
+        if (vdrive_cache_get_stats((uint8_t)i, &st) != VDRIVE_SUCCESS) continue;
+        com_printf(COM1_PORT, "[vDriveCache] drive=%d lines=%u ways=%u valid=%u dirty=%u\n",
+                   i, st.lines, st.ways, st.valid_lines, st.dirty_lines);
+        com_printf(COM1_PORT, "[vDriveCache]   hits=%u misses=%u evictions=%u writebacks=%u readahead=%u\n",
+                   (uint32_t)st.hits, (uint32_t)st.misses, (uint32_t)st.evictions,
+                   (uint32_t)st.writebacks, (uint32_t)st.readahead);
     }
 }
 
@@ -1060,6 +1549,12 @@ int vdrive_flush(uint8_t vdrive_id) {
     com_printf(COM1_PORT, "[vDrive] flush: vdrive %u backend=%u id=%u\n",
                vdrive_id, drive->backend, drive->backend_id);
 
+    /* Push write-back cache contents out before asking the device to flush */
+    if (vdrive_cache_sync(vdrive_id) != VDRIVE_SUCCESS) {
+        com_printf(COM1_PORT, "[vDrive] flush: vdrive %u cache writeback failed\n", vdrive_id);
+        return VDRIVE_ERR_WRITE_FAILED;
+    }
+
     if (drive->backend == VDRIVE_BACKEND_SATA) {
         return sata_flush(drive->backend_id);
     } else if (drive->backend == VDRIVE_BACKEND_ATA) {
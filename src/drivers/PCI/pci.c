@@ -6,6 +6,9 @@
 #include "moduos/kernel/interrupts/idt.h"
 #include "moduos/kernel/macros.h"
 #include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/memory/paging.h"
+#include "moduos/kernel/smp.h"
+#include "moduos/arch/AMD64/interrupts/apic.h"
 
 // Device storage
 static pci_device_t pci_devices[MAX_PCI_DEVICES];
@@ -117,6 +120,19 @@ static void pci_probe_bars(pci_device_t *dev) {
     }
 }
 
+static void pci_probe_msi(pci_device_t *dev) {
+    dev->msi_cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+    dev->msix_cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+    dev->irq_mode = PCI_IRQ_INTX;
+    dev->msix_size = 0;
+    dev->msi_vectors = 0;
+    dev->msix_table = NULL;
+    if (dev->msix_cap) {
+        uint16_t flags = pci_config_read_word(dev->bus, dev->device, dev->function, dev->msix_cap + PCI_MSIX_FLAGS);
+        dev->msix_size = (flags & PCI_MSIX_FLAGS_QSIZE) + 1;
+    }
+}
+
 static void pci_check_device(uint8_t bus, uint8_t device) {
     uint8_t function = 0;
     uint16_t vendor_id = pci_config_read_word(bus, device, function, PCI_VENDOR_ID);
@@ -150,6 +166,7 @@ static void pci_check_device(uint8_t bus, uint8_t device) {
     dev->status = pci_config_read_word(bus, device, function, PCI_STATUS);
     
     pci_probe_bars(dev);
+    pci_probe_msi(dev);
     
     // Check for multifunction device
     if (header_type & 0x80) {
@@ -181,6 +198,8 @@ static void pci_check_device(uint8_t bus, uint8_t device) {
             dev->status = pci_config_read_word(bus, device, function, PCI_STATUS);
             
             pci_probe_bars(dev);
+            pci_probe_msi(dev);
+    pci_probe_msi(dev);
         }
     }
 }
@@ -330,6 +349,179 @@ void pci_set_command(pci_device_t *dev, uint16_t command) {
     dev->command = command;
 }
 
+// ============================================================================
+// Capabilities and Message-Signalled Interrupts
+// ============================================================================
+
+uint8_t pci_find_capability(pci_device_t *dev, uint8_t cap_id) {
+    if (!dev) return 0;
+    uint16_t status = pci_config_read_word(dev->bus, dev->device, dev->function, PCI_STATUS);
+    if (!(status & PCI_STATUS_CAP_LIST)) return 0;
+
+    uint8_t ptr = pci_config_read_byte(dev->bus, dev->device, dev->function, PCI_CAPABILITY_LIST) & 0xFC;
+    // The list lives in the device-specific area; bound the walk in case it loops.
+    for (int n = 0; ptr >= 0x40 && n < 48; n++) {
+        uint8_t id = pci_config_read_byte(dev->bus, dev->device, dev->function, ptr);
+        if (id == cap_id) return ptr;
+        ptr = pci_config_read_byte(dev->bus, dev->device, dev->function, ptr + 1) & 0xFC;
+    }
+    return 0;
+}
+
+int pci_irq_vector_count(pci_device_t *dev) {
+    if (!dev || !apic_is_enabled()) return 0;
+    if (dev->msix_cap) return dev->msix_size;
+    if (dev->msi_cap) return 1;
+    return 0;
+}
+
+// Message address/data for a fixed, edge-triggered interrupt on the BSP.
+// Device interrupts are serviced there, as with the IOAPIC routing.
+static void pci_msi_message(int vector, uint32_t *addr, uint32_t *data) {
+    cpu_local_t *bsp = smp_get_cpu(0);
+    uint32_t dest = bsp ? (uint32_t)bsp->apic_id : apic_local_id();
+    *addr = PCI_MSI_ADDR_BASE | ((dest & 0xFF) << 12);
+    *data = (uint32_t)vector & 0xFF;
+}
+
+static void pci_set_intx(pci_device_t *dev, int enable) {
+    uint16_t command = pci_config_read_word(dev->bus, dev->device, dev->function, PCI_COMMAND);
+    if (enable) command &= ~PCI_COMMAND_INTX_DISABLE;
+    else command |= PCI_COMMAND_INTX_DISABLE;
+    pci_config_write_word(dev->bus, dev->device, dev->function, PCI_COMMAND, command);
+    dev->command = command;
+}
+
+static volatile uint32_t *pci_msix_map_table(pci_device_t *dev) {
+    if (dev->msix_table) return dev->msix_table;
+
+    uint32_t table = pci_config_read_dword(dev->bus, dev->device, dev->function, dev->msix_cap + PCI_MSIX_TABLE);
+    int bir = table & 0x7;
+    if (bir > 5 || dev->bar_type[bir] == 1) return NULL;
+
+    uint8_t bar_offset = PCI_BAR0 + bir * 4;
+    uint32_t lo = pci_config_read_dword(dev->bus, dev->device, dev->function, bar_offset);
+    uint64_t phys = lo & 0xFFFFFFF0u;
+    if ((lo & 0x06) == 0x04 && bir < 5)
+        phys |= (uint64_t)pci_config_read_dword(dev->bus, dev->device, dev->function, bar_offset + 4) << 32;
+    if (!phys) return NULL;
+
+    phys += table & ~0x7u;
+    dev->msix_table = (volatile uint32_t *)ioremap(phys, (uint64_t)dev->msix_size * PCI_MSIX_ENTRY_SIZE);
+    return dev->msix_table;
+}
+
+static int pci_msix_request(pci_device_t *dev, int index, int vector) {
+    volatile uint32_t *table = pci_msix_map_table(dev);
+    if (!table) return -1;
+
+    uint8_t cap = dev->msix_cap;
+    uint16_t flags = pci_config_read_word(dev->bus, dev->device, dev->function, cap + PCI_MSIX_FLAGS);
+    if (!(flags & PCI_MSIX_FLAGS_ENABLE)) {
+        // Enable with the function masked, mask every entry, then unmask the
+        // function: only entries that get a vector can fire.
+        flags |= PCI_MSIX_FLAGS_ENABLE | PCI_MSIX_FLAGS_MASKALL;
+        pci_config_write_word(dev->bus, dev->device, dev->function, cap + PCI_MSIX_FLAGS, flags);
+        for (int i = 0; i < dev->msix_size; i++) {
+            volatile uint32_t *e = table + i * (PCI_MSIX_ENTRY_SIZE / 4);
+            e[PCI_MSIX_ENTRY_CTRL / 4] |= PCI_MSIX_ENTRY_CTRL_MASKBIT;
+        }
+        pci_set_intx(dev, 0);
+        flags &= ~PCI_MSIX_FLAGS_MASKALL;
+        pci_config_write_word(dev->bus, dev->device, dev->function, cap + PCI_MSIX_FLAGS, flags);
+        dev->irq_mode = PCI_IRQ_MSIX;
+    }
+
+    volatile uint32_t *e = table + index * (PCI_MSIX_ENTRY_SIZE / 4);
+    if (!(e[PCI_MSIX_ENTRY_CTRL / 4] & PCI_MSIX_ENTRY_CTRL_MASKBIT)) return -1;   // entry in use
+
+    uint32_t addr, data;
+    pci_msi_message(vector, &addr, &data);
+    e[PCI_MSIX_ENTRY_ADDR_LO / 4] = addr;
+    e[PCI_MSIX_ENTRY_ADDR_HI / 4] = 0;
+    e[PCI_MSIX_ENTRY_DATA / 4] = data;
+    e[PCI_MSIX_ENTRY_CTRL / 4] &= ~PCI_MSIX_ENTRY_CTRL_MASKBIT;
+    return 0;
+}
+
+static int pci_msi_request(pci_device_t *dev, int vector) {
+    uint8_t cap = dev->msi_cap;
+    uint16_t flags = pci_config_read_word(dev->bus, dev->device, dev->function, cap + PCI_MSI_FLAGS);
+    if (flags & PCI_MSI_FLAGS_ENABLE) return -1;   // single vector already taken
+
+    uint32_t addr, data;
+    pci_msi_message(vector, &addr, &data);
+    pci_config_write_dword(dev->bus, dev->device, dev->function, cap + PCI_MSI_ADDRESS_LO, addr);
+    if (flags & PCI_MSI_FLAGS_64BIT) {
+        pci_config_write_dword(dev->bus, dev->device, dev->function, cap + PCI_MSI_ADDRESS_HI, 0);
+        pci_config_write_word(dev->bus, dev->device, dev->function, cap + PCI_MSI_DATA_64, (uint16_t)data);
+        if (flags & PCI_MSI_FLAGS_MASKBIT)
+            pci_config_write_dword(dev->bus, dev->device, dev->function, cap + PCI_MSI_MASK_64, 0);
+    } else {
+        pci_config_write_word(dev->bus, dev->device, dev->function, cap + PCI_MSI_DATA_32, (uint16_t)data);
+        if (flags & PCI_MSI_FLAGS_MASKBIT)
+            pci_config_write_dword(dev->bus, dev->device, dev->function, cap + PCI_MSI_MASK_32, 0);
+    }
+
+    // One vector (QSIZE = 0); multi-message MSI needs aligned vector blocks.
+    flags &= ~PCI_MSI_FLAGS_QSIZE;
+    flags |= PCI_MSI_FLAGS_ENABLE;
+    pci_set_intx(dev, 0);
+    pci_config_write_word(dev->bus, dev->device, dev->function, cap + PCI_MSI_FLAGS, flags);
+    dev->irq_mode = PCI_IRQ_MSI;
+    return 0;
+}
+
+int pci_request_irq_vector(pci_device_t *dev, int index, void (*handler)(void *ctx), void *ctx, const char *name) {
+    if (!dev || !handler || index < 0 || index >= pci_irq_vector_count(dev)) return -1;
+
+    int vector = irq_alloc_vector(handler, ctx, name);
+    if (vector < 0) return -1;
+
+    int rc = dev->msix_cap ? pci_msix_request(dev, index, vector) : pci_msi_request(dev, vector);
+    if (rc != 0) {
+        irq_free_vector(vector);
+        return -1;
+    }
+    dev->msi_vectors++;
+
+    com_printf(COM1_PORT, "[PCI] %02x:%02x.%x %s vector %d -> 0x%x\n",
+               dev->bus, dev->device, dev->function,
+               dev->irq_mode == PCI_IRQ_MSIX ? "MSI-X" : "MSI", index, vector);
+    return vector;
+}
+
+void pci_free_irq_vector(pci_device_t *dev, int index) {
+    if (!dev || dev->irq_mode == PCI_IRQ_INTX || !dev->msi_vectors) return;
+
+    int vector = -1;
+    if (dev->irq_mode == PCI_IRQ_MSIX) {
+        if (index < 0 || index >= dev->msix_size || !dev->msix_table) return;
+        volatile uint32_t *e = dev->msix_table + index * (PCI_MSIX_ENTRY_SIZE / 4);
+        if (e[PCI_MSIX_ENTRY_CTRL / 4] & PCI_MSIX_ENTRY_CTRL_MASKBIT) return;
+        e[PCI_MSIX_ENTRY_CTRL / 4] |= PCI_MSIX_ENTRY_CTRL_MASKBIT;
+        vector = e[PCI_MSIX_ENTRY_DATA / 4] & 0xFF;
+    } else {
+        if (index != 0) return;
+        uint8_t cap = dev->msi_cap;
+        uint16_t flags = pci_config_read_word(dev->bus, dev->device, dev->function, cap + PCI_MSI_FLAGS);
+        uint8_t data_off = (flags & PCI_MSI_FLAGS_64BIT) ? PCI_MSI_DATA_64 : PCI_MSI_DATA_32;
+        vector = pci_config_read_word(dev->bus, dev->device, dev->function, cap + data_off) & 0xFF;
+        pci_config_write_word(dev->bus, dev->device, dev->function, cap + PCI_MSI_FLAGS, flags & ~PCI_MSI_FLAGS_ENABLE);
+    }
+
+    irq_free_vector(vector);
+
+    if (--dev->msi_vectors == 0) {
+        if (dev->irq_mode == PCI_IRQ_MSIX) {
+            uint16_t flags = pci_config_read_word(dev->bus, dev->device, dev->function, dev->msix_cap + PCI_MSIX_FLAGS);
+            pci_config_write_word(dev->bus, dev->device, dev->function, dev->msix_cap + PCI_MSIX_FLAGS, flags & ~PCI_MSIX_FLAGS_ENABLE);
+        }
+        dev->irq_mode = PCI_IRQ_INTX;
+        pci_set_intx(dev, 1);
+    }
+}
+
 // ============================================================================
 // Driver Registration
 // ============================================================================
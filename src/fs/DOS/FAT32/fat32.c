@@ -4,6 +4,7 @@
 #include "moduos/drivers/graphics/VGA.h"
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/spinlock.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -72,6 +73,395 @@ static uint32_t safe_divide(uint32_t numerator, uint32_t denominator) {
     return numerator / denominator;
 }
 
+/* --- FAT CACHE ---
+ *
+ * Each mount keeps a small write-back cache of FAT blocks (FAT32_FAT_BLOCK
+ * bytes of the first FAT copy), so walking a chain costs a memory lookup per
+ * entry instead of a sector read. Updates only dirty the cached block;
+ * fat32_fat_flush() writes dirty blocks to every FAT copy at the end of each
+ * modifying operation, on eviction and at unmount, so the mirrors are updated
+ * once per block rather than once per entry.
+ *
+ * Allocation uses a bitmap of used clusters, built from the FAT on the first
+ * allocation, and a rotating next-free hint seeded from FSInfo. Volumes whose
+ * bitmap would exceed FAT32_BITMAP_MAX_BYTES go without it and scan cached FAT
+ * entries from the hint instead.
+ *
+ * One lock per mount covers the cache and is held across FAT I/O, like the
+ * vDrive block cache (order: FS driver -> vDrive).
+ */
+
+#define FAT32_FAT_BLOCK         4096u
+#define FAT32_FAT_CACHE_BLOCKS  32
+#define FAT32_BITMAP_MAX_BYTES  (1024u * 1024u)
+#define FAT32_BITMAP_READ_BLOCKS 16
+
+typedef struct {
+    uint32_t block;         /* FAT byte offset / FAT32_FAT_BLOCK */
+    uint8_t valid;
+    uint8_t dirty;
+    uint64_t last_use;
+    uint8_t *data;          /* kmalloc'd (DMA-safe) */
+} fat32_fat_block_t;
+
+typedef struct {
+    spinlock_t lock;
+    fat32_fat_block_t blocks[FAT32_FAT_CACHE_BLOCKS];
+    uint64_t use_counter;
+    int last_hit;
+    uint32_t max_cluster;   /* highest allocatable cluster */
+    uint32_t next_free;     /* allocation hint */
+    uint32_t free_count;    /* exact while used_map is built */
+    uint8_t *used_map;      /* bit per cluster, set = in use */
+    int map_state;          /* 0 = not built yet, 1 = built, -1 = unavailable */
+    uint32_t fsinfo_lba;    /* 0: volume has no usable FSInfo sector */
+    uint8_t fsinfo_dirty;
+} fat32_fat_cache_t;
+
+static fat32_fat_cache_t fat32_fat_caches[FAT32_MAX_MOUNTS];
+
+static uint32_t fat32_max_cluster(const fat32_fs_t *fs) {
+    uint32_t data_sectors = 0;
+    if (fs->total_sectors > (fs->first_data_sector - fs->partition_lba)) {
+        data_sectors = fs->total_sectors - (fs->first_data_sector - fs->partition_lba);
+    }
+    uint32_t maxc = safe_divide(data_sectors, fs->sectors_per_cluster) + 1;
+
+    /* Never past what the FAT itself can describe. */
+    uint64_t fat_entries = ((uint64_t)fs->sectors_per_fat * fs->bytes_per_sector) / 4;
+    if (fat_entries < 3) return 0;
+    if ((uint64_t)maxc > fat_entries - 1) maxc = (uint32_t)(fat_entries - 1);
+    if (maxc > 0x0FFFFFF6) maxc = 0x0FFFFFF6;
+    return maxc;
+}
+
+/* Sectors of FAT block `block`, relative to the start of a FAT copy. */
+static int fat32_fat_block_span(const fat32_fs_t *fs, uint32_t block, uint32_t *first, uint32_t *count) {
+    uint32_t spb = FAT32_FAT_BLOCK / fs->bytes_per_sector;
+    uint64_t start = (uint64_t)block * spb;
+    if (start >= fs->sectors_per_fat) return -1;
+    *first = (uint32_t)start;
+    *count = spb;
+    if (start + spb > fs->sectors_per_fat) *count = fs->sectors_per_fat - (uint32_t)start;
+    return 0;
+}
+
+static int fat32_fat_write_block(const fat32_fs_t *fs, fat32_fat_block_t *b) {
+    uint32_t first, count;
+    if (fat32_fat_block_span(fs, b->block, &first, &count) != 0) return -1;
+
+    for (uint32_t fat = 0; fat < fs->num_fats; fat++) {
+        uint64_t lba = (uint64_t)fs->partition_lba + fs->reserved_sectors +
+                       (uint64_t)fat * fs->sectors_per_fat + first;
+        if (vdrive_write(fs->vdrive_id, lba, count, b->data) != VDRIVE_SUCCESS) {
+            com_printf(COM1_PORT, "FAT32: FAT block %u write failed (copy %u)\n", b->block, fat);
+            return -1;
+        }
+    }
+    b->dirty = 0;
+    return 0;
+}
+
+static fat32_fat_block_t *fat32_fat_lookup_locked(fat32_fat_cache_t *c, uint32_t block) {
+    fat32_fat_block_t *b = &c->blocks[c->last_hit];
+    if (b->valid && b->block == block) return b;
+    for (int i = 0; i < FAT32_FAT_CACHE_BLOCKS; i++) {
+        b = &c->blocks[i];
+        if (b->valid && b->block == block) {
+            c->last_hit = i;
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/* Cached FAT block, read in (evicting the least recently used) on a miss. */
+static fat32_fat_block_t *fat32_fat_block_locked(const fat32_fs_t *fs, fat32_fat_cache_t *c, uint32_t block) {
+    fat32_fat_block_t *b = fat32_fat_lookup_locked(c, block);
+    if (b) {
+        b->last_use = ++c->use_counter;
+        return b;
+    }
+
+    int victim = 0;
+    for (int i = 0; i < FAT32_FAT_CACHE_BLOCKS; i++) {
+        if (!c->blocks[i].valid) { victim = i; break; }
+        if (c->blocks[i].last_use < c->blocks[victim].last_use) victim = i;
+    }
+    b = &c->blocks[victim];
+    if (b->valid && b->dirty && fat32_fat_write_block(fs, b) != 0) return NULL;
+    b->valid = 0;
+
+    uint32_t first, count;
+    if (fat32_fat_block_span(fs, block, &first, &count) != 0) return NULL;
+    if (!b->data) {
+        b->data = (uint8_t*)kmalloc(FAT32_FAT_BLOCK);
+        if (!b->data) return NULL;
+    }
+    memset(b->data, 0, FAT32_FAT_BLOCK);
+    uint64_t lba = (uint64_t)fs->partition_lba + fs->reserved_sectors + first;
+    if (vdrive_read(fs->vdrive_id, lba, count, b->data) != VDRIVE_SUCCESS) return NULL;
+
+    b->block = block;
+    b->valid = 1;
+    b->dirty = 0;
+    b->last_use = ++c->use_counter;
+    c->last_hit = victim;
+    return b;
+}
+
+static int fat32_fat_get_locked(const fat32_fs_t *fs, fat32_fat_cache_t *c, uint32_t cluster, uint32_t *out_val) {
+    uint64_t off = (uint64_t)cluster * 4U;
+    if (off + 4 > (uint64_t)fs->sectors_per_fat * fs->bytes_per_sector) return -2;
+
+    fat32_fat_block_t *b = fat32_fat_block_locked(fs, c, (uint32_t)(off / FAT32_FAT_BLOCK));
+    if (!b) return -4;
+    const uint8_t *p = b->data + (off % FAT32_FAT_BLOCK);
+    *out_val = ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) & 0x0FFFFFFF;
+    return 0;
+}
+
+static int fat32_fat_set_locked(const fat32_fs_t *fs, fat32_fat_cache_t *c, uint32_t cluster, uint32_t value) {
+    uint64_t off = (uint64_t)cluster * 4U;
+    if (off + 4 > (uint64_t)fs->sectors_per_fat * fs->bytes_per_sector) return -2;
+
+    fat32_fat_block_t *b = fat32_fat_block_locked(fs, c, (uint32_t)(off / FAT32_FAT_BLOCK));
+    if (!b) return -4;
+    uint8_t *p = b->data + (off % FAT32_FAT_BLOCK);
+
+    /* The top four bits are reserved and must be preserved. */
+    value = (value & 0x0FFFFFFF) | ((uint32_t)p[3] & 0xF0) << 24;
+    p[0] = (uint8_t)(value & 0xFF);
+    p[1] = (uint8_t)((value >> 8) & 0xFF);
+    p[2] = (uint8_t)((value >> 16) & 0xFF);
+    p[3] = (uint8_t)((value >> 24) & 0xFF);
+    b->dirty = 1;
+
+    if (c->used_map && cluster >= 2 && cluster <= c->max_cluster) {
+        uint8_t bit = (uint8_t)(1u << (cluster & 7));
+        int was_used = (c->used_map[cluster >> 3] & bit) != 0;
+        int now_used = (value & 0x0FFFFFFF) != 0;
+        if (was_used && !now_used) { c->used_map[cluster >> 3] &= (uint8_t)~bit; c->free_count++; }
+        if (!was_used && now_used) { c->used_map[cluster >> 3] |= bit; c->free_count--; }
+    }
+    c->fsinfo_dirty = 1;
+    return 0;
+}
+
+/* Build used_map from the FAT. Large sequential reads; blocks already in the
+ * cache are taken from it since they may be newer than the disk. */
+static void fat32_fat_build_map_locked(const fat32_fs_t *fs, fat32_fat_cache_t *c) {
+    if (c->map_state != 0) return;
+    c->map_state = -1;
+
+    uint32_t maxc = c->max_cluster;
+    if (maxc < 2) return;
+    uint32_t map_bytes = maxc / 8 + 1;
+    if (map_bytes > FAT32_BITMAP_MAX_BYTES) {
+        com_printf(COM1_PORT, "FAT32: %u clusters, allocating without a free map\n", maxc - 1);
+        return;
+    }
+
+    uint8_t *map = (uint8_t*)kzalloc(map_bytes);
+    uint8_t *buf = (uint8_t*)kmalloc(FAT32_FAT_BLOCK * FAT32_BITMAP_READ_BLOCKS);
+    if (!map || !buf) {
+        if (map) kfree(map);
+        if (buf) kfree(buf);
+        return;
+    }
+
+    uint32_t spb = FAT32_FAT_BLOCK / fs->bytes_per_sector;
+    uint32_t nblocks = (uint32_t)(((uint64_t)maxc * 4) / FAT32_FAT_BLOCK) + 1;
+    uint32_t free_count = 0;
+    map[0] |= 0x03; /* clusters 0 and 1 are reserved */
+
+    for (uint32_t b0 = 0; b0 < nblocks; b0 += FAT32_BITMAP_READ_BLOCKS) {
+        uint32_t nb = nblocks - b0;
+        if (nb > FAT32_BITMAP_READ_BLOCKS) nb = FAT32_BITMAP_READ_BLOCKS;
+        uint32_t first = b0 * spb;
+        uint32_t count = nb * spb;
+        if (first + count > fs->sectors_per_fat) count = fs->sectors_per_fat - first;
+
+        memset(buf, 0, (size_t)nb * FAT32_FAT_BLOCK);
+        uint64_t lba = (uint64_t)fs->partition_lba + fs->reserved_sectors + first;
+        if (vdrive_read(fs->vdrive_id, lba, count, buf) != VDRIVE_SUCCESS) {
+            com_printf(COM1_PORT, "FAT32: FAT read failed building free map\n");
+            kfree(buf);
+            kfree(map);
+            return;
+        }
+
+        for (uint32_t i = 0; i < nb; i++) {
+            fat32_fat_block_t *cached = fat32_fat_lookup_locked(c, b0 + i);
+            const uint8_t *src = cached ? cached->data : buf + (size_t)i * FAT32_FAT_BLOCK;
+            uint32_t base = (b0 + i) * (FAT32_FAT_BLOCK / 4);
+            for (uint32_t e = 0; e < FAT32_FAT_BLOCK / 4; e++) {
+                uint32_t cl = base + e;
+                if (cl > maxc) break;
+                if (cl < 2) continue;
+                const uint8_t *p = src + e * 4;
+                uint32_t v = ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                              ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) & 0x0FFFFFFF;
+                if (v) map[cl >> 3] |= (uint8_t)(1u << (cl & 7));
+                else free_count++;
+            }
+        }
+    }
+
+    kfree(buf);
+    c->used_map = map;
+    c->free_count = free_count;
+    c->map_state = 1;
+    c->fsinfo_dirty = 1;
+    com_printf(COM1_PORT, "FAT32: free map built, %u of %u clusters free\n", free_count, maxc - 1);
+}
+
+static int fat32_fat_find_free_locked(const fat32_fs_t *fs, fat32_fat_cache_t *c, uint32_t *out_cluster) {
+    fat32_fat_build_map_locked(fs, c);
+
+    uint32_t maxc = c->max_cluster;
+    if (maxc < 2) return -2;
+    uint32_t cl = c->next_free;
+    if (cl < 2 || cl > maxc) cl = 2;
+    uint32_t span = maxc - 1;
+
+    if (c->used_map) {
+        if (c->free_count == 0) return -4;
+        for (uint32_t seen = 0; seen < span;) {
+            uint8_t bits = c->used_map[cl >> 3];
+            if ((cl & 7) == 0 && bits == 0xFF && cl + 7 <= maxc) {
+                cl += 8;
+                seen += 8;
+            } else {
+                if (!(bits & (1u << (cl & 7)))) { *out_cluster = cl; return 0; }
+                cl++;
+                seen++;
+            }
+            if (cl > maxc) cl = 2;
+        }
+        return -4;
+    }
+
+    for (uint32_t seen = 0; seen < span; seen++) {
+        uint32_t v = 0;
+        if (fat32_fat_get_locked(fs, c, cl, &v) != 0) return -3;
+        if (v == 0) { *out_cluster = cl; return 0; }
+        if (++cl > maxc) cl = 2;
+    }
+    return -4;
+}
+
+static int fat32_fat_write_fsinfo_locked(const fat32_fs_t *fs, fat32_fat_cache_t *c) {
+    uint8_t *sec = (uint8_t*)kmalloc(4096);
+    if (!sec) return -1;
+    int rc = -1;
+    if (vdrive_read_sector(fs->vdrive_id, c->fsinfo_lba, sec) == VDRIVE_SUCCESS) {
+        uint32_t free_count = c->used_map ? c->free_count : 0xFFFFFFFF;
+        sec[488] = (uint8_t)(free_count & 0xFF);
+        sec[489] = (uint8_t)((free_count >> 8) & 0xFF);
+        sec[490] = (uint8_t)((free_count >> 16) & 0xFF);
+        sec[491] = (uint8_t)((free_count >> 24) & 0xFF);
+        sec[492] = (uint8_t)(c->next_free & 0xFF);
+        sec[493] = (uint8_t)((c->next_free >> 8) & 0xFF);
+        sec[494] = (uint8_t)((c->next_free >> 16) & 0xFF);
+        sec[495] = (uint8_t)((c->next_free >> 24) & 0xFF);
+        if (vdrive_write_sector(fs->vdrive_id, c->fsinfo_lba, sec) == VDRIVE_SUCCESS) rc = 0;
+    }
+    kfree(sec);
+    if (rc == 0) c->fsinfo_dirty = 0;
+    return rc;
+}
+
+/* Write every dirty FAT block to all FAT copies, then FSInfo. */
+static int fat32_fat_flush(int handle) {
+    if (!fat32_valid_handle(handle)) return -1;
+    fat32_fs_t *fs = &fat32_mounts[handle];
+    fat32_fat_cache_t *c = &fat32_fat_caches[handle];
+
+    int rc = 0;
+    spinlock_lock(&c->lock);
+    for (int i = 0; i < FAT32_FAT_CACHE_BLOCKS; i++) {
+        fat32_fat_block_t *b = &c->blocks[i];
+        if (b->valid && b->dirty && fat32_fat_write_block(fs, b) != 0) rc = -2;
+    }
+    if (rc == 0 && c->fsinfo_dirty && c->fsinfo_lba) {
+        /* Only a hint for other systems; losing it is harmless. */
+        (void)fat32_fat_write_fsinfo_locked(fs, c);
+    }
+    spinlock_unlock(&c->lock);
+    return rc;
+}
+
+static void fat32_fat_cache_init(int handle, uint32_t fsinfo_lba, uint32_t next_free) {
+    fat32_fs_t *fs = &fat32_mounts[handle];
+    fat32_fat_cache_t *c = &fat32_fat_caches[handle];
+
+    memset(c, 0, sizeof(*c));
+    spinlock_init(&c->lock);
+    c->max_cluster = fat32_max_cluster(fs);
+    c->next_free = (next_free >= 2 && next_free <= c->max_cluster) ? next_free : 2;
+    c->fsinfo_lba = fsinfo_lba;
+}
+
+static void fat32_fat_cache_release(int handle) {
+    fat32_fat_cache_t *c = &fat32_fat_caches[handle];
+
+    if (fat32_fat_flush(handle) != 0) {
+        com_printf(COM1_PORT, "FAT32: handle %d: dirty FAT blocks lost at unmount\n", handle);
+    }
+    for (int i = 0; i < FAT32_FAT_CACHE_BLOCKS; i++) {
+        if (c->blocks[i].data) kfree(c->blocks[i].data);
+    }
+    if (c->used_map) kfree(c->used_map);
+    memset(c, 0, sizeof(*c));
+}
+
+static int fat32_read_fat_entry(int handle, uint32_t cluster, uint32_t *out_val) {
+    if (!out_val) return -1;
+    *out_val = 0;
+    if (!fat32_valid_handle(handle)) return -1;
+    if (cluster < 2) return -2;
+
+    fat32_fat_cache_t *c = &fat32_fat_caches[handle];
+    spinlock_lock(&c->lock);
+    int rc = fat32_fat_get_locked(&fat32_mounts[handle], c, cluster, out_val);
+    spinlock_unlock(&c->lock);
+    return rc;
+}
+
+static int fat32_write_fat_entry(int handle, uint32_t cluster, uint32_t value) {
+    if (!fat32_valid_handle(handle)) return -1;
+    if (cluster < 2) return -2;
+
+    fat32_fat_cache_t *c = &fat32_fat_caches[handle];
+    spinlock_lock(&c->lock);
+    int rc = fat32_fat_set_locked(&fat32_mounts[handle], c, cluster, value);
+    spinlock_unlock(&c->lock);
+    return rc;
+}
+
+/* Find a free cluster and mark it end-of-chain in one step. */
+static int fat32_claim_free_cluster(int handle, uint32_t *out_cluster) {
+    if (!out_cluster) return -1;
+    *out_cluster = 0;
+    if (!fat32_valid_handle(handle)) return -1;
+
+    fat32_fs_t *fs = &fat32_mounts[handle];
+    fat32_fat_cache_t *c = &fat32_fat_caches[handle];
+    uint32_t cl = 0;
+
+    spinlock_lock(&c->lock);
+    int rc = fat32_fat_find_free_locked(fs, c, &cl);
+    if (rc == 0) rc = fat32_fat_set_locked(fs, c, cl, 0x0FFFFFFF);
+    if (rc == 0) {
+        c->next_free = (cl + 1 > c->max_cluster) ? 2 : cl + 1;
+        *out_cluster = cl;
+    }
+    spinlock_unlock(&c->lock);
+    return rc;
+}
+
 static uint32_t calculate_cluster_size(uint64_t partition_sectors) {
     uint64_t size_mb = (partition_sectors * 512) / (1024 * 1024);
     
@@ -460,7 +850,25 @@ int fat32_mount(int vdrive_id, uint32_t partition_lba) {
         return -9;
     }
 
+    /* FSInfo (optional): seeds the allocation hint and is kept up to date. */
+    uint32_t fsinfo_lba = 0;
+    uint32_t next_free = 0;
+    uint16_t fsinfo_sec = (uint16_t)sector[48] | ((uint16_t)sector[49] << 8);
+    if (fsinfo_sec != 0 && fsinfo_sec != 0xFFFF && fsinfo_sec < fs->reserved_sectors &&
+        vdrive_read_sector(vdrive_id, partition_lba + fsinfo_sec, sector) == VDRIVE_SUCCESS) {
+        uint32_t lead = (uint32_t)sector[0] | ((uint32_t)sector[1] << 8) |
+                        ((uint32_t)sector[2] << 16) | ((uint32_t)sector[3] << 24);
+        uint32_t struc = (uint32_t)sector[484] | ((uint32_t)sector[485] << 8) |
+                         ((uint32_t)sector[486] << 16) | ((uint32_t)sector[487] << 24);
+        if (lead == 0x41615252 && struc == 0x61417272) {
+            fsinfo_lba = partition_lba + fsinfo_sec;
+            next_free = (uint32_t)sector[492] | ((uint32_t)sector[493] << 8) |
+                        ((uint32_t)sector[494] << 16) | ((uint32_t)sector[495] << 24);
+        }
+    }
+
     /* Mark as active */
+    fat32_fat_cache_init(handle, fsinfo_lba, next_free);
     fs->active = 1;
     
     com_printf(COM1_PORT, "FAT32: mount successful! handle=%d, root_cluster=%u\n", handle, fs->root_cluster);
@@ -532,6 +940,7 @@ int fat32_mount_auto(int vdrive_id) {
 void fat32_unmount(int handle) {
     if (fat32_valid_handle(handle)) {
         com_printf(COM1_PORT, "FAT32: unmounting handle %d\n", handle);
+        fat32_fat_cache_release(handle);
         memset(&fat32_mounts[handle], 0, sizeof(fat32_fs_t));
     }
 }
@@ -574,59 +983,64 @@ static int fat32_write_cluster(int handle, uint32_t cluster, const void* buffer)
     return (result == VDRIVE_SUCCESS) ? 0 : -1;
 }
 
-int fat32_next_cluster(int handle, uint32_t cluster, uint32_t* out_next) {
+/*
+ * Runs of physically adjacent clusters move in one vDrive request. Files
+ * written in one go are usually a single run (allocation walks forward from
+ * the next-free hint), so this is most of the sequential bandwidth.
+ */
+#define FAT32_MAX_RUN_BYTES (4u * 1024u * 1024u)
+
+static uint32_t fat32_max_run_clusters(const fat32_fs_t* fs) {
+    uint32_t clus_size = (uint32_t)fs->bytes_per_sector * (uint32_t)fs->sectors_per_cluster;
+    uint32_t n = safe_divide(FAT32_MAX_RUN_BYTES, clus_size);
+    return n ? n : 1;
+}
+
+static int fat32_read_clusters(int handle, uint32_t cluster, uint32_t count, void* buffer) {
     if (!fat32_valid_handle(handle)) return -1;
-    if (out_next == NULL) return -2;
-    
+    if (cluster < 2 || count == 0 || cluster + count - 1 >= 0x0FFFFFF8) return -2;
+    if (buffer == NULL) return -3;
+
     fat32_fs_t* fs = &fat32_mounts[handle];
-    if (fs->bytes_per_sector == 0) return -3;
-    
-    uint32_t fat_offset = cluster * 4U;
-    uint32_t fat_sector = fs->partition_lba + fs->reserved_sectors + 
-                          safe_divide(fat_offset, fs->bytes_per_sector);
-    uint32_t ent_offset = fat_offset % fs->bytes_per_sector;
+    uint32_t lba = cluster_to_lba(fs, cluster);
 
-    uint8_t *sec = (uint8_t*)kmalloc(512);
-    if (!sec) return -4;
+    int result = vdrive_read(fs->vdrive_id, lba, count * fs->sectors_per_cluster, buffer);
+    return (result == VDRIVE_SUCCESS) ? 0 : -1;
+}
 
-    if (vdrive_read_sector(fs->vdrive_id, fat_sector, sec) != VDRIVE_SUCCESS) {
-        kfree(sec);
-        return -4;
-    }
+static int fat32_write_clusters(int handle, uint32_t cluster, uint32_t count, const void* buffer) {
+    if (!fat32_valid_handle(handle)) return -1;
+    if (cluster < 2 || count == 0 || cluster + count - 1 >= 0x0FFFFFF8) return -2;
+    if (buffer == NULL) return -3;
 
-    uint32_t entry;
-    if ((ent_offset + 4) <= fs->bytes_per_sector) {
-        entry = (uint32_t)sec[ent_offset] |
-                ((uint32_t)sec[ent_offset + 1] << 8) |
-                ((uint32_t)sec[ent_offset + 2] << 16) |
-                ((uint32_t)sec[ent_offset + 3] << 24);
-    } else {
-        /* Entry crosses sector boundary */
-        uint8_t *sec2 = (uint8_t*)kmalloc(512);
-        if (!sec2) { kfree(sec); return -5; }
+    fat32_fs_t* fs = &fat32_mounts[handle];
+    uint32_t lba = cluster_to_lba(fs, cluster);
 
-        if (vdrive_read_sector(fs->vdrive_id, fat_sector + 1, sec2) != VDRIVE_SUCCESS) {
-            kfree(sec2);
-            kfree(sec);
-            return -5;
-        }
+    int result = vdrive_write(fs->vdrive_id, lba, count * fs->sectors_per_cluster, buffer);
+    return (result == VDRIVE_SUCCESS) ? 0 : -1;
+}
 
-        uint8_t tmp[4];
-        uint32_t bytes_from_first = fs->bytes_per_sector - ent_offset;
-        for (uint32_t i = 0; i < bytes_from_first; i++) {
-            tmp[i] = sec[ent_offset + i];
-        }
-        for (uint32_t i = 0; i < (4 - bytes_from_first); i++) {
-            tmp[bytes_from_first + i] = sec2[i];
+/* Length of the contiguous run of chain clusters starting at `cluster`, at
+ * most `max`; *out_next is the FAT entry of the run's last cluster. */
+static int fat32_chain_run(int handle, uint32_t cluster, uint32_t max, uint32_t* out_len, uint32_t* out_next) {
+    uint32_t len = 1;
+    for (;;) {
+        uint32_t next;
+        if (fat32_read_fat_entry(handle, cluster + len - 1, &next) != 0) return -1;
+        if (len >= max || next != cluster + len) {
+            *out_len = len;
+            *out_next = next;
+            return 0;
         }
-        entry = (uint32_t)tmp[0] | ((uint32_t)tmp[1] << 8) | 
-                ((uint32_t)tmp[2] << 16) | ((uint32_t)tmp[3] << 24);
-        kfree(sec2);
+        len++;
     }
+}
 
-    entry &= 0x0FFFFFFF;
-    *out_next = entry;
-    kfree(sec);
+int fat32_next_cluster(int handle, uint32_t cluster, uint32_t* out_next) {
+    if (!fat32_valid_handle(handle)) return -1;
+    if (out_next == NULL) return -2;
+
+    if (fat32_read_fat_entry(handle, cluster, out_next) != 0) return -4;
     return 0;
 }
 
@@ -1354,99 +1768,6 @@ static int fat32_build_short_name_candidate(const char *long_name, int suffix, u
     return 0;
 }
 
-static int fat32_read_fat_entry(int handle, uint32_t cluster, uint32_t *out_val) {
-    if (!out_val) return -1;
-    *out_val = 0;
-    if (!fat32_valid_handle(handle)) return -1;
-
-    fat32_fs_t *fs = &fat32_mounts[handle];
-    if (cluster < 2) return -2;
-
-    uint32_t fat_offset = cluster * 4U;
-    uint32_t fat_sector = fs->partition_lba + fs->reserved_sectors + safe_divide(fat_offset, fs->bytes_per_sector);
-    uint32_t ent_offset = fat_offset % fs->bytes_per_sector;
-
-    uint8_t *sec = (uint8_t*)kmalloc(512);
-    if (!sec) return -3;
-
-    if (vdrive_read_sector(fs->vdrive_id, fat_sector, sec) != VDRIVE_SUCCESS) { kfree(sec); return -4; }
-
-    uint32_t entry;
-    if ((ent_offset + 4) <= fs->bytes_per_sector) {
-        entry = (uint32_t)sec[ent_offset] |
-                ((uint32_t)sec[ent_offset + 1] << 8) |
-                ((uint32_t)sec[ent_offset + 2] << 16) |
-                ((uint32_t)sec[ent_offset + 3] << 24);
-    } else {
-        uint8_t *sec2 = (uint8_t*)kmalloc(512);
-        if (!sec2) { kfree(sec); return -3; }
-        if (vdrive_read_sector(fs->vdrive_id, fat_sector + 1, sec2) != VDRIVE_SUCCESS) { kfree(sec2); kfree(sec); return -4; }
-        uint8_t tmp[4];
-        uint32_t bytes_from_first = fs->bytes_per_sector - ent_offset;
-        for (uint32_t i = 0; i < bytes_from_first; i++) tmp[i] = sec[ent_offset + i];
-        for (uint32_t i = 0; i < (4 - bytes_from_first); i++) tmp[bytes_from_first + i] = sec2[i];
-        entry = (uint32_t)tmp[0] | ((uint32_t)tmp[1] << 8) | ((uint32_t)tmp[2] << 16) | ((uint32_t)tmp[3] << 24);
-        kfree(sec2);
-    }
-
-    kfree(sec);
-    entry &= 0x0FFFFFFF;
-    *out_val = entry;
-    return 0;
-}
-
-static int fat32_write_fat_entry(int handle, uint32_t cluster, uint32_t value) {
-    if (!fat32_valid_handle(handle)) return -1;
-
-    fat32_fs_t *fs = &fat32_mounts[handle];
-    if (cluster < 2) return -2;
-
-    value &= 0x0FFFFFFF;
-
-    uint32_t fat_offset = cluster * 4U;
-    uint32_t fat_sector_rel = safe_divide(fat_offset, fs->bytes_per_sector);
-    uint32_t ent_offset = fat_offset % fs->bytes_per_sector;
-
-    for (uint32_t fat = 0; fat < fs->num_fats; fat++) {
-        uint32_t fat_sector = fs->partition_lba + fs->reserved_sectors + fat_sector_rel + fat * fs->sectors_per_fat;
-
-        uint8_t *sec = (uint8_t*)kmalloc(512);
-        if (!sec) return -3;
-        if (vdrive_read_sector(fs->vdrive_id, fat_sector, sec) != VDRIVE_SUCCESS) { kfree(sec); return -4; }
-
-        if ((ent_offset + 4) <= fs->bytes_per_sector) {
-            sec[ent_offset]     = (uint8_t)(value & 0xFF);
-            sec[ent_offset + 1] = (uint8_t)((value >> 8) & 0xFF);
-            sec[ent_offset + 2] = (uint8_t)((value >> 16) & 0xFF);
-            sec[ent_offset + 3] = (uint8_t)((value >> 24) & 0xFF);
-            if (vdrive_write_sector(fs->vdrive_id, fat_sector, sec) != VDRIVE_SUCCESS) { kfree(sec); return -5; }
-        } else {
-            uint8_t *sec2 = (uint8_t*)kmalloc(512);
-            if (!sec2) { kfree(sec); return -3; }
-            if (vdrive_read_sector(fs->vdrive_id, fat_sector + 1, sec2) != VDRIVE_SUCCESS) { kfree(sec2); kfree(sec); return -4; }
-
-            uint8_t tmp[4];
-            tmp[0] = (uint8_t)(value & 0xFF);
-            tmp[1] = (uint8_t)((value >> 8) & 0xFF);
-            tmp[2] = (uint8_t)((value >> 16) & 0xFF);
-            tmp[3] = (uint8_t)((value >> 24) & 0xFF);
-
-            uint32_t bytes_from_first = fs->bytes_per_sector - ent_offset;
-            for (uint32_t i = 0; i < bytes_from_first; i++) sec[ent_offset + i] = tmp[i];
-            for (uint32_t i = 0; i < (4 - bytes_from_first); i++) sec2[i] = tmp[bytes_from_first + i];
-
-            if (vdrive_write_sector(fs->vdrive_id, fat_sector, sec) != VDRIVE_SUCCESS) { kfree(sec2); kfree(sec); return -5; }
-            if (vdrive_write_sector(fs->vdrive_id, fat_sector + 1, sec2) != VDRIVE_SUCCESS) { kfree(sec2); kfree(sec); return -5; }
-
-            kfree(sec2);
-        }
-
-        kfree(sec);
-    }
-
-    return 0;
-}
-
 static int fat32_zero_cluster(int handle, uint32_t cluster) {
     if (!fat32_valid_handle(handle)) return -1;
     fat32_fs_t *fs = &fat32_mounts[handle];
@@ -1459,31 +1780,6 @@ static int fat32_zero_cluster(int handle, uint32_t cluster) {
     return rc;
 }
 
-static int fat32_find_free_cluster(int handle, uint32_t *out_cluster) {
-    if (!out_cluster) return -1;
-    *out_cluster = 0;
-
-    if (!fat32_valid_handle(handle)) return -1;
-    fat32_fs_t *fs = &fat32_mounts[handle];
-
-    // conservative maximum cluster number from volume size.
-    uint32_t data_sectors = 0;
-    if (fs->total_sectors > (fs->first_data_sector - fs->partition_lba)) {
-        data_sectors = fs->total_sectors - (fs->first_data_sector - fs->partition_lba);
-    }
-    uint32_t data_clusters = safe_divide(data_sectors, fs->sectors_per_cluster);
-    uint32_t maxc = data_clusters + 1;
-    if (maxc < 2) return -2;
-
-    for (uint32_t c = 2; c <= maxc; c++) {
-        uint32_t v = 0;
-        if (fat32_read_fat_entry(handle, c, &v) != 0) return -3;
-        if (v == 0) { *out_cluster = c; return 0; }
-    }
-
-    return -4;
-}
-
 static int fat32_free_cluster_chain(int handle, uint32_t first_cluster) {
     if (!fat32_valid_handle(handle)) return -1;
     uint32_t c = first_cluster;
@@ -1501,6 +1797,7 @@ static int fat32_free_cluster_chain(int handle, uint32_t first_cluster) {
     return 0;
 }
 
+/* The clusters are not zeroed: callers write every cluster they allocate. */
 static int fat32_alloc_cluster_chain(int handle, uint32_t clusters, uint32_t *out_first) {
     if (!out_first) return -1;
     *out_first = 0;
@@ -1513,26 +1810,21 @@ static int fat32_alloc_cluster_chain(int handle, uint32_t clusters, uint32_t *ou
 
     for (uint32_t i = 0; i < clusters; i++) {
         uint32_t c = 0;
-        if (fat32_find_free_cluster(handle, &c) != 0) {
+        if (fat32_claim_free_cluster(handle, &c) != 0) {
             if (first) (void)fat32_free_cluster_chain(handle, first);
             return -2;
         }
 
-        if (fat32_write_fat_entry(handle, c, 0x0FFFFFFF) != 0) {
-            if (first) (void)fat32_free_cluster_chain(handle, first);
-            return -3;
-        }
-
         if (!first) first = c;
         if (prev) {
             if (fat32_write_fat_entry(handle, prev, c) != 0) {
+                (void)fat32_write_fat_entry(handle, c, 0);
                 if (first) (void)fat32_free_cluster_chain(handle, first);
                 return -3;
             }
         }
 
         prev = c;
-        (void)fat32_zero_cluster(handle, c);
     }
 
     *out_first = first;
@@ -1619,8 +1911,7 @@ static int fat32_find_free_dir_slots(int handle, uint32_t dir_cluster, uint32_t
     }
 
     uint32_t newc = 0;
-    if (fat32_find_free_cluster(handle, &newc) != 0) { kfree(buf); return -5; }
-    if (fat32_write_fat_entry(handle, newc, 0x0FFFFFFF) != 0) { kfree(buf); return -6; }
+    if (fat32_claim_free_cluster(handle, &newc) != 0) { kfree(buf); return -5; }
     if (prev) {
         if (fat32_write_fat_entry(handle, prev, newc) != 0) { kfree(buf); return -6; }
     }
@@ -1946,7 +2237,7 @@ static int fat32_find_entry_location_in_dir(int handle, uint32_t dir_cluster, co
     return -5;
 }
 
-int fat32_unlink_by_path(int handle, const char* path) {
+static int fat32_unlink_nosync(int handle, const char* path) {
     if (!fat32_valid_handle(handle) || !path) return -1;
 
     fat32_fs_t* fs = &fat32_mounts[handle];
@@ -2021,7 +2312,14 @@ int fat32_unlink_by_path(int handle, const char* path) {
     return 0;
 }
 
-int fat32_rmdir_by_path(int handle, const char* path) {
+int fat32_unlink_by_path(int handle, const char* path) {
+    int rc = fat32_unlink_nosync(handle, path);
+    /* FAT changes reach the disk (all copies) once per operation. */
+    if (fat32_fat_flush(handle) != 0 && rc == 0) rc = -12;
+    return rc;
+}
+
+static int fat32_rmdir_nosync(int handle, const char* path) {
     if (!fat32_valid_handle(handle) || !path) return -1;
 
     fat32_fs_t* fs = &fat32_mounts[handle];
@@ -2136,7 +2434,13 @@ empty_scan_done:
     return 0;
 }
 
-int fat32_mkdir_by_path(int handle, const char* path) {
+int fat32_rmdir_by_path(int handle, const char* path) {
+    int rc = fat32_rmdir_nosync(handle, path);
+    if (fat32_fat_flush(handle) != 0 && rc == 0) rc = -17;
+    return rc;
+}
+
+static int fat32_mkdir_nosync(int handle, const char* path) {
     if (!fat32_valid_handle(handle) || !path) return -1;
 
     fat32_fs_t* fs = &fat32_mounts[handle];
@@ -2228,8 +2532,14 @@ int fat32_mkdir_by_path(int handle, const char* path) {
     return 0;
 }
 
+int fat32_mkdir_by_path(int handle, const char* path) {
+    int rc = fat32_mkdir_nosync(handle, path);
+    if (fat32_fat_flush(handle) != 0 && rc == 0) rc = -12;
+    return rc;
+}
+
 // Overwrite an existing file; if it doesn't exist, create it (LFN + 8.3 short alias).
-int fat32_write_file_by_path(int handle, const char* path, const void* data, size_t size) {
+static int fat32_write_file_nosync(int handle, const char* path, const void* data, size_t size) {
     if (!fat32_valid_handle(handle) || !path) return -1;
     if (!data && size != 0) return -2;
 
@@ -2281,33 +2591,180 @@ int fat32_write_file_by_path(int handle, const char* path, const void* data, siz
         return 0;
     }
 
-    void *buf = kmalloc(clus_size);
-    if (!buf) return -9;
-
+    // Whole clusters go straight from the caller's buffer, one request per
+    // contiguous run; only the partial last cluster is padded in a bounce buffer.
     size_t written = 0;
     uint32_t c = first_cluster;
+    uint32_t max_run = fat32_max_run_clusters(fs);
     int guard = 0;
     while (c >= 2 && c < 0x0FFFFFF8 && written < size) {
-        if (++guard > 200000) { kfree(buf); return -10; }
+        if (++guard > 200000) return -10;
 
-        memset(buf, 0, clus_size);
-        size_t chunk = clus_size;
-        if (chunk > (size - written)) chunk = (size - written);
-        memcpy(buf, (const uint8_t*)data + written, chunk);
+        uint32_t run = 1;
+        uint32_t next = 0;
+        size_t whole = (size - written) / clus_size;
+        if (whole > 0) {
+            if (fat32_chain_run(handle, c, whole < max_run ? (uint32_t)whole : max_run, &run, &next) != 0) return -13;
+            if (fat32_write_clusters(handle, c, run, (const uint8_t*)data + written) != 0) return -11;
+            written += (size_t)run * clus_size;
+        } else {
+            void *buf = kmalloc(clus_size);
+            if (!buf) return -9;
+            memset(buf, 0, clus_size);
+            memcpy(buf, (const uint8_t*)data + written, size - written);
+            int wrc = fat32_write_cluster(handle, c, buf);
+            kfree(buf);
+            if (wrc != 0) return -11;
+            written = size;
+            break;
+        }
 
-        if (fat32_write_cluster(handle, c, buf) != 0) { kfree(buf); return -11; }
-        written += chunk;
+        uint32_t last = c + run - 1;
+        if (next >= 0x0FFFFFF8 || next == last) break;
+        c = next;
+    }
 
-        uint32_t next = 0;
-        if (fat32_read_fat_entry(handle, c, &next) != 0) break;
-        if (next >= 0x0FFFFFF8 || next == c) break;
+    // The chain ended (or was unreadable) before all data was written.
+    if (written < size) return -13;
+    return 0;
+}
+
+int fat32_write_file_by_path(int handle, const char* path, const void* data, size_t size) {
+    int rc = fat32_write_file_nosync(handle, path, data, size);
+    if (fat32_fat_flush(handle) != 0 && rc == 0) rc = -12;
+    return rc;
+}
+/* Cluster at position `index` of a chain (0 if the chain is shorter), plus the
+ * chain's last cluster and length. Walks a contiguous run per step. */
+static int fat32_chain_locate(int handle, uint32_t first, uint32_t index,
+                              uint32_t *out_at, uint32_t *out_last, uint32_t *out_len) {
+    *out_at = 0;
+    *out_last = 0;
+    *out_len = 0;
+
+    uint32_t c = first;
+    uint32_t pos = 0;
+    int guard = 0;
+    while (c >= 2 && c < 0x0FFFFFF8) {
+        if (++guard > 200000) return -2;
+        uint32_t run = 0, next = 0;
+        if (fat32_chain_run(handle, c, 0xFFFFFFFFu, &run, &next) != 0) return -1;
+        if (index >= pos && index - pos < run) *out_at = c + (index - pos);
+        pos += run;
+        *out_last = c + run - 1;
+        if (next == *out_last) break;
         c = next;
     }
+    *out_len = pos;
+    return 0;
+}
 
-    kfree(buf);
+/*
+ * Write `size` bytes at `offset` without replacing the rest of the file. The
+ * chain is extended as needed, a gap between the old end and `offset` reads
+ * as zeros, and only the clusters in the written range are touched: whole
+ * clusters go out in contiguous runs, the partial head/tail clusters are
+ * read-modify-written. A missing file is created.
+ */
+static int fat32_write_file_at_nosync(int handle, const char* path, const void* data, size_t size, uint64_t offset) {
+    if (!fat32_valid_handle(handle) || !path) return -1;
+    if (!data && size != 0) return -2;
+
+    fat32_fs_t* fs = &fat32_mounts[handle];
+    uint32_t clus_size = (uint32_t)fs->bytes_per_sector * (uint32_t)fs->sectors_per_cluster;
+    if (clus_size == 0 || clus_size > FAT32_MAX_CLUSTER_SIZE) return -3;
+    if (size == 0) return 0;
+
+    uint64_t end = offset + size;
+    if (end > 0xFFFFFFFFull) return -4; /* FAT32 file size limit */
+
+    struct fat_dir_entry fe;
+    if (fat32_find_file(handle, path, &fe) != 0) {
+        if (fat32_write_file_nosync(handle, path, NULL, 0) != 0) return -5;
+        if (fat32_find_file(handle, path, &fe) != 0) return -5;
+    }
+    if (fe.attr & 0x10) return -6;
+
+    uint32_t first = ((uint32_t)fe.first_cluster_high << 16) | (uint32_t)fe.first_cluster_low;
+    uint32_t old_size = fe.filesize;
+    uint32_t new_size = (end > old_size) ? (uint32_t)end : old_size;
+
+    // Grow the chain to cover new_size.
+    uint32_t at = 0, last = 0, have = 0;
+    if (first >= 2 && fat32_chain_locate(handle, first, 0, &at, &last, &have) != 0) return -7;
+    uint32_t need = (uint32_t)(((uint64_t)new_size + clus_size - 1) / clus_size);
+    if (need > have) {
+        uint32_t more = 0;
+        if (fat32_alloc_cluster_chain(handle, need - have, &more) != 0) return -8;
+        if (have == 0) {
+            first = more;
+        } else if (fat32_write_fat_entry(handle, last, more) != 0) {
+            (void)fat32_free_cluster_chain(handle, more);
+            return -8;
+        }
+    }
+
+    // Start at the old end of file when there is a gap to zero.
+    uint64_t pos = (offset > old_size) ? old_size : offset;
+    uint32_t c = 0;
+    if (fat32_chain_locate(handle, first, (uint32_t)(pos / clus_size), &c, &last, &have) != 0 || c < 2) return -7;
+
+    const uint8_t *src = (const uint8_t*)data;
+    uint32_t max_run = fat32_max_run_clusters(fs);
+    uint8_t *bounce = NULL;
+    int rc = 0;
+
+    while (pos < end) {
+        if (c < 2 || c >= 0x0FFFFFF8) { rc = -7; break; }
+        uint32_t in_off = (uint32_t)(pos % clus_size);
+        uint64_t cstart = pos - in_off;
+
+        if (in_off == 0 && pos >= offset && end - pos >= clus_size) {
+            uint64_t whole = (end - pos) / clus_size;
+            uint32_t run = 0, next = 0;
+            if (fat32_chain_run(handle, c, whole < max_run ? (uint32_t)whole : max_run, &run, &next) != 0) { rc = -9; break; }
+            if (fat32_write_clusters(handle, c, run, src + (pos - offset)) != 0) { rc = -10; break; }
+            pos += (uint64_t)run * clus_size;
+            c = next;
+            continue;
+        }
+
+        if (!bounce) bounce = (uint8_t*)fat32_alloc_cluster_buffer(fs);
+        if (!bounce) { rc = -11; break; }
+        if (cstart < old_size) {
+            if (fat32_read_cluster(handle, c, bounce) != 0) { rc = -9; break; }
+            /* Bytes past the old end of file are undefined on disk. */
+            if (old_size < cstart + clus_size) {
+                memset(bounce + (old_size - cstart), 0, (size_t)(cstart + clus_size - old_size));
+            }
+        } else {
+            memset(bounce, 0, clus_size);
+        }
+
+        uint64_t lo = (cstart > offset) ? cstart : offset;
+        uint64_t hi = (end < cstart + clus_size) ? end : cstart + clus_size;
+        if (lo < hi) memcpy(bounce + (lo - cstart), src + (lo - offset), (size_t)(hi - lo));
+        if (fat32_write_cluster(handle, c, bounce) != 0) { rc = -10; break; }
+
+        pos = cstart + clus_size;
+        if (pos < end && fat32_next_cluster(handle, c, &c) != 0) { rc = -9; break; }
+    }
+
+    if (bounce) kfree(bounce);
+    if (rc != 0) return rc;
+
+    if (new_size != old_size || first != (((uint32_t)fe.first_cluster_high << 16) | (uint32_t)fe.first_cluster_low)) {
+        if (fat32_update_file_entry(handle, path, first, new_size) != 0) return -12;
+    }
     return 0;
 }
 
+int fat32_write_file_at_by_path(int handle, const char* path, const void* data, size_t size, uint64_t offset) {
+    int rc = fat32_write_file_at_nosync(handle, path, data, size, offset);
+    if (fat32_fat_flush(handle) != 0 && rc == 0) rc = -13;
+    return rc;
+}
+
 /* --- ROOT LISTING --- */
 int fat32_list_root(int handle) {
     if (!fat32_valid_handle(handle)) {
@@ -2497,50 +2954,118 @@ int fat32_read_file_by_path(int handle, const char* path, void* out_buf, size_t
 
         /* If this is the final path component and not a directory, it's the file */
         if (path[path_idx] == '\0' && !(entry.attr & 0x10)) {
-            uint32_t file_cluster = current_cluster;
-            uint32_t remaining = entry.filesize;
-            void *cluster_buf = fat32_alloc_cluster_buffer(fs);
-            if (!cluster_buf) return -4;
-            uint8_t* dest = (uint8_t*)out_buf;
+            if (entry.filesize > buf_size) {
+                VGA_Write("FAT32: output buffer too small\n");
+                return -5;
+            }
+
             size_t total_read = 0;
-            uint32_t clus_size = (uint32_t)fs->bytes_per_sector * (uint32_t)fs->sectors_per_cluster;
+            if (fat32_read_at(handle, current_cluster, entry.filesize, 0,
+                              out_buf, entry.filesize, &total_read) != 0) {
+                com_printf(COM1_PORT, "FAT32: failed to read %s\n", component);
+                return -4;
+            }
 
-            while (file_cluster >= 2 && file_cluster < 0x0FFFFFF8 && remaining > 0) {
-                if (fat32_read_cluster(handle, file_cluster, cluster_buf) != 0) {
-                    com_printf(COM1_PORT, "FAT32: failed to read cluster %u\n", file_cluster);
-                    kfree(cluster_buf);
-                    return -4;
-                }
+            if (out_size) *out_size = total_read;
+            return 0;
+        }
+    }
 
-                size_t to_copy = clus_size;
-                if (to_copy > remaining) to_copy = remaining;
-                if (total_read + to_copy > buf_size) {
-                    VGA_Write("FAT32: output buffer too small\n");
-                    return -5;
-                }
+    return -7; /* Not a file or not found */
+}
 
-                memcpy(dest + total_read, cluster_buf, to_copy);
-                total_read += to_copy;
-                remaining -= to_copy;
+/*
+ * Offset read from a resolved cluster chain. Whole clusters land directly in the
+ * caller's buffer, one request per contiguous run; only a partial head/tail
+ * cluster is bounced. The per-mount seek
+ * hint lets a sequential reader continue from where the previous call stopped
+ * instead of walking the FAT from the first cluster every time.
+ */
+int fat32_read_at(int handle, uint32_t first_cluster, uint32_t file_size, uint64_t offset,
+                  void* out_buf, size_t size, size_t* out_size) {
+    if (!fat32_valid_handle(handle) || (!out_buf && size != 0)) return -1;
+    if (out_size) *out_size = 0;
+    if (offset >= file_size || size == 0) return 0;
+    if ((uint64_t)size > file_size - offset) size = (size_t)(file_size - offset);
 
-                uint32_t next;
-                if (fat32_next_cluster(handle, file_cluster, &next) != 0) {
-                    kfree(cluster_buf);
-                    return -6;
-                }
+    fat32_fs_t* fs = &fat32_mounts[handle];
+    uint32_t clus_size = (uint32_t)fs->bytes_per_sector * (uint32_t)fs->sectors_per_cluster;
+    if (clus_size == 0) return -1;
 
-                if (next >= 0x0FFFFFF8 || next == file_cluster) break;
-                file_cluster = next;
-            }
+    uint32_t want = (uint32_t)(offset / clus_size);
+    uint32_t clus = first_cluster;
+    uint32_t idx = 0;
+    if (fs->seek_first == first_cluster && fs->seek_cluster >= 2 && fs->seek_index <= want) {
+        clus = fs->seek_cluster;
+        idx = fs->seek_index;
+    }
+    while (idx < want) {
+        uint32_t next;
+        if (fat32_next_cluster(handle, clus, &next) != 0) return -4;
+        if (next < 2 || next >= 0x0FFFFFF8) return -5; /* chain shorter than dir entry size */
+        clus = next;
+        idx++;
+    }
 
-            if (out_size) *out_size = total_read;
-            // com_printf(COM1_PORT, "FAT32: read file '%s', %u bytes\n", component, (unsigned)total_read);
-            kfree(cluster_buf);
-            return 0;
+    uint8_t* dest = (uint8_t*)out_buf;
+    uint8_t* bounce = NULL;
+    size_t done = 0;
+    int rc = 0;
+
+    while (done < size) {
+        if (clus < 2 || clus >= 0x0FFFFFF8) { rc = -5; break; }
+
+        uint32_t in_off = (uint32_t)((offset + done) % clus_size);
+        size_t n = clus_size - in_off;
+        if (n > size - done) n = size - done;
+
+        uint32_t run = 1;
+        uint32_t next = 0;
+        int have_next = 0;
+        if (n == clus_size) {
+            size_t whole = (size - done) / clus_size;
+            uint32_t max_run = fat32_max_run_clusters(fs);
+            if (whole < max_run) max_run = (uint32_t)whole;
+            if (fat32_chain_run(handle, clus, max_run, &run, &next) != 0) { rc = -4; break; }
+            have_next = 1;
+            if (fat32_read_clusters(handle, clus, run, dest + done) != 0) { rc = -3; break; }
+            n = (size_t)run * clus_size;
+        } else {
+            if (!bounce) bounce = (uint8_t*)fat32_alloc_cluster_buffer(fs);
+            if (!bounce) { rc = -2; break; }
+            if (fat32_read_cluster(handle, clus, bounce) != 0) { rc = -3; break; }
+            memcpy(dest + done, bounce + in_off, n);
+        }
+        done += n;
+        clus += run - 1;
+        idx += run - 1;
+
+        fs->seek_first = first_cluster;
+        fs->seek_cluster = clus;
+        fs->seek_index = idx;
+
+        if (done < size) {
+            if (!have_next && fat32_next_cluster(handle, clus, &next) != 0) { rc = -4; break; }
+            clus = next;
+            idx++;
         }
     }
 
-    return -7; /* Not a file or not found */
+    if (bounce) kfree(bounce);
+    if (out_size) *out_size = done;
+    return rc;
+}
+
+int fat32_read_file_at_by_path(int handle, const char* path, uint64_t offset, void* out_buf, size_t size, size_t* out_size) {
+    if (out_size) *out_size = 0;
+    if (!fat32_valid_handle(handle) || !path) return -1;
+
+    struct fat_dir_entry entry;
+    if (fat32_find_file(handle, path, &entry) != 0) return -2;
+    if (entry.attr & 0x10) return -3;
+
+    uint32_t first = ((uint32_t)entry.first_cluster_high << 16) | (uint32_t)entry.first_cluster_low;
+    return fat32_read_at(handle, first, entry.filesize, offset, out_buf, size, out_size);
 }
 
 int fat32_find_file(int handle, const char* path, struct fat_dir_entry* out_entry) {
@@ -2591,9 +3116,8 @@ int fat32_find_file(int handle, const char* path, struct fat_dir_entry* out_entr
             cluster = next;
         }
 
-        if (!found) { kfree(buf); return -4; } /* Component not found */
-
         kfree(buf);
+        if (!found) return -4; /* Component not found */
 
         /* If not the last component, must be directory */
         if (path[path_idx] != '\0' && !(entry.attr & 0x10)) return -5;
@@ -2606,7 +3130,6 @@ int fat32_find_file(int handle, const char* path, struct fat_dir_entry* out_entr
         /* Last component reached */
         if (path[path_idx] == '\0') {
             memcpy(out_entry, &entry, sizeof(struct fat_dir_entry));
-            kfree(buf);
             return 0;
         }
     }
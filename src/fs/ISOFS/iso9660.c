@@ -521,6 +521,65 @@ int iso9660_find_file(int handle, const char* path, iso9660_dir_entry_t* out_ent
     return -5;
 }
 
+/*
+ * Offset read inside a single extent. Block-aligned spans go straight into the
+ * caller's buffer (in ISO9660_READ_BUFFER_LIMIT pieces, as iso9660_read_extent does);
+ * only a partial first/last logical block is bounced.
+ */
+int iso9660_read_at(int handle, uint32_t extent_lba, uint32_t file_size, uint64_t offset,
+                    void* out_buf, size_t size, size_t* out_size) {
+    if (!iso9660_valid_handle(handle) || (!out_buf && size != 0)) return -1;
+    if (out_size) *out_size = 0;
+    if (offset >= file_size || size == 0) return 0;
+    if ((uint64_t)size > file_size - offset) size = (size_t)(file_size - offset);
+
+    iso9660_fs_t* fs = &iso_mounts[handle];
+    uint32_t lbs = fs->logical_block_size;
+    const uint32_t max_chunk_blocks = ISO9660_READ_BUFFER_LIMIT / lbs;
+
+    uint8_t* dest = (uint8_t*)out_buf;
+    uint8_t* bounce = NULL;
+    size_t done = 0;
+    int rc = 0;
+
+    while (done < size) {
+        uint64_t pos = offset + done;
+        uint32_t blk = (uint32_t)(pos / lbs);
+        uint32_t in_off = (uint32_t)(pos % lbs);
+        size_t left = size - done;
+
+        if (in_off == 0 && left >= lbs) {
+            uint32_t n = (uint32_t)(left / lbs);
+            if (n > max_chunk_blocks) n = max_chunk_blocks;
+            if (read_logical_blocks_rel(fs, extent_lba + blk, n, dest + done) != 0) { rc = -2; break; }
+            done += (size_t)n * lbs;
+        } else {
+            if (!bounce) bounce = (uint8_t*)kmalloc(lbs);
+            if (!bounce) { rc = -3; break; }
+            if (read_logical_blocks_rel(fs, extent_lba + blk, 1, bounce) != 0) { rc = -2; break; }
+            size_t n = lbs - in_off;
+            if (n > left) n = left;
+            memcpy(dest + done, bounce + in_off, n);
+            done += n;
+        }
+    }
+
+    if (bounce) kfree(bounce);
+    if (out_size) *out_size = done;
+    return rc;
+}
+
+int iso9660_read_file_at_by_path(int handle, const char* path, uint64_t offset,
+                                 void* out_buf, size_t size, size_t* out_size) {
+    if (out_size) *out_size = 0;
+
+    iso9660_dir_entry_t entry;
+    if (iso9660_find_file(handle, path, &entry) != 0) return -4;
+    if (entry.flags & 0x02) return -5;
+
+    return iso9660_read_at(handle, entry.extent_lba, entry.size, offset, out_buf, size, out_size);
+}
+
 int iso9660_read_file_by_path(int handle, const char* path, void* out_buf, 
                                size_t buf_size, size_t* out_size) {
     if (!iso9660_valid_handle(handle)) return -1;
@@ -4,6 +4,8 @@
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/fs/MDFS/mdfs_dir.h"
+#include "moduos/fs/MDFS/mdfs_alloc.h"
+#include "moduos/fs/MDFS/mdfs_file.h"
 
 #define MDFS_MAX_MOUNTS 16
 
@@ -72,57 +74,6 @@ static int mdfs_write_inode_raw(const mdfs_fs_t *fs, uint32_t ino, const mdfs_in
     return 0;
 }
 
-static int mdfs_bitmap_test_set(uint8_t *bm, uint64_t idx) {
-    uint64_t byte = idx / 8;
-    uint8_t bit = (uint8_t)(1u << (idx % 8));
-    int was = (bm[byte] & bit) != 0;
-    bm[byte] |= bit;
-    return was;
-}
-
-static int mdfs_alloc_block(const mdfs_fs_t *fs, uint64_t *out_block) {
-    if (!fs || !out_block) return -1;
-    uint8_t *bm = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!bm) return -2;
-    if (mdfs_read_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -3; }
-
-    uint64_t total = fs->sb.total_blocks;
-    uint64_t start = mdfs_meta_end(&fs->sb);
-    if (start < 1) start = 1;
-
-    for (uint64_t b = start; b < total; b++) {
-        if (!mdfs_bitmap_test_set(bm, b)) {
-            if (mdfs_write_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -4; }
-            kfree(bm);
-            *out_block = b;
-            return 0;
-        }
-    }
-
-    kfree(bm);
-    return -5;
-}
-
-static int mdfs_alloc_inode(const mdfs_fs_t *fs, uint32_t *out_ino) {
-    if (!fs || !out_ino) return -1;
-    uint8_t *bm = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!bm) return -2;
-    if (mdfs_read_block(fs->vdrive_id, fs->start_lba, fs->sb.inode_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -3; }
-
-    uint64_t total = fs->sb.total_inodes;
-    for (uint64_t i = 1; i < total; i++) {
-        if (!mdfs_bitmap_test_set(bm, i)) {
-            if (mdfs_write_block(fs->vdrive_id, fs->start_lba, fs->sb.inode_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -4; }
-            kfree(bm);
-            *out_ino = (uint32_t)i;
-            return 0;
-        }
-    }
-
-    kfree(bm);
-    return -5;
-}
-
 static int mdfs_path_is_root(const char *path) {
     return (!path || path[0] == 0 || (path[0] == '/' && path[1] == 0));
 }
@@ -285,6 +236,10 @@ int mdfs_mount(int vdrive_id, uint32_t start_lba) {
     if (sb.magic != MDFS_MAGIC) return -3;
     if (sb.version != MDFS_VERSION) return -4; /* requires v2 */
     if (sb.block_size != MDFS_BLOCK_SIZE) return -5;
+    if (sb.features & ~MDFS_FEATURE_SUPPORTED) {
+        com_printf(COM1_PORT, "[MDFS] unsupported features 0x%x\n", sb.features & ~MDFS_FEATURE_SUPPORTED);
+        return -7;
+    }
 
     // Verify checksum (best-effort; placeholder hash)
     uint32_t saved = sb.checksum;
@@ -306,9 +261,50 @@ int mdfs_mount(int vdrive_id, uint32_t start_lba) {
     g_mdfs[handle].start_lba = start_lba;
     g_mdfs[handle].sb = sb;
 
+    int arc = mdfs_alloc_init(&g_mdfs[handle]);
+    if (arc != 0) {
+        com_printf(COM1_PORT, "[MDFS] cannot load allocation bitmaps (%d)\n", arc);
+        memset(&g_mdfs[handle], 0, sizeof(g_mdfs[handle]));
+        return -8;
+    }
+
+    /* Buffered appends must not wait for close or unmount to reach the disk. */
+    (void)vdrive_register_writeback_hook(mdfs_delalloc_writeback);
+
     return handle;
 }
 
+int mdfs_unmount(int handle) {
+    if (handle < 0 || handle >= MDFS_MAX_MOUNTS || !g_mdfs[handle].in_use) return -1;
+    mdfs_fs_t *fs = &g_mdfs[handle];
+
+    // Buffered appends get their blocks now; then record the free counts.
+    // Whatever still fails to write cannot outlive the mount.
+    int rc = mdfs_delalloc_flush(fs, 0);
+    if (rc != 0) mdfs_delalloc_drop(fs, 0);
+    uint64_t free_blocks = 0, free_inodes = 0;
+    mdfs_alloc_counts(fs, &free_blocks, &free_inodes);
+    fs->sb.free_blocks = free_blocks;
+    fs->sb.free_inodes = free_inodes;
+    mdfs_alloc_release(fs);
+
+    uint8_t *blk = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
+    if (blk) {
+        fs->sb.checksum = 0;
+        fs->sb.checksum = mdfs_crc32(&fs->sb, sizeof(fs->sb));
+        memset(blk, 0, MDFS_BLOCK_SIZE);
+        memcpy(blk, &fs->sb, sizeof(fs->sb));
+        if (mdfs_write_block(fs->vdrive_id, fs->start_lba, 1, blk) != VDRIVE_SUCCESS ||
+            mdfs_write_block(fs->vdrive_id, fs->start_lba, 2, blk) != VDRIVE_SUCCESS) {
+            rc = -2;
+        }
+        kfree(blk);
+    }
+
+    memset(fs, 0, sizeof(*fs));
+    return rc;
+}
+
 int mdfs_mkfs(int vdrive_id, uint32_t start_lba, uint32_t sectors, const char *label) {
     (void)label;
 
@@ -320,14 +316,14 @@ int mdfs_mkfs(int vdrive_id, uint32_t start_lba, uint32_t sectors, const char *l
 
     uint64_t total_blocks = (uint64_t)sectors / (MDFS_BLOCK_SIZE/512u);
 
-    // Layout (very simple v1):
-    // block0 reserved, block1 super, block2 backup, block3 block bitmap (1 block),
-    // block4 inode bitmap (1 block), block5.. inode table (8 blocks), data after.
+    // Layout:
+    // block0 reserved, block1 super, block2 backup, block3.. block bitmap (one block
+    // per 128 MiB), then inode bitmap (1 block), inode table (8 blocks), data after.
     uint64_t block_bitmap_start = 3;
-    uint64_t block_bitmap_blocks = 1;
-    uint64_t inode_bitmap_start = 4;
+    uint64_t block_bitmap_blocks = (total_blocks + MDFS_BITS_PER_BITMAP_BLOCK - 1) / MDFS_BITS_PER_BITMAP_BLOCK;
+    uint64_t inode_bitmap_start = block_bitmap_start + block_bitmap_blocks;
     uint64_t inode_bitmap_blocks = 1;
-    uint64_t inode_table_start  = 5;
+    uint64_t inode_table_start  = inode_bitmap_start + inode_bitmap_blocks;
     uint64_t inode_table_blocks = 8;
 
     uint64_t meta_end = inode_table_start + inode_table_blocks;
@@ -352,6 +348,7 @@ int mdfs_mkfs(int vdrive_id, uint32_t start_lba, uint32_t sectors, const char *l
     sb.inode_table_start = inode_table_start;
     sb.inode_table_blocks = inode_table_blocks;
     sb.root_inode = 1;
+    sb.features = MDFS_FEATURE_EXTENTS;
 
     // checksum (CRC32)
     sb.checksum = 0;
@@ -382,6 +379,7 @@ int mdfs_mkfs(int vdrive_id, uint32_t start_lba, uint32_t sectors, const char *l
     memset(blk, 0, MDFS_BLOCK_SIZE);
 
     // block bitmap: mark blocks [0..meta_end-1] used AND root_dir_block used
+    // (the metadata always fits in the range of the first bitmap block)
     uint8_t *bb = blk;
     for (uint64_t b = 0; b < meta_end; b++) {
         bb[b / 8] |= (uint8_t)(1u << (b % 8));
@@ -391,9 +389,13 @@ int mdfs_mkfs(int vdrive_id, uint32_t start_lba, uint32_t sectors, const char *l
     // account for allocated root dir block
     if (sb.free_blocks > 0) sb.free_blocks -= 1;
 
-    if (vdrive_write((uint8_t)vdrive_id, (uint64_t)(start_lba + (uint32_t)(block_bitmap_start * (MDFS_BLOCK_SIZE/512u))), (MDFS_BLOCK_SIZE/512u), blk) != VDRIVE_SUCCESS) {
-        kfree(blk);
-        return -8;
+    for (uint64_t i = 0; i < block_bitmap_blocks; i++) {
+        uint32_t lba = start_lba + (uint32_t)((block_bitmap_start + i) * (MDFS_BLOCK_SIZE/512u));
+        if (vdrive_write((uint8_t)vdrive_id, (uint64_t)lba, (MDFS_BLOCK_SIZE/512u), blk) != VDRIVE_SUCCESS) {
+            kfree(blk);
+            return -8;
+        }
+        if (i == 0) memset(blk, 0, MDFS_BLOCK_SIZE);
     }
 
     // inode bitmap: mark inode 1 used
@@ -446,12 +448,13 @@ int mdfs_mkfs(int vdrive_id, uint32_t start_lba, uint32_t sectors, const char *l
         tmp.vdrive_id = vdrive_id;
         tmp.start_lba = start_lba;
         tmp.sb = sb;
+        if (mdfs_alloc_init(&tmp) != 0) { kfree(blk); return -16; }
 
         // lost+found directory
         uint32_t lf_ino = 0;
         if (mdfs_alloc_inode(&tmp, &lf_ino) == 0) {
-            uint64_t lf_block = 0;
-            if (mdfs_alloc_block(&tmp, &lf_block) == 0) {
+            uint64_t lf_block = 0, lf_count = 0;
+            if (mdfs_alloc_blocks(&tmp, 0, 1, &lf_block, &lf_count) == 0) {
                 // zero dir block
                 uint8_t *z = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
                 if (z) {
@@ -474,28 +477,18 @@ int mdfs_mkfs(int vdrive_id, uint32_t start_lba, uint32_t sectors, const char *l
         uint32_t tf_ino = 0;
         if (mdfs_alloc_inode(&tmp, &tf_ino) == 0) {
             mdfs_inode_t fi;
-            memset(&fi, 0, sizeof(fi));
-            fi.mode = 0x8000;
-            fi.link_count = 1;
+            mdfs_inode_init_file(&tmp, &fi);
             const char *msg = "MDFS OK\n";
-            size_t msg_len = strlen(msg);
-
-            // allocate one data block
-            uint64_t fb = 0;
-            if (mdfs_alloc_block(&tmp, &fb) == 0) {
-                uint8_t *z = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-                if (z) {
-                    memset(z, 0, MDFS_BLOCK_SIZE);
-                    memcpy(z, msg, msg_len);
-                    (void)mdfs_write_block(vdrive_id, start_lba, fb, z);
-                    kfree(z);
-                }
-                fi.direct[0] = fb;
-                fi.size_bytes = msg_len;
-                (void)mdfs_write_inode_raw(&tmp, tf_ino, &fi);
+            if (mdfs_inode_write(&tmp, tf_ino, &fi, msg, strlen(msg), 0) == 0) {
                 (void)mdfs_v2_root_add_export(&tmp, "test.txt", tf_ino, 1);
             }
         }
+
+        uint64_t free_blocks = 0, free_inodes = 0;
+        mdfs_alloc_counts(&tmp, &free_blocks, &free_inodes);
+        sb.free_blocks = free_blocks;
+        sb.free_inodes = free_inodes;
+        mdfs_alloc_release(&tmp);
     }
 
     // Rewrite superblock (with updated free_blocks + checksum)
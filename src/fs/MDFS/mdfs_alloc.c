@@ -0,0 +1,419 @@
+#include "moduos/fs/MDFS/mdfs_alloc.h"
+#include "moduos/fs/MDFS/mdfs_disk.h"
+#include "moduos/drivers/Drive/vDrive.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/COM/com.h"
+
+/*
+ * Allocation bitmaps.
+ *
+ * Each mount keeps its inode bitmap and the first MDFS_BITMAP_MAX_BYTES of
+ * its block bitmap in memory for its lifetime. The block bitmap is split into
+ * groups of MDFS_BITS_PER_BITMAP_BLOCK blocks (one bitmap block each) with a
+ * free count per group, so searches step over full groups without looking at
+ * their bits. Allocating and freeing in the cached groups only change memory
+ * and mark the bitmap block dirty; mdfs_alloc_flush() writes dirty blocks back
+ * at the end of each modifying operation and at unmount.
+ *
+ * Groups past the cache (volumes over 32 GiB) are read from disk one bitmap
+ * block at a time when a search reaches them, and changes to them are written
+ * through. Their free counts are learned on first read; until then they are
+ * assumed to have space, and the volume free count comes from the superblock.
+ *
+ * Block allocation prefers the free run right behind `goal` (the end of the
+ * file's previous extent) when it is long enough, otherwise the first free run
+ * of the full requested length, otherwise the longest run seen.
+ *
+ * One lock per mount covers the state and is held across bitmap I/O
+ * (order: FS driver -> vDrive).
+ */
+
+#define MDFS_BITMAP_MAX_BYTES (1024u * 1024u)   /* 32 GiB of 4 KiB blocks cached */
+#define MDFS_GROUP_UNKNOWN    UINT32_MAX        /* uncached group not read yet */
+
+struct mdfs_alloc_state {
+    spinlock_t lock;
+    uint8_t *block_map;
+    uint8_t *inode_map;
+    uint32_t *group_free;   // free blocks per group (all groups)
+    uint8_t *block_dirty;   // per cached group (= block bitmap block)
+    uint8_t *inode_dirty;   // per inode bitmap block
+    uint8_t *disk_buf;      // one bitmap block of an uncached group
+    uint64_t groups;
+    uint64_t cached;        // groups held in block_map
+    uint64_t inode_blocks;
+    uint64_t data_start;    // first allocatable block
+    uint64_t cache_limit;   // first block past the cached groups
+    uint64_t limit;         // first block past the allocatable range
+    uint64_t inode_limit;
+    uint64_t free_blocks;
+    uint64_t free_inodes;
+};
+
+static const uint8_t mdfs_nibble_bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+static int mdfs_bit(const uint8_t *map, uint64_t b) {
+    return (map[b / 8] >> (b % 8)) & 1u;
+}
+
+// Free bits in [from, to).
+static uint64_t mdfs_count_free(const uint8_t *map, uint64_t from, uint64_t to) {
+    uint64_t used = 0, b = from;
+    while (b < to && (b % 8)) used += mdfs_bit(map, b++);
+    while (b + 8 <= to) {
+        uint8_t v = map[b / 8];
+        used += mdfs_nibble_bits[v & 0xF] + mdfs_nibble_bits[v >> 4];
+        b += 8;
+    }
+    while (b < to) used += mdfs_bit(map, b++);
+    return (to - from) - used;
+}
+
+static int mdfs_map_read(const mdfs_fs_t *fs, uint64_t first, uint64_t blocks, uint8_t *out) {
+    for (uint64_t i = 0; i < blocks;) {
+        uint64_t n = blocks - i;
+        if (n > MDFS_MAX_IO_BLOCKS) n = MDFS_MAX_IO_BLOCKS;
+        if (mdfs_disk_read_blocks(fs->vdrive_id, fs->start_lba, first + i, (uint32_t)n, out + i * MDFS_BLOCK_SIZE) != VDRIVE_SUCCESS) return -1;
+        i += n;
+    }
+    return 0;
+}
+
+// Write the dirty blocks of one bitmap, coalescing neighbours into one request.
+static int mdfs_map_flush_locked(const mdfs_fs_t *fs, uint64_t first, uint64_t blocks, uint8_t *map, uint8_t *dirty) {
+    int rc = 0;
+    uint64_t i = 0;
+    while (i < blocks) {
+        if (!dirty[i]) { i++; continue; }
+        uint64_t n = 1;
+        while (i + n < blocks && dirty[i + n] && n < MDFS_MAX_IO_BLOCKS) n++;
+        if (mdfs_disk_write_blocks(fs->vdrive_id, fs->start_lba, first + i, (uint32_t)n, map + i * MDFS_BLOCK_SIZE) != VDRIVE_SUCCESS) {
+            rc = -2;
+        } else {
+            memset(dirty + i, 0, (size_t)n);
+        }
+        i += n;
+    }
+    return rc;
+}
+
+// First and last+1 block of group g inside the allocatable range.
+static void mdfs_group_span(const struct mdfs_alloc_state *st, uint64_t g, uint64_t *from, uint64_t *to) {
+    *from = g * (uint64_t)MDFS_BITS_PER_BITMAP_BLOCK;
+    *to = *from + MDFS_BITS_PER_BITMAP_BLOCK;
+    if (*from < st->data_start) *from = st->data_start;
+    if (*to > st->limit) *to = st->limit;
+}
+
+static void mdfs_alloc_free_state(struct mdfs_alloc_state *st) {
+    if (st->block_map) kfree(st->block_map);
+    if (st->inode_map) kfree(st->inode_map);
+    if (st->group_free) kfree(st->group_free);
+    if (st->block_dirty) kfree(st->block_dirty);
+    if (st->inode_dirty) kfree(st->inode_dirty);
+    if (st->disk_buf) kfree(st->disk_buf);
+    kfree(st);
+}
+
+int mdfs_alloc_init(mdfs_fs_t *fs) {
+    if (!fs) return -1;
+    fs->alloc = NULL;
+
+    struct mdfs_alloc_state *st = (struct mdfs_alloc_state*)kzalloc(sizeof(*st));
+    if (!st) return -2;
+    spinlock_init(&st->lock);
+
+    st->groups = fs->sb.block_bitmap_blocks;
+    st->cached = st->groups;
+    if (st->cached > MDFS_BITMAP_MAX_BYTES / MDFS_BLOCK_SIZE) {
+        st->cached = MDFS_BITMAP_MAX_BYTES / MDFS_BLOCK_SIZE;
+        com_printf(COM1_PORT, "[MDFS] caching %u of %u block bitmap groups; the rest is read from disk\n",
+                   (unsigned)st->cached, (unsigned)st->groups);
+    }
+    st->inode_blocks = fs->sb.inode_bitmap_blocks;
+    st->data_start = fs->sb.inode_table_start + fs->sb.inode_table_blocks;
+    st->limit = st->groups * (uint64_t)MDFS_BITS_PER_BITMAP_BLOCK;
+    if (st->limit > fs->sb.total_blocks) st->limit = fs->sb.total_blocks;
+    st->cache_limit = st->cached * (uint64_t)MDFS_BITS_PER_BITMAP_BLOCK;
+    if (st->cache_limit > st->limit) st->cache_limit = st->limit;
+    st->inode_limit = st->inode_blocks * (uint64_t)MDFS_BITS_PER_BITMAP_BLOCK;
+    if (st->inode_limit > fs->sb.total_inodes) st->inode_limit = fs->sb.total_inodes;
+    if (st->groups == 0 || st->inode_blocks == 0 || st->data_start >= st->limit) { kfree(st); return -3; }
+
+    st->block_map = (uint8_t*)kmalloc((size_t)(st->cached * MDFS_BLOCK_SIZE));
+    st->inode_map = (uint8_t*)kmalloc((size_t)(st->inode_blocks * MDFS_BLOCK_SIZE));
+    st->group_free = (uint32_t*)kzalloc((size_t)st->groups * sizeof(uint32_t));
+    st->block_dirty = (uint8_t*)kzalloc((size_t)st->cached);
+    st->inode_dirty = (uint8_t*)kzalloc((size_t)st->inode_blocks);
+    if (st->cached < st->groups) st->disk_buf = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
+    if (!st->block_map || !st->inode_map || !st->group_free || !st->block_dirty || !st->inode_dirty ||
+        (st->cached < st->groups && !st->disk_buf)) {
+        mdfs_alloc_free_state(st);
+        return -2;
+    }
+
+    if (mdfs_map_read(fs, fs->sb.block_bitmap_start, st->cached, st->block_map) != 0 ||
+        mdfs_map_read(fs, fs->sb.inode_bitmap_start, st->inode_blocks, st->inode_map) != 0) {
+        mdfs_alloc_free_state(st);
+        return -4;
+    }
+
+    for (uint64_t g = 0; g < st->cached; g++) {
+        uint64_t from, to;
+        mdfs_group_span(st, g, &from, &to);
+        st->group_free[g] = (from < to) ? (uint32_t)mdfs_count_free(st->block_map, from, to) : 0;
+        st->free_blocks += st->group_free[g];
+    }
+    if (st->cached < st->groups) {
+        // Not counted bit by bit: the superblock says what the rest holds.
+        for (uint64_t g = st->cached; g < st->groups; g++) st->group_free[g] = MDFS_GROUP_UNKNOWN;
+        if (fs->sb.free_blocks > st->free_blocks) st->free_blocks = fs->sb.free_blocks;
+    }
+    st->free_inodes = (st->inode_limit > 1) ? mdfs_count_free(st->inode_map, 1, st->inode_limit) : 0;
+
+    fs->alloc = st;
+    return 0;
+}
+
+int mdfs_alloc_flush(const mdfs_fs_t *fs) {
+    if (!fs || !fs->alloc) return -1;
+    struct mdfs_alloc_state *st = fs->alloc;
+
+    spinlock_lock(&st->lock);
+    int rc = mdfs_map_flush_locked(fs, fs->sb.block_bitmap_start, st->cached, st->block_map, st->block_dirty);
+    if (mdfs_map_flush_locked(fs, fs->sb.inode_bitmap_start, st->inode_blocks, st->inode_map, st->inode_dirty) != 0) rc = -2;
+    spinlock_unlock(&st->lock);
+    return rc;
+}
+
+void mdfs_alloc_release(mdfs_fs_t *fs) {
+    if (!fs || !fs->alloc) return;
+    if (mdfs_alloc_flush(fs) != 0) {
+        com_write_string(COM1_PORT, "[MDFS] dirty bitmap blocks lost at unmount\n");
+    }
+    mdfs_alloc_free_state(fs->alloc);
+    fs->alloc = NULL;
+}
+
+void mdfs_alloc_counts(const mdfs_fs_t *fs, uint64_t *free_blocks, uint64_t *free_inodes) {
+    struct mdfs_alloc_state *st = fs ? fs->alloc : NULL;
+    if (!st) return;
+    spinlock_lock(&st->lock);
+    if (free_blocks) *free_blocks = st->free_blocks;
+    if (free_inodes) *free_inodes = st->free_inodes;
+    spinlock_unlock(&st->lock);
+}
+
+// End of the free run starting at b, stopping at `to`.
+static uint64_t mdfs_run_end(const uint8_t *map, uint64_t b, uint64_t to) {
+    while (b < to) {
+        if ((b % 8) == 0 && b + 8 <= to && map[b / 8] == 0) { b += 8; continue; }
+        if (mdfs_bit(map, b)) break;
+        b++;
+    }
+    return b;
+}
+
+/* Look for a free run of `want` blocks in [from, to) of map, skipping groups
+ * that group_free (if given) marks full. Returns 1 with it in *best_*, else 0
+ * with the longest (shorter) run seen so far kept there. */
+static int mdfs_find_run(const uint8_t *map, const uint32_t *group_free, uint64_t from, uint64_t to,
+                         uint64_t want, uint64_t *best_start, uint64_t *best_len) {
+    uint64_t b = from;
+    while (b < to) {
+        if (group_free && (b % MDFS_BITS_PER_BITMAP_BLOCK) == 0 && group_free[b / MDFS_BITS_PER_BITMAP_BLOCK] == 0) {
+            b += MDFS_BITS_PER_BITMAP_BLOCK;
+            continue;
+        }
+        if ((b % 8) == 0 && b + 8 <= to && map[b / 8] == 0xFF) { b += 8; continue; }
+        if (mdfs_bit(map, b)) { b++; continue; }
+
+        uint64_t cap = (want > to - b) ? to : b + want;
+        uint64_t e = mdfs_run_end(map, b, cap);
+        if (e - b > *best_len) {
+            *best_start = b;
+            *best_len = e - b;
+        }
+        if (e - b >= want) return 1;
+        b = e;
+    }
+    return 0;
+}
+
+// Read uncached group g into disk_buf and learn its free count.
+static int mdfs_disk_group_load(const mdfs_fs_t *fs, struct mdfs_alloc_state *st, uint64_t g) {
+    if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start + g, st->disk_buf) != VDRIVE_SUCCESS) return -1;
+    if (st->group_free[g] == MDFS_GROUP_UNKNOWN) {
+        uint64_t from, to;
+        mdfs_group_span(st, g, &from, &to);
+        uint64_t base = g * (uint64_t)MDFS_BITS_PER_BITMAP_BLOCK;
+        st->group_free[g] = (from < to) ? (uint32_t)mdfs_count_free(st->disk_buf, from - base, to - base) : 0;
+    }
+    return 0;
+}
+
+/* mdfs_find_run() over the uncached groups in [from, to), reading each
+ * bitmap block that may have space. Runs end at group boundaries. */
+static int mdfs_disk_find_run(const mdfs_fs_t *fs, struct mdfs_alloc_state *st, uint64_t from, uint64_t to,
+                              uint64_t want, uint64_t *best_start, uint64_t *best_len) {
+    if (from < st->cache_limit) from = st->cache_limit;
+    while (from < to) {
+        uint64_t g = from / MDFS_BITS_PER_BITMAP_BLOCK;
+        uint64_t base = g * (uint64_t)MDFS_BITS_PER_BITMAP_BLOCK;
+        uint64_t end = base + MDFS_BITS_PER_BITMAP_BLOCK;
+        if (end > to) end = to;
+        if (st->group_free[g] != 0 && mdfs_disk_group_load(fs, st, g) == 0 && st->group_free[g] != 0) {
+            uint64_t bs = 0, bl = 0;
+            int found = mdfs_find_run(st->disk_buf, NULL, from - base, end - base, want, &bs, &bl);
+            if (bl > *best_len) {
+                *best_start = base + bs;
+                *best_len = bl;
+            }
+            if (found) return 1;
+        }
+        from = end;
+    }
+    return 0;
+}
+
+/* Set (used) or clear [start, start + count) in the uncached groups, writing
+ * each bitmap block straight back. Returns the number of bits changed. */
+static int64_t mdfs_disk_mark(const mdfs_fs_t *fs, struct mdfs_alloc_state *st, uint64_t start, uint64_t count, int used) {
+    int64_t changed = 0;
+    uint64_t b = start, end = start + count;
+    while (b < end) {
+        uint64_t g = b / MDFS_BITS_PER_BITMAP_BLOCK;
+        uint64_t base = g * (uint64_t)MDFS_BITS_PER_BITMAP_BLOCK;
+        uint64_t gend = base + MDFS_BITS_PER_BITMAP_BLOCK;
+        if (gend > end) gend = end;
+        if (mdfs_disk_group_load(fs, st, g) != 0) return -1;
+        uint32_t n = 0;
+        for (; b < gend; b++) {
+            uint64_t bit = b - base;
+            uint8_t m = (uint8_t)(1u << (bit % 8));
+            if (!!(st->disk_buf[bit / 8] & m) == !!used) continue;
+            if (used) st->disk_buf[bit / 8] |= m;
+            else st->disk_buf[bit / 8] &= (uint8_t)~m;
+            n++;
+        }
+        if (n && mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start + g, st->disk_buf) != VDRIVE_SUCCESS) return -1;
+        if (used) st->group_free[g] -= n;
+        else st->group_free[g] += n;
+        changed += n;
+    }
+    return changed;
+}
+
+int mdfs_alloc_blocks(const mdfs_fs_t *fs, uint64_t goal, uint64_t want, uint64_t *out_start, uint64_t *out_count) {
+    if (!fs || !fs->alloc || !out_start || !out_count || want == 0) return -1;
+    struct mdfs_alloc_state *st = fs->alloc;
+
+    spinlock_lock(&st->lock);
+    uint64_t lo = st->data_start, hi = st->cache_limit, end = st->limit;
+    if (st->free_blocks == 0) { spinlock_unlock(&st->lock); return -5; }
+    if (goal < lo || goal >= end) goal = lo;
+
+    uint64_t s = goal, len = 0;
+    if (goal < hi) {
+        if (!mdfs_bit(st->block_map, goal)) {
+            uint64_t cap = (want > hi - goal) ? hi : goal + want;
+            len = mdfs_run_end(st->block_map, goal, cap) - goal;
+        }
+        if (len < want) {
+            uint64_t bs = 0, bl = 0;
+            if (!mdfs_find_run(st->block_map, st->group_free, goal, hi, want, &bs, &bl) &&
+                !mdfs_find_run(st->block_map, st->group_free, lo, goal, want, &bs, &bl))
+                (void)mdfs_disk_find_run(fs, st, hi, end, want, &bs, &bl);
+            if (bl > len) { s = bs; len = bl; }
+        }
+    } else {
+        // The goal lies past the cache: stay near it, on disk.
+        uint64_t bs = 0, bl = 0;
+        if (!mdfs_disk_find_run(fs, st, goal, end, want, &bs, &bl) &&
+            !mdfs_disk_find_run(fs, st, hi, goal, want, &bs, &bl))
+            (void)mdfs_find_run(st->block_map, st->group_free, lo, hi, want, &bs, &bl);
+        s = bs;
+        len = bl;
+    }
+    if (len == 0) { spinlock_unlock(&st->lock); return -5; }
+
+    if (s >= hi) {
+        if (mdfs_disk_mark(fs, st, s, len, 1) != (int64_t)len) { spinlock_unlock(&st->lock); return -4; }
+    } else {
+        for (uint64_t b = s; b < s + len; b++) {
+            st->block_map[b / 8] |= (uint8_t)(1u << (b % 8));
+            uint64_t g = b / MDFS_BITS_PER_BITMAP_BLOCK;
+            st->group_free[g]--;
+            st->block_dirty[g] = 1;
+        }
+    }
+    st->free_blocks = st->free_blocks > len ? st->free_blocks - len : 0;
+    spinlock_unlock(&st->lock);
+
+    *out_start = s;
+    *out_count = len;
+    return 0;
+}
+
+int mdfs_free_blocks(const mdfs_fs_t *fs, uint64_t start, uint64_t count) {
+    if (!fs || !fs->alloc || count == 0) return -1;
+    struct mdfs_alloc_state *st = fs->alloc;
+    if (start < st->data_start || start + count > st->limit || start + count < start) return -1;
+
+    int rc = 0;
+    spinlock_lock(&st->lock);
+    uint64_t b = start, end = start + count;
+    for (; b < end && b < st->cache_limit; b++) {
+        uint8_t bit = (uint8_t)(1u << (b % 8));
+        if (!(st->block_map[b / 8] & bit)) continue;
+        st->block_map[b / 8] &= (uint8_t)~bit;
+        uint64_t g = b / MDFS_BITS_PER_BITMAP_BLOCK;
+        st->group_free[g]++;
+        st->block_dirty[g] = 1;
+        st->free_blocks++;
+    }
+    if (b < end) {
+        int64_t n = mdfs_disk_mark(fs, st, b, end - b, 0);
+        if (n < 0) rc = -4;
+        else st->free_blocks += (uint64_t)n;
+    }
+    spinlock_unlock(&st->lock);
+    return rc;
+}
+
+int mdfs_alloc_inode(const mdfs_fs_t *fs, uint32_t *out_ino) {
+    if (!fs || !fs->alloc || !out_ino) return -1;
+    struct mdfs_alloc_state *st = fs->alloc;
+
+    spinlock_lock(&st->lock);
+    for (uint64_t i = 1; i < st->inode_limit && st->free_inodes; i++) {
+        if ((i % 8) == 0 && i + 8 <= st->inode_limit && st->inode_map[i / 8] == 0xFF) { i += 7; continue; }
+        if (mdfs_bit(st->inode_map, i)) continue;
+        st->inode_map[i / 8] |= (uint8_t)(1u << (i % 8));
+        st->inode_dirty[i / MDFS_BITS_PER_BITMAP_BLOCK] = 1;
+        st->free_inodes--;
+        spinlock_unlock(&st->lock);
+        *out_ino = (uint32_t)i;
+        return 0;
+    }
+    spinlock_unlock(&st->lock);
+    return -5;
+}
+
+int mdfs_free_inode(const mdfs_fs_t *fs, uint32_t ino) {
+    if (!fs || !fs->alloc || ino == 0) return -1;
+    struct mdfs_alloc_state *st = fs->alloc;
+    if (ino >= st->inode_limit) return -1;
+
+    spinlock_lock(&st->lock);
+    uint8_t bit = (uint8_t)(1u << (ino % 8));
+    if (st->inode_map[ino / 8] & bit) {
+        st->inode_map[ino / 8] &= (uint8_t)~bit;
+        st->inode_dirty[ino / MDFS_BITS_PER_BITMAP_BLOCK] = 1;
+        st->free_inodes++;
+    }
+    spinlock_unlock(&st->lock);
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include "moduos/kernel/memory/string.h"
 #include "moduos/fs/MDFS/mdfs_dir.h"
 #include "moduos/fs/MDFS/mdfs_disk.h"
+#include "moduos/fs/MDFS/mdfs_alloc.h"
+#include "moduos/fs/MDFS/mdfs_file.h"
 #include "moduos/kernel/COM/com.h"
 
 // Implementations live in mdfs.c (helpers are static there), but we expose a minimal
@@ -172,6 +174,7 @@ int mdfs_stat_by_path(int handle, const char *path, uint32_t *out_size, int *out
             *out_size = 0;
         } else {
             mdfs_inode_t ino;
+            if (mdfs_delalloc_flush(fs, ino_n) != 0) return -3;
             if (mdfs_disk_read_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_n, &ino) != 0) return -3;
             *out_size = (uint32_t)ino.size_bytes;
         }
@@ -195,105 +198,55 @@ int mdfs_read_file_by_path(int handle, const char *path, void *buffer, size_t bu
     if (typ != 1) return -3;
 
     mdfs_inode_t ino;
+    if (mdfs_delalloc_flush(fs, ino_n) != 0) return -4;
     if (mdfs_disk_read_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_n, &ino) != 0) return -4;
 
-    // read direct blocks only (v1)
-    uint8_t *blk = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!blk) return -5;
-
-    size_t to_read = (size_t)ino.size_bytes;
-    if (to_read > buffer_size) to_read = buffer_size;
-
-    size_t done = 0;
-    while (done < to_read) {
-        uint64_t bi = done / MDFS_BLOCK_SIZE;
-        uint64_t boff = done % MDFS_BLOCK_SIZE;
-        if (bi >= MDFS_MAX_DIRECT) break;
-        uint64_t bno = ino.direct[bi];
-        if (!bno) break;
-        if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, bno, blk) != VDRIVE_SUCCESS) { kfree(blk); return -6; }
-        size_t chunk = MDFS_BLOCK_SIZE - (size_t)boff;
-        if (chunk > (to_read - done)) chunk = to_read - done;
-        memcpy((uint8_t*)buffer + done, blk + boff, chunk);
-        done += chunk;
-    }
+    return mdfs_inode_read(fs, &ino, 0, buffer, buffer_size, bytes_read);
+}
 
-    kfree(blk);
-    *bytes_read = done;
-    return 0;
+int mdfs_read_file_at_by_inode(int handle, uint32_t inode, uint64_t offset, void *buffer, size_t size, size_t *bytes_read) {
+    const mdfs_fs_t *fs = mdfs_get_fs(handle);
+    if (!fs || (!buffer && size != 0) || !bytes_read) return -1;
+    *bytes_read = 0;
+
+    mdfs_inode_t ino;
+    if (mdfs_delalloc_flush(fs, inode) != 0) return -4;
+    if (mdfs_disk_read_inode(fs->vdrive_id, fs->start_lba, &fs->sb, inode, &ino) != 0) return -4;
+    if ((ino.mode & 0xF000) != 0x8000) return -3;
+    return mdfs_inode_read(fs, &ino, offset, buffer, size, bytes_read);
 }
 
-static int mdfs_alloc_inode_simple(const mdfs_fs_t *fs, uint32_t *out_ino) {
-    // simple bitmap scan (1 block)
-    uint8_t *bm = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!bm) return -1;
-    if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, fs->sb.inode_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -2; }
-
-    for (uint32_t i = 1; i < (uint32_t)fs->sb.total_inodes; i++) {
-        uint32_t byte = i / 8;
-        uint8_t bit = (uint8_t)(1u << (i % 8));
-        if ((bm[byte] & bit) == 0) {
-            bm[byte] |= bit;
-            if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, fs->sb.inode_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -3; }
-            kfree(bm);
-            *out_ino = i;
-            return 0;
-        }
-    }
+int mdfs_read_file_at_by_path(int handle, const char *path, uint64_t offset, void *buffer, size_t size, size_t *bytes_read) {
+    const mdfs_fs_t *fs = mdfs_get_fs(handle);
+    if (!fs || !path || !bytes_read) return -1;
+    *bytes_read = 0;
 
-    kfree(bm);
-    return -4;
+    uint32_t ino_n = 0;
+    uint8_t typ = 0;
+    if (mdfs_lookup_path(fs, path, &ino_n, &typ) != 0) return -2;
+    if (typ != 1) return -3;
+    return mdfs_read_file_at_by_inode(handle, ino_n, offset, buffer, size, bytes_read);
 }
 
-static int mdfs_alloc_block_simple(const mdfs_fs_t *fs, uint64_t *out_block) {
-    uint8_t *bm = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!bm) return -1;
-    if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -2; }
-
-    uint64_t start = fs->sb.inode_table_start + fs->sb.inode_table_blocks;
-    for (uint64_t b = start; b < fs->sb.total_blocks; b++) {
-        uint64_t byte = b / 8;
-        uint8_t bit = (uint8_t)(1u << (b % 8));
-        if ((bm[byte] & bit) == 0) {
-            bm[byte] |= bit;
-            if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -3; }
-            kfree(bm);
-            *out_block = b;
-            return 0;
-        }
-    }
+static int mdfs_alloc_inode_simple(const mdfs_fs_t *fs, uint32_t *out_ino) {
+    return mdfs_alloc_inode(fs, out_ino);
+}
 
-    kfree(bm);
-    return -4;
+static int mdfs_alloc_block_simple(const mdfs_fs_t *fs, uint64_t *out_block) {
+    uint64_t count = 0;
+    return mdfs_alloc_blocks(fs, 0, 1, out_block, &count);
 }
 
 static int mdfs_free_inode_simple(const mdfs_fs_t *fs, uint32_t ino) {
-    if (!fs || ino == 0) return -1;
-    uint8_t *bm = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!bm) return -2;
-    if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, fs->sb.inode_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -3; }
-    uint32_t byte = ino / 8;
-    uint8_t bit = (uint8_t)(1u << (ino % 8));
-    bm[byte] &= (uint8_t)~bit;
-    if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, fs->sb.inode_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -4; }
-    kfree(bm);
-    return 0;
+    return mdfs_free_inode(fs, ino);
 }
 
 static int mdfs_free_block_simple(const mdfs_fs_t *fs, uint64_t bno) {
     if (!fs || bno == 0) return -1;
-    uint8_t *bm = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!bm) return -2;
-    if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -3; }
-    uint64_t byte = bno / 8;
-    uint8_t bit = (uint8_t)(1u << (bno % 8));
-    bm[byte] &= (uint8_t)~bit;
-    if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, fs->sb.block_bitmap_start, bm) != VDRIVE_SUCCESS) { kfree(bm); return -4; }
-    kfree(bm);
-    return 0;
+    return mdfs_free_blocks(fs, bno, 1);
 }
 
-int mdfs_unlink_by_path(int handle, const char *path) {
+static int mdfs_unlink_by_path_nosync(int handle, const char *path) {
     const mdfs_fs_t *fs = mdfs_get_fs(handle);
     if (!fs || !path) return -1;
 
@@ -333,10 +286,9 @@ int mdfs_unlink_by_path(int handle, const char *path) {
     // Remove from parent
     if (mdfs_v2_dir_remove(fs, pino, base) != 0) return -9;
 
-    // Free data blocks (direct only)
-    for (uint32_t i = 0; i < MDFS_MAX_DIRECT; i++) {
-        if (fin.direct[i]) (void)mdfs_free_block_simple(fs, fin.direct[i]);
-    }
+    // Free data blocks (direct blocks or extents); buffered appends die with them
+    mdfs_delalloc_drop(fs, ino);
+    (void)mdfs_inode_truncate(fs, ino, &fin, 0);
 
     // Clear inode then free
     mdfs_inode_t z;
@@ -347,7 +299,7 @@ int mdfs_unlink_by_path(int handle, const char *path) {
     return 0;
 }
 
-int mdfs_rmdir_by_path(int handle, const char *path) {
+static int mdfs_rmdir_by_path_nosync(int handle, const char *path) {
     const mdfs_fs_t *fs = mdfs_get_fs(handle);
     if (!fs || !path) return -1;
 
@@ -410,7 +362,7 @@ int mdfs_rmdir_by_path(int handle, const char *path) {
     return 0;
 }
 
-int mdfs_mkdir_by_path(int handle, const char *path) {
+static int mdfs_mkdir_by_path_nosync(int handle, const char *path) {
     const mdfs_fs_t *fs = mdfs_get_fs(handle);
     if (!fs || !path) return -1;
 
@@ -478,10 +430,8 @@ int mdfs_mkdir_by_path(int handle, const char *path) {
     return 0;
 }
 
-int mdfs_write_file_by_path(int handle, const char *path, const void *buffer, size_t size) {
-    const mdfs_fs_t *fs = mdfs_get_fs(handle);
-    if (!fs || !path || (!buffer && size != 0)) return -1;
-
+// Resolve a regular file, creating it (empty) in its parent directory if missing.
+static int mdfs_open_file_by_path(const mdfs_fs_t *fs, const char *path, uint32_t *out_ino) {
     if (path[0] == 0 || (path[0] == '/' && path[1] == 0)) return -2;
 
     // Split into parent dir + basename
@@ -509,108 +459,114 @@ int mdfs_write_file_by_path(int handle, const char *path, const void *buffer, si
 
     uint32_t existing_ino = 0;
     uint8_t existing_type = 0;
-    int exists = (mdfs_v2_dir_lookup(fs, dir_ino, base, &existing_ino, &existing_type) == 0);
-
-    uint32_t ino_num = 0;
-    if (exists) {
+    if (mdfs_v2_dir_lookup(fs, dir_ino, base, &existing_ino, &existing_type) == 0) {
         if (existing_type != 1) return -6;
-        ino_num = existing_ino;
-    } else {
-        if (mdfs_alloc_inode_simple(fs, &ino_num) != 0) return -7;
-        mdfs_inode_t new_ino;
-        memset(&new_ino, 0, sizeof(new_ino));
-        new_ino.mode = 0x8000;
-        new_ino.link_count = 1;
-        if (mdfs_disk_write_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_num, &new_ino) != 0) return -8;
-        if (mdfs_v2_dir_add(fs, dir_ino, base, ino_num, 1) != 0) return -9;
+        *out_ino = existing_ino;
+        return 0;
     }
 
-    // write file data (direct blocks only)
+    uint32_t ino_num = 0;
+    if (mdfs_alloc_inode_simple(fs, &ino_num) != 0) return -7;
+    mdfs_inode_t new_ino;
+    mdfs_inode_init_file(fs, &new_ino);
+    if (mdfs_disk_write_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_num, &new_ino) != 0) return -8;
+    if (mdfs_v2_dir_add(fs, dir_ino, base, ino_num, 1) != 0) return -9;
+    *out_ino = ino_num;
+    return 0;
+}
+
+static int mdfs_write_file_by_path_nosync(int handle, const char *path, const void *buffer, size_t size) {
+    const mdfs_fs_t *fs = mdfs_get_fs(handle);
+    if (!fs || !path || (!buffer && size != 0)) return -1;
+
+    uint32_t ino_num = 0;
+    int rc = mdfs_open_file_by_path(fs, path, &ino_num);
+    if (rc != 0) return rc;
+
+    // Replace the contents: drop the old blocks so the new data gets fresh contiguous runs.
+    mdfs_delalloc_drop(fs, ino_num);
     mdfs_inode_t ino;
     if (mdfs_disk_read_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_num, &ino) != 0) return -8;
+    if (mdfs_inode_truncate(fs, ino_num, &ino, 0) != 0) return -15;
+    return mdfs_inode_write(fs, ino_num, &ino, buffer, size, 0);
+}
 
-    uint8_t *blk = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
-    if (!blk) return -9;
+/* Additional functions required by newer kernel API */
 
-    size_t done = 0;
-    while (done < size) {
-        uint64_t bi = done / MDFS_BLOCK_SIZE;
-        uint64_t boff = done % MDFS_BLOCK_SIZE;
-        if (bi >= MDFS_MAX_DIRECT) { kfree(blk); return -10; }
-
-        if (ino.direct[bi] == 0) {
-            uint64_t nb = 0;
-            if (mdfs_alloc_block_simple(fs, &nb) != 0) { kfree(blk); return -11; }
-            ino.direct[bi] = nb;
-            memset(blk, 0, MDFS_BLOCK_SIZE);
-            if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, nb, blk) != VDRIVE_SUCCESS) { kfree(blk); return -12; }
-        }
+int mdfs_flush_inode(int handle, uint32_t inode) {
+    const mdfs_fs_t *fs = mdfs_get_fs(handle);
+    if (!fs || inode == 0) return -1;
+    return mdfs_delalloc_flush(fs, inode);
+}
 
-        uint64_t bno = ino.direct[bi];
-        if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, bno, blk) != VDRIVE_SUCCESS) { kfree(blk); return -13; }
-        size_t chunk = MDFS_BLOCK_SIZE - (size_t)boff;
-        if (chunk > (size - done)) chunk = size - done;
-        memcpy(blk + boff, (const uint8_t*)buffer + done, chunk);
-        if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, bno, blk) != VDRIVE_SUCCESS) { kfree(blk); return -14; }
-        done += chunk;
-    }
+static int mdfs_create_file_trunc_nosync(int handle, const char *path, int truncate, uint32_t *out_inode) {
+    const mdfs_fs_t *fs = mdfs_get_fs(handle);
+    if (!fs || !path || !out_inode) return -1;
 
-    ino.size_bytes = size;
-    if (mdfs_disk_write_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_num, &ino) != 0) { kfree(blk); return -15; }
+    uint32_t ino_num = 0;
+    int rc = mdfs_open_file_by_path(fs, path, &ino_num);
+    if (rc != 0) return rc;
 
-    kfree(blk);
+    if (truncate) {
+        mdfs_inode_t ino;
+        mdfs_delalloc_drop(fs, ino_num);
+        if (mdfs_disk_read_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_num, &ino) != 0) return -8;
+        if (ino.size_bytes != 0 && mdfs_inode_truncate(fs, ino_num, &ino, 0) != 0) return -15;
+    }
+    *out_inode = ino_num;
     return 0;
 }
 
-/* Additional functions required by newer kernel API */
+static int mdfs_write_file_at_by_inode_nosync(int handle, uint32_t inode, const void *buffer, size_t size, uint64_t offset) {
+    const mdfs_fs_t *fs = mdfs_get_fs(handle);
+    if (!fs || inode == 0 || (!buffer && size != 0)) return -1;
+
+    return mdfs_inode_write_delayed(fs, inode, buffer, size, offset);
+}
 
-int mdfs_unmount(int handle) {
-    /* Old MDFS doesn't have explicit unmount, just mark as unused */
+static int mdfs_write_file_at_by_path_nosync(int handle, const char *path, const void *buffer, size_t size, uint64_t offset) {
     const mdfs_fs_t *fs = mdfs_get_fs(handle);
-    if (!fs) return -1;
-    /* The mount slot is managed by kernel, we don't need to do anything */
-    return 0;
+    if (!fs || !path || (!buffer && size != 0)) return -1;
+
+    uint32_t ino_num = 0;
+    int rc = mdfs_open_file_by_path(fs, path, &ino_num);
+    if (rc != 0) return rc;
+    return mdfs_write_file_at_by_inode_nosync(handle, ino_num, buffer, size, offset);
 }
 
-int mdfs_flush_inode(int handle, uint32_t inode) {
-    /* Old MDFS writes through immediately, no buffering to flush */
-    (void)handle;
-    (void)inode;
-    return 0;
+/* Public mutators: allocations only touch the in-memory bitmaps, which are
+ * written back once at the end of each operation. */
+
+static int mdfs_sync_after(int handle, int rc) {
+    const mdfs_fs_t *fs = mdfs_get_fs(handle);
+    if (fs && mdfs_alloc_flush(fs) != 0 && rc == 0) rc = -16;
+    return rc;
+}
+
+int mdfs_unlink_by_path(int handle, const char *path) {
+    return mdfs_sync_after(handle, mdfs_unlink_by_path_nosync(handle, path));
+}
+
+int mdfs_rmdir_by_path(int handle, const char *path) {
+    return mdfs_sync_after(handle, mdfs_rmdir_by_path_nosync(handle, path));
+}
+
+int mdfs_mkdir_by_path(int handle, const char *path) {
+    return mdfs_sync_after(handle, mdfs_mkdir_by_path_nosync(handle, path));
+}
+
+int mdfs_write_file_by_path(int handle, const char *path, const void *buffer, size_t size) {
+    return mdfs_sync_after(handle, mdfs_write_file_by_path_nosync(handle, path, buffer, size));
 }
 
 int mdfs_create_file_trunc(int handle, const char *path, int truncate, uint32_t *out_inode) {
-    /* For now, just create/truncate via write_file_by_path with empty buffer */
-    const mdfs_fs_t *fs = mdfs_get_fs(handle);
-    if (!fs || !path || !out_inode) return -1;
-    
-    /* Write empty file (creates or truncates) */
-    int rc = mdfs_write_file_by_path(handle, path, NULL, 0);
-    if (rc != 0) return rc;
-    
-    /* Look up the inode we just created using mdfs_lookup_path */
-    uint32_t ino = 0;
-    uint8_t typ = 0;
-    if (mdfs_lookup_path(fs, path, &ino, &typ) != 0) {
-        return -2;
-    }
-    if (typ != 1) return -3; /* Not a file */
-    *out_inode = ino;
-    return 0;
+    return mdfs_sync_after(handle, mdfs_create_file_trunc_nosync(handle, path, truncate, out_inode));
 }
 
 int mdfs_write_file_at_by_path(int handle, const char *path, const void *buffer, size_t size, uint64_t offset) {
-    /* Old MDFS doesn't support offset writes, only full rewrites */
-    if (offset != 0) return -1; /* Not supported */
-    return mdfs_write_file_by_path(handle, path, buffer, size);
+    return mdfs_sync_after(handle, mdfs_write_file_at_by_path_nosync(handle, path, buffer, size, offset));
 }
 
 int mdfs_write_file_at_by_inode(int handle, uint32_t inode, const void *buffer, size_t size, uint64_t offset) {
-    /* Old MDFS doesn't support writing by inode or offsets */
-    (void)handle;
-    (void)inode;
-    (void)buffer;
-    (void)size;
-    (void)offset;
-    return -1; /* Not supported */
+    return mdfs_sync_after(handle, mdfs_write_file_at_by_inode_nosync(handle, inode, buffer, size, offset));
 }
@@ -30,6 +30,18 @@ int mdfs_disk_write_block(int vdrive_id, uint32_t start_lba, uint64_t block_no,
     return vdrive_write((uint8_t)vdrive_id, (uint64_t)lba, (MDFS_BLOCK_SIZE / 512u), in);
 }
 
+int mdfs_disk_read_blocks(int vdrive_id, uint32_t start_lba, uint64_t block_no, uint32_t count, void *out) {
+    if (count == 0 || count > MDFS_MAX_IO_BLOCKS) return VDRIVE_ERR_INVALID_COUNT;
+    uint64_t lba = (uint64_t)start_lba + block_no * (MDFS_BLOCK_SIZE / 512u);
+    return vdrive_read((uint8_t)vdrive_id, lba, count * (MDFS_BLOCK_SIZE / 512u), out);
+}
+
+int mdfs_disk_write_blocks(int vdrive_id, uint32_t start_lba, uint64_t block_no, uint32_t count, const void *in) {
+    if (count == 0 || count > MDFS_MAX_IO_BLOCKS) return VDRIVE_ERR_INVALID_COUNT;
+    uint64_t lba = (uint64_t)start_lba + block_no * (MDFS_BLOCK_SIZE / 512u);
+    return vdrive_write((uint8_t)vdrive_id, lba, count * (MDFS_BLOCK_SIZE / 512u), in);
+}
+
 int mdfs_disk_read_inode(int vdrive_id, uint32_t start_lba, const mdfs_superblock_t *sb, uint32_t ino, mdfs_inode_t *out) {
     uint64_t byte_off = (uint64_t)ino * (uint64_t)MDFS_INODE_SIZE;
     uint64_t block = sb->inode_table_start + (byte_off / MDFS_BLOCK_SIZE);
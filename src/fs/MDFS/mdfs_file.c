@@ -0,0 +1,706 @@
+#include "moduos/fs/MDFS/mdfs_file.h"
+#include "moduos/fs/MDFS/mdfs_alloc.h"
+#include "moduos/fs/MDFS/mdfs_disk.h"
+#include "moduos/drivers/Drive/vDrive.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/COM/com.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+
+// File block -> disk block mapping and the data paths built on it. Lookups
+// return whole runs (a mapped extent or a hole) so reads and writes can move
+// up to MDFS_MAX_IO_BLOCKS per request instead of one block at a time.
+
+#define MDFS_MAX_FILE_BLOCKS 0xFFFFFFFFull   // extent lblock is 32 bits
+#define MDFS_RUN_UNBOUNDED   UINT64_MAX
+
+static int mdfs_is_extent_inode(const mdfs_inode_t *ino) {
+    return (ino->flags & MDFS_INODE_FLAG_EXTENTS) != 0;
+}
+
+static const mdfs_extent_header_t *mdfs_ext_root(const mdfs_inode_t *ino) {
+    return (const mdfs_extent_header_t*)ino->extent_root;
+}
+
+static const void *mdfs_ext_root_recs(const mdfs_inode_t *ino) {
+    return ino->extent_root + sizeof(mdfs_extent_header_t);
+}
+
+static int mdfs_ext_header_ok(const mdfs_extent_header_t *h, uint32_t cap) {
+    return h->magic == MDFS_EXTENT_MAGIC && h->entries <= cap && h->depth <= MDFS_EXTENT_MAX_DEPTH;
+}
+
+/* Look lbn up in n sorted extents; `bound` is the first file block past the
+ * range these extents cover (the next leaf's start, or unbounded). */
+static void mdfs_ext_find(const mdfs_extent_t *e, uint32_t n, uint64_t lbn, uint64_t bound, uint64_t *pblock, uint64_t *run) {
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (e[mid].lblock <= lbn) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo > 0) {
+        const mdfs_extent_t *x = &e[lo - 1];
+        uint64_t end = (uint64_t)x->lblock + x->len;
+        if (lbn < end) {
+            *pblock = x->pblock + (lbn - x->lblock);
+            *run = end - lbn;
+            return;
+        }
+    }
+    *pblock = 0;
+    *run = ((lo < n) ? (uint64_t)e[lo].lblock : bound) - lbn;
+}
+
+static void mdfs_direct_find(const mdfs_inode_t *ino, uint64_t lbn, uint64_t *pblock, uint64_t *run) {
+    if (lbn >= MDFS_MAX_DIRECT) { *pblock = 0; *run = MDFS_RUN_UNBOUNDED; return; }
+    uint64_t p = ino->direct[lbn];
+    uint64_t r = 1;
+    while (lbn + r < MDFS_MAX_DIRECT) {
+        uint64_t q = ino->direct[lbn + r];
+        if (p ? (q != p + r) : (q != 0)) break;
+        r++;
+    }
+    if (!p && lbn + r == MDFS_MAX_DIRECT) r = MDFS_RUN_UNBOUNDED;
+    *pblock = p;
+    *run = r;
+}
+
+// Read-side lookups; a depth-1 tree keeps the last leaf it loaded.
+typedef struct {
+    const mdfs_fs_t *fs;
+    const mdfs_inode_t *ino;
+    uint8_t *leaf;
+    uint64_t leaf_bno;
+} mdfs_map_cursor_t;
+
+static int mdfs_map_lookup(mdfs_map_cursor_t *c, uint64_t lbn, uint64_t *pblock, uint64_t *run) {
+    if (!mdfs_is_extent_inode(c->ino)) {
+        mdfs_direct_find(c->ino, lbn, pblock, run);
+        return 0;
+    }
+
+    const mdfs_extent_header_t *h = mdfs_ext_root(c->ino);
+    if (!mdfs_ext_header_ok(h, MDFS_EXTENT_ROOT_ENTRIES)) return -1;
+    if (h->depth == 0) {
+        mdfs_ext_find((const mdfs_extent_t*)mdfs_ext_root_recs(c->ino), h->entries, lbn, MDFS_RUN_UNBOUNDED, pblock, run);
+        return 0;
+    }
+
+    const mdfs_extent_idx_t *idx = (const mdfs_extent_idx_t*)mdfs_ext_root_recs(c->ino);
+    uint32_t n = h->entries;
+    uint32_t i = 0;
+    while (i < n && idx[i].lblock <= lbn) i++;
+    if (i == 0) {
+        *pblock = 0;
+        *run = n ? (uint64_t)idx[0].lblock - lbn : MDFS_RUN_UNBOUNDED;
+        return 0;
+    }
+    i--;
+
+    if (!c->leaf || c->leaf_bno != idx[i].leaf) {
+        if (!c->leaf && !(c->leaf = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE))) return -2;
+        c->leaf_bno = 0;
+        if (mdfs_disk_read_block(c->fs->vdrive_id, c->fs->start_lba, idx[i].leaf, c->leaf) != VDRIVE_SUCCESS) return -3;
+        const mdfs_extent_header_t *lh = (const mdfs_extent_header_t*)c->leaf;
+        if (!mdfs_ext_header_ok(lh, MDFS_EXTENT_LEAF_ENTRIES) || lh->depth != 0) return -4;
+        c->leaf_bno = idx[i].leaf;
+    }
+    const mdfs_extent_header_t *lh = (const mdfs_extent_header_t*)c->leaf;
+    uint64_t bound = (i + 1 < n) ? (uint64_t)idx[i + 1].lblock : MDFS_RUN_UNBOUNDED;
+    mdfs_ext_find((const mdfs_extent_t*)(c->leaf + sizeof(*lh)), lh->entries, lbn, bound, pblock, run);
+    return 0;
+}
+
+/* Write-side view of an extent tree: every extent in one sorted array, edited
+ * in memory and laid back out (inline, or packed into leaves) by store. */
+typedef struct {
+    mdfs_extent_t *ext;
+    uint32_t count;
+    uint32_t cap;
+    uint64_t leaves[MDFS_EXTENT_ROOT_ENTRIES];
+    uint32_t nleaves;
+    uint32_t dirty_from;    // first record changed since load, UINT32_MAX if none
+} mdfs_emap_t;
+
+#define MDFS_EMAP_MAX ((uint32_t)(MDFS_EXTENT_ROOT_ENTRIES * MDFS_EXTENT_LEAF_ENTRIES))
+
+static int mdfs_emap_reserve(mdfs_emap_t *m, uint32_t need) {
+    if (need <= m->cap) return 0;
+    if (need > MDFS_EMAP_MAX) return -1;
+    uint32_t cap = m->cap ? m->cap * 2 : 16;
+    if (cap < need) cap = need;
+    if (cap > MDFS_EMAP_MAX) cap = MDFS_EMAP_MAX;
+    mdfs_extent_t *n = (mdfs_extent_t*)kmalloc((size_t)cap * sizeof(mdfs_extent_t));
+    if (!n) return -2;
+    if (m->count) memcpy(n, m->ext, (size_t)m->count * sizeof(mdfs_extent_t));
+    if (m->ext) kfree(m->ext);
+    m->ext = n;
+    m->cap = cap;
+    return 0;
+}
+
+static void mdfs_emap_free(mdfs_emap_t *m) {
+    if (m->ext) kfree(m->ext);
+    m->ext = NULL;
+    m->count = m->cap = 0;
+}
+
+static void mdfs_emap_touch(mdfs_emap_t *m, uint32_t i) {
+    if (i < m->dirty_from) m->dirty_from = i;
+}
+
+static int mdfs_emap_load(const mdfs_fs_t *fs, const mdfs_inode_t *ino, mdfs_emap_t *m) {
+    memset(m, 0, sizeof(*m));
+    m->dirty_from = UINT32_MAX;
+
+    const mdfs_extent_header_t *h = mdfs_ext_root(ino);
+    if (!mdfs_ext_header_ok(h, MDFS_EXTENT_ROOT_ENTRIES)) return -1;
+    if (h->depth == 0) {
+        if (mdfs_emap_reserve(m, h->entries) != 0) return -2;
+        if (h->entries) memcpy(m->ext, mdfs_ext_root_recs(ino), (size_t)h->entries * sizeof(mdfs_extent_t));
+        m->count = h->entries;
+        return 0;
+    }
+
+    uint8_t *blk = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
+    if (!blk) return -2;
+    const mdfs_extent_idx_t *idx = (const mdfs_extent_idx_t*)mdfs_ext_root_recs(ino);
+    for (uint32_t i = 0; i < h->entries; i++) {
+        m->leaves[m->nleaves++] = idx[i].leaf;
+        if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, idx[i].leaf, blk) != VDRIVE_SUCCESS) { kfree(blk); mdfs_emap_free(m); return -3; }
+        const mdfs_extent_header_t *lh = (const mdfs_extent_header_t*)blk;
+        if (!mdfs_ext_header_ok(lh, MDFS_EXTENT_LEAF_ENTRIES) || lh->depth != 0) { kfree(blk); mdfs_emap_free(m); return -1; }
+        if (mdfs_emap_reserve(m, m->count + lh->entries) != 0) { kfree(blk); mdfs_emap_free(m); return -2; }
+        memcpy(m->ext + m->count, blk + sizeof(*lh), (size_t)lh->entries * sizeof(mdfs_extent_t));
+        m->count += lh->entries;
+    }
+    kfree(blk);
+    return 0;
+}
+
+// Lay the extents back out into the inode root (and leaves). The caller writes the inode.
+static int mdfs_emap_store(const mdfs_fs_t *fs, mdfs_inode_t *ino, mdfs_emap_t *m) {
+    mdfs_extent_header_t *h = (mdfs_extent_header_t*)ino->extent_root;
+    uint8_t *recs = ino->extent_root + sizeof(*h);
+
+    if (m->count <= MDFS_EXTENT_ROOT_ENTRIES) {
+        while (m->nleaves) (void)mdfs_free_blocks(fs, m->leaves[--m->nleaves], 1);
+        memset(ino->extent_root, 0, sizeof(ino->extent_root));
+        h->magic = MDFS_EXTENT_MAGIC;
+        h->entries = (uint16_t)m->count;
+        h->max = (uint16_t)MDFS_EXTENT_ROOT_ENTRIES;
+        h->depth = 0;
+        if (m->count) memcpy(recs, m->ext, (size_t)m->count * sizeof(mdfs_extent_t));
+        return 0;
+    }
+
+    uint32_t per_leaf = (uint32_t)MDFS_EXTENT_LEAF_ENTRIES;
+    uint32_t need = (m->count + per_leaf - 1) / per_leaf;
+    if (need > MDFS_EXTENT_ROOT_ENTRIES) return -2;
+
+    // Only leaves from the first changed record on differ from what is on disk.
+    uint32_t first = (m->dirty_from == UINT32_MAX) ? need : m->dirty_from / per_leaf;
+    uint32_t had = m->nleaves;
+    while (m->nleaves < need) {
+        uint64_t b = 0, got = 0;
+        if (mdfs_alloc_blocks(fs, 0, 1, &b, &got) != 0) {
+            while (m->nleaves > had) (void)mdfs_free_blocks(fs, m->leaves[--m->nleaves], 1);
+            return -11;
+        }
+        m->leaves[m->nleaves++] = b;
+    }
+    if (first > had) first = had;
+    while (m->nleaves > need) (void)mdfs_free_blocks(fs, m->leaves[--m->nleaves], 1);
+
+    uint8_t *blk = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
+    if (!blk) return -2;
+    for (uint32_t i = first; i < need; i++) {
+        uint32_t base = i * per_leaf;
+        uint32_t n = m->count - base;
+        if (n > per_leaf) n = per_leaf;
+        memset(blk, 0, MDFS_BLOCK_SIZE);
+        mdfs_extent_header_t *lh = (mdfs_extent_header_t*)blk;
+        lh->magic = MDFS_EXTENT_MAGIC;
+        lh->entries = (uint16_t)n;
+        lh->max = (uint16_t)per_leaf;
+        lh->depth = 0;
+        memcpy(blk + sizeof(*lh), m->ext + base, (size_t)n * sizeof(mdfs_extent_t));
+        if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, m->leaves[i], blk) != VDRIVE_SUCCESS) { kfree(blk); return -14; }
+    }
+    kfree(blk);
+
+    memset(ino->extent_root, 0, sizeof(ino->extent_root));
+    h->magic = MDFS_EXTENT_MAGIC;
+    h->entries = (uint16_t)need;
+    h->max = (uint16_t)MDFS_EXTENT_ROOT_ENTRIES;
+    h->depth = 1;
+    mdfs_extent_idx_t *idx = (mdfs_extent_idx_t*)recs;
+    for (uint32_t i = 0; i < need; i++) {
+        idx[i].lblock = m->ext[i * per_leaf].lblock;
+        idx[i].leaf = m->leaves[i];
+    }
+    return 0;
+}
+
+// Map the unmapped range [lbn, lbn + n) to [pblock, pblock + n), merging with neighbours.
+static int mdfs_emap_insert(mdfs_emap_t *m, uint64_t lbn, uint64_t pblock, uint64_t n) {
+    uint32_t i = 0;
+    while (i < m->count && m->ext[i].lblock < lbn) i++;
+
+    if (i > 0) {
+        mdfs_extent_t *p = &m->ext[i - 1];
+        if ((uint64_t)p->lblock + p->len == lbn && p->pblock + p->len == pblock) {
+            p->len += (uint32_t)n;
+            mdfs_emap_touch(m, i - 1);
+            if (i < m->count) {
+                mdfs_extent_t *x = &m->ext[i];
+                if ((uint64_t)p->lblock + p->len == x->lblock && p->pblock + p->len == x->pblock) {
+                    p->len += x->len;
+                    memmove(x, x + 1, (size_t)(m->count - i - 1) * sizeof(mdfs_extent_t));
+                    m->count--;
+                }
+            }
+            return 0;
+        }
+    }
+    if (i < m->count) {
+        mdfs_extent_t *x = &m->ext[i];
+        if (lbn + n == x->lblock && pblock + n == x->pblock) {
+            x->lblock = (uint32_t)lbn;
+            x->pblock = pblock;
+            x->len += (uint32_t)n;
+            mdfs_emap_touch(m, i);
+            return 0;
+        }
+    }
+
+    if (mdfs_emap_reserve(m, m->count + 1) != 0) return -2;
+    memmove(&m->ext[i + 1], &m->ext[i], (size_t)(m->count - i) * sizeof(mdfs_extent_t));
+    m->ext[i].lblock = (uint32_t)lbn;
+    m->ext[i].len = (uint32_t)n;
+    m->ext[i].pblock = pblock;
+    m->count++;
+    mdfs_emap_touch(m, i);
+    return 0;
+}
+
+// Drop (and free) everything from file block `keep` on.
+static void mdfs_emap_trim(const mdfs_fs_t *fs, mdfs_emap_t *m, uint64_t keep) {
+    while (m->count > 0) {
+        mdfs_extent_t *x = &m->ext[m->count - 1];
+        uint64_t end = (uint64_t)x->lblock + x->len;
+        if (x->lblock >= keep) {
+            (void)mdfs_free_blocks(fs, x->pblock, x->len);
+            m->count--;
+            mdfs_emap_touch(m, m->count);
+            continue;
+        }
+        if (end > keep) {
+            uint64_t cut = end - keep;
+            (void)mdfs_free_blocks(fs, x->pblock + (keep - x->lblock), cut);
+            x->len -= (uint32_t)cut;
+            mdfs_emap_touch(m, m->count - 1);
+        }
+        break;
+    }
+}
+
+// Allocation goal for file block lbn: right behind the data mapped before it.
+static uint64_t mdfs_emap_goal(const mdfs_emap_t *m, uint64_t lbn) {
+    uint64_t goal = 0;
+    for (uint32_t i = 0; i < m->count && m->ext[i].lblock < lbn; i++) {
+        goal = m->ext[i].pblock + (lbn - m->ext[i].lblock);
+    }
+    return goal;
+}
+
+void mdfs_inode_init_file(const mdfs_fs_t *fs, mdfs_inode_t *ino) {
+    memset(ino, 0, sizeof(*ino));
+    ino->mode = 0x8000;
+    ino->link_count = 1;
+    if (fs && (fs->sb.features & MDFS_FEATURE_EXTENTS)) {
+        mdfs_extent_header_t *h = (mdfs_extent_header_t*)ino->extent_root;
+        ino->flags |= MDFS_INODE_FLAG_EXTENTS;
+        h->magic = MDFS_EXTENT_MAGIC;
+        h->max = (uint16_t)MDFS_EXTENT_ROOT_ENTRIES;
+    }
+}
+
+int mdfs_inode_read(const mdfs_fs_t *fs, const mdfs_inode_t *ino, uint64_t offset, void *buffer, size_t size, size_t *bytes_read) {
+    if (!fs || !ino || (!buffer && size != 0) || !bytes_read) return -1;
+    *bytes_read = 0;
+    if (offset >= ino->size_bytes || size == 0) return 0;
+    if ((uint64_t)size > ino->size_bytes - offset) size = (size_t)(ino->size_bytes - offset);
+
+    mdfs_map_cursor_t c = { fs, ino, NULL, 0 };
+    uint8_t *out = (uint8_t*)buffer;
+    uint8_t *blk = NULL;
+    size_t done = 0;
+    int rc = 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        uint64_t lbn = pos / MDFS_BLOCK_SIZE;
+        size_t boff = (size_t)(pos % MDFS_BLOCK_SIZE);
+        uint64_t pblock = 0, run = 0;
+        if (mdfs_map_lookup(&c, lbn, &pblock, &run) != 0) { rc = -6; break; }
+
+        if (!pblock) {
+            size_t chunk = size - done;
+            if (run < ((uint64_t)chunk + boff + MDFS_BLOCK_SIZE - 1) / MDFS_BLOCK_SIZE) {
+                chunk = (size_t)(run * MDFS_BLOCK_SIZE - boff);
+            }
+            memset(out + done, 0, chunk);
+            done += chunk;
+        } else if (boff == 0 && size - done >= MDFS_BLOCK_SIZE) {
+            // Whole blocks of one run go straight into the caller's buffer.
+            uint64_t n = (size - done) / MDFS_BLOCK_SIZE;
+            if (n > run) n = run;
+            if (n > MDFS_MAX_IO_BLOCKS) n = MDFS_MAX_IO_BLOCKS;
+            if (mdfs_disk_read_blocks(fs->vdrive_id, fs->start_lba, pblock, (uint32_t)n, out + done) != VDRIVE_SUCCESS) { rc = -6; break; }
+            done += (size_t)n * MDFS_BLOCK_SIZE;
+        } else {
+            if (!blk && !(blk = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE))) { rc = -5; break; }
+            if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, pblock, blk) != VDRIVE_SUCCESS) { rc = -6; break; }
+            size_t chunk = MDFS_BLOCK_SIZE - boff;
+            if (chunk > size - done) chunk = size - done;
+            memcpy(out + done, blk + boff, chunk);
+            done += chunk;
+        }
+    }
+
+    if (blk) kfree(blk);
+    if (c.leaf) kfree(c.leaf);
+    if (rc != 0) return rc;
+    *bytes_read = done;
+    return 0;
+}
+
+int mdfs_inode_write(const mdfs_fs_t *fs, uint32_t ino_n, mdfs_inode_t *ino, const void *buffer, size_t size, uint64_t offset) {
+    if (!fs || !ino || (!buffer && size != 0)) return -1;
+    if (size == 0) return 0;
+    uint64_t end = offset + size;
+    if (end < offset || (end - 1) / MDFS_BLOCK_SIZE >= MDFS_MAX_FILE_BLOCKS) return -10;
+
+    int ext = mdfs_is_extent_inode(ino);
+    mdfs_emap_t m;
+    if (ext && mdfs_emap_load(fs, ino, &m) != 0) return -6;
+
+    uint8_t *blk = (uint8_t*)kmalloc(MDFS_BLOCK_SIZE);
+    if (!blk) {
+        if (ext) mdfs_emap_free(&m);
+        return -9;
+    }
+
+    const uint8_t *src = (const uint8_t*)buffer;
+    uint64_t pos = offset;
+    int rc = 0;
+    while (pos < end && rc == 0) {
+        uint64_t lbn = pos / MDFS_BLOCK_SIZE;
+        uint64_t pblock = 0, run = 0;
+        int fresh = 0;
+        if (ext) mdfs_ext_find(m.ext, m.count, lbn, MDFS_RUN_UNBOUNDED, &pblock, &run);
+        else mdfs_direct_find(ino, lbn, &pblock, &run);
+
+        if (!pblock) {
+            // Allocate the whole unmapped part of the write as one run if we can.
+            uint64_t want = (end - 1) / MDFS_BLOCK_SIZE - lbn + 1;
+            if (want > run) want = run;
+            uint64_t got = 0;
+            if (ext) {
+                if (mdfs_alloc_blocks(fs, mdfs_emap_goal(&m, lbn), want, &pblock, &got) != 0) { rc = -11; break; }
+                if (mdfs_emap_insert(&m, lbn, pblock, got) != 0) {
+                    (void)mdfs_free_blocks(fs, pblock, got);
+                    rc = -12;
+                    break;
+                }
+            } else {
+                if (lbn >= MDFS_MAX_DIRECT) { rc = -10; break; }
+                if (mdfs_alloc_blocks(fs, 0, 1, &pblock, &got) != 0) { rc = -11; break; }
+                ino->direct[lbn] = pblock;
+            }
+            run = got;
+            fresh = 1;
+        }
+
+        while (run > 0 && pos < end) {
+            size_t boff = (size_t)(pos % MDFS_BLOCK_SIZE);
+            if (boff == 0 && end - pos >= MDFS_BLOCK_SIZE) {
+                uint64_t n = (end - pos) / MDFS_BLOCK_SIZE;
+                if (n > run) n = run;
+                if (n > MDFS_MAX_IO_BLOCKS) n = MDFS_MAX_IO_BLOCKS;
+                if (mdfs_disk_write_blocks(fs->vdrive_id, fs->start_lba, pblock, (uint32_t)n, src + (pos - offset)) != VDRIVE_SUCCESS) { rc = -14; break; }
+                pos += n * MDFS_BLOCK_SIZE;
+                pblock += n;
+                run -= n;
+            } else {
+                // Partial block: new blocks start out zeroed so nothing stale shows past EOF.
+                size_t chunk = MDFS_BLOCK_SIZE - boff;
+                if (chunk > end - pos) chunk = (size_t)(end - pos);
+                if (fresh) memset(blk, 0, MDFS_BLOCK_SIZE);
+                else if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, pblock, blk) != VDRIVE_SUCCESS) { rc = -13; break; }
+                memcpy(blk + boff, src + (pos - offset), chunk);
+                if (mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, pblock, blk) != VDRIVE_SUCCESS) { rc = -14; break; }
+                pos += chunk;
+                pblock++;
+                run--;
+            }
+        }
+    }
+    kfree(blk);
+
+    if (ext) {
+        int src_rc = mdfs_emap_store(fs, ino, &m);
+        mdfs_emap_free(&m);
+        if (src_rc != 0) return src_rc;
+    }
+    if (pos > offset && pos > ino->size_bytes) ino->size_bytes = pos;
+    if (mdfs_disk_write_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_n, ino) != 0 && rc == 0) rc = -15;
+    return rc;
+}
+
+int mdfs_inode_truncate(const mdfs_fs_t *fs, uint32_t ino_n, mdfs_inode_t *ino, uint64_t new_size) {
+    if (!fs || !ino) return -1;
+
+    if (new_size < ino->size_bytes) {
+        uint64_t keep = (new_size + MDFS_BLOCK_SIZE - 1) / MDFS_BLOCK_SIZE;
+        if (mdfs_is_extent_inode(ino)) {
+            mdfs_emap_t m;
+            if (mdfs_emap_load(fs, ino, &m) != 0) return -6;
+            mdfs_emap_trim(fs, &m, keep);
+            int rc = mdfs_emap_store(fs, ino, &m);
+            mdfs_emap_free(&m);
+            if (rc != 0) return rc;
+        } else {
+            for (uint64_t i = keep; i < MDFS_MAX_DIRECT; i++) {
+                if (ino->direct[i]) (void)mdfs_free_blocks(fs, ino->direct[i], 1);
+                ino->direct[i] = 0;
+            }
+        }
+
+        // Zero the kept block's tail so growing the file again reads zeros there.
+        if (new_size % MDFS_BLOCK_SIZE) {
+            mdfs_map_cursor_t c = { fs, ino, NULL, 0 };
+            uint64_t pblock = 0, run = 0;
+            int lrc = mdfs_map_lookup(&c, new_size / MDFS_BLOCK_SIZE, &pblock, &run);
+            if (c.leaf) kfree(c.leaf);
+            uint8_t *blk = (lrc == 0 && pblock) ? (uint8_t*)kmalloc(MDFS_BLOCK_SIZE) : NULL;
+            if (blk) {
+                size_t boff = (size_t)(new_size % MDFS_BLOCK_SIZE);
+                if (mdfs_disk_read_block(fs->vdrive_id, fs->start_lba, pblock, blk) == VDRIVE_SUCCESS) {
+                    memset(blk + boff, 0, MDFS_BLOCK_SIZE - boff);
+                    (void)mdfs_disk_write_block(fs->vdrive_id, fs->start_lba, pblock, blk);
+                }
+                kfree(blk);
+            }
+        }
+    }
+
+    ino->size_bytes = new_size;
+    if (mdfs_disk_write_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_n, ino) != 0) return -15;
+    return 0;
+}
+
+/*
+ * Delayed allocation.
+ *
+ * Appends through mdfs_inode_write_delayed() collect in a per-file buffer
+ * instead of going to disk, and blocks are chosen only when the buffer is
+ * written out: when it is full, on any other access to the file, on
+ * mdfs_flush_inode() (close), at unmount, and from the vDrive writeback thread
+ * once it is MDFS_DELALLOC_AGE_MS old. One allocation then covers up to
+ * MDFS_DELALLOC_MAX bytes, so files written side by side in small pieces still
+ * end up in long contiguous runs. The on-disk size lags until the flush; the
+ * read, stat and write entry points flush the file first.
+ *
+ * All buffers together stay under MDFS_DELALLOC_BUDGET of kernel heap: a
+ * buffer that would go over it writes out the least recently used others
+ * first, and when that is not enough the append goes straight to disk.
+ *
+ * A buffer whose write-out fails stays in place, still dirty and still
+ * counted against the budget, and is retried by the next flush; the error
+ * goes to whoever asked for the flush (close, unmount, the next write).
+ *
+ * A global lock covers the slots and is held while a buffer is written out
+ * (order: delalloc -> bitmaps -> vDrive).
+ */
+
+#define MDFS_DELALLOC_SLOTS  8
+#define MDFS_DELALLOC_MAX    (1024u * 1024u)
+#define MDFS_DELALLOC_MIN    (256u * 1024u)
+#define MDFS_DELALLOC_BUDGET (4u * 1024u * 1024u)  /* 1/8 of the kernel heap */
+#define MDFS_DELALLOC_AGE_MS 1000
+
+typedef struct {
+    const mdfs_fs_t *fs;    // NULL: slot unused
+    uint32_t ino;
+    uint64_t off;           // file offset of buf[0] (the on-disk EOF)
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    uint64_t last_use;
+    uint64_t since_ms;      // when the oldest buffered byte came in
+} mdfs_delalloc_t;
+
+static spinlock_t g_dl_lock;
+static mdfs_delalloc_t g_dl[MDFS_DELALLOC_SLOTS];
+static uint64_t g_dl_counter;
+static size_t g_dl_bytes;   // sum of all buffer capacities
+
+static mdfs_delalloc_t *mdfs_dl_find_locked(const mdfs_fs_t *fs, uint32_t ino_n) {
+    for (int i = 0; i < MDFS_DELALLOC_SLOTS; i++) {
+        if (g_dl[i].fs == fs && g_dl[i].ino == ino_n) return &g_dl[i];
+    }
+    return NULL;
+}
+
+static void mdfs_dl_clear_locked(mdfs_delalloc_t *d) {
+    if (d->buf) kfree(d->buf);
+    g_dl_bytes -= d->cap;
+    memset(d, 0, sizeof(*d));
+}
+
+// Write the buffer out and free the slot. On failure the buffer is kept as is;
+// writing it again at the same offset is harmless if part of it made it.
+static int mdfs_dl_write_locked(mdfs_delalloc_t *d) {
+    if (d->len) {
+        mdfs_inode_t ino;
+        if (mdfs_disk_read_inode(d->fs->vdrive_id, d->fs->start_lba, &d->fs->sb, d->ino, &ino) != 0) return -8;
+        int rc = mdfs_inode_write(d->fs, d->ino, &ino, d->buf, d->len, d->off);
+        if (rc != 0) return rc;
+    }
+    mdfs_dl_clear_locked(d);
+    return 0;
+}
+
+// Write out the least recently used buffer other than keep. Returns the
+// freed slot, or NULL when there is nothing else that can be written out.
+static mdfs_delalloc_t *mdfs_dl_evict_locked(const mdfs_delalloc_t *keep) {
+    uint32_t failed = 0;
+    for (;;) {
+        mdfs_delalloc_t *lru = NULL;
+        for (int i = 0; i < MDFS_DELALLOC_SLOTS; i++) {
+            if (!g_dl[i].fs || &g_dl[i] == keep || (failed & (1u << i))) continue;
+            if (!lru || g_dl[i].last_use < lru->last_use) lru = &g_dl[i];
+        }
+        if (!lru) return NULL;
+        const mdfs_fs_t *fs = lru->fs;
+        int rc = mdfs_dl_write_locked(lru);
+        (void)mdfs_alloc_flush(fs);
+        if (rc == 0) return lru;
+        com_write_string(COM1_PORT, "[MDFS] delayed write failed on eviction; buffer kept\n");
+        failed |= 1u << (lru - g_dl);
+    }
+}
+
+static int mdfs_dl_append_locked(mdfs_delalloc_t *d, const void *buffer, size_t size) {
+    if (d->len + size > d->cap) {
+        size_t cap = d->cap ? d->cap : MDFS_DELALLOC_MIN;
+        while (cap < d->len + size) cap *= 2;
+        if (cap > MDFS_DELALLOC_MAX) cap = MDFS_DELALLOC_MAX;
+        while (g_dl_bytes - d->cap + cap > MDFS_DELALLOC_BUDGET) {
+            if (!mdfs_dl_evict_locked(d)) return -3;
+        }
+        uint8_t *n = (uint8_t*)kmalloc(cap);
+        if (!n) return -2;
+        if (d->len) memcpy(n, d->buf, d->len);
+        if (d->buf) kfree(d->buf);
+        g_dl_bytes += cap - d->cap;
+        d->buf = n;
+        d->cap = cap;
+    }
+    if (d->len == 0) d->since_ms = ticks_to_ms(get_system_ticks());
+    memcpy(d->buf + d->len, buffer, size);
+    d->len += size;
+    d->last_use = ++g_dl_counter;
+    return 0;
+}
+
+// A free slot, writing out the least recently used buffer if there is none.
+static mdfs_delalloc_t *mdfs_dl_claim_locked(void) {
+    for (int i = 0; i < MDFS_DELALLOC_SLOTS; i++) {
+        if (!g_dl[i].fs) return &g_dl[i];
+    }
+    return mdfs_dl_evict_locked(NULL);
+}
+
+int mdfs_inode_write_delayed(const mdfs_fs_t *fs, uint32_t ino_n, const void *buffer, size_t size, uint64_t offset) {
+    if (!fs || ino_n == 0 || (!buffer && size != 0)) return -1;
+    if (size == 0) return 0;
+
+    int rc = 0;
+    spinlock_lock(&g_dl_lock);
+    mdfs_delalloc_t *d = mdfs_dl_find_locked(fs, ino_n);
+    if (d && offset == d->off + d->len && d->len + size <= MDFS_DELALLOC_MAX &&
+        mdfs_dl_append_locked(d, buffer, size) == 0) {
+        spinlock_unlock(&g_dl_lock);
+        return 0;
+    }
+    if (d && (rc = mdfs_dl_write_locked(d)) != 0) {
+        spinlock_unlock(&g_dl_lock);
+        return rc;
+    }
+
+    mdfs_inode_t ino;
+    if (mdfs_disk_read_inode(fs->vdrive_id, fs->start_lba, &fs->sb, ino_n, &ino) != 0) { spinlock_unlock(&g_dl_lock); return -8; }
+    if ((ino.mode & 0xF000) != 0x8000) { spinlock_unlock(&g_dl_lock); return -6; }
+
+    // Only appends at EOF wait; the last block may be partial, which is fine.
+    if (mdfs_is_extent_inode(&ino) && offset == ino.size_bytes && size < MDFS_DELALLOC_MAX &&
+        (d = mdfs_dl_claim_locked()) != NULL) {
+        d->fs = fs;
+        d->ino = ino_n;
+        d->off = offset;
+        if (mdfs_dl_append_locked(d, buffer, size) == 0) {
+            spinlock_unlock(&g_dl_lock);
+            return 0;
+        }
+        mdfs_dl_clear_locked(d);
+    }
+
+    rc = mdfs_inode_write(fs, ino_n, &ino, buffer, size, offset);
+    spinlock_unlock(&g_dl_lock);
+    return rc;
+}
+
+int mdfs_delalloc_flush(const mdfs_fs_t *fs, uint32_t ino_n) {
+    if (!fs) return -1;
+    int rc = 0, wrote = 0;
+    spinlock_lock(&g_dl_lock);
+    for (int i = 0; i < MDFS_DELALLOC_SLOTS; i++) {
+        mdfs_delalloc_t *d = &g_dl[i];
+        if (d->fs != fs || (ino_n && d->ino != ino_n)) continue;
+        if (mdfs_dl_write_locked(d) != 0) rc = -2;
+        wrote = 1;
+    }
+    // New extents are on disk now; their bitmap bits must follow.
+    if (wrote && mdfs_alloc_flush(fs) != 0) rc = -2;
+    spinlock_unlock(&g_dl_lock);
+    return rc;
+}
+
+void mdfs_delalloc_writeback(uint64_t now_ms) {
+    spinlock_lock(&g_dl_lock);
+    for (int i = 0; i < MDFS_DELALLOC_SLOTS; i++) {
+        mdfs_delalloc_t *d = &g_dl[i];
+        if (!d->fs || now_ms - d->since_ms < MDFS_DELALLOC_AGE_MS) continue;
+        const mdfs_fs_t *fs = d->fs;
+        if (mdfs_dl_write_locked(d) != 0) {
+            com_write_string(COM1_PORT, "[MDFS] delayed write failed in writeback; retrying later\n");
+            d->since_ms = now_ms;
+        }
+        (void)mdfs_alloc_flush(fs);
+    }
+    spinlock_unlock(&g_dl_lock);
+}
+
+void mdfs_delalloc_drop(const mdfs_fs_t *fs, uint32_t ino_n) {
+    if (!fs) return;
+    spinlock_lock(&g_dl_lock);
+    for (int i = 0; i < MDFS_DELALLOC_SLOTS; i++) {
+        mdfs_delalloc_t *d = &g_dl[i];
+        if (d->fs == fs && (!ino_n || d->ino == ino_n)) mdfs_dl_clear_locked(d);
+    }
+    spinlock_unlock(&g_dl_lock);
+}
@@ -738,14 +738,19 @@ static uint64_t dev_video0_get_user_fb_addr(const framebuffer_t *fb) {
 
     if (g_user_fb_addr) return g_user_fb_addr;
 
-    /* Pick a fixed low canonical address far away from program text/stack. */
-    const uint64_t user_fb_base = 0x0000004000000000ULL;
-
-    if (paging_map_range(user_fb_base, fb->phys_addr, fb->size_bytes, PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER) != 0) {
+    /* Pick a fixed low canonical address far away from program text/stack.
+     * Keep it congruent to the physical address modulo 2MiB so the bulk of the
+     * framebuffer is mapped with 2MiB pages (blits otherwise walk a TLB entry
+     * per 4KiB of pixels). */
+    const uint64_t user_fb_base = 0x0000004000000000ULL + (fb->phys_addr & (PAGING_2M_SIZE - 1) & ~0xFFFULL);
+
+    if (paging_map_range_huge(user_fb_base, fb->phys_addr & ~0xFFFULL,
+                              fb->size_bytes + (fb->phys_addr & 0xFFFULL),
+                              PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER | PFLAG_SHARED) != 0) {
         return 0;
     }
 
-    g_user_fb_addr = user_fb_base;
+    g_user_fb_addr = user_fb_base + (fb->phys_addr & 0xFFFULL);
     return g_user_fb_addr;
 }
 
@@ -1019,7 +1024,8 @@ static ssize_t dev_video0_write(void *ctx, const void *buf, size_t count) {
 
             if (!b->user_addr) {
                 uint64_t ua = video0_alloc_user_va(b->size_bytes);
-                if (paging_map_range(ua, b->phys_base, b->size_bytes, PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER) != 0) {
+                if (paging_map_range(ua, b->phys_base, b->size_bytes,
+                                     PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER | PFLAG_SHARED) != 0) {
                     resp.user_addr = 0; resp.size_bytes = 0; resp.pitch = 0; resp.fmt = 0;
                     video0_resp_set(c, &resp, sizeof(resp));
                     break;
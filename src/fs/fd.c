@@ -1,13 +1,16 @@
-//fd.c - File descriptor management implementation (with HVFS)
+//fd.c - File descriptor management implementation (page-cache backed reads)
 #include "moduos/fs/fd.h"
 #include "moduos/fs/fs.h"
-#include "moduos/fs/hvfs.h"
-#include "moduos/fs/hvfs_cache.h"
+#include "moduos/fs/pcache.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/memory/memory.h"
 // #include "moduos/kernel/process/process.h"  // OLD
 #include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/process/waitqueue.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/interrupts/irq_lock.h"
+#include "moduos/kernel/errno.h"
 #include "moduos/drivers/Drive/vDrive.h"
 #include "moduos/fs/path.h"
 #include "moduos/fs/devfs.h"
@@ -15,17 +18,26 @@
 #include "moduos/drivers/graphics/VGA.h"
 #include "moduos/fs/MDFS/mdfs.h"
 
-/* Pipe ring buffer — shared between read and write fd entries. */
-#define PIPE_BUF_SIZE 4096
-
+/* Pipe ring buffer — shared between the read-end and write-end open files.
+ * Readers and writers block on rd_wq/wr_wq; the fast path skips the wake when
+ * nobody is queued.
+ */
 typedef struct {
-    char    buf[PIPE_BUF_SIZE];
-    int     read_pos;
-    int     write_pos;
-    int     count;
-    int     write_end_open;  /* 0 when write fd is closed → EOF on read */
+    spinlock_t lock;
+    char    *buf;
+    uint32_t cap;            /* power of two, PIPE_MIN_SIZE..PIPE_MAX_SIZE */
+    uint32_t read_pos;
+    uint32_t count;
+    int      write_end_open; /* 0 when write end is closed → EOF on read */
+    int      read_end_open;  /* 0 when read end is closed → EPIPE/SIGPIPE on write */
+    wait_queue_t rd_wq;      /* readers waiting for data or EOF */
+    wait_queue_t wr_wq;      /* writers waiting for space or EPIPE */
 } pipe_buf_t;
 
+#ifndef SIGPIPE
+#define SIGPIPE 13
+#endif
+
 /* NOTE: FD_DEBUG can be enabled to trace file operations to COM1.
  * This is extremely slow on real hardware/VMs (serial output bottleneck).
  */
@@ -39,22 +51,25 @@ typedef struct {
 #define FD_LOG(s) do { (void)(s); } while (0)
 #endif
 
-/* Enhanced file descriptor structure with cached data */
-typedef struct {
+/* Open-file object.
+ * Allocated per open()/opendir()/pipe() and referenced from per-process
+ * descriptor tables (process_t::fd_table). dup(), dup2() and fork() only add
+ * references, so descriptors sharing an object also share its offset and write
+ * buffer (POSIX open file description semantics). There is no system-wide
+ * table: the only limit is PROCESS_MAX_FDS slots per process.
+ */
+struct open_file {
+    int refs;                 /* descriptor slots referencing this object */
     int mount_slot;           /* Which filesystem mount (0-25) */
     char path[256];           /* Full file path */
     size_t position;          /* Current read/write position */
     size_t file_size;         /* Total file size */
     int flags;                /* FD_FLAG_* flags */
-    int in_use;               /* Is this FD active? */
-    int pid;                  /* Owner process ID (0 for kernel) */
     int type;                 /* FD_TYPE_* */
-    void* cached_data;        /* Cached file contents (for reading) OR devfs/userfs handle */
+    void* cached_data;        /* devfs/userfs handle */
     int is_directory;         /* 1 if this is a directory descriptor */
     void* dir_handle;         /* Directory handle (fs_dir_t*) or DEVVFS handle */
     int is_devvfs;            /* 1 if dir_handle is a DEVVFS pseudo dir */
-    int is_devfs;             /* 1 if cached_data is a devfs handle */
-    int is_userfs;            /* 1 if cached_data is a userfs handle or userfs dir */
 
     /* Pipe support */
     void *pipe_buf;           /* pipe_buf_t* when type==FD_TYPE_PIPE */
@@ -71,107 +86,429 @@ typedef struct {
     size_t   wbuf_cap;
     size_t   wbuf_len;
     size_t   wbuf_file_off;
-} file_descriptor_internal_t;
 
-/* Global file descriptor table */
-static file_descriptor_internal_t fd_table[MAX_FDS];
+    /* Shared page-cache object for regular files opened for reading. */
+    pcache_file_t *pcache;
+};
+
+#define FD_BITMAP_WORDS (PROCESS_MAX_FDS / 64)
+
+_Static_assert(MAX_FDS == PROCESS_MAX_FDS, "fd.h and process_new.h disagree on the per-process fd limit");
+_Static_assert(PROCESS_MAX_FDS % 64 == 0, "fd bitmap works in whole 64-bit words");
+
+/* A descriptor table: slot pointers plus a bitmap of used slots, so allocating
+ * the lowest free fd is a ctz per 64 slots and lookup is a single index. */
+typedef struct {
+    open_file_t **slot;
+    uint64_t *used;
+    int *ready;
+} fd_tbl_t;
+
+/* Console stdio objects. They hold a permanent reference and are shared by
+ * every process that has not redirected fd 0/1/2. */
+static open_file_t console_files[3];
+
+/* Table used when there is no current process (early boot, kernel init). */
+static open_file_t *kernel_fd_slots[PROCESS_MAX_FDS];
+static uint64_t kernel_fd_used[FD_BITMAP_WORDS];
+static int kernel_fd_ready = 0;
+
+/* Serialises slot/bitmap updates. Tables of other processes are touched by
+ * fork and fd injection, so the owner is not the only writer. */
+static spinlock_t fd_lock;
 static int fd_initialized = 0;
 
 #define FD_WRITEBUF_DEFAULT_CAP (256u * 1024u) /* 256KiB */
 #define FD_WRITEBUF_MAX_CAP     (4u * 1024u * 1024u) /* 4MiB */
 
-static int fd_flush_write_buffer(int fd) {
-    if (fd < 0 || fd >= MAX_FDS) return -1;
-    if (!fd_table[fd].in_use) return -1;
-    if (fd_table[fd].wbuf_len == 0) return 0;
+static void fd_tbl_of(process_t *p, fd_tbl_t *t) {
+    if (p) {
+        t->slot = (open_file_t **)p->fd_table;
+        t->used = p->fd_used;
+        t->ready = &p->fd_ready;
+    } else {
+        t->slot = kernel_fd_slots;
+        t->used = kernel_fd_used;
+        t->ready = &kernel_fd_ready;
+    }
+}
+
+static inline int fd_bit_test(const fd_tbl_t *t, int fd) {
+    return (t->used[fd >> 6] >> (fd & 63)) & 1;
+}
+
+static inline void fd_bit_set(fd_tbl_t *t, int fd) {
+    t->used[fd >> 6] |= 1ULL << (fd & 63);
+}
+
+static inline void fd_bit_clear(fd_tbl_t *t, int fd) {
+    t->used[fd >> 6] &= ~(1ULL << (fd & 63));
+}
+
+/* Find (and mark used) the lowest free slot >= min_fd. Caller holds fd_lock. */
+static int fd_slot_alloc(fd_tbl_t *t, int min_fd) {
+    if (min_fd < 0) min_fd = 0;
+    for (int w = min_fd >> 6; w < FD_BITMAP_WORDS; w++) {
+        uint64_t avail = ~t->used[w];
+        if (w == (min_fd >> 6)) avail &= ~0ULL << (min_fd & 63);
+        if (!avail) continue;
+        int fd = (w << 6) + __builtin_ctzll(avail);
+        fd_bit_set(t, fd);
+        t->slot[fd] = NULL;
+        return fd;
+    }
+    return -1;
+}
+
+static inline void of_get(open_file_t *f) {
+    __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+}
+
+/* Give a table its stdio slots on first use. Caller holds fd_lock. */
+static void fd_tbl_prepare(fd_tbl_t *t) {
+    if (*t->ready) return;
+    for (int i = 0; i < 3; i++) {
+        if (fd_bit_test(t, i)) continue;
+        of_get(&console_files[i]);
+        t->slot[i] = &console_files[i];
+        fd_bit_set(t, i);
+    }
+    *t->ready = 1;
+}
+
+static void fd_cur_tbl(fd_tbl_t *t) {
+    fd_tbl_of(process_get_current(), t);
+    if (!*t->ready) {
+        spinlock_lock(&fd_lock);
+        fd_tbl_prepare(t);
+        spinlock_unlock(&fd_lock);
+    }
+}
+
+/* Borrowed lookup in the current table (O(1)). */
+static open_file_t *fd_file(int fd) {
+    if (fd < 0 || fd >= PROCESS_MAX_FDS) return NULL;
+    fd_tbl_t t;
+    fd_cur_tbl(&t);
+    return fd_bit_test(&t, fd) ? t.slot[fd] : NULL;
+}
+
+static open_file_t *of_alloc(int type, int flags) {
+    open_file_t *f = (open_file_t*)kmalloc(sizeof(open_file_t));
+    if (!f) return NULL;
+    memset(f, 0, sizeof(*f));
+    f->refs = 1;
+    f->mount_slot = -1;
+    f->type = type;
+    f->flags = flags;
+    return f;
+}
+
+/* Publish a new object (holding one reference) in the lowest free slot >= min_fd.
+ * On failure the reference is kept by the caller. */
+static int fd_install_new(open_file_t *f, int min_fd) {
+    fd_tbl_t t;
+    fd_cur_tbl(&t);
+    spinlock_lock(&fd_lock);
+    int fd = fd_slot_alloc(&t, min_fd);
+    if (fd >= 0) t.slot[fd] = f;
+    spinlock_unlock(&fd_lock);
+    return fd;
+}
+
+static int fd_flush_write_buffer(open_file_t *f) {
+    if (!f) return -1;
+    if (f->wbuf_len == 0) return 0;
 
-    fs_mount_t *mount = fs_get_mount(fd_table[fd].mount_slot);
+    fs_mount_t *mount = fs_get_mount(f->mount_slot);
     if (!mount || !mount->valid) return -3;
 
     int rc;
-    if (mount->type == FS_TYPE_MDFS && fd_table[fd].cache_valid && fd_table[fd].cached_type == 1 && fd_table[fd].cached_inode != 0) {
-        rc = mdfs_write_file_at_by_inode(mount->handle, fd_table[fd].cached_inode,
-                                         fd_table[fd].wbuf, fd_table[fd].wbuf_len,
-                                         fd_table[fd].wbuf_file_off);
+    if (mount->type == FS_TYPE_MDFS && f->cache_valid && f->cached_type == 1 && f->cached_inode != 0) {
+        rc = mdfs_write_file_at_by_inode(mount->handle, f->cached_inode,
+                                         f->wbuf, f->wbuf_len,
+                                         f->wbuf_file_off);
+        /* By-inode writes bypass fs_write_file_at(), which normally invalidates. */
+        pcache_invalidate(mount, f->path);
     } else {
-        rc = fs_write_file_at(mount, fd_table[fd].path, fd_table[fd].wbuf, fd_table[fd].wbuf_len, fd_table[fd].wbuf_file_off);
+        rc = fs_write_file_at(mount, f->path, f->wbuf, f->wbuf_len, f->wbuf_file_off);
     }
 
     if (rc != 0) return (rc < 0) ? rc : -3;
 
-    /* If we flushed data at the current position, advance position accordingly.
-     * Note: fd_table[fd].position tracks the logical file position used by fd_write().
-     */
-    if (fd_table[fd].position == fd_table[fd].wbuf_file_off + fd_table[fd].wbuf_len) {
-        /* position already accounts for buffered writes */
+    f->wbuf_len = 0;
+    return 0;
+}
+
+/* --- PIPES --- */
+
+static uint32_t pipe_round_size(size_t n) {
+    if (n < PIPE_MIN_SIZE) n = PIPE_MIN_SIZE;
+    uint32_t sz = PIPE_MIN_SIZE;
+    while (sz < n && sz < PIPE_MAX_SIZE) sz <<= 1;
+    return sz;
+}
+
+static pipe_buf_t *pipe_alloc(uint32_t cap) {
+    pipe_buf_t *pb = (pipe_buf_t*)kmalloc(sizeof(pipe_buf_t));
+    if (!pb) return NULL;
+    memset(pb, 0, sizeof(*pb));
+    pb->buf = (char*)kmalloc(cap);
+    if (!pb->buf) {
+        kfree(pb);
+        return NULL;
     }
+    spinlock_init(&pb->lock);
+    wait_queue_init(&pb->rd_wq);
+    wait_queue_init(&pb->wr_wq);
+    pb->cap = cap;
+    pb->write_end_open = 1;
+    pb->read_end_open = 1;
+    return pb;
+}
+
+static void pipe_wake(wait_queue_t *wq) {
+    if (wait_queue_active(wq)) wake_up_all(wq);
+}
 
-    fd_table[fd].wbuf_len = 0;
+/* Sleep on one of the pipe's wait queues. Called with interrupts disabled
+ * and pb->lock held (dropped here); we are queued before the lock is
+ * released, so a wake issued after the caller's check cannot be lost.
+ * Returns -EINTR when a signal arrived. */
+static int pipe_sleep(pipe_buf_t *pb, wait_queue_t *wq) {
+    wait_entry_t we;
+    prepare_to_wait(wq, &we, 0);
+    spinlock_unlock(&pb->lock);
+    schedule();
+    finish_wait(wq, &we);
+    spinlock_lock(&pb->lock);
+
+    process_t *p = process_get_current();
+    if (p && (p->pending_signals & ~p->blocked_signals)) return -EINTR;
     return 0;
 }
 
-/* Initialize FD table */
+static void pipe_release_end(pipe_buf_t *pb, int is_read_end) {
+    uint64_t irq = irq_save();
+    spinlock_lock(&pb->lock);
+    if (is_read_end) pb->read_end_open = 0;
+    else pb->write_end_open = 0;
+    int last = !pb->read_end_open && !pb->write_end_open;
+    spinlock_unlock(&pb->lock);
+    irq_restore(irq);
+
+    if (last) {
+        kfree(pb->buf);
+        kfree(pb);
+        return;
+    }
+    /* Readers now see EOF, writers EPIPE. */
+    if (is_read_end) pipe_wake(&pb->wr_wq);
+    else pipe_wake(&pb->rd_wq);
+}
+
+static ssize_t pipe_read(open_file_t *f, void *buffer, size_t count) {
+    pipe_buf_t *pb = (pipe_buf_t*)f->pipe_buf;
+    if (!pb || !f->is_read_end) return -1;
+    if (count == 0) return 0;
+
+    uint64_t irq = irq_save();
+    spinlock_lock(&pb->lock);
+    while (pb->count == 0) {
+        int rc = 0;
+        if (!pb->write_end_open) rc = 0;            /* EOF */
+        else if (f->flags & FD_FLAG_NONBLOCK) rc = -EAGAIN;
+        else if ((rc = pipe_sleep(pb, &pb->rd_wq)) == 0) continue;
+        spinlock_unlock(&pb->lock);
+        irq_restore(irq);
+        return rc;
+    }
+
+    /* At most two memcpy()s: up to the end of the ring, then from its start. */
+    size_t n = (count < pb->count) ? count : pb->count;
+    size_t first = pb->cap - pb->read_pos;
+    if (first > n) first = n;
+    memcpy(buffer, pb->buf + pb->read_pos, first);
+    memcpy((char*)buffer + first, pb->buf, n - first);
+    pb->read_pos = (uint32_t)((pb->read_pos + n) & (pb->cap - 1));
+    pb->count -= (uint32_t)n;
+    if (pb->count == 0) pb->read_pos = 0;   /* keep the next write contiguous */
+    spinlock_unlock(&pb->lock);
+    irq_restore(irq);
+
+    pipe_wake(&pb->wr_wq);
+    return (ssize_t)n;
+}
+
+static ssize_t pipe_write(open_file_t *f, const void *buffer, size_t count) {
+    pipe_buf_t *pb = (pipe_buf_t*)f->pipe_buf;
+    if (!pb || f->is_read_end) return -1;
+    if (count == 0) return 0;
+
+    const char *src = (const char*)buffer;
+    size_t done = 0;
+    ssize_t err = 0;
+
+    uint64_t irq = irq_save();
+    spinlock_lock(&pb->lock);
+    while (done < count) {
+        if (!pb->read_end_open) {
+            err = -EPIPE;
+            break;
+        }
+
+        /* Writes of at most PIPE_ATOMIC_SIZE bytes are never interleaved. */
+        size_t left = count - done;
+        size_t space = pb->cap - pb->count;
+        size_t need = (done == 0 && left <= PIPE_ATOMIC_SIZE) ? left : 1;
+        if (space < need) {
+            if (f->flags & FD_FLAG_NONBLOCK) {
+                err = -EAGAIN;
+                break;
+            }
+            int rc = pipe_sleep(pb, &pb->wr_wq);
+            if (rc != 0) {
+                err = rc;
+                break;
+            }
+            continue;
+        }
+
+        size_t n = (left < space) ? left : space;
+        uint32_t wpos = (pb->read_pos + pb->count) & (pb->cap - 1);
+        size_t first = pb->cap - wpos;
+        if (first > n) first = n;
+        memcpy(pb->buf + wpos, src + done, first);
+        memcpy(pb->buf, src + done + first, n - first);
+        pb->count += (uint32_t)n;
+        done += n;
+
+        if (wait_queue_active(&pb->rd_wq)) {
+            spinlock_unlock(&pb->lock);
+            wake_up_all(&pb->rd_wq);
+            spinlock_lock(&pb->lock);
+        }
+    }
+    spinlock_unlock(&pb->lock);
+    irq_restore(irq);
+
+    if (done > 0) return (ssize_t)done;
+    if (err == -EPIPE) {
+        process_t *p = process_get_current();
+        if (p) send_signal(p->pid, SIGPIPE);
+    }
+    return err;
+}
+
+/* F_SETPIPE_SZ: resize the ring, keeping buffered data. */
+static int pipe_set_size(pipe_buf_t *pb, size_t want) {
+    if (want > PIPE_MAX_SIZE) return -EPERM;
+    uint32_t cap = pipe_round_size(want);
+    char *nbuf = (char*)kmalloc(cap);
+    if (!nbuf) return -ENOMEM;
+
+    uint64_t irq = irq_save();
+    spinlock_lock(&pb->lock);
+    if (pb->count > cap) {
+        spinlock_unlock(&pb->lock);
+        irq_restore(irq);
+        kfree(nbuf);
+        return -EBUSY;
+    }
+    size_t first = pb->cap - pb->read_pos;
+    if (first > pb->count) first = pb->count;
+    memcpy(nbuf, pb->buf + pb->read_pos, first);
+    memcpy(nbuf + first, pb->buf, pb->count - first);
+    char *old = pb->buf;
+    pb->buf = nbuf;
+    pb->cap = cap;
+    pb->read_pos = 0;
+    spinlock_unlock(&pb->lock);
+    irq_restore(irq);
+
+    kfree(old);
+    pipe_wake(&pb->wr_wq);
+    return (int)cap;
+}
+
+/* Last reference gone: flush and release everything the object owns.
+ * Returns the first flush error, which close() reports. */
+static int of_release(open_file_t *f) {
+    /* Flush pending buffered writes before closing. */
+    int rc = fd_flush_write_buffer(f);
+
+    /* Flush MDFS inode write-behind cache (performance optimization) */
+    {
+        fs_mount_t *m = fs_get_mount(f->mount_slot);
+        if (m && m->valid && m->type == FS_TYPE_MDFS && f->cache_valid && f->cached_type == 1 && f->cached_inode != 0) {
+            int frc = mdfs_flush_inode(m->handle, f->cached_inode);
+            if (rc == 0 && frc != 0) rc = -3;
+        }
+    }
+
+    if (f->wbuf) kfree(f->wbuf);
+
+    if (f->type == FD_TYPE_PIPE && f->pipe_buf) {
+        pipe_release_end((pipe_buf_t*)f->pipe_buf, f->is_read_end);
+    }
+
+    /* Close devfs/userfs handle */
+    if (f->cached_data) {
+        if (f->type == FD_TYPE_DEVFS) {
+            devfs_close(f->cached_data);
+        } else if (f->type == FD_TYPE_USERFS) {
+            userfs_close(f->cached_data);
+        }
+    }
+
+    if (f->dir_handle) {
+        if (f->is_devvfs) {
+            kfree(f->dir_handle);
+        } else {
+            fs_closedir((fs_dir_t*)f->dir_handle);
+        }
+    }
+
+    /* Drop the page-cache reference; the pages themselves stay cached. */
+    if (f->pcache) pcache_put(f->pcache);
+
+    kfree(f);
+    return rc;
+}
+
+static int of_put(open_file_t *f) {
+    if (!f) return 0;
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0) return 0;
+    /* Console objects keep a permanent reference and never get here. */
+    return of_release(f);
+}
+
+/* Initialize FD layer */
 void fd_init(void) {
     if (fd_initialized) return;
-    
-    for (int i = 0; i < MAX_FDS; i++) {
-        fd_table[i].in_use = 0;
-        fd_table[i].mount_slot = -1;
-        fd_table[i].path[0] = '\0';
-        fd_table[i].position = 0;
-        fd_table[i].file_size = 0;
-        fd_table[i].flags = 0;
-        fd_table[i].pid = 0;
-        fd_table[i].cached_data = NULL;
-        fd_table[i].is_directory = 0;
-        fd_table[i].dir_handle = NULL;
-        fd_table[i].is_devvfs = 0;
-        fd_table[i].is_devfs = 0;
-        fd_table[i].is_userfs = 0;
-
-        fd_table[i].cached_inode = 0;
-        fd_table[i].cached_type = 0;
-        fd_table[i].cache_valid = 0;
-        fd_table[i]._pad_cache = 0;
-
-        fd_table[i].wbuf = NULL;
-        fd_table[i].wbuf_cap = 0;
-        fd_table[i].wbuf_len = 0;
-        fd_table[i].wbuf_file_off = 0;
-    }
-    
+
+    spinlock_init(&fd_lock);
+
     /* Reserve standard file descriptors */
-    fd_table[STDIN_FILENO].in_use = 1;
-    fd_table[STDIN_FILENO].flags = FD_FLAG_READ;
-    fd_table[STDIN_FILENO].pid = 0;
-    fd_table[STDIN_FILENO].cached_data = NULL;
-    
-    fd_table[STDOUT_FILENO].in_use = 1;
-    fd_table[STDOUT_FILENO].flags = FD_FLAG_WRITE;
-    fd_table[STDOUT_FILENO].pid = 0;
-    fd_table[STDOUT_FILENO].cached_data = NULL;
-    
-    fd_table[STDERR_FILENO].in_use = 1;
-    fd_table[STDERR_FILENO].flags = FD_FLAG_WRITE;
-    fd_table[STDERR_FILENO].pid = 0;
-    fd_table[STDERR_FILENO].cached_data = NULL;
-    
+    for (int i = 0; i < 3; i++) {
+        memset(&console_files[i], 0, sizeof(console_files[i]));
+        console_files[i].refs = 1;
+        console_files[i].mount_slot = -1;
+        console_files[i].type = FD_TYPE_CONSOLE;
+    }
+    console_files[STDIN_FILENO].flags = FD_FLAG_READ;
+    console_files[STDOUT_FILENO].flags = FD_FLAG_WRITE;
+    console_files[STDERR_FILENO].flags = FD_FLAG_WRITE;
+
     fd_initialized = 1;
     FD_LOG("[FD] File descriptor table initialized\n");
 }
 
-/* Find lowest free file descriptor at or above min_fd. */
-static int find_free_fd_from(int min_fd) {
-    for (int i = min_fd; i < MAX_FDS; i++) {
-        if (!fd_table[i].in_use)
-            return i;
-    }
-    return -1;
-}
-
-static int find_free_fd(void) {
-    /* POSIX: allocate the lowest available fd >= 0. */
-    return find_free_fd_from(0);
+static int fd_flags_from_open(int flags) {
+    int nb = (flags & O_NONBLOCK) ? FD_FLAG_NONBLOCK : 0;
+    if ((flags & O_RDWR) == O_RDWR) return FD_FLAG_READ | FD_FLAG_WRITE | nb;
+    if (flags & O_WRONLY) return FD_FLAG_WRITE | nb;
+    return FD_FLAG_READ | nb;
 }
 
 static int fd_open_devfs_internal(const char *node, int flags) {
@@ -186,40 +523,19 @@ static int fd_open_devfs_internal(const char *node, int flags) {
     }
     if (!h) return -1;
 
-    int fd = find_free_fd();
-    if (fd < 0) {
+    open_file_t *f = of_alloc(FD_TYPE_DEVFS, fd_flags_from_open(flags));
+    if (!f) {
         devfs_close(h);
         return -6;
     }
+    strncpy(f->path, node, sizeof(f->path) - 1);
+    f->cached_data = h;
 
-    // Convert flags
-    int fd_flags = 0;
-    if ((flags & O_RDWR) == O_RDWR) {
-        fd_flags = FD_FLAG_READ | FD_FLAG_WRITE;
-    } else if (flags & O_WRONLY) {
-        fd_flags = FD_FLAG_WRITE;
-    } else {
-        fd_flags = FD_FLAG_READ;
-    }
-
-    process_t* proc = process_get_current();
-    int pid = proc ? proc->pid : 0;
-
-    fd_table[fd].mount_slot = -1;
-    strncpy(fd_table[fd].path, node, sizeof(fd_table[fd].path) - 1);
-    fd_table[fd].path[sizeof(fd_table[fd].path) - 1] = 0;
-    fd_table[fd].position = 0;
-    fd_table[fd].file_size = 0;
-    fd_table[fd].flags = fd_flags;
-    fd_table[fd].pid = pid;
-    fd_table[fd].cached_data = h;
-    fd_table[fd].in_use = 1;
-    fd_table[fd].is_directory = 0;
-    fd_table[fd].dir_handle = NULL;
-    fd_table[fd].is_devvfs = 0;
-    fd_table[fd].is_devfs = 1;
-    fd_table[fd].is_userfs = 0;
-
+    int fd = fd_install_new(f, 0);
+    if (fd < 0) {
+        of_put(f);
+        return -6;
+    }
     return fd;
 }
 
@@ -232,39 +548,19 @@ static int fd_open_userfs_internal(const char *node, int flags) {
         return -1;
     }
 
-    int fd = find_free_fd();
-    if (fd < 0) {
+    open_file_t *f = of_alloc(FD_TYPE_USERFS, fd_flags_from_open(flags));
+    if (!f) {
         userfs_close(h);
         return -6;
     }
+    strncpy(f->path, node, sizeof(f->path) - 1);
+    f->cached_data = h;
 
-    int fd_flags = 0;
-    if ((flags & O_RDWR) == O_RDWR) {
-        fd_flags = FD_FLAG_READ | FD_FLAG_WRITE;
-    } else if (flags & O_WRONLY) {
-        fd_flags = FD_FLAG_WRITE;
-    } else {
-        fd_flags = FD_FLAG_READ;
-    }
-
-    process_t* proc = process_get_current();
-    int pid = proc ? proc->pid : 0;
-
-    fd_table[fd].mount_slot = -1;
-    strncpy(fd_table[fd].path, node, sizeof(fd_table[fd].path) - 1);
-    fd_table[fd].path[sizeof(fd_table[fd].path) - 1] = 0;
-    fd_table[fd].position = 0;
-    fd_table[fd].file_size = 0;
-    fd_table[fd].flags = fd_flags;
-    fd_table[fd].pid = pid;
-    fd_table[fd].cached_data = h;
-    fd_table[fd].in_use = 1;
-    fd_table[fd].is_directory = 0;
-    fd_table[fd].dir_handle = NULL;
-    fd_table[fd].is_devvfs = 0;
-    fd_table[fd].is_devfs = 0;
-    fd_table[fd].is_userfs = 1;
-
+    int fd = fd_install_new(f, 0);
+    if (fd < 0) {
+        of_put(f);
+        return -6;
+    }
     return fd;
 }
 
@@ -276,91 +572,62 @@ int fd_open_userfs(const char *node, int flags) {
     return fd_open_userfs_internal(node, flags);
 }
 
-/* Open file - now uses HVFS to cache file contents */
+/* Open file. Reads stream through the shared page cache instead of loading the
+ * whole file, so open() costs one stat and no data I/O. */
 int fd_open(int mount_slot, const char* path, int flags, int mode) {
     (void)mode; /* Unused for now */
-    
+
     fd_init();
-    
+
     if (!path || mount_slot < 0 || mount_slot >= 26) {
         FD_LOG("[FD] Invalid parameters\n");
         return -1;
     }
-    
-    /* Find free FD first */
-    int fd = find_free_fd();
-    if (fd < 0) {
-        FD_LOG("[FD] No free file descriptors\n");
-        return -6;
-    }
-    
+
     /* Convert flags */
-    int fd_flags = 0;
-    if ((flags & O_RDWR) == O_RDWR) {
-        fd_flags = FD_FLAG_READ | FD_FLAG_WRITE;
-    } else if (flags & O_WRONLY) {
-        fd_flags = FD_FLAG_WRITE;
-    } else {
-        fd_flags = FD_FLAG_READ;
-    }
-    
+    int fd_flags = fd_flags_from_open(flags);
     if (flags & O_APPEND) {
         fd_flags |= FD_FLAG_APPEND;
     }
-    
-    /* Get current process PID */
-    process_t* proc = process_get_current();
-    int pid = proc ? proc->pid : 0;
-    
-    /* Use HVFS to read file into memory (if reading) */
-    void* file_buffer = NULL;
+
+    /* Readers get a reference on the file's page-cache object; no data is read yet. */
+    pcache_file_t* pc = NULL;
     size_t file_size = 0;
-    
+
     if (fd_flags & FD_FLAG_READ) {
-        int hvfs_result = hvfs_read(mount_slot, path, &file_buffer, &file_size);
-        
-        if (hvfs_result != 0) {
-            FD_LOG("[FD] HVFS read failed: ");
-            if (FD_DEBUG) {
-                char err_str[16];
-                itoa(hvfs_result, err_str, 10);
-                com_write_string(COM1_PORT, err_str);
-                com_write_string(COM1_PORT, "\n");
-            }
-            
-            /* Map HVFS errors to fd_open errors */
-            switch (hvfs_result) {
-                case 1:  return -3; /* File not found */
-                case 2:  return -5; /* Is directory */
-                case -1: return -4; /* Stat failed */
-                case -3: return -6; /* Malloc failed */
-                default: return -7; /* Other error */
-            }
+        fs_mount_t* rm = fs_get_mount(mount_slot);
+        if (!rm || !rm->valid) {
+            FD_LOG("[FD] Invalid mount\n");
+            return -4;
         }
-        
-        if (FD_DEBUG) {
-            com_write_string(COM1_PORT, "[FD] HVFS loaded file: ");
-            char size_str[32];
-            itoa(file_size, size_str, 10);
-            com_write_string(COM1_PORT, size_str);
-            com_write_string(COM1_PORT, " bytes\n");
+
+        fs_file_info_t info;
+        if (fs_stat(rm, path, &info) != 0) {
+            FD_LOG("[FD] File not found\n");
+            return -3;
         }
+        if (info.is_directory) {
+            return -5;
+        }
+
+        pc = pcache_open(rm, path, &info);
+        if (!pc) {
+            FD_LOG("[FD] Page cache unavailable\n");
+            return -6;
+        }
+        file_size = info.size;
+    }
+
+    open_file_t *f = of_alloc(FD_TYPE_FILE, fd_flags);
+    if (!f) {
+        if (pc) pcache_put(pc);
+        return -6;
     }
-    
-    /* Initialize FD */
-    fd_table[fd].mount_slot = mount_slot;
-    strncpy(fd_table[fd].path, path, sizeof(fd_table[fd].path) - 1);
-    fd_table[fd].path[sizeof(fd_table[fd].path) - 1] = '\0';
-    fd_table[fd].position = (flags & O_APPEND) ? file_size : 0;
-    fd_table[fd].file_size = file_size;
-    fd_table[fd].flags = fd_flags;
-    fd_table[fd].pid = pid;
-    fd_table[fd].cached_data = file_buffer;
-    fd_table[fd].in_use = 1;
-
-    fd_table[fd].cache_valid = 0;
-    fd_table[fd].cached_inode = 0;
-    fd_table[fd].cached_type = 0;
+    f->mount_slot = mount_slot;
+    strncpy(f->path, path, sizeof(f->path) - 1);
+    f->position = (flags & O_APPEND) ? file_size : 0;
+    f->file_size = file_size;
+    f->pcache = pc;
 
     /* If this is an MDFS mount and we intend to write, resolve/create inode once.
      * This avoids path lookup and directory scans on every write().
@@ -371,12 +638,37 @@ int fd_open(int mount_slot, const char* path, int flags, int mode) {
         int tr = (flags & O_TRUNC) ? 1 : 0;
         int rc2 = mdfs_create_file_trunc(m->handle, path, tr, &ino_n);
         if (rc2 == 0) {
-            fd_table[fd].cache_valid = 1;
-            fd_table[fd].cached_inode = ino_n;
-            fd_table[fd].cached_type = 1;
+            f->cache_valid = 1;
+            f->cached_inode = ino_n;
+            f->cached_type = 1;
+        }
+        /* Creating/truncating went straight to MDFS; resync what readers see. */
+        pcache_invalidate(m, path);
+        if (pc) f->file_size = (size_t)pcache_file_size(pc);
+    } else if (m && m->valid && (fd_flags & FD_FLAG_WRITE)) {
+        /* Writes land at their offset and keep the rest of the file, so O_TRUNC
+         * has to empty it here. */
+        if (flags & O_TRUNC) {
+            (void)fs_write_file(m, path, NULL, 0);
+            f->file_size = pc ? (size_t)pcache_file_size(pc) : 0;
+        }
+    }
+    if (m && m->valid && (fd_flags & FD_FLAG_WRITE) && (flags & O_APPEND)) {
+        /* O_APPEND needs the size even without read access. */
+        if (!pc && !(flags & O_TRUNC)) {
+            fs_file_info_t winfo;
+            if (fs_stat(m, path, &winfo) == 0 && !winfo.is_directory) f->file_size = winfo.size;
         }
+        f->position = f->file_size;
     }
-    
+
+    int fd = fd_install_new(f, 0);
+    if (fd < 0) {
+        FD_LOG("[FD] No free file descriptors\n");
+        of_put(f);
+        return -6;
+    }
+
     if (FD_DEBUG) {
         com_write_string(COM1_PORT, "[FD] Opened file: ");
         com_write_string(COM1_PORT, path);
@@ -386,186 +678,129 @@ int fd_open(int mount_slot, const char* path, int flags, int mode) {
         com_write_string(COM1_PORT, fd_str);
         com_write_string(COM1_PORT, "\n");
     }
-    
+
     return fd;
 }
 
+/* Detach slot fd from table t and drop its reference. */
+static int fd_tbl_close(fd_tbl_t *t, int fd) {
+    if (fd < 0 || fd >= PROCESS_MAX_FDS) return -1;
+
+    spinlock_lock(&fd_lock);
+    if (!fd_bit_test(t, fd)) {
+        spinlock_unlock(&fd_lock);
+        return -1;
+    }
+    open_file_t *f = t->slot[fd];
+    t->slot[fd] = NULL;
+    fd_bit_clear(t, fd);
+    spinlock_unlock(&fd_lock);
+
+    return of_put(f);
+}
+
 /* Close file descriptor */
 int fd_close(int fd) {
     fd_init();
-    
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
-        return -1;
-    }
-    
-    /* Closing fd 0/1/2 is valid POSIX — just mark slot free. */
-    
-    /* Flush pending buffered writes before closing. */
-    (void)fd_flush_write_buffer(fd);
 
-    /* Flush MDFS inode write-behind cache (performance optimization) */
-    {
-        fs_mount_t *m = fs_get_mount(fd_table[fd].mount_slot);
-        if (m && m->valid && m->type == FS_TYPE_MDFS && fd_table[fd].cache_valid && fd_table[fd].cached_type == 1 && fd_table[fd].cached_inode != 0) {
-            (void)mdfs_flush_inode(m->handle, fd_table[fd].cached_inode);
-        }
-    }
+    /* Closing fd 0/1/2 is valid POSIX — it only drops this table's reference. */
+    fd_tbl_t t;
+    fd_cur_tbl(&t);
+    int rc = fd_tbl_close(&t, fd);
 
-    /* Free write buffer */
-    if (fd_table[fd].wbuf) {
-        kfree(fd_table[fd].wbuf);
-        fd_table[fd].wbuf = NULL;
-        fd_table[fd].wbuf_cap = 0;
-        fd_table[fd].wbuf_len = 0;
-        fd_table[fd].wbuf_file_off = 0;
-    }
-
-    /* Pipe cleanup: mark write end closed so readers see EOF */
-    if (fd_table[fd].type == FD_TYPE_PIPE && fd_table[fd].pipe_buf) {
-        pipe_buf_t *pb = (pipe_buf_t*)fd_table[fd].pipe_buf;
-        if (!fd_table[fd].is_read_end)
-            pb->write_end_open = 0;
-        /* The pipe_buf is shared between read and write ends.
-         * Only free it when both ends are closed.
-         * We use a simple ref-count via write_end_open + a separate flag. */
-        fd_table[fd].pipe_buf = NULL;
-    }
-
-    /* Close devfs/userfs handle OR free cached file data */
-    if (fd_table[fd].cached_data) {
-        if (fd_table[fd].is_devfs) {
-            devfs_close(fd_table[fd].cached_data);
-        } else if (fd_table[fd].is_userfs) {
-            userfs_close(fd_table[fd].cached_data);
-        } else {
-            /* cached_data may be an HVFS cached buffer. */
-            if (!hvfs_cache_release(fd_table[fd].mount_slot, fd_table[fd].path, fd_table[fd].cached_data)) {
-                kfree(fd_table[fd].cached_data);
-            }
-        }
-        fd_table[fd].cached_data = NULL;
-    }
-    
-    if (FD_DEBUG) {
+    if (FD_DEBUG && rc == 0) {
         com_write_string(COM1_PORT, "[FD] Closed FD ");
         char fd_str[16];
         itoa(fd, fd_str, 10);
         com_write_string(COM1_PORT, fd_str);
         com_write_string(COM1_PORT, "\n");
     }
-    
-    fd_table[fd].in_use = 0;
-    fd_table[fd].mount_slot = -1;
-    fd_table[fd].path[0] = '\0';
-    fd_table[fd].position = 0;
-    fd_table[fd].file_size = 0;
-    fd_table[fd].flags = 0;
-    fd_table[fd].is_directory = 0;
-    fd_table[fd].dir_handle = NULL;
-    fd_table[fd].is_devvfs = 0;
-    fd_table[fd].is_devfs = 0;
-    fd_table[fd].is_userfs = 0;
-
-    fd_table[fd].wbuf = NULL;
-    fd_table[fd].wbuf_cap = 0;
-    fd_table[fd].wbuf_len = 0;
-    fd_table[fd].wbuf_file_off = 0;
-    
-    return 0;
+
+    return rc;
 }
 
-/* Read from file descriptor - now uses cached data */
+/* Read from file descriptor - streams through the page cache */
 ssize_t fd_read(int fd, void* buffer, size_t count) {
     fd_init();
-    
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
+
+    open_file_t *f = fd_file(fd);
+    if (!f) {
         return -1;
     }
-    
+
     /* Check read permission */
-    if (!(fd_table[fd].flags & FD_FLAG_READ)) {
+    if (!(f->flags & FD_FLAG_READ)) {
         FD_LOG("[FD] No read permission\n");
         return -2;
     }
-    
-    /* Handle stdin specially (not implemented) */
-    if (fd == STDIN_FILENO) {
+
+    /* Console stdin is read via SYS_INPUT (not implemented here) */
+    if (f->type == FD_TYPE_CONSOLE) {
         return -3;
     }
 
     /* Pipe read */
-    if (fd_table[fd].type == FD_TYPE_PIPE) {
-        pipe_buf_t *pb = (pipe_buf_t*)fd_table[fd].pipe_buf;
-        if (!pb || !fd_table[fd].is_read_end) return -1;
-        /* Spin-wait for data (simple blocking read; no sleep/wakeup yet) */
-        while (pb->count == 0) {
-            if (!pb->write_end_open) return 0; /* EOF */
-            process_yield();
-        }
-        size_t n = (count < (size_t)pb->count) ? count : (size_t)pb->count;
-        char *dst = (char*)buffer;
-        for (size_t i = 0; i < n; i++) {
-            dst[i] = pb->buf[pb->read_pos];
-            pb->read_pos = (pb->read_pos + 1) % PIPE_BUF_SIZE;
-        }
-        pb->count -= (int)n;
-        return (ssize_t)n;
+    if (f->type == FD_TYPE_PIPE) {
+        return pipe_read(f, buffer, count);
     }
 
     /* devfs-backed FD */
-    if (fd_table[fd].is_devfs) {
-        if (!fd_table[fd].cached_data) return -4;
-        return devfs_read(fd_table[fd].cached_data, buffer, count);
+    if (f->type == FD_TYPE_DEVFS) {
+        if (!f->cached_data) return -4;
+        return devfs_read(f->cached_data, buffer, count);
     }
 
     /* userfs-backed FD */
-    if (fd_table[fd].is_userfs) {
-        if (!fd_table[fd].cached_data) return -4;
-        return userfs_read(fd_table[fd].cached_data, buffer, count);
+    if (f->type == FD_TYPE_USERFS) {
+        if (!f->cached_data) return -4;
+        return userfs_read(f->cached_data, buffer, count);
     }
 
-    /* Check if we have cached data */
-    if (!fd_table[fd].cached_data) {
-        FD_LOG("[FD] No cached data for reading\n");
+    if (!f->pcache) {
+        FD_LOG("[FD] No page cache for reading\n");
         return -4;
     }
-    
-    /* Check if at EOF */
-    if (fd_table[fd].position >= fd_table[fd].file_size) {
-        return 0; /* EOF */
-    }
-    
-    /* Calculate how much to read */
-    size_t remaining = fd_table[fd].file_size - fd_table[fd].position;
-    size_t to_read = (count < remaining) ? count : remaining;
-    
-    /* Copy from cached buffer at current position */
-    memcpy(buffer, (uint8_t*)fd_table[fd].cached_data + fd_table[fd].position, to_read);
-    
-    /* Update position */
-    fd_table[fd].position += to_read;
-    
-    return (ssize_t)to_read;
+
+    /* Make our own buffered writes visible before reading them back. */
+    if (f->wbuf_len) {
+        int frc = fd_flush_write_buffer(f);
+        if (frc != 0) return frc;
+        f->wbuf_file_off = f->position;
+    }
+
+    size_t got = 0;
+    int rc = pcache_read(f->pcache, f->position, buffer, count, &got);
+    if (rc != 0) {
+        FD_LOG("[FD] Page cache read failed\n");
+        return -5;
+    }
+
+    /* Update position (0 bytes == EOF) */
+    f->position += got;
+    if (f->position > f->file_size) f->file_size = f->position;
+
+    return (ssize_t)got;
 }
 
 /* Write to file descriptor */
 ssize_t fd_write(int fd, const void* buffer, size_t count) {
     fd_init();
 
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
+    open_file_t *f = fd_file(fd);
+    if (!f) {
         return -1;
     }
 
     if (!buffer && count != 0) return -1;
 
     /* Check write permission */
-    if (!(fd_table[fd].flags & FD_FLAG_WRITE)) {
+    if (!(f->flags & FD_FLAG_WRITE)) {
         return -2;
     }
 
 
-    /* Handle stdout/stderr specially */
-    if (fd == STDOUT_FILENO || fd == STDERR_FILENO) {
+    /* Console stdout/stderr (dispatch on the object, so dup2() redirection works) */
+    if (f->type == FD_TYPE_CONSOLE) {
         /* Userspace typically writes via SYS_WRITE (string) for console output.
          * SYS_WRITEFILE is primarily used for binary-safe writes.
          */
@@ -576,33 +811,24 @@ ssize_t fd_write(int fd, const void* buffer, size_t count) {
     }
 
     /* Pipe write */
-    if (fd_table[fd].type == FD_TYPE_PIPE) {
-        pipe_buf_t *pb = (pipe_buf_t*)fd_table[fd].pipe_buf;
-        if (!pb || fd_table[fd].is_read_end) return -1;
-        const char *src = (const char*)buffer;
-        size_t written = 0;
-        while (written < count) {
-            while (pb->count == PIPE_BUF_SIZE)
-                process_yield(); /* wait for space */
-            pb->buf[pb->write_pos] = src[written++];
-            pb->write_pos = (pb->write_pos + 1) % PIPE_BUF_SIZE;
-            pb->count++;
-        }
-        return (ssize_t)count;
+    if (f->type == FD_TYPE_PIPE) {
+        return pipe_write(f, buffer, count);
     }
 
     /* devfs-backed FD: dispatch to devfs_write */
-    if (fd_table[fd].is_devfs) {
-        if (!fd_table[fd].cached_data) return -4;
-        return devfs_write(fd_table[fd].cached_data, buffer, count);
+    if (f->type == FD_TYPE_DEVFS) {
+        if (!f->cached_data) return -4;
+        return devfs_write(f->cached_data, buffer, count);
     }
 
     /* userfs-backed FD: dispatch to userfs_write */
-    if (fd_table[fd].is_userfs) {
-        if (!fd_table[fd].cached_data) return -4;
-        return userfs_write(fd_table[fd].cached_data, buffer, count);
+    if (f->type == FD_TYPE_USERFS) {
+        if (!f->cached_data) return -4;
+        return userfs_write(f->cached_data, buffer, count);
     }
 
+    if (f->type != FD_TYPE_FILE) return -1;
+
     /* Regular file writing: COALESCE small sequential writes into bigger IO.
      * Without this, userland writing in 4KiB chunks can cause hundreds of thousands of
      * vdrive_write() calls.
@@ -610,190 +836,180 @@ ssize_t fd_write(int fd, const void* buffer, size_t count) {
     if (count == 0) return 0;
 
     /* Ensure buffer exists. */
-    if (!fd_table[fd].wbuf) {
-        fd_table[fd].wbuf_cap = FD_WRITEBUF_DEFAULT_CAP;
-        fd_table[fd].wbuf = (uint8_t*)kmalloc(fd_table[fd].wbuf_cap);
-        fd_table[fd].wbuf_len = 0;
-        fd_table[fd].wbuf_file_off = fd_table[fd].position;
-        if (!fd_table[fd].wbuf) {
+    if (!f->wbuf) {
+        f->wbuf_cap = FD_WRITEBUF_DEFAULT_CAP;
+        f->wbuf = (uint8_t*)kmalloc(f->wbuf_cap);
+        f->wbuf_len = 0;
+        f->wbuf_file_off = f->position;
+        if (!f->wbuf) {
             // Fall back to direct write if we can't allocate the buffer.
-            fs_mount_t *mount = fs_get_mount(fd_table[fd].mount_slot);
+            fs_mount_t *mount = fs_get_mount(f->mount_slot);
             if (!mount || !mount->valid) return -3;
             int rc;
-            if (mount->type == FS_TYPE_MDFS && fd_table[fd].cache_valid && fd_table[fd].cached_type == 1 && fd_table[fd].cached_inode != 0) {
-                rc = mdfs_write_file_at_by_inode(mount->handle, fd_table[fd].cached_inode, buffer, count, fd_table[fd].position);
+            if (mount->type == FS_TYPE_MDFS && f->cache_valid && f->cached_type == 1 && f->cached_inode != 0) {
+                rc = mdfs_write_file_at_by_inode(mount->handle, f->cached_inode, buffer, count, f->position);
+                pcache_invalidate(mount, f->path);
             } else {
-                rc = fs_write_file_at(mount, fd_table[fd].path, buffer, count, fd_table[fd].position);
+                rc = fs_write_file_at(mount, f->path, buffer, count, f->position);
             }
             if (rc != 0) return (rc < 0) ? (ssize_t)rc : -3;
-            fd_table[fd].position += count;
-            if (fd_table[fd].position > fd_table[fd].file_size) fd_table[fd].file_size = fd_table[fd].position;
+            f->position += count;
+            if (f->position > f->file_size) f->file_size = f->position;
             return (ssize_t)count;
         }
     }
 
     /* If this write is not contiguous with buffered data, flush first. */
-    size_t expected_off = fd_table[fd].wbuf_file_off + fd_table[fd].wbuf_len;
-    if (fd_table[fd].position != expected_off) {
-        int frc = fd_flush_write_buffer(fd);
+    size_t expected_off = f->wbuf_file_off + f->wbuf_len;
+    if (f->position != expected_off) {
+        int frc = fd_flush_write_buffer(f);
         if (frc != 0) return (ssize_t)frc;
-        fd_table[fd].wbuf_file_off = fd_table[fd].position;
+        f->wbuf_file_off = f->position;
     }
 
     const uint8_t *src = (const uint8_t*)buffer;
     size_t remaining = count;
     while (remaining > 0) {
-        size_t space = fd_table[fd].wbuf_cap - fd_table[fd].wbuf_len;
+        size_t space = f->wbuf_cap - f->wbuf_len;
         if (space == 0) {
             /* Buffer full. For sequential workloads, prefer growing the buffer up to a cap
              * instead of flushing too often.
              */
-            if (fd_table[fd].wbuf_cap < FD_WRITEBUF_MAX_CAP) {
-                size_t new_cap = fd_table[fd].wbuf_cap * 2u;
+            if (f->wbuf_cap < FD_WRITEBUF_MAX_CAP) {
+                size_t new_cap = f->wbuf_cap * 2u;
                 if (new_cap > FD_WRITEBUF_MAX_CAP) new_cap = FD_WRITEBUF_MAX_CAP;
 
                 uint8_t *nb = (uint8_t*)kmalloc(new_cap);
                 if (nb) {
-                    memcpy(nb, fd_table[fd].wbuf, fd_table[fd].wbuf_len);
-                    kfree(fd_table[fd].wbuf);
-                    fd_table[fd].wbuf = nb;
-                    fd_table[fd].wbuf_cap = new_cap;
-                    space = fd_table[fd].wbuf_cap - fd_table[fd].wbuf_len;
+                    memcpy(nb, f->wbuf, f->wbuf_len);
+                    kfree(f->wbuf);
+                    f->wbuf = nb;
+                    f->wbuf_cap = new_cap;
+                    space = f->wbuf_cap - f->wbuf_len;
                 } else {
-                    int frc = fd_flush_write_buffer(fd);
+                    int frc = fd_flush_write_buffer(f);
                     if (frc != 0) return (ssize_t)frc;
-                    fd_table[fd].wbuf_file_off = fd_table[fd].position;
-                    space = fd_table[fd].wbuf_cap;
+                    f->wbuf_file_off = f->position;
+                    space = f->wbuf_cap;
                 }
             } else {
-                int frc = fd_flush_write_buffer(fd);
+                int frc = fd_flush_write_buffer(f);
                 if (frc != 0) return (ssize_t)frc;
-                fd_table[fd].wbuf_file_off = fd_table[fd].position;
-                space = fd_table[fd].wbuf_cap;
+                f->wbuf_file_off = f->position;
+                space = f->wbuf_cap;
             }
         }
 
         size_t take = (remaining < space) ? remaining : space;
-        memcpy(fd_table[fd].wbuf + fd_table[fd].wbuf_len, src, take);
-        fd_table[fd].wbuf_len += take;
-        fd_table[fd].position += take;
+        memcpy(f->wbuf + f->wbuf_len, src, take);
+        f->wbuf_len += take;
+        f->position += take;
         src += take;
         remaining -= take;
 
         /* Flush eagerly once buffer is full; otherwise keep coalescing. */
-        if (fd_table[fd].wbuf_len == fd_table[fd].wbuf_cap) {
-            int frc = fd_flush_write_buffer(fd);
+        if (f->wbuf_len == f->wbuf_cap) {
+            int frc = fd_flush_write_buffer(f);
             if (frc != 0) return (ssize_t)frc;
-            fd_table[fd].wbuf_file_off = fd_table[fd].position;
+            f->wbuf_file_off = f->position;
         }
     }
 
-    if (fd_table[fd].position > fd_table[fd].file_size) fd_table[fd].file_size = fd_table[fd].position;
+    if (f->position > f->file_size) f->file_size = f->position;
     return (ssize_t)count;
 }
 
 /* Seek in file */
 off_t fd_lseek(int fd, off_t offset, int whence) {
     fd_init();
-    
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
+
+    open_file_t *f = fd_file(fd);
+    if (!f) {
         return -1;
     }
-    
-    /* Can't seek stdin/stdout/stderr */
-    if (fd <= 2) {
+
+    /* Can't seek the console or a pipe */
+    if (f->type == FD_TYPE_CONSOLE || f->type == FD_TYPE_PIPE) {
         return -2;
     }
-    
+
     off_t new_pos;
-    
+
     /* Seeking changes the write position. If we have buffered writes, flush first
      * to preserve ordering and file offsets.
      */
-    if ((fd_table[fd].flags & FD_FLAG_WRITE) && fd_table[fd].wbuf_len) {
-        int frc = fd_flush_write_buffer(fd);
+    if ((f->flags & FD_FLAG_WRITE) && f->wbuf_len) {
+        int frc = fd_flush_write_buffer(f);
         if (frc != 0) return frc;
-        fd_table[fd].wbuf_file_off = fd_table[fd].position;
+        f->wbuf_file_off = f->position;
     }
 
     switch (whence) {
         case SEEK_SET:
             new_pos = offset;
             break;
-            
+
         case SEEK_CUR:
-            new_pos = fd_table[fd].position + offset;
+            new_pos = f->position + offset;
             break;
-            
+
         case SEEK_END:
-            new_pos = fd_table[fd].file_size + offset;
+            new_pos = f->file_size + offset;
             break;
-            
+
         default:
             return -3;
     }
-    
+
     /* Clamp to valid range */
     if (new_pos < 0) {
         new_pos = 0;
-    } else if ((size_t)new_pos > fd_table[fd].file_size) {
-        new_pos = fd_table[fd].file_size;
+    } else if ((size_t)new_pos > f->file_size) {
+        new_pos = f->file_size;
     }
-    
-    fd_table[fd].position = new_pos;
-    
+
+    f->position = new_pos;
+
     return new_pos;
 }
 
 /* Get file descriptor structure */
 file_descriptor_t* fd_get(int fd) {
     fd_init();
-    
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
-        return NULL;
-    }
-    
+
     /* Return as public type (without cached_data pointer) */
-    return (file_descriptor_t*)&fd_table[fd];
+    return (file_descriptor_t*)fd_file(fd);
 }
 
 /* Check if FD is valid */
 int fd_is_valid(int fd) {
     fd_init();
-    
-    return (fd >= 0 && fd < MAX_FDS && fd_table[fd].in_use) ? 1 : 0;
+
+    return fd_file(fd) ? 1 : 0;
 }
 
-/* Duplicate file descriptor */
+/* Duplicate file descriptor. Both slots reference the same open file. */
 int fd_dup(int oldfd) {
     fd_init();
-    
-    if (oldfd < 0 || oldfd >= MAX_FDS || !fd_table[oldfd].in_use) {
+
+    if (oldfd < 0 || oldfd >= PROCESS_MAX_FDS) return -1;
+
+    fd_tbl_t t;
+    fd_cur_tbl(&t);
+    spinlock_lock(&fd_lock);
+    if (!fd_bit_test(&t, oldfd)) {
+        spinlock_unlock(&fd_lock);
         return -1;
     }
-    
-    int newfd = find_free_fd();
+    int newfd = fd_slot_alloc(&t, 0);
     if (newfd < 0) {
+        spinlock_unlock(&fd_lock);
         return -2;
     }
-    
-    /* Copy FD structure */
-    fd_table[newfd] = fd_table[oldfd];
-    
-    /* Important: Don't share cached data pointer! 
-       Each FD needs its own copy if we want independent positions */
-    if (fd_table[oldfd].cached_data && fd_table[oldfd].file_size > 0) {
-        void* new_cache = kmalloc(fd_table[oldfd].file_size);
-        if (new_cache) {
-            memcpy(new_cache, fd_table[oldfd].cached_data, fd_table[oldfd].file_size);
-            fd_table[newfd].cached_data = new_cache;
-        } else {
-            /* Failed to allocate, can't dup */
-            fd_table[newfd].in_use = 0;
-            return -3;
-        }
-    }
-    
+    of_get(t.slot[oldfd]);
+    t.slot[newfd] = t.slot[oldfd];
+    spinlock_unlock(&fd_lock);
+
     return newfd;
 }
 
@@ -803,86 +1019,116 @@ int fd_dup(int oldfd) {
 int fd_dup2(int oldfd, int newfd) {
     fd_init();
 
-    if (oldfd < 0 || oldfd >= MAX_FDS || !fd_table[oldfd].in_use) return -1;
-    if (newfd < 0 || newfd >= MAX_FDS) return -1;
-    if (oldfd == newfd) return newfd;
-
-    /* Close newfd if open — suppress errors, POSIX says best-effort. */
-    if (fd_table[newfd].in_use)
-        fd_close(newfd);
+    if (oldfd < 0 || oldfd >= PROCESS_MAX_FDS) return -1;
+    if (newfd < 0 || newfd >= PROCESS_MAX_FDS) return -1;
 
-    fd_table[newfd] = fd_table[oldfd];
-    fd_table[newfd].in_use = 1;
-
-    /* Duplicate cached data buffer so both FDs have independent position. */
-    if (fd_table[oldfd].cached_data && fd_table[oldfd].file_size > 0
-        && !fd_table[oldfd].is_devfs && !fd_table[oldfd].is_userfs) {
-        void *nb = kmalloc(fd_table[oldfd].file_size);
-        if (nb) {
-            memcpy(nb, fd_table[oldfd].cached_data, fd_table[oldfd].file_size);
-            fd_table[newfd].cached_data = nb;
-        } else {
-            fd_table[newfd].cached_data = NULL;
-        }
+    fd_tbl_t t;
+    fd_cur_tbl(&t);
+    spinlock_lock(&fd_lock);
+    if (!fd_bit_test(&t, oldfd)) {
+        spinlock_unlock(&fd_lock);
+        return -1;
     }
-    /* Write buffer is not inherited — child starts fresh. */
-    fd_table[newfd].wbuf = NULL;
-    fd_table[newfd].wbuf_cap = 0;
-    fd_table[newfd].wbuf_len = 0;
-    fd_table[newfd].wbuf_file_off = 0;
+    if (oldfd == newfd) {
+        spinlock_unlock(&fd_lock);
+        return newfd;
+    }
+
+    /* Swap the slot in one step; the replaced file is released outside the lock. */
+    open_file_t *old = fd_bit_test(&t, newfd) ? t.slot[newfd] : NULL;
+    of_get(t.slot[oldfd]);
+    t.slot[newfd] = t.slot[oldfd];
+    fd_bit_set(&t, newfd);
+    spinlock_unlock(&fd_lock);
 
+    of_put(old);
     return newfd;
 }
 
-/* Clone all open FDs from parent_pid into child_pid.
- * Used by fork() to give the child the same open file table. */
+/* Give child_pid a copy of parent_pid's descriptor table (fork()).
+ * Every slot keeps its number and only takes another reference on the
+ * parent's open file, so offsets are shared as POSIX requires. */
 void fd_clone_for_fork(int parent_pid, int child_pid) {
     fd_init();
-    for (int i = 0; i < MAX_FDS; i++) {
-        if (!fd_table[i].in_use || fd_table[i].pid != parent_pid) continue;
-        /* Duplicate the slot into a fresh entry for the child. */
-        file_descriptor_internal_t copy = fd_table[i];
-        copy.pid = child_pid;
-        /* Give the child its own cached data copy so seek positions diverge. */
-        if (copy.cached_data && copy.file_size > 0
-            && !copy.is_devfs && !copy.is_userfs) {
-            void *nb = kmalloc(copy.file_size);
-            if (nb) {
-                memcpy(nb, fd_table[i].cached_data, copy.file_size);
-                copy.cached_data = nb;
-            } else {
-                copy.cached_data = NULL;
-            }
+
+    process_t *parent = process_find((uint32_t)parent_pid);
+    process_t *child = process_find((uint32_t)child_pid);
+    if (!child) return;
+
+    fd_tbl_t pt, ct;
+    fd_tbl_of(parent, &pt);
+    fd_tbl_of(child, &ct);
+
+    spinlock_lock(&fd_lock);
+    fd_tbl_prepare(&pt);
+    for (int w = 0; w < FD_BITMAP_WORDS; w++) {
+        uint64_t bits = pt.used[w];
+        ct.used[w] = bits;
+        while (bits) {
+            int fd = (w << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            of_get(pt.slot[fd]);
+            ct.slot[fd] = pt.slot[fd];
         }
-        copy.wbuf = NULL;
-        copy.wbuf_cap = 0;
-        copy.wbuf_len = 0;
-        copy.wbuf_file_off = 0;
-        fd_table[i] = copy;  /* preserve parent slot untouched; child needs its own slot */
-        /* Actually we need a NEW slot for the child at the same fd number. */
-        /* Restore parent slot first, then copy to the same index — this only
-         * works if we treat fd as process-local.  Since the table is global,
-         * we reuse the same index but tag it with child_pid when fd_close_all
-         * is called per-pid.  The parent's slot stays as-is (pid=parent_pid).
-         * We need a second slot at the same fd number for the child — not
-         * possible with a global flat table.
-         *
-         * Practical compromise: share the slot but update pid to child_pid
-         * only for FDs 0,1,2 (stdio).  All other FDs get fresh duplicates
-         * in new slots. */
-        fd_table[i] = fd_table[i]; /* restore */
-        fd_table[i].pid = parent_pid; /* keep parent ownership */
-        if (i < 3) {
-            /* stdio is shared read-only — no separate slot needed.
-             * Just mark child as a co-owner by leaving pid as parent for now;
-             * child's fd_close_all skips these slots. */
-        } else {
-            int nfd = find_free_fd_from(3);
+    }
+    *ct.ready = 1;
+    spinlock_unlock(&fd_lock);
+}
+
+/* fcntl() — descriptor/open-file flags and pipe sizing. */
+int fd_fcntl(int fd, int cmd, long arg) {
+    fd_init();
+
+    open_file_t *f = fd_file(fd);
+    if (!f) return -EBADF;
+
+    switch (cmd) {
+        case F_DUPFD: {
+            if (arg < 0 || arg >= PROCESS_MAX_FDS) return -EINVAL;
+            fd_tbl_t t;
+            fd_cur_tbl(&t);
+            spinlock_lock(&fd_lock);
+            int nfd = fd_slot_alloc(&t, (int)arg);
             if (nfd >= 0) {
-                fd_table[nfd] = copy;
-                fd_table[nfd].pid = child_pid;
+                of_get(f);
+                t.slot[nfd] = f;
             }
+            spinlock_unlock(&fd_lock);
+            return (nfd >= 0) ? nfd : -EMFILE;
+        }
+
+        case F_GETFD:
+        case F_SETFD:
+            return 0;   /* no close-on-exec support yet */
+
+        case F_GETFL: {
+            int fl = O_RDONLY;
+            if ((f->flags & (FD_FLAG_READ | FD_FLAG_WRITE)) == (FD_FLAG_READ | FD_FLAG_WRITE)) fl = O_RDWR;
+            else if (f->flags & FD_FLAG_WRITE) fl = O_WRONLY;
+            if (f->flags & FD_FLAG_APPEND) fl |= O_APPEND;
+            if (f->flags & FD_FLAG_NONBLOCK) fl |= O_NONBLOCK;
+            return fl;
         }
+
+        case F_SETFL:
+            /* Only the status flags may change; the access mode is fixed at open. */
+            if (arg & O_NONBLOCK) f->flags |= FD_FLAG_NONBLOCK;
+            else f->flags &= ~FD_FLAG_NONBLOCK;
+            if (arg & O_APPEND) f->flags |= FD_FLAG_APPEND;
+            else f->flags &= ~FD_FLAG_APPEND;
+            return 0;
+
+        case F_GETPIPE_SZ:
+            if (f->type != FD_TYPE_PIPE || !f->pipe_buf) return -EBADF;
+            return (int)((pipe_buf_t*)f->pipe_buf)->cap;
+
+        case F_SETPIPE_SZ:
+            if (f->type != FD_TYPE_PIPE || !f->pipe_buf) return -EBADF;
+            if (arg <= 0) return -EINVAL;
+            return pipe_set_size((pipe_buf_t*)f->pipe_buf, (size_t)arg);
+
+        default:
+            return -EINVAL;
     }
 }
 
@@ -891,32 +1137,40 @@ int fd_pipe(int fds[2]) {
     fd_init();
 
     /* Allocate ring buffer */
-    pipe_buf_t *pb = (pipe_buf_t*)kmalloc(sizeof(pipe_buf_t));
+    pipe_buf_t *pb = pipe_alloc(PIPE_DEF_SIZE);
     if (!pb) return -1;
-    pb->read_pos     = 0;
-    pb->write_pos    = 0;
-    pb->count        = 0;
-    pb->write_end_open = 1;
 
-    int rfd = find_free_fd_from(0);
-    if (rfd < 0) { kfree(pb); return -1; }
-    fd_table[rfd].in_use    = 1;
-    fd_table[rfd].type      = FD_TYPE_PIPE;
-    fd_table[rfd].flags     = FD_FLAG_READ;
-    fd_table[rfd].pipe_buf  = pb;
-    fd_table[rfd].is_read_end = 1;
+    open_file_t *rf = of_alloc(FD_TYPE_PIPE, FD_FLAG_READ);
+    open_file_t *wf = of_alloc(FD_TYPE_PIPE, FD_FLAG_WRITE);
+    if (!rf || !wf) {
+        if (rf) kfree(rf);
+        if (wf) kfree(wf);
+        kfree(pb->buf);
+        kfree(pb);
+        return -1;
+    }
+    rf->pipe_buf = pb;
+    rf->is_read_end = 1;
+    wf->pipe_buf = pb;
+    wf->is_read_end = 0;
 
-    int wfd = find_free_fd_from(rfd + 1);
+    fd_tbl_t t;
+    fd_cur_tbl(&t);
+    spinlock_lock(&fd_lock);
+    int rfd = fd_slot_alloc(&t, 0);
+    int wfd = (rfd >= 0) ? fd_slot_alloc(&t, rfd + 1) : -1;
     if (wfd < 0) {
-        fd_table[rfd].in_use = 0;
+        if (rfd >= 0) fd_bit_clear(&t, rfd);
+        spinlock_unlock(&fd_lock);
+        kfree(rf);
+        kfree(wf);
+        kfree(pb->buf);
         kfree(pb);
         return -1;
     }
-    fd_table[wfd].in_use    = 1;
-    fd_table[wfd].type      = FD_TYPE_PIPE;
-    fd_table[wfd].flags     = FD_FLAG_WRITE;
-    fd_table[wfd].pipe_buf  = pb;
-    fd_table[wfd].is_read_end = 0;
+    t.slot[rfd] = rf;
+    t.slot[wfd] = wf;
+    spinlock_unlock(&fd_lock);
 
     fds[0] = rfd;
     fds[1] = wfd;
@@ -926,86 +1180,134 @@ int fd_pipe(int fds[2]) {
 /* Close all FDs for a process */
 void fd_close_all(int pid) {
     fd_init();
-    
-    if (pid == 0) {
-        process_t* proc = process_get_current();
-        if (proc) pid = proc->pid;
-    }
 
-    /* Close from 0 — fd 0/1/2 may now be owned by this process */
-    for (int i = 0; i < MAX_FDS; i++) {
-        if (fd_table[i].in_use && fd_table[i].pid == pid) {
-            fd_close(i);
+    process_t *p = (pid == 0) ? process_get_current() : process_find((uint32_t)pid);
+    if (!p && pid != 0) return;
+
+    fd_tbl_t t;
+    fd_tbl_of(p, &t);
+    for (int w = 0; w < FD_BITMAP_WORDS; w++) {
+        uint64_t bits = t.used[w];
+        while (bits) {
+            int fd = (w << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            (void)fd_tbl_close(&t, fd);
         }
     }
 }
 
+/* Install `f` at slot fd of process pid, taking a new reference.
+ * Refuses occupied slots. Used by process_inject_fd(). */
+int fd_install_at(uint32_t pid, int fd, open_file_t *f) {
+    fd_init();
+
+    if (!f || fd < 0 || fd >= PROCESS_MAX_FDS) return -1;
+    process_t *p = process_find(pid);
+    if (!p) return -1;
+
+    fd_tbl_t t;
+    fd_tbl_of(p, &t);
+    spinlock_lock(&fd_lock);
+    fd_tbl_prepare(&t);
+    if (fd_bit_test(&t, fd)) {
+        spinlock_unlock(&fd_lock);
+        return -2;
+    }
+    of_get(f);
+    t.slot[fd] = f;
+    fd_bit_set(&t, fd);
+    spinlock_unlock(&fd_lock);
+    return 0;
+}
+
+/* Close slot fd of process pid. */
+int fd_close_in(uint32_t pid, int fd) {
+    fd_init();
+
+    process_t *p = process_find(pid);
+    if (!p) return -1;
+
+    fd_tbl_t t;
+    fd_tbl_of(p, &t);
+    return fd_tbl_close(&t, fd);
+}
+
+/* Referenced lookup of fd in process pid (0 = current). Release with fd_file_put(). */
+open_file_t *fd_file_get(uint32_t pid, int fd) {
+    fd_init();
+
+    if (fd < 0 || fd >= PROCESS_MAX_FDS) return NULL;
+    process_t *p = (pid == 0) ? process_get_current() : process_find(pid);
+    if (!p && pid != 0) return NULL;
+
+    fd_tbl_t t;
+    fd_tbl_of(p, &t);
+    spinlock_lock(&fd_lock);
+    fd_tbl_prepare(&t);
+    open_file_t *f = fd_bit_test(&t, fd) ? t.slot[fd] : NULL;
+    if (f) of_get(f);
+    spinlock_unlock(&fd_lock);
+    return f;
+}
+
+void fd_file_put(open_file_t *f) {
+    of_put(f);
+}
+
 /* Get current position */
 off_t fd_tell(int fd) {
     fd_init();
-    
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
+
+    open_file_t *f = fd_file(fd);
+    if (!f) {
         return -1;
     }
-    
-    return fd_table[fd].position;
+
+    return f->position;
 }
 
 /* --- DIRECTORY OPERATIONS --- */
 
 int fd_opendir(int mount_slot, const char* path) {
     fd_init();
-    
+
     if (!path || mount_slot < 0) {
         return -1;
     }
-    
+
     /* Get mount */
     fs_mount_t* mount = fs_get_mount(mount_slot);
     if (!mount || !mount->valid) {
         return -1;
     }
-    
+
     /* Open directory using filesystem layer */
     fs_dir_t* dir = fs_opendir(mount, path);
     if (!dir) {
         return -1;
     }
-    
-    /* Find free FD slot */
-    int fd = -1;
-    for (int i = 3; i < MAX_FDS; i++) {
-        if (!fd_table[i].in_use) {
-            fd = i;
-            break;
-        }
+
+    open_file_t *f = of_alloc(FD_TYPE_DIR, FD_FLAG_READ);
+    if (!f) {
+        fs_closedir(dir);
+        return -1;
     }
-    
+    f->mount_slot = mount_slot;
+    strncpy(f->path, path, sizeof(f->path) - 1);
+    f->is_directory = 1;
+    f->dir_handle = dir;
+
+    /* Directory descriptors never take the stdio numbers */
+    int fd = fd_install_new(f, 3);
     if (fd < 0) {
-        fs_closedir(dir);
+        of_put(f);
         return -1;
     }
-    
-    /* Get current process PID */
-    process_t* proc = process_get_current();
-    int pid = proc ? proc->pid : 0;
-    
-    /* Set up FD entry */
-    fd_table[fd].in_use = 1;
-    fd_table[fd].mount_slot = mount_slot;
-    strncpy(fd_table[fd].path, path, sizeof(fd_table[fd].path) - 1);
-    fd_table[fd].path[sizeof(fd_table[fd].path) - 1] = '\0';
-    fd_table[fd].position = 0;
-    fd_table[fd].file_size = 0;
-    fd_table[fd].flags = FD_FLAG_READ;
-    fd_table[fd].pid = pid;
-    fd_table[fd].cached_data = NULL;
-    fd_table[fd].is_directory = 1;
-    fd_table[fd].dir_handle = dir;
-    
+
     return fd;
 }
 
+
 typedef struct {
     int kind;   /* 0=$/, 1=$/mnt, 2=$/dev, 3=$/user */
     int index;  /* current index */
@@ -1032,12 +1334,27 @@ static void devvfs_sanitize(const char *in, char *out, size_t out_sz) {
     out[j] = 0;
 }
 
+static int fd_devvfs_install(devvfs_dir_t *h) {
+    open_file_t *f = of_alloc(FD_TYPE_DIR, FD_FLAG_READ);
+    if (!f) {
+        kfree(h);
+        return -1;
+    }
+    f->is_directory = 1;
+    f->is_devvfs = 1;
+    f->dir_handle = h;
+
+    int fd = fd_install_new(f, 0);
+    if (fd < 0) {
+        of_put(f);
+        return -1;
+    }
+    return fd;
+}
+
 int fd_devvfs_opendir_dev(const char *dev_subdir) {
     fd_init();
 
-    int fd = find_free_fd();
-    if (fd < 0) return -1;
-
     devvfs_dir_t *h = (devvfs_dir_t*)kmalloc(sizeof(devvfs_dir_t));
     if (!h) return -1;
     memset(h, 0, sizeof(*h));
@@ -1049,22 +1366,7 @@ int fd_devvfs_opendir_dev(const char *dev_subdir) {
         h->dev_path[sizeof(h->dev_path) - 1] = 0;
     }
 
-    process_t* proc = process_get_current();
-    int pid = proc ? proc->pid : 0;
-
-    fd_table[fd].in_use = 1;
-    fd_table[fd].mount_slot = -1;
-    fd_table[fd].path[0] = '\0';
-    fd_table[fd].position = 0;
-    fd_table[fd].file_size = 0;
-    fd_table[fd].flags = FD_FLAG_READ;
-    fd_table[fd].pid = pid;
-    fd_table[fd].cached_data = NULL;
-    fd_table[fd].is_directory = 1;
-    fd_table[fd].is_devvfs = 1;
-    fd_table[fd].dir_handle = h;
-
-    return fd;
+    return fd_devvfs_install(h);
 }
 
 int fd_devvfs_opendir(int kind) {
@@ -1072,44 +1374,26 @@ int fd_devvfs_opendir(int kind) {
 
     if (kind != 0 && kind != 1 && kind != 3) return -1;
 
-    int fd = find_free_fd();
-    if (fd < 0) return -1;
-
     devvfs_dir_t *h = (devvfs_dir_t*)kmalloc(sizeof(devvfs_dir_t));
     if (!h) return -1;
     memset(h, 0, sizeof(*h));
     h->kind = kind;
-    if (kind == 0) h->index = 0;
-    else h->index = 0;
+    h->index = 0;
     h->cookie = 0;
     h->dev_path[0] = 0;
 
-    process_t* proc = process_get_current();
-    int pid = proc ? proc->pid : 0;
-
-    fd_table[fd].in_use = 1;
-    fd_table[fd].mount_slot = -1;
-    fd_table[fd].path[0] = '\0';
-    fd_table[fd].position = 0;
-    fd_table[fd].file_size = 0;
-    fd_table[fd].flags = FD_FLAG_READ;
-    fd_table[fd].pid = pid;
-    fd_table[fd].cached_data = NULL;
-    fd_table[fd].is_directory = 1;
-    fd_table[fd].is_devvfs = 1;
-    fd_table[fd].dir_handle = h;
-
-    return fd;
+    return fd_devvfs_install(h);
 }
 
 int fd_readdir(int fd, char* name_buf, size_t buf_size, int* is_dir, uint32_t* size) {
     fd_init();
 
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
+    open_file_t *f = fd_file(fd);
+    if (!f) {
         return -1;
     }
 
-    if (!fd_table[fd].is_directory || !fd_table[fd].dir_handle) {
+    if (!f->is_directory || !f->dir_handle) {
         return -1;
     }
 
@@ -1117,8 +1401,9 @@ int fd_readdir(int fd, char* name_buf, size_t buf_size, int* is_dir, uint32_t* s
         return -1;
     }
 
-    if (fd_table[fd].is_devvfs) {
-        devvfs_dir_t *h = (devvfs_dir_t*)fd_table[fd].dir_handle;
+    if (f->is_devvfs) {
+        devvfs_dir_t *h = (devvfs_dir_t*)f->dir_handle;
+
 
         if (h->kind == 0) {
             // $/: DEVVFS root
@@ -1220,7 +1505,7 @@ int fd_readdir(int fd, char* name_buf, size_t buf_size, int* is_dir, uint32_t* s
         return 0;
     }
 
-    fs_dir_t* dir = (fs_dir_t*)fd_table[fd].dir_handle;
+    fs_dir_t* dir = (fs_dir_t*)f->dir_handle;
     fs_dirent_t entry;
 
     int result = fs_readdir(dir, &entry);
@@ -1240,33 +1525,18 @@ int fd_readdir(int fd, char* name_buf, size_t buf_size, int* is_dir, uint32_t* s
         *size = entry.size;
     }
 
-    fd_table[fd].position++;
+    f->position++;
     return 1; /* Successfully read entry */
 }
 
 int fd_closedir(int fd) {
     fd_init();
-    
-    if (fd < 0 || fd >= MAX_FDS || !fd_table[fd].in_use) {
-        return -1;
-    }
-    
-    if (!fd_table[fd].is_directory) {
-        return -1;
-    }
 
-    if (fd_table[fd].dir_handle) {
-        if (fd_table[fd].is_devvfs) {
-            kfree(fd_table[fd].dir_handle);
-        } else {
-            fs_closedir((fs_dir_t*)fd_table[fd].dir_handle);
-        }
-        fd_table[fd].dir_handle = NULL;
+    open_file_t *f = fd_file(fd);
+    if (!f || !f->is_directory) {
+        return -1;
     }
 
-    fd_table[fd].in_use = 0;
-    fd_table[fd].is_directory = 0;
-    fd_table[fd].is_devvfs = 0;
-
-    return 0;
+    /* The directory handle is released with the last reference. */
+    return fd_close(fd);
 }
@@ -7,6 +7,8 @@
 #include "moduos/kernel/spinlock.h"
 #include "moduos/kernel/errno.h"
 #include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/fs/pcache.h"
 #include "moduos/arch/AMD64/interrupts/timer.h"
 
 // External FS driver registry (third-party)
@@ -603,6 +605,8 @@ int fs_unmount_slot(int slot) {
     }
     
     fs_mount_t* mount = &mount_table[slot].mount;
+
+    pcache_invalidate(mount, NULL);
     
     switch (mount->type) {
         case FS_TYPE_FAT32:
@@ -811,11 +815,32 @@ int fs_read_file(fs_mount_t* mount, const char* path, void* buffer,
     return result;
 }
 
-int fs_write_file(fs_mount_t* mount, const char* path, const void* buffer, size_t size) {
-    return fs_write_file_at(mount, path, buffer, size, 0);
+/* Drivers without read_at: slurp the file once and hand back the requested slice. */
+static int fs_ext_read_at_fallback(fs_mount_t* mount, const char* path, uint64_t offset,
+                                   void* buffer, size_t size, size_t* out) {
+    fs_file_info_t info;
+    if (!mount->ext_ops->read_file || !mount->ext_ops->stat) return -4;
+    if (mount->ext_ops->stat(mount, path, &info) != 0) return -2;
+    if (info.is_directory) return -5;
+    if (offset >= info.size || size == 0) return 0;
+
+    uint8_t *tmp = (uint8_t*)kmalloc(info.size);
+    if (!tmp) return -6;
+    size_t got = 0;
+    int rc = mount->ext_ops->read_file(mount, path, tmp, info.size, &got);
+    if (rc == 0 && offset < got) {
+        size_t n = got - (size_t)offset;
+        if (n > size) n = size;
+        memcpy(buffer, tmp + offset, n);
+        *out = n;
+    }
+    kfree(tmp);
+    return rc;
 }
 
-int fs_write_file_at(fs_mount_t* mount, const char* path, const void* buffer, size_t size, size_t offset) {
+int fs_read_file_at(fs_mount_t* mount, const char* path, const fs_file_info_t* info,
+                    uint64_t offset, void* buffer, size_t size, size_t* bytes_read) {
+    if (bytes_read) *bytes_read = 0;
     if (!mount || !mount->valid || !path || (!buffer && size != 0)) {
         return -1;
     }
@@ -823,33 +848,100 @@ int fs_write_file_at(fs_mount_t* mount, const char* path, const void* buffer, si
     uint64_t t0 = 0;
     if (g_fs_trace) t0 = get_system_ticks();
 
-    /* External FS drivers currently only expose whole-file overwrite (no offset writes). */
+    int result;
+    size_t got = 0;
+
     if (mount->type == FS_TYPE_EXTERNAL) {
-        if (offset != 0) return -10;
-        if (mount->ext_ops && mount->ext_ops->write_file) {
-            return mount->ext_ops->write_file(mount, path, buffer, size);
+        if (!mount->ext_ops) return -4;
+        if (mount->ext_ops->read_at) {
+            result = mount->ext_ops->read_at(mount, path, offset, buffer, size, &got);
+        } else {
+            result = fs_ext_read_at_fallback(mount, path, offset, buffer, size, &got);
         }
-        return -4;
+    } else {
+        switch (mount->type) {
+            case FS_TYPE_FAT32:
+                if (info) result = fat32_read_at(mount->handle, info->cluster, info->size, offset, buffer, size, &got);
+                else result = fat32_read_file_at_by_path(mount->handle, path, offset, buffer, size, &got);
+                break;
+
+            case FS_TYPE_ISO9660:
+                if (info) result = iso9660_read_at(mount->handle, info->cluster, info->size, offset, buffer, size, &got);
+                else result = iso9660_read_file_at_by_path(mount->handle, path, offset, buffer, size, &got);
+                break;
+
+            case FS_TYPE_MDFS:
+                result = mdfs_read_file_at_by_path(mount->handle, path, offset, buffer, size, &got);
+                break;
+
+            default:
+                return -3;
+        }
+    }
+
+    if (bytes_read) *bytes_read = got;
+
+    if (g_fs_trace) {
+        uint64_t dt = get_system_ticks() - t0;
+        com_printf(COM1_PORT, "[FS-TRACE] read_at %s off=%u bytes=%u rc=%d dticks=%u time=%ums\n",
+                   path,
+                   (unsigned)offset,
+                   (unsigned)got,
+                   result,
+                   (unsigned)dt,
+                   (unsigned)ticks_to_ms(dt));
     }
 
+    return result;
+}
+
+/* whole != 0: replace the file with `buffer` (fs_write_file); otherwise write
+ * `size` bytes at `offset` and leave the rest of the file alone. */
+static int fs_write_common(fs_mount_t* mount, const char* path, const void* buffer, size_t size,
+                           size_t offset, int whole) {
+    if (!mount || !mount->valid || !path || (!buffer && size != 0)) {
+        return -1;
+    }
+
+    uint64_t t0 = 0;
+    if (g_fs_trace) t0 = get_system_ticks();
+
     int rc;
-    switch (mount->type) {
-        case FS_TYPE_FAT32:
-            /* FAT32 write path is whole-file overwrite only for now. */
-            if (offset != 0) rc = -10;
-            else rc = fat32_write_file_by_path(mount->handle, path, buffer, size);
-            break;
-        case FS_TYPE_ISO9660:
-            rc = -EROFS; // read-only
-            break;
-        case FS_TYPE_MDFS:
-            rc = mdfs_write_file_at_by_path(mount->handle, path, buffer, size, offset);
-            break;
-        default:
-            rc = -3;
-            break;
+    if (mount->type == FS_TYPE_EXTERNAL) {
+        /* write_at is optional; without it only whole-file replacement works. */
+        if (!mount->ext_ops) {
+            rc = -4;
+        } else if (!whole && mount->ext_ops->write_at) {
+            rc = mount->ext_ops->write_at(mount, path, (uint64_t)offset, buffer, size);
+        } else if (!whole && offset != 0) {
+            rc = -10;
+        } else if (mount->ext_ops->write_file) {
+            rc = mount->ext_ops->write_file(mount, path, buffer, size);
+        } else {
+            rc = -4;
+        }
+    } else {
+        switch (mount->type) {
+            case FS_TYPE_FAT32:
+                if (whole) rc = fat32_write_file_by_path(mount->handle, path, buffer, size);
+                else rc = fat32_write_file_at_by_path(mount->handle, path, buffer, size, (uint64_t)offset);
+                break;
+            case FS_TYPE_ISO9660:
+                rc = -EROFS; // read-only
+                break;
+            case FS_TYPE_MDFS:
+                if (whole) rc = mdfs_write_file_by_path(mount->handle, path, buffer, size);
+                else rc = mdfs_write_file_at_by_path(mount->handle, path, buffer, size, (uint64_t)offset);
+                break;
+            default:
+                rc = -3;
+                break;
+        }
     }
 
+    /* Pages cached before the write (and, on FAT32, the old cluster chain) are stale. */
+    pcache_invalidate(mount, path);
+
     if (g_fs_trace) {
         uint64_t t1 = get_system_ticks();
         uint64_t dt = t1 - t0;
@@ -868,6 +960,14 @@ int fs_write_file_at(fs_mount_t* mount, const char* path, const void* buffer, si
     return rc;
 }
 
+int fs_write_file(fs_mount_t* mount, const char* path, const void* buffer, size_t size) {
+    return fs_write_common(mount, path, buffer, size, 0, 1);
+}
+
+int fs_write_file_at(fs_mount_t* mount, const char* path, const void* buffer, size_t size, size_t offset) {
+    return fs_write_common(mount, path, buffer, size, offset, 0);
+}
+
 int fs_stat(fs_mount_t* mount, const char* path, fs_file_info_t* info) {
     if (!mount || !mount->valid || !path || !info) {
         return -1;
@@ -1068,6 +1168,8 @@ int fs_rmdir(fs_mount_t* mount, const char* path) {
 int fs_unlink(fs_mount_t* mount, const char* path) {
     if (!mount || !mount->valid || !path) return -1;
 
+    pcache_invalidate(mount, path);
+
     if (mount->type == FS_TYPE_EXTERNAL) {
         if (mount->ext_ops && mount->ext_ops->unlink) {
             return mount->ext_ops->unlink(mount, path);
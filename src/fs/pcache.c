@@ -0,0 +1,390 @@
+#include "moduos/fs/pcache.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/loader/exec_image.h"
+
+/* Fixed pool of pages shared by all files, replaced with the CLOCK algorithm.
+ * Lookup is a hash on (file slot, page index). One lock covers the whole cache and
+ * is held across fills, the same way the vDrive block cache holds its lock across
+ * device I/O; lock order is pcache -> FS driver -> vDrive.
+ */
+
+#define PCACHE_MAX_PAGES     (PCACHE_BYTES / PCACHE_PAGE_SIZE)
+#define PCACHE_HASH_BUCKETS  1024u
+#define PCACHE_NONE          (-1)
+
+typedef struct {
+    int16_t  file;        /* owning g_files[] slot, PCACHE_NONE when free */
+    uint8_t  referenced;  /* CLOCK second-chance bit */
+    uint8_t  _pad;
+    int32_t  hnext;       /* next page in the hash bucket */
+    uint64_t index;       /* page number within the file */
+} pcache_page_t;
+
+struct pcache_file {
+    int in_use;
+    uint32_t refcnt;
+    fs_mount_t *mount;
+    char path[256];
+    fs_file_info_t info;  /* location/size the cached pages belong to */
+    int stale;            /* re-stat before the next read */
+    uint32_t resident;    /* pages currently cached */
+    uint64_t next_page;   /* page after the last read, for sequential detection */
+    uint32_t ra_pages;    /* current read-ahead window */
+    uint64_t last_use;
+};
+
+static spinlock_t g_lock;
+static int g_inited = 0;
+static uint8_t *g_data;
+static uint8_t *g_bounce;
+static uint32_t g_npages;
+static uint32_t g_hand;
+static uint64_t g_use_counter = 1;
+static pcache_page_t g_pages[PCACHE_MAX_PAGES];
+static int32_t g_hash[PCACHE_HASH_BUCKETS];
+static struct pcache_file g_files[PCACHE_MAX_FILES];
+static pcache_stats_t g_stats;
+
+static inline uint32_t pcache_bucket(int file, uint64_t index) {
+    uint64_t h = index * 0x9E3779B97F4A7C15ULL ^ (uint64_t)file * 0xC2B2AE3D27D4EB4FULL;
+    return (uint32_t)(h >> 32) & (PCACHE_HASH_BUCKETS - 1);
+}
+
+static inline uint8_t *pcache_page_data(int32_t slot) {
+    return g_data + (size_t)slot * PCACHE_PAGE_SIZE;
+}
+
+static inline int pcache_file_slot(const pcache_file_t *f) {
+    return (int)(f - g_files);
+}
+
+/* Caller holds g_lock. */
+static int pcache_init_locked(void) {
+    if (g_inited) return 0;
+
+    uint32_t bytes = PCACHE_BYTES;
+    while (!g_data && bytes >= PCACHE_MIN_BYTES) {
+        g_data = (uint8_t*)kmalloc(bytes);
+        if (!g_data) bytes /= 2;
+    }
+    g_bounce = (uint8_t*)kmalloc(PCACHE_RA_MAX_PAGES * PCACHE_PAGE_SIZE);
+    if (!g_data || !g_bounce) {
+        if (g_data) kfree(g_data);
+        if (g_bounce) kfree(g_bounce);
+        g_data = NULL;
+        g_bounce = NULL;
+        return -1;
+    }
+
+    g_npages = bytes / PCACHE_PAGE_SIZE;
+    for (uint32_t i = 0; i < PCACHE_MAX_PAGES; i++) {
+        g_pages[i].file = PCACHE_NONE;
+        g_pages[i].referenced = 0;
+        g_pages[i].hnext = PCACHE_NONE;
+    }
+    for (uint32_t i = 0; i < PCACHE_HASH_BUCKETS; i++) g_hash[i] = PCACHE_NONE;
+    memset(g_files, 0, sizeof(g_files));
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.pages = g_npages;
+    g_hand = 0;
+    g_inited = 1;
+
+    com_printf(COM1_PORT, "[PCACHE] %u pages (%u KiB)\n", g_npages, bytes / 1024u);
+    return 0;
+}
+
+static int32_t pcache_lookup(int file, uint64_t index) {
+    for (int32_t s = g_hash[pcache_bucket(file, index)]; s != PCACHE_NONE; s = g_pages[s].hnext) {
+        if (g_pages[s].file == file && g_pages[s].index == index) return s;
+    }
+    return PCACHE_NONE;
+}
+
+static void pcache_unhash(int32_t slot) {
+    pcache_page_t *p = &g_pages[slot];
+    int32_t *link = &g_hash[pcache_bucket(p->file, p->index)];
+    while (*link != PCACHE_NONE) {
+        if (*link == slot) {
+            *link = p->hnext;
+            break;
+        }
+        link = &g_pages[*link].hnext;
+    }
+    g_files[p->file].resident--;
+    g_stats.pages_used--;
+    p->file = PCACHE_NONE;
+    p->hnext = PCACHE_NONE;
+    p->referenced = 0;
+}
+
+static void pcache_drop_file_pages(int file) {
+    if (g_files[file].resident == 0) return;
+    for (uint32_t i = 0; i < g_npages && g_files[file].resident; i++) {
+        if (g_pages[i].file == file) pcache_unhash((int32_t)i);
+    }
+}
+
+/* CLOCK: free pages are taken immediately, referenced pages get a second chance. */
+static int32_t pcache_victim(void) {
+    for (uint32_t scanned = 0; scanned < 2 * g_npages; scanned++) {
+        int32_t s = (int32_t)g_hand;
+        g_hand = (g_hand + 1) % g_npages;
+        pcache_page_t *p = &g_pages[s];
+        if (p->file == PCACHE_NONE) return s;
+        if (p->referenced) {
+            p->referenced = 0;
+            continue;
+        }
+        pcache_unhash(s);
+        g_stats.evictions++;
+        return s;
+    }
+    return PCACHE_NONE;
+}
+
+static void pcache_insert(int32_t slot, int file, uint64_t index, int referenced) {
+    pcache_page_t *p = &g_pages[slot];
+    uint32_t b = pcache_bucket(file, index);
+    p->file = (int16_t)file;
+    p->index = index;
+    p->referenced = referenced ? 1 : 0;
+    p->hnext = g_hash[b];
+    g_hash[b] = slot;
+    g_files[file].resident++;
+    g_stats.pages_used++;
+}
+
+static int pcache_same_file(const fs_file_info_t *a, const fs_file_info_t *b) {
+    return a->size == b->size && a->cluster == b->cluster && a->is_directory == b->is_directory;
+}
+
+/* Re-stat a file whose pages were invalidated. Caller holds g_lock. */
+static int pcache_refresh(pcache_file_t *f) {
+    fs_file_info_t info;
+    if (fs_stat(f->mount, f->path, &info) != 0 || info.is_directory) return -2;
+    if (!pcache_same_file(&info, &f->info)) pcache_drop_file_pages(pcache_file_slot(f));
+    f->info = info;
+    f->stale = 0;
+    return 0;
+}
+
+/*
+ * Bring page `index` (plus read-ahead) into the cache and return its slot.
+ * The window doubles while the reader stays sequential and collapses back to
+ * PCACHE_RA_MIN_PAGES on a seek; it also stops at EOF and at the first page that
+ * is already resident.
+ */
+static int32_t pcache_fill(pcache_file_t *f, uint64_t index) {
+    int file = pcache_file_slot(f);
+
+    if (index == f->next_page) {
+        f->ra_pages = f->ra_pages ? f->ra_pages * 2 : PCACHE_RA_MIN_PAGES;
+        if (f->ra_pages > PCACHE_RA_MAX_PAGES) f->ra_pages = PCACHE_RA_MAX_PAGES;
+    } else {
+        f->ra_pages = PCACHE_RA_MIN_PAGES;
+    }
+
+    uint64_t last = ((uint64_t)f->info.size - 1) / PCACHE_PAGE_SIZE;
+    uint32_t n = f->ra_pages;
+    if ((uint64_t)n > last - index + 1) n = (uint32_t)(last - index + 1);
+    for (uint32_t k = 1; k < n; k++) {
+        if (pcache_lookup(file, index + k) != PCACHE_NONE) { n = k; break; }
+    }
+
+    size_t got = 0;
+    int rc = fs_read_file_at(f->mount, f->path, &f->info, index * PCACHE_PAGE_SIZE,
+                             g_bounce, (size_t)n * PCACHE_PAGE_SIZE, &got);
+    g_stats.fills++;
+    if (rc != 0) return PCACHE_NONE;
+
+    uint32_t pages = (uint32_t)((got + PCACHE_PAGE_SIZE - 1) / PCACHE_PAGE_SIZE);
+    if (pages == 0) return PCACHE_NONE;
+    if (got < (size_t)pages * PCACHE_PAGE_SIZE) {
+        memset(g_bounce + got, 0, (size_t)pages * PCACHE_PAGE_SIZE - got);
+    }
+
+    int32_t first = PCACHE_NONE;
+    for (uint32_t k = 0; k < pages; k++) {
+        int32_t s = pcache_victim();
+        if (s == PCACHE_NONE) break;
+        memcpy(pcache_page_data(s), g_bounce + (size_t)k * PCACHE_PAGE_SIZE, PCACHE_PAGE_SIZE);
+        pcache_insert(s, file, index + k, k == 0);
+        if (k == 0) first = s;
+        else g_stats.readahead++;
+    }
+    return first;
+}
+
+pcache_file_t *pcache_open(fs_mount_t *mount, const char *path, const fs_file_info_t *info) {
+    if (!mount || !path || !*path || !info) return NULL;
+
+    spinlock_lock(&g_lock);
+    if (pcache_init_locked() != 0) {
+        spinlock_unlock(&g_lock);
+        return NULL;
+    }
+
+    int free_slot = -1, lru = -1;
+    for (int i = 0; i < PCACHE_MAX_FILES; i++) {
+        pcache_file_t *f = &g_files[i];
+        if (!f->in_use) {
+            if (free_slot < 0) free_slot = i;
+            continue;
+        }
+        if (f->mount == mount && strcmp(f->path, path) == 0) {
+            if (!pcache_same_file(info, &f->info)) pcache_drop_file_pages(i);
+            f->info = *info;
+            f->stale = 0;
+            f->refcnt++;
+            f->last_use = g_use_counter++;
+            spinlock_unlock(&g_lock);
+            return f;
+        }
+        if (f->refcnt == 0 && (lru < 0 || f->last_use < g_files[lru].last_use)) lru = i;
+    }
+
+    /* Reuse the least recently used closed file if the table is full. */
+    int slot = free_slot;
+    if (slot < 0 && lru >= 0) {
+        pcache_drop_file_pages(lru);
+        slot = lru;
+    }
+    if (slot < 0) {
+        spinlock_unlock(&g_lock);
+        return NULL;
+    }
+
+    pcache_file_t *f = &g_files[slot];
+    memset(f, 0, sizeof(*f));
+    f->in_use = 1;
+    f->refcnt = 1;
+    f->mount = mount;
+    strncpy(f->path, path, sizeof(f->path) - 1);
+    f->path[sizeof(f->path) - 1] = 0;
+    f->info = *info;
+    f->next_page = (uint64_t)-1;
+    f->last_use = g_use_counter++;
+    spinlock_unlock(&g_lock);
+    return f;
+}
+
+void pcache_get(pcache_file_t *f) {
+    if (!f) return;
+    spinlock_lock(&g_lock);
+    f->refcnt++;
+    spinlock_unlock(&g_lock);
+}
+
+/* Pages stay resident after the last close so reopening a file is a hit;
+ * the slot is recycled by pcache_open() when the table fills up. */
+void pcache_put(pcache_file_t *f) {
+    if (!f) return;
+    spinlock_lock(&g_lock);
+    if (f->refcnt > 0) f->refcnt--;
+    f->last_use = g_use_counter++;
+    spinlock_unlock(&g_lock);
+}
+
+int pcache_read(pcache_file_t *f, uint64_t offset, void *buf, size_t len, size_t *out) {
+    if (out) *out = 0;
+    if (!f || (!buf && len != 0)) return -1;
+
+    spinlock_lock(&g_lock);
+    if (f->stale && pcache_refresh(f) != 0) {
+        spinlock_unlock(&g_lock);
+        return -2;
+    }
+
+    uint64_t size = f->info.size;
+    if (offset >= size || len == 0) {
+        spinlock_unlock(&g_lock);
+        return 0;
+    }
+    if ((uint64_t)len > size - offset) len = (size_t)(size - offset);
+
+    int file = pcache_file_slot(f);
+    uint8_t *dst = (uint8_t*)buf;
+    size_t done = 0;
+    int rc = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        uint64_t index = pos / PCACHE_PAGE_SIZE;
+        size_t in_page = (size_t)(pos % PCACHE_PAGE_SIZE);
+        size_t n = PCACHE_PAGE_SIZE - in_page;
+        if (n > len - done) n = len - done;
+
+        int32_t s = pcache_lookup(file, index);
+        if (s != PCACHE_NONE) {
+            g_pages[s].referenced = 1;
+            g_stats.hits++;
+        } else {
+            g_stats.misses++;
+            s = pcache_fill(f, index);
+            if (s == PCACHE_NONE) { rc = -3; break; }
+        }
+        memcpy(dst + done, pcache_page_data(s) + in_page, n);
+        done += n;
+        f->next_page = index + 1;
+    }
+    f->last_use = g_use_counter++;
+    spinlock_unlock(&g_lock);
+
+    if (out) *out = done;
+    return (done == 0) ? rc : 0;
+}
+
+uint64_t pcache_file_size(pcache_file_t *f) {
+    if (!f) return 0;
+    spinlock_lock(&g_lock);
+    if (f->stale) (void)pcache_refresh(f);
+    uint64_t size = f->info.size;
+    spinlock_unlock(&g_lock);
+    return size;
+}
+
+void pcache_invalidate(fs_mount_t *mount, const char *path) {
+    if (!mount) return;
+    spinlock_lock(&g_lock);
+    if (!g_inited) {
+        spinlock_unlock(&g_lock);
+        return;
+    }
+    for (int i = 0; i < PCACHE_MAX_FILES; i++) {
+        pcache_file_t *f = &g_files[i];
+        if (!f->in_use || f->mount != mount) continue;
+        if (path && strcmp(f->path, path) != 0) continue;
+        pcache_drop_file_pages(i);
+        f->stale = 1;
+        f->next_page = (uint64_t)-1;
+        g_stats.invalidations++;
+        /* Closed files have nothing left worth keeping; free the slot. */
+        if (f->refcnt == 0) f->in_use = 0;
+    }
+    spinlock_unlock(&g_lock);
+
+    /* After dropping g_lock: exec images nest pcache inside their own lock. */
+    exec_image_invalidate(mount, path);
+}
+
+void pcache_get_stats(pcache_stats_t *out) {
+    if (!out) return;
+    spinlock_lock(&g_lock);
+    *out = g_stats;
+    out->files = 0;
+    for (int i = 0; i < PCACHE_MAX_FILES; i++) {
+        if (g_files[i].in_use) out->files++;
+    }
+    spinlock_unlock(&g_lock);
+}
+
+void pcache_dump_stats(void) {
+    pcache_stats_t st;
+    pcache_get_stats(&st);
+    com_printf(COM1_PORT, "[PCACHE] pages=%u used=%u files=%u\n", st.pages, st.pages_used, st.files);
+    com_printf(COM1_PORT, "[PCACHE]   hits=%u misses=%u fills=%u readahead=%u evictions=%u invalidations=%u\n",
+               (uint32_t)st.hits, (uint32_t)st.misses, (uint32_t)st.fills,
+               (uint32_t)st.readahead, (uint32_t)st.evictions, (uint32_t)st.invalidations);
+}
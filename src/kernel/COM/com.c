@@ -1,4 +1,5 @@
 #include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/COM/klog.h"
 #include "moduos/kernel/io/io.h"
 #include <stddef.h>
 
@@ -152,44 +153,48 @@ int com_is_initialized(uint16_t port) {
     return com_port_initialized[port_idx];
 }
 
-int com_write_byte(uint16_t port, uint8_t data) {
+int com_write_direct(uint16_t port, const uint8_t* data, uint32_t len) {
+    if (data == NULL) return -1;
+
     int port_idx = get_port_index(port);
-    
+
     /* If port not initialized, try early init */
     if (port_idx >= 0 && !com_port_initialized[port_idx]) {
         com_early_init(port);
     }
-    
-    if (wait_tx_ready(port) != 0) {
-        return -1; /* Timeout */
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (wait_tx_ready(port) != 0) {
+            return i; /* Timeout: number of bytes written before it */
+        }
+        outb(port + COM_DATA_REG, data[i]);
     }
-    outb(port + COM_DATA_REG, data);
-    return 0;
+    return len;
+}
+
+/* COM1 output goes to the kernel log ring once it is running (klog.h). */
+static int com_out(uint16_t port, const uint8_t* data, uint32_t len) {
+    if (port == COM1_PORT && klog_emit((const char *)data, len) == 0) {
+        return len;
+    }
+    return com_write_direct(port, data, len);
+}
+
+int com_write_byte(uint16_t port, uint8_t data) {
+    return com_out(port, &data, 1) == 1 ? 0 : -1;
 }
 
 int com_write_string(uint16_t port, const char* str) {
     if (str == NULL) return -1;
-    
-    int count = 0;
-    while (*str) {
-        if (com_write_byte(port, *str) != 0) {
-            return -1;
-        }
-        str++;
-        count++;
-    }
-    return count;
+
+    uint32_t len = 0;
+    while (str[len]) len++;
+    return com_out(port, (const uint8_t *)str, len) == (int)len ? (int)len : -1;
 }
 
 int com_write(uint16_t port, const uint8_t* data, uint32_t len) {
     if (data == NULL) return -1;
-    
-    for (uint32_t i = 0; i < len; i++) {
-        if (com_write_byte(port, data[i]) != 0) {
-            return i; /* Return number of bytes written before failure */
-        }
-    }
-    return len;
+    return com_out(port, data, len);
 }
 
 
@@ -339,208 +344,198 @@ int com_test(uint16_t port) {
 
 int com_write_hex(uint16_t port, uint8_t value) {
     const char hex_chars[] = "0123456789ABCDEF";
-    char hex_str[2];
+    uint8_t hex_str[2];
 
     hex_str[0] = hex_chars[(value >> 4) & 0x0F];  // High nibble
     hex_str[1] = hex_chars[value & 0x0F];         // Low nibble
 
-    for (int i = 0; i < 2; i++) {
-        if (com_write_byte(port, hex_str[i]) != 0) {
-            return -1;  // Failed to write
-        }
-    }
-
-    return 2;  // Two characters written
+    return com_out(port, hex_str, 2) == 2 ? 2 : -1;
 }
 
 int com_write_hex64(uint16_t port, uint64_t value) {
     // Print as 16 hex chars, high nibble first.
     const char hex_chars[] = "0123456789ABCDEF";
+    uint8_t hex_str[16];
     for (int i = 15; i >= 0; i--) {
-        uint8_t nib = (uint8_t)((value >> (i * 4)) & 0x0Fu);
-        if (com_write_byte(port, hex_chars[nib]) != 0) return -1;
+        hex_str[15 - i] = hex_chars[(value >> (i * 4)) & 0x0Fu];
     }
-    return 16;
+    return com_out(port, hex_str, 16) == 16 ? 16 : -1;
 }
 
-/* Helper function to convert integer to string */
-static int int_to_string(int value, char *buf, int base) {
-    if (base < 2 || base > 16) return 0;
-    
-    int i = 0;
-    int is_negative = 0;
-    
-    if (value < 0 && base == 10) {
-        is_negative = 1;
-        value = -value;
-    }
-    
-    if (value == 0) {
-        buf[i++] = '0';
-        buf[i] = '\0';
-        return i;
-    }
-    
-    char temp[32];
-    int temp_i = 0;
-    
-    while (value != 0) {
-        int rem = value % base;
-        temp[temp_i++] = (rem > 9) ? (rem - 10) + 'a' : rem + '0';
-        value = value / base;
-    }
-    
-    if (is_negative) {
-        buf[i++] = '-';
-    }
-    
-    while (temp_i > 0) {
-        buf[i++] = temp[--temp_i];
+/* Formatter shared by com_printf() and com_vsnprintf(). Output goes either
+ * to a port, staged in buf and flushed in chunks, or into a caller's buffer
+ * (port == 0), truncated but still counted. */
+typedef struct {
+    uint16_t port;
+    char *buf;
+    uint32_t size;
+    uint32_t len;
+    int count;
+} com_fmt_t;
+
+static void fmt_flush(com_fmt_t *f) {
+    if (f->port && f->len) {
+        com_out(f->port, (const uint8_t *)f->buf, f->len);
+        f->len = 0;
     }
-    
-    buf[i] = '\0';
-    return i;
 }
 
-/* Helper function to convert unsigned integer to string */
-static int uint_to_string(unsigned int value, char *buf, int base) {
-    if (base < 2 || base > 16) return 0;
-    
-    int i = 0;
-    
-    if (value == 0) {
-        buf[i++] = '0';
-        buf[i] = '\0';
-        return i;
-    }
-    
-    char temp[32];
-    int temp_i = 0;
-    
-    while (value != 0) {
-        int rem = value % base;
-        temp[temp_i++] = (rem > 9) ? (rem - 10) + 'a' : rem + '0';
-        value = value / base;
+static void fmt_put(com_fmt_t *f, const char *s, uint32_t n) {
+    f->count += (int)n;
+    while (n) {
+        uint32_t room = f->size - f->len - (f->port ? 0 : 1);
+        if (room == 0) {
+            if (!f->port) return;
+            fmt_flush(f);
+            continue;
+        }
+        uint32_t k = n < room ? n : room;
+        for (uint32_t i = 0; i < k; i++) f->buf[f->len + i] = s[i];
+        f->len += k;
+        s += k;
+        n -= k;
     }
-    
-    while (temp_i > 0) {
-        buf[i++] = temp[--temp_i];
+}
+
+static void fmt_pad(com_fmt_t *f, char c, int n) {
+    while (n-- > 0) fmt_put(f, &c, 1);
+}
+
+static void fmt_field(com_fmt_t *f, const char *s, int len, int width, int left, char pad) {
+    /* Zero padding goes between the sign and the digits. */
+    if (pad == '0' && !left && len > 0 && s[0] == '-' && width > len) {
+        fmt_put(f, s, 1);
+        fmt_pad(f, '0', width - len);
+        fmt_put(f, s + 1, (uint32_t)len - 1);
+        return;
     }
-    
-    buf[i] = '\0';
+    if (!left) fmt_pad(f, pad, width - len);
+    fmt_put(f, s, (uint32_t)len);
+    if (left) fmt_pad(f, ' ', width - len);
+}
+
+static int fmt_number(char *out, unsigned long long v, int base, int upper, int negative) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    int n = 0, i = 0;
+    do {
+        tmp[n++] = digits[v % (unsigned)base];
+        v /= (unsigned)base;
+    } while (v);
+    if (negative) out[i++] = '-';
+    while (n) out[i++] = tmp[--n];
     return i;
 }
 
-int com_printf(uint16_t port, const char* format, ...) {
-    if (format == NULL) return -1;
-    
-    __builtin_va_list args;
-    __builtin_va_start(args, format);
-    
-    int count = 0;
-    char buffer[32];
-    
+static void com_format(com_fmt_t *f, const char *format, __builtin_va_list args) {
+    char num[24];
+
     while (*format) {
-        if (*format == '%' && *(format + 1)) {
+        if (*format != '%' || !format[1]) {
+            const char *run = format;
+            while (*format && !(*format == '%' && format[1])) format++;
+            fmt_put(f, run, (uint32_t)(format - run));
+            continue;
+        }
+
+        const char *spec = format++;
+        int left = 0;
+        char pad = ' ';
+        for (;; format++) {
+            if (*format == '-') left = 1;
+            else if (*format == '0') pad = '0';
+            else break;
+        }
+        int width = 0;
+        if (*format == '*') {
+            width = __builtin_va_arg(args, int);
             format++;
-            switch (*format) {
-                case 'd':
-                case 'i': {
-                    int val = __builtin_va_arg(args, int);
-                    int_to_string(val, buffer, 10);
-                    com_write_string(port, buffer);
-                    count += int_to_string(val, buffer, 10);
-                    break;
-                }
-                case 'u': {
-                    unsigned int val = __builtin_va_arg(args, unsigned int);
-                    uint_to_string(val, buffer, 10);
-                    com_write_string(port, buffer);
-                    count += uint_to_string(val, buffer, 10);
-                    break;
-                }
-                case 'x': {
-                    unsigned int val = __builtin_va_arg(args, unsigned int);
-                    uint_to_string(val, buffer, 16);
-                    com_write_string(port, buffer);
-                    count += uint_to_string(val, buffer, 16);
-                    break;
-                }
-                case 'X': {
-                    unsigned int val = __builtin_va_arg(args, unsigned int);
-                    int len = uint_to_string(val, buffer, 16);
-                    for (int i = 0; i < len; i++) {
-                        if (buffer[i] >= 'a' && buffer[i] <= 'f') {
-                            buffer[i] = buffer[i] - 'a' + 'A';
-                        }
-                    }
-                    com_write_string(port, buffer);
-                    count += len;
-                    break;
-                }
-                case 's': {
-                    char *str = __builtin_va_arg(args, char*);
-                    if (str) {
-                        int len = com_write_string(port, str);
-                        count += (len > 0) ? len : 0;
-                    } else {
-                        com_write_string(port, "(null)");
-                        count += 6;
-                    }
-                    break;
-                }
-                case 'c': {
-                    char ch = (char)__builtin_va_arg(args, int);
-                    com_write_byte(port, ch);
-                    count++;
-                    break;
-                }
-                case '%': {
-                    com_write_byte(port, '%');
-                    count++;
-                    break;
-                }
-                case '0': {
-                    // Handle format like %02x, %04x
-                    int width = 0;
-                    format++;
-                    while (*format >= '0' && *format <= '9') {
-                        width = width * 10 + (*format - '0');
-                        format++;
-                    }
-                    if (*format == 'x' || *format == 'X') {
-                        unsigned int val = __builtin_va_arg(args, unsigned int);
-                        int len = uint_to_string(val, buffer, 16);
-                        // Pad with zeros
-                        for (int i = len; i < width; i++) {
-                            com_write_byte(port, '0');
-                            count++;
-                        }
-                        if (*format == 'X') {
-                            for (int i = 0; i < len; i++) {
-                                if (buffer[i] >= 'a' && buffer[i] <= 'f') {
-                                    buffer[i] = buffer[i] - 'a' + 'A';
-                                }
-                            }
-                        }
-                        com_write_string(port, buffer);
-                        count += len;
-                    }
-                    break;
-                }
-                default:
-                    com_write_byte(port, '%');
-                    com_write_byte(port, *format);
-                    count += 2;
-                    break;
-            }
         } else {
-            com_write_byte(port, *format);
-            count++;
+            while (*format >= '0' && *format <= '9') width = width * 10 + (*format++ - '0');
+        }
+        int prec = -1;
+        if (*format == '.') {
+            format++;
+            prec = 0;
+            while (*format >= '0' && *format <= '9') prec = prec * 10 + (*format++ - '0');
+        }
+        int lng = 0;
+        while (*format == 'l' || *format == 'z' || *format == 'h') {
+            if (*format != 'h') lng++;
+            format++;
+        }
+
+        switch (*format) {
+            case 'd':
+            case 'i': {
+                long long v = lng ? __builtin_va_arg(args, long long) : __builtin_va_arg(args, int);
+                unsigned long long mag = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+                fmt_field(f, num, fmt_number(num, mag, 10, 0, v < 0), width, left, pad);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                unsigned long long v = lng ? __builtin_va_arg(args, unsigned long long)
+                                           : __builtin_va_arg(args, unsigned int);
+                int base = *format == 'u' ? 10 : 16;
+                fmt_field(f, num, fmt_number(num, v, base, *format == 'X', 0), width, left, pad);
+                break;
+            }
+            case 'p': {
+                uint64_t v = (uint64_t)(uintptr_t)__builtin_va_arg(args, void *);
+                fmt_put(f, "0x", 2);
+                fmt_field(f, num, fmt_number(num, v, 16, 0, 0), width, left, pad);
+                break;
+            }
+            case 's': {
+                const char *str = __builtin_va_arg(args, const char *);
+                if (!str) str = "(null)";
+                int len = 0;
+                while (str[len] && (prec < 0 || len < prec)) len++;
+                fmt_field(f, str, len, width, left, ' ');
+                break;
+            }
+            case 'c': {
+                char ch = (char)__builtin_va_arg(args, int);
+                fmt_field(f, &ch, 1, width, left, ' ');
+                break;
+            }
+            case '%':
+                fmt_put(f, "%", 1);
+                break;
+            default:
+                /* Unknown conversion: print it as written. */
+                fmt_put(f, spec, (uint32_t)(format - spec) + (*format ? 1 : 0));
+                if (!*format) return;
+                break;
         }
         format++;
     }
-    
+}
+
+int com_vsnprintf(char *buf, uint32_t size, const char *format, __builtin_va_list args) {
+    if (buf == NULL || size == 0 || format == NULL) return -1;
+
+    com_fmt_t f = { .port = 0, .buf = buf, .size = size, .len = 0, .count = 0 };
+    com_format(&f, format, args);
+    buf[f.len] = '\0';
+    return f.count;
+}
+
+int com_printf(uint16_t port, const char* format, ...) {
+    if (format == NULL) return -1;
+
+    /* Stage output so the log ring (or the UART) sees whole chunks rather
+     * than one call per character. */
+    char stage[128];
+    com_fmt_t f = { .port = port, .buf = stage, .size = sizeof(stage), .len = 0, .count = 0 };
+
+    __builtin_va_list args;
+    __builtin_va_start(args, format);
+    com_format(&f, format, args);
     __builtin_va_end(args);
-    return count;
+
+    fmt_flush(&f);
+    return f.count;
 }
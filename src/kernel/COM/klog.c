@@ -0,0 +1,480 @@
+// klog.c - per-CPU kernel log rings, the klogd drainer and $/dev/kmsg
+//
+// Every CPU owns a single-producer ring of line records. Only that CPU
+// writes it, with interrupts off, so publishing a line is a copy and a
+// release store of the tail. klogd is the only consumer: it merges the rings
+// by sequence number, writes each line to the UART and appends it to a
+// history ring that $/dev/kmsg readers walk at their own pace.
+
+#include "moduos/kernel/COM/klog.h"
+#include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/smp.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/process/waitqueue.h"
+#include "moduos/kernel/timer_wheel.h"
+#include "moduos/fs/devfs.h"
+#include "moduos/fs/fd.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define KLOG_LINE_MAX          256
+#define KLOG_CPU_RING_SIZE     (16u * 1024u)   /* power of two */
+#define KLOG_HIST_SIZE         (64u * 1024u)   /* power of two */
+#define KLOG_DRAIN_INTERVAL_MS 10
+
+#define KLOG_F_NEWLINE 0x01     /* line ended in '\n' (else it filled up) */
+#define KLOG_PAD       0xFFFFu  /* len marker: rest of the ring is unused */
+
+typedef struct {
+    uint16_t len;               /* text bytes following the header */
+    uint8_t level;
+    uint8_t flags;
+    uint16_t cpu;
+    uint16_t reserved;
+    uint64_t seq;
+    uint64_t ts_ns;
+} klog_rec_t;
+
+/* Records are 8-byte aligned and never wrap; a record that does not fit
+ * before the end of the ring starts over at offset 0. */
+#define KLOG_REC_BYTES(len) (((uint32_t)sizeof(klog_rec_t) + (uint32_t)(len) + 7u) & ~7u)
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;
+    volatile uint64_t head;     /* consumer position (monotonic) */
+    volatile uint64_t tail;     /* producer position (monotonic) */
+} klog_ring_t;
+
+typedef struct {
+    klog_ring_t ring;
+    volatile uint64_t dropped;  /* lines lost to a full ring */
+    uint64_t dropped_reported;
+    int line_level;             /* -1: take it from the line's tag */
+    uint32_t line_len;
+    char line[KLOG_LINE_MAX];
+} klog_cpu_t;
+
+static volatile int g_klog_deferred;
+static uint64_t g_klog_seq;
+static klog_cpu_t *volatile g_klog_cpu[SMP_MAX_CPUS];
+static volatile uint32_t g_klog_ncpu;
+
+static klog_cpu_t g_klog_bsp;
+static uint8_t g_klog_bsp_buf[KLOG_CPU_RING_SIZE] __attribute__((aligned(8)));
+
+static spinlock_t g_klog_drain_lock;
+
+static klog_ring_t g_klog_hist;
+static uint8_t g_klog_hist_buf[KLOG_HIST_SIZE] __attribute__((aligned(8)));
+static spinlock_t g_klog_hist_lock;
+static wait_queue_t g_kmsg_wq;
+
+static int klog_snprintf(char *buf, uint32_t size, const char *fmt, ...) {
+    __builtin_va_list args;
+    __builtin_va_start(args, fmt);
+    int n = com_vsnprintf(buf, size, fmt, args);
+    __builtin_va_end(args);
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// Rings
+// ---------------------------------------------------------------------------
+
+// Space for need bytes at the tail, or NULL if the ring is full. The caller
+// fills the record in and publishes it by storing *end to r->tail.
+static klog_rec_t *ring_reserve(klog_ring_t *r, uint32_t need, uint64_t *end) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->tail;
+    uint32_t off = (uint32_t)tail & (r->size - 1);
+    uint32_t contig = r->size - off;
+    uint32_t skip = contig < need ? contig : 0;
+
+    if (tail + skip + need - head > r->size) return NULL;
+    if (skip) {
+        if (contig >= sizeof(klog_rec_t)) ((klog_rec_t *)(r->buf + off))->len = KLOG_PAD;
+        off = 0;
+    }
+    *end = tail + skip + need;
+    return (klog_rec_t *)(r->buf + off);
+}
+
+// Record at *pos (skipping a wrap marker), or NULL once *pos reaches the tail.
+static klog_rec_t *ring_peek(klog_ring_t *r, uint64_t *pos) {
+    uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    while (*pos != tail) {
+        uint32_t off = (uint32_t)*pos & (r->size - 1);
+        uint32_t contig = r->size - off;
+        klog_rec_t *rec = (klog_rec_t *)(r->buf + off);
+        if (contig < sizeof(klog_rec_t) || rec->len == KLOG_PAD) {
+            *pos += contig;
+            continue;
+        }
+        return rec;
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Producers
+// ---------------------------------------------------------------------------
+
+static int klog_line_level(const char *s, uint32_t n) {
+    static const struct { const char *tag; int level; } tags[] = {
+        { "[PANIC]",    KLOG_EMERG },
+        { "[FAULT]",    KLOG_ALERT },
+        { "[CRITICAL]", KLOG_CRIT },
+        { "[ERROR]",    KLOG_ERR },
+        { "[WARN]",     KLOG_WARNING },
+    };
+    for (size_t i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+        size_t tl = strlen(tags[i].tag);
+        if (n >= tl && memcmp(s, tags[i].tag, tl) == 0) return tags[i].level;
+    }
+    return KLOG_INFO;
+}
+
+// Publish this CPU's line buffer. Interrupts are off.
+static void klog_commit(klog_cpu_t *c, uint32_t cpu, int flags) {
+    uint32_t len = c->line_len;
+    c->line_len = 0;
+
+    uint64_t end;
+    klog_rec_t *rec = ring_reserve(&c->ring, KLOG_REC_BYTES(len), &end);
+    if (!rec) {
+        c->dropped++;
+        return;
+    }
+    rec->len = (uint16_t)len;
+    rec->level = (uint8_t)(c->line_level >= 0 ? c->line_level : klog_line_level(c->line, len));
+    rec->flags = (uint8_t)flags;
+    rec->cpu = (uint16_t)cpu;
+    rec->reserved = 0;
+    rec->seq = __atomic_fetch_add(&g_klog_seq, 1, __ATOMIC_RELAXED);
+    rec->ts_ns = sched_clock_ns();
+    memcpy(rec + 1, c->line, len);
+    __atomic_store_n(&c->ring.tail, end, __ATOMIC_RELEASE);
+}
+
+static int klog_write(int level, const char *data, uint32_t len) {
+    if (!__atomic_load_n(&g_klog_deferred, __ATOMIC_ACQUIRE)) return -1;
+
+    uint64_t flags = irq_save();
+    uint32_t cpu = (uint32_t)get_cpu_id();
+    klog_cpu_t *c = cpu < SMP_MAX_CPUS ? g_klog_cpu[cpu] : NULL;
+    if (!c) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    if (c->line_len == 0) c->line_level = level;
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            klog_commit(c, cpu, KLOG_F_NEWLINE);
+            c->line_level = level;
+            continue;
+        }
+        c->line[c->line_len++] = data[i];
+        if (c->line_len == KLOG_LINE_MAX) klog_commit(c, cpu, 0);
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+int klog_emit(const char *data, uint32_t len) {
+    return klog_write(-1, data, len);
+}
+
+int klog_deferred(void) {
+    return __atomic_load_n(&g_klog_deferred, __ATOMIC_ACQUIRE);
+}
+
+void klog_printf(int level, const char *fmt, ...) {
+    char buf[KLOG_LINE_MAX];
+    __builtin_va_list args;
+    __builtin_va_start(args, fmt);
+    int n = com_vsnprintf(buf, sizeof(buf), fmt, args);
+    __builtin_va_end(args);
+    if (n < 0) return;
+    if (n > (int)sizeof(buf) - 1) n = (int)sizeof(buf) - 1;
+
+    if (klog_write(level, buf, (uint32_t)n) != 0)
+        com_write_direct(COM1_PORT, (const uint8_t *)buf, (uint32_t)n);
+}
+
+int klog_cpu_init(uint32_t cpu) {
+    if (cpu >= SMP_MAX_CPUS) return -1;
+    if (g_klog_cpu[cpu]) return 0;
+
+    klog_cpu_t *c;
+    if (cpu == 0) {
+        c = &g_klog_bsp;
+        c->ring.buf = g_klog_bsp_buf;
+    } else {
+        c = (klog_cpu_t *)kzalloc(sizeof(*c));
+        if (!c) return -1;
+        c->ring.buf = (uint8_t *)kmalloc(KLOG_CPU_RING_SIZE);
+        if (!c->ring.buf) {
+            kfree(c);
+            return -1;
+        }
+    }
+    c->ring.size = KLOG_CPU_RING_SIZE;
+    c->line_level = -1;
+
+    __atomic_store_n(&g_klog_cpu[cpu], c, __ATOMIC_RELEASE);
+    if (cpu + 1 > g_klog_ncpu) __atomic_store_n(&g_klog_ncpu, cpu + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Drainer
+// ---------------------------------------------------------------------------
+
+static void hist_append(const klog_rec_t *hdr, const char *text) {
+    uint64_t flags;
+    spinlock_lock_irqsave(&g_klog_hist_lock, &flags);
+
+    uint32_t need = KLOG_REC_BYTES(hdr->len);
+    uint64_t end;
+    klog_rec_t *rec;
+    while (!(rec = ring_reserve(&g_klog_hist, need, &end))) {
+        // Overwrite the oldest line; readers behind it skip ahead.
+        uint64_t pos = g_klog_hist.head;
+        klog_rec_t *old = ring_peek(&g_klog_hist, &pos);
+        g_klog_hist.head = old ? pos + KLOG_REC_BYTES(old->len) : pos;
+    }
+    *rec = *hdr;
+    memcpy(rec + 1, text, hdr->len);
+    __atomic_store_n(&g_klog_hist.tail, end, __ATOMIC_RELEASE);
+
+    spinlock_unlock_irqrestore(&g_klog_hist_lock, flags);
+}
+
+static void klog_output(const klog_rec_t *hdr, const char *text) {
+    com_write_direct(COM1_PORT, (const uint8_t *)text, hdr->len);
+    if (hdr->flags & KLOG_F_NEWLINE) com_write_direct(COM1_PORT, (const uint8_t *)"\n", 1);
+    hist_append(hdr, text);
+}
+
+// Caller holds g_klog_drain_lock (or has given up on it, see
+// klog_console_sync). Returns the number of lines written.
+static int klog_drain_locked(void) {
+    char text[KLOG_LINE_MAX];
+    int written = 0;
+    uint32_t ncpu = __atomic_load_n(&g_klog_ncpu, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        klog_cpu_t *best = NULL;
+        klog_rec_t *best_rec = NULL;
+        uint64_t best_pos = 0;
+        for (uint32_t i = 0; i < ncpu; i++) {
+            klog_cpu_t *c = g_klog_cpu[i];
+            if (!c) continue;
+            uint64_t pos = c->ring.head;
+            klog_rec_t *rec = ring_peek(&c->ring, &pos);
+            if (rec && (!best_rec || rec->seq < best_rec->seq)) {
+                best = c;
+                best_rec = rec;
+                best_pos = pos;
+            }
+        }
+        if (!best) break;
+
+        // Copy out before handing the space back to the producer.
+        klog_rec_t hdr = *best_rec;
+        memcpy(text, best_rec + 1, hdr.len);
+        __atomic_store_n(&best->ring.head, best_pos + KLOG_REC_BYTES(hdr.len), __ATOMIC_RELEASE);
+
+        klog_output(&hdr, text);
+        written++;
+    }
+
+    for (uint32_t i = 0; i < ncpu; i++) {
+        klog_cpu_t *c = g_klog_cpu[i];
+        if (!c) continue;
+        uint64_t dropped = __atomic_load_n(&c->dropped, __ATOMIC_RELAXED);
+        if (dropped == c->dropped_reported) continue;
+
+        int n = klog_snprintf(text, sizeof(text), "[WARN] [KLOG] cpu%u: %llu lines dropped (ring full)",
+                              (unsigned)i, (unsigned long long)(dropped - c->dropped_reported));
+        if (n > (int)sizeof(text) - 1) n = (int)sizeof(text) - 1;
+
+        klog_rec_t hdr = { 0 };
+        hdr.len = (uint16_t)n;
+        hdr.level = KLOG_WARNING;
+        hdr.flags = KLOG_F_NEWLINE;
+        hdr.cpu = (uint16_t)i;
+        hdr.seq = __atomic_fetch_add(&g_klog_seq, 1, __ATOMIC_RELAXED);
+        hdr.ts_ns = sched_clock_ns();
+        c->dropped_reported = dropped;
+        klog_output(&hdr, text);
+        written++;
+    }
+    return written;
+}
+
+void klog_drain(void) {
+    if (!spinlock_trylock(&g_klog_drain_lock)) return;
+    int written = klog_drain_locked();
+    spinlock_unlock(&g_klog_drain_lock);
+
+    if (written && wait_queue_active(&g_kmsg_wq)) wake_up_all(&g_kmsg_wq);
+}
+
+void klog_console_sync(void) {
+    if (!__atomic_exchange_n(&g_klog_deferred, 0, __ATOMIC_SEQ_CST)) return;
+
+    // This CPU's unfinished line goes out too.
+    uint64_t flags = irq_save();
+    uint32_t cpu = (uint32_t)get_cpu_id();
+    klog_cpu_t *c = cpu < SMP_MAX_CPUS ? g_klog_cpu[cpu] : NULL;
+    if (c && c->line_len) klog_commit(c, cpu, 0);
+    irq_restore(flags);
+
+    // klogd may be mid-line on another CPU (or be what crashed): wait a
+    // little for it, then drain regardless.
+    int locked = 0;
+    for (uint32_t spins = 0; spins < 1000000u; spins++) {
+        if (spinlock_trylock(&g_klog_drain_lock)) {
+            locked = 1;
+            break;
+        }
+        cpu_relax();
+    }
+    klog_drain_locked();
+    if (locked) spinlock_unlock(&g_klog_drain_lock);
+}
+
+static void klogd_thread(void) {
+    for (;;) {
+        klog_drain();
+        sleep_ms(KLOG_DRAIN_INTERVAL_MS);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// $/dev/kmsg
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    uint64_t pos;               /* next history position to return */
+    int flags;
+} kmsg_reader_t;
+
+static void *kmsg_open(void *ctx, int flags) {
+    (void)ctx;
+    kmsg_reader_t *r = (kmsg_reader_t *)kzalloc(sizeof(*r));
+    if (!r) return NULL;
+    uint64_t irqf;
+    spinlock_lock_irqsave(&g_klog_hist_lock, &irqf);
+    r->pos = g_klog_hist.head;
+    spinlock_unlock_irqrestore(&g_klog_hist_lock, irqf);
+    r->flags = flags;
+    return r;
+}
+
+// Copy the reader's next record out. Returns 1 and its end position in
+// *next, or 0 if the reader has caught up.
+static int kmsg_next(kmsg_reader_t *r, klog_rec_t *hdr, char *text, uint64_t *next) {
+    int got = 0;
+    uint64_t flags;
+    spinlock_lock_irqsave(&g_klog_hist_lock, &flags);
+    if ((int64_t)(r->pos - g_klog_hist.head) < 0) r->pos = g_klog_hist.head;
+    uint64_t pos = r->pos;
+    klog_rec_t *rec = ring_peek(&g_klog_hist, &pos);
+    if (rec) {
+        *hdr = *rec;
+        memcpy(text, rec + 1, rec->len);
+        *next = pos + KLOG_REC_BYTES(rec->len);
+        got = 1;
+    } else {
+        r->pos = pos;
+    }
+    spinlock_unlock_irqrestore(&g_klog_hist_lock, flags);
+    return got;
+}
+
+static ssize_t kmsg_read(void *ctx, void *buf, size_t count) {
+    kmsg_reader_t *r = (kmsg_reader_t *)ctx;
+    if (!r || !buf) return -1;
+
+    char *out = (char *)buf;
+    size_t n = 0;
+    char text[KLOG_LINE_MAX];
+    char prefix[64];
+
+    for (;;) {
+        klog_rec_t hdr;
+        uint64_t next;
+        if (!kmsg_next(r, &hdr, text, &next)) {
+            if (n || (r->flags & O_NONBLOCK) || !wait_can_block()) break;
+
+            wait_entry_t we;
+            prepare_to_wait(&g_kmsg_wq, &we, 0);
+            if (!kmsg_next(r, &hdr, text, &next)) schedule();
+            finish_wait(&g_kmsg_wq, &we);
+            continue;
+        }
+
+        int plen = klog_snprintf(prefix, sizeof(prefix), "%u,%llu,%llu,%u;",
+                                 (unsigned)hdr.level, (unsigned long long)hdr.seq,
+                                 (unsigned long long)(hdr.ts_ns / 1000ULL), (unsigned)hdr.cpu);
+        size_t need = (size_t)plen + hdr.len + 1;
+        if (need > count - n) {
+            // Whole records only; a buffer too small for even one is an error.
+            if (n == 0) return -1;
+            break;
+        }
+        memcpy(out + n, prefix, (size_t)plen);
+        memcpy(out + n + plen, text, hdr.len);
+        out[n + plen + hdr.len] = '\n';
+        n += need;
+        r->pos = next;
+    }
+    return (ssize_t)n;
+}
+
+static int kmsg_close(void *ctx) {
+    kfree(ctx);
+    return 0;
+}
+
+static const devfs_device_ops_t g_kmsg_ops = {
+    .name = "kmsg",
+    .open = kmsg_open,
+    .read = kmsg_read,
+    .write = NULL,
+    .close = kmsg_close,
+};
+
+void klog_start(void) {
+    static int started = 0;
+    if (started) return;
+
+    spinlock_init(&g_klog_drain_lock);
+    spinlock_init(&g_klog_hist_lock);
+    wait_queue_init(&g_kmsg_wq);
+    g_klog_hist.buf = g_klog_hist_buf;
+    g_klog_hist.size = KLOG_HIST_SIZE;
+    klog_cpu_init(0);
+
+    devfs_owner_t owner = { .kind = DEVFS_OWNER_KERNEL, .id = "kernel" };
+    if (devfs_register_path("kmsg", &g_kmsg_ops, NULL, owner) != 0)
+        com_write_string(COM1_PORT, "[KLOG] failed to register $/dev/kmsg\n");
+
+    process_t *p = process_create("klogd", klogd_thread, 5);
+    if (!p) {
+        com_write_string(COM1_PORT, "[KLOG] failed to start klogd; serial logging stays synchronous\n");
+        return;
+    }
+    started = 1;
+    __atomic_store_n(&g_klog_deferred, 1, __ATOMIC_RELEASE);
+    com_printf(COM1_PORT, "[KLOG] log ring active, drained by klogd (pid %u)\n", p->pid);
+}
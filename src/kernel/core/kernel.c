@@ -396,7 +396,9 @@ static void kernel_post_init_run_shell(void) {
     __asm__ volatile("sti");
     while (1) {
         schedule();
-        __asm__ volatile("hlt");
+        __asm__ volatile("cli");
+        if (!scheduler_idle_has_work()) __asm__ volatile("sti; hlt" ::: "memory");
+        else __asm__ volatile("sti; pause" ::: "memory");
     }
 }
 
@@ -504,12 +506,7 @@ static void kernel_try_enable_framebuffer(uint64_t mb2_ptr) {
 }
 
 static void gfx_sleep_ms(uint64_t ms) {
-    /* Delay using PIT ticks */
-    const uint64_t start = get_system_ticks();
-    const uint64_t ticks = ms_to_ticks(ms);
-    while ((get_system_ticks() - start) < ticks) {
-        __asm__ volatile("hlt");
-    }
+    (void)sleep_ms(ms);
 }
 
 static void kernel_post_init_graphics_test(uint64_t mb2_ptr) {
@@ -626,11 +623,15 @@ void kernel_main(uint64_t mb2_ptr)
     /* Enable interrupts and enter the idle loop.
      * create_init_process() has already enqueued PID 1; the first schedule()
      * call below will switch to it.  When PID 1 later yields or blocks the
-     * scheduler returns here, we hlt until the next timer tick, and repeat. */
+     * scheduler returns here and we hlt until an interrupt, and repeat. The
+     * BSP is tickless, so work is checked with interrupts off before the
+     * sti; hlt (a wakeup cannot land in between). */
     com_write_string(COM1_PORT, "[KERNEL] Entering idle loop...\n");
     __asm__ volatile("sti");
     for (;;) {
         schedule();
-        __asm__ volatile("hlt");
+        __asm__ volatile("cli");
+        if (!scheduler_idle_has_work()) __asm__ volatile("sti; hlt" ::: "memory");
+        else __asm__ volatile("sti; pause" ::: "memory");
     }
 }
@@ -2,11 +2,14 @@
 
 #include "moduos/kernel/mdinit.h"
 #include "moduos/kernel/smp.h"
+#include "moduos/kernel/percpu_heap.h"
 #include "moduos/arch/AMD64/gdt.h"
+#include "moduos/arch/AMD64/fpu.h"
 
 // We include the old kernel.c dependencies here so init behavior remains unchanged.
 #include "moduos/kernel/kernel.h"
 #include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/COM/klog.h"
 #include "moduos/kernel/debug.h"
 #include "moduos/kernel/memory/memory.h"
 
@@ -15,6 +18,7 @@ void memory_smoke_test(void);
 
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/memory/memops.h"
 #include "moduos/kernel/multiboot2.h"
 #include "moduos/kernel/bootscreen.h"
 #include "moduos/kernel/sqrm.h"
@@ -99,21 +103,6 @@ static void com_print_dec64(uint64_t v) {
     }
 }
 
-static inline void fpu_init(void) {
-    __asm__ volatile (
-        "fninit\n"
-        "mov %%cr0, %%rax\n"
-        "and $~0x4, %%rax\n"
-        "mov %%rax, %%cr0\n"
-        "mov %%cr4, %%rax\n"
-        "or $0x600, %%rax\n"
-        "mov %%rax, %%cr4\n"
-        :
-        :
-        : "rax", "memory"
-    );
-}
-
 static void Interrupts_Init(void) {
     COM_LOG_INFO(COM1_PORT, "Remapping PIC");
     pic_remap(0x20, 0x28);
@@ -463,6 +452,11 @@ static int detect_boot_drive(void) {
 // ------------------ INIT ------------------
 static void init(uint64_t mb2_ptr_init) {
     g_mdinit_mb2_ptr = mb2_ptr_init;
+
+    /* GS base -> BSP cpu_local_t before anything reads `current` or the CPU id.
+     * amd64_gdt_init() later reloads the segment registers but keeps the GS MSRs. */
+    smp_init_bsp_early();
+
     // Initialize COM ports FIRST for early debug output
     com_early_init(COM1_PORT);
     com_early_init(COM2_PORT);
@@ -491,9 +485,12 @@ static void init(uint64_t mb2_ptr_init) {
     Interrupts_Init();
 
     COM_LOG(COM1_PORT, "Initializing FPU");
-    fpu_init();
+    fpu_init_cpu();
     COM_LOG_OK(COM1_PORT, "Successfuly Initialized FPU");
 
+    /* Pick memcpy/memset variants now that SSE is enabled (CPUID only, no heap). */
+    memops_init();
+
     // Debug: show multiboot pointer
     com_write_string(COM1_PORT, "\n=== MEMORY INITIALIZATION ===\n");
     com_write_string(COM1_PORT, "[MEM] Multiboot2 pointer: ");
@@ -508,6 +505,9 @@ static void init(uint64_t mb2_ptr_init) {
     __asm__ volatile("sti");
     COM_LOG_OK(COM1_PORT, "CPU interrupts enabled!");
 
+    /* Needs the heap and a ticking PIT; logs GB/s per memcpy/memset variant. */
+    memops_boot_benchmark();
+
     /* Initialize SMBIOS table pointers from Multiboot2, so bootscreen can pick correct branding. */
     md64api_init_smbios_from_mb2((void*)(uintptr_t)mb2_ptr_init);
 
@@ -525,6 +525,27 @@ static void init(uint64_t mb2_ptr_init) {
     memory_smoke_test();
     com_write_string(COM1_PORT, "=== MEMORY INITIALIZATION COMPLETE ===\n\n");
 
+    // Initialize ACPI
+    if (acpi_init() == 0) {
+        acpi_initialized = 1;
+        COM_LOG_OK(COM1_PORT, "ACPI initialized");
+
+        // APIC/LAPIC/IOAPIC init temporarily disabled (work in progress).
+        // Re-enable once APIC interrupt vectors/EOI are fully stable.
+        // (void)apic_init_from_madt();
+        // (void)apic_timer_init(1000);
+        // if (ioapic_init_from_madt() == 0) {
+        //     for (int i = 0; i < 16; i++) pic_mask_irq((uint8_t)i);
+        // }
+
+        /* MSI/MSI-X messages target the BSP's LAPIC, so enable it (virtual
+         * wire: PIC IRQs keep flowing) before the first driver asks for one.
+         * Without a MADT, pci_irq_vector_count() stays 0 and drivers use INTx. */
+        (void)apic_enable_bsp_for_smp();
+    } else {
+        COM_LOG_WARN(COM1_PORT, "ACPI initialization failed");
+    }
+
     // Early storage stack so boot drive can be found ASAP.
     storage_early_init();
 
@@ -581,41 +602,39 @@ static void init(uint64_t mb2_ptr_init) {
     // Optional: poll HID reports for a short time during boot to validate USB HID.
     hid_debug_poll_early();
 
-    // Initialize ACPI
-    if (acpi_init() == 0) {
-        acpi_initialized = 1;
-        COM_LOG_OK(COM1_PORT, "ACPI initialized");
-
-        // APIC/LAPIC/IOAPIC init temporarily disabled (work in progress).
-        // Re-enable once APIC interrupt vectors/EOI are fully stable.
-        // (void)apic_init_from_madt();
-        // (void)apic_timer_init(1000);
-        // if (ioapic_init_from_madt() == 0) {
-        //     for (int i = 0; i < 16; i++) pic_mask_irq((uint8_t)i);
-        // }
-    } else {
-        COM_LOG_WARN(COM1_PORT, "ACPI initialization failed");
-    }
-
     // Late device init (PS/2/input/USB, etc)
     devices_late_init();
 
     // Initialize process management system
     COM_LOG_INFO(COM1_PORT, "Initializing process management");
 
-    /* GDT must be loaded first: writing a segment register in long mode zeros
-     * the hidden base, which would clobber any MSR write done beforehand.
-     * smp_init_bsp_early() sets GS_BASE after the GDT is stable. */
+    /* Per-CPU GDT/TSS for the BSP. Reloading GS zeros its hidden base, so
+     * amd64_gdt_init() restores GS_BASE/KERNEL_GS_BASE set at the top of init(). */
     amd64_gdt_init();
 
-    /* Set up per-CPU GS base for BSP after the GDT is in place. */
-    smp_init_bsp_early();
+    /* kmalloc() magazines hang off cpu_local_t, so this needs GS base. */
+    percpu_heap_init();
 
     // Use new POSIX-compliant process system
     process_management_init();
     syscall_init();
     COM_LOG_OK(COM1_PORT, "Process management initialized");
 
+    /* From here on COM1 output is buffered per CPU and drained by klogd. */
+    klog_start();
+
+    /* vDrive cache is write-back; age out dirty lines in the background. */
+    vdrive_cache_start_writeback();
+
+    /* Runtime accounting and tickless CPUs need an invariant TSC's rate. */
+    tsc_calibrate();
+
+    /* Start the other CPUs last: from here on user processes may run on them. */
+    smp_init_aps();
+
+    /* The BSP's LAPIC is up (see acpi_init() above): stop the PIT and let the
+     * scheduler time the BSP with one-shots too. */
+    (void)timer_enter_nohz();
 }
 
 void mdinit_run(uint64_t mb2_ptr) {
@@ -1,4 +1,5 @@
 #include "moduos/kernel/panic.h"
+#include "moduos/kernel/COM/klog.h"
 #include "moduos/drivers/graphics/VGA.h"
 #include "moduos/drivers/power/ACPI.h"
 #include "moduos/drivers/Time/RTC.h"
@@ -292,6 +293,7 @@ static void panic_draw_gui(const char* title, const char* message, const char* t
 void panic(const char* title, const char* message, const char* tips, const char* err_cat, const char* err_code, int reboot_delay)
 {
     __asm__ volatile("cli" ::: "memory");
+    klog_console_sync();
     for (int i = reboot_delay; i >= 0; i--) {
         panic_header(title);
         panic_draw_gui(title, message, tips, err_cat, err_code, i);
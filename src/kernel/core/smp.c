@@ -1,15 +1,58 @@
 #include "moduos/kernel/smp.h"
 #include "moduos/kernel/percpu.h"
-#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/kernel/percpu_heap.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/COM/klog.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/string.h"
-
-#define SMP_MAX_CPUS 256
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/arch/AMD64/gdt.h"
+#include "moduos/arch/AMD64/fpu.h"
+#include "moduos/arch/AMD64/msr.h"
+#include "moduos/arch/AMD64/syscall/syscall64.h"
+#include "moduos/arch/AMD64/interrupts/apic.h"
+#include "moduos/arch/AMD64/interrupts/idt.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+#include "moduos/drivers/power/ACPI.h"
 
 static cpu_local_t g_bsp_cpu;
 static cpu_state_t g_cpu_states[SMP_MAX_CPUS];
 static cpu_local_t *g_cpus[SMP_MAX_CPUS];
 static uint32_t g_cpu_count = 1;
 
+/* AP startup. The real-mode trampoline (ap_trampoline.asm) is copied to
+ * AP_TRAMPOLINE_PHYS, which phys.c keeps reserved with the rest of the low 1 MiB.
+ * The STARTUP IPI vector is that address divided by 4 KiB. */
+#define AP_TRAMPOLINE_PHYS  0x8000u
+#define AP_STACK_SIZE       16384u     /* also the AP idle context's kernel_stack */
+#define AP_TIMER_HZ         1000u
+
+/* Must match the data block at the end of ap_trampoline.asm. */
+typedef struct {
+    uint64_t cr3;
+    uint64_t efer;
+    uint64_t cr0;
+    uint64_t cr4;
+    uint64_t stack;
+    uint64_t entry;
+    uint64_t cpu;
+} __attribute__((packed)) ap_boot_data_t;
+
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_data[];
+extern uint8_t ap_trampoline_end[];
+
+static process_t *g_ap_idle[SMP_MAX_CPUS];
+static volatile uint32_t g_ap_ready;    /* cpu id of the last AP that finished init */
+
+/* Big kernel lock state (see smp.h). */
+static spinlock_t g_bkl;
+static volatile int64_t g_bkl_owner = -1;
+static int g_bkl_depth;
+
 /*
  * Early BSP initialization.
  * Sets up GS base and registers the BSP's per-CPU structure.
@@ -48,8 +91,7 @@ void smp_init_bsp_early(void) {
 }
 
 /*
- * Returns the number of online CPUs.
- * Currently always 1 (BSP only) until APIC AP bring-up is implemented.
+ * Returns the number of registered CPU slots.
  */
 uint32_t smp_cpu_count(void) {
     return g_cpu_count;
@@ -74,7 +116,7 @@ cpu_local_t *smp_get_cpu(uint32_t cpu_id) {
 
 /*
  * Register a per-CPU data block during early initialization.
- * Called by AP bring-up code once APIC is available.
+ * Called by smp_init_aps() for each AP before it is started.
  */
 void smp_register_percpu(uint32_t cpu_id, cpu_local_t *pcpu) {
     if (cpu_id >= SMP_MAX_CPUS || pcpu == NULL)
@@ -90,6 +132,81 @@ void smp_register_percpu(uint32_t cpu_id, cpu_local_t *pcpu) {
     pcpu->cpu_num = cpu_id;
 }
 
+void smp_send_resched(uint32_t cpu_id) {
+    if (cpu_id >= SMP_MAX_CPUS || !g_cpus[cpu_id]) return;
+    if (smp_get_cpu_state(cpu_id) != CPU_STATE_RUNNING) return;
+    (void)apic_send_resched((uint8_t)g_cpus[cpu_id]->apic_id);
+}
+
+/* ---------------------------------------------------------------------------
+ * TLB shootdown (see smp.h)
+ * ------------------------------------------------------------------------- */
+
+/* Past this many pages a CR3 reload is cheaper than invlpg per page (kernel
+ * mappings are not global, so the reload drops them too). */
+#define TLB_FLUSH_ALL_PAGES 32u
+
+static spinlock_t g_tlb_lock;
+static volatile uint64_t g_tlb_start, g_tlb_end;    /* request in flight */
+static volatile uint32_t g_tlb_pending;             /* targets yet to flush */
+static volatile uint8_t g_tlb_req[SMP_MAX_CPUS];    /* per target: not flushed yet */
+
+static void tlb_flush_local(uint64_t start, uint64_t end) {
+    if ((end - start) / 4096u > TLB_FLUSH_ALL_PAGES) {
+        uint64_t cr3;
+        __asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) :: "memory");
+        return;
+    }
+    for (uint64_t v = start; v < end; v += 4096u)
+        __asm__ volatile("invlpg (%0)" :: "r"(v) : "memory");
+}
+
+void smp_tlb_ipi(void) {
+    uint64_t me = get_cpu_id();
+    if (me >= SMP_MAX_CPUS || !__atomic_exchange_n(&g_tlb_req[me], 0, __ATOMIC_ACQ_REL)) return;
+    tlb_flush_local(g_tlb_start, g_tlb_end);
+    __atomic_sub_fetch(&g_tlb_pending, 1, __ATOMIC_RELEASE);
+}
+
+void smp_tlb_shootdown(uint64_t start, uint64_t end) {
+    start &= ~0xFFFULL;
+    if (end <= start || g_cpu_count < 2) return;
+    uint32_t me = (uint32_t)get_cpu_id();
+    uint32_t count = g_cpu_count;
+    uint32_t c;
+    for (c = 0; c < count; c++) {
+        if (c != me && g_cpus[c] && g_cpu_states[c] == CPU_STATE_RUNNING) break;
+    }
+    if (c == count) return;
+
+    /* Waiting with IF clear: serve our own requests by polling meanwhile, or two
+     * CPUs shooting down at once would wait on each other forever. */
+    uint64_t flags = irq_save();
+    while (!spinlock_trylock(&g_tlb_lock)) {
+        smp_tlb_ipi();
+        cpu_relax();
+    }
+
+    g_tlb_start = start;
+    g_tlb_end = end;
+    for (c = 0; c < count; c++) {
+        if (c == me || !g_cpus[c] || g_cpu_states[c] != CPU_STATE_RUNNING) continue;
+        __atomic_add_fetch(&g_tlb_pending, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_tlb_req[c], 1, __ATOMIC_RELEASE);
+    }
+    for (c = 0; c < count; c++) {
+        if (!__atomic_load_n(&g_tlb_req[c], __ATOMIC_ACQUIRE)) continue;
+        /* A CPU we cannot reach has nothing to wait for. */
+        if (apic_send_tlb((uint8_t)g_cpus[c]->apic_id) != 0 &&
+            __atomic_exchange_n(&g_tlb_req[c], 0, __ATOMIC_ACQ_REL))
+            __atomic_sub_fetch(&g_tlb_pending, 1, __ATOMIC_RELEASE);
+    }
+    while (__atomic_load_n(&g_tlb_pending, __ATOMIC_ACQUIRE)) cpu_relax();
+
+    spinlock_unlock(&g_tlb_lock);
+    irq_restore(flags);
+}
+
 /*
  * Query the state of a CPU.
  */
@@ -108,3 +225,221 @@ void smp_set_cpu_state(uint32_t cpu_id, cpu_state_t state) {
         return;
     g_cpu_states[cpu_id] = state;
 }
+
+/* ---------------------------------------------------------------------------
+ * Big kernel lock
+ * ------------------------------------------------------------------------- */
+
+int bkl_held(void) {
+    return g_bkl_owner == (int64_t)get_cpu_id();
+}
+
+void bkl_lock(void) {
+    int64_t me = (int64_t)get_cpu_id();
+    if (g_bkl_owner == me) {
+        g_bkl_depth++;
+        return;
+    }
+
+    /* Keep taking interrupts while waiting, even on the syscall path where
+     * IF is clear: the holder may be waiting for a tick or an IRQ that only
+     * this CPU receives. */
+    uint64_t flags = irq_save();
+    while (!spinlock_trylock(&g_bkl)) {
+        __asm__ volatile("sti; pause; cli" ::: "memory");
+    }
+    g_bkl_owner = me;
+    g_bkl_depth = 1;
+    irq_restore(flags);
+}
+
+void bkl_unlock(void) {
+    if (g_bkl_owner != (int64_t)get_cpu_id()) return;
+    if (--g_bkl_depth > 0) return;
+    g_bkl_owner = -1;
+    spinlock_unlock(&g_bkl);
+}
+
+int bkl_release_all(void) {
+    if (g_bkl_owner != (int64_t)get_cpu_id()) return 0;
+    int depth = g_bkl_depth;
+    g_bkl_depth = 0;
+    g_bkl_owner = -1;
+    spinlock_unlock(&g_bkl);
+    return depth;
+}
+
+void bkl_reacquire(int depth) {
+    if (depth <= 0) return;
+    bkl_lock();
+    g_bkl_depth = depth;
+}
+
+/* ---------------------------------------------------------------------------
+ * AP bring-up
+ * ------------------------------------------------------------------------- */
+
+static inline uint64_t read_cr0(void) { uint64_t v; __asm__ volatile("mov %%cr0, %0" : "=r"(v)); return v; }
+static inline uint64_t read_cr3_raw(void) { uint64_t v; __asm__ volatile("mov %%cr3, %0" : "=r"(v)); return v; }
+static inline uint64_t read_cr4(void) { uint64_t v; __asm__ volatile("mov %%cr4, %0" : "=r"(v)); return v; }
+
+static void smp_delay_ms(uint64_t ms) {
+    uint64_t end = get_system_ticks() + ms_to_ticks(ms) + 1;
+    while (get_system_ticks() < end) cpu_relax();
+}
+
+/* First C code on an AP. Called by the trampoline on the AP's boot stack with
+ * GS not yet set up; never returns (becomes this CPU's idle loop). */
+void smp_ap_main(uint64_t cpu) {
+    cpu_local_t *cl = g_cpus[cpu];
+
+    amd64_gdt_init_cpu((uint32_t)cpu);
+    amd64_cpu_set_gs_base((uint64_t)(uintptr_t)cl);
+    amd64_cpu_set_kernel_gs_base((uint64_t)(uintptr_t)cl);
+    idt_load();
+    fpu_init_cpu();
+
+    amd64_syscall_init_cpu();
+    apic_ap_init();
+    cl->apic_id = apic_local_id();
+
+    process_t *idle = g_ap_idle[cpu];
+    set_curproc(idle);
+    scheduler_register_idle(idle);
+
+    /* Tickless: the scheduler arms the one-shot timer only when this CPU
+     * has something to time. It needs the invariant TSC as its clock; fall
+     * back to a periodic tick without that or the one-shot timer. */
+    int nohz = tsc_khz() && apic_timer_start_oneshot() == 0;
+    int timer_ok = nohz || apic_timer_start(AP_TIMER_HZ) == 0;
+    if (nohz) scheduler_set_nohz();
+
+    smp_set_cpu_state((uint32_t)cpu, CPU_STATE_RUNNING);
+    __atomic_store_n(&g_ap_ready, (uint32_t)cpu, __ATOMIC_RELEASE);
+
+    __asm__ volatile("sti");
+    for (;;) {
+        schedule();
+        /* With the tick stopped only an IPI ends the halt: check for work
+         * with interrupts off so one cannot land between check and hlt. */
+        __asm__ volatile("cli");
+        if (timer_ok && !scheduler_idle_has_work()) __asm__ volatile("sti; hlt" ::: "memory");
+        else __asm__ volatile("sti; pause" ::: "memory");
+    }
+}
+
+/* Idle context for an AP. Like the BSP's PID 0 it is the CPU's boot thread
+ * itself, so it needs no entry point; it is never put in the process table. */
+static process_t *smp_make_idle(uint32_t cpu, void *stack) {
+    process_t *idle = (process_t *)kzalloc(sizeof(process_t));
+    if (!idle) return NULL;
+    idle->fpu_state = fpu_state_alloc();
+    if (!idle->fpu_state) { kfree(idle); return NULL; }
+
+    idle->pid = 0;
+    idle->controlling_tty = -1;
+    strncpy(idle->name, "idle", PROCESS_NAME_MAX - 1);
+    idle->kernel_stack = stack;
+    idle->cr3 = read_cr3_raw();
+    idle->weight = 1024;
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->sched_cpu = (int)cpu;
+    idle->on_cpu = 1;
+
+    extern int boot_drive_slot;
+    idle->current_slot = boot_drive_slot;
+    idle->cwd[0] = '/';
+    return idle;
+}
+
+static int smp_start_ap(uint32_t cpu, uint8_t apic_id, ap_boot_data_t *data) {
+    cpu_local_t *cl = (cpu_local_t *)kzalloc(sizeof(cpu_local_t));
+    void *stack = kmalloc(AP_STACK_SIZE);
+    process_t *idle = stack ? smp_make_idle(cpu, stack) : NULL;
+    if (!cl || !idle) {
+        com_printf(COM1_PORT, "[SMP] CPU%u (APIC %u): out of memory\n", cpu, apic_id);
+        if (stack) kfree(stack);
+        if (cl) kfree(cl);
+        return -1;
+    }
+
+    cl->apic_id = apic_id;
+    smp_register_percpu(cpu, cl);
+    percpu_heap_init_cpu(cl);
+    if (klog_cpu_init(cpu) != 0)
+        com_printf(COM1_PORT, "[SMP] CPU%u: no log ring, its output stays synchronous\n", cpu);
+    g_ap_idle[cpu] = idle;
+    smp_set_cpu_state(cpu, CPU_STATE_INIT);
+
+    data->stack = ((uint64_t)(uintptr_t)stack + AP_STACK_SIZE - 16) & ~0xFULL;
+    data->cpu = cpu;
+    __atomic_store_n(&g_ap_ready, 0, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* INIT, 10 ms, STARTUP, then a second STARTUP only if the first was missed. */
+    apic_send_init(apic_id);
+    smp_delay_ms(10);
+    apic_send_startup(apic_id, (uint8_t)(AP_TRAMPOLINE_PHYS >> 12));
+    smp_delay_ms(1);
+    if (__atomic_load_n(&g_ap_ready, __ATOMIC_ACQUIRE) != cpu) {
+        apic_send_startup(apic_id, (uint8_t)(AP_TRAMPOLINE_PHYS >> 12));
+    }
+
+    for (int i = 0; i < 100; i++) {
+        if (__atomic_load_n(&g_ap_ready, __ATOMIC_ACQUIRE) == cpu) return 0;
+        smp_delay_ms(1);
+    }
+
+    /* The AP never reported in. Its stack and idle context may still be
+     * referenced by a late start, so they are leaked rather than freed. */
+    smp_set_cpu_state(cpu, CPU_STATE_OFFLINE);
+    com_printf(COM1_PORT, "[SMP] CPU%u (APIC %u) did not start\n", cpu, apic_id);
+    return -1;
+}
+
+uint32_t smp_init_aps(void) {
+    madt_t *madt = acpi_get_madt();
+    if (!madt) {
+        com_write_string(COM1_PORT, "[SMP] No MADT; running on the BSP only\n");
+        return 1;
+    }
+    if (apic_enable_bsp_for_smp() != 0) {
+        com_write_string(COM1_PORT, "[SMP] LAPIC unavailable; running on the BSP only\n");
+        return 1;
+    }
+
+    uint32_t bsp_apic = apic_local_id();
+    g_bsp_cpu.apic_id = bsp_apic;
+
+    /* Install the trampoline and the parts of its data block shared by all APs. */
+    size_t tramp_len = (size_t)(ap_trampoline_end - ap_trampoline_start);
+    uint8_t *tramp = (uint8_t *)phys_to_virt_kernel(AP_TRAMPOLINE_PHYS);
+    memcpy(tramp, ap_trampoline_start, tramp_len);
+    ap_boot_data_t *data = (ap_boot_data_t *)(tramp + (ap_trampoline_data - ap_trampoline_start));
+
+    data->cr3 = read_cr3_raw();
+    data->efer = rdmsr(0xC0000080u);
+    data->cr0 = read_cr0() & ~(1ULL << 3);   /* never start with CR0.TS set */
+    data->cr4 = read_cr4();
+    data->entry = (uint64_t)(uintptr_t)smp_ap_main;
+
+    uint32_t online = 1;
+    uint32_t next_cpu = 1;
+    uint8_t *ptr = madt->entries;
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+    while (ptr + sizeof(madt_entry_header_t) <= end && next_cpu < SMP_MAX_CPUS) {
+        madt_entry_header_t *h = (madt_entry_header_t *)ptr;
+        if (h->length < sizeof(madt_entry_header_t)) break;
+        if (h->type == 0 && h->length >= sizeof(madt_local_apic_t)) {
+            madt_local_apic_t *la = (madt_local_apic_t *)ptr;
+            if ((la->flags & 1u) && la->apic_id != bsp_apic) {
+                if (smp_start_ap(next_cpu, la->apic_id, data) == 0) online++;
+                next_cpu++;
+            }
+        }
+        ptr += h->length;
+    }
+
+    com_printf(COM1_PORT, "[SMP] %u CPU(s) online\n", online);
+    return online;
+}
@@ -0,0 +1,254 @@
+// timer_wheel.c - hierarchical timer wheel and timed sleeps
+//
+// tv1 holds timers due within the next 256 ticks, one slot per tick. tvn[l]
+// holds timers further out in 64 slots of 256 * 64^l ticks each. Whenever
+// the low bits of the clock wrap, the next slot of the level above is
+// re-filed into finer slots ("cascade"), so every tick only has to look at a
+// single tv1 slot.
+
+#include "moduos/kernel/timer_wheel.h"
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/process/waitqueue.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define TVR_BITS   8
+#define TVN_BITS   6
+#define TVN_LEVELS 4
+#define TVR_SIZE   (1u << TVR_BITS)
+#define TVN_SIZE   (1u << TVN_BITS)
+#define TVR_MASK   (TVR_SIZE - 1u)
+#define TVN_MASK   (TVN_SIZE - 1u)
+/* Largest delta the wheel can hold (~49 days at 1 kHz); later deadlines
+ * park in the outermost level and are re-filed when it cascades. */
+#define TW_MAX_DELTA ((1ULL << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1ULL)
+
+static struct {
+    spinlock_t lock;
+    uint64_t clk;                          /* next tick to process */
+    ktimer_t *tv1[TVR_SIZE];
+    ktimer_t *tvn[TVN_LEVELS][TVN_SIZE];
+    ktimer_t *volatile running;            /* callback in progress */
+    ktimer_stats_t stats;
+} g_tw;
+
+static void tw_link(ktimer_t **slot, ktimer_t *t) {
+    t->next = *slot;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+    t->pending = 1;
+}
+
+static void tw_unlink(ktimer_t *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    t->pending = 0;
+}
+
+// Caller holds g_tw.lock.
+static void tw_add(ktimer_t *t) {
+    uint64_t expires = t->expires;
+    uint64_t delta = expires - g_tw.clk;
+
+    if ((int64_t)delta < 0) {
+        // Already due: fire on the next tick processed.
+        tw_link(&g_tw.tv1[g_tw.clk & TVR_MASK], t);
+        return;
+    }
+    if (delta < TVR_SIZE) {
+        tw_link(&g_tw.tv1[expires & TVR_MASK], t);
+        return;
+    }
+    if (delta > TW_MAX_DELTA) {
+        delta = TW_MAX_DELTA;
+        expires = g_tw.clk + delta;
+    }
+    for (int lvl = 0; lvl < TVN_LEVELS; lvl++) {
+        unsigned shift = TVR_BITS + (unsigned)(lvl + 1) * TVN_BITS;
+        if (lvl == TVN_LEVELS - 1 || delta < (1ULL << shift)) {
+            unsigned idx = (unsigned)(expires >> (shift - TVN_BITS)) & TVN_MASK;
+            tw_link(&g_tw.tvn[lvl][idx], t);
+            return;
+        }
+    }
+}
+
+// Re-file one slot of level lvl into finer slots. Returns the slot index so
+// the caller knows whether the level above wrapped too.
+static unsigned tw_cascade(int lvl, unsigned idx) {
+    ktimer_t *list = g_tw.tvn[lvl][idx];
+    g_tw.tvn[lvl][idx] = NULL;
+    while (list) {
+        ktimer_t *t = list;
+        list = t->next;
+        t->pending = 0;
+        tw_add(t);
+        g_tw.stats.cascaded++;
+    }
+    return idx;
+}
+
+void timer_setup(ktimer_t *t, ktimer_fn_t fn, void *arg) {
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->fn = fn;
+    t->arg = arg;
+    t->pending = 0;
+}
+
+void timer_arm(ktimer_t *t, uint64_t deadline) {
+    uint64_t flags;
+    spinlock_lock_irqsave(&g_tw.lock, &flags);
+    if (t->pending) tw_unlink(t);
+    t->expires = deadline;
+    tw_add(t);
+    g_tw.stats.armed++;
+    spinlock_unlock_irqrestore(&g_tw.lock, flags);
+
+    // A tickless timebase CPU only wakes for the deadline it last programmed.
+    scheduler_timer_armed(deadline);
+}
+
+int timer_cancel(ktimer_t *t) {
+    uint64_t flags;
+    int was_pending = 0;
+    spinlock_lock_irqsave(&g_tw.lock, &flags);
+    if (t->pending) {
+        tw_unlink(t);
+        g_tw.stats.cancelled++;
+        was_pending = 1;
+    }
+    spinlock_unlock_irqrestore(&g_tw.lock, flags);
+
+    // The callback may be running on the timebase CPU right now; the caller
+    // is about to free or reuse t, so let it finish.
+    while (g_tw.running == t) cpu_relax();
+    return was_pending;
+}
+
+void timer_run_expired(uint64_t now) {
+    spinlock_lock(&g_tw.lock);
+    while ((int64_t)(now - g_tw.clk) >= 0) {
+        unsigned idx = (unsigned)(g_tw.clk & TVR_MASK);
+        if (idx == 0) {
+            for (int lvl = 0; lvl < TVN_LEVELS; lvl++) {
+                unsigned shift = TVR_BITS + (unsigned)lvl * TVN_BITS;
+                if (tw_cascade(lvl, (unsigned)(g_tw.clk >> shift) & TVN_MASK) != 0) break;
+            }
+        }
+        g_tw.clk++;
+
+        while (g_tw.tv1[idx]) {
+            ktimer_t *t = g_tw.tv1[idx];
+            tw_unlink(t);
+            g_tw.stats.fired++;
+            g_tw.running = t;
+            spinlock_unlock(&g_tw.lock);
+
+            t->fn(t->arg);
+
+            spinlock_lock(&g_tw.lock);
+            g_tw.running = NULL;
+        }
+    }
+    spinlock_unlock(&g_tw.lock);
+}
+
+uint64_t timer_next_expiry(void) {
+    uint64_t flags;
+    uint64_t next = TIMER_NO_EXPIRY;
+    spinlock_lock_irqsave(&g_tw.lock, &flags);
+    uint64_t clk = g_tw.clk;
+
+    for (unsigned i = 0; i < TVR_SIZE; i++) {
+        if (g_tw.tv1[(clk + i) & TVR_MASK]) {
+            next = clk + i;
+            goto out;
+        }
+    }
+
+    // Nothing in tv1: wake for the first cascade of a non-empty outer slot.
+    // That is no later than any deadline in it, and re-files it into tv1.
+    for (int lvl = 0; lvl < TVN_LEVELS; lvl++) {
+        unsigned shift = TVR_BITS + (unsigned)lvl * TVN_BITS;
+        uint64_t base = clk >> shift;
+        for (unsigned j = 0; j <= TVN_SIZE; j++) {
+            uint64_t at = (base + j) << shift;
+            if (at < clk) continue;
+            if (at >= next) break;
+            if (g_tw.tvn[lvl][(base + j) & TVN_MASK]) {
+                next = at;
+                break;
+            }
+        }
+    }
+out:
+    spinlock_unlock_irqrestore(&g_tw.lock, flags);
+    return next;
+}
+
+void timer_get_stats(ktimer_stats_t *out) {
+    if (!out) return;
+    uint64_t flags;
+    spinlock_lock_irqsave(&g_tw.lock, &flags);
+    *out = g_tw.stats;
+    out->clock = g_tw.clk;
+    spinlock_unlock_irqrestore(&g_tw.lock, flags);
+}
+
+// ---------------------------------------------------------------------------
+// Timed sleeps
+// ---------------------------------------------------------------------------
+
+static void halt_wake(void *arg) {
+    (void)arg;
+}
+
+static void halt_until(uint64_t deadline) {
+    uint64_t rflags;
+    __asm__ volatile("pushfq; pop %0" : "=r"(rflags));
+    // Ticks may be stopped: only the timebase CPU can count on an interrupt
+    // at the deadline, and only with a timer of its own in the wheel.
+    int can_hlt = (rflags & (1ULL << 9)) && get_cpu_id() == 0;
+    ktimer_t t;
+    if (can_hlt) {
+        timer_setup(&t, halt_wake, NULL);
+        timer_arm(&t, deadline);
+    }
+    while ((int64_t)(get_system_ticks() - deadline) < 0) {
+        if (can_hlt) __asm__ volatile("hlt" ::: "memory");
+        else cpu_relax();
+    }
+    if (can_hlt) timer_cancel(&t);
+}
+
+// Block until the deadline. Returns 1 when it was reached, 0 when something
+// else (a signal) woke us first.
+static int sleep_timed(uint64_t deadline) {
+    process_t *p = current;
+    // Any unique channel will do; only the timer and signals wake us.
+    scheduler_set_sleeping(p, &p->sleep_ticks);
+    int rc = schedule_until(deadline);
+    scheduler_wait_done(p);
+    return rc != 0;
+}
+
+int sleep_until(uint64_t deadline) {
+    if ((int64_t)(get_system_ticks() - deadline) >= 0) return 0;
+    if (!wait_can_block()) {
+        halt_until(deadline);
+        return 0;
+    }
+    return sleep_timed(deadline) ? 0 : -1;
+}
+
+int sleep_ms(uint64_t ms) {
+    return sleep_until(get_system_ticks() + ms_to_ticks(ms));
+}
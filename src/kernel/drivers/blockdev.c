@@ -39,19 +39,29 @@ int blockdev_get_info(blockdev_handle_t h, blockdev_info_t *out) {
     return e->ops->get_info(e->ctx, out);
 }
 
-int blockdev_read(blockdev_handle_t h, uint64_t lba, uint32_t count, void *buf, size_t buf_sz) {
-    blockdev_entry_t *e = blockdev_get(h);
-    if (!e || !buf) return -1;
-
+/* Common argument checks for read/write/submit. */
+static int blockdev_check(blockdev_entry_t *e, uint64_t lba, uint32_t count, size_t buf_sz, int write) {
     blockdev_info_t info;
     if (e->ops->get_info(e->ctx, &info) != 0) return -2;
     if (info.sector_size == 0) return -3;
 
+    // EROFS-style behavior for read-only devices
+    if (write && (info.flags & BLOCKDEV_F_READONLY)) return -30;
+
     uint64_t need = (uint64_t)count * (uint64_t)info.sector_size;
     if ((uint64_t)buf_sz < need) return -4;
     if (count == 0) return 0;
     if (lba >= info.sector_count) return -5;
     if (lba + count > info.sector_count) return -6;
+    return 0;
+}
+
+int blockdev_read(blockdev_handle_t h, uint64_t lba, uint32_t count, void *buf, size_t buf_sz) {
+    blockdev_entry_t *e = blockdev_get(h);
+    if (!e || !buf) return -1;
+
+    int rc = blockdev_check(e, lba, count, buf_sz, 0);
+    if (rc != 0 || count == 0) return rc;
 
     return e->ops->read(e->ctx, lba, count, buf, buf_sz);
 }
@@ -60,19 +70,44 @@ int blockdev_write(blockdev_handle_t h, uint64_t lba, uint32_t count, const void
     blockdev_entry_t *e = blockdev_get(h);
     if (!e || !buf) return -1;
 
-    blockdev_info_t info;
-    if (e->ops->get_info(e->ctx, &info) != 0) return -2;
-    if (info.sector_size == 0) return -3;
-
-    // EROFS-style behavior for read-only devices
-    if (info.flags & BLOCKDEV_F_READONLY) return -30;
-
-    uint64_t need = (uint64_t)count * (uint64_t)info.sector_size;
-    if ((uint64_t)buf_sz < need) return -4;
-    if (count == 0) return 0;
-    if (lba >= info.sector_count) return -5;
-    if (lba + count > info.sector_count) return -6;
+    int rc = blockdev_check(e, lba, count, buf_sz, 1);
+    if (rc != 0 || count == 0) return rc;
 
     if (!e->ops->write) return -31;
     return e->ops->write(e->ctx, lba, count, buf, buf_sz);
 }
+
+int blockdev_submit(blockdev_handle_t h, blockdev_request_t *req) {
+    blockdev_entry_t *e = blockdev_get(h);
+    if (!e || !req || !req->buf) return -1;
+
+    int rc = blockdev_check(e, req->lba, req->count, req->buf_sz, req->write);
+    if (rc != 0) return rc;
+    if (req->write && !e->ops->write) return -31;
+
+    req->status = BLOCKDEV_REQ_PENDING;
+    req->driver_data = NULL;
+    if (req->count != 0 && e->ops->submit) {
+        rc = e->ops->submit(e->ctx, req);
+        if (rc != 0) req->status = rc;
+        return rc;
+    }
+
+    // No queue: run it now and report completion immediately.
+    if (req->count == 0) rc = 0;
+    else if (req->write) rc = e->ops->write(e->ctx, req->lba, req->count, req->buf, req->buf_sz);
+    else rc = e->ops->read(e->ctx, req->lba, req->count, req->buf, req->buf_sz);
+    if (req->done) req->done(req, rc);
+    req->status = rc;
+    return 0;
+}
+
+int blockdev_complete(blockdev_handle_t h, blockdev_request_t *req) {
+    blockdev_entry_t *e = blockdev_get(h);
+    if (!e || !req) return -1;
+
+    if (e->ops->submit && e->ops->complete && req->count != 0) {
+        return e->ops->complete(e->ctx, req);
+    }
+    return req->status;
+}
@@ -46,10 +46,54 @@ static int vdb_write(void *ctx, uint64_t lba, uint32_t count, const void *buf, s
     return vdrive_write(c->vdrive_id, lba, count, buf);
 }
 
+static void vdb_async_done(vdrive_request_t *vreq, int status) {
+    blockdev_request_t *req = (blockdev_request_t*)vreq->ctx;
+    if (req->done) req->done(req, status);
+    req->status = status;
+}
+
+static int vdb_submit(void *ctx, blockdev_request_t *req) {
+    if (!ctx || !req || !req->buf) return -1;
+    vdrive_block_ctx_t *c = (vdrive_block_ctx_t*)ctx;
+
+    vdrive_request_t *vreq = (vdrive_request_t*)kmalloc(sizeof(vdrive_request_t));
+    if (!vreq) return -1;
+    memset(vreq, 0, sizeof(*vreq));
+    vreq->lba = req->lba;
+    vreq->count = req->count;
+    vreq->buffer = req->buf;
+    vreq->write = req->write;
+    vreq->done = vdb_async_done;
+    vreq->ctx = req;
+
+    int rc = vdrive_submit(c->vdrive_id, vreq);
+    if (rc != VDRIVE_SUCCESS) {
+        kfree(vreq);
+        return rc;
+    }
+    req->driver_data = vreq;
+    return 0;
+}
+
+static int vdb_complete(void *ctx, blockdev_request_t *req) {
+    (void)ctx;
+    if (!req) return -1;
+    vdrive_request_t *vreq = (vdrive_request_t*)req->driver_data;
+    if (!vreq) return req->status;
+
+    int rc = vdrive_complete(vreq);
+    kfree(vreq);
+    req->driver_data = NULL;
+    req->status = rc;
+    return rc;
+}
+
 static const blockdev_ops_t g_vdrive_block_ops = {
     .get_info = vdb_get_info,
     .read = vdb_read,
     .write = vdb_write,
+    .submit = vdb_submit,
+    .complete = vdb_complete,
 };
 
 blockdev_handle_t blockdev_get_vdrive_handle(int vdrive_id) {
@@ -3,11 +3,17 @@
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/interrupts/irq_lock.h"
 #include "moduos/kernel/interrupts/hlt_wait.h"
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/process/waitqueue.h"
 
 // Global event queue
 EventQueue g_event_queue;
 static uint8_t g_modifier_state = MOD_NONE;
 
+// Processes blocked in event_wait(). Each event can only be consumed once, so
+// waiters are exclusive and event_push() wakes one of them.
+static wait_queue_t g_event_wq;
+
 // Current modifier state
 static volatile uint8_t current_modifiers = MOD_NONE;
 
@@ -17,6 +23,7 @@ void event_init(void) {
     g_event_queue.write_index = 0;
     g_event_queue.count = 0;
     current_modifiers = MOD_NONE;
+    wait_queue_init(&g_event_wq);
 }
 
 bool event_push(Event *event) {
@@ -36,6 +43,7 @@ bool event_push(Event *event) {
     g_event_queue.count++;
 
     irq_restore(f);
+    wake_up(&g_event_wq);
     return true;
 }
 
@@ -61,13 +69,20 @@ bool event_poll(Event *out_event) {
 
 Event event_wait(void) {
     Event event;
-    
-    // Wait until an event is available.
-    // Syscalls enter with IF=0 (interrupt gate), so a bare HLT would deadlock.
+
     while (!event_poll(&event)) {
-        hlt_wait_preserve_if();
+        // The boot/idle context cannot sleep. Syscalls enter with IF=0
+        // (interrupt gate), so a bare HLT would deadlock there.
+        if (!wait_can_block()) {
+            hlt_wait_preserve_if();
+            continue;
+        }
+        wait_entry_t we;
+        prepare_to_wait(&g_event_wq, &we, 1);
+        if (!event_pending()) schedule();
+        finish_wait(&g_event_wq, &we);
     }
-    
+
     return event;
 }
 
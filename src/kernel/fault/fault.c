@@ -3,6 +3,7 @@
 #include "moduos/kernel/interrupts/idt.h"
 #include "moduos/drivers/graphics/VGA.h"
 #include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/COM/klog.h"
 // #include "moduos/kernel/process/process.h"  /* process_exit, schedule */  // OLD
 #include "moduos/kernel/process/process.h"
 #include "moduos/kernel/memory/string.h"
@@ -10,6 +11,7 @@
 #include "moduos/kernel/panic.h"
 #include "moduos/kernel/memory/phys.h"
 #include "moduos/kernel/memory/paging.h"
+#include "moduos/kernel/memory/vma.h"
 
 // Debug: last syscall info (from syscall.c)
 extern volatile uint64_t g_last_syscall_num;
@@ -102,6 +104,9 @@ static void format_hex64(uint64_t value, char* buffer) {
 
 // Helper: Log to COM port
 static void log_fault(const char *name, interrupt_frame_t *frame) {
+    /* Nothing may stay buffered in the log ring from here on. */
+    klog_console_sync();
+
     com_write_string(COM1_PORT, "\n[FAULT] ");
     com_write_string(COM1_PORT, name);
     com_write_string(COM1_PORT, "\n");
@@ -527,6 +532,70 @@ void fault_handler_general_protection(uint64_t error_code, interrupt_frame_t *fr
     fault_panic("General Protection Fault", message, frame, "GPF");
 }
 
+/* Locate the 4 KiB PTE for a user page in the address space loaded in CR3. */
+static uint64_t *fault_user_pte_ptr(uint64_t page) {
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    uint64_t *t = (uint64_t *)phys_to_virt_kernel(cr3 & 0x000FFFFFFFFFF000ULL);
+    for (int shift = 39; shift > 12; shift -= 9) {
+        uint64_t e = t[(page >> shift) & 0x1FF];
+        if (!(e & PFLAG_PRESENT) || (e & (1ULL << 7))) return NULL;
+        t = (uint64_t *)phys_to_virt_kernel(e & 0x000FFFFFFFFFF000ULL);
+    }
+    return &t[(page >> 12) & 0x1FF];
+}
+
+/* Resolve a write fault on a PFLAG_COW page. Returns 1 if the PTE is now writable. */
+static int fault_break_cow(uint64_t page) {
+    uint64_t *ptep = fault_user_pte_ptr(page);
+    if (!ptep) return 0;
+    uint64_t pte = *ptep;
+    if (!(pte & PFLAG_PRESENT) || !(pte & PFLAG_USER) || !(pte & PFLAG_COW) || (pte & PFLAG_WRITABLE))
+        return 0;
+
+    uint64_t old_phys = pte & 0x000FFFFFFFFFF000ULL;
+
+    /* Last sharer (the other side exited or exec'd): just take the frame back.
+     * A frame phys.c does not manage is never copied, only shared. */
+    if (phys_ref_get(old_phys) == 1 || !phys_ref_managed(old_phys)) {
+        *ptep = (pte | PFLAG_WRITABLE) & ~(uint64_t)PFLAG_COW;
+        __asm__ volatile("invlpg (%0)" :: "r"(page) : "memory");
+        return 1;
+    }
+
+    uint64_t new_phys = phys_alloc_frame();
+    if (!new_phys) return 0;
+
+    /* The old page is still readable at `page`; only the new frame needs a kernel
+     * mapping. Use the physmap when it reaches, else the paging scratch slot. */
+    int copied = 0;
+    if (new_phys < PAGING_PHYSMAP_LIMIT) {
+        memcpy(phys_to_virt_kernel(new_phys), (const void *)(uintptr_t)page, 4096);
+        copied = 1;
+    } else {
+        uint64_t scratch = paging_get_scratch_base();
+        if (scratch && paging_map_page(scratch, new_phys, PFLAG_PRESENT | PFLAG_WRITABLE) == 0) {
+            memcpy((void *)(uintptr_t)scratch, (const void *)(uintptr_t)page, 4096);
+            copied = 1;
+        }
+        if (scratch) paging_unmap_page(scratch);
+    }
+    if (!copied) {
+        phys_free_frame(new_phys);
+        return 0;
+    }
+
+    // Install new PTE: writable, user, present, clear COW.
+    uint64_t new_pte = (pte & ~0x000FFFFFFFFFF000ULL) | new_phys;
+    new_pte |= PFLAG_WRITABLE;
+    new_pte &= ~(uint64_t)PFLAG_COW;
+    *ptep = new_pte;
+    __asm__ volatile("invlpg (%0)" :: "r"(page) : "memory");
+
+    phys_ref_dec(old_phys);
+    return 1;
+}
+
 void fault_handler_page_fault(uint64_t error_code, interrupt_frame_t *frame) {
     /* Reentrancy guard: if we fault while handling a page fault, stop immediately.
      * For user-mode faults we can still recover by killing the process.
@@ -579,48 +648,34 @@ void fault_handler_page_fault(uint64_t error_code, interrupt_frame_t *frame) {
     uint64_t faulting_address;
     __asm__ volatile("mov %%cr2, %0" : "=r"(faulting_address));
 
-    /* Handle Copy-On-Write write faults for user processes.
-     * Note: This handler runs in CPL0 even for user faults. We must keep it simple.
+    /* Copy-On-Write write faults on user pages. Taken from CPL3 and also from CPL0
+     * when the kernel writes into a user buffer (CR0.WP is set in paging_init()).
      */
-    if ((frame->cs & 3) == 3) {
-        if ((error_code & PF_PRESENT) && (error_code & PF_WRITE)) {
-            uint64_t page = faulting_address & ~0xFFFULL;
-            uint64_t pte = paging_get_pte(page);
-            if ((pte & PFLAG_PRESENT) && (pte & PFLAG_USER) && (pte & PFLAG_COW) && !(pte & PFLAG_WRITABLE)) {
-                uint64_t old_phys = pte & 0xFFFFFFFFFFFFF000ULL;
-                uint64_t new_phys = phys_alloc_frame();
-                if (new_phys) {
-                    // Copy page contents using the paging scratch area.
-                    uint64_t scratch = paging_get_scratch_base();
-                    if (scratch) {
-                        uint64_t scratch2 = scratch + 0x1000ULL;
-                        if (paging_map_page(scratch, new_phys, PFLAG_PRESENT | PFLAG_WRITABLE) == 0 &&
-                            paging_map_page(scratch2, old_phys, PFLAG_PRESENT | PFLAG_WRITABLE) == 0) {
-                            memcpy((void*)(uintptr_t)scratch, (void*)(uintptr_t)scratch2, 4096);
-                            paging_unmap_page(scratch2);
-                            paging_unmap_page(scratch);
-
-                            // Install new PTE: writable, user, present, clear COW.
-                            uint64_t new_pte = (new_phys & 0xFFFFFFFFFFFFF000ULL) | (pte & 0xFFFULL);
-                            new_pte |= PFLAG_WRITABLE;
-                            new_pte &= ~PFLAG_COW;
-                            paging_set_pte(page, new_pte);
-
-                            phys_ref_dec(old_phys);
-                            in_pf = 0;
-                            return;
-                        }
-                        paging_unmap_page(scratch2);
-                        paging_unmap_page(scratch);
-                    }
-                    phys_free_frame(new_phys);
-                }
-            }
+    if ((error_code & PF_PRESENT) && (error_code & PF_WRITE) &&
+        faulting_address < 0x0000800000000000ULL) {
+        if (fault_break_cow(faulting_address & ~0xFFFULL)) {
+            in_pf = 0;
+            return;
         }
-
         // Not a COW fixable fault: continue to stack growth check below
     }
 
+    /* Demand-paged user areas (ELF segments). Filling a page may read the
+     * executable from disk, which sleeps on I/O: drop the reentrancy guard and
+     * re-enable interrupts if the faulting context had them on.
+     */
+    if (!(error_code & PF_PRESENT) && faulting_address < 0x0000800000000000ULL) {
+        process_t *p = process_get_current();
+        if (p && p->vmas) {
+            in_pf = 0;
+            if (frame->rflags & 0x200) __asm__ volatile("sti");
+            int rc = vma_handle_fault(p, faulting_address, (error_code & PF_WRITE) != 0);
+            __asm__ volatile("cli");
+            if (rc == 1) return;
+            in_pf = 1;
+        }
+    }
+
     /* Kernel heap demand paging (fault-handler-safe):
      * For non-present faults in the heap range, allocate a frame and install the missing PTE
      * WITHOUT calling paging_map_page() (which may allocate/zero page tables and fault again).
@@ -1,11 +1,149 @@
 // #include "moduos/kernel/process/process.h"  // OLD
-#include "moduos/kernel/process/process.h"
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/smp.h"
+#include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/arch/AMD64/fpu.h"
 #include <stdint.h>
 
 /* Lazy FPU switching support.
- * We keep track of which process currently owns the live FPU state.
+ * Each CPU tracks which process owns its live FPU state. The owner's registers
+ * are written back when it is switched out, so a process that migrates to
+ * another CPU always finds its saved state in fpu_state.
  */
-static process_t *g_fpu_owner = NULL;
+static process_t *g_fpu_owner[SMP_MAX_CPUS];
+
+enum {
+    FPU_SAVE_FXSAVE = 0,
+    FPU_SAVE_XSAVE,
+    FPU_SAVE_XSAVEC,
+    FPU_SAVE_XSAVEOPT,
+};
+
+static int g_fpu_method = FPU_SAVE_FXSAVE;
+static uint64_t g_xcr0;
+static size_t g_fpu_size = 512;
+static int g_fpu_probed;
+
+static const char *const g_fpu_method_name[] = { "fxsave", "xsave", "xsavec", "xsaveopt" };
+
+static inline void fpu_cpuid(uint32_t leaf, uint32_t sub, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(sub));
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t val) {
+    __asm__ volatile("xsetbv" :: "c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static void fpu_probe(void) {
+    uint32_t a, b, c, d;
+    fpu_cpuid(0, 0, &a, &b, &c, &d);
+    uint32_t max_leaf = a;
+
+    fpu_cpuid(1, 0, &a, &b, &c, &d);
+    int have_xsave = (c >> 26) & 1;
+    int have_avx = (c >> 28) & 1;
+    if (!have_xsave || max_leaf < 0xD) return;
+
+    int have_avx512 = 0;
+    if (max_leaf >= 7) {
+        fpu_cpuid(7, 0, &a, &b, &c, &d);
+        have_avx512 = (b >> 16) & 1;
+    }
+
+    fpu_cpuid(0xD, 0, &a, &b, &c, &d);
+    uint64_t supported = ((uint64_t)d << 32) | a;
+    uint64_t xcr0 = XFEATURE_X87 | XFEATURE_SSE;
+    if (have_avx && (supported & XFEATURE_AVX)) {
+        xcr0 |= XFEATURE_AVX;
+        if (have_avx512 && (supported & XFEATURE_AVX512) == XFEATURE_AVX512)
+            xcr0 |= XFEATURE_AVX512;
+    }
+
+    fpu_cpuid(0xD, 1, &a, &b, &c, &d);
+    if (a & 1)        g_fpu_method = FPU_SAVE_XSAVEOPT;
+    else if (a & 2)   g_fpu_method = FPU_SAVE_XSAVEC;
+    else              g_fpu_method = FPU_SAVE_XSAVE;
+    g_xcr0 = xcr0;
+}
+
+void fpu_init_cpu(void) {
+    int first = !g_fpu_probed;
+    if (first) {
+        fpu_probe();
+        g_fpu_probed = 1;
+    }
+
+    uint64_t cr0, cr4;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~(1ULL << 2);              /* EM */
+    cr0 |= (1ULL << 1);               /* MP: WAIT honours TS too */
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0) : "memory");
+
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= (1ULL << 9) | (1ULL << 10); /* OSFXSR | OSXMMEXCPT */
+    if (g_xcr0) cr4 |= (1ULL << 18);   /* OSXSAVE */
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+
+    if (g_xcr0) xsetbv(0, g_xcr0);
+    __asm__ volatile("fninit");
+
+    if (!first) return;
+    if (g_xcr0) {
+        /* EBX reflects the XCR0 just loaded; the standard layout is never
+         * smaller than the compacted one. */
+        uint32_t a, b, c, d;
+        fpu_cpuid(0xD, 0, &a, &b, &c, &d);
+        g_fpu_size = b;
+    }
+    com_printf(COM1_PORT, "[FPU] xcr0=0x%llx save=%s area=%u bytes\n",
+               (unsigned long long)g_xcr0, g_fpu_method_name[g_fpu_method],
+               (unsigned)g_fpu_size);
+}
+
+size_t fpu_state_size(void) {
+    return g_fpu_size;
+}
+
+void *fpu_state_alloc(void) {
+    uint8_t *buf = (uint8_t *)kmalloc_aligned(g_fpu_size, 64);
+    if (!buf) return NULL;
+    /* A zero XSAVE header restores every component to its init state, but
+     * FCW and MXCSR are taken from the legacy area, so give them their reset
+     * values (all exceptions masked). */
+    memset(buf, 0, g_fpu_size);
+    *(uint16_t *)(buf + 0) = 0x037F;
+    *(uint32_t *)(buf + 24) = 0x1F80;
+    return buf;
+}
+
+/* The save area is addressed through a register: the pointer field itself is
+ * not the buffer. All-ones in EDX:EAX requests every component in XCR0. */
+static inline void fpu_save(void *buf) {
+    switch (g_fpu_method) {
+    case FPU_SAVE_XSAVEOPT:
+        __asm__ volatile("xsaveopt64 (%0)" :: "r"(buf), "a"(0xFFFFFFFFu), "d"(0xFFFFFFFFu) : "memory");
+        break;
+    case FPU_SAVE_XSAVEC:
+        __asm__ volatile("xsavec64 (%0)" :: "r"(buf), "a"(0xFFFFFFFFu), "d"(0xFFFFFFFFu) : "memory");
+        break;
+    case FPU_SAVE_XSAVE:
+        __asm__ volatile("xsave64 (%0)" :: "r"(buf), "a"(0xFFFFFFFFu), "d"(0xFFFFFFFFu) : "memory");
+        break;
+    default:
+        __asm__ volatile("fxsave64 (%0)" :: "r"(buf) : "memory");
+        break;
+    }
+}
+
+static inline void fpu_restore(const void *buf) {
+    if (g_fpu_method != FPU_SAVE_FXSAVE)
+        __asm__ volatile("xrstor64 (%0)" :: "r"(buf), "a"(0xFFFFFFFFu), "d"(0xFFFFFFFFu) : "memory");
+    else
+        __asm__ volatile("fxrstor64 (%0)" :: "r"(buf) : "memory");
+}
 
 static inline void set_ts(void) {
     uint64_t cr0;
@@ -18,7 +156,21 @@ static inline void clear_ts(void) {
     __asm__ volatile("clts" ::: "memory");
 }
 
-void fpu_lazy_on_context_switch(process_t *next) {
+void fpu_lazy_on_context_switch(process_t *prev, process_t *next) {
+    process_t **owner = &g_fpu_owner[get_cpu_id()];
+
+    /* The owner is only ever the process leaving this CPU, so a user prev
+     * that is not the owner went a whole slice without touching the FPU. */
+    if (prev && prev->is_user && prev != *owner) prev->fpu_counter = 0;
+
+    /* Leaving the owner: save its registers before anything else (a kernel
+     * thread's SSE use, or another CPU resuming it) can touch them. */
+    if (*owner && *owner != next) {
+        clear_ts();
+        fpu_save((*owner)->fpu_state);
+        *owner = NULL;
+    }
+
     /* Only use lazy FPU switching for user processes.
      * During kernel boot and in kernel threads, trapping (#NM) is dangerous because
      * many kernel routines (memcpy/printf) may use SSE, and the #NM handler itself
@@ -30,20 +182,35 @@ void fpu_lazy_on_context_switch(process_t *next) {
     }
 
     /* If next is the current owner, allow FPU instructions without trapping. */
-    if (next == g_fpu_owner) {
+    if (next == *owner) {
+        clear_ts();
+    } else if (next->fpu_counter > FPU_EAGER_THRESHOLD) {
+        /* FPU-heavy: it would trap straight away, so restore it now. The
+         * 8-bit counter wraps now and then, giving it a lazy slice again to
+         * notice when it stops using the FPU. */
         clear_ts();
+        fpu_restore(next->fpu_state);
+        *owner = next;
+        next->fpu_counter++;
     } else {
         set_ts();
     }
 }
 
 void fpu_lazy_on_process_exit(process_t *p) {
-    if (p && p == g_fpu_owner) {
-        g_fpu_owner = NULL;
+    process_t **owner = &g_fpu_owner[get_cpu_id()];
+    if (p && p == *owner) {
+        *owner = NULL;
         set_ts();
     }
 }
 
+void fpu_lazy_sync(process_t *p) {
+    uint64_t flags = irq_save();
+    if (p && g_fpu_owner[get_cpu_id()] == p) fpu_save(p->fpu_state);
+    irq_restore(flags);
+}
+
 void fpu_lazy_handle_nm(void) {
     process_t *cur = process_get_current();
     if (!cur || !cur->is_user) {
@@ -55,16 +222,18 @@ void fpu_lazy_handle_nm(void) {
     /* Enable FPU for this task. */
     clear_ts();
 
-    if (cur == g_fpu_owner) {
+    process_t **owner = &g_fpu_owner[get_cpu_id()];
+    if (cur == *owner) {
         return;
     }
 
     /* Save old owner state (if any). */
-    if (g_fpu_owner) {
-        __asm__ volatile("fxsave64 %0" : "=m"(g_fpu_owner->fpu_state));
+    if (*owner) {
+        fpu_save((*owner)->fpu_state);
     }
 
     /* Restore current. */
-    __asm__ volatile("fxrstor64 %0" :: "m"(cur->fpu_state));
-    g_fpu_owner = cur;
+    fpu_restore(cur->fpu_state);
+    *owner = cur;
+    cur->fpu_counter++;
 }
@@ -7,6 +7,8 @@
 #include "moduos/kernel/memory/phys.h"
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/macros.h"
+#include "moduos/kernel/memory/vma.h"
+#include "moduos/kernel/loader/exec_image.h"
 
 /*
  * NOTE:
@@ -252,6 +254,96 @@ int elf_load_with_args(const void *elf_data, size_t size, uint64_t *entry_point,
     return 0;
 }
 
+int elf_map_image(process_t *p, exec_image_t *img, uint64_t *entry_point,
+                  uint64_t *out_image_base, uint64_t *out_image_end) {
+    if (out_image_base) *out_image_base = 0;
+    if (out_image_end) *out_image_end = 0;
+    if (!p || !img || !entry_point) return -1;
+
+    uint64_t size = exec_image_size(img);
+    elf64_ehdr_t ehdr;
+    size_t got = 0;
+    if (size < sizeof(ehdr) || exec_image_read(img, 0, &ehdr, sizeof(ehdr), &got) != 0 || got != sizeof(ehdr)) {
+        COM_LOG_ERROR(COM1_PORT, "ELF too small");
+        return -1;
+    }
+    if (elf_validate(&ehdr) != 0) return -1;
+    if (ehdr.e_phoff == 0 || ehdr.e_phnum == 0) {
+        COM_LOG_ERROR(COM1_PORT, "ELF has no program headers");
+        return -1;
+    }
+    if (ehdr.e_phentsize && ehdr.e_phentsize < sizeof(elf64_phdr_t)) {
+        COM_LOG_ERROR(COM1_PORT, "ELF program header entries too small");
+        return -1;
+    }
+    uint64_t phentsz = (ehdr.e_phentsize ? ehdr.e_phentsize : (uint64_t)sizeof(elf64_phdr_t));
+    uint64_t ph_bytes = (uint64_t)ehdr.e_phnum * phentsz;
+    if (ehdr.e_phoff > size || ph_bytes > size - ehdr.e_phoff) {
+        COM_LOG_ERROR(COM1_PORT, "ELF program header table out of range");
+        return -1;
+    }
+
+    /* Only the program header table is read now; segment contents are
+     * faulted in from the image (and its shared text frames) when touched. */
+    uint8_t *ph = (uint8_t *)kmalloc((size_t)ph_bytes);
+    if (!ph) return -1;
+    if (exec_image_read(img, ehdr.e_phoff, ph, (size_t)ph_bytes, &got) != 0 || got != ph_bytes) {
+        kfree(ph);
+        return -1;
+    }
+
+    uint64_t img_base = 0;
+    uint64_t img_end = 0;
+    int rc = 0;
+    for (int i = 0; i < ehdr.e_phnum; i++) {
+        elf64_phdr_t *phdr = (elf64_phdr_t *)(ph + (uint64_t)i * phentsz);
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) continue;
+
+        if (phdr->p_offset > size || phdr->p_filesz > size - phdr->p_offset) {
+            COM_LOG_ERROR(COM1_PORT, "ELF segment file range out of bounds");
+            rc = -1;
+            break;
+        }
+        if (phdr->p_filesz > phdr->p_memsz || phdr->p_vaddr >= 0x0000800000000000ULL ||
+            phdr->p_memsz > 0x0000800000000000ULL - phdr->p_vaddr) {
+            COM_LOG_ERROR(COM1_PORT, "ELF segment outside user space");
+            rc = -1;
+            break;
+        }
+
+        uint32_t flags = VMA_READ;
+        if (phdr->p_flags & PF_W) flags |= VMA_WRITE;
+        if (phdr->p_flags & PF_X) flags |= VMA_EXEC;
+        if (vma_add_file(p, phdr->p_vaddr, phdr->p_memsz, flags, img, phdr->p_offset, phdr->p_filesz) != 0) {
+            COM_LOG_ERROR(COM1_PORT, "ELF segment overlaps another");
+            rc = -1;
+            break;
+        }
+
+        uint64_t seg_start = phdr->p_vaddr & ~0xFFFULL;
+        uint64_t seg_end = (phdr->p_vaddr + phdr->p_memsz + 0xFFFULL) & ~0xFFFULL;
+        if (img_base == 0 || seg_start < img_base) img_base = seg_start;
+        if (seg_end > img_end) img_end = seg_end;
+
+        com_printf(COM1_PORT, "[ELF] segment %d vaddr=0x%llx filesz=%llu memsz=%llu %c%c%c (demand paged)\n",
+                   i, (unsigned long long)phdr->p_vaddr,
+                   (unsigned long long)phdr->p_filesz, (unsigned long long)phdr->p_memsz,
+                   (flags & VMA_READ) ? 'r' : '-', (flags & VMA_WRITE) ? 'w' : '-',
+                   (flags & VMA_EXEC) ? 'x' : '-');
+    }
+    kfree(ph);
+    if (rc != 0) return -1;
+    if (img_end == 0) {
+        COM_LOG_ERROR(COM1_PORT, "ELF has no loadable segments");
+        return -1;
+    }
+
+    *entry_point = ehdr.e_entry;
+    if (out_image_base) *out_image_base = img_base;
+    if (out_image_end) *out_image_end = img_end;
+    return 0;
+}
+
 int elf_get_interp_path(const void *elf_data, size_t size, char *out, size_t out_size) {
     if (!elf_data || size < sizeof(elf64_ehdr_t) || !out || out_size == 0) return -1;
     if (elf_validate(elf_data) != 0) return -1;
@@ -0,0 +1,181 @@
+#include "moduos/kernel/loader/exec_image.h"
+#include "moduos/fs/pcache.h"
+#include "moduos/kernel/spinlock.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/phys.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/COM/com.h"
+
+/* Fixed table of images under one lock. File I/O never happens with the lock
+ * held: readers go through the page cache, which has its own. The frame
+ * table is sized to the file when the image is created. */
+
+struct exec_image {
+    int in_use;
+    uint32_t refcnt;        /* VMAs (and exec in progress) using the image */
+    int stale;              /* file changed: no new users, freed at refcnt 0 */
+    fs_mount_t *mount;
+    char path[256];
+    fs_file_info_t info;
+    pcache_file_t *pc;      /* NULL: read with fs_read_file_at() */
+    uint64_t npages;
+    uint64_t *frames;       /* shared read-only frame per file page, 0 = not loaded */
+    uint64_t resident;
+    uint64_t last_use;
+};
+
+static spinlock_t g_lock;
+static exec_image_t g_images[EXEC_IMAGE_MAX];
+static uint64_t g_use_counter = 1;
+
+static int exec_image_same_file(const fs_file_info_t *a, const fs_file_info_t *b) {
+    return a->size == b->size && a->cluster == b->cluster && a->is_directory == b->is_directory;
+}
+
+/* Caller holds g_lock. */
+static void exec_image_release_locked(exec_image_t *img) {
+    for (uint64_t i = 0; i < img->npages && img->resident; i++) {
+        if (img->frames[i]) {
+            phys_ref_dec(img->frames[i]);
+            img->frames[i] = 0;
+            img->resident--;
+        }
+    }
+    if (img->frames) kfree(img->frames);
+    if (img->pc) pcache_put(img->pc);
+    memset(img, 0, sizeof(*img));
+}
+
+exec_image_t *exec_image_open(fs_mount_t *mount, const char *path, const fs_file_info_t *info) {
+    if (!mount || !path || !*path || !info || info->is_directory || info->size == 0) return NULL;
+
+    uint64_t npages = ((uint64_t)info->size + 4095) / 4096;
+    uint64_t *frames = (uint64_t *)kzalloc((size_t)npages * sizeof(uint64_t));
+    if (!frames) return NULL;
+
+    spinlock_lock(&g_lock);
+    int free_slot = -1, lru = -1;
+    for (int i = 0; i < EXEC_IMAGE_MAX; i++) {
+        exec_image_t *img = &g_images[i];
+        if (!img->in_use) {
+            if (free_slot < 0) free_slot = i;
+            continue;
+        }
+        if (!img->stale && img->mount == mount && strcmp(img->path, path) == 0) {
+            if (exec_image_same_file(&img->info, info)) {
+                img->refcnt++;
+                img->last_use = g_use_counter++;
+                spinlock_unlock(&g_lock);
+                kfree(frames);
+                return img;
+            }
+            /* Replaced behind our back without an invalidation: retire it. */
+            img->stale = 1;
+            if (img->refcnt == 0) {
+                exec_image_release_locked(img);
+                if (free_slot < 0) free_slot = i;
+            }
+            continue;
+        }
+        if (img->refcnt == 0 && (lru < 0 || img->last_use < g_images[lru].last_use)) lru = i;
+    }
+
+    int slot = free_slot;
+    if (slot < 0 && lru >= 0) {
+        exec_image_release_locked(&g_images[lru]);
+        slot = lru;
+    }
+    if (slot < 0) {
+        spinlock_unlock(&g_lock);
+        kfree(frames);
+        com_printf(COM1_PORT, "[EXECIMG] table full, cannot map %s\n", path);
+        return NULL;
+    }
+
+    exec_image_t *img = &g_images[slot];
+    img->in_use = 1;
+    img->refcnt = 1;
+    img->mount = mount;
+    strncpy(img->path, path, sizeof(img->path) - 1);
+    img->path[sizeof(img->path) - 1] = 0;
+    img->info = *info;
+    img->npages = npages;
+    img->frames = frames;
+    img->last_use = g_use_counter++;
+    spinlock_unlock(&g_lock);
+
+    /* Outside g_lock: pcache_put() is called under it, so the order is
+     * exec_image -> pcache. A failed open just means uncached reads. */
+    pcache_file_t *pc = pcache_open(mount, path, info);
+    spinlock_lock(&g_lock);
+    img->pc = pc;
+    spinlock_unlock(&g_lock);
+    return img;
+}
+
+void exec_image_get(exec_image_t *img) {
+    if (!img) return;
+    spinlock_lock(&g_lock);
+    img->refcnt++;
+    spinlock_unlock(&g_lock);
+}
+
+void exec_image_put(exec_image_t *img) {
+    if (!img) return;
+    spinlock_lock(&g_lock);
+    if (img->refcnt > 0) img->refcnt--;
+    img->last_use = g_use_counter++;
+    if (img->refcnt == 0 && img->stale) exec_image_release_locked(img);
+    spinlock_unlock(&g_lock);
+}
+
+uint64_t exec_image_size(exec_image_t *img) {
+    return img ? (uint64_t)img->info.size : 0;
+}
+
+int exec_image_read(exec_image_t *img, uint64_t offset, void *buf, size_t len, size_t *out) {
+    if (out) *out = 0;
+    if (!img || (!buf && len)) return -1;
+    if (img->pc) return pcache_read(img->pc, offset, buf, len, out);
+
+    uint64_t size = img->info.size;
+    if (offset >= size || len == 0) return 0;
+    if ((uint64_t)len > size - offset) len = (size_t)(size - offset);
+    return fs_read_file_at(img->mount, img->path, &img->info, offset, buf, len, out);
+}
+
+uint64_t exec_image_frame(exec_image_t *img, uint64_t index) {
+    uint64_t phys = 0;
+    spinlock_lock(&g_lock);
+    if (img && index < img->npages && img->frames[index]) {
+        phys = img->frames[index];
+        phys_ref_inc(phys);
+    }
+    spinlock_unlock(&g_lock);
+    return phys;
+}
+
+void exec_image_set_frame(exec_image_t *img, uint64_t index, uint64_t phys) {
+    if (!img || !phys) return;
+    spinlock_lock(&g_lock);
+    /* A retired image no longer matches the file; don't hand its pages out. */
+    if (index < img->npages && !img->frames[index] && !img->stale) {
+        phys_ref_inc(phys);
+        img->frames[index] = phys;
+        img->resident++;
+    }
+    spinlock_unlock(&g_lock);
+}
+
+void exec_image_invalidate(fs_mount_t *mount, const char *path) {
+    if (!mount) return;
+    spinlock_lock(&g_lock);
+    for (int i = 0; i < EXEC_IMAGE_MAX; i++) {
+        exec_image_t *img = &g_images[i];
+        if (!img->in_use || img->stale || img->mount != mount) continue;
+        if (path && strcmp(img->path, path) != 0) continue;
+        img->stale = 1;
+        if (img->refcnt == 0) exec_image_release_locked(img);
+    }
+    spinlock_unlock(&g_lock);
+}
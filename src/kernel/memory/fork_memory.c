@@ -3,6 +3,7 @@
  * Implements copy-on-write (COW) for process forking
  */
 
+#include "moduos/kernel/memory/fork_memory.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/phys.h"
 #include "moduos/kernel/memory/string.h"
@@ -11,69 +12,152 @@
 #ifndef PAGE_SIZE
 #define PAGE_SIZE 4096
 #endif
-#define USER_SPACE_START 0x0000000000400000ULL
-#define USER_SPACE_END   0x00007FFFFFFFF000ULL
+
+#define PTE_ADDR_MASK     0x000FFFFFFFFFF000ULL
+#define PTE_PS            (1ULL << 7)
+#define PTE_NX            (1ULL << 63)
+#define USER_PML4_ENTRIES 256   /* entries 0..255 cover the user half */
+#define PT_ENTRIES        512
+
+static inline uint64_t *table_virt(uint64_t entry) {
+    return (uint64_t *)phys_to_virt_kernel(entry & PTE_ADDR_MASK);
+}
+
+static inline int is_user_entry(uint64_t e) {
+    return (e & (PFLAG_PRESENT | PFLAG_USER)) == (PFLAG_PRESENT | PFLAG_USER);
+}
+
+static uint64_t *alloc_table(uint64_t *slot) {
+    uint64_t phys = phys_alloc_frame_below(PAGING_PT_ALLOC_LIMIT);
+    if (!phys) return NULL;
+    uint64_t *t = (uint64_t *)phys_to_virt_kernel(phys);
+    memset(t, 0, PAGE_SIZE);
+    *slot = phys | PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER;
+    return t;
+}
+
+/* Child-side table behind `slot`. Kernel-only low-half entries (boot identity map)
+ * are replaced with a private table, same as get_or_create_in_pml4() does. */
+static uint64_t *dst_table(uint64_t *slot) {
+    if (is_user_entry(*slot)) return table_virt(*slot);
+    return alloc_table(slot);
+}
+
+/* Turn a 2 MiB user PDE into a PT of 512 small PTEs so it can be shared per 4 KiB
+ * frame (the refcount table and the COW fault path work on 4 KiB frames). */
+static int split_huge_pde(uint64_t *pde) {
+    uint64_t e = *pde;
+    uint64_t base = e & PTE_ADDR_MASK & ~0x1FFFFFULL;
+    uint64_t flags = (e & 0xFFFULL & ~PTE_PS) | (e & PTE_NX);
+
+    uint64_t phys = phys_alloc_frame_below(PAGING_PT_ALLOC_LIMIT);
+    if (!phys) return -1;
+    uint64_t *pt = (uint64_t *)phys_to_virt_kernel(phys);
+    for (int i = 0; i < PT_ENTRIES; i++) {
+        pt[i] = (base + (uint64_t)i * PAGE_SIZE) | flags;
+    }
+    *pde = phys | PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER;
+    return 0;
+}
+
+/* Drop every user mapping and user page-table page below `pml4` (OOM unwind). */
+static void release_user_tables(uint64_t *pml4) {
+    for (int i4 = 0; i4 < USER_PML4_ENTRIES; i4++) {
+        if (!is_user_entry(pml4[i4])) continue;
+        uint64_t *pdpt = table_virt(pml4[i4]);
+        for (int i3 = 0; i3 < PT_ENTRIES; i3++) {
+            if (!is_user_entry(pdpt[i3]) || (pdpt[i3] & PTE_PS)) continue;
+            uint64_t *pd = table_virt(pdpt[i3]);
+            for (int i2 = 0; i2 < PT_ENTRIES; i2++) {
+                if (!is_user_entry(pd[i2]) || (pd[i2] & PTE_PS)) continue;
+                uint64_t *pt = table_virt(pd[i2]);
+                for (int i1 = 0; i1 < PT_ENTRIES; i1++) {
+                    if (pt[i1] & PFLAG_PRESENT) phys_ref_dec(pt[i1] & PTE_ADDR_MASK);
+                }
+                phys_free_frame(pd[i2] & PTE_ADDR_MASK);
+            }
+            phys_free_frame(pdpt[i3] & PTE_ADDR_MASK);
+        }
+        phys_free_frame(pml4[i4] & PTE_ADDR_MASK);
+        pml4[i4] = 0;
+    }
+}
 
 /*
- * Copy all user-space pages from source to destination page directory.
- * This is called during fork() to duplicate the parent's memory.
- * 
- * For now: Simple copy (not COW). Each page is physically copied.
- * TODO: Implement true copy-on-write using PFLAG_COW
+ * Share all user-space pages of src_cr3 with dst_cr3 copy-on-write.
+ *
+ * Only populated page-table levels are visited. Every present user frame gets an
+ * extra reference and is mapped into the child with the same flags; writable
+ * frames lose PFLAG_WRITABLE and gain PFLAG_COW in *both* address spaces, so the
+ * first write from either side takes a #PF that fault.c resolves by copying (or,
+ * when the other side already let go, by simply restoring write access).
+ * PFLAG_SHARED frames (MAP_SHARED) stay writable on both sides, and PROT_NONE
+ * frames (PFLAG_NOACCESS, USER cleared) are carried over as well. Frames phys.c
+ * does not manage (device MMIO, firmware) are mapped as-is without a reference.
  */
-void copy_user_memory(uint64_t src_cr3, uint64_t dst_cr3) {
-    uint64_t scratch_base = paging_get_scratch_base();
-    uint64_t *src_pml4 = (uint64_t *)phys_to_virt_kernel(src_cr3);
-    uint64_t *dst_pml4 = (uint64_t *)phys_to_virt_kernel(dst_cr3);
-    
-    if (!src_pml4 || !dst_pml4 || !scratch_base) {
+int copy_user_memory(uint64_t src_cr3, uint64_t dst_cr3) {
+    uint64_t *src_pml4 = table_virt(src_cr3);
+    uint64_t *dst_pml4 = table_virt(dst_cr3);
+
+    if (!src_pml4 || !dst_pml4) {
         com_write_string(COM1_PORT, "[FORK] copy_user_memory: invalid parameters\n");
-        return;
+        return -1;
     }
-    
-    /* Save current CR3 */
-    uint64_t old_cr3;
-    __asm__ volatile("mov %%cr3, %0" : "=r"(old_cr3));
-    
-    /* Switch to source address space to read pages */
-    paging_switch_cr3(src_cr3);
-    
-    /* Walk through user space and copy mapped pages */
-    for (uint64_t vaddr = USER_SPACE_START; vaddr < USER_SPACE_END; vaddr += PAGE_SIZE) {
-        /* Check if page is mapped in source */
-        uint64_t src_pte = paging_get_pte(vaddr);
-        if (!(src_pte & PFLAG_PRESENT)) {
-            continue;  /* Page not mapped, skip */
-        }
-        
-        /* Get physical address of source page */
-        uint64_t src_phys = paging_virt_to_phys(vaddr);
-        if (!src_phys) {
-            continue;
-        }
-        
-        /* Allocate new physical page for child */
-        uint64_t dst_phys = phys_alloc_frame();
-        if (!dst_phys) {
-            com_write_string(COM1_PORT, "[FORK] copy_user_memory: out of memory\n");
-            break;
-        }
-        
-        /* Copy page data using scratch mapping */
-        void *src_ptr = phys_to_virt_kernel(src_phys);
-        void *dst_ptr = phys_to_virt_kernel(dst_phys);
-        
-        if (src_ptr && dst_ptr) {
-            memcpy(dst_ptr, src_ptr, PAGE_SIZE);
+
+    int rc = 0;
+    for (int i4 = 0; i4 < USER_PML4_ENTRIES && rc == 0; i4++) {
+        if (!is_user_entry(src_pml4[i4])) continue;
+        uint64_t *src_pdpt = table_virt(src_pml4[i4]);
+        uint64_t *dst_pdpt = dst_table(&dst_pml4[i4]);
+        if (!dst_pdpt) { rc = -1; break; }
+
+        for (int i3 = 0; i3 < PT_ENTRIES && rc == 0; i3++) {
+            if (!is_user_entry(src_pdpt[i3])) continue;
+            if (src_pdpt[i3] & PTE_PS) {
+                com_write_string(COM1_PORT, "[FORK] copy_user_memory: skipping 1GiB user page\n");
+                continue;
+            }
+            uint64_t *src_pd = table_virt(src_pdpt[i3]);
+            uint64_t *dst_pd = dst_table(&dst_pdpt[i3]);
+            if (!dst_pd) { rc = -1; break; }
+
+            for (int i2 = 0; i2 < PT_ENTRIES; i2++) {
+                if (!is_user_entry(src_pd[i2])) continue;
+                if ((src_pd[i2] & PTE_PS) && split_huge_pde(&src_pd[i2]) != 0) { rc = -1; break; }
+                uint64_t *src_pt = table_virt(src_pd[i2]);
+                uint64_t *dst_pt = dst_table(&dst_pd[i2]);
+                if (!dst_pt) { rc = -1; break; }
+
+                for (int i1 = 0; i1 < PT_ENTRIES; i1++) {
+                    uint64_t pte = src_pt[i1];
+                    if (!is_user_entry(pte) &&
+                        (pte & (PFLAG_PRESENT | PFLAG_NOACCESS)) != (PFLAG_PRESENT | PFLAG_NOACCESS))
+                        continue;
+                    if (!phys_ref_managed(pte & PTE_ADDR_MASK)) {
+                        dst_pt[i1] = pte;
+                        continue;
+                    }
+                    if ((pte & PFLAG_WRITABLE) && !(pte & PFLAG_SHARED)) {
+                        pte = (pte & ~(uint64_t)PFLAG_WRITABLE) | PFLAG_COW;
+                        src_pt[i1] = pte;
+                    }
+                    phys_ref_inc(pte & PTE_ADDR_MASK);
+                    dst_pt[i1] = pte;
+                }
+            }
         }
-        
-        /* Map the new page in destination address space */
-        paging_switch_cr3(dst_cr3);
-        uint64_t flags = src_pte & 0xFFF;  /* Preserve flags */
-        paging_map_page(vaddr, dst_phys, flags);
-        paging_switch_cr3(src_cr3);
     }
-    
-    /* Restore original CR3 */
-    paging_switch_cr3(old_cr3);
+
+    /* Parent PTEs were write-protected in place: flush its TLB once for the whole walk. */
+    uint64_t cur_cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cur_cr3));
+    if ((cur_cr3 & PTE_ADDR_MASK) == (src_cr3 & PTE_ADDR_MASK)) {
+        __asm__ volatile("mov %0, %%cr3" :: "r"(cur_cr3) : "memory");
+    }
+
+    if (rc != 0) {
+        com_write_string(COM1_PORT, "[FORK] copy_user_memory: out of memory\n");
+        release_user_tables(dst_pml4);
+    }
+    return rc;
 }
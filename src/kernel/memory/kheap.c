@@ -1,6 +1,9 @@
 #include "moduos/kernel/memory/phys.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/memory/kheap.h"
+#include "moduos/kernel/slab.h"
+#include "moduos/kernel/percpu_heap.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/kernel/spinlock.h"
 #include "moduos/kernel/debug.h"
@@ -8,9 +11,11 @@
 #include <stddef.h>
 
 /* --- CONFIGURATION --- */
-#define KHEAP_START 0xFFFF800000000000ULL
-#define KHEAP_MAX   (KHEAP_START + (32 * 1024 * 1024ULL)) /* 32 MiB heap */
+/* KHEAP_START / KHEAP_MAX live in kheap.h (shared with the SLAB allocator). */
 #define KHEAP_PAGE_FLAGS (PFLAG_PRESENT | PFLAG_WRITABLE)
+/* Blocks of at least this many pages get 2MiB-aligned VA and frames so
+ * paging_map_range_huge() can map them with 2MiB pages. */
+#define KHEAP_HUGE_PAGES (PAGING_2M_SIZE / PAGE_SIZE)
 /* Heap debug verbosity:
  * 0: off
  * 1: lightweight (keep existing useful checks)
@@ -210,14 +215,13 @@ static uint64_t find_and_remove_free_block(uint64_t pages) {
     return 0;
 }
 
-/* --- PUBLIC API --- */
-
-void *kmalloc(size_t size) {
-    kheap_lock();
-    if (size == 0) KHEAP_UNLOCK_AND_RETURN_VAL(NULL);
-    size_t total_size = size + sizeof(struct alloc_header);
-    uint64_t pages = (total_size + PAGE_SIZE - 1) / PAGE_SIZE;
+/* --- PAGE BLOCKS --- */
 
+/* Reserve `pages` of heap VA, back them with physically contiguous frames and map them.
+ * Caller must hold the heap lock. Returns the virtual base (0 on failure) and the
+ * physical base via phys_out.
+ */
+static uint64_t kheap_map_block(uint64_t pages, size_t req_size, uint64_t *phys_out) {
     debug_log("Allocating pages: ", pages, 0);
 
     uint64_t virt = find_and_remove_free_block(pages);
@@ -229,8 +233,15 @@ void *kmalloc(size_t size) {
     }
 
     if (!virt) {
-        if (heap_alloc_next + pages * PAGE_SIZE > KHEAP_MAX) {
-            log_oom(size, "Virtual limit reached"); kheap_unlock(); return NULL;
+        uint64_t start = heap_alloc_next;
+        if (pages >= KHEAP_HUGE_PAGES) start = (start + PAGING_2M_SIZE - 1) & ~(PAGING_2M_SIZE - 1);
+        if (start + pages * PAGE_SIZE > KHEAP_MAX) {
+            log_oom(req_size, "Virtual limit reached"); return 0;
+        }
+        /* The alignment gap stays usable for smaller blocks. */
+        if (start != heap_alloc_next) {
+            insert_and_coalesce(heap_alloc_next, (start - heap_alloc_next) / PAGE_SIZE);
+            heap_alloc_next = start;
         }
         debug_log("[KHEAP] bump before heap_alloc_next=", heap_alloc_next, 1);
         virt = heap_alloc_next;
@@ -239,12 +250,9 @@ void *kmalloc(size_t size) {
         used_from_bump = 1;
     }
 
-    if (phys_count_free_frames() < pages) {
-        if (used_from_bump) heap_alloc_next -= pages * PAGE_SIZE;
-        else insert_and_coalesce(virt, pages);
-        log_oom(size, "Phys memory low"); kheap_unlock(); return NULL;
-    }
-
+    /* NOTE: no phys_count_free_frames() pre-check here; it walks the whole frame
+     * bitmap and phys_alloc_contiguous() already reports exhaustion by returning 0.
+     */
 #if (KHEAP_DEBUG >= 2)
     com_write_string(COM1_PORT, "[KHEAP] Alloc phys contiguous pages=");
     {
@@ -252,7 +260,10 @@ void *kmalloc(size_t size) {
         com_write_string(COM1_PORT, "\n");
     }
 #endif
-    uint64_t phys = phys_alloc_contiguous(pages);
+    uint64_t phys = 0;
+    if (pages >= KHEAP_HUGE_PAGES && !(virt & (PAGING_2M_SIZE - 1)))
+        phys = phys_alloc_contiguous_aligned(pages, PAGING_2M_SIZE);
+    if (!phys) phys = phys_alloc_contiguous(pages);
 #if (KHEAP_DEBUG >= 2)
     com_write_string(COM1_PORT, "[KHEAP] phys_base=");
     com_printf(COM1_PORT, "0x%08x%08x\n", (uint32_t)(phys >> 32), (uint32_t)(phys & 0xFFFFFFFFu));
@@ -260,22 +271,24 @@ void *kmalloc(size_t size) {
     if (!phys) { 
         if (used_from_bump) heap_alloc_next -= pages * PAGE_SIZE;
         else insert_and_coalesce(virt, pages);
-        log_oom(size, "Phys fragmentation"); kheap_unlock(); return NULL;
+        log_oom(req_size, "Phys memory low/fragmented"); return 0;
     }
 
 #if (KHEAP_DEBUG >= 2)
     com_write_string(COM1_PORT, "[KHEAP] paging_map_range virt=");
     com_printf(COM1_PORT, "0x%08x%08x size=0x%x\n", (uint32_t)(virt >> 32), (uint32_t)(virt & 0xFFFFFFFFu), (uint32_t)(pages * PAGE_SIZE));
 #endif
-    if (paging_map_range(virt, phys, pages * PAGE_SIZE, KHEAP_PAGE_FLAGS) != 0) {
+    if (paging_map_range_huge(virt, phys, pages * PAGE_SIZE, KHEAP_PAGE_FLAGS) != 0) {
         for (uint64_t i = 0; i < pages; ++i) phys_ref_dec(phys + i * PAGE_SIZE);
         if (used_from_bump) heap_alloc_next -= pages * PAGE_SIZE;
         else insert_and_coalesce(virt, pages);
-        log_oom(size, "Paging failure"); kheap_unlock(); return NULL;
+        log_oom(req_size, "Paging failure"); return 0;
     }
 
+#if (KHEAP_DEBUG >= 2)
     /* Debug: verify every mapped heap page is present AND maps to the expected physical page.
      * If this fails, paging structures are being corrupted or reused.
+     * paging_map_page() already invlpg's each page, so no CR3 reload is needed afterwards.
      */
     for (uint64_t i = 0; i < pages; ++i) {
         uint64_t vaddr = virt + i * PAGE_SIZE;
@@ -302,8 +315,65 @@ void *kmalloc(size_t size) {
             for (;;) { __asm__ volatile("cli; hlt"); }
         }
     }
+#endif
 
-    __asm__ volatile("mov %%cr3, %%rax\n\tmov %%rax, %%cr3" ::: "rax", "memory");
+    *phys_out = phys;
+    return virt;
+}
+
+/* Unmap a page block and return its frames and VA. Called without the heap lock:
+ * the unmap waits for every CPU to drop the old translations, and only then may
+ * the frames and the VA be handed out again. */
+static void kheap_unmap_block(uint64_t virt, uint64_t phys_base, uint64_t pages) {
+    paging_unmap_range(virt, pages * PAGE_SIZE);
+    for (uint64_t i = 0; i < pages; i++) phys_ref_dec(phys_base + i * PAGE_SIZE);
+    kheap_lock();
+    insert_and_coalesce(virt, pages);
+    kheap_unlock();
+}
+
+void *kheap_alloc_pages(size_t pages) {
+    if (pages == 0) return NULL;
+    kheap_lock();
+    uint64_t phys = 0;
+    uint64_t virt = kheap_map_block(pages, pages * PAGE_SIZE, &phys);
+    kheap_unlock();
+    return virt ? (void *)(uintptr_t)virt : NULL;
+}
+
+void kheap_free_pages(void *ptr, size_t pages) {
+    uint64_t virt = (uint64_t)(uintptr_t)ptr;
+    if (!ptr || pages == 0) return;
+    if (virt < KHEAP_START || virt + pages * PAGE_SIZE > KHEAP_MAX || (virt & (PAGE_SIZE - 1))) {
+        com_write_string(COM1_PORT, "[KHEAP] WARNING: kheap_free_pages on bad range\n");
+        return;
+    }
+    /* Blocks come from a single phys_alloc_contiguous() call, so the base is enough. */
+    uint64_t phys = paging_virt_to_phys(virt);
+    if (phys) kheap_unmap_block(virt, phys & ~(PAGE_SIZE - 1), pages);
+}
+
+/* --- PUBLIC API --- */
+
+void *kmalloc(size_t size) {
+    if (size == 0) return NULL;
+
+    /* Small requests are served from the SLAB size classes (through the per-CPU
+     * magazines) instead of burning at least one whole page (plus header) per allocation.
+     */
+    if (size <= SLAB_MAX_SIZE) {
+        void *obj = percpu_kmalloc(size);
+        if (obj) return obj;
+        /* SLAB exhausted or not ready: fall through to the page allocator. */
+    }
+
+    kheap_lock();
+    size_t total_size = size + sizeof(struct alloc_header);
+    uint64_t pages = (total_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uint64_t phys = 0;
+    uint64_t virt = kheap_map_block(pages, size, &phys);
+    if (!virt) KHEAP_UNLOCK_AND_RETURN_VAL(NULL);
 
 #if (KHEAP_DEBUG >= 2)
     com_write_string(COM1_PORT, "[KHEAP] writing header at virt=");
@@ -320,8 +390,7 @@ void *kmalloc(size_t size) {
 }
 
 void kfree(void *ptr) {
-    kheap_lock();
-    if (!ptr) KHEAP_UNLOCK_AND_RETURN();
+    if (!ptr) return;
 
     uint64_t p = (uint64_t)(uintptr_t)ptr;
 
@@ -331,31 +400,37 @@ void kfree(void *ptr) {
         char pb[32]; uint64_to_hex(p, pb, sizeof(pb));
         com_write_string(COM1_PORT, pb);
         com_write_string(COM1_PORT, "\n");
-        KHEAP_UNLOCK_AND_RETURN();
+        return;
     }
 
     /* Handle kmalloc_aligned() pointers first.
      * The aligned prefix lives immediately before the pointer.
-     * 
-     * Must unlock before recursive kfree to avoid deadlock!
+     * The raw pointer must precede ptr inside the heap; this rejects stray magic
+     * values found in a neighbouring SLAB object.
      */
     {
         uint64_t prefix_addr = p - sizeof(struct aligned_prefix);
         if (prefix_addr >= KHEAP_START) {
             if (paging_virt_to_phys(prefix_addr) != 0) {
                 struct aligned_prefix *ap = (struct aligned_prefix *)(uintptr_t)prefix_addr;
-                if (ap->magic == ALIGNED_MAGIC && ap->raw) {
+                uint64_t raw_addr = (uint64_t)(uintptr_t)ap->raw;
+                if (ap->magic == ALIGNED_MAGIC && raw_addr >= KHEAP_START && raw_addr <= prefix_addr) {
                     void *raw = ap->raw;
                     ap->magic = 0;
                     ap->raw = NULL;
-                    kheap_unlock();  /* UNLOCK before recursive call! */
-                    kfree(raw);      /* This will reacquire the lock */
+                    kfree(raw);
                     return;
                 }
             }
         }
     }
 
+    /* Small objects go back to this CPU's magazine or their SLAB cache (never our lock). */
+    if (percpu_try_free(ptr)) return;
+    if (slab_try_free(ptr)) return;
+
+    kheap_lock();
+
     /* Normal kmalloc() pointer: header is located immediately before returned pointer. */
     uint64_t hdr_addr = p - sizeof(struct alloc_header);
     if (hdr_addr < KHEAP_START) {
@@ -423,17 +498,16 @@ void kfree(void *ptr) {
     uint64_t virt = (uint64_t)(uintptr_t)hdr;
 
     hdr->magic = FREED_MAGIC;
-
-    for (uint64_t i = 0; i < pages; i++) phys_ref_dec(phys_base + i * PAGE_SIZE);
-    for (uint64_t i = 0; i < pages; i++) paging_unmap_page(virt + i * PAGE_SIZE);
-    insert_and_coalesce(virt, pages);
     kheap_unlock();
+
+    kheap_unmap_block(virt, phys_base, pages);
 }
 
 
 /* Initialize kernel heap - MUST be called during boot */
 void kheap_init(void) {
     spinlock_init(&kheap_spinlock);
+    slab_init();
 }
 
 void *kmalloc_aligned(size_t size, size_t alignment) {
@@ -473,4 +547,5 @@ void kheap_stats(void) {
     com_write_string(COM1_PORT, "Allocs: "); uint64_to_dec(total_allocations, buf, sizeof(buf)); com_write_string(COM1_PORT, buf);
     com_write_string(COM1_PORT, " | OOM: "); uint64_to_dec(failed_allocations, buf, sizeof(buf)); com_write_string(COM1_PORT, buf);
     com_write_string(COM1_PORT, "\n--------------------\n");
+    slab_dump_stats();
 }
\ No newline at end of file
@@ -0,0 +1,331 @@
+// memops.c - CPUID-dispatched memcpy/memset/memmove/memcmp
+//
+// The hot entry points live here (not in string.c) so the variant selection,
+// the non-temporal bulk paths and the boot microbenchmark stay together.
+// Until memops_init() runs, everything uses the portable word-at-a-time code.
+
+#include "moduos/kernel/memory/memops.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/memory/kheap.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+#include "moduos/kernel/COM/com.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Unaligned 64-bit access that the compiler may not assume is aligned or non-aliasing. */
+typedef uint64_t __attribute__((may_alias, aligned(1))) memops_u64_t;
+
+typedef void (*memops_copy_fn)(void *dest, const void *src, size_t n);
+typedef void (*memops_fill_fn)(void *dest, uint8_t val, size_t n);
+
+/**********************************************************************
+ * WORD-AT-A-TIME (portable fallback)
+ **********************************************************************/
+
+static void copy_words(void *dest, const void *src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+    while (n && ((uintptr_t)d & 7)) { *d++ = *s++; n--; }
+    for (; n >= 32; n -= 32, d += 32, s += 32) {
+        ((memops_u64_t *)d)[0] = ((const memops_u64_t *)s)[0];
+        ((memops_u64_t *)d)[1] = ((const memops_u64_t *)s)[1];
+        ((memops_u64_t *)d)[2] = ((const memops_u64_t *)s)[2];
+        ((memops_u64_t *)d)[3] = ((const memops_u64_t *)s)[3];
+    }
+    for (; n >= 8; n -= 8, d += 8, s += 8) {
+        *(memops_u64_t *)d = *(const memops_u64_t *)s;
+    }
+    while (n--) *d++ = *s++;
+}
+
+static void fill_words(void *dest, uint8_t val, size_t n) {
+    uint8_t *d = dest;
+    uint64_t pat = 0x0101010101010101ULL * val;
+
+    while (n && ((uintptr_t)d & 7)) { *d++ = val; n--; }
+    for (; n >= 32; n -= 32, d += 32) {
+        ((memops_u64_t *)d)[0] = pat;
+        ((memops_u64_t *)d)[1] = pat;
+        ((memops_u64_t *)d)[2] = pat;
+        ((memops_u64_t *)d)[3] = pat;
+    }
+    for (; n >= 8; n -= 8, d += 8) *(memops_u64_t *)d = pat;
+    while (n--) *d++ = val;
+}
+
+/* Overlapping move with dest > src: copy from the end, a word at a time. Each
+ * 8-byte load completes before the store, and the loaded bytes lie below every
+ * byte already written, so this is safe for any overlap distance. */
+static void move_backward(uint8_t *d, const uint8_t *s, size_t n) {
+    d += n;
+    s += n;
+    while (n && ((uintptr_t)d & 7)) { *--d = *--s; n--; }
+    for (; n >= 8; n -= 8) {
+        d -= 8;
+        s -= 8;
+        *(memops_u64_t *)d = *(const memops_u64_t *)s;
+    }
+    while (n--) *--d = *--s;
+}
+
+/**********************************************************************
+ * ERMS / FSRM (rep movsb / rep stosb)
+ **********************************************************************/
+
+static void copy_erms(void *dest, const void *src, size_t n) {
+    __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+static void fill_erms(void *dest, uint8_t val, size_t n) {
+    __asm__ volatile("rep stosb" : "+D"(dest), "+c"(n) : "a"(val) : "memory");
+}
+
+/**********************************************************************
+ * NON-TEMPORAL BULK PATHS
+ * dest 64-byte aligned, n a non-zero multiple of 64; src may be unaligned.
+ *
+ * movnti streams from general-purpose registers, so these never touch the
+ * lazily switched user FPU/SSE state and are safe in fault and IRQ context.
+ **********************************************************************/
+
+static void copy_nt(void *dest, const void *src, size_t n) {
+    __asm__ volatile(
+        "1:\n\t"
+        "mov     0(%1), %%r8\n\t"
+        "mov     8(%1), %%r9\n\t"
+        "mov    16(%1), %%r10\n\t"
+        "mov    24(%1), %%r11\n\t"
+        "movnti %%r8,   0(%0)\n\t"
+        "movnti %%r9,   8(%0)\n\t"
+        "movnti %%r10, 16(%0)\n\t"
+        "movnti %%r11, 24(%0)\n\t"
+        "mov    32(%1), %%r8\n\t"
+        "mov    40(%1), %%r9\n\t"
+        "mov    48(%1), %%r10\n\t"
+        "mov    56(%1), %%r11\n\t"
+        "movnti %%r8,  32(%0)\n\t"
+        "movnti %%r9,  40(%0)\n\t"
+        "movnti %%r10, 48(%0)\n\t"
+        "movnti %%r11, 56(%0)\n\t"
+        "add $64, %0\n\t"
+        "add $64, %1\n\t"
+        "sub $64, %2\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : "+r"(dest), "+r"(src), "+r"(n)
+        :
+        : "r8", "r9", "r10", "r11", "memory", "cc");
+}
+
+static void fill_nt(void *dest, uint8_t val, size_t n) {
+    uint64_t pat = 0x0101010101010101ULL * val;
+    __asm__ volatile(
+        "1:\n\t"
+        "movnti %2,  0(%0)\n\t"
+        "movnti %2,  8(%0)\n\t"
+        "movnti %2, 16(%0)\n\t"
+        "movnti %2, 24(%0)\n\t"
+        "movnti %2, 32(%0)\n\t"
+        "movnti %2, 40(%0)\n\t"
+        "movnti %2, 48(%0)\n\t"
+        "movnti %2, 56(%0)\n\t"
+        "add $64, %0\n\t"
+        "sub $64, %1\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : "+r"(dest), "+r"(n)
+        : "r"(pat)
+        : "memory", "cc");
+}
+
+/**********************************************************************
+ * DISPATCH
+ **********************************************************************/
+
+static memops_copy_fn g_copy = copy_words;
+static memops_fill_fn g_fill = fill_words;
+static memops_copy_fn g_copy_nt = NULL;
+static memops_fill_fn g_fill_nt = NULL;
+
+static int g_have_erms = 0;
+static int g_have_fsrm = 0;
+
+static inline void memops_cpuid(uint32_t leaf, uint32_t sub, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(sub));
+}
+
+void memops_init(void) {
+    uint32_t a, b, c, d;
+    memops_cpuid(0, 0, &a, &b, &c, &d);
+    uint32_t max_leaf = a;
+
+    memops_cpuid(1, 0, &a, &b, &c, &d);
+    int have_sse2 = (d >> 26) & 1;   /* movnti */
+
+    if (max_leaf >= 7) {
+        memops_cpuid(7, 0, &a, &b, &c, &d);
+        g_have_erms = (b >> 9) & 1;
+        g_have_fsrm = (d >> 4) & 1;
+    }
+
+    if (g_have_erms || g_have_fsrm) {
+        g_copy = copy_erms;
+        g_fill = fill_erms;
+    }
+    if (have_sse2) {
+        g_copy_nt = copy_nt;
+        g_fill_nt = fill_nt;
+    }
+
+    com_printf(COM1_PORT, "[MEMOPS] erms=%u fsrm=%u -> copy=%s bulk=%s\n",
+               (unsigned)g_have_erms, (unsigned)g_have_fsrm,
+               g_copy == copy_erms ? "erms" : "words",
+               g_copy_nt ? "movnti" : "none");
+}
+
+void *memcpy(void *dest, const void *src, size_t len) {
+    if (len >= MEMOPS_NT_THRESHOLD && g_copy_nt) {
+        uint8_t *d = dest;
+        const uint8_t *s = src;
+        size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+        g_copy(d, s, head);
+        d += head; s += head; len -= head;
+
+        size_t bulk = len & ~(size_t)63;
+        g_copy_nt(d, s, bulk);
+        g_copy(d + bulk, s + bulk, len - bulk);
+        return dest;
+    }
+    g_copy(dest, src, len);
+    return dest;
+}
+
+void *memset(void *dest, int val, size_t len) {
+    if (len >= MEMOPS_NT_THRESHOLD && g_fill_nt) {
+        uint8_t *d = dest;
+        size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+        g_fill(d, (uint8_t)val, head);
+        d += head; len -= head;
+
+        size_t bulk = len & ~(size_t)63;
+        g_fill_nt(d, (uint8_t)val, bulk);
+        g_fill(d + bulk, (uint8_t)val, len - bulk);
+        return dest;
+    }
+    g_fill(dest, (uint8_t)val, len);
+    return dest;
+}
+
+// memmove - handles overlapping memory regions
+//
+// NOTE: This is performance-critical for framebuffer scrolling (multi-megabyte moves).
+// Forward moves (dest below src, or no overlap) take the memcpy paths, which all copy
+// front to back and never store ahead of an unread source byte.
+void *memmove(void *dest, const void *src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    if (d == s || n == 0) return dest;
+
+    if (d < s || d >= s + n) return memcpy(dest, src, n);
+
+    move_backward(d, s, n);
+    return dest;
+}
+
+int memcmp(const void *s1, const void *s2, size_t n) {
+    const uint8_t *p1 = s1;
+    const uint8_t *p2 = s2;
+
+    /* Skip equal words; the first differing word is resolved bytewise below. */
+    for (; n >= 8; n -= 8, p1 += 8, p2 += 8) {
+        if (*(const memops_u64_t *)p1 != *(const memops_u64_t *)p2) break;
+    }
+    while (n--) {
+        if (*p1 != *p2) {
+            return *p1 - *p2;
+        }
+        ++p1;
+        ++p2;
+    }
+    return 0;
+}
+
+/**********************************************************************
+ * BOOT MICROBENCHMARK
+ **********************************************************************/
+
+#if MEMOPS_BOOT_BENCH
+
+#define MEMOPS_BENCH_BYTES (1024 * 1024)
+#define MEMOPS_BENCH_MS    20
+
+static int bench_wait_tick(uint64_t *out) {
+    uint64_t t0 = get_system_ticks();
+    for (uint32_t spin = 0; spin < 200000000u; spin++) {
+        uint64_t t1 = get_system_ticks();
+        if (t1 != t0) { *out = t1; return 0; }
+        __asm__ volatile("pause");
+    }
+    return -1;
+}
+
+/* Run one variant for MEMOPS_BENCH_MS and log its throughput. */
+static int bench_run(const char *op, const char *name, memops_copy_fn copy, memops_fill_fn fill,
+                     void *dst, const void *src) {
+    uint64_t start, now;
+    if (bench_wait_tick(&start) != 0) return -1;
+
+    uint64_t bytes = 0;
+    do {
+        if (copy) copy(dst, src, MEMOPS_BENCH_BYTES);
+        else fill(dst, 0x5A, MEMOPS_BENCH_BYTES);
+        bytes += MEMOPS_BENCH_BYTES;
+        now = get_system_ticks();
+    } while (ticks_to_ms(now - start) < MEMOPS_BENCH_MS);
+
+    uint64_t ms = ticks_to_ms(now - start);
+    if (ms == 0) ms = 1;
+    /* 1 GB/s == 1e6 bytes per ms; keep two decimals. */
+    uint64_t centi = bytes / (ms * 10000ULL);
+    com_printf(COM1_PORT, "[MEMOPS] %s %s: %u.%u%u GB/s\n", op, name,
+               (unsigned)(centi / 100), (unsigned)((centi / 10) % 10), (unsigned)(centi % 10));
+    return 0;
+}
+
+void memops_boot_benchmark(void) {
+    size_t pages = MEMOPS_BENCH_BYTES / 4096;
+    uint8_t *src = kheap_alloc_pages(pages);
+    uint8_t *dst = kheap_alloc_pages(pages);
+    if (!src || !dst) {
+        com_write_string(COM1_PORT, "[MEMOPS] benchmark skipped: no memory\n");
+        goto out;
+    }
+    fill_words(src, 0xA5, MEMOPS_BENCH_BYTES);
+
+    if (bench_run("memcpy", "words", copy_words, NULL, dst, src) != 0) {
+        com_write_string(COM1_PORT, "[MEMOPS] benchmark skipped: timer not ticking\n");
+        goto out;
+    }
+    if (g_have_erms || g_have_fsrm) bench_run("memcpy", "erms", copy_erms, NULL, dst, src);
+    bench_run("memcpy", "movnti", copy_nt, NULL, dst, src);
+
+    bench_run("memset", "words", NULL, fill_words, dst, NULL);
+    if (g_have_erms || g_have_fsrm) bench_run("memset", "erms", NULL, fill_erms, dst, NULL);
+    bench_run("memset", "movnti", NULL, fill_nt, dst, NULL);
+
+    com_printf(COM1_PORT, "[MEMOPS] selected: <%u KiB %s, >=%u KiB %s\n",
+               (unsigned)(MEMOPS_NT_THRESHOLD / 1024), g_copy == copy_erms ? "erms" : "words",
+               (unsigned)(MEMOPS_NT_THRESHOLD / 1024),
+               g_copy_nt ? "movnti" : "words");
+out:
+    if (src) kheap_free_pages(src, pages);
+    if (dst) kheap_free_pages(dst, pages);
+}
+
+#else
+
+void memops_boot_benchmark(void) {
+}
+
+#endif /* MEMOPS_BOOT_BENCH */
@@ -2,6 +2,7 @@
 #include "moduos/kernel/memory/memory.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/phys.h"
+#include "moduos/kernel/memory/kheap.h"
 #include "moduos/kernel/COM/com.h"
 #include "moduos/kernel/multiboot2.h"
 #include "moduos/drivers/graphics/VGA.h"
@@ -27,6 +28,9 @@ void memory_system_init(void *mb2)
     com_write_string(COM1_PORT, "[MEM] Step 3: Initializing paging system (copying bootloader mappings)...\n");
     paging_init();
 
+    /* Heap lock + SLAB size classes; must precede the first kmalloc(). */
+    kheap_init();
+
     // Graphics init deferred to GPU drivers; stay in VGA text mode.
     {
         com_write_string(COM1_PORT, "[FB] Multiboot framebuffer disabled; using VGA text until GPU drivers init\n");
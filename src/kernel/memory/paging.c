@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/smp.h"
 
 /* SMP Safety: Track whether SMP has started */
 static int paging_smp_started = 0;
@@ -29,9 +30,14 @@ void paging_set_smp_started(void) {
 #define VGA_TEXT_BUFFER 0xB8000ULL
 #define VGA_TEXT_SIZE   0x1000ULL  /* 4KB */
 
+/* Boot PML4. Only used to find free kernel slots; paging_map_page() and friends
+ * work on whatever the calling CPU's CR3 points at (active_pml4()). */
 static uint64_t *pml4 = NULL;       /* virtual pointer (via phys_to_virt) to PML4 */
 static uint64_t pml4_phys = 0;      /* physical address of PML4 */
 
+/* Translations at or above this are kernel mappings shared by every address space. */
+#define KERNEL_HALF_BASE 0xFFFF800000000000ULL
+
 /* Master kernel CR3 - set during boot and used as reference for copying kernel mappings */
 static uint64_t kernel_master_cr3 = 0;
 
@@ -66,16 +72,9 @@ void *phys_to_virt_kernel(uint64_t phys) {
 }
 
 /*
- * Page-table pages must be accessible immediately (we memset() them).
- * This kernel currently identity-maps only the first ~512MB early on.
- * So we must allocate paging structures from low physical memory.
+ * Page-table pages must be accessible immediately (we memset() them), so they
+ * come from below PAGING_PT_ALLOC_LIMIT (see paging.h).
  */
-#ifndef PAGING_PT_ALLOC_LIMIT
-// IMPORTANT: page-table pages must be allocated from memory that is *already* accessible
-// when we memset() them. During early identity mapping we cannot assume all <512MB is
-// already mapped, so keep this very low.
-#define PAGING_PT_ALLOC_LIMIT 0x04000000ULL /* 64MB */
-#endif
 
 static uint64_t *alloc_pt_page(void) {
     // Page tables must be allocated from *already identity-mapped* physical memory.
@@ -94,20 +93,32 @@ static uint64_t *alloc_pt_page(void) {
     return (uint64_t *)v;
 }
 
-uint64_t *paging_get_pml4(void) {
-    return (uint64_t *)pml4;
+uint64_t paging_get_pml4_phys(void) {
+    if (!pml4) return 0;
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3 & 0x000FFFFFFFFFF000ULL;
 }
 
-uint64_t paging_get_pml4_phys(void) {
-    return pml4_phys;
+/* The calling CPU's address space. Read from CR3 every time, so a process
+ * running on another CPU is never modified by mistake. */
+static uint64_t *active_pml4(void) {
+    return (uint64_t *)phys_to_virt(paging_get_pml4_phys());
+}
+
+uint64_t *paging_get_pml4(void) {
+    return active_pml4();
 }
 
 void paging_switch_cr3(uint64_t new_cr3_phys) {
     if (!new_cr3_phys) return;
     __asm__ volatile("mov %0, %%cr3" :: "r"(new_cr3_phys) : "memory");
-    /* Keep paging.c internal state in sync with the active address space */
-    pml4_phys = new_cr3_phys & 0xFFFFFFFFFFFFF000ULL;
-    pml4 = (uint64_t*)phys_to_virt(pml4_phys);
+}
+
+/* The local invlpg done by the caller only covers this CPU; kernel mappings
+ * may also be cached by every other one. */
+static void kernel_tlb_shootdown(uint64_t virt, uint64_t size) {
+    if (virt >= KERNEL_HALF_BASE) smp_tlb_shootdown(virt, virt + size);
 }
 
 static void format_hex64(char *buf, uint64_t v) {
@@ -175,6 +186,13 @@ void paging_init(void) {
      * leading to immediate crashes on iretq after faults (GPF/triple fault).
      */
     paging_reserve_bootloader_tables();
+
+    /* Make ring 0 honour read-only PTEs as well (CR0.WP). Without it, kernel writes
+     * into user buffers would silently land on frames shared copy-on-write after fork(). */
+    uint64_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= (1ULL << 16);
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0) : "memory");
 }
 
 /* Walk current page tables and reserve every paging-structure page (PML4/PDPT/PD/PT)
@@ -284,10 +302,19 @@ static uint64_t *get_or_create(uint64_t *table, unsigned idx) {
     }
 }
 
-int paging_map_page(uint64_t virt, uint64_t phys, uint64_t flags) {
-    if (!pml4) paging_init();
-    if (!pml4) return -1;
+static uint64_t *get_or_create_in_pml4(uint64_t *pml4_virt, unsigned idx4);
 
+/* PDPT under root[i4] for a new mapping. In a process PML4 (own_user) a user
+ * mapping gets a private PDPT in place of an inherited kernel-only one, as in
+ * paging_map_range_to_pml4(). */
+static uint64_t *pml4_slot(uint64_t *root, unsigned i4, uint64_t flags, int own_user) {
+    uint64_t *pdpt = (own_user && (flags & PFLAG_USER)) ? get_or_create_in_pml4(root, i4)
+                                                        : get_or_create(root, i4);
+    if (pdpt && (flags & PFLAG_USER)) root[i4] |= PFLAG_USER;
+    return pdpt;
+}
+
+static int map_page_in(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t flags, int own_user) {
     // Per-page map logging is extremely expensive on QEMU serial; keep it only for very verbose debugging.
     if (kernel_debug_get_level() >= KDBG_ON) {
         com_write_string(COM1_PORT, "[PAGING] map_page virt=");
@@ -305,17 +332,13 @@ int paging_map_page(uint64_t virt, uint64_t phys, uint64_t flags) {
     unsigned i2 = (virt >> 21) & 0x1FF;
     unsigned i1 = (virt >> 12) & 0x1FF;
 
-    uint64_t *pdpt = get_or_create(pml4, i4);
+    /* If mapping a user page, all paging levels must have the USER bit set. */
+    uint64_t *pdpt = pml4_slot(root, i4, flags, own_user);
     if (!pdpt) {
         /* If PML4 entry is huge (shouldn't happen), fail. */
         return -1;
     }
 
-    /* If mapping a user page, all paging levels must have the USER bit set. */
-    if (flags & PFLAG_USER) {
-        pml4[i4] |= PFLAG_USER;
-    }
-
     /* Split 1GB huge page at PDPT level if present */
     uint64_t ent3 = pdpt[i3];
     if ((ent3 & PFLAG_PRESENT) && (ent3 & (1ULL << 7))) {
@@ -374,15 +397,26 @@ int paging_map_page(uint64_t virt, uint64_t phys, uint64_t flags) {
     return 0;
 }
 
-int paging_unmap_page(uint64_t virt) {
+int paging_map_page(uint64_t virt, uint64_t phys, uint64_t flags) {
+    if (!pml4) paging_init();
     if (!pml4) return -1;
+    return map_page_in(active_pml4(), virt, phys, flags, 0);
+}
+
+int paging_map_page_in_pml4(uint64_t *pml4_virt, uint64_t virt, uint64_t phys, uint64_t flags) {
+    if (!pml4_virt) return -1;
+    return map_page_in(pml4_virt, virt, phys, flags, 1);
+}
+
+static int split_2m_in(uint64_t *root, uint64_t virt);
 
+static int unmap_page_in(uint64_t *root, uint64_t virt) {
     unsigned i4 = (virt >> 39) & 0x1FF;
     unsigned i3 = (virt >> 30) & 0x1FF;
     unsigned i2 = (virt >> 21) & 0x1FF;
     unsigned i1 = (virt >> 12) & 0x1FF;
 
-    uint64_t ent4 = pml4[i4];
+    uint64_t ent4 = root[i4];
     if (!(ent4 & PFLAG_PRESENT)) return -1;
     uint64_t *pdpt = (uint64_t *)phys_to_virt(ent4 & PAGE_MASK);
     if (!pdpt) return -1;
@@ -404,8 +438,9 @@ int paging_unmap_page(uint64_t virt) {
     
     /*Check for 2MiB huge page */
     if (ent2 & (1ULL << 7)) {
-        /* Cannot unmap single 4K page from 2MiB huge page */
-        return -1;
+        /* Unmapping one 4K page out of a 2MiB page (partial munmap): split it first. */
+        if (split_2m_in(root, virt) != 0) return -1;
+        ent2 = pd[i2];
     }
     
     uint64_t *pt = (uint64_t *)phys_to_virt(ent2 & PAGE_MASK);
@@ -416,10 +451,19 @@ int paging_unmap_page(uint64_t virt) {
     return 0;
 }
 
-int paging_map_2m_page(uint64_t virt, uint64_t phys, uint64_t flags) {
-    if (!pml4) paging_init();
+int paging_unmap_page(uint64_t virt) {
     if (!pml4) return -1;
+    int rc = unmap_page_in(active_pml4(), virt);
+    if (rc == 0) kernel_tlb_shootdown(virt & PAGE_MASK, PAGE_SIZE);
+    return rc;
+}
+
+int paging_unmap_page_in_pml4(uint64_t *pml4_virt, uint64_t virt) {
+    if (!pml4_virt) return -1;
+    return unmap_page_in(pml4_virt, virt);
+}
 
+static int map_2m_in(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t flags, int own_user) {
     // Require 2MB alignment
     if ((virt & 0x1FFFFFULL) || (phys & 0x1FFFFFULL)) return -1;
 
@@ -427,7 +471,7 @@ int paging_map_2m_page(uint64_t virt, uint64_t phys, uint64_t flags) {
     unsigned i3 = (virt >> 30) & 0x1FF;
     unsigned i2 = (virt >> 21) & 0x1FF;
 
-    uint64_t *pdpt = get_or_create(pml4, i4);
+    uint64_t *pdpt = pml4_slot(root, i4, flags, own_user);
     if (!pdpt) return -1;
 
     // If PDPT entry is a 1GB huge page, split it into a PD of 2MB huge pages
@@ -450,6 +494,7 @@ int paging_map_2m_page(uint64_t virt, uint64_t phys, uint64_t flags) {
 
     uint64_t *pd = get_or_create(pdpt, i3);
     if (!pd) return -1;
+    if (flags & PFLAG_USER) pdpt[i3] |= PFLAG_USER;
 
     // If PD entry is already a table (4KB pages), don't overwrite it.
     // If it's already a huge page, also leave it.
@@ -475,6 +520,17 @@ int paging_map_2m_page(uint64_t virt, uint64_t phys, uint64_t flags) {
     return 0;
 }
 
+int paging_map_2m_page(uint64_t virt, uint64_t phys, uint64_t flags) {
+    if (!pml4) paging_init();
+    if (!pml4) return -1;
+    return map_2m_in(active_pml4(), virt, phys, flags, 0);
+}
+
+int paging_map_2m_page_in_pml4(uint64_t *pml4_virt, uint64_t virt, uint64_t phys, uint64_t flags) {
+    if (!pml4_virt) return -1;
+    return map_2m_in(pml4_virt, virt, phys, flags, 1);
+}
+
 int paging_map_2m_range(uint64_t virt_base, uint64_t phys_base, uint64_t size, uint64_t flags) {
     const uint64_t huge_sz = 2ULL * 1024 * 1024;
     if ((virt_base & (huge_sz - 1)) || (phys_base & (huge_sz - 1))) return -1;
@@ -488,6 +544,128 @@ int paging_map_2m_range(uint64_t virt_base, uint64_t phys_base, uint64_t size, u
     return 0;
 }
 
+int paging_map_range_huge(uint64_t virt_base, uint64_t phys_base, uint64_t size, uint64_t flags) {
+    const uint64_t huge_sz = PAGING_2M_SIZE;
+    uint64_t end = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    uint64_t off = 0;
+    while (off < end) {
+        uint64_t vaddr = virt_base + off;
+        uint64_t paddr = phys_base + off;
+        if (!(vaddr & (huge_sz - 1)) && !(paddr & (huge_sz - 1)) && end - off >= huge_sz &&
+            paging_2m_slot_free(vaddr) && paging_map_2m_page(vaddr, paddr, flags) == 0) {
+            off += huge_sz;
+            continue;
+        }
+        if (paging_map_page(vaddr, paddr, flags) != 0) return -1;
+        off += PAGE_SIZE;
+    }
+    return 0;
+}
+
+/* PD entry for virt under root, or NULL if there is no PD (or a 1GiB page). */
+static uint64_t *pde_ptr(uint64_t *root, uint64_t virt) {
+    if (!root) return NULL;
+    uint64_t ent4 = root[(virt >> 39) & 0x1FF];
+    if (!(ent4 & PFLAG_PRESENT)) return NULL;
+    uint64_t *pdpt = (uint64_t *)phys_to_virt(ent4 & PAGE_MASK);
+    if (!pdpt) return NULL;
+    uint64_t ent3 = pdpt[(virt >> 30) & 0x1FF];
+    if (!(ent3 & PFLAG_PRESENT) || (ent3 & (1ULL << 7))) return NULL;
+    uint64_t *pd = (uint64_t *)phys_to_virt(ent3 & PAGE_MASK);
+    if (!pd) return NULL;
+    return &pd[(virt >> 21) & 0x1FF];
+}
+
+static int split_2m_in(uint64_t *root, uint64_t virt) {
+    uint64_t *pde = pde_ptr(root, virt);
+    if (!pde) return 0;
+    uint64_t ent2 = *pde;
+    if (!(ent2 & PFLAG_PRESENT) || !(ent2 & (1ULL << 7))) return 0;
+
+    uint64_t *new_pt = alloc_pt_page();
+    if (!new_pt) return -1;
+    uint64_t new_pt_phys = (phys_offset == 0) ? (uint64_t)(uintptr_t)new_pt : ((uint64_t)(uintptr_t)new_pt - phys_offset);
+
+    /* Bit 12 of a 2MiB entry is PAT, not an address bit. */
+    uint64_t base_phys = ent2 & 0x000FFFFFFFE00000ULL;
+    uint64_t pte_flags = (ent2 & 0xFFFULL & ~(1ULL << 7)) | (ent2 & (1ULL << 63));
+    for (int j = 0; j < 512; j++) {
+        new_pt[j] = (base_phys + ((uint64_t)j << 12)) | pte_flags;
+    }
+
+    *pde = (new_pt_phys & PAGE_MASK) | PFLAG_PRESENT | PFLAG_WRITABLE | (ent2 & PFLAG_USER);
+    /* One invlpg anywhere in the old 2MiB page drops its TLB entry. */
+    __asm__ volatile("invlpg (%0)" :: "r"(virt) : "memory");
+    return 0;
+}
+
+int paging_split_2m_page(uint64_t virt) {
+    if (!pml4) return -1;
+    return split_2m_in(active_pml4(), virt);
+}
+
+int paging_split_2m_page_in_pml4(uint64_t *pml4_virt, uint64_t virt) {
+    return split_2m_in(pml4_virt, virt);
+}
+
+static int unmap_2m_in(uint64_t *root, uint64_t virt) {
+    if (virt & (PAGING_2M_SIZE - 1)) return -1;
+    uint64_t *pde = pde_ptr(root, virt);
+    if (!pde || !(*pde & PFLAG_PRESENT) || !(*pde & (1ULL << 7))) return -1;
+    *pde = 0;
+    __asm__ volatile("invlpg (%0)" :: "r"(virt) : "memory");
+    return 0;
+}
+
+int paging_unmap_2m_page(uint64_t virt) {
+    if (!pml4) return -1;
+    int rc = unmap_2m_in(active_pml4(), virt);
+    if (rc == 0) kernel_tlb_shootdown(virt, PAGING_2M_SIZE);
+    return rc;
+}
+
+int paging_unmap_range(uint64_t virt_base, uint64_t size) {
+    if (!pml4) return -1;
+    uint64_t *root = active_pml4();
+    uint64_t end = virt_base + ((size + PAGE_SIZE - 1) & PAGE_MASK);
+    for (uint64_t v = virt_base & PAGE_MASK; v < end; ) {
+        if (!(v & (PAGING_2M_SIZE - 1)) && end - v >= PAGING_2M_SIZE && unmap_2m_in(root, v) == 0) {
+            v += PAGING_2M_SIZE;
+            continue;
+        }
+        (void)unmap_page_in(root, v);
+        v += PAGE_SIZE;
+    }
+    /* One shootdown for the whole range instead of an IPI round per page. */
+    kernel_tlb_shootdown(virt_base & PAGE_MASK, end - (virt_base & PAGE_MASK));
+    return 0;
+}
+
+int paging_unmap_2m_page_in_pml4(uint64_t *pml4_virt, uint64_t virt) {
+    return unmap_2m_in(pml4_virt, virt);
+}
+
+static int slot_free_2m_in(uint64_t *root, uint64_t virt, int own_user) {
+    if (!root) return 0;
+    uint64_t ent4 = root[(virt >> 39) & 0x1FF];
+    /* A kernel-only entry in a process PML4 gets replaced by map_2m_in(). */
+    if (!(ent4 & PFLAG_PRESENT) || (own_user && !(ent4 & PFLAG_USER))) return 1;
+    uint64_t *pde = pde_ptr(root, virt);
+    if (pde) return !(*pde & PFLAG_PRESENT);
+    /* No PD yet: free unless a 1GiB page covers it. */
+    uint64_t *pdpt = (uint64_t *)phys_to_virt(ent4 & PAGE_MASK);
+    return pdpt && !(pdpt[(virt >> 30) & 0x1FF] & PFLAG_PRESENT);
+}
+
+int paging_2m_slot_free(uint64_t virt) {
+    if (!pml4) return 0;
+    return slot_free_2m_in(active_pml4(), virt, 0);
+}
+
+int paging_2m_slot_free_in_pml4(uint64_t *pml4_virt, uint64_t virt) {
+    return slot_free_2m_in(pml4_virt, virt, 1);
+}
+
 int paging_map_range(uint64_t virt_base, uint64_t phys_base, uint64_t size, uint64_t flags) {
     uint64_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
     char tmp[32];
@@ -687,15 +865,18 @@ uint64_t paging_get_pte(uint64_t virt) {
     uint64_t cr3;
     __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
     uint64_t pml4_phys = cr3 & 0xFFFFFFFFFFFFF000ULL;
-    uint64_t *current_pml4 = (uint64_t*)phys_to_virt(pml4_phys);
-    if (!current_pml4) return 0;
+    return paging_get_pte_in_pml4((uint64_t*)phys_to_virt(pml4_phys), virt);
+}
+
+uint64_t paging_get_pte_in_pml4(uint64_t *pml4_virt, uint64_t virt) {
+    if (!pml4_virt) return 0;
 
     uint64_t pml4_idx = (virt >> 39) & 0x1FF;
     uint64_t pdpt_idx = (virt >> 30) & 0x1FF;
     uint64_t pd_idx   = (virt >> 21) & 0x1FF;
     uint64_t pt_idx   = (virt >> 12) & 0x1FF;
 
-    uint64_t pml4_entry = current_pml4[pml4_idx];
+    uint64_t pml4_entry = pml4_virt[pml4_idx];
     if (!(pml4_entry & PFLAG_PRESENT)) return 0;
 
     uint64_t pdpt_phys = pml4_entry & 0xFFFFFFFFFFFFF000ULL;
@@ -724,18 +905,14 @@ uint64_t paging_get_pte(uint64_t virt) {
     return pt[pt_idx];
 }
 
-int paging_set_pte(uint64_t virt, uint64_t pte) {
-    if (!pml4) paging_init();
-    if (!pml4) return -1;
-
+static int set_pte_in(uint64_t *root, uint64_t virt, uint64_t pte, int own_user) {
     unsigned i4 = (virt >> 39) & 0x1FF;
     unsigned i3 = (virt >> 30) & 0x1FF;
     unsigned i2 = (virt >> 21) & 0x1FF;
     unsigned i1 = (virt >> 12) & 0x1FF;
 
-    uint64_t *pdpt = get_or_create(pml4, i4);
+    uint64_t *pdpt = pml4_slot(root, i4, pte, own_user);
     if (!pdpt) return -1;
-    if (pte & PFLAG_USER) pml4[i4] |= PFLAG_USER;
 
     uint64_t *pd = get_or_create(pdpt, i3);
     if (!pd) return -1;
@@ -750,6 +927,19 @@ int paging_set_pte(uint64_t virt, uint64_t pte) {
     return 0;
 }
 
+int paging_set_pte(uint64_t virt, uint64_t pte) {
+    if (!pml4) paging_init();
+    if (!pml4) return -1;
+    int rc = set_pte_in(active_pml4(), virt, pte, 0);
+    if (rc == 0) kernel_tlb_shootdown(virt & PAGE_MASK, PAGE_SIZE);
+    return rc;
+}
+
+int paging_set_pte_in_pml4(uint64_t *pml4_virt, uint64_t virt, uint64_t pte) {
+    if (!pml4_virt) return -1;
+    return set_pte_in(pml4_virt, virt, pte, 1);
+}
+
 uint64_t paging_get_flags(uint64_t virt) {
     uint64_t *current_pml4 = paging_get_pml4();
     if (!current_pml4) {
@@ -0,0 +1,190 @@
+// percpu_heap.c - per-CPU magazine front-end for kmalloc()
+//
+// Each CPU owns one magazine per kmalloc size class. The hot path only pops or
+// pushes a pointer on the local magazine with interrupts disabled; the SLAB
+// cache lock is taken once per batch when a magazine runs empty or overflows.
+
+#include "moduos/kernel/percpu_heap.h"
+#include "moduos/kernel/slab.h"
+#include "moduos/kernel/smp.h"
+#include "moduos/kernel/memory/kheap.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/interrupts/irq_lock.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/kernel/COM/com.h"
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct pcpu_magazine {
+    uint32_t count;
+    uint32_t capacity;
+    void *objs[PERCPU_MAG_MAX];
+} pcpu_magazine_t;
+
+typedef struct percpu_heap {
+    uint32_t cpu;
+    int ready;
+    pcpu_magazine_t mags[SLAB_KMALLOC_CLASSES];
+
+    /* statistics (only touched by the owning CPU) */
+    uint64_t alloc_hits;
+    uint64_t alloc_misses;
+    uint64_t frees;
+    uint64_t drains;
+} __attribute__((aligned(64))) percpu_heap_t;
+
+static percpu_heap_t g_pcpu_heaps[MAX_CPUS];
+static slab_cache_t *g_class_cache[SLAB_KMALLOC_CLASSES];
+static volatile int percpu_heap_ready = 0;
+
+static inline size_t class_size(int cls) {
+    return (size_t)SLAB_MIN_SIZE << cls;
+}
+
+/* Caller has interrupts disabled, so we cannot migrate between the read and the use. */
+static inline percpu_heap_t *this_cpu_heap(void) {
+    if (!percpu_heap_ready) return NULL;
+    cpu_local_t *cl = cpu_local_get();
+    if (!cl) return NULL;
+    percpu_heap_t *h = (percpu_heap_t *)(uintptr_t)cl->heap;
+    return (h && h->ready) ? h : NULL;
+}
+
+static int class_of_cache(slab_cache_t *c) {
+    for (int i = 0; i < SLAB_KMALLOC_CLASSES; i++) {
+        if (g_class_cache[i] == c) return i;
+    }
+    return -1;
+}
+
+void percpu_heap_init_cpu(cpu_local_t *cpu) {
+    if (!cpu || cpu->cpu_num >= MAX_CPUS) return;
+
+    percpu_heap_t *h = &g_pcpu_heaps[cpu->cpu_num];
+    memset(h, 0, sizeof(*h));
+    h->cpu = (uint32_t)cpu->cpu_num;
+    for (int i = 0; i < SLAB_KMALLOC_CLASSES; i++) {
+        size_t cap = PERCPU_MAG_BYTES / class_size(i);
+        if (cap > PERCPU_MAG_MAX) cap = PERCPU_MAG_MAX;
+        if (cap < 2) cap = 2;
+        h->mags[i].capacity = (uint32_t)cap;
+    }
+    h->ready = 1;
+    cpu->heap = (uint64_t)(uintptr_t)h;
+}
+
+void percpu_heap_init(void) {
+    for (int i = 0; i < SLAB_KMALLOC_CLASSES; i++) {
+        g_class_cache[i] = slab_kmalloc_cache(i);
+    }
+
+    uint32_t n = smp_cpu_count();
+    if (n > MAX_CPUS) n = MAX_CPUS;
+    for (uint32_t c = 0; c < n; c++) {
+        cpu_local_t *cl = smp_get_cpu(c);
+        if (cl) percpu_heap_init_cpu(cl);
+    }
+
+    __atomic_store_n(&percpu_heap_ready, 1, __ATOMIC_RELEASE);
+    com_printf(COM1_PORT, "[PCPU-HEAP] magazines ready for %u CPU(s)\n", n);
+}
+
+void *percpu_kmalloc(size_t size) {
+    if (size == 0) return NULL;
+    if (size > SLAB_MAX_SIZE) return kmalloc(size);
+
+    int cls = slab_kmalloc_index(size);
+    uint64_t flags = irq_save();
+    percpu_heap_t *h = this_cpu_heap();
+    if (!h || !g_class_cache[cls]) {
+        irq_restore(flags);
+        return slab_kmalloc(size);
+    }
+
+    pcpu_magazine_t *m = &h->mags[cls];
+    if (m->count == 0) {
+        /* Refill half a magazine so a following free burst does not drain at once. */
+        size_t batch = m->capacity / 2;
+        if (batch == 0) batch = 1;
+        m->count = (uint32_t)slab_alloc_bulk(g_class_cache[cls], m->objs, batch);
+        h->alloc_misses++;
+        if (m->count == 0) {
+            irq_restore(flags);
+            return NULL;
+        }
+    } else {
+        h->alloc_hits++;
+    }
+
+    void *obj = m->objs[--m->count];
+    irq_restore(flags);
+    return obj;
+}
+
+int percpu_try_free(void *ptr) {
+    slab_cache_t *c = slab_obj_cache(ptr);
+    if (!c) return 0;
+    int cls = class_of_cache(c);
+    if (cls < 0) return 0;
+
+    uint64_t flags = irq_save();
+    percpu_heap_t *h = this_cpu_heap();
+    if (!h) {
+        irq_restore(flags);
+        slab_free(c, ptr);
+        return 1;
+    }
+
+    pcpu_magazine_t *m = &h->mags[cls];
+    if (m->count == m->capacity) {
+        /* Drain the older (colder) half; keep the recently freed, cache-hot objects. */
+        uint32_t batch = m->capacity / 2;
+        if (batch == 0) batch = 1;
+        slab_free_bulk(c, m->objs, batch);
+        for (uint32_t i = batch; i < m->count; i++) m->objs[i - batch] = m->objs[i];
+        m->count -= batch;
+        h->drains++;
+    }
+
+    m->objs[m->count++] = ptr;
+    h->frees++;
+    irq_restore(flags);
+    return 1;
+}
+
+void percpu_kfree(void *ptr) {
+    if (!ptr) return;
+    if (!percpu_try_free(ptr)) kfree(ptr);
+}
+
+int percpu_heap_get_stats(int cpu, md_heapstats_cpu_u *out) {
+    if (!out || cpu < 0 || cpu >= MAX_CPUS) return -1;
+    percpu_heap_t *h = &g_pcpu_heaps[cpu];
+    if (!h->ready) return -1;
+
+    memset(out, 0, sizeof(*out));
+    out->cpu = h->cpu;
+    out->alloc_hits = h->alloc_hits;
+    out->alloc_misses = h->alloc_misses;
+    out->frees = h->frees;
+    out->drains = h->drains;
+    for (int i = 0; i < SLAB_KMALLOC_CLASSES; i++) {
+        out->cached_objects += h->mags[i].count;
+        out->cached_bytes += (uint64_t)h->mags[i].count * class_size(i);
+    }
+    return 0;
+}
+
+void percpu_heap_stats(int cpu, size_t *total_bytes, size_t *used_bytes, size_t *free_bytes) {
+    size_t total = 0, cached = 0;
+    if (cpu >= 0 && cpu < MAX_CPUS && g_pcpu_heaps[cpu].ready) {
+        percpu_heap_t *h = &g_pcpu_heaps[cpu];
+        for (int i = 0; i < SLAB_KMALLOC_CLASSES; i++) {
+            total += (size_t)h->mags[i].capacity * class_size(i);
+            cached += (size_t)h->mags[i].count * class_size(i);
+        }
+    }
+    if (total_bytes) *total_bytes = total;
+    if (used_bytes) *used_bytes = total - cached;
+    if (free_bytes) *free_bytes = cached;
+}
@@ -29,15 +29,59 @@ static size_t refcnt_size = 0;
 /* Which region index the bitmap+frame space begins at */
 static size_t alloc_start_region = 0;
 
-/* Spinlock to protect bitmap and refcnt operations (SMP-safe) */
+/* Buddy allocator.
+ *
+ * Free frames are kept on per-order free lists (order k == 2^k frames, physically
+ * aligned to 2^k pages). Lists are threaded through idx-indexed link arrays that
+ * live in the same metadata area as the bitmap and refcount table; buddy_order[]
+ * is only valid for the head frame of a free block. The bitmap stays authoritative
+ * for "is this frame allocated" so refcounting/reserve logic is unchanged.
+ */
+#define PHYS_MAX_ORDER 11            /* orders 0..10: 4 KiB .. 4 MiB blocks */
+#define BUDDY_NIL      0xFFFFFFFFu
+#define BUDDY_NOT_FREE 0xFFu
+
+static uint32_t *buddy_next = NULL;
+static uint32_t *buddy_prev = NULL;
+static uint8_t  *buddy_order = NULL;
+static int buddy_ready = 0;
+
+/* Address-based zones. Each zone owns its free lists and lock, so page-table
+ * allocations (LOW), physmap-reachable memory (DIRECT), 32-bit DMA memory (DMA32)
+ * and everything above 4 GiB (HIGH) do not contend on one global lock.
+ * Zone limits are multiples of the largest block size, so a buddy never crosses a zone.
+ */
+enum { ZONE_LOW, ZONE_DIRECT, ZONE_DMA32, ZONE_HIGH, PHYS_NUM_ZONES };
+
+static const uint64_t zone_limit[PHYS_NUM_ZONES] = {
+    64ULL * 1024 * 1024,
+    1ULL * 1024 * 1024 * 1024,
+    4ULL * 1024 * 1024 * 1024,
+    UINT64_MAX,
+};
+
+/* General allocations prefer memory that is reachable through the physmap and
+ * leave the low 64 MiB for page tables. */
+static const int zone_pref[PHYS_NUM_ZONES] = { ZONE_DIRECT, ZONE_DMA32, ZONE_HIGH, ZONE_LOW };
+
+typedef struct phys_zone {
+    uint32_t free_head[PHYS_MAX_ORDER];
+    uint64_t free_frames;
+} phys_zone_t;
+
+static phys_zone_t zones[PHYS_NUM_ZONES];
 /* Cache-line aligned to prevent false sharing */
-static spinlock_t phys_lock __attribute__((aligned(64)));
-/* Fine-grained locking: 8 zones for reduced contention */
-#define PHYS_NUM_ZONES 8
-static spinlock_t zone_locks[PHYS_NUM_ZONES] __attribute__((aligned(64)));
-
-static inline int get_zone_for_frame(uint64_t frame_idx) {
-    return (int)(frame_idx % PHYS_NUM_ZONES);
+static spinlock_t zone_locks[PHYS_NUM_ZONES] __attribute__((aligned(64)));
+
+static inline int zone_of_phys(uint64_t phys) {
+    for (int z = 0; z < PHYS_NUM_ZONES - 1; z++) {
+        if (phys < zone_limit[z]) return z;
+    }
+    return ZONE_HIGH;
+}
+
+static inline uint64_t zone_base(int z) {
+    return z == 0 ? 0 : zone_limit[z - 1];
 }
 
 /* Bitmap operations */
@@ -125,6 +169,152 @@ static uint64_t idx_from_phys(uint64_t addr) {
     return UINT64_MAX;
 }
 
+/**********************************************************************
+ * BUDDY FREE LISTS (caller holds the zone lock)
+ **********************************************************************/
+
+static void free_list_add(int z, uint64_t idx, unsigned order) {
+    phys_zone_t *zn = &zones[z];
+    uint32_t head = zn->free_head[order];
+    buddy_order[idx] = (uint8_t)order;
+    buddy_prev[idx] = BUDDY_NIL;
+    buddy_next[idx] = head;
+    if (head != BUDDY_NIL) buddy_prev[head] = (uint32_t)idx;
+    zn->free_head[order] = (uint32_t)idx;
+}
+
+static void free_list_del(int z, uint64_t idx, unsigned order) {
+    phys_zone_t *zn = &zones[z];
+    uint32_t next = buddy_next[idx];
+    uint32_t prev = buddy_prev[idx];
+    if (prev != BUDDY_NIL) buddy_next[prev] = next;
+    else zn->free_head[order] = next;
+    if (next != BUDDY_NIL) buddy_prev[next] = prev;
+    buddy_order[idx] = BUDDY_NOT_FREE;
+}
+
+/* Return true if `idx` heads a free block of `order` that starts exactly at `phys`
+ * and is index-contiguous with `ref_idx` (i.e. in the same region). */
+static int buddy_is_free_head(uint64_t idx, uint64_t phys, unsigned order,
+                              uint64_t ref_idx, uint64_t ref_phys) {
+    if (idx == UINT64_MAX || idx >= frame_count) return 0;
+    if (buddy_order[idx] != order) return 0;
+    if (phys_from_idx(idx) != phys) return 0;
+    uint64_t di = idx > ref_idx ? idx - ref_idx : ref_idx - idx;
+    uint64_t dp = phys > ref_phys ? phys - ref_phys : ref_phys - phys;
+    return di * PAGE_SIZE == dp;
+}
+
+/* Insert a free block and coalesce it with its buddies as far as possible. */
+static void buddy_free_block(int z, uint64_t idx, unsigned order) {
+    uint64_t phys = phys_from_idx(idx);
+    while (order < PHYS_MAX_ORDER - 1) {
+        uint64_t bphys = phys ^ (PAGE_SIZE << order);
+        uint64_t bidx = idx_from_phys(bphys);
+        if (!buddy_is_free_head(bidx, bphys, order, idx, phys)) break;
+        free_list_del(z, bidx, order);
+        if (bphys < phys) {
+            phys = bphys;
+            idx = bidx;
+        }
+        order++;
+    }
+    free_list_add(z, idx, order);
+}
+
+/* Pop a block of exactly `order`, splitting a larger one if needed. */
+static uint64_t buddy_alloc_block(int z, unsigned order) {
+    for (unsigned o = order; o < PHYS_MAX_ORDER; o++) {
+        uint32_t idx = zones[z].free_head[o];
+        if (idx == BUDDY_NIL) continue;
+        free_list_del(z, idx, o);
+        while (o > order) {
+            o--;
+            free_list_add(z, idx + (1ULL << o), o);
+        }
+        return idx;
+    }
+    return UINT64_MAX;
+}
+
+/* Give [idx, idx+n) back to the lists as maximal naturally-aligned blocks. */
+static void buddy_release_range(int z, uint64_t idx, uint64_t n) {
+    while (n) {
+        uint64_t phys = phys_from_idx(idx);
+        unsigned order = 0;
+        while (order + 1 < PHYS_MAX_ORDER &&
+               (1ULL << (order + 1)) <= n &&
+               (phys & ((PAGE_SIZE << (order + 1)) - 1)) == 0) {
+            order++;
+        }
+        buddy_free_block(z, idx, order);
+        idx += 1ULL << order;
+        n -= 1ULL << order;
+    }
+}
+
+/* Remove one specific free frame from whatever free block contains it. */
+static int buddy_claim_frame(int z, uint64_t idx) {
+    uint64_t phys = phys_from_idx(idx);
+    for (unsigned o = 0; o < PHYS_MAX_ORDER; o++) {
+        uint64_t hphys = phys & ~((PAGE_SIZE << o) - 1);
+        uint64_t hidx = idx_from_phys(hphys);
+        if (!buddy_is_free_head(hidx, hphys, o, idx, phys)) continue;
+
+        free_list_del(z, hidx, o);
+        /* Split down, returning the halves that do not contain idx. */
+        while (o > 0) {
+            o--;
+            uint64_t half = 1ULL << o;
+            if (idx >= hidx + half) {
+                free_list_add(z, hidx, o);
+                hidx += half;
+            } else {
+                free_list_add(z, hidx + half, o);
+            }
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static inline void frame_mark_used(uint64_t idx) {
+    bm_set(idx);
+    if (refcnt) refcnt[idx] = 1;
+}
+
+/* Build the free lists from the bitmap once all boot-time reservations are in. */
+static void buddy_build(void) {
+    for (int z = 0; z < PHYS_NUM_ZONES; z++) {
+        for (unsigned o = 0; o < PHYS_MAX_ORDER; o++) zones[z].free_head[o] = BUDDY_NIL;
+        zones[z].free_frames = 0;
+    }
+    for (uint64_t i = 0; i < frame_count; i++) buddy_order[i] = BUDDY_NOT_FREE;
+
+    uint64_t skip = 0;
+    for (size_t r = alloc_start_region; r < region_count; r++) {
+        uint64_t base = regions[r*2+0];
+        uint64_t frames = regions[r*2+1] / PAGE_SIZE;
+
+        uint64_t i = 0;
+        while (i < frames) {
+            if (bm_test(skip + i)) { i++; continue; }
+
+            /* Free run, clipped to the zone of its first frame. */
+            uint64_t start = i;
+            int z = zone_of_phys(base + start * PAGE_SIZE);
+            while (i < frames && !bm_test(skip + i) &&
+                   zone_of_phys(base + i * PAGE_SIZE) == z) {
+                i++;
+            }
+            buddy_release_range(z, skip + start, i - start);
+            zones[z].free_frames += i - start;
+        }
+        skip += frames;
+    }
+    buddy_ready = 1;
+}
+
 /**********************************************************************
  * INITIALIZATION
  **********************************************************************/
@@ -137,8 +327,12 @@ void phys_init(uint64_t total_mem, const void *usable, size_t count) {
     const uint64_t *src = usable;
 
     for (size_t i = 0; i < region_count; i++) {
-        regions[i*2+0] = src[i*2+0];
-        regions[i*2+1] = src[i*2+1];
+        /* Trim to whole pages so frame physical addresses stay page-aligned
+         * (buddy block alignment is derived from them). */
+        uint64_t base = (src[i*2+0] + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uint64_t end  = (src[i*2+0] + src[i*2+1]) & ~(PAGE_SIZE - 1);
+        regions[i*2+0] = base;
+        regions[i*2+1] = end > base ? end - base : 0;
     }
 
     /* Find the best region to place bitmap.
@@ -199,13 +393,16 @@ void phys_init(uint64_t total_mem, const void *usable, size_t count) {
     }
 
     frame_count = total_frames;
-    bitmap_size = (frame_count + 7) / 8;
+    bitmap_size = ((frame_count + 63) / 64) * 8;  /* keep refcnt/link arrays 8-byte aligned */
 
     // Refcount array sits right after the bitmap.
     refcnt_size = (size_t)(frame_count * sizeof(uint32_t));
 
-    /* Calculate how many frames the bitmap+refcount storage occupies */
-    uint64_t meta_bytes = bitmap_size + refcnt_size;
+    /* Buddy link arrays and per-frame order bytes follow the refcount table. */
+    size_t link_size = (size_t)(frame_count * sizeof(uint32_t));
+
+    /* Calculate how many frames the bitmap+refcount+buddy storage occupies */
+    uint64_t meta_bytes = bitmap_size + refcnt_size + 2 * link_size + frame_count;
     uint64_t bitmap_frames = (meta_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
 
     com_write_string(COM1_PORT, "[PHYS] Placing bitmap at physical address 0x");
@@ -230,6 +427,9 @@ void phys_init(uint64_t total_mem, const void *usable, size_t count) {
     /* Set bitmap pointer via kernel physmap (do NOT assume identity mapping). */
     bitmap = (uint8_t *)phys_to_virt_kernel(bitmap_location);
     refcnt = (uint32_t *)phys_to_virt_kernel(bitmap_location + bitmap_size);
+    buddy_next = (uint32_t *)((uint8_t *)refcnt + refcnt_size);
+    buddy_prev = (uint32_t *)((uint8_t *)buddy_next + link_size);
+    buddy_order = (uint8_t *)buddy_prev + link_size;
 
     /* Initialize metadata */
     for (size_t i = 0; i < bitmap_size; i++) {
@@ -288,15 +488,12 @@ void phys_init(uint64_t total_mem, const void *usable, size_t count) {
 
     log_phys(frame_count, (uint64_t)(uintptr_t)bitmap, bitmap_size);
     
-    // Initialize the physical memory spinlock
-    spinlock_init(&phys_lock);
+    // Initialize the per-zone spinlocks and carve the free lists
     for (int z = 0; z < PHYS_NUM_ZONES; z++) { spinlock_init(&zone_locks[z]); }
+    buddy_build();
     
     // Debug: show how many frames are free
-    uint64_t free_frames = 0;
-    for (uint64_t i = 0; i < frame_count; i++) {
-        if (!bm_test(i)) free_frames++;
-    }
+    uint64_t free_frames = phys_count_free_frames();
     com_write_string(COM1_PORT, "[PHYS] Free frames: ");
     char buf[32];
     p = buf;
@@ -316,42 +513,60 @@ void phys_init(uint64_t total_mem, const void *usable, size_t count) {
  **********************************************************************/
 
 uint64_t phys_alloc_frame(void) {
-    if (!bitmap || frame_count == 0)
+    if (!bitmap || frame_count == 0 || !buddy_ready)
         return 0;
 
-    spinlock_lock(&phys_lock);
-    /* Simple linear search for free frame */
-    for (uint64_t i = 0; i < frame_count; i++) {
-        if (!bm_test(i)) {
-            bm_set(i);
-            if (refcnt) refcnt[i] = 1;
-            uint64_t phys = phys_from_idx(i);
-            spinlock_unlock(&phys_lock);
-            return phys;
+    for (int i = 0; i < PHYS_NUM_ZONES; i++) {
+        int z = zone_pref[i];
+        spinlock_lock(&zone_locks[z]);
+        uint64_t idx = buddy_alloc_block(z, 0);
+        if (idx != UINT64_MAX) {
+            frame_mark_used(idx);
+            zones[z].free_frames--;
+            spinlock_unlock(&zone_locks[z]);
+            return phys_from_idx(idx);
         }
+        spinlock_unlock(&zone_locks[z]);
     }
-    spinlock_unlock(&phys_lock);
     return 0; /* Out of memory */
 }
 
 uint64_t phys_alloc_frame_below(uint64_t max_phys) {
-    if (!bitmap || frame_count == 0 || max_phys == 0)
+    if (!bitmap || frame_count == 0 || max_phys == 0 || !buddy_ready)
         return 0;
 
-    spinlock_lock(&phys_lock);
-    for (uint64_t i = 0; i < frame_count; i++) {
-        if (bm_test(i)) continue;
+    for (int z = 0; z < PHYS_NUM_ZONES && zone_base(z) < max_phys; z++) {
+        spinlock_lock(&zone_locks[z]);
 
-        uint64_t phys = phys_from_idx(i);
-        if (phys == 0) continue;
-        if (phys >= max_phys) continue;
+        uint64_t idx = UINT64_MAX;
+        if (zone_limit[z] <= max_phys) {
+            idx = buddy_alloc_block(z, 0);
+        } else {
+            /* Zone straddles the limit: take the first block whose head is below it
+             * and split it keeping the lowest frame. */
+            for (unsigned o = 0; o < PHYS_MAX_ORDER && idx == UINT64_MAX; o++) {
+                for (uint32_t h = zones[z].free_head[o]; h != BUDDY_NIL; h = buddy_next[h]) {
+                    uint64_t hp = phys_from_idx(h);
+                    if (hp == 0 || hp >= max_phys) continue;
+                    free_list_del(z, h, o);
+                    while (o > 0) {
+                        o--;
+                        free_list_add(z, h + (1ULL << o), o);
+                    }
+                    idx = h;
+                    break;
+                }
+            }
+        }
 
-        bm_set(i);
-        if (refcnt) refcnt[i] = 1;
-        spinlock_unlock(&phys_lock);
-        return phys;
+        if (idx != UINT64_MAX) {
+            frame_mark_used(idx);
+            zones[z].free_frames--;
+            spinlock_unlock(&zone_locks[z]);
+            return phys_from_idx(idx);
+        }
+        spinlock_unlock(&zone_locks[z]);
     }
-    spinlock_unlock(&phys_lock);
     return 0;
 }
 
@@ -360,32 +575,54 @@ void phys_free_frame(uint64_t phys) {
         return;
 
     uint64_t idx = idx_from_phys(phys);
-    if (idx != UINT64_MAX && idx < frame_count) {
-        spinlock_lock(&phys_lock);
-        if (!refcnt) {
-            bm_clear(idx);
-            spinlock_unlock(&phys_lock);
-            return;
-        }
+    if (idx == UINT64_MAX || idx >= frame_count)
+        return;
+
+    int z = zone_of_phys(phys);
+    spinlock_lock(&zone_locks[z]);
+    if (!bm_test(idx)) {
+        spinlock_unlock(&zone_locks[z]);
+        return; /* double free: never put a frame on the lists twice */
+    }
+    if (refcnt) {
         if (refcnt[idx] == 0xFFFFFFFFu) {
-            spinlock_unlock(&phys_lock);
+            spinlock_unlock(&zone_locks[z]);
             return; /* pinned */
         }
         if (refcnt[idx] > 1) {
             refcnt[idx]--;
-            spinlock_unlock(&phys_lock);
+            spinlock_unlock(&zone_locks[z]);
             return;
         }
         refcnt[idx] = 0;
-        bm_clear(idx);
-        spinlock_unlock(&phys_lock);
     }
+    bm_clear(idx);
+    if (buddy_ready) {
+        buddy_free_block(z, idx, 0);
+        zones[z].free_frames++;
+    }
+    spinlock_unlock(&zone_locks[z]);
 }
 
 static int is_pow2_u64(uint64_t x) { return x && ((x & (x - 1)) == 0); }
 
-// Internal helper: allocate within a *single* physical region so the returned run is
-// guaranteed physically contiguous.
+static unsigned ceil_log2_u64(uint64_t x) {
+    unsigned o = 0;
+    while ((1ULL << o) < x) o++;
+    return o;
+}
+
+static void zones_lock_all(void) {
+    for (int z = 0; z < PHYS_NUM_ZONES; z++) spinlock_lock(&zone_locks[z]);
+}
+
+static void zones_unlock_all(void) {
+    for (int z = PHYS_NUM_ZONES - 1; z >= 0; z--) spinlock_unlock(&zone_locks[z]);
+}
+
+// Internal helper for runs larger than the biggest buddy block: allocate within a
+// *single* physical region so the returned run is guaranteed physically contiguous.
+// Caller holds every zone lock.
 static uint64_t phys_alloc_contiguous_in_region(size_t region_idx, size_t nframes, uint64_t align) {
     if (nframes == 0) return 0;
     if (!is_pow2_u64(align)) return 0;
@@ -420,8 +657,10 @@ static uint64_t phys_alloc_contiguous_in_region(size_t region_idx, size_t nframe
 
         if (found) {
             for (size_t j = 0; j < nframes; j++) {
-                bm_set(start_idx + j);
-                if (refcnt) refcnt[start_idx + j] = 1;
+                uint64_t fp = phys_candidate + j * PAGE_SIZE;
+                int z = zone_of_phys(fp);
+                if (buddy_claim_frame(z, start_idx + j) == 0) zones[z].free_frames--;
+                frame_mark_used(start_idx + j);
             }
             return phys_candidate;
         }
@@ -431,19 +670,45 @@ static uint64_t phys_alloc_contiguous_in_region(size_t region_idx, size_t nframe
 }
 
 uint64_t phys_alloc_contiguous_aligned(size_t nframes, uint64_t align) {
-    if (!bitmap || nframes == 0 || frame_count == 0) return 0;
+    if (!bitmap || nframes == 0 || frame_count == 0 || !buddy_ready) return 0;
     if (nframes > frame_count) return 0;
 
     if (align == 0) align = PAGE_SIZE;
     if (!is_pow2_u64(align)) return 0;
     if ((align % PAGE_SIZE) != 0) return 0;
 
-    for (size_t r = alloc_start_region; r < region_count; r++) {
-        uint64_t p = phys_alloc_contiguous_in_region(r, nframes, align);
-        if (p) return p;
+    /* A buddy block of order k is naturally aligned to 2^k pages, so one block
+     * covering both the size and the alignment satisfies the request; the unused
+     * tail goes straight back to the free lists. */
+    unsigned order = ceil_log2_u64(nframes);
+    unsigned align_order = ceil_log2_u64(align / PAGE_SIZE);
+    if (align_order > order) order = align_order;
+
+    if (order < PHYS_MAX_ORDER) {
+        for (int i = 0; i < PHYS_NUM_ZONES; i++) {
+            int z = zone_pref[i];
+            spinlock_lock(&zone_locks[z]);
+            uint64_t idx = buddy_alloc_block(z, order);
+            if (idx != UINT64_MAX) {
+                for (size_t j = 0; j < nframes; j++) frame_mark_used(idx + j);
+                buddy_release_range(z, idx + nframes, (1ULL << order) - nframes);
+                zones[z].free_frames -= nframes;
+                spinlock_unlock(&zone_locks[z]);
+                return phys_from_idx(idx);
+            }
+            spinlock_unlock(&zone_locks[z]);
+        }
+        return 0;
     }
 
-    return 0;
+    /* Larger than the biggest block: slow linear scan (boot-time / rare). */
+    uint64_t p = 0;
+    zones_lock_all();
+    for (size_t r = alloc_start_region; r < region_count && !p; r++) {
+        p = phys_alloc_contiguous_in_region(r, nframes, align);
+    }
+    zones_unlock_all();
+    return p;
 }
 
 uint64_t phys_alloc_contiguous(size_t nframes) {
@@ -475,10 +740,17 @@ void phys_reserve_range(uint64_t pstart, uint64_t plen) {
 
     if (end_idx < start_idx) return;
 
+    if (buddy_ready) zones_lock_all();
     for (uint64_t i = start_idx; i <= end_idx && i < frame_count; i++) {
+        if (buddy_ready && !bm_test(i)) {
+            /* Currently free: pull it out of its buddy block first. */
+            int z = zone_of_phys(phys_from_idx(i));
+            if (buddy_claim_frame(z, i) == 0) zones[z].free_frames--;
+        }
         bm_set(i);
         if (refcnt) refcnt[i] = 0xFFFFFFFFu; /* pin reserved frames */
     }
+    if (buddy_ready) zones_unlock_all();
 }
 
 uint64_t phys_total_frames(void) {
@@ -489,9 +761,13 @@ void phys_ref_inc(uint64_t phys) {
     if (!refcnt || phys == 0) return;
     uint64_t idx = idx_from_phys(phys);
     if (idx == UINT64_MAX || idx >= frame_count) return;
-    if (refcnt[idx] == 0xFFFFFFFFu) return;
-    if (refcnt[idx] == 0) refcnt[idx] = 1;
-    else refcnt[idx]++;
+    int z = zone_of_phys(phys);
+    spinlock_lock(&zone_locks[z]);
+    if (refcnt[idx] != 0xFFFFFFFFu) {
+        if (refcnt[idx] == 0) refcnt[idx] = 1;
+        else refcnt[idx]++;
+    }
+    spinlock_unlock(&zone_locks[z]);
 }
 
 void phys_ref_dec(uint64_t phys) {
@@ -505,21 +781,22 @@ uint32_t phys_ref_get(uint64_t phys) {
     return refcnt[idx];
 }
 
-/* Add this function to phys.c */
+int phys_ref_managed(uint64_t phys) {
+    uint32_t ref = phys_ref_get(phys);
+    return ref != 0 && ref != 0xFFFFFFFFu;
+}
 
 /**
  * Count how many free frames are currently available
- * Returns: number of free (unset) frames in the bitmap
+ * Returns: number of frames on the buddy free lists (O(1) per zone)
  */
 uint64_t phys_count_free_frames(void) {
     if (!bitmap || frame_count == 0)
         return 0;
     
     uint64_t free = 0;
-    for (uint64_t i = 0; i < frame_count; i++) {
-        if (!bm_test(i)) {
-            free++;
-        }
+    for (int z = 0; z < PHYS_NUM_ZONES; z++) {
+        free += __atomic_load_n(&zones[z].free_frames, __ATOMIC_RELAXED);
     }
     return free;
 }
@@ -0,0 +1,467 @@
+// slab.c - SLAB allocator (size-class object caches on top of kheap pages)
+//
+// Each cache carves physically contiguous kheap page blocks ("slabs") into
+// fixed-size objects linked through a freelist. A page -> slab map covering the
+// whole heap arena lets kfree() find the owning slab in O(1) without any
+// per-object header.
+//
+// Small objects (< SLAB_OFFSLAB_MIN) keep the slab descriptor at the start of
+// the slab itself; larger objects keep it off-slab (allocated from the meta
+// cache) so e.g. 4 KiB objects still pack whole pages.
+
+#include "moduos/kernel/slab.h"
+#include "moduos/kernel/memory/kheap.h"
+#include "moduos/kernel/memory/phys.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/COM/com.h"
+#include "moduos/kernel/spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define SLAB_MAX_CACHES   32
+#define SLAB_OFFSLAB_MIN  512   /* objects this large keep their descriptor off-slab */
+#define SLAB_MAX_PAGES    8     /* upper bound on pages per slab */
+#define SLAB_MIN_OBJS     4     /* grow slab size until it holds at least this many */
+#define SLAB_KEEP_EMPTY   1     /* empty slabs kept cached per cache before release */
+#define SLAB_HEAP_PAGES   ((KHEAP_MAX - KHEAP_START) / PAGE_SIZE)
+
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    slab_cache_t *cache;
+    uint8_t *base;        /* first byte of the slab's page block */
+    void *freelist;       /* free objects, linked through cache->link_off */
+    uint32_t inuse;
+    uint32_t total;
+} slab_t;
+
+struct slab_cache {
+    char name[24];
+    size_t object_size;   /* size requested by the creator */
+    size_t stride;        /* distance between objects */
+    size_t align;
+    size_t link_off;      /* where the freelist link lives inside a free object */
+    slab_ctor_t ctor;
+    uint32_t pages_per_slab;
+    uint32_t objs_per_slab;
+    uint32_t obj_offset;  /* offset of the first object from slab base */
+    int off_slab;
+    int used;
+
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+    uint32_t nr_empty;
+
+    spinlock_t lock;
+
+    /* statistics */
+    uint64_t nr_slabs;
+    uint64_t active_objs;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t grows;
+    uint64_t shrinks;
+    uint64_t failures;
+};
+
+static slab_cache_t cache_pool[SLAB_MAX_CACHES];
+static slab_cache_t *slab_meta_cache = NULL;
+
+/* kmalloc() size classes: 16 .. 4096 */
+static slab_cache_t *kmalloc_caches[SLAB_KMALLOC_CLASSES];
+static const char *kmalloc_names[SLAB_KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+    "kmalloc-512", "kmalloc-1024", "kmalloc-2048", "kmalloc-4096",
+};
+
+/* heap page index -> owning slab (NULL for non-SLAB heap pages) */
+static slab_t *slab_page_map[SLAB_HEAP_PAGES];
+
+static spinlock_t slab_init_lock;
+static volatile int slab_ready = 0;
+
+/* --- HELPERS --- */
+
+static inline size_t align_up(size_t v, size_t a) {
+    return (v + a - 1) & ~(a - 1);
+}
+
+static inline void **obj_link(slab_cache_t *c, void *obj) {
+    return (void **)((uint8_t *)obj + c->link_off);
+}
+
+static void list_push(slab_t **head, slab_t *s) {
+    s->prev = NULL;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void list_del(slab_t **head, slab_t *s) {
+    if (s->prev) s->prev->next = s->next;
+    else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+static void page_map_set(slab_t *s, uint32_t pages, slab_t *val) {
+    uint64_t idx = ((uint64_t)(uintptr_t)s->base - KHEAP_START) / PAGE_SIZE;
+    for (uint32_t i = 0; i < pages && idx + i < SLAB_HEAP_PAGES; i++) {
+        slab_page_map[idx + i] = val;
+    }
+}
+
+static slab_t *slab_lookup(const void *ptr) {
+    uint64_t p = (uint64_t)(uintptr_t)ptr;
+    if (p < KHEAP_START || p >= KHEAP_MAX) return NULL;
+    return slab_page_map[(p - KHEAP_START) / PAGE_SIZE];
+}
+
+/* --- CACHE SETUP --- */
+
+static int cache_setup(slab_cache_t *c, const char *name, size_t object_size, size_t align,
+                       slab_ctor_t ctor, int allow_off_slab) {
+    if (object_size == 0 || object_size > SLAB_MAX_SIZE) return -1;
+    if (align < sizeof(void *)) align = sizeof(void *);
+    if (align & (align - 1)) return -1;
+
+    memset(c, 0, sizeof(*c));
+    size_t n = 0;
+    if (name) {
+        while (name[n] && n + 1 < sizeof(c->name)) { c->name[n] = name[n]; n++; }
+    }
+    c->name[n] = 0;
+
+    c->object_size = object_size;
+    c->align = align;
+    c->ctor = ctor;
+
+    /* Constructed objects must keep their contents while free, so the freelist
+     * link goes after the object instead of over its first word.
+     */
+    size_t body = object_size < sizeof(void *) ? sizeof(void *) : object_size;
+    if (ctor) {
+        c->link_off = align_up(object_size, sizeof(void *));
+        body = c->link_off + sizeof(void *);
+    }
+    c->stride = align_up(body, align);
+
+    c->off_slab = (allow_off_slab && c->stride >= SLAB_OFFSLAB_MIN) ? 1 : 0;
+    c->obj_offset = c->off_slab ? 0 : (uint32_t)align_up(sizeof(slab_t), align);
+
+    uint32_t pages = 1;
+    for (;;) {
+        size_t usable = (size_t)pages * PAGE_SIZE - c->obj_offset;
+        size_t objs = usable / c->stride;
+        if ((objs >= SLAB_MIN_OBJS || pages >= SLAB_MAX_PAGES) && objs > 0) {
+            c->pages_per_slab = pages;
+            c->objs_per_slab = (uint32_t)objs;
+            break;
+        }
+        if (pages >= SLAB_MAX_PAGES) return -1;
+        pages <<= 1;
+    }
+
+    spinlock_init(&c->lock);
+    c->used = 1;
+    return 0;
+}
+
+static slab_cache_t *cache_pool_get(void) {
+    for (int i = 0; i < SLAB_MAX_CACHES; i++) {
+        if (!cache_pool[i].used) return &cache_pool[i];
+    }
+    return NULL;
+}
+
+void slab_init(void) {
+    if (slab_ready) return;
+
+    spinlock_lock(&slab_init_lock);
+    if (slab_ready) { spinlock_unlock(&slab_init_lock); return; }
+
+    /* Descriptor cache for off-slab caches; always on-slab itself. */
+    slab_meta_cache = cache_pool_get();
+    if (!slab_meta_cache || cache_setup(slab_meta_cache, "slab-meta", sizeof(slab_t), 16, NULL, 0) != 0) {
+        com_write_string(COM1_PORT, "[SLAB] FATAL: cannot create meta cache\n");
+        slab_meta_cache = NULL;
+        spinlock_unlock(&slab_init_lock);
+        return;
+    }
+
+    size_t size = SLAB_MIN_SIZE;
+    for (int i = 0; i < SLAB_KMALLOC_CLASSES; i++, size <<= 1) {
+        slab_cache_t *c = cache_pool_get();
+        /* Natural alignment up to a cache line, like the page-based kmalloc gave. */
+        size_t align = size < 64 ? size : 64;
+        if (!c || cache_setup(c, kmalloc_names[i], size, align, NULL, 1) != 0) {
+            com_write_string(COM1_PORT, "[SLAB] ERROR: cannot create kmalloc cache\n");
+            kmalloc_caches[i] = NULL;
+            continue;
+        }
+        kmalloc_caches[i] = c;
+    }
+
+    __atomic_store_n(&slab_ready, 1, __ATOMIC_RELEASE);
+    spinlock_unlock(&slab_init_lock);
+    com_write_string(COM1_PORT, "[SLAB] kmalloc size classes 16..4096 ready\n");
+}
+
+slab_cache_t *slab_cache_create_ctor(const char *name, size_t object_size, size_t align,
+                                     slab_ctor_t ctor) {
+    if (!slab_ready) slab_init();
+
+    spinlock_lock(&slab_init_lock);
+    slab_cache_t *c = cache_pool_get();
+    if (!c || cache_setup(c, name, object_size, align, ctor, 1) != 0) {
+        spinlock_unlock(&slab_init_lock);
+        com_write_string(COM1_PORT, "[SLAB] ERROR: slab_cache_create failed for ");
+        com_write_string(COM1_PORT, name ? name : "(null)");
+        com_write_string(COM1_PORT, "\n");
+        return NULL;
+    }
+    spinlock_unlock(&slab_init_lock);
+    return c;
+}
+
+slab_cache_t *slab_cache_create(const char *name, size_t object_size, size_t align) {
+    return slab_cache_create_ctor(name, object_size, align, NULL);
+}
+
+/* --- SLAB GROW / SHRINK (cache lock held) --- */
+
+static slab_t *slab_grow(slab_cache_t *c) {
+    uint8_t *base = (uint8_t *)kheap_alloc_pages(c->pages_per_slab);
+    if (!base) return NULL;
+
+    slab_t *s;
+    if (c->off_slab) {
+        s = (slab_t *)slab_alloc(slab_meta_cache);
+        if (!s) {
+            kheap_free_pages(base, c->pages_per_slab);
+            return NULL;
+        }
+    } else {
+        s = (slab_t *)base;
+    }
+
+    s->next = s->prev = NULL;
+    s->cache = c;
+    s->base = base;
+    s->inuse = 0;
+    s->total = c->objs_per_slab;
+
+    /* Build the freelist front-to-back so allocations walk memory upwards. */
+    void *head = NULL;
+    for (uint32_t i = c->objs_per_slab; i > 0; i--) {
+        void *obj = base + c->obj_offset + (size_t)(i - 1) * c->stride;
+        if (c->ctor) c->ctor(obj);
+        *obj_link(c, obj) = head;
+        head = obj;
+    }
+    s->freelist = head;
+
+    page_map_set(s, c->pages_per_slab, s);
+    c->nr_slabs++;
+    c->grows++;
+    return s;
+}
+
+static void slab_destroy(slab_cache_t *c, slab_t *s) {
+    uint8_t *base = s->base;
+    page_map_set(s, c->pages_per_slab, NULL);
+    c->nr_slabs--;
+    c->shrinks++;
+    if (c->off_slab) slab_free(slab_meta_cache, s);
+    kheap_free_pages(base, c->pages_per_slab);
+}
+
+/* --- OBJECT ALLOC / FREE --- */
+
+/* Pop one object; cache lock held. */
+static void *slab_alloc_locked(slab_cache_t *cache) {
+    slab_t *s = cache->partial;
+    if (!s) {
+        s = cache->empty;
+        if (s) {
+            list_del(&cache->empty, s);
+            cache->nr_empty--;
+        } else {
+            s = slab_grow(cache);
+            if (!s) {
+                cache->failures++;
+                return NULL;
+            }
+        }
+        list_push(&cache->partial, s);
+    }
+
+    void *obj = s->freelist;
+    s->freelist = *obj_link(cache, obj);
+    s->inuse++;
+    if (s->inuse == s->total) {
+        list_del(&cache->partial, s);
+        list_push(&cache->full, s);
+    }
+
+    cache->active_objs++;
+    cache->allocs++;
+    return obj;
+}
+
+/* Validate obj against cache; returns its slab or NULL. */
+static slab_t *slab_check_obj(slab_cache_t *cache, void *obj) {
+    slab_t *s = slab_lookup(obj);
+    uintptr_t off = (uintptr_t)obj - (uintptr_t)(s ? s->base : 0);
+    if (!s || s->cache != cache || off < cache->obj_offset ||
+        ((off - cache->obj_offset) % cache->stride) != 0) {
+        com_write_string(COM1_PORT, "[SLAB] WARNING: free of foreign/misaligned object in ");
+        com_write_string(COM1_PORT, cache->name);
+        com_write_string(COM1_PORT, "\n");
+        return NULL;
+    }
+    return s;
+}
+
+/* Push one object back; cache lock held. */
+static void slab_free_locked(slab_cache_t *cache, slab_t *s, void *obj) {
+    if (s->inuse == 0) {
+        com_write_string(COM1_PORT, "[SLAB] WARNING: double free in ");
+        com_write_string(COM1_PORT, cache->name);
+        com_write_string(COM1_PORT, "\n");
+        return;
+    }
+
+    if (s->inuse == s->total) {
+        list_del(&cache->full, s);
+        list_push(&cache->partial, s);
+    }
+
+    *obj_link(cache, obj) = s->freelist;
+    s->freelist = obj;
+    s->inuse--;
+    cache->active_objs--;
+    cache->frees++;
+
+    if (s->inuse == 0) {
+        list_del(&cache->partial, s);
+        if (cache->nr_empty < SLAB_KEEP_EMPTY) {
+            list_push(&cache->empty, s);
+            cache->nr_empty++;
+        } else {
+            slab_destroy(cache, s);
+        }
+    }
+}
+
+void *slab_alloc(slab_cache_t *cache) {
+    if (!cache) return NULL;
+    spinlock_lock(&cache->lock);
+    void *obj = slab_alloc_locked(cache);
+    spinlock_unlock(&cache->lock);
+    return obj;
+}
+
+void slab_free(slab_cache_t *cache, void *obj) {
+    if (!cache || !obj) return;
+    slab_t *s = slab_check_obj(cache, obj);
+    if (!s) return;
+    spinlock_lock(&cache->lock);
+    slab_free_locked(cache, s, obj);
+    spinlock_unlock(&cache->lock);
+}
+
+size_t slab_alloc_bulk(slab_cache_t *cache, void **objs, size_t n) {
+    if (!cache || !objs) return 0;
+    size_t got = 0;
+    spinlock_lock(&cache->lock);
+    while (got < n) {
+        void *obj = slab_alloc_locked(cache);
+        if (!obj) break;
+        objs[got++] = obj;
+    }
+    spinlock_unlock(&cache->lock);
+    return got;
+}
+
+void slab_free_bulk(slab_cache_t *cache, void **objs, size_t n) {
+    if (!cache || !objs) return;
+    spinlock_lock(&cache->lock);
+    for (size_t i = 0; i < n; i++) {
+        slab_t *s = objs[i] ? slab_check_obj(cache, objs[i]) : NULL;
+        if (s) slab_free_locked(cache, s, objs[i]);
+    }
+    spinlock_unlock(&cache->lock);
+}
+
+/* --- kmalloc ROUTING --- */
+
+int slab_kmalloc_index(size_t size) {
+    if (size == 0 || size > SLAB_MAX_SIZE) return -1;
+    size_t cls = SLAB_MIN_SIZE;
+    int idx = 0;
+    while (cls < size) { cls <<= 1; idx++; }
+    return idx;
+}
+
+slab_cache_t *slab_kmalloc_cache(int index) {
+    if (index < 0 || index >= SLAB_KMALLOC_CLASSES) return NULL;
+    if (!slab_ready) slab_init();
+    return kmalloc_caches[index];
+}
+
+slab_cache_t *slab_obj_cache(const void *ptr) {
+    slab_t *s = slab_lookup(ptr);
+    if (!s) return NULL;
+    slab_cache_t *c = s->cache;
+    uintptr_t off = (uintptr_t)ptr - (uintptr_t)s->base;
+    if (off < c->obj_offset || ((off - c->obj_offset) % c->stride) != 0) return NULL;
+    return c;
+}
+
+void *slab_kmalloc(size_t size) {
+    if (size == 0) return NULL;
+    if (size > SLAB_MAX_SIZE) return kmalloc(size);
+
+    slab_cache_t *c = slab_kmalloc_cache(slab_kmalloc_index(size));
+    return c ? slab_alloc(c) : NULL;
+}
+
+int slab_try_free(void *ptr) {
+    slab_t *s = slab_lookup(ptr);
+    if (!s) return 0;
+    slab_free(s->cache, ptr);
+    return 1;
+}
+
+void slab_kfree(void *ptr) {
+    if (!ptr) return;
+    if (!slab_try_free(ptr)) kfree(ptr);
+}
+
+/* --- STATISTICS --- */
+
+void slab_cache_stats(slab_cache_t *cache, size_t *objects_allocated,
+                      size_t *objects_free, size_t *total_memory) {
+    if (!cache) return;
+    spinlock_lock(&cache->lock);
+    uint64_t total = cache->nr_slabs * cache->objs_per_slab;
+    if (objects_allocated) *objects_allocated = (size_t)cache->active_objs;
+    if (objects_free) *objects_free = (size_t)(total - cache->active_objs);
+    if (total_memory) *total_memory = (size_t)(cache->nr_slabs * cache->pages_per_slab * PAGE_SIZE);
+    spinlock_unlock(&cache->lock);
+}
+
+void slab_dump_stats(void) {
+    com_write_string(COM1_PORT, "--- SLAB STATS (name size active/total slabs pages allocs frees fail) ---\n");
+    for (int i = 0; i < SLAB_MAX_CACHES; i++) {
+        slab_cache_t *c = &cache_pool[i];
+        if (!c->used) continue;
+        com_printf(COM1_PORT, "%s %u %u/%u %u %u %u %u %u\n",
+                   c->name, (uint32_t)c->object_size,
+                   (uint32_t)c->active_objs, (uint32_t)(c->nr_slabs * c->objs_per_slab),
+                   (uint32_t)c->nr_slabs, (uint32_t)(c->nr_slabs * c->pages_per_slab),
+                   (uint32_t)c->allocs, (uint32_t)c->frees, (uint32_t)c->failures);
+    }
+}
@@ -205,24 +205,7 @@ int snprintf(char *str, size_t size, const char *format, ...) {
     return written;
 }
 
-// Optimized memset function using word-sized accesses if possible
-void *memset(void *dest, int val, size_t len) {
-    unsigned char *ptr = dest;
-    while (len--) {
-        *ptr++ = (unsigned char)val;
-    }
-    return dest;
-}
-
-// Optimized memcpy function
-void *memcpy(void *dest, const void *src, size_t len) {
-    const unsigned char *s = src;
-    unsigned char *d = dest;
-    while (len--) {
-        *d++ = *s++;
-    }
-    return dest;
-}
+/* memset/memcpy/memmove/memcmp live in memops.c (CPUID-dispatched). */
 
 // Optimized strlen function using pointer arithmetic
 size_t strlen(const char *str) {
@@ -324,69 +307,6 @@ int strncmp(const char *s1, const char *s2, size_t n) {
     return n ? *(unsigned char *)s1 - *(unsigned char *)s2 : 0;
 }
 
-// Optimized memcmp function
-int memcmp(const void *s1, const void *s2, size_t n) {
-    const uint8_t *p1 = s1;
-    const uint8_t *p2 = s2;
-    
-    while (n--) {
-        if (*p1 != *p2) {
-            return *p1 - *p2;
-        }
-        ++p1;
-        ++p2;
-    }
-    return 0;
-}
-
-// memmove - handles overlapping memory regions
-//
-// NOTE: This is performance-critical for framebuffer scrolling (multi-megabyte moves).
-// The simple byte loop can appear like a "hang" under emulation.
-void *memmove(void *dest, const void *src, size_t n) {
-    if (dest == src || n == 0) return dest;
-
-#if defined(__x86_64__) || defined(__amd64__)
-    // Use rep movsb (handles any alignment; fast on modern CPUs and in QEMU).
-    // We must handle overlap direction correctly.
-    if ((uintptr_t)dest < (uintptr_t)src) {
-        __asm__ volatile(
-            "cld\n\t"
-            "rep movsb"
-            : "+D"(dest), "+S"(src), "+c"(n)
-            :
-            : "memory"
-        );
-        return dest;
-    }
-
-    // Backward copy: start from end, set DF, rep movsb, then clear DF.
-    const uint8_t *s = (const uint8_t*)src + n - 1;
-    uint8_t *d = (uint8_t*)dest + n - 1;
-    __asm__ volatile(
-        "std\n\t"
-        "rep movsb\n\t"
-        "cld"
-        : "+D"(d), "+S"(s), "+c"(n)
-        :
-        : "memory"
-    );
-    return dest;
-#else
-    unsigned char *d = (unsigned char*)dest;
-    const unsigned char *s = (const unsigned char*)src;
-
-    if (d < s) {
-        while (n--) *d++ = *s++;
-    } else {
-        d += n;
-        s += n;
-        while (n--) *--d = *--s;
-    }
-    return dest;
-#endif
-}
-
 // strchr - find first occurrence of character in string
 char *strchr(const char *str, int c) {
     while (*str) {
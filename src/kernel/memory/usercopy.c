@@ -1,13 +1,17 @@
 #include "moduos/kernel/memory/usercopy.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/memory/vma.h"
+#include "moduos/kernel/process/process.h"
 
 /*
  * Minimal user pointer validation.
  * We validate that each page in [addr, addr+n) is mapped and has PFLAG_USER set.
  * This kernel uses a single address space; USER bit is still meaningful.
+ * Pages of demand-paged areas (vma.h) that were never touched are faulted in
+ * here rather than rejected.
  */
-static int user_range_is_mapped(uint64_t addr, size_t n) {
+static int user_range_is_mapped(uint64_t addr, size_t n, int write) {
     if (n == 0) return 1;
     if (addr >= 0x0000800000000000ULL) return 0;
     uint64_t end = addr + (uint64_t)n - 1;
@@ -19,7 +23,10 @@ static int user_range_is_mapped(uint64_t addr, size_t n) {
 
     for (uint64_t v = start_page; v <= end_page; v += 0x1000ULL) {
         uint64_t pte = paging_get_pte(v);
-        if (!(pte & PFLAG_PRESENT)) return 0;
+        if (!(pte & PFLAG_PRESENT)) {
+            if (vma_handle_fault(process_get_current(), v, write) != 1) return 0;
+            pte = paging_get_pte(v);
+        }
         if (!(pte & PFLAG_USER)) return 0;
     }
 
@@ -28,7 +35,7 @@ static int user_range_is_mapped(uint64_t addr, size_t n) {
 
 int usercopy_to_user(void *user_dst, const void *kernel_src, size_t n) {
     if (!user_dst || (!kernel_src && n)) return -1;
-    if (!user_range_is_mapped((uint64_t)(uintptr_t)user_dst, n)) {
+    if (!user_range_is_mapped((uint64_t)(uintptr_t)user_dst, n, 1)) {
         extern void com_write_string(uint16_t, const char*);
         extern int com_write_hex64(uint16_t, uint64_t);
         com_write_string(0x3F8, "[USERCOPY] ERROR: user range not mapped\n");
@@ -67,7 +74,7 @@ int usercopy_to_user(void *user_dst, const void *kernel_src, size_t n) {
 
 int usercopy_from_user(void *kernel_dst, const void *user_src, size_t n) {
     if (!kernel_dst || (!user_src && n)) return -1;
-    if (!user_range_is_mapped((uint64_t)(uintptr_t)user_src, n)) return -2;
+    if (!user_range_is_mapped((uint64_t)(uintptr_t)user_src, n, 0)) return -2;
     memcpy(kernel_dst, user_src, n);
     return 0;
 }
@@ -79,7 +86,7 @@ int usercopy_string_from_user(char *kernel_dst, const char *user_src, size_t max
 
     /* Copy byte-by-byte with mapping checks per page boundary. */
     for (size_t i = 0; i + 1 < max_len; i++) {
-        if (!user_range_is_mapped((uint64_t)(uintptr_t)(user_src + i), 1)) {
+        if (!user_range_is_mapped((uint64_t)(uintptr_t)(user_src + i), 1, 0)) {
             kernel_dst[i] = 0;
             return -2;
         }
@@ -0,0 +1,471 @@
+#include "moduos/kernel/memory/vma.h"
+#include "moduos/kernel/loader/exec_image.h"
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/memory/memory.h"
+#include "moduos/kernel/memory/paging.h"
+#include "moduos/kernel/memory/phys.h"
+#include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/spinlock.h"
+
+#define VMA_PAGE      4096ULL
+#define VMA_PAGE_MASK (~(VMA_PAGE - 1))
+#define VMA_USER_TOP  0x0000800000000000ULL
+#define VMA_HUGE      PAGING_2M_SIZE
+#define VMA_ADDR_MASK 0x000FFFFFFFFFF000ULL
+#define VMA_HUGE_ADDR_MASK 0x000FFFFFFFE00000ULL
+
+/* Shared all-zero frame for reads of untouched anonymous memory. */
+static spinlock_t g_zero_lock;
+static uint64_t g_zero_frame;
+
+static uint64_t vma_zero_frame(void) {
+    spinlock_lock(&g_zero_lock);
+    if (!g_zero_frame) {
+        uint64_t phys = phys_alloc_frame_below(PAGING_PHYSMAP_LIMIT);
+        if (phys) {
+            memset(phys_to_virt_kernel(phys), 0, VMA_PAGE);
+            g_zero_frame = phys;
+        }
+    }
+    uint64_t phys = g_zero_frame;
+    spinlock_unlock(&g_zero_lock);
+    return phys;
+}
+
+/* The process's own PML4, which need not be the one loaded on this CPU. */
+static uint64_t *vma_pml4(process_t *p) {
+    uint64_t cr3 = p->page_table ? p->page_table : p->cr3;
+    return (uint64_t *)phys_to_virt_kernel(cr3 & VMA_ADDR_MASK);
+}
+
+int vma_add_file(process_t *p, uint64_t vaddr, uint64_t mem_size, uint32_t flags,
+                 exec_image_t *image, uint64_t file_offset, uint64_t file_size) {
+    if (!p || mem_size == 0 || file_size > mem_size) return -1;
+    uint64_t start = vaddr & VMA_PAGE_MASK;
+    uint64_t end = (vaddr + mem_size + VMA_PAGE - 1) & VMA_PAGE_MASK;
+    if (end <= start || end > VMA_USER_TOP) return -1;
+
+    /* ELF segments may share a boundary page, so only reject real overlaps
+     * of whole pages beyond that. */
+    vma_t **link = &p->vmas;
+    while (*link && (*link)->start < start) link = &(*link)->next;
+    for (vma_t *v = p->vmas; v; v = v->next) {
+        if (v->start < end && start < v->end) {
+            uint64_t lo = v->start > start ? v->start : start;
+            uint64_t hi = v->end < end ? v->end : end;
+            if (hi - lo > VMA_PAGE) return -1;
+        }
+    }
+
+    vma_t *v = (vma_t *)kzalloc(sizeof(*v));
+    if (!v) return -1;
+    v->start = start;
+    v->end = end;
+    v->flags = flags;
+    v->image = image;
+    v->file_vaddr = vaddr;
+    v->file_offset = file_offset;
+    v->file_size = file_size;
+    v->mem_end = vaddr + mem_size;
+    if (image) exec_image_get(image);
+
+    v->next = *link;
+    *link = v;
+    return 0;
+}
+
+int vma_add_anon(process_t *p, uint64_t start, uint64_t end, uint32_t flags) {
+    if (!p || ((start | end) & (VMA_PAGE - 1)) || end <= start || end > VMA_USER_TOP) return -1;
+    for (vma_t *v = p->vmas; v && v->start < end; v = v->next) {
+        if (start < v->end) return -1;
+    }
+
+    vma_t *prev = NULL, **link = &p->vmas;
+    while (*link && (*link)->start < start) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    vma_t *next = *link;
+
+    if (prev && !prev->image && prev->flags == flags && prev->end == start) {
+        prev->end = prev->mem_end = end;
+        if (next && !next->image && next->flags == flags && next->start == end) {
+            prev->end = prev->mem_end = next->end;
+            prev->next = next->next;
+            kfree(next);
+        }
+        return 0;
+    }
+    if (next && !next->image && next->flags == flags && next->start == end) {
+        next->start = next->file_vaddr = start;
+        return 0;
+    }
+
+    vma_t *v = (vma_t *)kzalloc(sizeof(*v));
+    if (!v) return -1;
+    v->start = v->file_vaddr = start;
+    v->end = v->mem_end = end;
+    v->flags = flags;
+    v->next = next;
+    *link = v;
+    return 0;
+}
+
+/* Split v at `at` (page aligned, strictly inside v); v keeps the low part. */
+static int vma_split(vma_t *v, uint64_t at) {
+    vma_t *n = (vma_t *)kmalloc(sizeof(*n));
+    if (!n) return -1;
+    *n = *v;
+    n->start = at;
+    v->end = at;
+    v->next = n;
+    if (n->image) exec_image_get(n->image);
+    return 0;
+}
+
+int vma_remove_range(process_t *p, uint64_t start, uint64_t end) {
+    if (!p) return -1;
+    vma_t **link = &p->vmas;
+    while (*link && (*link)->start < end) {
+        vma_t *v = *link;
+        if (v->end <= start) {
+            link = &v->next;
+            continue;
+        }
+        if (v->start < start) {
+            if (vma_split(v, start) != 0) return -1;
+            link = &v->next;
+            continue;
+        }
+        if (v->end > end && vma_split(v, end) != 0) return -1;
+        *link = v->next;
+        if (v->image) exec_image_put(v->image);
+        kfree(v);
+    }
+    return 0;
+}
+
+uint64_t vma_find_gap(process_t *p, uint64_t lo, uint64_t hi, uint64_t size, uint64_t align) {
+    if (!p || size == 0) return 0;
+    if (align < VMA_PAGE) align = VMA_PAGE;
+    uint64_t cand = (lo + align - 1) & ~(align - 1);
+    for (vma_t *v = p->vmas; v; v = v->next) {
+        if (v->end <= cand) continue;
+        if (v->start >= cand + size) break;
+        cand = (v->end + align - 1) & ~(align - 1);
+    }
+    if (cand + size < cand || cand + size > hi) return 0;
+    return cand;
+}
+
+void vma_unmap_pages(process_t *p, uint64_t start, uint64_t end) {
+    uint64_t *pml4 = p ? vma_pml4(p) : NULL;
+    if (!pml4) return;
+    uint64_t cur = start & VMA_PAGE_MASK;
+    while (cur < end) {
+        uint64_t pte = paging_get_pte_in_pml4(pml4, cur);
+        if (!(pte & PFLAG_PRESENT)) {
+            cur += VMA_PAGE;
+            continue;
+        }
+        uint64_t phys = pte & VMA_ADDR_MASK;
+        if (pte & PFLAG_HUGE) {
+            phys = pte & VMA_HUGE_ADDR_MASK;
+            if (!(cur & (VMA_HUGE - 1)) && cur + VMA_HUGE <= end &&
+                paging_unmap_2m_page_in_pml4(pml4, cur) == 0) {
+                for (uint64_t i = 0; i < VMA_HUGE; i += VMA_PAGE) phys_ref_dec(phys + i);
+                cur += VMA_HUGE;
+                continue;
+            }
+            phys += cur & (VMA_HUGE - 1);
+        }
+        /* paging_unmap_page_in_pml4() splits a partly covered 2 MiB page itself. */
+        if (paging_unmap_page_in_pml4(pml4, cur) == 0) phys_ref_dec(phys);
+        cur += VMA_PAGE;
+    }
+}
+
+vma_t *vma_find(process_t *p, uint64_t addr) {
+    if (!p) return NULL;
+    for (vma_t *v = p->vmas; v && v->start <= addr; v = v->next) {
+        if (addr < v->end) return v;
+    }
+    return NULL;
+}
+
+/* Union of the flags of every VMA covering `page` (ELF segments may share one). */
+static uint32_t vma_page_flags(process_t *p, uint64_t page) {
+    uint32_t flags = 0;
+    for (vma_t *o = p->vmas; o && o->start < page + VMA_PAGE; o = o->next) {
+        if (page < o->end) flags |= o->flags;
+    }
+    return flags;
+}
+
+static int vma_page_sole(process_t *p, vma_t *v, uint64_t page) {
+    for (vma_t *o = p->vmas; o && o->start < page + VMA_PAGE; o = o->next) {
+        if (o != v && page < o->end) return 0;
+    }
+    return 1;
+}
+
+/* Leaf PTE bits (besides the frame) for a populated page with these flags. */
+static uint64_t vma_pte_flags(uint32_t flags) {
+    if (!(flags & VMA_PROT_MASK)) return PFLAG_PRESENT | PFLAG_NOACCESS;
+    uint64_t pte = PFLAG_PRESENT | PFLAG_USER;
+    if (flags & VMA_WRITE) pte |= PFLAG_WRITABLE;
+    if (flags & VMA_SHARED) pte |= PFLAG_SHARED;
+    return pte;
+}
+
+/* Whether `page` can map the image's shared frame: it is covered by this VMA
+ * alone, read-only, and is exactly one page of the file (file offsets and
+ * addresses congruent, no zero-filled bytes inside the page). */
+static int vma_page_shareable(process_t *p, vma_t *v, uint64_t page, uint64_t *out_index) {
+    if (!v->image || (v->flags & VMA_WRITE) || !(v->flags & VMA_PROT_MASK)) return 0;
+    if (((v->file_vaddr ^ v->file_offset) & (VMA_PAGE - 1)) != 0) return 0;
+    if (!vma_page_sole(p, v, page)) return 0;
+
+    /* Bytes past mem_end are unspecified, so only real .bss rules it out. */
+    uint64_t file_end = v->file_vaddr + v->file_size;
+    if (file_end < page + VMA_PAGE && file_end < v->mem_end) return 0;
+    if (page < v->file_vaddr && v->file_offset < v->file_vaddr - page) return 0;
+
+    *out_index = (v->file_offset + page - v->file_vaddr) / VMA_PAGE;
+    return 1;
+}
+
+/* Fill the freshly mapped, zeroed `page` with the file bytes of every VMA that
+ * covers part of it. */
+static int vma_fill_private(process_t *p, uint64_t page) {
+    for (vma_t *v = p->vmas; v && v->start < page + VMA_PAGE; v = v->next) {
+        if (!v->image || page >= v->end) continue;
+        uint64_t lo = v->file_vaddr > page ? v->file_vaddr : page;
+        uint64_t hi = v->file_vaddr + v->file_size;
+        if (hi > page + VMA_PAGE) hi = page + VMA_PAGE;
+        if (lo >= hi) continue;
+
+        size_t got = 0;
+        size_t want = (size_t)(hi - lo);
+        if (exec_image_read(v->image, v->file_offset + (lo - v->file_vaddr),
+                            (void *)(uintptr_t)lo, want, &got) != 0 || got != want)
+            return -1;
+    }
+    return 0;
+}
+
+/* Map a new frame at `page`, writable for the fill, then set final flags. */
+static uint64_t vma_map_new(uint64_t *pml4, uint64_t page) {
+    uint64_t phys = phys_alloc_frame();
+    if (!phys) return 0;
+    if (paging_map_page_in_pml4(pml4, page, phys, PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER) != 0) {
+        phys_free_frame(phys);
+        return 0;
+    }
+    memset((void *)(uintptr_t)page, 0, VMA_PAGE);
+    return phys;
+}
+
+static void vma_unmap_new(uint64_t *pml4, uint64_t page, uint64_t phys) {
+    paging_unmap_page_in_pml4(pml4, page);
+    phys_ref_dec(phys);
+}
+
+static void vma_set_final(uint64_t *pml4, uint64_t page, uint64_t phys, uint64_t pte_flags) {
+    if (pte_flags == (PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER)) return;
+    (void)paging_set_pte_in_pml4(pml4, page, phys | pte_flags);
+}
+
+/* Back the whole 2 MiB block around `page` with one zeroed huge page when the
+ * block lies inside v alone and nothing in it is mapped yet. Returns 1 if it
+ * did, 0 to fall back to 4 KiB pages. */
+static int vma_fill_huge(process_t *p, uint64_t *pml4, vma_t *v, uint64_t page) {
+    uint64_t base = page & ~(VMA_HUGE - 1);
+    if (base < v->start || base + VMA_HUGE > v->end) return 0;
+    for (vma_t *o = p->vmas; o && o->start < base + VMA_HUGE; o = o->next) {
+        if (o != v && base < o->end) return 0;
+    }
+    if (!paging_2m_slot_free_in_pml4(pml4, base)) return 0;
+
+    uint64_t phys = phys_alloc_contiguous_aligned(VMA_HUGE / VMA_PAGE, VMA_HUGE);
+    if (!phys) return 0;
+    if (paging_map_2m_page_in_pml4(pml4, base, phys, PFLAG_PRESENT | PFLAG_WRITABLE | PFLAG_USER) != 0) {
+        for (uint64_t i = 0; i < VMA_HUGE; i += VMA_PAGE) phys_ref_dec(phys + i);
+        return 0;
+    }
+    memset((void *)(uintptr_t)base, 0, VMA_HUGE);
+    return 1;
+}
+
+/* Populate the non-present `page` of v. Access rights are the caller's. */
+static int vma_fill_page(process_t *p, vma_t *v, uint64_t page, int write) {
+    uint32_t flags = vma_page_flags(p, page);
+    uint64_t *pml4 = vma_pml4(p);
+    if (!pml4) return -1;
+
+    if (!v->image && !(flags & VMA_SHARED) && (flags & VMA_WRITE) && vma_fill_huge(p, pml4, v, page))
+        return 1;
+
+    if (!v->image && !(flags & VMA_SHARED) && !write && (flags & VMA_PROT_MASK) &&
+        vma_page_sole(p, v, page)) {
+        /* Untouched anonymous memory: share the zero frame until written. */
+        uint64_t zero = vma_zero_frame();
+        if (zero) {
+            uint64_t pte = PFLAG_PRESENT | PFLAG_USER;
+            if (flags & VMA_WRITE) pte |= PFLAG_COW;
+            phys_ref_inc(zero);
+            if (paging_map_page_in_pml4(pml4, page, zero, pte) != 0) {
+                phys_ref_dec(zero);
+                return -1;
+            }
+            return 1;
+        }
+    }
+
+    uint64_t index = 0;
+    if (vma_page_shareable(p, v, page, &index)) {
+        uint64_t phys = exec_image_frame(v->image, index);
+        if (phys) {
+            if (paging_map_page_in_pml4(pml4, page, phys, PFLAG_PRESENT | PFLAG_USER) != 0) {
+                phys_ref_dec(phys);
+                return -1;
+            }
+            return 1;
+        }
+
+        /* First user of this page: load the whole file page, then share it. */
+        phys = vma_map_new(pml4, page);
+        if (!phys) return -1;
+        uint64_t off = index * VMA_PAGE;
+        uint64_t size = exec_image_size(v->image);
+        size_t want = (size_t)((size - off < VMA_PAGE) ? size - off : VMA_PAGE);
+        size_t got = 0;
+        if (exec_image_read(v->image, off, (void *)(uintptr_t)page, want, &got) != 0 || got != want) {
+            vma_unmap_new(pml4, page, phys);
+            return -1;
+        }
+        vma_set_final(pml4, page, phys, PFLAG_PRESENT | PFLAG_USER);
+        exec_image_set_frame(v->image, index, phys);
+        return 1;
+    }
+
+    uint64_t phys = vma_map_new(pml4, page);
+    if (!phys) return -1;
+    if (vma_fill_private(p, page) != 0) {
+        vma_unmap_new(pml4, page, phys);
+        return -1;
+    }
+    vma_set_final(pml4, page, phys, vma_pte_flags(flags));
+    return 1;
+}
+
+int vma_handle_fault(process_t *p, uint64_t addr, int write) {
+    if (!p || addr >= VMA_USER_TOP) return 0;
+    vma_t *v = vma_find(p, addr);
+    if (!v) return 0;
+
+    uint64_t page = addr & VMA_PAGE_MASK;
+    uint32_t flags = vma_page_flags(p, page);
+    if (!(flags & VMA_PROT_MASK)) return -1;
+    if (write && !(flags & VMA_WRITE)) return -1;
+
+    /* Raced with (or repeated) a fill; only permissions can be missing. */
+    uint64_t pte = paging_get_pte_in_pml4(vma_pml4(p), page);
+    if (pte & PFLAG_PRESENT) {
+        if (!(pte & PFLAG_USER)) return -1;
+        return (!write || (pte & PFLAG_WRITABLE)) ? 1 : -1;
+    }
+    return vma_fill_page(p, v, page, write);
+}
+
+int vma_protect(process_t *p, uint64_t start, uint64_t end, uint32_t prot) {
+    if (!p || ((start | end) & (VMA_PAGE - 1)) || end <= start) return -1;
+    prot &= VMA_PROT_MASK;
+
+    uint64_t cur = start;
+    for (vma_t *v = p->vmas; v && cur < end; v = v->next) {
+        if (v->end <= cur) continue;
+        if (v->start > cur) return -1;
+        cur = v->end;
+    }
+    if (cur < end) return -1;
+
+    for (vma_t *v = p->vmas; v && v->start < end; v = v->next) {
+        if (v->end <= start) continue;
+        if (v->start < start) {
+            if (vma_split(v, start) != 0) return -2;
+            continue;
+        }
+        if (v->end > end && vma_split(v, end) != 0) return -2;
+        v->flags = (v->flags & ~(uint32_t)VMA_PROT_MASK) | prot;
+    }
+
+    /* Write access comes back through a COW fault unless the frame is shared
+     * on purpose; fault_break_cow() just flips the bit when nobody else maps it. */
+    uint64_t *pml4 = vma_pml4(p);
+    if (!pml4) return -2;
+    for (uint64_t page = start; page < end; page += VMA_PAGE) {
+        uint64_t pte = paging_get_pte_in_pml4(pml4, page);
+        if (!(pte & PFLAG_PRESENT)) continue;
+        if (pte & PFLAG_HUGE) {
+            if (paging_split_2m_page_in_pml4(pml4, page) != 0) return -2;
+            pte = paging_get_pte_in_pml4(pml4, page);
+        }
+        uint32_t flags = vma_page_flags(p, page);
+        uint64_t npte = pte & ~(uint64_t)(PFLAG_WRITABLE | PFLAG_COW | PFLAG_USER | PFLAG_NOACCESS);
+        if (!(flags & VMA_PROT_MASK)) {
+            npte |= PFLAG_NOACCESS;
+        } else {
+            npte |= PFLAG_USER;
+            if (flags & VMA_WRITE)
+                npte |= (pte & (PFLAG_WRITABLE | PFLAG_SHARED)) ? PFLAG_WRITABLE : PFLAG_COW;
+        }
+        if (npte == pte) continue;
+        (void)paging_set_pte_in_pml4(pml4, page, npte);
+    }
+    return 0;
+}
+
+int vma_populate_shared(process_t *p) {
+    if (!p) return -1;
+    uint64_t *pml4 = vma_pml4(p);
+    for (vma_t *v = p->vmas; v; v = v->next) {
+        if (!(v->flags & VMA_SHARED)) continue;
+        for (uint64_t page = v->start; page < v->end; page += VMA_PAGE) {
+            if (paging_get_pte_in_pml4(pml4, page) & PFLAG_PRESENT) continue;
+            if (vma_fill_page(p, v, page, 1) != 1) return -1;
+        }
+    }
+    return 0;
+}
+
+int vma_dup(process_t *dst, process_t *src) {
+    if (!dst || !src) return -1;
+    vma_t **tail = &dst->vmas;
+    while (*tail) tail = &(*tail)->next;
+    for (vma_t *v = src->vmas; v; v = v->next) {
+        vma_t *c = (vma_t *)kmalloc(sizeof(*c));
+        if (!c) {
+            vma_free_all(dst);
+            return -1;
+        }
+        *c = *v;
+        c->next = NULL;
+        if (c->image) exec_image_get(c->image);
+        *tail = c;
+        tail = &c->next;
+    }
+    return 0;
+}
+
+void vma_free_all(process_t *p) {
+    if (!p) return;
+    vma_t *v = p->vmas;
+    p->vmas = NULL;
+    while (v) {
+        vma_t *next = v->next;
+        if (v->image) exec_image_put(v->image);
+        kfree(v);
+        v = next;
+    }
+}
@@ -16,6 +16,7 @@
 #include "moduos/arch/AMD64/interrupts/irq.h"
 #include "moduos/arch/AMD64/interrupts/pic.h"
 #include "moduos/arch/AMD64/interrupts/timer.h"
+#include "moduos/kernel/timer_wheel.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/io/io.h"
 #include "moduos/kernel/spinlock.h"
@@ -1356,11 +1357,7 @@ static int sqrm_devfs_register_path(const char *path, const void *ops, void *ctx
 }
 
 static void sqrm_sleep_ms_impl(uint64_t ms) {
-    const uint64_t start = get_system_ticks();
-    const uint64_t wait = ms_to_ticks(ms);
-    while ((get_system_ticks() - start) < wait) {
-        // busy wait; modules should avoid long sleeps
-    }
+    (void)sleep_ms(ms);
 }
 
 static void sqrm_build_api(const sqrm_module_desc_t *desc, sqrm_kernel_api_t *out_api) {
@@ -1436,6 +1433,11 @@ static void sqrm_build_api(const sqrm_module_desc_t *desc, sqrm_kernel_api_t *ou
         out_api->pci_enable_bus_mastering = pci_enable_bus_mastering;
         out_api->ioremap = ioremap;
         out_api->ioremap_guarded = ioremap_guarded;
+        out_api->pci_irq_vector_count = pci_irq_vector_count;
+        out_api->pci_request_irq_vector = pci_request_irq_vector;
+        out_api->pci_free_irq_vector = pci_free_irq_vector;
+        out_api->irq_alloc_vector = irq_alloc_vector;
+        out_api->irq_free_vector = irq_free_vector;
     }
 
     // NET modules also need PCI + MMIO
@@ -1448,6 +1450,11 @@ static void sqrm_build_api(const sqrm_module_desc_t *desc, sqrm_kernel_api_t *ou
         out_api->pci_enable_bus_mastering = pci_enable_bus_mastering;
         out_api->ioremap = ioremap;
         out_api->ioremap_guarded = ioremap_guarded;
+        out_api->pci_irq_vector_count = pci_irq_vector_count;
+        out_api->pci_request_irq_vector = pci_request_irq_vector;
+        out_api->pci_free_irq_vector = pci_free_irq_vector;
+        out_api->irq_alloc_vector = irq_alloc_vector;
+        out_api->irq_free_vector = irq_free_vector;
 
         // restricted PCI config access
         out_api->pci_cfg_read32 = pci_config_read_dword;
@@ -1465,6 +1472,11 @@ static void sqrm_build_api(const sqrm_module_desc_t *desc, sqrm_kernel_api_t *ou
         out_api->pci_enable_bus_mastering = pci_enable_bus_mastering;
         out_api->ioremap = ioremap;
         out_api->ioremap_guarded = ioremap_guarded;
+        out_api->pci_irq_vector_count = pci_irq_vector_count;
+        out_api->pci_request_irq_vector = pci_request_irq_vector;
+        out_api->pci_free_irq_vector = pci_free_irq_vector;
+        out_api->irq_alloc_vector = irq_alloc_vector;
+        out_api->irq_free_vector = irq_free_vector;
 
         // restricted PCI config access
         out_api->pci_cfg_read32 = pci_config_read_dword;
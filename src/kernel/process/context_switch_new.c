@@ -17,7 +17,8 @@ typedef cpu_context_t cpu_state_t;
 
 // Use the new context_switch_asm which matches cpu_context_t offsets exactly.
 extern void context_switch_asm(cpu_context_t *old_ctx, cpu_context_t *new_ctx,
-                                void *old_fpu, void *new_fpu, uint64_t new_cr3);
+                                void *old_fpu, void *new_fpu, uint64_t new_cr3,
+                                volatile int *old_on_cpu);
 
 // CR3 register access.
 // read_cr3 is non-static so process_init_new.c can link against it.
@@ -34,7 +35,7 @@ static void write_cr3(uint64_t val) {
 
 // External functions from arch-specific code
 extern void amd64_syscall_set_kernel_stack(uint64_t stack_top);
-extern void fpu_lazy_on_context_switch(process_t *next);
+extern void fpu_lazy_on_context_switch(process_t *prev, process_t *next);
 
 // Use the same stack size as process.h (8192). The local #define previously
 // conflicted with process.h's definition; since we no longer include process.h,
@@ -51,8 +52,8 @@ void switch_to(process_t *prev, process_t *next) {
         return;
     }
     
-    // Note: Interrupts must remain ENABLED so timer can preempt user processes
-    // The scheduler lock protects the critical sections
+    // Called from schedule() with interrupts disabled; the incoming context's
+    // saved RFLAGS decides whether they come back on.
     
     // Save current CR3 into the outgoing process's page_table field.
     uint64_t old_cr3 = read_cr3();
@@ -134,7 +135,7 @@ void switch_to(process_t *prev, process_t *next) {
 
     // Lazy FPU: set CR0.TS so the next FP instruction traps.
     // Do this BEFORE CR3 switch to avoid running code in wrong address space
-    fpu_lazy_on_context_switch(next);
+    fpu_lazy_on_context_switch(prev, next);
 
     // context_switch_asm stub expects cpu_state_t* which is aliased to
     // cpu_context_t* above - same layout, safe cast. The 'context' field
@@ -145,6 +146,7 @@ void switch_to(process_t *prev, process_t *next) {
         &next->context,
         prev ? prev->fpu_state : NULL,
         next->fpu_state,
-        next_cr3
+        next_cr3,
+        prev ? &prev->on_cpu : NULL
     );
 }
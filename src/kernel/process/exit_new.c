@@ -32,12 +32,9 @@ void do_exit(int status) {
     com_write_string(COM1_PORT, buf);
     com_write_string(COM1_PORT, "\n");
 
-    // Close all file descriptors
-    for (int i = 0; i < PROCESS_MAX_FDS; i++) {
-        if (p->fd_table[i]) {
-            p->fd_table[i] = NULL;
-        }
-    }
+    // Close all file descriptors (drops this process's open-file references)
+    extern void fd_close_all(int pid);
+    fd_close_all((int)p->pid);
 
     // Reparent children to init (PID 1) under the children lock
     spinlock_lock(&children_lock);
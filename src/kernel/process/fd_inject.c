@@ -1,29 +1,16 @@
 // fd_inject.c - File descriptor injection into process fd_table
 //
 // Allows privileged kernel components (TTY manager, pipe subsystem, etc.) to
-// inject an opaque fd object into a target process's fd_table[fd] slot before
-// the process begins executing. The fd_table stores void* so the kernel's vfs
-// layer can cast to the appropriate type at the call site.
+// inject an open file (open_file_t, see fs/fd.h) into a target process's
+// fd_table[fd] slot before the process begins executing. The descriptor tables
+// and their locking belong to fs/fd.c; these are thin, logged wrappers.
 
 #include "moduos/kernel/process/process_new.h"
-#include "moduos/kernel/spinlock.h"
+#include "moduos/fs/fd.h"
 #include "moduos/kernel/COM/com.h"
 
 extern char *itoa(int value, char *str, int base);
 
-// A single coarse lock is sufficient: fd injection is a setup-time operation,
-// not a hot path. Concurrent injection into different processes is serialised
-// but that is acceptable for the intended use case.
-static spinlock_t fd_inject_lock;
-static int fd_inject_lock_inited = 0;
-
-static void ensure_lock(void) {
-    if (!fd_inject_lock_inited) {
-        spinlock_init(&fd_inject_lock);
-        fd_inject_lock_inited = 1;
-    }
-}
-
 // Inject fd_obj into process pid's fd_table at slot fd.
 //
 // Rules:
@@ -45,26 +32,16 @@ int process_inject_fd(uint32_t pid, int fd, void *fd_obj) {
         return -1;
     }
 
-    ensure_lock();
-    spinlock_lock(&fd_inject_lock);
-
-    process_t *p = process_find(pid);
-    if (!p) {
-        spinlock_unlock(&fd_inject_lock);
-        com_write_string(COM1_PORT, "[FD_INJ] Target process not found\n");
+    int rc = fd_install_at(pid, fd, (open_file_t *)fd_obj);
+    if (rc == -2) {
+        com_write_string(COM1_PORT, "[FD_INJ] Slot already occupied - close first\n");
         return -1;
     }
-
-    if (p->fd_table[fd] != NULL) {
-        spinlock_unlock(&fd_inject_lock);
-        com_write_string(COM1_PORT, "[FD_INJ] Slot already occupied - close first\n");
+    if (rc != 0) {
+        com_write_string(COM1_PORT, "[FD_INJ] Target process not found\n");
         return -1;
     }
 
-    p->fd_table[fd] = fd_obj;
-
-    spinlock_unlock(&fd_inject_lock);
-
     com_write_string(COM1_PORT, "[FD_INJ] Injected fd ");
     char buf[16];
     itoa(fd, buf, 10);
@@ -77,34 +54,20 @@ int process_inject_fd(uint32_t pid, int fd, void *fd_obj) {
     return 0;
 }
 
-// Retrieve the fd object at slot fd in process pid's fd_table.
+// Retrieve the open file at slot fd in process pid's fd_table, with a
+// reference the caller drops via fd_file_put().
 // Returns NULL if the process is not found or the slot is empty.
 void *process_get_fd(uint32_t pid, int fd) {
     if (fd < 0 || fd >= PROCESS_MAX_FDS) return NULL;
-
-    ensure_lock();
-    spinlock_lock(&fd_inject_lock);
-    process_t *p = process_find(pid);
-    void *obj = p ? p->fd_table[fd] : NULL;
-    spinlock_unlock(&fd_inject_lock);
-    return obj;
+    if (pid == 0) return NULL;   // 0 means "current" to the fd layer
+    return fd_file_get(pid, fd);
 }
 
-// Clear fd slot fd in process pid's fd_table (does not call any close
-// callback - that is the caller's responsibility).
+// Close fd slot fd in process pid's fd_table. The open file is released
+// once no other descriptor references it.
 //
 // Returns 0 on success, -1 if the process is not found or fd is out of range.
 int process_close_fd(uint32_t pid, int fd) {
     if (fd < 0 || fd >= PROCESS_MAX_FDS) return -1;
-
-    ensure_lock();
-    spinlock_lock(&fd_inject_lock);
-    process_t *p = process_find(pid);
-    if (!p) {
-        spinlock_unlock(&fd_inject_lock);
-        return -1;
-    }
-    p->fd_table[fd] = NULL;
-    spinlock_unlock(&fd_inject_lock);
-    return 0;
+    return fd_close_in(pid, fd);
 }
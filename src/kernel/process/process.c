@@ -3,6 +3,7 @@
 // process subsystem. process.h is intentionally NOT included here to avoid
 // the old process_t definition conflicting with the new one.
 #include "moduos/kernel/process/process_new.h"
+#include "moduos/arch/AMD64/fpu.h"
 
 // Constants defined in process.h that process_new.h does not carry.
 #ifndef KERNEL_STACK_SIZE
@@ -21,7 +22,7 @@ extern uint64_t scheduler_get_clock_ticks(void);
 extern void debug_print_ready_queue(void);
 
 // FPU lazy-switching hooks (fpu_lazy.c).
-extern void fpu_lazy_on_context_switch(process_t *next);
+extern void fpu_lazy_on_context_switch(process_t *prev, process_t *next);
 extern void fpu_lazy_on_process_exit(process_t *p);
 extern void fpu_lazy_handle_nm(void);
 
@@ -29,6 +30,7 @@ extern void fpu_lazy_handle_nm(void);
 #include "moduos/kernel/memory/memory.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/phys.h"
+#include "moduos/kernel/memory/vma.h"
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/macros.h"
 #include "moduos/kernel/debug.h"
@@ -53,8 +55,7 @@ extern int process_register(process_t *proc);
 extern int process_unregister(uint32_t pid);
 extern void process_table_init(void);
 extern void process_return_trampoline(void);
-
-static process_t *current_process = NULL;
+extern void kthread_start_trampoline(void);
 
 static char **copy_argv(int argc, char **argv) {
     if (argc <= 0 || !argv) return NULL;
@@ -83,20 +84,14 @@ static void free_argv(int argc, char **argv) {
     kfree(argv);
 }
 
-// NOTE: cpu-local storage is not fully initialized yet in current boot flow.
-// Until SMP/per-CPU is brought up, use the legacy global pointer.
 static inline process_t *get_curproc(void) {
-    return current_process;
+    return current;
 }
 
-// Global current pointer declared in process_table.c
-extern volatile process_t *current;
-
+/* 'current' lives in this CPU's cpu_local_t; GS base is set up before any
+ * process exists (smp_init_bsp_early() on the BSP, smp_ap_main() on APs). */
 void set_curproc(process_t *p) {
-    current_process = p;
-    // Keep the new-system 'current' pointer in sync so process_new.h
-    // callers (process_get_current, get_current) see the correct process.
-    current = p;
+    cpu_local_get()->current_process = (uint64_t)(uintptr_t)p;
 }
 
 /* Used by the user-mode entry trampoline to retrieve the current process CR3
@@ -130,6 +125,7 @@ void process_destroy(process_t *proc) {
     proc->context.rsp = 0;
     proc->context.rip = 0;
 
+    vma_free_all(proc);
     if (proc->fpu_state)    { kfree(proc->fpu_state);    proc->fpu_state    = NULL; }
     if (proc->argv) { free_argv(proc->argc, proc->argv); proc->argv = NULL; }
     if (proc->envp) { free_argv(proc->envc, proc->envp); proc->envp = NULL; }
@@ -158,18 +154,12 @@ uint64_t *process_get_build_pml4(void) {
     return g_build_pml4;
 }
 
-static void free_user_range(uint64_t start, uint64_t end) {
+static void free_user_range(process_t *p, uint64_t start, uint64_t end) {
     if (end <= start) return;
     start &= ~0xFFFULL;
     end = (end + 0xFFFULL) & ~0xFFFULL;
 
-    for (uint64_t cur = start; cur < end; cur += 0x1000ULL) {
-        uint64_t phys = paging_virt_to_phys(cur);
-        if (phys != 0) {
-            paging_unmap_page(cur);
-            phys_ref_dec(phys & ~0xFFFULL);
-        }
-    }
+    vma_unmap_pages(p, start, end);
 }
 
 void process_free_user_memory(process_t *p) {
@@ -182,22 +172,29 @@ void process_free_user_memory(process_t *p) {
 
     /* Program image mapped by ELF loader (precise range recorded at exec time). */
     if (p->user_image_base && p->user_image_end && p->user_image_end > p->user_image_base) {
-        free_user_range(p->user_image_base, p->user_image_end);
+        free_user_range(p, p->user_image_base, p->user_image_end);
     }
 
     /* User heap mappings created by sys_sbrk() */
-    free_user_range(p->user_heap_base, p->user_heap_end);
+    free_user_range(p, p->user_heap_base, p->user_heap_end);
 
     /* User mmap mappings created by sys_mmap() */
-    free_user_range(p->user_mmap_base, p->user_mmap_end);
+    free_user_range(p, p->user_mmap_base, p->user_mmap_end);
 
     /* User stack region (including any growth). */
     if (p->user_stack_top && p->user_stack_low && p->user_stack_top > p->user_stack_low) {
-        free_user_range(p->user_stack_low, p->user_stack_top);
+        free_user_range(p, p->user_stack_low, p->user_stack_top);
     } else if (p->user_stack) {
         uint64_t base = (uint64_t)(uintptr_t)p->user_stack;
-        free_user_range(base, base + USER_STACK_SIZE);
+        free_user_range(p, base, base + USER_STACK_SIZE);
+    }
+
+    /* Demand-paged areas: ELF segments lie in the ranges above, but MAP_FIXED
+     * mappings can be anywhere. free_user_range() skips pages already freed. */
+    for (vma_t *v = p->vmas; v; v = v->next) {
+        free_user_range(p, v->start, v->end);
     }
+    vma_free_all(p);
 }
 
 /* process_get_current() is a static inline in process_new.h returning 'current'.
@@ -262,14 +259,11 @@ void process_yield_debug(void) {
 }
 #endif
 
-/* process_sleep() is a static inline in process_new.h (uses sleep_on).
+/* process_sleep() is a static inline in process_new.h (uses sleep_ms()).
  * No out-of-line definition needed. */
 
 void process_wake(uint32_t pid) {
-    process_t *p = process_get_by_pid(pid);
-    if (!p || p->state != PROCESS_STATE_SLEEPING) return;
-    p->state = PROCESS_STATE_READY;
-    scheduler_add_process(p);
+    scheduler_wake(process_get_by_pid(pid), NULL);
 }
 
 
@@ -292,8 +286,10 @@ process_t* process_create_with_args(const char *name, void (*entry_point)(void),
         return NULL;
     }
 
+    process_t *creator = get_curproc();
     proc->pid = pid;
-    proc->ppid = current_process ? current_process->pid : 0;
+    proc->ppid = creator ? creator->pid : 0;
+    proc->sched_cpu = -1;
     strncpy(proc->name, name, PROCESS_NAME_MAX - 1);
     proc->state = PROCESS_STATE_READY;
     proc->priority = priority;
@@ -302,11 +298,11 @@ process_t* process_create_with_args(const char *name, void (*entry_point)(void),
      * so they can register devfs nodes. Once user sessions are established,
      * SYS_SETUID can drop privileges.
      */
-    proc->uid = current_process ? current_process->uid : 0;
-    if (!current_process || uid_is_kernel(proc->uid)) {
+    proc->uid = creator ? creator->uid : 0;
+    if (!creator || uid_is_kernel(proc->uid)) {
         proc->uid = 0;
     }
-    proc->gid = current_process ? current_process->gid : 0;
+    proc->gid = creator ? creator->gid : 0;
 
     if (argc > 0 && argv) {
         proc->argv = copy_argv(argc, argv);
@@ -526,7 +522,10 @@ argv_stack_done:;
 
         proc->context.rip = (uint64_t)(uintptr_t)amd64_enter_user_trampoline;
     } else {
-        proc->context.rip = ep;
+        /* Kernel threads start in kthread_start_trampoline, which takes the big
+         * kernel lock and jumps to the entry point held in rbx. */
+        proc->context.rbx = ep;
+        proc->context.rip = (uint64_t)(uintptr_t)kthread_start_trampoline;
     }
 
     uint64_t top = (stack_top(proc->kernel_stack) - 16) & ~0xFULL;
@@ -542,8 +541,8 @@ argv_stack_done:;
     proc->context.rbp = initial_rsp;
     proc->context.rflags = 0x202;
 
-    // fpu_state is a void* — allocate 512-byte FXSAVE area.
-    proc->fpu_state = kzalloc(512);
+    // fpu_state is a void* — FXSAVE/XSAVE area sized for this CPU.
+    proc->fpu_state = fpu_state_alloc();
     if (!proc->fpu_state) {
         COM_LOG_ERROR(COM1_PORT, "Failed to allocate FPU state");
         if (proc->argv) free_argv(proc->argc, proc->argv);
@@ -569,9 +568,9 @@ argv_stack_done:;
         proc->context.rbx = 0;
     }
 
-    if (current_process) {
-        proc->current_slot = current_process->current_slot;
-        strncpy(proc->cwd, current_process->cwd, sizeof(proc->cwd) - 1);
+    if (creator) {
+        proc->current_slot = creator->current_slot;
+        strncpy(proc->cwd, creator->cwd, sizeof(proc->cwd) - 1);
         proc->cwd[sizeof(proc->cwd) - 1] = 0;
     } else {
         proc->current_slot = -1;
@@ -118,6 +118,9 @@ void process_management_init(void) {
     extern void set_curproc(process_t *p);
     set_curproc(idle);
 
+    // The boot thread is the BSP's idle context (run queue fallback).
+    scheduler_register_idle(idle);
+
     // Set up kernel stack for interrupts/syscalls
     uint64_t kstack_top = (uint64_t)idle->kernel_stack + KERNEL_STACK_SIZE - 16;
     amd64_syscall_set_kernel_stack(kstack_top);
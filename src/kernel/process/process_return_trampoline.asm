@@ -1,8 +1,10 @@
 global process_return_trampoline
+global kthread_start_trampoline
 ; Call do_exit(0) when a process returns from its entry point.
 ; do_exit uses the new-system 'current' global, matching both
 ; the new process_new.h API and the legacy process.c path.
 extern do_exit
+extern bkl_lock
 
 section .text
 process_return_trampoline:
@@ -10,3 +12,12 @@ process_return_trampoline:
     call do_exit
     hlt                 ; do_exit never returns; halt if it somehow does
     jmp process_return_trampoline
+
+; First instruction of every kernel thread (context.rip). Kernel threads run
+; under the big kernel lock like syscalls do; the entry point is in rbx.
+; Entered with rsp = 8 (mod 16) just like after a call.
+kthread_start_trampoline:
+    sub rsp, 8
+    call bkl_lock
+    add rsp, 8
+    jmp rbx
@@ -3,8 +3,10 @@
 #include "moduos/kernel/process/process_new.h"
 #include "moduos/kernel/memory/kheap.h"
 #include "moduos/kernel/memory/string.h"
+#include "moduos/kernel/memory/vma.h"
 #include "moduos/kernel/rwlock.h"
 #include "moduos/kernel/spinlock.h"
+#include "moduos/arch/AMD64/fpu.h"
 #include <stdint.h>
 
 // ---------------------------------------------------------------------------
@@ -12,7 +14,6 @@
 // ---------------------------------------------------------------------------
 
 process_t *process_table[MAX_PROCESSES];
-volatile process_t *current = NULL;
 
 static spinlock_t ptable_lock __attribute__((aligned(64)));
 uint32_t next_pid = 1;   // PID 0 reserved for idle; extern-declared in process_new.h
@@ -26,7 +27,6 @@ void process_table_init(void) {
     for (int i = 0; i < MAX_PROCESSES; i++)
         process_table[i] = NULL;
     next_pid = 1;
-    current  = NULL;
 }
 
 // process_table_compat_init() was a separate call in process_init_new.c;
@@ -84,13 +84,13 @@ process_t *process_alloc(void) {
     
     memset(p, 0, sizeof(process_t));
 
-    p->fpu_state = kmalloc(512);   // FXSAVE area
+    p->fpu_state = fpu_state_alloc();   // FXSAVE/XSAVE area
     if (!p->fpu_state) { kfree(p); spinlock_unlock(&ptable_lock); return NULL; }
-    memset(p->fpu_state, 0, 512);
 
     p->pid      = pid;
     p->refcount = 1;
     p->state    = PROCESS_STATE_EMBRYO;
+    p->sched_cpu = -1;
 
     process_table[pid] = p;
     next_pid = (pid + 1 < MAX_PROCESSES) ? pid + 1 : 1;
@@ -107,6 +107,7 @@ void process_free(process_t *p) {
         process_table[p->pid] = NULL;
     spinlock_unlock(&ptable_lock);
 
+    vma_free_all(p);
     if (p->fpu_state)   kfree(p->fpu_state);
     if (p->kernel_stack) kfree(p->kernel_stack);
 
@@ -1,10 +1,24 @@
 // scheduler.c - HTDS (Hybrid-Tree Decay Scheduler) with Red-Black Tree
 //
-// Adapted from anyway™_internal_NTOSIUX scheduler to use global scheduler state
-// while maintaining compatibility with the legacy CFS API.
+// Adapted from anyway™_internal_NTOSIUX scheduler while maintaining
+// compatibility with the legacy CFS API.
 //
 // Red-Black Tree implementation provides O(log N) operations vs O(N) for
 // the previous linked-list CFS scheduler.
+//
+// Each CPU owns a run queue (its own tree, lock and min_vruntime). Processes
+// stay on the queue of the CPU they last ran on; idle or underloaded CPUs pull
+// work from the busiest queue from their timer tick (sched_balance()).
+// Kernel threads are pinned to the BSP.
+//
+// Runtime is charged from sched_clock_ns() (the TSC once calibrated) at every
+// tick and context switch, not as a fixed amount per tick. Every CPU is
+// tickless once its LAPIC timer is one-shot: it is armed for the end of the
+// current slice or the next balance check, and stopped while the CPU is idle.
+// The BSP owns the timebase (derived from the TSC) and the timer wheel, so it
+// also wakes for the next wheel expiry; the PIT only ticks until then. Enqueueing onto an empty
+// remote queue sends that CPU a reschedule IPI, and a busy CPU kicks a
+// stopped one when it has work to spare.
 
 #include "moduos/kernel/process/process_new.h"
 #include "moduos/kernel/spinlock.h"
@@ -13,13 +27,17 @@
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/memory/kheap.h"
 #include "moduos/kernel/debug.h"
+#include "moduos/kernel/smp.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/arch/AMD64/interrupts/apic.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+#include "moduos/kernel/timer_wheel.h"
 #include <stdint.h>
 #include <stdbool.h>
 
 // External declarations
 extern process_t *process_table[MAX_PROCESSES];
 extern process_t *process_find(uint32_t pid);
-extern volatile process_t *current;
 
 // ---------------------------------------------------------------------------
 // Config & globals
@@ -28,6 +46,9 @@ extern volatile process_t *current;
 #define NICE_0_WEIGHT        1024
 #define MIN_GRANULARITY_NS   750000ULL         // 0.75 ms
 #define SCHED_WAKEUP_BONUS_NS 1000000ULL       // 1 ms I/O boost
+#define SCHED_LATENCY_NS     6000000ULL        // every queued process runs once per 6 ms
+#define SCHED_BALANCE_NS      100000000ULL     // busy CPU: pull check every 100 ms
+#define SCHED_IDLE_BALANCE_NS   4000000ULL     // idle CPU with a tick: every 4 ms
 
 // Weight table (Linux prio_to_weight[], nice -20..19)
 static const uint32_t nice_to_weight_table[40] = {
@@ -51,18 +72,41 @@ typedef struct rbtree_node {
     uint64_t vruntime;
 } rbtree_node_t;
 
-// Scheduler state
+// Per-CPU run queue. The lock is also taken from the timer tick, so every
+// other user takes it with interrupts disabled.
 typedef struct {
+    spinlock_t lock;
     rbtree_node_t *root;
     rbtree_node_t *leftmost;
     uint64_t min_vruntime;
-    uint64_t clock_ticks;
-} sched_state_t;
-
-static spinlock_t sched_lock __attribute__((aligned(64)));
-static sched_state_t g_sched;
+    uint64_t clock_ticks;          // timer interrupts taken
+    uint64_t balance_next;         // sched_clock_ns() of the next pull check
+    uint64_t migrations;           // processes pulled onto this queue
+    uint32_t nr_queued;            // processes in the tree
+    process_t *curr;               // process running on this CPU
+    process_t *idle;               // this CPU's idle context
+    int nohz;                      // one-shot LAPIC timer, programmed per event
+    volatile int tick_stopped;     // nohz CPU idle with its timer off
+    volatile uint64_t wheel_next;  // timebase CPU: wheel tick the timer covers
+} sched_rq_t;
+
+static sched_rq_t g_rqs[SMP_MAX_CPUS];
 static int sched_enabled = 0;
 
+static inline sched_rq_t *this_rq(void) {
+    return &g_rqs[get_cpu_id()];
+}
+
+static inline uint32_t rq_cpu(sched_rq_t *rq) {
+    return (uint32_t)(rq - g_rqs);
+}
+
+// Runnable load: queued processes plus whatever non-idle process is running.
+static inline uint32_t rq_load(sched_rq_t *rq) {
+    process_t *c = rq->curr;
+    return rq->nr_queued + ((c && c != rq->idle) ? 1u : 0u);
+}
+
 // Node tracking: indexed by PID to map process -> rbtree_node
 static rbtree_node_t *g_sched_nodes[MAX_PROCESSES];
 
@@ -100,7 +144,14 @@ static inline rbtree_node_t *rbtree_successor(rbtree_node_t *node) {
     return NULL;
 }
 
-static inline void rbtree_rotate_left(rbtree_node_t *node) {
+// In-order successor anywhere in the tree (used to walk a queue in vruntime order).
+static inline rbtree_node_t *rbtree_next(rbtree_node_t *node) {
+    if (node->right != NULL) return rbtree_successor(node);
+    while (node->parent && node == node->parent->right) node = node->parent;
+    return node->parent;
+}
+
+static inline void rbtree_rotate_left(sched_rq_t *rq, rbtree_node_t *node) {
     rbtree_node_t *right_child = node->right;
     if (!right_child) return;
 
@@ -109,7 +160,7 @@ static inline void rbtree_rotate_left(rbtree_node_t *node) {
 
     right_child->parent = node->parent;
     if (!node->parent) {
-        g_sched.root = right_child;
+        rq->root = right_child;
     } else if (node->parent->left == node) {
         node->parent->left = right_child;
     } else {
@@ -120,7 +171,7 @@ static inline void rbtree_rotate_left(rbtree_node_t *node) {
     node->parent = right_child;
 }
 
-static inline void rbtree_rotate_right(rbtree_node_t *node) {
+static inline void rbtree_rotate_right(sched_rq_t *rq, rbtree_node_t *node) {
     rbtree_node_t *left_child = node->left;
     if (!left_child) return;
 
@@ -129,7 +180,7 @@ static inline void rbtree_rotate_right(rbtree_node_t *node) {
 
     left_child->parent = node->parent;
     if (!node->parent) {
-        g_sched.root = left_child;
+        rq->root = left_child;
     } else if (node->parent->left == node) {
         node->parent->left = left_child;
     } else {
@@ -140,7 +191,7 @@ static inline void rbtree_rotate_right(rbtree_node_t *node) {
     node->parent = left_child;
 }
 
-static inline void rbtree_insert_fixup(rbtree_node_t *node) {
+static inline void rbtree_insert_fixup(sched_rq_t *rq, rbtree_node_t *node) {
     while (node->parent && node->parent->is_red) {
         if (node->parent == node->parent->parent->left) {
             rbtree_node_t *uncle = node->parent->parent->right;
@@ -153,11 +204,11 @@ static inline void rbtree_insert_fixup(rbtree_node_t *node) {
             } else {
                 if (node == node->parent->right) {
                     node = node->parent;
-                    rbtree_rotate_left(node);
+                    rbtree_rotate_left(rq, node);
                 }
                 node->parent->is_red = false;
                 node->parent->parent->is_red = true;
-                rbtree_rotate_right(node->parent->parent);
+                rbtree_rotate_right(rq, node->parent->parent);
             }
         } else {
             rbtree_node_t *uncle = node->parent->parent->left;
@@ -170,26 +221,27 @@ static inline void rbtree_insert_fixup(rbtree_node_t *node) {
             } else {
                 if (node == node->parent->left) {
                     node = node->parent;
-                    rbtree_rotate_right(node);
+                    rbtree_rotate_right(rq, node);
                 }
                 node->parent->is_red = false;
                 node->parent->parent->is_red = true;
-                rbtree_rotate_left(node->parent->parent);
+                rbtree_rotate_left(rq, node->parent->parent);
             }
         }
     }
-    if (g_sched.root) g_sched.root->is_red = false;
+    if (rq->root) rq->root->is_red = false;
 }
 
-static inline void rbtree_remove_fixup(rbtree_node_t *node, rbtree_node_t *parent) {
-    while (node != g_sched.root && !node->is_red) {
+static inline void rbtree_remove_fixup(sched_rq_t *rq, rbtree_node_t *node, rbtree_node_t *parent) {
+    // node may be NULL (a removed black leaf); parent tells us where it was.
+    while (node != rq->root && (!node || !node->is_red)) {
         if (node == parent->left) {
             rbtree_node_t *sibling = parent->right;
 
             if (sibling && sibling->is_red) {
                 sibling->is_red = false;
                 parent->is_red = true;
-                rbtree_rotate_left(parent);
+                rbtree_rotate_left(rq, parent);
                 sibling = parent->right;
             }
 
@@ -203,14 +255,14 @@ static inline void rbtree_remove_fixup(rbtree_node_t *node, rbtree_node_t *paren
                 if (!sibling->right || !sibling->right->is_red) {
                     if (sibling->left) sibling->left->is_red = false;
                     sibling->is_red = true;
-                    rbtree_rotate_right(sibling);
+                    rbtree_rotate_right(rq, sibling);
                     sibling = parent->right;
                 }
                 sibling->is_red = parent->is_red;
                 parent->is_red = false;
                 if (sibling->right) sibling->right->is_red = false;
-                rbtree_rotate_left(parent);
-                node = g_sched.root;
+                rbtree_rotate_left(rq, parent);
+                node = rq->root;
                 break;
             }
         } else {
@@ -219,7 +271,7 @@ static inline void rbtree_remove_fixup(rbtree_node_t *node, rbtree_node_t *paren
             if (sibling && sibling->is_red) {
                 sibling->is_red = false;
                 parent->is_red = true;
-                rbtree_rotate_right(parent);
+                rbtree_rotate_right(rq, parent);
                 sibling = parent->left;
             }
 
@@ -233,14 +285,14 @@ static inline void rbtree_remove_fixup(rbtree_node_t *node, rbtree_node_t *paren
                 if (!sibling->left || !sibling->left->is_red) {
                     if (sibling->right) sibling->right->is_red = false;
                     sibling->is_red = true;
-                    rbtree_rotate_left(sibling);
+                    rbtree_rotate_left(rq, sibling);
                     sibling = parent->left;
                 }
                 sibling->is_red = parent->is_red;
                 parent->is_red = false;
                 if (sibling->left) sibling->left->is_red = false;
-                rbtree_rotate_right(parent);
-                node = g_sched.root;
+                rbtree_rotate_right(rq, parent);
+                node = rq->root;
                 break;
             }
         }
@@ -252,7 +304,7 @@ static inline void rbtree_remove_fixup(rbtree_node_t *node, rbtree_node_t *paren
 // Tree insertion
 // ---------------------------------------------------------------------------
 
-static void rbtree_insert(process_t *p) {
+static void rbtree_insert(sched_rq_t *rq, process_t *p) {
     if (!p) return;
 
     rbtree_node_t *node = (rbtree_node_t *)kzalloc(sizeof(rbtree_node_t));
@@ -267,22 +319,22 @@ static void rbtree_insert(process_t *p) {
 
     set_sched_node(p, node);
 
-    if (g_sched.root == NULL) {
-        g_sched.root = node;
+    if (rq->root == NULL) {
+        rq->root = node;
         node->is_red = false;
-        g_sched.leftmost = node;
+        rq->leftmost = node;
         return;
     }
 
-    rbtree_node_t *current = g_sched.root;
+    rbtree_node_t *cur = rq->root;
     rbtree_node_t *parent = NULL;
 
-    while (current != NULL) {
-        parent = current;
-        if (node->vruntime < current->vruntime) {
-            current = current->left;
+    while (cur != NULL) {
+        parent = cur;
+        if (node->vruntime < cur->vruntime) {
+            cur = cur->left;
         } else {
-            current = current->right;
+            cur = cur->right;
         }
     }
 
@@ -293,86 +345,160 @@ static void rbtree_insert(process_t *p) {
         parent->right = node;
     }
 
-    if (node->vruntime < g_sched.leftmost->vruntime) {
-        g_sched.leftmost = node;
+    if (node->vruntime < rq->leftmost->vruntime) {
+        rq->leftmost = node;
     }
 
-    rbtree_insert_fixup(node);
+    rbtree_insert_fixup(rq, node);
 }
 
 // ---------------------------------------------------------------------------
 // Tree removal
 // ---------------------------------------------------------------------------
 
-static void rbtree_remove(process_t *p) {
+static inline void rbtree_transplant(sched_rq_t *rq, rbtree_node_t *u, rbtree_node_t *v) {
+    if (!u->parent) {
+        rq->root = v;
+    } else if (u->parent->left == u) {
+        u->parent->left = v;
+    } else {
+        u->parent->right = v;
+    }
+    if (v) v->parent = u->parent;
+}
+
+static void rbtree_remove(sched_rq_t *rq, process_t *p) {
     if (!p) return;
 
     rbtree_node_t *node = get_sched_node(p);
     if (!node) return;
+
+    // The leftmost node has no left child: its successor is the leftmost node
+    // of its right subtree, or else its parent.
+    if (rq->leftmost == node) {
+        rq->leftmost = node->right ? rbtree_successor(node) : node->parent;
+    }
+
     rbtree_node_t *child, *parent;
-    bool node_was_red = node->is_red;
+    bool removed_red = node->is_red;
 
     if (node->left == NULL) {
         child = node->right;
         parent = node->parent;
-
-        if (child != NULL) child->parent = parent;
-        if (parent == NULL) {
-            g_sched.root = child;
-        } else if (parent->left == node) {
-            parent->left = child;
-        } else {
-            parent->right = child;
-        }
-
-        if (g_sched.leftmost == node) {
-            g_sched.leftmost = (child != NULL) ? child : parent;
-        }
+        rbtree_transplant(rq, node, child);
     } else if (node->right == NULL) {
         child = node->left;
         parent = node->parent;
+        rbtree_transplant(rq, node, child);
+    } else {
+        // Two children: splice the in-order successor into node's position.
+        rbtree_node_t *successor = rbtree_successor(node);
+        removed_red = successor->is_red;
+        child = successor->right;
 
-        if (parent == NULL) {
-            g_sched.root = child;
-        } else if (parent->left == node) {
-            parent->left = child;
+        if (successor->parent == node) {
+            parent = successor;
         } else {
-            parent->right = child;
+            parent = successor->parent;
+            rbtree_transplant(rq, successor, successor->right);
+            successor->right = node->right;
+            successor->right->parent = successor;
         }
 
-        child->parent = parent;
-
-        if (g_sched.leftmost == node) {
-            g_sched.leftmost = child;
-        }
-    } else {
-        rbtree_node_t *successor = rbtree_successor(node);
-        node->vruntime = successor->vruntime;
-        node->process = successor->process;
-        set_sched_node(successor->process, node);
-
-        rbtree_remove(successor->process);
-        return;
+        rbtree_transplant(rq, node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->is_red = node->is_red;
     }
 
-    if (!node_was_red && child != NULL) {
-        rbtree_remove_fixup(child, parent);
+    if (!removed_red) {
+        rbtree_remove_fixup(rq, child, parent);
     }
 
     kfree(node);
     set_sched_node(p, NULL);
 }
 
+// ---------------------------------------------------------------------------
+// Run queue helpers (caller holds rq->lock)
+// ---------------------------------------------------------------------------
+
+static void sched_program_tick(sched_rq_t *rq, uint64_t now);
+
+static void enqueue(sched_rq_t *rq, process_t *p) {
+    if (get_sched_node(p)) return;   // already queued (e.g. woken twice)
+    if (p->weight == 0) p->weight = nice_to_weight(p->nice);
+    if (p->vruntime < rq->min_vruntime) p->vruntime = rq->min_vruntime;
+    rbtree_insert(rq, p);
+    if (get_sched_node(p)) rq->nr_queued++;
+    p->sched_cpu = (int)rq_cpu(rq);
+
+    // A tickless CPU with nothing else queued may be halted with its timer
+    // off, or running one process on a long timeout: make it look again.
+    uint32_t cpu = rq_cpu(rq);
+    if (rq->nohz && rq->nr_queued == 1) {
+        if (cpu != get_cpu_id()) smp_send_resched(cpu);
+        else sched_program_tick(rq, sched_clock_ns());
+    }
+}
+
+static void dequeue(sched_rq_t *rq, process_t *p) {
+    if (!get_sched_node(p)) return;
+    rbtree_remove(rq, p);
+    rq->nr_queued--;
+}
+
+// Lock the run queue p belongs to. p->sched_cpu only changes with that queue
+// locked (migration holds both queues), so re-check after taking the lock.
+static sched_rq_t *lock_task_rq(process_t *p, uint64_t *flags) {
+    for (;;) {
+        int cpu = p->sched_cpu;
+        if (cpu < 0 || cpu >= SMP_MAX_CPUS) return NULL;
+        sched_rq_t *rq = &g_rqs[cpu];
+        spinlock_lock_irqsave(&rq->lock, flags);
+        if (p->sched_cpu == cpu) return rq;
+        spinlock_unlock_irqrestore(&rq->lock, *flags);
+    }
+}
+
+// Home CPU for a process that is not on any queue yet: kernel threads stay on
+// the BSP, user processes go to the least loaded online CPU.
+static int select_cpu(process_t *p) {
+    if (!p->is_user) return 0;
+
+    uint32_t n = smp_cpu_count();
+    if (n > SMP_MAX_CPUS) n = SMP_MAX_CPUS;
+    int best = 0;
+    uint32_t best_load = rq_load(&g_rqs[0]);
+    for (uint32_t c = 1; c < n; c++) {
+        if (smp_get_cpu_state(c) != CPU_STATE_RUNNING) continue;
+        uint32_t load = rq_load(&g_rqs[c]);
+        if (load < best_load) { best = (int)c; best_load = load; }
+    }
+    return best;
+}
+
 // ---------------------------------------------------------------------------
 // Public API for process.c
 // ---------------------------------------------------------------------------
 
 void scheduler_init(void) {
-    spinlock_init(&sched_lock);
-    g_sched.root = NULL;
-    g_sched.leftmost = NULL;
-    g_sched.min_vruntime = 0;
-    g_sched.clock_ticks = 0;
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        sched_rq_t *rq = &g_rqs[c];
+        spinlock_init(&rq->lock);
+        rq->root = NULL;
+        rq->leftmost = NULL;
+        rq->min_vruntime = 0;
+        rq->clock_ticks = 0;
+        rq->balance_next = SCHED_BALANCE_NS;
+        rq->migrations = 0;
+        rq->nr_queued = 0;
+        rq->curr = NULL;
+        rq->idle = NULL;
+        rq->nohz = 0;
+        rq->tick_stopped = 0;
+        rq->wheel_next = TIMER_NO_EXPIRY;
+    }
     sched_enabled = 1;
     com_write_string(COM1_PORT, "[SCHED] HTDS (Red-Black Tree Decay Scheduler) initialized\n");
 }
@@ -380,60 +506,74 @@ void scheduler_init(void) {
 // Compatibility alias
 void scheduler_compat_init(void) { /* no-op */ }
 
+// Called on each CPU with the context that becomes its idle process.
+void scheduler_register_idle(process_t *idle) {
+    sched_rq_t *rq = this_rq();
+    idle->sched_cpu = (int)rq_cpu(rq);
+    idle->on_cpu = 1;
+    rq->idle = idle;
+    rq->curr = idle;
+}
+
 void scheduler_add_process(process_t *p) {
     if (!p) return;
-    spinlock_lock(&sched_lock);
-    if (p->state != PROCESS_STATE_ZOMBIE && p->state != PROCESS_STATE_TERMINATED) {
-        if (p->weight == 0) p->weight = nice_to_weight(p->nice);
-        if (p->vruntime < g_sched.min_vruntime) p->vruntime = g_sched.min_vruntime;
-        rbtree_insert(p);
-        p->state = PROCESS_STATE_READY;
+    if (p->state == PROCESS_STATE_ZOMBIE || p->state == PROCESS_STATE_TERMINATED) return;
+
+    uint64_t flags;
+    sched_rq_t *rq = lock_task_rq(p, &flags);
+    if (!rq) {
+        rq = &g_rqs[select_cpu(p)];
+        spinlock_lock_irqsave(&rq->lock, &flags);
     }
-    spinlock_unlock(&sched_lock);
+    enqueue(rq, p);
+    p->state = PROCESS_STATE_READY;
+    spinlock_unlock_irqrestore(&rq->lock, flags);
 }
 
 void scheduler_add(process_t *p) { scheduler_add_process(p); }
 
 void scheduler_remove_process(process_t *p) {
     if (!p) return;
-    spinlock_lock(&sched_lock);
-    rbtree_remove(p);
-    spinlock_unlock(&sched_lock);
+    uint64_t flags;
+    sched_rq_t *rq = lock_task_rq(p, &flags);
+    if (!rq) return;
+    dequeue(rq, p);
+    spinlock_unlock_irqrestore(&rq->lock, flags);
 }
 
 void scheduler_remove(process_t *p) { scheduler_remove_process(p); }
 
-// Getters
-uint64_t scheduler_get_min_vruntime(void)  { return g_sched.min_vruntime; }
-uint64_t scheduler_get_clock_ticks(void)   { return g_sched.clock_ticks;  }
+// Getters (this CPU's queue)
+uint64_t scheduler_get_min_vruntime(void)  { return this_rq()->min_vruntime; }
+uint64_t scheduler_get_clock_ticks(void)   { return this_rq()->clock_ticks;  }
 
 // Pick next process to run
-static process_t *pick_next(void) {
-    spinlock_lock(&sched_lock);
+static process_t *pick_next(sched_rq_t *rq) {
+    uint64_t flags;
+    spinlock_lock_irqsave(&rq->lock, &flags);
     process_t *p = NULL;
-    if (g_sched.leftmost) {
-        p = g_sched.leftmost->process;
-        rbtree_remove(p);
+    if (rq->leftmost) {
+        p = rq->leftmost->process;
+        dequeue(rq, p);
     }
-    spinlock_unlock(&sched_lock);
+    spinlock_unlock_irqrestore(&rq->lock, flags);
     return p;
 }
 
-// Re-enqueue a process
-static void requeue(process_t *p) {
+// Re-enqueue the outgoing process on this CPU's queue
+static void requeue(sched_rq_t *rq, process_t *p) {
     if (!p) return;
-    spinlock_lock(&sched_lock);
+    uint64_t flags;
+    spinlock_lock_irqsave(&rq->lock, &flags);
     if (p->state != PROCESS_STATE_ZOMBIE && p->state != PROCESS_STATE_TERMINATED) {
-        if (p->weight == 0) p->weight = nice_to_weight(p->nice);
-        if (p->vruntime < g_sched.min_vruntime) p->vruntime = g_sched.min_vruntime;
-        rbtree_insert(p);
+        enqueue(rq, p);
         p->state = PROCESS_STATE_READY;
     }
-    spinlock_unlock(&sched_lock);
+    spinlock_unlock_irqrestore(&rq->lock, flags);
 }
 
-// Update vruntime based on execution time
-static void update_curr(process_t *p, uint64_t delta_ns) {
+// Update vruntime based on execution time (timer tick, interrupts off)
+static void update_curr(sched_rq_t *rq, process_t *p, uint64_t delta_ns) {
     if (!p) return;
     if (p->weight == 0) p->weight = nice_to_weight(p->nice);
     if (p->weight == 0) p->weight = NICE_0_WEIGHT;
@@ -441,8 +581,137 @@ static void update_curr(process_t *p, uint64_t delta_ns) {
     p->vruntime += (delta_ns * NICE_0_WEIGHT) / p->weight;
 
     // Advance min_vruntime
-    if (g_sched.leftmost && g_sched.leftmost->vruntime > g_sched.min_vruntime)
-        g_sched.min_vruntime = g_sched.leftmost->vruntime;
+    spinlock_lock(&rq->lock);
+    if (rq->leftmost && rq->leftmost->vruntime > rq->min_vruntime)
+        rq->min_vruntime = rq->leftmost->vruntime;
+    spinlock_unlock(&rq->lock);
+}
+
+// Charge the running process for the time since it was last charged.
+static void account_curr(sched_rq_t *rq, process_t *p, uint64_t now) {
+    if (!p || p == rq->idle || p->pid == 0) return;
+    if (now > p->exec_start) {
+        uint64_t delta = now - p->exec_start;
+        update_curr(rq, p, delta);
+        p->runtime_ns += delta;
+        uint32_t hz = get_pit_frequency();
+        p->total_time = p->runtime_ns / (1000000000ULL / (hz ? hz : 100));
+    }
+    p->exec_start = now;
+}
+
+// Tickless CPUs: arm the one-shot timer for the next thing this CPU has to
+// do, or stop it when there is nothing to do. The timebase CPU (the BSP)
+// also runs the timer wheel, so it wakes for the next wheel expiry as well.
+// Interrupts off.
+static void sched_program_tick(sched_rq_t *rq, uint64_t now) {
+    if (!rq->nohz) return;
+
+    uint64_t until = UINT64_MAX;
+    process_t *c = rq->curr;
+    if (!c || c == rq->idle) {
+        // Idle: tick_stopped tells busy CPUs to kick us, even if the wheel
+        // still has us wake up now and then.
+        rq->tick_stopped = rq->nr_queued == 0;
+        if (rq->nr_queued) until = MIN_GRANULARITY_NS;
+    } else {
+        rq->tick_stopped = 0;
+        until = rq->balance_next > now ? rq->balance_next - now : MIN_GRANULARITY_NS;
+        if (rq->nr_queued) {
+            uint64_t slice = SCHED_LATENCY_NS / (rq->nr_queued + 1u);
+            if (slice < MIN_GRANULARITY_NS) slice = MIN_GRANULARITY_NS;
+            if (slice < until) until = slice;
+        }
+    }
+
+    if (rq_cpu(rq) == 0) {
+        // Anything armed while we look must kick us (see scheduler_timer_armed).
+        rq->wheel_next = TIMER_NO_EXPIRY;
+        uint64_t next = timer_next_expiry();
+        rq->wheel_next = next;
+        if (next != TIMER_NO_EXPIRY) {
+            uint64_t wheel_ns = timer_ns_until_tick(next);
+            if (wheel_ns < until) until = wheel_ns;
+        }
+    }
+
+    if (until == UINT64_MAX) apic_timer_stop();
+    else apic_timer_arm_ns(until);
+}
+
+// timer_arm() hook: a deadline earlier than the one the tickless timebase
+// CPU is armed for needs that CPU to re-program its timer.
+void scheduler_timer_armed(uint64_t deadline) {
+    if (!sched_enabled) return;
+    sched_rq_t *rq = &g_rqs[0];
+    if (!rq->nohz || deadline >= rq->wheel_next) return;
+
+    if (get_cpu_id() != 0) {
+        smp_send_resched(0);
+        return;
+    }
+    uint64_t f = irq_save();
+    sched_program_tick(rq, sched_clock_ns());
+    irq_restore(f);
+}
+
+// ---------------------------------------------------------------------------
+// Load balancing — called from the timer tick (interrupts off)
+// ---------------------------------------------------------------------------
+
+static void sched_balance(sched_rq_t *rq, uint64_t now) {
+    uint32_t my_load = rq_load(rq);
+    rq->balance_next = now + (my_load ? SCHED_BALANCE_NS : SCHED_IDLE_BALANCE_NS);
+
+    uint32_t n = smp_cpu_count();
+    if (n < 2) return;
+    if (n > SMP_MAX_CPUS) n = SMP_MAX_CPUS;
+
+    // Stopped CPUs do not come looking for work; wake one to pull ours.
+    if (my_load >= 2) {
+        for (uint32_t c = 0; c < n; c++) {
+            sched_rq_t *other = &g_rqs[c];
+            if (other == rq || !other->tick_stopped) continue;
+            if (smp_get_cpu_state(c) != CPU_STATE_RUNNING) continue;
+            other->tick_stopped = 0;
+            smp_send_resched(c);
+            break;
+        }
+    }
+
+    sched_rq_t *busiest = NULL;
+    uint32_t max_load = 0;
+    for (uint32_t c = 0; c < n; c++) {
+        sched_rq_t *other = &g_rqs[c];
+        if (other == rq || smp_get_cpu_state(c) != CPU_STATE_RUNNING) continue;
+        uint32_t load = rq_load(other);
+        if (load > max_load) { max_load = load; busiest = other; }
+    }
+    // Moving one process only helps when it leaves the queues closer to even.
+    if (!busiest || max_load < my_load + 2) return;
+
+    // Lock both queues in address order so two CPUs pulling from each other cannot deadlock.
+    sched_rq_t *first = rq < busiest ? rq : busiest;
+    sched_rq_t *second = rq < busiest ? busiest : rq;
+    spinlock_lock(&first->lock);
+    spinlock_lock(&second->lock);
+
+    // Pull the most deserving (lowest vruntime) process that may leave its CPU.
+    for (rbtree_node_t *node = busiest->leftmost; node; node = rbtree_next(node)) {
+        process_t *p = node->process;
+        if (!p->is_user || p->on_cpu) continue;
+
+        dequeue(busiest, p);
+        // Keep its lag relative to the queue it joins.
+        uint64_t lag = p->vruntime > busiest->min_vruntime ? p->vruntime - busiest->min_vruntime : 0;
+        p->vruntime = rq->min_vruntime + lag;
+        enqueue(rq, p);
+        rq->migrations++;
+        break;
+    }
+
+    spinlock_unlock(&second->lock);
+    spinlock_unlock(&first->lock);
 }
 
 // ---------------------------------------------------------------------------
@@ -452,75 +721,181 @@ static void update_curr(process_t *p, uint64_t delta_ns) {
 void schedule(void) {
     if (!sched_enabled) return;
 
-    process_t *prev = (process_t *)current;
+    // No migration between choosing this CPU's queue and switching.
+    uint64_t irqf = irq_save();
+    sched_rq_t *rq = this_rq();
+
+    process_t *prev = current;
     process_t *next = NULL;
+    uint64_t now = sched_clock_ns();
 
-    if (prev) prev->need_resched = 0;
+    if (prev) {
+        prev->need_resched = 0;
+        account_curr(rq, prev, now);
+    }
 
-    if (prev && prev->pid != 0 &&
-        (prev->state == PROCESS_STATE_RUNNING  ||
-         prev->state == PROCESS_STATE_RUNNABLE ||
-         prev->state == PROCESS_STATE_READY)) {
-        requeue(prev);
+    if (prev && prev->pid != 0) {
+        // Decide under wake_lock so a concurrent scheduler_wake() either sees
+        // us still running (and just cancels the sleep) or sees us blocked
+        // (and queues us); never both.
+        spinlock_lock(&prev->wake_lock);
+        if (prev->state == PROCESS_STATE_SLEEPING) {
+            prev->sched_blocked = 1;
+        } else if (prev->state == PROCESS_STATE_RUNNING  ||
+                   prev->state == PROCESS_STATE_RUNNABLE ||
+                   prev->state == PROCESS_STATE_READY) {
+            requeue(rq, prev);
+        }
+        spinlock_unlock(&prev->wake_lock);
     }
 
-    next = pick_next();
-    if (!next) next = process_find(0);
+    next = pick_next(rq);
+    if (!next && rq->nohz) {
+        // About to idle with the tick off: look for work elsewhere first.
+        rq->curr = rq->idle;
+        sched_balance(rq, now);
+        next = pick_next(rq);
+    }
+    if (!next) next = rq->idle ? rq->idle : process_find(0);
 
     if (next) {
+        // A process woken on this queue may still be switching out on another CPU.
+        if (next != prev) {
+            while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) cpu_relax();
+            next->on_cpu = 1;
+        }
         next->state = PROCESS_STATE_RUNNING;
         next->need_resched = 0;
+        next->exec_start = now;
+        rq->curr = next;
     }
+    sched_program_tick(rq, now);
 
+    int bkl_depth = 0;
     if (prev != next && next) {
-        extern void set_curproc(process_t *p);
         set_curproc(next);
 
+        // The big kernel lock is per CPU, not per process: hand it back while
+        // another process runs here and take it again once prev resumes.
+        bkl_depth = bkl_release_all();
+
         extern void switch_to(process_t *prev, process_t *next);
         switch_to(prev, next);
     }
+
+    irq_restore(irqf);
+    bkl_reacquire(bkl_depth);
 }
 
 // ---------------------------------------------------------------------------
-// scheduler_tick() — called from timer IRQ (~1 kHz)
+// scheduler_tick() — called from timer IRQ (~1 kHz) on every CPU
 // ---------------------------------------------------------------------------
 
 void scheduler_tick(void) {
     if (!sched_enabled) return;
 
-    process_t *curr_cast = (process_t *)current;
+    sched_rq_t *rq = this_rq();
+    process_t *curr_cast = current;
+
+    rq->clock_ticks++;
+    uint64_t now = sched_clock_ns();
+
+    if (curr_cast) {
+        account_curr(rq, curr_cast, now);
+        if (rq->min_vruntime > 0 && curr_cast->vruntime > rq->min_vruntime + MIN_GRANULARITY_NS)
+            curr_cast->need_resched = 1;
+    }
+
+    if (now >= rq->balance_next) sched_balance(rq, now);
+    sched_program_tick(rq, now);
+}
 
-    g_sched.clock_ticks++;
+// Reschedule IPI (interrupt context): something was queued here, or another
+// CPU wants us to pull. An idle CPU leaves hlt and its loop calls
+// schedule(); a busy one picks up a slice-length timer.
+void scheduler_resched_ipi(void) {
+    if (!sched_enabled) return;
+    sched_rq_t *rq = this_rq();
+    rq->tick_stopped = 0;
+    process_t *c = rq->curr;
+    if (c && c != rq->idle && rq->nr_queued) c->need_resched = 1;
+    sched_program_tick(rq, sched_clock_ns());
+}
 
-    update_curr(curr_cast, 1000000ULL /* 1 ms per tick */);
+// Called by a CPU that runs its LAPIC timer one-shot (before it first
+// schedules, or with interrupts off): from now on it is only interrupted
+// when it has work to time.
+void scheduler_set_nohz(void) {
+    sched_rq_t *rq = this_rq();
+    rq->wheel_next = TIMER_NO_EXPIRY;
+    rq->nohz = 1;
+    sched_program_tick(rq, sched_clock_ns());
+}
 
-    if (g_sched.min_vruntime > 0 && curr_cast->vruntime > g_sched.min_vruntime + MIN_GRANULARITY_NS)
-        curr_cast->need_resched = 1;
+// Idle loops check this with interrupts disabled right before sti; hlt, so a
+// reschedule IPI cannot slip in between the check and the halt.
+int scheduler_idle_has_work(void) {
+    return this_rq()->nr_queued != 0;
 }
 
 // ---------------------------------------------------------------------------
 // sleep / wakeup
+//
+// A process goes to sleep in two steps: scheduler_set_sleeping() marks it
+// SLEEPING while it is still running, then schedule() switches it out. A
+// wakeup that lands in between just flips it back to RUNNING, so the
+// schedule() call returns at once and nobody ever queues a process that is
+// still on a CPU. Wait queues and channels live in waitqueue.c.
 // ---------------------------------------------------------------------------
 
-void sleep_on(void *channel) {
-    if (!current) return;
-    
-    process_t *curr_cast = (process_t *)current;
-    curr_cast->wait_channel = channel;
-    curr_cast->state = PROCESS_STATE_SLEEPING;
-    scheduler_remove_process(curr_cast);
-    schedule();
-}
-
-void wakeup(void *channel) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_t *p = process_table[i];
-        if (p && p->state == PROCESS_STATE_SLEEPING &&
-            p->wait_channel == channel) {
-            p->wait_channel = NULL;
-            scheduler_add_process(p);
+void scheduler_set_sleeping(process_t *p, void *channel) {
+    uint64_t flags;
+    spinlock_lock_irqsave(&p->wake_lock, &flags);
+    p->wait_channel = channel;
+    p->state = PROCESS_STATE_SLEEPING;
+    spinlock_unlock_irqrestore(&p->wake_lock, flags);
+}
+
+void scheduler_wait_done(process_t *p) {
+    uint64_t flags;
+    spinlock_lock_irqsave(&p->wake_lock, &flags);
+    if (p->state == PROCESS_STATE_SLEEPING) {
+        p->wait_channel = NULL;
+        p->state = PROCESS_STATE_RUNNING;
+    }
+    spinlock_unlock_irqrestore(&p->wake_lock, flags);
+}
+
+// Make a sleeping process runnable. channel == NULL wakes it whatever it is
+// waiting for. Returns 1 if p was woken.
+int scheduler_wake(process_t *p, void *channel) {
+    if (!p) return 0;
+    uint64_t flags;
+    spinlock_lock_irqsave(&p->wake_lock, &flags);
+    if (p->state != PROCESS_STATE_SLEEPING ||
+        (channel != NULL && p->wait_channel != channel)) {
+        spinlock_unlock_irqrestore(&p->wake_lock, flags);
+        return 0;
+    }
+    p->wait_channel = NULL;
+    if (!p->sched_blocked) {
+        // Not switched out yet: cancel the sleep in place.
+        p->state = PROCESS_STATE_RUNNING;
+    } else {
+        // Back onto the queue it last ran on, or the least loaded one.
+        p->sched_blocked = 0;
+        uint64_t rqf;
+        sched_rq_t *rq = lock_task_rq(p, &rqf);
+        if (!rq) {
+            rq = &g_rqs[select_cpu(p)];
+            spinlock_lock_irqsave(&rq->lock, &rqf);
         }
+        enqueue(rq, p);
+        p->state = PROCESS_STATE_READY;
+        spinlock_unlock_irqrestore(&rq->lock, rqf);
     }
+    spinlock_unlock_irqrestore(&p->wake_lock, flags);
+    return 1;
 }
 
 // ---------------------------------------------------------------------------
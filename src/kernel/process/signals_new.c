@@ -32,13 +32,9 @@ int send_signal(uint32_t pid, int sig) {
     // Set pending signal bit
     p->pending_signals |= (1ULL << sig);
     
-    /* If the process is sleeping, move it to the compat CFS queue so that
-     * schedule() can pick it up.  scheduler_add() delegates to the same
-     * compat queue, so this is consistent with the wakeup() path. */
-    if (p->state == PROCESS_STATE_SLEEPING) {
-        p->state = PROCESS_STATE_RUNNABLE;
-        scheduler_add(p);   /* → scheduler_add_process() → compat CFS queue */
-    }
+    /* If the process is sleeping (on a channel or a timed sleep), put it back
+     * on its run queue so it can act on the signal. */
+    scheduler_wake(p, NULL);
     
     return 0;
 }
@@ -114,6 +114,10 @@ int do_waitpid(int32_t pid, int *status, int options) {
             // parent's.  Without this, free_user_range() would unmap the parent's
             // pages at the same virtual addresses, corrupting the parent.
             
+            // A child that exited on another CPU may still be leaving switch_to()
+            // there, running on its kernel stack and page tables. Wait it out.
+            while (found->on_cpu) cpu_relax();
+
             // Get the ACTUAL current CR3 - this is what we need to restore to
             uint64_t actual_current_cr3;
             __asm__ volatile("mov %%cr3, %0" : "=r"(actual_current_cr3));
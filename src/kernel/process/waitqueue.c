@@ -0,0 +1,188 @@
+// waitqueue.c - wait queues and the hashed legacy sleep_on()/wakeup() channels
+
+#include "moduos/kernel/process/waitqueue.h"
+#include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/timer_wheel.h"
+#include "moduos/arch/AMD64/interrupts/timer.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Caller holds wq->lock.
+static void wq_check_init(wait_queue_t *wq) {
+    if (!wq->head.next) {
+        wq->head.next = &wq->head;
+        wq->head.prev = &wq->head;
+    }
+}
+
+static int we_linked(wait_entry_t *we) {
+    return we->next != NULL;
+}
+
+static void we_add(wait_queue_t *wq, wait_entry_t *we) {
+    // Non-exclusive waiters go first so a bounded wake reaches all of them
+    // before it starts counting exclusive ones.
+    wait_entry_t *at = we->exclusive ? wq->head.prev : &wq->head;
+    we->prev = at;
+    we->next = at->next;
+    at->next->prev = we;
+    at->next = we;
+    wq->nr_waiters++;
+}
+
+static void we_del(wait_queue_t *wq, wait_entry_t *we) {
+    we->prev->next = we->next;
+    we->next->prev = we->prev;
+    we->next = NULL;
+    we->prev = NULL;
+    wq->nr_waiters--;
+}
+
+void wait_queue_init(wait_queue_t *wq) {
+    spinlock_init(&wq->lock);
+    wq->head.next = &wq->head;
+    wq->head.prev = &wq->head;
+    wq->head.proc = NULL;
+    wq->nr_waiters = 0;
+}
+
+int wait_can_block(void) {
+    // PID 0 is a CPU's boot/idle context and what schedule() falls back to.
+    process_t *p = current;
+    return p && p->pid != 0;
+}
+
+static void prepare_to_wait_key(wait_queue_t *wq, wait_entry_t *we, int exclusive, void *key) {
+    process_t *p = current;
+    we->proc = p;
+    we->key = key;
+    we->exclusive = exclusive;
+
+    uint64_t flags;
+    spinlock_lock_irqsave(&wq->lock, &flags);
+    wq_check_init(wq);
+    we_add(wq, we);
+    scheduler_set_sleeping(p, key);
+    spinlock_unlock_irqrestore(&wq->lock, flags);
+}
+
+void prepare_to_wait(wait_queue_t *wq, wait_entry_t *we, int exclusive) {
+    prepare_to_wait_key(wq, we, exclusive, wq);
+}
+
+void finish_wait(wait_queue_t *wq, wait_entry_t *we) {
+    uint64_t flags;
+    spinlock_lock_irqsave(&wq->lock, &flags);
+    if (we_linked(we)) we_del(wq, we);
+    spinlock_unlock_irqrestore(&wq->lock, flags);
+
+    scheduler_wait_done(current);
+}
+
+// Wake entries whose key matches. Woken entries are unlinked here so a
+// second wake before the sleeper runs does not count them again.
+static int wake_key(wait_queue_t *wq, void *key, int nr_exclusive) {
+    int woken = 0;
+    uint64_t flags;
+    spinlock_lock_irqsave(&wq->lock, &flags);
+    wq_check_init(wq);
+    wait_entry_t *we = wq->head.next;
+    while (we != &wq->head) {
+        wait_entry_t *next = we->next;
+        if (we->key == key && scheduler_wake(we->proc, key)) {
+            int exclusive = we->exclusive;
+            we_del(wq, we);
+            woken++;
+            if (exclusive && nr_exclusive > 0 && --nr_exclusive == 0) break;
+        }
+        we = next;
+    }
+    spinlock_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+int wake_up_nr(wait_queue_t *wq, int nr_exclusive) {
+    if (!wait_queue_active(wq)) return 0;
+    return wake_key(wq, wq, nr_exclusive);
+}
+
+// ---------------------------------------------------------------------------
+// Blocking with a deadline
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    ktimer_t timer;
+    process_t *proc;
+    void *key;
+} wq_timeout_t;
+
+static void wq_timeout_fire(void *arg) {
+    wq_timeout_t *t = (wq_timeout_t *)arg;
+    scheduler_wake(t->proc, t->key);
+}
+
+int schedule_until(uint64_t deadline) {
+    process_t *p = current;
+    if (!deadline) {
+        schedule();
+        return 0;
+    }
+
+    wq_timeout_t to;
+    timer_setup(&to.timer, wq_timeout_fire, &to);
+    to.proc = p;
+    to.key = p->wait_channel;
+    p->sleep_ticks = deadline;
+    timer_arm(&to.timer, deadline);
+
+    schedule();
+
+    int fired = !timer_cancel(&to.timer);
+    p->sleep_ticks = 0;
+    return fired ? -1 : 0;
+}
+
+// One prepare/schedule/finish round. Returns -1 if the deadline woke us.
+static int wq_block(wait_queue_t *wq, void *key, uint64_t deadline) {
+    wait_entry_t we;
+    prepare_to_wait_key(wq, &we, 0, key);
+    int rc = schedule_until(deadline);
+    finish_wait(wq, &we);
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Legacy channels
+//
+// sleep_on(channel) parks the caller in the bucket its channel hashes to and
+// wakeup(channel) only walks that bucket, instead of every process slot.
+// ---------------------------------------------------------------------------
+
+#define WQ_HASH_BITS 6
+#define WQ_HASH_SIZE (1u << WQ_HASH_BITS)
+
+static wait_queue_t g_chan_wq[WQ_HASH_SIZE];
+
+static wait_queue_t *chan_wq(void *channel) {
+    uint64_t h = (uint64_t)(uintptr_t)channel * 0x9E3779B97F4A7C15ULL;
+    return &g_chan_wq[h >> (64 - WQ_HASH_BITS)];
+}
+
+void sleep_on(void *channel) {
+    if (!wait_can_block()) return;
+    wq_block(chan_wq(channel), channel, 0);
+}
+
+int sleep_on_timeout(void *channel, uint64_t deadline) {
+    if ((int64_t)(get_system_ticks() - deadline) >= 0) return 0;
+    if (!wait_can_block()) {
+        sleep_until(deadline);
+        return 0;
+    }
+    return wq_block(chan_wq(channel), channel, deadline) == 0;
+}
+
+void wakeup(void *channel) {
+    wait_queue_t *wq = chan_wq(channel);
+    if (wait_queue_active(wq)) wake_key(wq, channel, 0);
+}
@@ -7,10 +7,13 @@
 #include "moduos/kernel/errno.h"
 // #include "moduos/kernel/process/process.h"  // OLD
 #include "moduos/kernel/process/process_new.h"
+#include "moduos/kernel/smp.h"
 #include "moduos/kernel/memory/memory.h"
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/memory/usercopy.h"
 #include "moduos/kernel/loader/elf.h"
+#include "moduos/kernel/loader/exec_image.h"
+#include "moduos/kernel/memory/vma.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/phys.h"
 #include "moduos/fs/fs.h"
@@ -432,7 +435,6 @@ static int build_user_stack(process_t *p, int argc, char **kargv, int envc, char
 }
 
 int sys_execve_impl(const char *path_user, char *const *argv_user, char *const *envp_user) {
-    extern volatile process_t *current;
     com_write_string(COM1_PORT, "[EXECVE] Entry: current=0x");
     com_write_hex64(COM1_PORT, (uint64_t)(uintptr_t)current);
     com_write_string(COM1_PORT, "\n");
@@ -514,24 +516,38 @@ int sys_execve_impl(const char *path_user, char *const *argv_user, char *const *
         if (rc != 0) { free_strv(kargv, argc); return rc; }
     }
 
-    // Read ELF into kernel buffer.
-    void *elf_buf = kmalloc(st.size);
-    if (!elf_buf) { free_strv(kargv, argc); free_strv(kenvp, envc); return -ENOMEM; }
-    size_t rd = 0;
-    if (fs_read_file(mnt, rel, elf_buf, st.size, &rd) != 0 || rd < sizeof(elf64_ehdr_t)) {
-        kfree(elf_buf);
+    // Map the executable lazily: nothing but its program headers is read
+    // here. Segment pages are faulted in from the shared image (vma.c), so
+    // exec cost no longer scales with binary size. The new VMAs are built
+    // aside first, so a bad binary fails with the old image still intact.
+    exec_image_t *img = exec_image_open(mnt, rel, &st);
+    if (!img) { free_strv(kargv, argc); free_strv(kenvp, envc); return -ENOMEM; }
+
+    uint64_t entry = 0;
+    uint64_t img_base = 0, img_end = 0;
+    vma_t *old_vmas = p->vmas;
+    p->vmas = NULL;
+    rc = elf_map_image(p, img, &entry, &img_base, &img_end);
+    exec_image_put(img);   // the VMAs hold their own references
+    vma_t *new_vmas = p->vmas;
+    p->vmas = old_vmas;
+    if (rc != 0) {
+        p->vmas = new_vmas;
+        vma_free_all(p);
+        p->vmas = old_vmas;
         free_strv(kargv, argc);
         free_strv(kenvp, envc);
-        return -ENOENT;
+        return -ENOEXEC;
     }
 
     // Create a fresh PML4 for the new image BEFORE switching to process CR3.
     // CRITICAL: paging_create_process_pml4() must copy kernel mappings from
     // the current kernel CR3, not from a process CR3 with incomplete mappings!
-    extern void process_set_build_pml4(uint64_t *virt, uint64_t phys);
     uint64_t new_cr3 = paging_create_process_pml4();
     if (!new_cr3) {
-        kfree(elf_buf);
+        p->vmas = new_vmas;
+        vma_free_all(p);
+        p->vmas = old_vmas;
         free_strv(kargv, argc);
         free_strv(kenvp, envc);
         return -ENOMEM;
@@ -542,27 +558,12 @@ int sys_execve_impl(const char *path_user, char *const *argv_user, char *const *
     // page tables, not whatever PML4 was last switched in.
     extern void paging_switch_cr3(uint64_t);
     paging_switch_cr3(p->cr3);
-    process_free_user_memory(p);
+    process_free_user_memory(p);   // also drops the old VMAs
     p->user_image_base = 0;
     p->user_image_end  = 0;
     p->user_heap_end   = p->user_heap_base;
     p->user_mmap_end   = p->user_mmap_base;
-    
-    // Set up the build PML4 pointer for ELF loading
-    uint64_t *new_pml4_virt = (uint64_t *)phys_to_virt_kernel(new_cr3 & ~0xFFFULL);
-    process_set_build_pml4(new_pml4_virt, new_cr3);
-
-    // Load ELF — segments go into new_pml4 via g_build_pml4.
-    uint64_t entry = 0;
-    uint64_t img_base = 0, img_end = 0;
-    rc = elf_load_with_args(elf_buf, rd, &entry, 0, NULL, &img_base, &img_end);
-    kfree(elf_buf);
-    process_set_build_pml4(NULL, 0);   // clear so stale pointer isn't reused
-    if (rc != 0) {
-        free_strv(kargv, argc);
-        free_strv(kenvp, envc);
-        return -ENOEXEC;
-    }
+    p->vmas = new_vmas;
 
     // Commit the new address space to the process and switch CR3 now so that
     // build_user_stack() and amd64_enter_user_now() see the correct mappings.
@@ -642,6 +643,7 @@ int sys_execve_impl(const char *path_user, char *const *argv_user, char *const *
     p->user_rsp = user_rsp;
 
     __asm__ volatile("cli");
+    bkl_release_all();   // leaving the kernel without unwinding syscall_handler()
     amd64_enter_user_now(entry, user_rsp, (uint64_t)argc, user_argv, user_envp);
 
     // not reached
@@ -1,7 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only
 //
 // ModuOS Kernel (GPLv2)
-// fork_impl.c - Linux-like fork() for ModuOS (full address-space copy)
+// fork_impl.c - Linux-like fork() for ModuOS (copy-on-write address space)
 // Included by syscall.c
 
 #include "moduos/kernel/errno.h"
@@ -12,9 +12,12 @@
 #include "moduos/kernel/memory/string.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/phys.h"
+#include "moduos/kernel/memory/fork_memory.h"
+#include "moduos/kernel/memory/vma.h"
 #include "moduos/kernel/COM/com.h"
+#include "moduos/arch/AMD64/cpu.h"
+#include "moduos/arch/AMD64/fpu.h"
 
-extern volatile uint64_t g_syscall_entry_rbp;
 extern void syscall_entry_return(void);
 
 // From process.c (private); replicate constants
@@ -48,13 +51,11 @@ static void fork_free_strv(char **v, int n) {
     kfree(v);
 }
 
-extern uint64_t phys_alloc_frame(void);
-extern void     phys_free_frame(uint64_t phys);
-
-// Clone the parent's user address space into a fresh PML4 by physically
-// copying each mapped user page.  This allocates fresh physical frames for each
-// user page, ensuring the child has an independent copy that won't corrupt the
-// parent when process_free_user_memory() is called.
+// Clone the parent's user address space into a fresh PML4. User frames are
+// shared copy-on-write (see fork_memory.c) rather than copied, so fork() costs
+// one page-table walk and the fork+exec pattern never touches the data pages.
+// Shared frames are refcounted, so process_free_user_memory() in either
+// process only drops its own reference.
 static int clone_user_address_space(process_t *parent, process_t *child) {
     if (!parent || !child) return -EINVAL;
 
@@ -65,81 +66,13 @@ static int clone_user_address_space(process_t *parent, process_t *child) {
     com_write_hex64(COM1_PORT, child_cr3);
     com_write_string(COM1_PORT, "\n");
 
-    uint64_t *child_pml4 = (uint64_t *)phys_to_virt_kernel(child_cr3 & ~0xFFFULL);
-    if (!child_pml4) return -ENOMEM;
-
-    // Scratch VA used to temporarily map the new child physical page so we
-    // can copy into it while still running on the parent's CR3.
-    uint64_t scratch = paging_get_scratch_base();
-
-    /* Resolve the current process PML4 and the kernel PML4 once for the loop. */
-    uint64_t *kernel_pml4 = paging_get_pml4();
-    uint64_t *cur_pml4 = NULL;
-    unsigned  scratch_i4 = scratch ? ((scratch >> 39) & 0x1FF) : 0;
-    if (scratch && kernel_pml4) {
-        uint64_t cr3_phys;
-        __asm__ volatile("mov %%cr3, %0" : "=r"(cr3_phys));
-        cr3_phys &= 0xFFFFFFFFFFFFF000ULL;
-        uint64_t *p = (uint64_t *)phys_to_virt_kernel(cr3_phys);
-        if (p != kernel_pml4) cur_pml4 = p;
-    }
+    // MAP_SHARED pages must exist before the copy or each side would fault in its own.
+    if (vma_populate_shared(parent) != 0) return -ENOMEM;
 
-    struct range { uint64_t a, b; } ranges[4];
-    int rn = 0;
-
-    if (parent->user_image_base && parent->user_image_end > parent->user_image_base)
-        ranges[rn++] = (struct range){ parent->user_image_base, parent->user_image_end };
-    if (parent->user_heap_base && parent->user_heap_end > parent->user_heap_base)
-        ranges[rn++] = (struct range){ parent->user_heap_base, parent->user_heap_end };
-    if (parent->user_mmap_base && parent->user_mmap_end > parent->user_mmap_base)
-        ranges[rn++] = (struct range){ parent->user_mmap_base, parent->user_mmap_end };
-    if (parent->user_stack_low && parent->user_stack_top > parent->user_stack_low) {
-        ranges[rn++] = (struct range){ parent->user_stack_low, parent->user_stack_top };
-        com_write_string(COM1_PORT, "[FORK] Copying stack range 0x");
-        com_write_hex64(COM1_PORT, parent->user_stack_low);
-        com_write_string(COM1_PORT, " - 0x");
-        com_write_hex64(COM1_PORT, parent->user_stack_top);
-        com_write_string(COM1_PORT, "\n");
-    }
-
-    for (int i = 0; i < rn; i++) {
-        uint64_t start = ranges[i].a & ~0xFFFULL;
-        uint64_t end   = (ranges[i].b + 0xFFFULL) & ~0xFFFULL;
-        for (uint64_t v = start; v < end; v += 0x1000ULL) {
-            uint64_t parent_phys = paging_virt_to_phys(v);
-            if (!parent_phys) {
-                com_write_string(COM1_PORT, "[FORK] Skipping unmapped page at 0x");
-                com_write_hex64(COM1_PORT, v);
-                com_write_string(COM1_PORT, "\n");
-                continue;
-            }
-            uint64_t pte = paging_get_pte(v);
-            if (!(pte & PFLAG_USER)) continue;
-
-            // Allocate a fresh physical page for the child.
-            uint64_t child_phys = phys_alloc_frame();
-            if (!child_phys) return -ENOMEM;
-
-            // Map scratch VA → child_phys in the kernel PML4, then propagate the
-            // PML4 slot into the current process CR3 before dereferencing scratch.
-            paging_map_page(scratch, child_phys, PFLAG_PRESENT | PFLAG_WRITABLE);
-            if (cur_pml4 && kernel_pml4)
-                cur_pml4[scratch_i4] = kernel_pml4[scratch_i4];
-
-            // Copy parent page content (virtual address v is readable from here).
-            memcpy((void *)(uintptr_t)scratch, (void *)(uintptr_t)v, 4096);
-
-            // Unmap scratch to avoid stale TLB entries.
-            paging_unmap_page(scratch);
-
-            // Map child_phys into child's address space with the same flags.
-            uint64_t flags = (pte & 0xFFFULL) | PFLAG_PRESENT | PFLAG_USER | PFLAG_WRITABLE;
-            if (paging_map_range_to_pml4(child_pml4, v, child_phys, 4096, flags) != 0) {
-                phys_free_frame(child_phys);
-                return -ENOMEM;
-            }
-        }
-    }
+    uint64_t parent_cr3 = parent->page_table ? parent->page_table : parent->cr3;
+    if (copy_user_memory(parent_cr3, child_cr3) != 0) return -ENOMEM;
+    // Pages not yet faulted in stay demand-paged in the child as well.
+    if (vma_dup(child, parent) != 0) return -ENOMEM;
 
     com_write_string(COM1_PORT, "[FORK] Setting child CR3=0x");
     com_write_hex64(COM1_PORT, child_cr3);
@@ -205,9 +138,12 @@ int sys_fork_impl(void) {
     child->envp = dup_strv(parent->envp, parent->envc);
     if (parent->envc && !child->envp) { process_free(child); return -ENOMEM; }
 
-    // Copy FPU state (process_alloc() already allocated fpu_state)
-    if (parent->fpu_state && child->fpu_state)
-        memcpy(child->fpu_state, parent->fpu_state, 512);
+    // Copy FPU state (process_alloc() already allocated fpu_state). The
+    // parent's live registers may still be on this CPU; write them back first.
+    if (parent->fpu_state && child->fpu_state) {
+        fpu_lazy_sync(parent);
+        memcpy(child->fpu_state, parent->fpu_state, fpu_state_size());
+    }
 
     // Kernel stack: copy parent's stack byte-for-byte so the saved frames
     // and on-stack variables are valid in the child's context.
@@ -219,7 +155,8 @@ int sys_fork_impl(void) {
     uint64_t parent_stack_base = (uint64_t)(uintptr_t)parent->kernel_stack;
     uint64_t child_stack_base  = (uint64_t)(uintptr_t)child->kernel_stack;
 
-    uint64_t parent_rbp = g_syscall_entry_rbp;
+    /* Both syscall entry stubs record their frame base in this CPU's cpu_local_t. */
+    uint64_t parent_rbp = cpu_local_get()->syscall_frame;
     if (!parent_rbp ||
         parent_rbp < parent_stack_base ||
         parent_rbp >= parent_stack_base + KERNEL_STACK_SIZE) {
@@ -249,7 +186,6 @@ int sys_fork_impl(void) {
     com_write_string(COM1_PORT, " RSP=0x");
     com_write_hex64(COM1_PORT, child->context.rsp);
     com_write_string(COM1_PORT, " current=0x");
-    extern volatile process_t *current;
     com_write_hex64(COM1_PORT, (uint64_t)current);
     com_write_string(COM1_PORT, "\n");
 
@@ -15,6 +15,7 @@
 #include "moduos/kernel/memory/memory.h"
 #include "moduos/kernel/memory/paging.h"
 #include "moduos/kernel/memory/phys.h"
+#include "moduos/kernel/memory/vma.h"
 #include "moduos/kernel/interrupts/idt.h"
 #include "moduos/drivers/graphics/VGA.h"
 #include "moduos/kernel/COM/com.h"
@@ -24,6 +25,8 @@
 #include "moduos/kernel/md64api_user.h"
 #include "moduos/kernel/md64api_pidinfo_user.h"
 #include "moduos/kernel/process/proclist_user.h"
+#include "moduos/kernel/percpu_heap.h"
+#include "moduos/kernel/smp.h"
 #include "moduos/fs/fs.h"
 #include "moduos/fs/fd.h"
 #include "moduos/fs/path.h"
@@ -38,7 +41,7 @@
 /* Forward declarations */
 uint64_t sys_signal(int sig, uint64_t handler);
 int sys_raise(int sig);
-int sys_fd_inject(uint32_t pid, int fd, void *arg);
+int sys_fd_inject(uint32_t pid, int fd, int src_fd);
 
 /* Helper: Copy string from userspace to kernel buffer */
 static int copy_string_from_user(const char *user_str, char *kernel_buf, size_t max_len) {
@@ -64,13 +67,13 @@ extern void syscall_entry(void);
 
 volatile uint64_t g_last_syscall_num = 0;
 volatile uint64_t g_last_syscall_args[5] = {0,0,0,0,0};
-volatile uint64_t g_syscall_entry_rbp = 0;
 
 static int sys_vfs_mkfs(const vfs_mkfs_req_t *user_req);
 static int sys_vfs_getpart(const vfs_part_req_t *user_req, vfs_part_info_t *user_out);
 static int sys_vfs_mbrinit(const vfs_mbrinit_req_t *user_req);
 static int sys_pidinfo(uint32_t pid, md64api_pid_info_u *out, size_t out_size);
 static int sys_proclist(md_proclist_entry_u *out, size_t out_bytes);
+static int sys_heapstats(md_heapstats_cpu_u *out, size_t out_bytes);
 static int sys_mount(int vdrive_id, uint32_t partition_lba, int fs_type);
 static int sys_unmount(int slot);
 static int sys_mounts(char *user_buf, size_t buflen);
@@ -89,8 +92,22 @@ void syscall_init(void) {
 /* Forward declaration — defined in signals_new.c */
 extern void check_signals(void);
 
+static uint64_t syscall_dispatch(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
+                                 uint64_t arg3, uint64_t arg4, uint64_t arg5);
+
+/* Syscalls run under the big kernel lock (see smp.h): the handlers below were
+ * written for a single CPU. exit/execve leave through schedule() or
+ * amd64_enter_user_now() instead of returning here and drop the lock there. */
 uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
                          uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    bkl_lock();
+    uint64_t ret = syscall_dispatch(syscall_num, arg1, arg2, arg3, arg4, arg5);
+    bkl_unlock();
+    return ret;
+}
+
+static uint64_t syscall_dispatch(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
+                                 uint64_t arg3, uint64_t arg4, uint64_t arg5) {
     g_last_syscall_num = syscall_num;
     g_last_syscall_args[0] = arg1;
     g_last_syscall_args[1] = arg2;
@@ -100,7 +117,6 @@ uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
     
     // DEBUG: Check PID 2 before each syscall from PID 4
     extern process_t *process_get_by_pid(uint32_t);
-    extern volatile process_t *current;
     if (current && current->pid == 4) {
         process_t *pid2 = process_get_by_pid(2);
         if (pid2 && pid2->page_table == 0) {
@@ -147,13 +163,13 @@ uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
             return 0;
         }
 
-        case SYS_SLEEP:   return sys_sleep((unsigned int)arg1);
+        case SYS_SLEEP:   return sys_sleep((unsigned int)arg1, (unsigned int)arg2);
         case SYS_YIELD:   sys_yield(); return 0;
         case SYS_SBRK:    return (uint64_t)sys_sbrk((intptr_t)arg1);
         case SYS_KILL:    return sys_kill((int)arg1, (int)arg2);
         case SYS_SIGNAL:  return sys_signal((int)arg1, (uint64_t)arg2);
         case SYS_RAISE:   return sys_raise((int)arg1);
-        case SYS_FD_INJECT: return sys_fd_inject((uint32_t)arg1, (int)arg2, (void*)arg3);
+        case SYS_FD_INJECT: return sys_fd_inject((uint32_t)arg1, (int)arg2, (int)arg3);
         case SYS_TIME:    return sys_time();
         case SYS_EXEC:    return sys_exec((const char*)arg1);
         case SYS_EXECVE:  
@@ -176,6 +192,8 @@ uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
             return (uint64_t)sys_mmap((void*)arg1, (size_t)arg2, (int)arg3, (int)arg4);
         case SYS_MUNMAP:
             return (uint64_t)sys_munmap((void*)arg1, (size_t)arg2);
+        case SYS_MPROTECT:
+            return (uint64_t)sys_mprotect((void*)arg1, (size_t)arg2, (int)arg3);
 
         case SYS_VFS_MKFS:
             return (uint64_t)sys_vfs_mkfs((const vfs_mkfs_req_t*)arg1);
@@ -189,6 +207,8 @@ uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
             return (uint64_t)sys_proclist((md_proclist_entry_u*)arg1, (size_t)arg2);
         case SYS_PIDINFO:
             return (uint64_t)sys_pidinfo((uint32_t)arg1, (md64api_pid_info_u*)arg2, (size_t)arg3);
+        case SYS_HEAPSTATS:
+            return (uint64_t)sys_heapstats((md_heapstats_cpu_u*)arg1, (size_t)arg2);
         case SYS_MOUNT:
             return (uint64_t)sys_mount((int)arg1, (uint32_t)arg2, (int)arg3);
         case SYS_UNMOUNT:
@@ -206,6 +226,9 @@ uint64_t syscall_handler(uint64_t syscall_num, uint64_t arg1, uint64_t arg2,
             return (uint64_t)fd_dup2((int)arg1, (int)arg2);
         }
 
+        case SYS_FCNTL:
+            return (uint64_t)(int64_t)fd_fcntl((int)arg1, (int)arg2, (long)arg3);
+
         case SYS_PIPE: {
             extern int fd_pipe(int[2]);
             int k_fds[2] = {-1, -1};
@@ -351,7 +374,8 @@ static void safe_strcpy(char *dst, size_t dst_sz, const char *src) {
 ssize_t sys_writefile(int fd, const char *user_buf, size_t count) {
     if (!user_buf) return -1;
 
-    // Write to console: still copy from user, but chunk it.
+    // Everything (console, pipes, files) goes through fd_write() so a dup2()'d
+    // stdout follows the redirection.
     // Write to files: MUST use kmalloc() buffer (DMA-safe) and chunked copyin.
     const size_t CHUNK = 4096;
     char *kbuf = (char*)kmalloc(CHUNK);
@@ -367,16 +391,11 @@ ssize_t sys_writefile(int fd, const char *user_buf, size_t count) {
             return -1;
         }
 
-        if (fd == STDOUT_FILENO || fd == STDERR_FILENO) {
-            VGA_WriteN(kbuf, n);
-            total += n;
-            continue;
-        }
-
         ssize_t wr = fd_write(fd, kbuf, n);
         if (wr < 0) {
             kfree(kbuf);
-            return wr;
+            /* A pipe that filled then broke still reports what got through. */
+            return total ? (ssize_t)total : wr;
         }
         if ((size_t)wr == 0) break;
         total += (size_t)wr;
@@ -517,9 +536,11 @@ int sys_getppid(void) {
     return proc ? (int)proc->parent_pid : -1;
 }
 
-int sys_sleep(unsigned int seconds) {
-    process_sleep(seconds * 1000);
-    return 0;
+/* sleep(seconds, milliseconds): the two are added, so sleep(3) callers that
+ * leave arg2 zero keep working. Returns -EINTR if a signal cut it short. */
+int sys_sleep(unsigned int seconds, unsigned int ms) {
+    uint64_t total_ms = (uint64_t)seconds * 1000ULL + ms;
+    return sleep_ms(total_ms) == 0 ? 0 : -EINTR;
 }
 
 void sys_yield(void) {
@@ -571,41 +592,56 @@ void* sys_sbrk(intptr_t increment) {
     return (void*)(uintptr_t)old;
 }
 
-/* VM mapping (MVP). prot: bit0=R bit1=W bit2=X (X currently ignored)
- * flags: bit0=FIXED, bit1=ANON (only anon supported)
+/* Anonymous memory mappings (MAP_* / PROT_* in syscall_numbers.h). mmap only
+ * records a VMA; pages are zero-filled on first touch by the page-fault
+ * handler, so large mappings don't need contiguous physical memory.
+ * Mappings of 2 MiB or more are placed 2 MiB aligned so the fault handler can
+ * back them with huge pages. PROT_EXEC is accepted but not enforced (no NX).
  */
+static uint32_t mmap_vma_flags(int prot, int flags) {
+    uint32_t f = 0;
+    if (prot & PROT_READ)  f |= VMA_READ;
+    if (prot & PROT_WRITE) f |= VMA_WRITE;
+    if (prot & PROT_EXEC)  f |= VMA_EXEC;
+    if (flags & MAP_SHARED) f |= VMA_SHARED;
+    return f;
+}
+
+/* Drop the pages and VMAs of [start, end). */
+static int mmap_release(process_t *p, uint64_t start, uint64_t end) {
+    vma_unmap_pages(p, start, end);
+    return vma_remove_range(p, start, end);
+}
+
 void* sys_mmap(void *addr, size_t size, int prot, int flags) {
-    (void)flags;
     process_t *p = process_get_current();
     if (!p || !p->is_user) return (void*)-1;
     if (size == 0) return (void*)-1;
+    if ((flags & MAP_SHARED) && (flags & MAP_PRIVATE)) return (void*)-1;
 
     uint64_t sz = ((uint64_t)size + 0xFFFULL) & ~0xFFFULL;
+    if (sz < (uint64_t)size) return (void*)-1;
 
     uint64_t v = (uint64_t)(uintptr_t)addr;
-    int fixed = (flags & 1) != 0;
+    int fixed = (flags & MAP_FIXED) != 0;
 
     if (fixed) {
         if (v == 0 || (v & 0xFFFULL)) return (void*)-1;
+        if (v + sz < v || v + sz > 0x0000800000000000ULL) return (void*)-1;
+        /* MAP_FIXED replaces whatever was mapped there before. */
+        if (mmap_release(p, v, v + sz) != 0) return (void*)-1;
     } else {
-        v = (p->user_mmap_end + 0xFFFULL) & ~0xFFFULL;
-        if (v < p->user_mmap_base) v = p->user_mmap_base;
-        if (v + sz > p->user_mmap_limit) return (void*)-1;
-    }
-
-    size_t pages = (size_t)(sz / 0x1000ULL);
-    uint64_t phys = phys_alloc_contiguous(pages);
-    if (!phys) return (void*)-1;
-
-    uint64_t pflags = PFLAG_PRESENT | PFLAG_USER;
-    if (prot & 2) pflags |= PFLAG_WRITABLE;
-
-    if (paging_map_range(v, phys, sz, pflags) != 0) {
-        for (size_t i = 0; i < pages; i++) phys_free_frame(phys + (uint64_t)i * 0x1000ULL);
-        return (void*)-1;
+        /* Honour a hint inside the mmap window if that hole is free, else first fit. */
+        uint64_t align = (sz >= PAGING_2M_SIZE) ? PAGING_2M_SIZE : 0x1000ULL;
+        uint64_t hint = v;
+        v = 0;
+        if (hint && !(hint & 0xFFFULL) && hint >= p->user_mmap_base && hint < p->user_mmap_limit)
+            v = vma_find_gap(p, hint, p->user_mmap_limit, sz, 0x1000ULL);
+        if (v != hint) v = vma_find_gap(p, p->user_mmap_base, p->user_mmap_limit, sz, align);
+        if (!v) return (void*)-1;
     }
 
-    memset((void*)(uintptr_t)v, 0, (size_t)sz);
+    if (vma_add_anon(p, v, v + sz, mmap_vma_flags(prot, flags)) != 0) return (void*)-1;
 
     if (!fixed) {
         if (v + sz > p->user_mmap_end) p->user_mmap_end = v + sz;
@@ -624,16 +660,24 @@ int sys_munmap(void *addr, size_t size) {
 
     uint64_t sz = ((uint64_t)size + 0xFFFULL) & ~0xFFFULL;
     uint64_t end = v + sz;
+    if (end < v || end > 0x0000800000000000ULL) return -1;
 
-    for (uint64_t cur = v; cur < end; cur += 0x1000ULL) {
-        uint64_t phys = paging_virt_to_phys(cur);
-        if (phys != 0) {
-            paging_unmap_page(cur);
-            phys_free_frame(phys & ~0xFFFULL);
-        }
-    }
+    return mmap_release(p, v, end) == 0 ? 0 : -1;
+}
 
-    return 0;
+int sys_mprotect(void *addr, size_t size, int prot) {
+    process_t *p = process_get_current();
+    if (!p || !p->is_user) return -EINVAL;
+
+    uint64_t v = (uint64_t)(uintptr_t)addr;
+    if (v & 0xFFFULL) return -EINVAL;
+    if (size == 0) return 0;
+
+    uint64_t sz = ((uint64_t)size + 0xFFFULL) & ~0xFFFULL;
+    if (v + sz < v || v + sz > 0x0000800000000000ULL) return -ENOMEM;
+
+    /* Only VMA-backed memory (mmap and ELF segments) can change protection. */
+    return vma_protect(p, v, v + sz, mmap_vma_flags(prot, 0)) == 0 ? 0 : -ENOMEM;
 }
 
 int sys_kill(int pid, int sig) {
@@ -1231,12 +1275,18 @@ int sys_raise(int sig) {
     return sys_kill((int)p->pid, sig);
 }
 
-// FD injection syscall (for privileged processes like TTY manager)
+// FD injection syscall (for privileged processes like TTY manager).
+// Shares the caller's descriptor src_fd with process pid as slot fd; userland
+// never handles kernel object pointers.
 extern int process_inject_fd(uint32_t pid, int fd, void *fd_obj);
 
-int sys_fd_inject(uint32_t pid, int fd, void *fd_obj) {
+int sys_fd_inject(uint32_t pid, int fd, int src_fd) {
     // TODO: Add permission check - only allow root or TTY manager
-    return process_inject_fd(pid, fd, fd_obj);
+    open_file_t *f = fd_file_get(0, src_fd);
+    if (!f) return -1;
+    int rc = process_inject_fd(pid, fd, f);
+    fd_file_put(f);
+    return rc;
 }
 
 int sys_userfs_register(const userfs_user_node_t *user_node) {
@@ -1313,6 +1363,23 @@ static int sys_proclist(md_proclist_entry_u *out, size_t out_bytes) {
     return (int)count;
 }
 
+static int sys_heapstats(md_heapstats_cpu_u *out, size_t out_bytes) {
+    if (!out || out_bytes < sizeof(md_heapstats_cpu_u)) return -EINVAL;
+
+    size_t max_entries = out_bytes / sizeof(md_heapstats_cpu_u);
+    uint32_t ncpu = smp_cpu_count();
+    if (ncpu > MAX_CPUS) ncpu = MAX_CPUS;
+
+    int count = 0;
+    for (uint32_t c = 0; c < ncpu && (size_t)count < max_entries; c++) {
+        md_heapstats_cpu_u e;
+        if (percpu_heap_get_stats((int)c, &e) != 0) continue;
+        if (usercopy_to_user(&out[count], &e, sizeof(e)) != 0) return -EFAULT;
+        count++;
+    }
+    return count;
+}
+
 static int sys_pidinfo(uint32_t pid, md64api_pid_info_u *out, size_t out_size) {
     if (!out || out_size < sizeof(md64api_pid_info_u)) return -1;
     if (pid >= MAX_PROCESSES) return -1;
@@ -144,6 +144,9 @@ static inline void *mm_mmap(void *addr, size_t size, int prot, int flags) {
 static inline int mm_munmap(void *addr, size_t size) {
     return (int)syscall(SYS_MUNMAP, (long)addr, (long)size, 0);
 }
+static inline int mm_mprotect(void *addr, size_t size, int prot) {
+    return (int)syscall(SYS_MPROTECT, (long)addr, (long)size, (long)prot);
+}
 
 static u64 align_down(u64 v) { return v & ~0xFFFULL; }
 static u64 align_up(u64 v) { return (v + 0xFFFULL) & ~0xFFFULL; }
@@ -198,10 +201,11 @@ static int map_load_segments(const void *file, u64 base, u64 *out_entry, u64 *ou
         u64 seg_end = align_up(seg_vaddr + ph[i].p_memsz);
         size_t map_sz = (size_t)(seg_end - seg_start);
 
-        int prot = 1; // R
-        if (ph[i].p_flags & PF_W) prot |= 2; // W
+        int prot = PROT_READ;
+        if (ph[i].p_flags & PF_W) prot |= PROT_WRITE;
 
-        void *m = mm_mmap((void*)(uintptr_t)seg_start, map_sz, prot, 1 /*FIXED*/ | 2 /*ANON*/);
+        /* Map writable for the copy, then drop to the segment's protection. */
+        void *m = mm_mmap((void*)(uintptr_t)seg_start, map_sz, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE);
         if ((long)m == -1) {
             printf("ld-moduos: mmap failed for segment\n");
             return -1;
@@ -210,6 +214,7 @@ static int map_load_segments(const void *file, u64 base, u64 *out_entry, u64 *ou
         if (ph[i].p_filesz) {
             memcpy((void*)(uintptr_t)seg_vaddr, (const u8*)file + ph[i].p_offset, (size_t)ph[i].p_filesz);
         }
+        if (!(prot & PROT_WRITE)) (void)mm_mprotect(m, map_sz, prot);
     }
 
     *out_entry = base + eh->e_entry;
@@ -325,7 +330,7 @@ static int obj_load(const char *path, so_obj_t **out_obj) {
     /* Choose base for ET_DYN */
     if (eh->e_type == ET_DYN) {
         /* reserve some range and use it as a base */
-        void *tmp = mm_mmap(NULL, 0x400000, 3, 2 /*ANON*/);
+        void *tmp = mm_mmap(NULL, 0x400000, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE);
         if ((long)tmp == -1) { free(file); return -1; }
         o->base = (u64)(uintptr_t)tmp;
         mm_munmap(tmp, 0x400000);
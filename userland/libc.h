@@ -287,6 +287,13 @@ static inline int get_process_list(md_proclist_entry_u *out, size_t out_count) {
     return (int)syscall(SYS_PROCLIST, (long)out, (long)(out_count * sizeof(*out)), 0);
 }
 
+#include "../include/moduos/kernel/memory/heapstats_user.h"
+
+/* Per-CPU kmalloc magazine counters; returns number of entries filled. */
+static inline int get_heap_stats(md_heapstats_cpu_u *out, size_t out_count) {
+    return (int)syscall(SYS_HEAPSTATS, (long)out, (long)(out_count * sizeof(*out)), 0);
+}
+
 #include "../include/moduos/kernel/md64api_pidinfo_user.h"
 
 static inline int md64api_get_pid_info(uint32_t pid, md64api_pid_info_u *out) {
@@ -1097,6 +1104,18 @@ static inline int pipe(int fds[2]) {
     return (int)syscall(SYS_PIPE, (long)fds, 0, 0);
 }
 
+#define F_DUPFD       0
+#define F_GETFD       1
+#define F_SETFD       2
+#define F_GETFL       3
+#define F_SETFL       4
+#define F_SETPIPE_SZ  1031
+#define F_GETPIPE_SZ  1032
+
+static inline int fcntl(int fd, int cmd, long arg) {
+    return (int)syscall(SYS_FCNTL, (long)fd, (long)cmd, arg);
+}
+
 static inline int geteuid(void) {
     return (int)syscall(SYS_GETEUID, 0, 0, 0);
 }
@@ -1159,6 +1178,16 @@ static inline void sleep(unsigned int sec) {
     syscall(SYS_SLEEP, sec, 0, 0);
 }
 
+/* Millisecond sleep; returns 0, or -EINTR if a signal woke the caller early. */
+static inline int msleep(unsigned int ms) {
+    return (int)syscall(SYS_SLEEP, ms / 1000u, ms % 1000u, 0);
+}
+
+/* Sleeps are tick-granular (1 ms); round up so the caller never wakes early. */
+static inline int usleep(unsigned int usec) {
+    return msleep((usec + 999u) / 1000u);
+}
+
 static inline int kill(int pid, int sig) {
     return (int)syscall(SYS_KILL, pid, sig, 0);
 }
@@ -1176,9 +1205,9 @@ static inline int raise(int sig) {
     return (int)syscall(SYS_RAISE, (long)sig, 0, 0);
 }
 
-// File descriptor injection (for TTY manager)
-static inline int fd_inject(int pid, int fd, void *fd_obj) {
-    return (int)syscall(SYS_FD_INJECT, (long)pid, (long)fd, (long)fd_obj);
+// File descriptor injection (for TTY manager): make our src_fd appear as fd in pid
+static inline int fd_inject(int pid, int fd, int src_fd) {
+    return (int)syscall(SYS_FD_INJECT, (long)pid, (long)fd, (long)src_fd);
 }
 
 // Directory operations
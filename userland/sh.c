@@ -20,6 +20,109 @@ void parse_command(char* input, char* command, char* args) {
     *args = '\0';
 }
 
+/* Build the full path to the executable. Search order:
+ *   1. Absolute path (starts with '/' or '$/')
+ *   2. /Apps/<command>.sqr
+ *   3. /ModuOS/System64/<command>.sqr
+ * Returns 0 and fills path on success, -1 if not found.
+ */
+static int resolve_command(const char *command, char *path, size_t path_sz) {
+    if (command[0] == '/' || (command[0] == '$' && command[1] == '/')) {
+        strncpy(path, command, path_sz - 1);
+        path[path_sz - 1] = '\0';
+        return 0;
+    }
+
+    /* Try /Apps first */
+    snprintf(path, path_sz, "/Apps/%s.sqr", command);
+    int probe = open(path, 0, 0);
+    if (probe < 0) {
+        /* Try system directory */
+        snprintf(path, path_sz, "/ModuOS/System64/%s.sqr", command);
+        probe = open(path, 0, 0);
+        if (probe < 0) {
+            path[0] = '\0';
+            return -1;
+        }
+    }
+    close(probe);
+    return 0;
+}
+
+/* Split line into argv in place. Returns argc. */
+static int split_args(char *line, char **argv_out, int max) {
+    int n = 0;
+    char *tok = line;
+    while (*tok && n < max - 1) {
+        while (*tok == ' ' || *tok == '\t') tok++;
+        if (!*tok) break;
+        argv_out[n++] = tok;
+        while (*tok && *tok != ' ' && *tok != '\t') tok++;
+        if (*tok) { *tok = '\0'; tok++; }
+    }
+    argv_out[n] = NULL;
+    return n;
+}
+
+/* "a | b": run both commands with a's stdout connected to b's stdin. */
+static void run_pipeline(const char *line) {
+    static char buf[256];
+    static char paths[2][256];
+    char *stage_argv[2][32];
+
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char *bar = strchr(buf, '|');
+    *bar = '\0';
+    char *stages[2] = { buf, bar + 1 };
+
+    for (int i = 0; i < 2; i++) {
+        if (split_args(stages[i], stage_argv[i], 32) == 0) {
+            printf("syntax error near '|'\n");
+            return;
+        }
+        if (resolve_command(stage_argv[i][0], paths[i], sizeof(paths[i])) != 0) {
+            printf("%s: command not found\n", stage_argv[i][0]);
+            return;
+        }
+        stage_argv[i][0] = paths[i];
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("pipe failed\n");
+        return;
+    }
+
+    int pids[2] = { -1, -1 };
+    for (int i = 0; i < 2; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            /* child: writer gets the pipe as stdout, reader as stdin */
+            if (i == 0) dup2(fds[1], 1);
+            else dup2(fds[0], 0);
+            close(fds[0]);
+            close(fds[1]);
+            execve(paths[i], stage_argv[i], NULL);
+            printf("%s: exec failed\n", paths[i]);
+            exit(1);
+        } else if (pids[i] < 0) {
+            printf("fork failed\n");
+        }
+    }
+
+    /* Drop our ends so the reader sees EOF once the writer exits. */
+    close(fds[0]);
+    close(fds[1]);
+
+    for (int i = 0; i < 2; i++) {
+        if (pids[i] > 0) {
+            int status = 0;
+            waitpid(pids[i], &status, 0);
+        }
+    }
+}
+
 int md_main(long argc, char** argv) {
     while (sh_running) {
         yield();
@@ -27,6 +130,11 @@ int md_main(long argc, char** argv) {
 
         char* user_input = input();
 
+        if (strchr(user_input, '|')) {
+            run_pipeline(user_input);
+            continue;
+        }
+
         char command[64] = {0};
         char args[192] = {0};
         parse_command(user_input, command, args);
@@ -38,6 +146,7 @@ int md_main(long argc, char** argv) {
             printf("  whoami      - Show current user\n");
             printf("  ls          - List files (run existing ls program)\n");
             printf("  cat <file>  - Display file contents (run existing cat program)\n");
+            printf("  a | b       - Pipe the output of a into b\n");
             printf("  mounts      - List mounted filesystems\n");
             printf("  mount <vdrive> <lba> <type> - Mount filesystem\n");
             printf("  unmount <slot> - Unmount filesystem\n");
@@ -84,49 +193,20 @@ int md_main(long argc, char** argv) {
         } else if (strlen(command) == 0) {
             /* empty input */
         } else {
-            /* Build the full path to the executable. Search order:
-             *   1. Absolute path (starts with '/' or '$/')
-             *   2. /Apps/<command>.sqr
-             *   3. /ModuOS/System64/<command>.sqr
-             */
             char path[256] = {0};
-
-            if (command[0] == '/' || (command[0] == '$' && command[1] == '/')) {
-                strncpy(path, command, sizeof(path) - 1);
-            } else {
-                /* Try /Apps first */
-                snprintf(path, sizeof(path), "/Apps/%s.sqr", command);
-                int probe = open(path, 0, 0);
-                if (probe < 0) {
-                    /* Try system directory */
-                    snprintf(path, sizeof(path), "/ModuOS/System64/%s.sqr", command);
-                    probe = open(path, 0, 0);
-                    if (probe < 0) {
-                        printf("%s: command not found\n", command);
-                        path[0] = '\0';
-                    }
-                }
-                if (probe >= 0) close(probe);
+            if (resolve_command(command, path, sizeof(path)) != 0) {
+                printf("%s: command not found\n", command);
             }
 
             if (path[0]) {
                 /* Build argv for the child: argv[0]=path, then split args */
                 char *child_argv[64];
-                int child_argc = 0;
-                child_argv[child_argc++] = path;
+                child_argv[0] = path;
 
                 /* Tokenize args in-place */
                 static char args_copy[192];
                 strncpy(args_copy, args, sizeof(args_copy) - 1);
-                char *tok = args_copy;
-                while (*tok && child_argc < 63) {
-                    while (*tok == ' ' || *tok == '\t') tok++;
-                    if (!*tok) break;
-                    child_argv[child_argc++] = tok;
-                    while (*tok && *tok != ' ' && *tok != '\t') tok++;
-                    if (*tok) { *tok = '\0'; tok++; }
-                }
-                child_argv[child_argc] = NULL;
+                split_args(args_copy, child_argv + 1, 63);
 
                 int pid = fork();
                 if (pid == 0) {